@@ -1,11 +1,10 @@
 TEMPLATE = app
 TARGET = g-timetracker
 
-QT += qml quick sql
+QT += qml quick sql network
 
 !android {
     QT += widgets
-    QT += network
 }
 
 SOURCES += \
@@ -22,6 +22,7 @@
 #include <QtQml>
 #include <QtQml/QQmlContext>
 #include <QPointer>
+#include <QTextStream>
 
 #ifndef Q_OS_ANDROID
 # include <QFontDatabase>
@@ -35,16 +36,22 @@
 
 #include "FileLogger.h"
 #include "TimeLogHistory.h"
+#include "TimeLogClock.h"
 #include "TimeLogRecentModel.h"
 #include "TimeLogSearchModel.h"
 #include "ReverseProxyModel.h"
 #include "TimeLogCategoryTreeModel.h"
 #include "TimeLogCategoryDepthModel.h"
+#include "TimeLogCategoryCompleterModel.h"
+#include "TimeLogStatsModel.h"
 #include "TimeTracker.h"
 #include "TimeLogCategoryTreeNode.h"
 #include "DataImporter.h"
 #include "DataExporter.h"
+#include "DataReporter.h"
 #include "DataSyncer.h"
+#include "TimeLogTrace.h"
+#include "TimeLogDiagnostics.h"
 #include "Notifier.h"
 #ifndef Q_OS_ANDROID
 # include "Updater.h"
@@ -54,6 +61,7 @@
 Q_LOGGING_CATEGORY(MAIN_CATEGORY, "main", QtInfoMsg)
 
 QPointer<Notifier> mainNotifier;
+TimeLogConnectionProfile mainConnectionProfile;
 
 #ifndef Q_OS_ANDROID
 void loadFont(const QString &path)
@@ -77,20 +85,57 @@ static QObject *timeTrackerSingletonTypeProvider(QQmlEngine *engine, QJSEngine *
     Q_UNUSED(scriptEngine)
 
     TimeTracker *timetracker = new TimeTracker();
+    timetracker->setConnectionProfile(mainConnectionProfile);
     QObject::connect(mainNotifier, SIGNAL(activateRequested()),
                      timetracker, SIGNAL(activateRequested()));
 
     return timetracker;
 }
 
-int main(int argc, char *argv[])
+static QObject *timeLogClockSingletonTypeProvider(QQmlEngine *engine, QJSEngine *scriptEngine)
+{
+    Q_UNUSED(engine)
+    Q_UNUSED(scriptEngine)
+
+    // Shared with the models, so the engine should not take it
+    TimeLogClock *clock = TimeLogClock::instance();
+    QQmlEngine::setObjectOwnership(clock, QQmlEngine::CppOwnership);
+
+    return clock;
+}
+
+// Reports are run from cron on servers without display, so no GUI application is created for them
+static bool isReportCommand(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        const QByteArray arg(argv[i]);
+        if (arg == "--stats" || arg.startsWith("--stats=")
+            || arg == "--history" || arg.startsWith("--history=")) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static QCoreApplication *createApplication(int &argc, char *argv[])
 {
+    if (isReportCommand(argc, argv)) {
+        return new QCoreApplication(argc, argv);
+    }
+
     QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
 #ifndef Q_OS_ANDROID
-    QtSingleApplication app(argc, argv);
+    return new QtSingleApplication(argc, argv);
 #else
-    QGuiApplication app(argc, argv);
+    return new QGuiApplication(argc, argv);
 #endif
+}
+
+int main(int argc, char *argv[])
+{
+    QScopedPointer<QCoreApplication> appPointer(createApplication(argc, argv));
+    QCoreApplication &app = *appPointer;
     app.setOrganizationName("G-TimeTracker");
     app.setOrganizationDomain("g-timetracker.org");
     app.setApplicationName("G-TimeTracker");
@@ -120,33 +165,76 @@ int main(int argc, char *argv[])
     QCommandLineOption exportOption(QStringList() << "e" << "export", "Export to a CSV file(s)",
                                     "target directory");
     parser.addOption(exportOption);
+    QCommandLineOption singleFileOption("singleFile", "Export to a single CSV file instead of the file per day");
+    parser.addOption(singleFileOption);
     QCommandLineOption separatorOption("separator", "Separator for import/export", "string", ";");
     parser.addOption(separatorOption);
     QCommandLineOption dataPathOption("dataPath", "Use specified path to program's data", "path");
     parser.addOption(dataPathOption);
+    QCommandLineOption dbProfileOption("dbProfile", "DB connection profile for the data path, e.g. "
+                                       "\"journal=wal,synchronous=normal,cache=8192,mmap=67108864,temp=memory,readers=2,slowquery=-1\" "
+                                       "or \"compatible\"", "profile");
+    parser.addOption(dbProfileOption);
     QCommandLineOption syncPathOption("syncPath", "Override path to sync folder", "path");
     parser.addOption(syncPathOption);
+    QCommandLineOption traceOption("trace", "Write a trace in the Chrome trace format on exit", "file");
+    parser.addOption(traceOption);
+    QCommandLineOption diagnosticsOption("diagnostics", "Print memory usage and DB stats of the data path");
+    parser.addOption(diagnosticsOption);
+    QCommandLineOption statsOption("stats", "Print stats for the range: all, today, yesterday, week, month, "
+                                   "year, a date or <from>..<to> dates", "range");
+    parser.addOption(statsOption);
+    QCommandLineOption historyOption("history", "Print entries for the range, same as for the stats", "range");
+    parser.addOption(historyOption);
+    QCommandLineOption categoryOption("category", "Limit the report to the category", "name");
+    parser.addOption(categoryOption);
+    QCommandLineOption depthOption("depth", "Depth of the categories in the stats", "depth", "1");
+    parser.addOption(depthOption);
+    QCommandLineOption bucketOption("bucket", "Split the stats by hour, day, week or month", "bucket");
+    parser.addOption(bucketOption);
+    QCommandLineOption formatOption("format", "Format of the report, csv or json", "format", "csv");
+    parser.addOption(formatOption);
     QCommandLineOption multiOption("multi", "Allow start of multiple instances");
     multiOption.setHidden(true);
     parser.addOption(multiOption);
 
     parser.process(app);
 
+    if (parser.isSet(dbProfileOption)) {
+        bool isProfileValid = false;
+        mainConnectionProfile = TimeLogConnectionProfile::fromString(parser.value(dbProfileOption),
+                                                                     &isProfileValid);
+        if (!isProfileValid) {
+            qCCritical(MAIN_CATEGORY) << "Invalid DB profile" << parser.value(dbProfileOption);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (parser.isSet(traceOption)) {
+        QString tracePath = parser.value(traceOption);
+        TimeLogTrace::setEnabled(true);
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [tracePath]() {
+            TimeLogTrace::dump(tracePath);
+        });
+    }
+
     Notifier notifier;
     mainNotifier = &notifier;
 
 #ifndef Q_OS_ANDROID
-    if (!parser.isSet(multiOption)) {
-        if (app.isRunning()) {
+    QtSingleApplication *singleApp = qobject_cast<QtSingleApplication*>(&app);
+    if (singleApp && !parser.isSet(multiOption)) {
+        if (singleApp->isRunning()) {
             qCInfo(MAIN_CATEGORY) << "The application is already running";
-            if (parser.isSet(importOption) || parser.isSet(exportOption)) {
+            if (parser.isSet(importOption)) {
                 return EXIT_FAILURE;
-            } else {
-                app.sendMessage(QString());
+            } else if (!parser.isSet(exportOption) && !parser.isSet(diagnosticsOption)) {
+                singleApp->sendMessage(QString());
                 return EXIT_SUCCESS;
             }
+            // Read-only usage doesn't interfere with the running instance in WAL mode
         } else {
-            QObject::connect(&app, SIGNAL(messageReceived(QString)),
+            QObject::connect(singleApp, SIGNAL(messageReceived(QString)),
                              &notifier, SLOT(requestActivate()));
         }
     }
@@ -156,6 +244,7 @@ int main(int argc, char *argv[])
     qRegisterMetaType<TimeLogEntry>();
     qRegisterMetaType<QVector<TimeLogEntry> >();
     qRegisterMetaType<QVector<TimeLogStats> >();
+    qRegisterMetaType<TimeLogStatsSeries>();
     qRegisterMetaType<QVector<TimeLogSyncDataEntry> >();
     qRegisterMetaType<QVector<TimeLogSyncDataCategory> >();
     qRegisterMetaType<QSet<QString> >();
@@ -167,9 +256,48 @@ int main(int argc, char *argv[])
     qRegisterMetaType<TimeLogCategory>();
     qRegisterMetaType<QVector<TimeLogCategory> >();
 
-    if (parser.isSet(importOption)) {
+    if (parser.isSet(statsOption) || parser.isSet(historyOption)) {
+        const bool isStats = parser.isSet(statsOption);
+        QDateTime begin;
+        QDateTime end;
+        if (!DataReporter::parseRange(parser.value(isStats ? statsOption : historyOption), begin, end)) {
+            qCCritical(MAIN_CATEGORY) << "Invalid range" << parser.value(isStats ? statsOption : historyOption);
+            return EXIT_FAILURE;
+        }
+        bool isDepthValid = false;
+        int depth = parser.value(depthOption).toInt(&isDepthValid);
+        int bucket = -1;
+        if (!isDepthValid || depth < 1) {
+            qCCritical(MAIN_CATEGORY) << "Invalid depth" << parser.value(depthOption);
+            return EXIT_FAILURE;
+        } else if (parser.isSet(bucketOption) && !DataReporter::parseBucket(parser.value(bucketOption), bucket)) {
+            qCCritical(MAIN_CATEGORY) << "Invalid bucket" << parser.value(bucketOption);
+            return EXIT_FAILURE;
+        } else if (parser.value(formatOption) != "csv" && parser.value(formatOption) != "json") {
+            qCCritical(MAIN_CATEGORY) << "Invalid format" << parser.value(formatOption);
+            return EXIT_FAILURE;
+        }
+
         TimeLogHistory history;
-        if (!history.init(parser.value(dataPathOption), QString(), false, true)) {
+        if (!history.init(parser.value(dataPathOption), QString(), true, false, mainConnectionProfile)) {
+            qCCritical(MAIN_CATEGORY) << "Fail to initialize db";
+            return EXIT_FAILURE;
+        }
+
+        DataReporter reporter(&history);
+        reporter.setReport(isStats ? DataReporter::StatsReport : DataReporter::HistoryReport);
+        reporter.setFormat(parser.value(formatOption) == "json" ? DataReporter::JsonFormat
+                                                               : DataReporter::CsvFormat);
+        reporter.setSeparator(parser.value(separatorOption));
+        reporter.setRange(begin, end);
+        reporter.setCategory(parser.value(categoryOption));
+        reporter.setDepth(depth);
+        reporter.setBucket(bucket);
+        reporter.start(QString());
+        return app.exec();
+    } else if (parser.isSet(importOption)) {
+        TimeLogHistory history;
+        if (!history.init(parser.value(dataPathOption), QString(), false, true, mainConnectionProfile)) {
             qCCritical(MAIN_CATEGORY) << "Fail to initialize db";
             return EXIT_FAILURE;
         }
@@ -178,15 +306,32 @@ int main(int argc, char *argv[])
         importer.setSeparator(parser.value(separatorOption));
         importer.start(parser.value(importOption));
         return app.exec();
+    } else if (parser.isSet(diagnosticsOption)) {
+        TimeLogHistory history;
+        if (!history.init(parser.value(dataPathOption), QString(), true, false, mainConnectionProfile)) {
+            qCCritical(MAIN_CATEGORY) << "Fail to initialize db";
+            return EXIT_FAILURE;
+        }
+
+        TimeLogDiagnostics diagnostics;
+        QObject::connect(&diagnostics, &TimeLogDiagnostics::reportAvailable, [&diagnostics](QVariantMap report) {
+            QTextStream(stdout) << diagnostics.reportText(report);
+            QCoreApplication::quit();
+        });
+        diagnostics.requestReport(&history);
+        int result = app.exec();
+        history.deinit();
+        return result;
     } else if (parser.isSet(exportOption)) {
         TimeLogHistory history;
-        if (!history.init(parser.value(dataPathOption), QString(), true)) {
+        if (!history.init(parser.value(dataPathOption), QString(), true, false, mainConnectionProfile)) {
             qCCritical(MAIN_CATEGORY) << "Fail to initialize db";
             return EXIT_FAILURE;
         }
 
         DataExporter exporter(&history);
         exporter.setSeparator(parser.value(separatorOption));
+        exporter.setSingleFile(parser.isSet(singleFileOption));
         exporter.start(parser.value(exportOption));
         return app.exec();
     } else {
@@ -196,12 +341,16 @@ int main(int argc, char *argv[])
 #endif
 
         qmlRegisterSingletonType<TimeTracker>("TimeLog", 1, 0, "TimeTracker", timeTrackerSingletonTypeProvider);
+        qmlRegisterSingletonType<TimeLogClock>("TimeLog", 1, 0, "TimeLogClock", timeLogClockSingletonTypeProvider);
         qmlRegisterType<TimeLogModel>("TimeLog", 1, 0, "TimeLogModel");
         qmlRegisterType<TimeLogRecentModel>("TimeLog", 1, 0, "TimeLogRecentModel");
         qmlRegisterType<TimeLogSearchModel>("TimeLog", 1, 0, "TimeLogSearchModel");
         qmlRegisterType<ReverseProxyModel>("TimeLog", 1, 0, "ReverseProxyModel");
         qmlRegisterType<TimeLogCategoryTreeModel>("TimeLog", 1, 0, "TimeLogCategoryTreeModel");
         qmlRegisterType<TimeLogCategoryDepthModel>("TimeLog", 1, 0, "TimeLogCategoryDepthModel");
+        qmlRegisterType<TimeLogCategoryCompleterModel>("TimeLog", 1, 0, "TimeLogCategoryCompleterModel");
+        qmlRegisterType<TimeLogStatsModel>("TimeLog", 1, 0, "TimeLogStatsModel");
+        qmlRegisterType<TimeLogDiagnostics>("TimeLog", 1, 0, "TimeLogDiagnostics");
         qmlRegisterUncreatableType<DataSyncer>("TimeLog", 1, 0, "DataSyncer", "This is a DataSyncer object");
 #ifndef Q_OS_ANDROID
         qmlRegisterType<Updater>("TimeLog", 1, 0, "Updater");
@@ -32,6 +32,41 @@ ColumnLayout {
         timeTracker: TimeTracker
     }
 
+    TimeLogCategoryCompleterModel {
+        id: completerModel
+
+        timeTracker: TimeTracker
+        filter: searchField.text
+        limit: 5
+    }
+
+    ItemPositioner {
+        TextFieldControl {
+            id: searchField
+
+            Layout.fillWidth: true
+            placeholderText: qsTr("Find category")
+        }
+
+        Repeater {
+            model: !!searchField.text ? completerModel : null
+
+            LabelControl {
+                Layout.fillWidth: true
+                elide: Text.ElideRight
+                text: model.fullName
+
+                MouseArea {
+                    anchors.fill: parent
+                    onClicked: {
+                        categoryModel.category = model.fullName
+                        searchField.text = ""
+                    }
+                }
+            }
+        }
+    }
+
     Repeater {
         model: categoryModel
 
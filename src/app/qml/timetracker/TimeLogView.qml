@@ -205,7 +205,7 @@ Item {
             width: listView.width
             category: model.category
             startTime: model.startTime
-            durationTime: (model.durationTime === -1 ? Util.calcDuration(startTime, new Date())
+            durationTime: (model.durationTime === -1 ? Util.calcDuration(startTime, model.succeedingStart)
                                                      : model.durationTime)
             comment: model.comment
             precedingStart: model.precedingStart
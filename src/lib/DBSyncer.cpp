@@ -26,29 +26,32 @@
 
 Q_LOGGING_CATEGORY(DB_SYNCER_CATEGORY, "DBSyncer", QtInfoMsg)
 
-DBSyncer::DBSyncer(TimeLogHistory *source, TimeLogHistory *destination, QObject *parent) :
+DBSyncer::DBSyncer(QObject *source, QObject *destination, QObject *parent) :
     QObject(parent),
     m_source(source),
     m_destination(destination),
     m_sm(new QStateMachine(this)),
-    m_sourceHashesState(new QState()),
-    m_destinationHashesState(new QState()),
+    m_hashesState(new QState()),
     m_syncState(new QState()),
     m_updateHashesState(new QState()),
     m_finalState(new QFinalState()),
-    m_isRecalcHashes(false)
+    m_isRecalcHashes(false),
+    m_isSourceHashesAvailable(false),
+    m_isDestinationHashesAvailable(false),
+    m_prefetchDepth(1),
+    m_rangesInFlight(0),
+    m_isCheckingDays(false),
+    m_hashesTime(0)
 {
-    m_sourceHashesState->addTransition(this, SIGNAL(sourceHashesChecked()), m_destinationHashesState);
-    m_destinationHashesState->addTransition(this, SIGNAL(destinationHashesChecked()), m_syncState);
+    m_hashesState->addTransition(this, SIGNAL(hashesChecked()), m_syncState);
     m_syncState->addTransition(this, SIGNAL(synced()), m_updateHashesState);
     m_updateHashesState->addTransition(this, SIGNAL(finished(QDateTime)), m_finalState);
 
-    m_sm->addState(m_sourceHashesState);
-    m_sm->addState(m_destinationHashesState);
+    m_sm->addState(m_hashesState);
     m_sm->addState(m_syncState);
     m_sm->addState(m_updateHashesState);
     m_sm->addState(m_finalState);
-    m_sm->setInitialState(m_sourceHashesState);
+    m_sm->setInitialState(m_hashesState);
 
     connect(this, SIGNAL(started()), m_sm, SLOT(start()));
     connect(this, SIGNAL(error(QString)), m_sm, SLOT(stop()));
@@ -60,24 +63,49 @@ DBSyncer::DBSyncer(TimeLogHistory *source, TimeLogHistory *destination, QObject
                                            QVector<TimeLogSyncDataCategory>,QDateTime)));
     connect(m_source, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)),
             this, SLOT(sourceHashesAvailable(QMap<QDateTime,QByteArray>)));
+    connect(m_source, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)),
+            this, SLOT(sourceDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)));
 
     connect(m_destination, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)),
             this, SLOT(destinationHashesAvailable(QMap<QDateTime,QByteArray>)));
+    connect(m_destination, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)),
+            this, SLOT(destinationDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)));
     connect(m_destination, SIGNAL(dataSynced(QDateTime)),
             this, SLOT(destinationDataSynced(QDateTime)));
     connect(m_destination, SIGNAL(hashesUpdated()),
             this, SLOT(destinationHashesUpdated()));
 }
 
+void DBSyncer::setPrefetchDepth(int prefetchDepth)
+{
+    m_prefetchDepth = qMax(1, prefetchDepth);
+}
+
+// Time spent waiting for both hashes in the last run
+qint64 DBSyncer::hashesTime() const
+{
+    return m_hashesTime;
+}
+
 void DBSyncer::start(bool isRecalcHashes, const QDateTime &maxMonth)
 {
     m_maxMonth = maxMonth;
     m_isRecalcHashes = isRecalcHashes;
     m_latestMTime = QDateTime();
+    m_syncRanges.clear();
+    m_rangesInFlight = 0;
+    m_isCheckingDays = false;
+    m_isSourceHashesAvailable = false;
+    m_isDestinationHashesAvailable = false;
+    m_hashesTime = 0;
+    m_hashesTimer.start();
 
     emit started(QPrivateSignal());
 
-    m_source->getHashes(m_maxMonth);
+    // Histories with own worker threads collect the hashes at the same time
+    QMetaObject::invokeMethod(m_source, "getHashes", Qt::DirectConnection,
+                              Q_ARG(QDateTime, m_maxMonth), Q_ARG(bool, false));
+    QMetaObject::invokeMethod(m_destination, "getHashes", Qt::DirectConnection);
 }
 
 void DBSyncer::sourceDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
@@ -101,31 +129,57 @@ void DBSyncer::sourceDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
         }
     }
 
-    m_destination->sync(updatedData, removedData, categoryData);
+    QMetaObject::invokeMethod(m_destination, "sync", Qt::DirectConnection,
+                              Q_ARG(QVector<TimeLogSyncDataEntry>, updatedData),
+                              Q_ARG(QVector<TimeLogSyncDataEntry>, removedData),
+                              Q_ARG(QVector<TimeLogSyncDataCategory>, categoryData));
 }
 
 void DBSyncer::sourceHashesAvailable(QMap<QDateTime, QByteArray> hashes)
 {
-    if (!m_sourceHashesState->active()) {
+    if (!m_hashesState->active() || m_isSourceHashesAvailable) {
         return;
     }
 
     m_sourceHashes = hashes;
+    m_isSourceHashesAvailable = true;
+
+    checkHashes();
+}
 
-    emit sourceHashesChecked(QPrivateSignal());
+void DBSyncer::sourceDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end)
+{
+    if (!m_syncState->active()) {
+        return;
+    }
 
-    m_destination->getHashes();
+    m_sourceDayHashes = hashes;
+
+    QMetaObject::invokeMethod(m_destination, "getDayHashes", Qt::DirectConnection,
+                              Q_ARG(QDateTime, begin), Q_ARG(QDateTime, end));
 }
 
 void DBSyncer::destinationHashesAvailable(QMap<QDateTime, QByteArray> hashes)
 {
-    if (!m_destinationHashesState->active()) {
+    if (!m_hashesState->active() || m_isDestinationHashesAvailable) {
         return;
     }
 
     m_destinationHashes = hashes;
+    m_isDestinationHashesAvailable = true;
+
+    checkHashes();
+}
+
+void DBSyncer::checkHashes()
+{
+    if (!m_isSourceHashesAvailable || !m_isDestinationHashesAvailable) {
+        return;
+    }
+
+    m_hashesTime = m_hashesTimer.elapsed();
 
-    emit destinationHashesChecked(QPrivateSignal());
+    emit hashesChecked(QPrivateSignal());
 
     m_syncPeriods = periodsToSync(m_sourceHashes, m_destinationHashes);
 
@@ -135,11 +189,29 @@ void DBSyncer::destinationHashesAvailable(QMap<QDateTime, QByteArray> hashes)
         qCDebug(DB_SYNCER_CATEGORY) << "Periods to sync:" << m_syncPeriods;
     }
 
-    if (m_syncPeriods.isEmpty()) {
-        emit synced(QPrivateSignal());
+    syncNext();
+}
+
+void DBSyncer::destinationDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end)
+{
+    Q_UNUSED(end)
+
+    if (!m_syncState->active()) {
+        return;
+    }
+
+    QList<QPair<QDateTime, QDateTime> > ranges(rangesToSync(m_sourceDayHashes, hashes));
+    m_sourceDayHashes.clear();
+    m_isCheckingDays = false;
+
+    if (ranges.isEmpty()) {
+        qCDebug(DB_SYNCER_CATEGORY) << "No days to sync for period" << begin;
     } else {
-        syncNextPeriod();
+        qCDebug(DB_SYNCER_CATEGORY) << "Ranges to sync for period" << begin << ranges;
     }
+    m_syncRanges.append(ranges);
+
+    syncNext();
 }
 
 void DBSyncer::destinationDataSynced(const QDateTime &maxSyncDate)
@@ -151,12 +223,9 @@ void DBSyncer::destinationDataSynced(const QDateTime &maxSyncDate)
     if (maxSyncDate > m_latestMTime) {
         m_latestMTime = maxSyncDate;
     }
+    --m_rangesInFlight;
 
-    if (m_syncPeriods.isEmpty()) {
-        emit synced(QPrivateSignal());
-    } else {
-        syncNextPeriod();
-    }
+    syncNext();
 }
 
 void DBSyncer::destinationHashesUpdated()
@@ -171,7 +240,7 @@ void DBSyncer::destinationHashesUpdated()
 void DBSyncer::dbSynced()
 {
     if (m_isRecalcHashes) {
-        m_destination->updateHashes();
+        QMetaObject::invokeMethod(m_destination, "updateHashes", Qt::DirectConnection);
     } else {
         emit finished(m_latestMTime);
     }
@@ -200,9 +269,71 @@ QList<QDateTime> DBSyncer::periodsToSync(const QMap<QDateTime, QByteArray> &sour
     return result;
 }
 
+QList<QPair<QDateTime, QDateTime> > DBSyncer::rangesToSync(const QMap<QDateTime, QByteArray> &source,
+                                                           const QMap<QDateTime, QByteArray> &destination) const
+{
+    QList<QPair<QDateTime, QDateTime> > result;
+    for (auto it = source.cbegin(); it != source.cend(); it++) {
+        if (destination.value(it.key()) == it.value()) {
+            continue;
+        }
+
+        // Adjacent days are joined into the single range
+        QDateTime end(it.key().addDays(1).addMSecs(-1));
+        if (!result.isEmpty() && result.constLast().second.addMSecs(1) == it.key()) {
+            result.last().second = end;
+        } else {
+            result.append(qMakePair(it.key(), end));
+        }
+    }
+
+    return result;
+}
+
+// Up to m_prefetchDepth ranges are read from the source ahead of the destination, so both
+// histories work at the same time. Ranges don't overlap, so they could be applied in any order.
+void DBSyncer::syncNext()
+{
+    while (m_rangesInFlight < m_prefetchDepth) {
+        if (!m_syncRanges.isEmpty()) {
+            syncNextRange();
+        } else if (!m_syncPeriods.isEmpty() && !m_isCheckingDays) {
+            syncNextPeriod();
+        } else {
+            break;
+        }
+    }
+
+    if (isSyncDone()) {
+        emit synced(QPrivateSignal());
+    }
+}
+
 void DBSyncer::syncNextPeriod()
 {
     QDateTime begin(m_syncPeriods.takeLast());
-    qCDebug(DB_SYNCER_CATEGORY) << "Syncyng for period" << begin;
-    m_source->getSyncData(begin, begin.addMonths(1).addMSecs(-1));
+    QDateTime end(begin.addMonths(1).addMSecs(-1));
+    // Period, missing in destination, is synced as a whole, otherwise only mismatched days are synced
+    if (m_destinationHashes.contains(begin)) {
+        qCDebug(DB_SYNCER_CATEGORY) << "Checking day hashes for period" << begin;
+        m_isCheckingDays = true;
+        QMetaObject::invokeMethod(m_source, "getDayHashes", Qt::DirectConnection,
+                                  Q_ARG(QDateTime, begin), Q_ARG(QDateTime, end));
+    } else {
+        m_syncRanges.append(qMakePair(begin, end));
+    }
+}
+
+void DBSyncer::syncNextRange()
+{
+    QPair<QDateTime, QDateTime> range(m_syncRanges.takeFirst());
+    qCDebug(DB_SYNCER_CATEGORY) << "Syncyng for range" << range.first << range.second;
+    ++m_rangesInFlight;
+    QMetaObject::invokeMethod(m_source, "getSyncData", Qt::DirectConnection,
+                              Q_ARG(QDateTime, range.first), Q_ARG(QDateTime, range.second));
+}
+
+bool DBSyncer::isSyncDone() const
+{
+    return m_syncRanges.isEmpty() && m_syncPeriods.isEmpty() && !m_isCheckingDays && !m_rangesInFlight;
 }
@@ -20,6 +20,7 @@
 #define DBSYNCER_H
 
 #include <QObject>
+#include <QElapsedTimer>
 
 #include "TimeLogSyncDataEntry.h"
 #include "TimeLogSyncDataCategory.h"
@@ -28,21 +29,22 @@ class QStateMachine;
 class QState;
 class QFinalState;
 
-class TimeLogHistory;
-
+// Source and destination are TimeLogHistory or TimeLogRemoteHistory, both have same sync slots and signals
 class DBSyncer : public QObject
 {
     Q_OBJECT
 public:
-    explicit DBSyncer(TimeLogHistory *source, TimeLogHistory *destination, QObject *parent = 0);
+    explicit DBSyncer(QObject *source, QObject *destination, QObject *parent = 0);
+
+    void setPrefetchDepth(int prefetchDepth);
+    qint64 hashesTime() const;
 
 signals:
     void finished(QDateTime latestMTime) const;
     void error(const QString &errorText) const;
 
     void started(QPrivateSignal);
-    void sourceHashesChecked(QPrivateSignal);
-    void destinationHashesChecked(QPrivateSignal);
+    void hashesChecked(QPrivateSignal);
     void synced(QPrivateSignal);
 
 public slots:
@@ -53,7 +55,10 @@ private slots:
                              QVector<TimeLogSyncDataCategory> categoryData, QDateTime until);
     void sourceHashesAvailable(QMap<QDateTime, QByteArray> hashes);
 
+    void sourceDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end);
+
     void destinationHashesAvailable(QMap<QDateTime, QByteArray> hashes);
+    void destinationDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end);
     void destinationDataSynced(const QDateTime &maxSyncDate);
     void destinationHashesUpdated();
 
@@ -62,14 +67,19 @@ private slots:
 private:
     QList<QDateTime> periodsToSync(const QMap<QDateTime, QByteArray> &source,
                                    const QMap<QDateTime, QByteArray> &destination) const;
+    QList<QPair<QDateTime, QDateTime> > rangesToSync(const QMap<QDateTime, QByteArray> &source,
+                                                     const QMap<QDateTime, QByteArray> &destination) const;
+    void checkHashes();
+    void syncNext();
     void syncNextPeriod();
+    void syncNextRange();
+    bool isSyncDone() const;
 
-    TimeLogHistory *m_source;
-    TimeLogHistory *m_destination;
+    QObject *m_source;
+    QObject *m_destination;
 
     QStateMachine *m_sm;
-    QState *m_sourceHashesState;
-    QState *m_destinationHashesState;
+    QState *m_hashesState;
     QState *m_syncState;
     QState *m_updateHashesState;
     QFinalState *m_finalState;
@@ -78,8 +88,17 @@ private:
     bool m_isRecalcHashes;
     QMap<QDateTime, QByteArray> m_sourceHashes;
     QMap<QDateTime, QByteArray> m_destinationHashes;
+    bool m_isSourceHashesAvailable;
+    bool m_isDestinationHashesAvailable;
     QList<QDateTime> m_syncPeriods;
+    QMap<QDateTime, QByteArray> m_sourceDayHashes;
+    QList<QPair<QDateTime, QDateTime> > m_syncRanges;
     QDateTime m_latestMTime;
+    int m_prefetchDepth;
+    int m_rangesInFlight;
+    bool m_isCheckingDays;
+    QElapsedTimer m_hashesTimer;
+    qint64 m_hashesTime;
 };
 
 #endif // DBSYNCER_H
@@ -33,15 +33,27 @@
         QCoreApplication::exit(EXIT_FAILURE);   \
     } while (0)
 
+const qlonglong exportRequestId(1);
+const uint exportChunkSize(1000);
+
 DataExporter::DataExporter(TimeLogHistory *db, QObject *parent) :
-    AbstractDataInOut(db, parent)
+    AbstractDataInOut(db, parent),
+    m_isSingleFile(false),
+    m_exportedSize(0)
 {
+    connect(m_db, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+            this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
     connect(m_db, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
             this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
     connect(m_db, SIGNAL(storedCategoriesAvailable(QVector<TimeLogCategory>)),
             this, SLOT(storedCategoriesAvailable(QVector<TimeLogCategory>)));
 }
 
+void DataExporter::setSingleFile(bool isSingleFile)
+{
+    m_isSingleFile = isSingleFile;
+}
+
 void DataExporter::startIO(const QString &path)
 {
     if (!prepareDir(path, m_dir)) {
@@ -58,6 +70,8 @@ void DataExporter::startIO(const QString &path)
         return;
     }
 
+    // Categories and entries are consistent, even if the running instance changes them meanwhile
+    m_db->beginReadSnapshot();
     m_db->getStoredCategories();
 }
 
@@ -66,26 +80,32 @@ void DataExporter::historyError(const QString &errorText)
     fail(QString("Fail to get data from db: %1").arg(errorText));
 }
 
+void DataExporter::historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (id != exportRequestId) {
+        return;
+    }
+
+    exportEntries(data);
+}
+
 void DataExporter::historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id)
 {
-    if (id == 0) {          // Begin of export period received
-        m_currentDate = data.first().startTime.toUTC().date();
-        m_db->getHistoryBefore(1, 1, QDateTime::currentDateTimeUtc());
+    if (id != exportRequestId) {
         return;
-    } else if (id == 1) {   // End of export period received
-        m_lastDate = data.last().startTime.toUTC().date();
-    } else if (m_currentDate > m_lastDate) {
-        qCInfo(DATA_IO_CATEGORY) << "All data successfully exported";
-        QCoreApplication::quit();
+    }
+
+    m_db->endReadSnapshot();
+
+    if (!exportEntries(data) || !closeFile()) {
         return;
-    } else {
-        if (!exportDay(data)) {
-            return;
-        }
-        m_currentDate = m_currentDate.addDays(1);
     }
 
-    exportCurrentDate(++id);
+    qint64 elapsed = qMax(Q_INT64_C(1), m_timer.elapsed());
+    qCInfo(DATA_IO_CATEGORY) << QString("All data successfully exported, %1 entries in %2 s, %3 entries/s")
+                                .arg(m_exportedSize).arg(elapsed / 1000.0, 0, 'f', 3)
+                                .arg(qRound64(m_exportedSize * 1000.0 / elapsed));
+    QCoreApplication::quit();
 }
 
 void DataExporter::storedCategoriesAvailable(QVector<TimeLogCategory> data)
@@ -94,52 +114,39 @@ void DataExporter::storedCategoriesAvailable(QVector<TimeLogCategory> data)
         return;
     }
 
-    m_db->getHistoryAfter(0, 1, QDateTime::fromTime_t(0, Qt::UTC));
+    // Single request in start order, entries are split to the files as they arrive
+    m_timer.start();
+    m_db->getHistoryBetween(exportRequestId, QDateTime::fromTime_t(0, Qt::UTC), QDateTime::currentDateTimeUtc(),
+                            QString(), false, exportChunkSize);
 }
 
-void DataExporter::exportCurrentDate(qlonglong id)
+bool DataExporter::exportEntries(const QVector<TimeLogEntry> &data)
 {
-    m_db->getHistoryBetween(id, QDateTime(m_currentDate, QTime(), Qt::UTC),
-                            QDateTime(m_currentDate.addDays(1), QTime(), Qt::UTC).addSecs(-1));
-}
+    for (const TimeLogEntry &entry: data) {
+        QDateTime startTime = entry.startTime.toUTC();
+        if (m_isSingleFile) {
+            if (!m_file.isOpen() && !openFile("timelog.csv")) {
+                return false;
+            }
+        } else if (!m_file.isOpen() || startTime.date() != m_currentDate) {
+            m_currentDate = startTime.date();
+            qCInfo(DATA_IO_CATEGORY) << QString("Exporting data for date %1").arg(m_currentDate.toString());
+
+            QString fileName = QString("%1 (%2).csv").arg(m_currentDate.toString(Qt::ISODate))
+                                                     .arg(m_currentDate.toString("ddd"));
+            if (!closeFile() || !openFile(fileName)) {
+                return false;
+            }
+        }
 
-bool DataExporter::exportDay(const QVector<TimeLogEntry> &data)
-{
-    if (data.isEmpty()) {
-        qCInfo(DATA_IO_CATEGORY) << QString("No data for date %1").arg(m_currentDate.toString());
-        return true;
+        m_stream << startTime.toString(Qt::ISODate) << m_sep << entry.category << m_sep
+                 << entry.comment << m_sep << entry.uuid.toString() << '\n';
     }
 
-    qCInfo(DATA_IO_CATEGORY) << QString("Exporting data for date %1").arg(m_currentDate.toString());
-
-    QString fileName = QString("%1 (%2).csv").arg(m_currentDate.toString(Qt::ISODate))
-                                             .arg(m_currentDate.toString("ddd"));
-    QString filePath = m_dir.filePath(fileName);
-    QFile file(filePath);
-    if (file.exists()) {
-        fail(QString("File %1 already exists").arg(filePath));
-        return false;
-    }
+    m_exportedSize += data.size();
 
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        fail(formatFileError("Fail to open file", file));
-        return false;
-    }
-
-    QStringList strings;
-    foreach (const TimeLogEntry &entry, data) {
-        QStringList values;
-        values << entry.startTime.toUTC().toString(Qt::ISODate);
-        values << entry.category;
-        values << entry.comment;
-        values << entry.uuid.toString();
-        strings.append(values.join(m_sep));
-    }
-
-    QTextStream stream(&file);
-    stream << strings.join('\n') << endl;
-    if (stream.status() != QTextStream::Ok || file.error() != QFileDevice::NoError) {
-        fail(formatFileError("Error writing to file", file));
+    if (m_stream.status() != QTextStream::Ok || m_file.error() != QFileDevice::NoError) {
+        fail(formatFileError("Error writing to file", m_file));
         return false;
     }
 
@@ -186,3 +193,39 @@ bool DataExporter::exportCategories(const QVector<TimeLogCategory> &data)
 
     return true;
 }
+
+bool DataExporter::openFile(const QString &fileName)
+{
+    m_file.setFileName(m_dir.filePath(fileName));
+    if (m_file.exists()) {
+        fail(QString("File %1 already exists").arg(m_file.fileName()));
+        return false;
+    }
+
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        fail(formatFileError("Fail to open file", m_file));
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+
+    return true;
+}
+
+bool DataExporter::closeFile()
+{
+    if (!m_file.isOpen()) {
+        return true;
+    }
+
+    m_stream.flush();
+    if (m_stream.status() != QTextStream::Ok || m_file.error() != QFileDevice::NoError) {
+        fail(formatFileError("Error writing to file", m_file));
+        return false;
+    }
+
+    m_stream.setDevice(nullptr);
+    m_file.close();
+
+    return true;
+}
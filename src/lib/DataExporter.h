@@ -19,6 +19,9 @@
 #ifndef DATAEXPORTER_H
 #define DATAEXPORTER_H
 
+#include <QTextStream>
+#include <QElapsedTimer>
+
 #include "AbstractDataInOut.h"
 #include "TimeLogEntry.h"
 #include "TimeLogCategory.h"
@@ -29,22 +32,30 @@ class DataExporter : public AbstractDataInOut
 public:
     explicit DataExporter(TimeLogHistory *db, QObject *parent = 0);
 
+    void setSingleFile(bool isSingleFile);
+
 protected slots:
     virtual void startIO(const QString &path);
     virtual void historyError(const QString &errorText);
 
 private slots:
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id);
     void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id);
     void storedCategoriesAvailable(QVector<TimeLogCategory> data);
 
 private:
-    void exportCurrentDate(qlonglong id);
-    bool exportDay(const QVector<TimeLogEntry> &data);
+    bool exportEntries(const QVector<TimeLogEntry> &data);
     bool exportCategories(const QVector<TimeLogCategory> &data);
+    bool openFile(const QString &fileName);
+    bool closeFile();
 
     QDir m_dir;
+    bool m_isSingleFile;
+    QFile m_file;
+    QTextStream m_stream;
     QDate m_currentDate;
-    QDate m_lastDate;
+    qlonglong m_exportedSize;
+    QElapsedTimer m_timer;
 };
 
 #endif // DATAEXPORTER_H
@@ -21,6 +21,7 @@
 #include <QDir>
 #include <QTextStream>
 #include <QCoreApplication>
+#include <QRunnable>
 
 #include "DataImporter.h"
 #include "TimeLogHistory.h"
@@ -31,8 +32,173 @@
         QCoreApplication::exit(EXIT_FAILURE);   \
     } while (0)
 
+// Entries per import transaction, small files are merged to fill it
+const int importChunkSize(5000);
+
+static int parseDigits(const QChar *data, int count)
+{
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        ushort digit = data[i].unicode() - '0';
+        if (digit > 9) {
+            return -1;
+        }
+        result = result * 10 + digit;
+    }
+
+    return result;
+}
+
+// Handles the exported format, yyyy-MM-ddTHH:mm:ss with optional offset, falls back to Qt for the rest
+static QDateTime parseDateTime(const QStringRef &text)
+{
+    const QChar *data = text.unicode();
+    int size = text.size();
+    if (size < 19 || data[4] != '-' || data[7] != '-' || data[10] != 'T' || data[13] != ':' || data[16] != ':') {
+        return QDateTime::fromString(text.toString(), Qt::ISODate);
+    }
+
+    int year = parseDigits(data, 4);
+    QDate date(year, parseDigits(data + 5, 2), parseDigits(data + 8, 2));
+    int hour = parseDigits(data + 11, 2);
+    int minute = parseDigits(data + 14, 2);
+    int second = parseDigits(data + 17, 2);
+    if (year < 0 || !date.isValid() || !QTime::isValid(hour, minute, second)) {
+        return QDateTime::fromString(text.toString(), Qt::ISODate);
+    }
+    QTime time(hour, minute, second);
+
+    if (size == 19) {
+        return QDateTime(date, time, Qt::LocalTime);
+    } else if (size == 20 && data[19] == 'Z') {
+        return QDateTime(date, time, Qt::UTC);
+    } else if (data[19] == '+' || data[19] == '-') {
+        int offsetHours = size >= 22 ? parseDigits(data + 20, 2) : -1;
+        int offsetMinutes = -1;
+        if (size == 22) {
+            offsetMinutes = 0;
+        } else if (size == 24) {
+            offsetMinutes = parseDigits(data + 22, 2);
+        } else if (size == 25 && data[22] == ':') {
+            offsetMinutes = parseDigits(data + 23, 2);
+        }
+        if (offsetHours >= 0 && offsetMinutes >= 0) {
+            int offset = (offsetHours * 60 + offsetMinutes) * 60;
+            return QDateTime(date, time, Qt::OffsetFromUTC, data[19] == '-' ? -offset : offset);
+        }
+    }
+
+    return QDateTime::fromString(text.toString(), Qt::ISODate);
+}
+
+// Fields are not quoted, so the line is split in place
+static TimeLogEntry parseLine(const QString &line, const QString &sep)
+{
+    TimeLogEntry result;
+
+    QStringRef fields[4];
+    int count = 0;
+    for (int pos = 0; count < 4;) {
+        int next = line.indexOf(sep, pos);
+        if (next == -1) {
+            fields[count++] = line.midRef(pos);
+            break;
+        }
+        fields[count++] = line.midRef(pos, next - pos);
+        pos = next + sep.size();
+    }
+
+    result.startTime = parseDateTime(fields[0]);
+    if (count >= 2) {
+        result.category = fields[1].toString();
+    }
+    if (count >= 3) {
+        result.comment = fields[2].toString();
+    }
+    if (count >= 4) {
+        result.uuid = QUuid(fields[3].toString());
+    } else {
+        result.uuid = QUuid::createUuid();
+    }
+
+    return result;
+}
+
+class DataImporterTask : public QRunnable
+{
+public:
+    DataImporterTask(DataImporter *importer, int index, const QString &path, const QString &sep) :
+        m_importer(importer),
+        m_index(index),
+        m_path(path),
+        m_sep(sep)
+    {
+    }
+
+    virtual void run()
+    {
+        QVector<TimeLogEntry> result;
+        QString errorText = parseFile(result);
+
+        QMetaObject::invokeMethod(m_importer, "fileParsed", Qt::QueuedConnection, Q_ARG(int, m_index),
+                                  Q_ARG(QVector<TimeLogEntry>, result), Q_ARG(QString, errorText));
+    }
+
+private:
+    QString parseFile(QVector<TimeLogEntry> &result) const
+    {
+        QFile file(m_path);
+        if (!file.exists()) {
+            return QString("File %1 does not exists").arg(m_path);
+        }
+
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return AbstractDataInOut::formatFileError("Fail to open file", file);
+        }
+
+        QTextStream stream(&file);
+        QString content = stream.readAll();
+        if (stream.status() != QTextStream::Ok || file.error() != QFileDevice::NoError) {
+            return AbstractDataInOut::formatFileError("Error reading file", file);
+        }
+
+        for (int pos = 0; pos < content.size();) {
+            int next = content.indexOf('\n', pos);
+            if (next == -1) {
+                next = content.size();
+            }
+            QString line = content.mid(pos, next - pos);
+            pos = next + 1;
+
+            TimeLogEntry entry = parseLine(line, m_sep);
+            if (entry.isValid()) {
+                result.append(entry);
+            } else {
+                qCWarning(DATA_IO_CATEGORY) << "Invalid entry in file" << m_path << "line:" << line;
+            }
+        }
+
+        if (!result.size()) {
+            qCWarning(DATA_IO_CATEGORY) << "No data in file" << m_path;
+        }
+
+        return QString();
+    }
+
+    DataImporter *m_importer;
+    int m_index;
+    QString m_path;
+    QString m_sep;
+};
+
 DataImporter::DataImporter(TimeLogHistory *db, QObject *parent) :
-    AbstractDataInOut(db, parent)
+    AbstractDataInOut(db, parent),
+    m_parseIndex(0),
+    m_currentIndex(0),
+    m_currentOffset(0),
+    m_isImporting(false),
+    m_chunkSize(0),
+    m_importedSize(0)
 {
     connect(m_db, SIGNAL(dataImported(QVector<TimeLogEntry>)),
             this, SLOT(historyDataImported(QVector<TimeLogEntry>)));
@@ -47,107 +213,105 @@ void DataImporter::startIO(const QString &path)
         return;
     }
 
-    m_currentIndex = 0;
-    importCurrentFile();
+    m_timer.start();
+    parseFiles();
 }
 
 void DataImporter::historyError(const QString &errorText)
 {
-    fail(QString("DB error while importing file %1: %2").arg(m_fileList.at(m_currentIndex)).arg(errorText));
+    // Last file of the chunk being imported
+    int index = qMax(0, m_currentOffset > 0 ? m_currentIndex : m_currentIndex - 1);
+    fail(QString("DB error while importing file %1: %2").arg(m_fileList.at(index)).arg(errorText));
 }
 
 void DataImporter::historyDataImported(QVector<TimeLogEntry> data)
 {
     Q_UNUSED(data)
 
-    qCInfo(DATA_IO_CATEGORY) << "Successfully imported file" << m_fileList.at(m_currentIndex);
+    m_isImporting = false;
+    m_importedSize += m_chunkSize;
 
-    ++m_currentIndex;
-    if (m_currentIndex == m_fileList.size()) {
-        QCoreApplication::quit();
-    } else {
-        importCurrentFile();
-    }
+    importParsedData();
 }
 
-void DataImporter::importCurrentFile()
+void DataImporter::fileParsed(int index, QVector<TimeLogEntry> data, QString errorText)
 {
-    qCInfo(DATA_IO_CATEGORY) << QString("Importing file %1 of %2")
-                                .arg(m_currentIndex+1).arg(m_fileList.size());
-    importFile(m_fileList.at(m_currentIndex));
+    if (!errorText.isEmpty()) {
+        fail(errorText);
+        return;
+    }
+
+    m_parsedData.insert(index, data);
+
+    if (!m_isImporting) {
+        importParsedData();
+    }
 }
 
-void DataImporter::importFile(const QString &path)
+// Parsing runs ahead of the DB by the limited amount of files, so the memory usage is bounded
+void DataImporter::parseFiles()
 {
-    QVector<TimeLogEntry> data = parseFile(path);
-
-    if (data.size()) {
-        m_db->import(data);
-    } else {
-        historyDataImported(data);
+    int maxParsedFiles = qMax(2, m_threadPool.maxThreadCount() * 2);
+    while (m_parseIndex < m_fileList.size() && m_parseIndex - m_currentIndex < maxParsedFiles) {
+        m_threadPool.start(new DataImporterTask(this, m_parseIndex, m_fileList.at(m_parseIndex), m_sep));
+        ++m_parseIndex;
     }
 }
 
-QVector<TimeLogEntry> DataImporter::parseFile(const QString &path) const
+void DataImporter::importParsedData()
 {
-    QVector<TimeLogEntry> result;
+    reportImportedFiles();
 
-    QFile file(path);
-    if (!file.exists()) {
-        fail(QString("File %1 does not exists").arg(path));
-        return result;
-    }
+    QVector<TimeLogEntry> chunk;
+    while (chunk.size() < importChunkSize && m_parsedData.contains(m_currentIndex)) {
+        const QVector<TimeLogEntry> &data = m_parsedData[m_currentIndex];
+        if (m_currentOffset == 0) {
+            qCInfo(DATA_IO_CATEGORY) << QString("Importing file %1 of %2")
+                                        .arg(m_currentIndex + 1).arg(m_fileList.size());
+        }
 
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        fail(formatFileError("Fail to open file", file));
-        return result;
-    }
+        int count = qMin(importChunkSize - chunk.size(), data.size() - m_currentOffset);
+        chunk.append(data.mid(m_currentOffset, count));
+        m_currentOffset += count;
 
-    QTextStream stream(&file);
-    while (!stream.atEnd()) {
-        QString line = stream.readLine();
-        TimeLogEntry entry = parseLine(line);
-        if (entry.isValid()) {
-            result.append(entry);
-        } else {
-            qCWarning(DATA_IO_CATEGORY) << "Invalid entry in file" << path << "line:" << line;
+        if (m_currentOffset == data.size()) {
+            m_parsedData.remove(m_currentIndex);
+            m_importedFiles.append(m_currentIndex);
+            m_currentOffset = 0;
+            ++m_currentIndex;
         }
     }
 
-    if (!result.size()) {
-        qCWarning(DATA_IO_CATEGORY) << "No data in file" << path;
+    parseFiles();
+
+    if (!chunk.isEmpty()) {
+        m_isImporting = true;
+        m_chunkSize = chunk.size();
+        m_db->import(chunk);
+        return;
     }
 
-    return result;
+    // Files without data are done immediately
+    reportImportedFiles();
+
+    if (m_currentIndex == m_fileList.size()) {
+        qint64 elapsed = qMax(Q_INT64_C(1), m_timer.elapsed());
+        qCInfo(DATA_IO_CATEGORY) << QString("Imported %1 entries from %2 files in %3 s, %4 entries/s")
+                                    .arg(m_importedSize).arg(m_fileList.size())
+                                    .arg(elapsed / 1000.0, 0, 'f', 3)
+                                    .arg(qRound64(m_importedSize * 1000.0 / elapsed));
+        QCoreApplication::quit();
+    }
 }
 
-TimeLogEntry DataImporter::parseLine(const QString &line) const
+void DataImporter::reportImportedFiles()
 {
-    TimeLogEntry result;
-
-    QStringList fields = line.split(m_sep, QString::KeepEmptyParts);
-    if (fields.isEmpty()) {
-        return result;
+    if (m_isImporting) {
+        return;
     }
 
-    if (fields.size() >= 1) {
-        result.startTime = QDateTime::fromString(fields.at(0), Qt::ISODate);
-        qCDebug(DATA_IO_CATEGORY) << "Entry time" << fields.at(0) << result.startTime.toTime_t();
-    }
-    if (fields.size() >= 2) {
-        result.category = fields.at(1);
-        qCDebug(DATA_IO_CATEGORY) << "Entry category" << result.category;
-    }
-    if (fields.size() >= 3) {
-        result.comment = fields.at(2);
-        qCDebug(DATA_IO_CATEGORY) << "Entry comment" << result.comment;
+    for (int index: m_importedFiles) {
+        qCInfo(DATA_IO_CATEGORY) << "Successfully imported file" << m_fileList.at(index);
     }
-    if (fields.size() >= 4) {
-        result.uuid = QUuid(fields.at(3));
-        qCDebug(DATA_IO_CATEGORY) << "Entry uuid" << result.uuid;
-    } else {
-        result.uuid = QUuid::createUuid();
-    }
-
-    return result;
+    m_importedFiles.clear();
 }
@@ -19,6 +19,10 @@
 #ifndef DATAIMPORTER_H
 #define DATAIMPORTER_H
 
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QMap>
+
 #include "AbstractDataInOut.h"
 #include "TimeLogEntry.h"
 
@@ -34,15 +38,24 @@ protected slots:
 
 private slots:
     void historyDataImported(QVector<TimeLogEntry> data);
+    void fileParsed(int index, QVector<TimeLogEntry> data, QString errorText);
 
 private:
-    void importCurrentFile();
-    void importFile(const QString &path);
-    QVector<TimeLogEntry> parseFile(const QString &path) const;
-    TimeLogEntry parseLine(const QString &line) const;
+    void parseFiles();
+    void importParsedData();
+    void reportImportedFiles();
 
     QStringList m_fileList;
+    int m_parseIndex;
     int m_currentIndex;
+    int m_currentOffset;
+    QMap<int, QVector<TimeLogEntry> > m_parsedData;
+    QVector<int> m_importedFiles;
+    bool m_isImporting;
+    int m_chunkSize;
+    qlonglong m_importedSize;
+    QElapsedTimer m_timer;
+    QThreadPool m_threadPool;
 };
 
 #endif // DATAIMPORTER_H
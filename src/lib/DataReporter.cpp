@@ -0,0 +1,303 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "DataReporter.h"
+#include "TimeLogHistory.h"
+
+#define fail(message) \
+    do {    \
+        qCCritical(DATA_IO_CATEGORY) << message;    \
+        QCoreApplication::exit(EXIT_FAILURE);   \
+    } while (0)
+
+const qlonglong reportRequestId(1);
+const uint reportChunkSize(1000);
+const QString categorySeparator(">");
+
+DataReporter::DataReporter(TimeLogHistory *db, QObject *parent) :
+    AbstractDataInOut(db, parent),
+    m_report(StatsReport),
+    m_format(CsvFormat),
+    m_begin(QDateTime::fromTime_t(0, Qt::UTC)),
+    m_end(QDateTime::currentDateTimeUtc()),
+    m_depth(1),
+    m_bucket(-1),
+    m_isFirstRecord(true)
+{
+    connect(m_db, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+            this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+    connect(m_db, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+            this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    connect(m_db, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)),
+            this, SLOT(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    connect(m_db, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)),
+            this, SLOT(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)));
+}
+
+void DataReporter::setReport(DataReporter::Report report)
+{
+    m_report = report;
+}
+
+void DataReporter::setFormat(DataReporter::Format format)
+{
+    m_format = format;
+}
+
+void DataReporter::setRange(const QDateTime &begin, const QDateTime &end)
+{
+    m_begin = begin;
+    m_end = end;
+}
+
+void DataReporter::setCategory(const QString &category)
+{
+    m_category = category;
+}
+
+void DataReporter::setDepth(int depth)
+{
+    m_depth = depth;
+}
+
+void DataReporter::setBucket(int bucket)
+{
+    m_bucket = bucket;
+}
+
+bool DataReporter::parseRange(const QString &range, QDateTime &begin, QDateTime &end)
+{
+    const QDate today(QDate::currentDate());
+    QDate beginDate;
+    QDate endDate(today);
+
+    if (range == "all") {
+        begin = QDateTime::fromTime_t(0, Qt::UTC);
+        end = QDateTime::currentDateTimeUtc();
+        return true;
+    } else if (range == "today") {
+        beginDate = today;
+    } else if (range == "yesterday") {
+        beginDate = today.addDays(-1);
+        endDate = beginDate;
+    } else if (range == "week") {
+        beginDate = today.addDays(1 - today.dayOfWeek());
+    } else if (range == "month") {
+        beginDate = QDate(today.year(), today.month(), 1);
+    } else if (range == "year") {
+        beginDate = QDate(today.year(), 1, 1);
+    } else if (range.contains("..")) {
+        const QString from(range.section("..", 0, 0).trimmed());
+        const QString to(range.section("..", 1).trimmed());
+        beginDate = from.isEmpty() ? QDate(1970, 1, 1) : QDate::fromString(from, Qt::ISODate);
+        endDate = to.isEmpty() ? today : QDate::fromString(to, Qt::ISODate);
+    } else {
+        beginDate = QDate::fromString(range, Qt::ISODate);
+        endDate = beginDate;
+    }
+
+    if (!beginDate.isValid() || !endDate.isValid() || endDate < beginDate) {
+        return false;
+    }
+
+    begin = QDateTime(beginDate).toUTC();
+    end = QDateTime(endDate.addDays(1)).addMSecs(-1).toUTC();
+
+    return true;
+}
+
+bool DataReporter::parseBucket(const QString &name, int &bucket)
+{
+    if (name == "hour") {
+        bucket = TimeLogStatsSeries::HourBucket;
+    } else if (name == "day") {
+        bucket = TimeLogStatsSeries::DayBucket;
+    } else if (name == "week") {
+        bucket = TimeLogStatsSeries::WeekBucket;
+    } else if (name == "month") {
+        bucket = TimeLogStatsSeries::MonthBucket;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void DataReporter::startIO(const QString &path)
+{
+    if (path.isEmpty()) {
+        if (!m_file.open(stdout, QIODevice::WriteOnly | QIODevice::Text)) {
+            fail(formatFileError("Fail to open stdout", m_file));
+            return;
+        }
+    } else {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+            fail(formatFileError("Fail to open file", m_file));
+            return;
+        }
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setCodec("UTF-8");
+
+    if (m_report == HistoryReport) {
+        writeHeader(QStringList() << "start" << "duration" << "category" << "comment" << "uuid");
+        m_db->getHistoryBetween(reportRequestId, m_begin, m_end, m_category, true, reportChunkSize);
+    } else if (m_bucket == -1 && m_depth == 1) {
+        // Daily stats give the range totals without the series matrix
+        writeHeader(QStringList() << "category" << "duration");
+        m_db->getStats(m_begin, m_end, m_category, categorySeparator);
+    } else if (m_bucket == -1) {
+        writeHeader(QStringList() << "category" << "duration");
+        m_db->getStatsSeries(m_begin, m_end, TimeLogStatsSeries::MonthBucket, m_depth, m_category, categorySeparator);
+    } else {
+        writeHeader(QStringList() << "bucket" << "category" << "duration");
+        m_db->getStatsSeries(m_begin, m_end, m_bucket, m_depth, m_category, categorySeparator);
+    }
+}
+
+void DataReporter::historyError(const QString &errorText)
+{
+    fail(QString("Fail to get data from db: %1").arg(errorText));
+}
+
+void DataReporter::historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (id != reportRequestId) {
+        return;
+    }
+
+    for (const TimeLogEntry &entry: data) {
+        writeRecord(QVariantList() << entry.startTime.toUTC().toString(Qt::ISODate) << entry.durationTime
+                                   << entry.category << entry.comment << entry.uuid.toString());
+    }
+}
+
+void DataReporter::historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (id != reportRequestId) {
+        return;
+    }
+
+    historyRequestPartial(data, id);
+    finish();
+}
+
+void DataReporter::statsDataAvailable(QVector<TimeLogStats> data, QDateTime until)
+{
+    Q_UNUSED(until)
+
+    for (const TimeLogStats &stats: data) {
+        writeRecord(QVariantList() << stats.category << stats.durationTime);
+    }
+    finish();
+}
+
+void DataReporter::statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until)
+{
+    Q_UNUSED(until)
+
+    if (m_bucket == -1) {
+        for (int categoryIndex = 0; categoryIndex < data.categories.size(); categoryIndex++) {
+            qint64 durationTime = 0;
+            for (int bucketIndex = 0; bucketIndex < data.buckets.size(); bucketIndex++) {
+                durationTime += data.durationTime(bucketIndex, categoryIndex);
+            }
+            writeRecord(QVariantList() << data.categories.at(categoryIndex) << durationTime);
+        }
+    } else {
+        for (int bucketIndex = 0; bucketIndex < data.buckets.size(); bucketIndex++) {
+            const QString bucket(data.buckets.at(bucketIndex).toUTC().toString(Qt::ISODate));
+            for (int categoryIndex = 0; categoryIndex < data.categories.size(); categoryIndex++) {
+                int durationTime = data.durationTime(bucketIndex, categoryIndex);
+                if (durationTime) {
+                    writeRecord(QVariantList() << bucket << data.categories.at(categoryIndex) << durationTime);
+                }
+            }
+        }
+    }
+    finish();
+}
+
+void DataReporter::writeHeader(const QStringList &columns)
+{
+    m_columns = columns;
+    m_isFirstRecord = true;
+
+    if (m_format == JsonFormat) {
+        m_stream << '[';
+    } else {
+        m_stream << columns.join(m_sep) << '\n';
+    }
+}
+
+void DataReporter::writeRecord(const QVariantList &values)
+{
+    Q_ASSERT(values.size() == m_columns.size());
+
+    if (m_format == JsonFormat) {
+        QJsonObject object;
+        for (int i = 0; i < values.size(); i++) {
+            object.insert(m_columns.at(i), QJsonValue::fromVariant(values.at(i)));
+        }
+        m_stream << (m_isFirstRecord ? "\n" : ",\n")
+                 << QString::fromUtf8(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    } else {
+        QStringList fields;
+        for (const QVariant &value: values) {
+            fields.append(csvField(value.toString()));
+        }
+        m_stream << fields.join(m_sep) << '\n';
+    }
+
+    m_isFirstRecord = false;
+}
+
+bool DataReporter::finish()
+{
+    if (m_format == JsonFormat) {
+        m_stream << "\n]\n";
+    }
+
+    m_stream.flush();
+    if (m_stream.status() != QTextStream::Ok || m_file.error() != QFileDevice::NoError) {
+        fail(formatFileError("Error writing report", m_file));
+        return false;
+    }
+
+    m_stream.setDevice(nullptr);
+    m_file.close();
+
+    QCoreApplication::quit();
+
+    return true;
+}
+
+QString DataReporter::csvField(const QString &value) const
+{
+    // Unlike the export, the reports are read by other tools, so the fields are quoted when needed
+    if (!value.contains(m_sep) && !value.contains('"') && !value.contains('\n')) {
+        return value;
+    }
+
+    return QString("\"%1\"").arg(QString(value).replace('"', "\"\""));
+}
@@ -0,0 +1,88 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef DATAREPORTER_H
+#define DATAREPORTER_H
+
+#include <QTextStream>
+#include <QDateTime>
+
+#include "AbstractDataInOut.h"
+#include "TimeLogEntry.h"
+#include "TimeLogStats.h"
+
+// Writes the stats or the history of the given range as CSV or JSON, to stdout for the empty path
+class DataReporter : public AbstractDataInOut
+{
+    Q_OBJECT
+public:
+    enum Report {
+        StatsReport,
+        HistoryReport
+    };
+
+    enum Format {
+        CsvFormat,
+        JsonFormat
+    };
+
+    explicit DataReporter(TimeLogHistory *db, QObject *parent = 0);
+
+    void setReport(Report report);
+    void setFormat(Format format);
+    void setRange(const QDateTime &begin, const QDateTime &end);
+    void setCategory(const QString &category);
+    void setDepth(int depth);
+    // Stats are summed over the range, unless the bucket is set
+    void setBucket(int bucket);
+
+    // "all", "today", "yesterday", "week", "month", "year" or "<from>..<to>" with ISO dates, either
+    // of them could be omitted, dates are in local time
+    static bool parseRange(const QString &range, QDateTime &begin, QDateTime &end);
+    static bool parseBucket(const QString &name, int &bucket);
+
+protected slots:
+    virtual void startIO(const QString &path);
+    virtual void historyError(const QString &errorText);
+
+private slots:
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id);
+    void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id);
+    void statsDataAvailable(QVector<TimeLogStats> data, QDateTime until);
+    void statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until);
+
+private:
+    void writeHeader(const QStringList &columns);
+    void writeRecord(const QVariantList &values);
+    bool finish();
+    QString csvField(const QString &value) const;
+
+    Report m_report;
+    Format m_format;
+    QDateTime m_begin;
+    QDateTime m_end;
+    QString m_category;
+    int m_depth;
+    int m_bucket;
+    QFile m_file;
+    QTextStream m_stream;
+    QStringList m_columns;
+    bool m_isFirstRecord;
+};
+
+#endif // DATAREPORTER_H
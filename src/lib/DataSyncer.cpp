@@ -20,6 +20,8 @@
 
 #include "DataSyncer.h"
 #include "DataSyncerWorker.h"
+#include "NetworkSyncerWorker.h"
+#include "TimeLogSyncProtocol.h"
 
 DataSyncer::DataSyncer(TimeLogHistory *history, QObject *parent) :
     QObject(parent),
@@ -27,17 +29,32 @@ DataSyncer::DataSyncer(TimeLogHistory *history, QObject *parent) :
     m_notifySync(true),
     m_notifyNextSync(false),
     m_autoSync(true),
+    m_syncMaxLatency(120),
+    m_syncServerPort(0),
+    m_syncInterval(0),
     m_thread(new QThread()),
-    m_worker(new DataSyncerWorker(history))
+    m_worker(new DataSyncerWorker(history)),
+    m_networkWorker(new NetworkSyncerWorker(history))
 {
     connect(m_worker, SIGNAL(error(QString)), this, SLOT(syncError(QString)));
     connect(m_worker, SIGNAL(synced()), this, SLOT(syncFinished()));
     connect(m_worker, SIGNAL(started()), this, SLOT(syncStarted()));
     connect(m_worker, SIGNAL(stopped()), this, SLOT(syncStopped()));
+    connect(m_worker, SIGNAL(syncScheduleChanged(QDateTime,int)),
+            this, SLOT(syncScheduleChanged(QDateTime,int)));
+    connect(m_worker, SIGNAL(syncMetricsAvailable(QVariantMap)),
+            this, SLOT(syncMetricsAvailable(QVariantMap)));
 
+    connect(m_networkWorker, SIGNAL(error(QString)), this, SLOT(syncError(QString)));
+    connect(m_networkWorker, SIGNAL(synced()), this, SLOT(syncFinished()));
+    connect(m_networkWorker, SIGNAL(started()), this, SLOT(syncStarted()));
+    connect(m_networkWorker, SIGNAL(stopped()), this, SLOT(syncStopped()));
+
+    connect(m_thread, SIGNAL(finished()), m_networkWorker, SLOT(deleteLater()));
     connect(m_thread, SIGNAL(finished()), m_worker, SLOT(deleteLater()));
     connect(m_worker, SIGNAL(destroyed()), m_thread, SLOT(deleteLater()));
 
+    m_networkWorker->moveToThread(m_thread);
     m_worker->moveToThread(m_thread);
     m_thread->start();
 }
@@ -65,6 +82,21 @@ bool DataSyncer::isRunning() const
     return m_isRunning;
 }
 
+QDateTime DataSyncer::nextSyncTime() const
+{
+    return m_nextSyncTime;
+}
+
+int DataSyncer::syncInterval() const
+{
+    return m_syncInterval;
+}
+
+QVariantMap DataSyncer::lastSyncMetrics() const
+{
+    return m_lastSyncMetrics;
+}
+
 void DataSyncer::setAutoSync(bool autoSync)
 {
     if (m_autoSync == autoSync) {
@@ -75,6 +107,8 @@ void DataSyncer::setAutoSync(bool autoSync)
 
     QMetaObject::invokeMethod(m_worker, "setAutoSync", Qt::AutoConnection,
                               Q_ARG(bool, autoSync));
+    QMetaObject::invokeMethod(m_networkWorker, "setAutoSync", Qt::AutoConnection,
+                              Q_ARG(bool, autoSync));
 
     emit autoSyncChanged(m_autoSync);
 }
@@ -107,6 +141,34 @@ void DataSyncer::setSyncCacheTimeout(int syncCacheTimeout)
     emit syncCacheTimeoutChanged(m_syncCacheTimeout);
 }
 
+void DataSyncer::setSyncMaxLatency(int syncMaxLatency)
+{
+    if (m_syncMaxLatency == syncMaxLatency) {
+        return;
+    }
+
+    m_syncMaxLatency = syncMaxLatency;
+
+    QMetaObject::invokeMethod(m_worker, "setSyncMaxLatency", Qt::AutoConnection,
+                              Q_ARG(int, syncMaxLatency));
+
+    emit syncMaxLatencyChanged(m_syncMaxLatency);
+}
+
+void DataSyncer::setMetricsLogPath(const QString &metricsLogPath)
+{
+    if (m_metricsLogPath == metricsLogPath) {
+        return;
+    }
+
+    m_metricsLogPath = metricsLogPath;
+
+    QMetaObject::invokeMethod(m_worker, "setMetricsLogPath", Qt::AutoConnection,
+                              Q_ARG(QString, metricsLogPath));
+
+    emit metricsLogPathChanged(m_metricsLogPath);
+}
+
 void DataSyncer::setSyncPath(const QUrl &syncPathUrl)
 {
     if (m_syncPath == syncPathUrl) {
@@ -121,14 +183,87 @@ void DataSyncer::setSyncPath(const QUrl &syncPathUrl)
     emit syncPathChanged(m_syncPath);
 }
 
+void DataSyncer::setSyncPeer(const QString &syncPeer)
+{
+    if (m_syncPeer == syncPeer) {
+        return;
+    }
+
+    m_syncPeer = syncPeer;
+
+    // "host" or "host:port"
+    QString host(m_syncPeer.section(':', 0, -2));
+    int port = m_syncPeer.section(':', -1).toInt();
+    if (host.isEmpty() || port <= 0) {
+        host = m_syncPeer;
+        port = TimeLogSyncProtocol::defaultPort;
+    }
+    QMetaObject::invokeMethod(m_networkWorker, "setPeer", Qt::AutoConnection,
+                              Q_ARG(QString, m_syncPeer.isEmpty() ? QString() : host), Q_ARG(int, port));
+
+    emit syncPeerChanged(m_syncPeer);
+}
+
+void DataSyncer::setSyncServerPort(int syncServerPort)
+{
+    if (m_syncServerPort == syncServerPort) {
+        return;
+    }
+
+    m_syncServerPort = syncServerPort;
+
+    QMetaObject::invokeMethod(m_networkWorker, "setServerPort", Qt::AutoConnection,
+                              Q_ARG(int, syncServerPort));
+
+    emit syncServerPortChanged(m_syncServerPort);
+}
+
+void DataSyncer::setSyncServerAddress(const QString &syncServerAddress)
+{
+    if (m_syncServerAddress == syncServerAddress) {
+        return;
+    }
+
+    m_syncServerAddress = syncServerAddress;
+
+    QMetaObject::invokeMethod(m_networkWorker, "setServerAddress", Qt::AutoConnection,
+                              Q_ARG(QString, syncServerAddress));
+
+    emit syncServerAddressChanged(m_syncServerAddress);
+}
+
+void DataSyncer::setSyncToken(const QString &syncToken)
+{
+    if (m_syncToken == syncToken) {
+        return;
+    }
+
+    m_syncToken = syncToken;
+
+    QMetaObject::invokeMethod(m_networkWorker, "setToken", Qt::AutoConnection,
+                              Q_ARG(QString, syncToken));
+
+    emit syncTokenChanged(m_syncToken);
+}
+
 void DataSyncer::setNoPack(bool noPack)
 {
     QMetaObject::invokeMethod(m_worker, "setNoPack", Qt::AutoConnection, Q_ARG(bool, noPack));
 }
 
+void DataSyncer::setCompression(bool compression)
+{
+    QMetaObject::invokeMethod(m_worker, "setCompression", Qt::AutoConnection, Q_ARG(bool, compression));
+}
+
 void DataSyncer::sync(const QDateTime &start)
 {
-    QMetaObject::invokeMethod(m_worker, "sync", Qt::AutoConnection, Q_ARG(QDateTime, start));
+    // Peer is synced directly, sync folder is used otherwise
+    if (!m_syncPeer.isEmpty()) {
+        QMetaObject::invokeMethod(m_networkWorker, "sync", Qt::AutoConnection);
+    } else {
+        QMetaObject::invokeMethod(m_worker, "sync", Qt::AutoConnection, Q_ARG(QDateTime, start));
+    }
 }
 
 void DataSyncer::syncError(const QString &errorText)
@@ -163,6 +298,26 @@ void DataSyncer::syncStopped()
     setIsRunning(false);
 }
 
+void DataSyncer::syncScheduleChanged(QDateTime nextSyncTime, int syncInterval)
+{
+    if (m_nextSyncTime != nextSyncTime) {
+        m_nextSyncTime = nextSyncTime;
+        emit nextSyncTimeChanged(m_nextSyncTime);
+    }
+
+    if (m_syncInterval != syncInterval) {
+        m_syncInterval = syncInterval;
+        emit syncIntervalChanged(m_syncInterval);
+    }
+}
+
+void DataSyncer::syncMetricsAvailable(QVariantMap metrics)
+{
+    m_lastSyncMetrics = metrics;
+
+    emit lastSyncMetricsChanged(m_lastSyncMetrics);
+}
+
 void DataSyncer::setIsRunning(bool isRunning)
 {
     if (m_isRunning == isRunning) {
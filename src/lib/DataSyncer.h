@@ -22,11 +22,13 @@
 #include <QObject>
 #include <QUrl>
 #include <QDateTime>
+#include <QVariantMap>
 
 class QThread;
 
 class TimeLogHistory;
 class DataSyncerWorker;
+class NetworkSyncerWorker;
 
 class DataSyncer : public QObject
 {
@@ -37,7 +39,16 @@ class DataSyncer : public QObject
     Q_PROPERTY(bool autoSync MEMBER m_autoSync WRITE setAutoSync NOTIFY autoSyncChanged)
     Q_PROPERTY(int syncCacheSize MEMBER m_syncCacheSize WRITE setSyncCacheSize NOTIFY syncCacheSizeChanged)
     Q_PROPERTY(int syncCacheTimeout MEMBER m_syncCacheTimeout WRITE setSyncCacheTimeout NOTIFY syncCacheTimeoutChanged)
+    Q_PROPERTY(int syncMaxLatency MEMBER m_syncMaxLatency WRITE setSyncMaxLatency NOTIFY syncMaxLatencyChanged)
     Q_PROPERTY(QUrl syncPath MEMBER m_syncPath WRITE setSyncPath NOTIFY syncPathChanged)
+    Q_PROPERTY(QString syncPeer MEMBER m_syncPeer WRITE setSyncPeer NOTIFY syncPeerChanged)
+    Q_PROPERTY(int syncServerPort MEMBER m_syncServerPort WRITE setSyncServerPort NOTIFY syncServerPortChanged)
+    Q_PROPERTY(QString syncServerAddress MEMBER m_syncServerAddress WRITE setSyncServerAddress NOTIFY syncServerAddressChanged)
+    Q_PROPERTY(QString syncToken MEMBER m_syncToken WRITE setSyncToken NOTIFY syncTokenChanged)
+    Q_PROPERTY(QDateTime nextSyncTime READ nextSyncTime NOTIFY nextSyncTimeChanged)
+    Q_PROPERTY(int syncInterval READ syncInterval NOTIFY syncIntervalChanged)
+    Q_PROPERTY(QString metricsLogPath MEMBER m_metricsLogPath WRITE setMetricsLogPath NOTIFY metricsLogPathChanged)
+    Q_PROPERTY(QVariantMap lastSyncMetrics READ lastSyncMetrics NOTIFY lastSyncMetricsChanged)
 public:
     explicit DataSyncer(TimeLogHistory *history, QObject *parent = 0);
     virtual ~DataSyncer();
@@ -46,12 +57,22 @@ public:
     void pack(const QDateTime &start = QDateTime::currentDateTimeUtc());
 
     bool isRunning() const;
+    QDateTime nextSyncTime() const;
+    int syncInterval() const;
+    QVariantMap lastSyncMetrics() const;
 
     void setAutoSync(bool autoSync);
     void setSyncCacheSize(int syncCacheSize);
     void setSyncCacheTimeout(int syncCacheTimeout);
+    void setSyncMaxLatency(int syncMaxLatency);
     void setSyncPath(const QUrl &syncPathUrl);
+    void setSyncPeer(const QString &syncPeer);
+    void setSyncServerPort(int syncServerPort);
+    void setSyncServerAddress(const QString &syncServerAddress);
+    void setSyncToken(const QString &syncToken);
+    void setMetricsLogPath(const QString &metricsLogPath);
     void setNoPack(bool noPack);
+    void setCompression(bool compression);
 
 signals:
     void isRunningChanged(bool newIsRunning) const;
@@ -60,7 +81,16 @@ signals:
     void autoSyncChanged(bool newAutoSync) const;
     void syncCacheSizeChanged(int newSyncCacheSize) const;
     void syncCacheTimeoutChanged(int newSyncCacheTimeout) const;
+    void syncMaxLatencyChanged(int newSyncMaxLatency) const;
+    void nextSyncTimeChanged(const QDateTime &newNextSyncTime) const;
+    void syncIntervalChanged(int newSyncInterval) const;
     void syncPathChanged(const QUrl &newSyncPath) const;
+    void syncPeerChanged(const QString &newSyncPeer) const;
+    void syncServerPortChanged(int newSyncServerPort) const;
+    void syncServerAddressChanged(const QString &newSyncServerAddress) const;
+    void syncTokenChanged(const QString &newSyncToken) const;
+    void metricsLogPathChanged(const QString &newMetricsLogPath) const;
+    void lastSyncMetricsChanged(const QVariantMap &newLastSyncMetrics) const;
     void error(const QString &errorText) const;
     void synced(QPrivateSignal);
 
@@ -72,6 +102,8 @@ private slots:
     void syncFinished();
     void syncStarted();
     void syncStopped();
+    void syncScheduleChanged(QDateTime nextSyncTime, int syncInterval);
+    void syncMetricsAvailable(QVariantMap metrics);
 
 private:
     void setIsRunning(bool isRunning);
@@ -81,9 +113,19 @@ private:
     bool m_autoSync;
     int m_syncCacheSize;
     int m_syncCacheTimeout;
+    int m_syncMaxLatency;
     QUrl m_syncPath;
+    QString m_syncPeer;
+    int m_syncServerPort;
+    QString m_syncServerAddress;
+    QString m_syncToken;
+    QDateTime m_nextSyncTime;
+    int m_syncInterval;
+    QString m_metricsLogPath;
+    QVariantMap m_lastSyncMetrics;
     QThread *m_thread;
     DataSyncerWorker *m_worker;
+    NetworkSyncerWorker *m_networkWorker;
 };
 
 #endif // DATASYNCER_H
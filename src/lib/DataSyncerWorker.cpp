@@ -21,8 +21,19 @@
 # include <Windows.h>
 #else
 # include <sys/time.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
 #endif
 #include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
 
 #include <QCoreApplication>
 #include <QStandardPaths>
@@ -32,12 +43,18 @@
 #include <QFinalState>
 #include <QTimer>
 #include <QFileSystemWatcher>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRunnable>
 
 #include <QLoggingCategory>
 
 #include "AbstractDataInOut.h"
 #include "DataSyncerWorker.h"
 #include "DBSyncer.h"
+#include "TimeLogHistoryClient.h"
+#include "TimeLogCategoryPool.h"
+#include "TimeLogTrace.h"
 
 #define fail(message) \
     do {    \
@@ -47,8 +64,22 @@
 
 Q_LOGGING_CATEGORY(SYNC_WORKER_CATEGORY, "DataSyncerWorker", QtInfoMsg)
 
-const qint32 syncFileFormatVersion = 1;
+const qint32 syncFileFormatVersion = 2;
+const qint32 legacySyncFileFormatVersion = 1;
 const qint32 syncFileStreamVersion = QDataStream::Qt_5_6;
+// Legacy files start with the big-endian stream version, so they never match
+const char syncFileMagic[] = "GTTS";
+const int syncFileMagicSize = 4;
+const quint8 syncFileCompressedFlag = 0x01;
+// Summary of the records goes before the chunks, so the file could be skipped without parsing it
+const quint8 syncFileSummaryFlag = 0x02;
+// Payload is framed into chunks, each one checked before it is decoded
+const int syncFileChunkSize = 64 * 1024;
+const int syncFileChunkChecksumSize = 4;
+// Compressed packs are split into blocks, so they could be streamed without loading whole file
+const char packFileMagic[] = "GTTP";
+const int packFileMagicSize = 4;
+const qint64 packBlockSize = 1024 * 1024;
 
 const int mTimeLength = QString::number(std::numeric_limits<qint64>::max()).length();
 const QString fileNamePattern = QString("(?<mTime>\\d{%1})-\\{[\\w-]+\\}").arg(mTimeLength);
@@ -59,15 +90,650 @@ const QRegularExpression syncFileNameRegexp(syncFileNamePattern);
 const QString packFileNamePattern = QString("^%1\\.pack$").arg(fileNamePattern);
 const QRegularExpression packFileNameRegexp(packFileNamePattern);
 
+// Delta packs hold the changes over the latest pack, in the sync file format
+const QString deltaFileNamePattern = QString("^%1\\.delta$").arg(fileNamePattern);
+const QRegularExpression deltaFileNameRegexp(deltaFileNamePattern);
+const int maxPackDeltas = 8;
+// Removed items are kept for this period before the pack, as devices could still be syncing the older data.
+// Older items are rejected by the DB, so a device, offline for longer, loses its unsynced changes before it.
+const int removedRetentionDays = 90;
+// Pack and DB have own worker threads, so next period is read while previous is written
+const int packSyncPrefetchDepth = 2;
+
+const qint32 manifestFormatVersion = 1;
+const qint64 manifestMTimeResolution = 2000;
+
 const int syncStartTimeout = 10;
 const int defaultSyncCacheSize = 10;
 const int fileWatchTimeout = 5;
 const int defaultSyncCacheTimeout = 3600;
+const int defaultSyncMaxLatency = 120;
+// Cycles are spaced by a multiple of the average cycle duration
+const int syncIntervalFactor = 10;
+// Metrics log is rotated to the single backup file
+const qint64 maxMetricsLogSize = 1024 * 1024;
+
+// Reflink or in-kernel copy, returns false if not supported for these files, caller falls back to QFile::copy()
+static bool kernelCopyFile(const QString &source, const QString &destination)
+{
+#ifdef __linux__
+    int sourceFd = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    if (sourceFd < 0) {
+        return false;
+    }
+
+    struct stat sourceStat;
+    if (fstat(sourceFd, &sourceStat) != 0) {
+        ::close(sourceFd);
+        return false;
+    }
+
+    QByteArray destinationName(QFile::encodeName(destination));
+    int destinationFd = ::open(destinationName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                               sourceStat.st_mode & 0777);
+    if (destinationFd < 0) {
+        ::close(sourceFd);
+        return false;
+    }
+
+    bool isOk = false;
+# ifdef FICLONE
+    // Copy-on-write clone takes constant time on btrfs, xfs and similar
+    isOk = ioctl(destinationFd, FICLONE, sourceFd) == 0;
+# endif
+# if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    if (!isOk) {
+        off_t remaining = sourceStat.st_size;
+        isOk = true;
+        while (remaining > 0) {
+            ssize_t copied = copy_file_range(sourceFd, NULL, destinationFd, NULL, remaining, 0);
+            if (copied <= 0) {
+                isOk = false;
+                break;
+            }
+            remaining -= copied;
+        }
+    }
+# endif
+
+    ::close(sourceFd);
+    if (::close(destinationFd) != 0) {
+        isOk = false;
+    }
+    if (!isOk) {
+        unlink(destinationName.constData());
+    }
+
+    return isOk;
+#else
+    Q_UNUSED(source)
+    Q_UNUSED(destination)
+
+    return false;
+#endif
+}
+
+// Makes the copied files durable, returns 0 or the errno of the first failure.
+// Each file is synced on its own, as syncfs() would also flush unrelated dirty data of the whole filesystem.
+static int syncFiles(const QString &dirPath, const QStringList &filePaths)
+{
+#ifdef WIN32
+    Q_UNUSED(dirPath)
+    Q_UNUSED(filePaths)
+
+    return 0;
+#else
+    int error = 0;
+    for (const QString &filePath: filePaths) {
+        int fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (!error) {
+                error = errno;
+            }
+            continue;
+        }
+        if (fsync(fd) != 0 && !error) {
+            error = errno;
+        }
+        ::close(fd);
+    }
+
+    // Directory entries of the new files
+    int dirFd = ::open(QFile::encodeName(dirPath).constData(), O_RDONLY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return error ? error : errno;
+    }
+    if (fsync(dirFd) != 0 && !error) {
+        error = errno;
+    }
+    ::close(dirFd);
+
+    return error;
+#endif
+}
+
+static void writeVarint(QByteArray &buffer, quint64 value)
+{
+    while (value >= 0x80) {
+        buffer.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buffer.append(static_cast<char>(value));
+}
+
+// Zigzag encoding keeps small negative deltas short
+static void writeSignedVarint(QByteArray &buffer, qint64 value)
+{
+    writeVarint(buffer, (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63));
+}
+
+static void writeBytes(QByteArray &buffer, const QByteArray &data)
+{
+    writeVarint(buffer, data.size());
+    buffer.append(data);
+}
+
+static std::array<quint32, 256> makeCrc32cTable()
+{
+    std::array<quint32, 256> table;
+    for (quint32 i = 0; i < 256; i++) {
+        quint32 value = i;
+        for (int bit = 0; bit < 8; bit++) {
+            value = (value >> 1) ^ (value & 1 ? 0x82f63b78 : 0);
+        }
+        table[i] = value;
+    }
+
+    return table;
+}
+
+// CRC-32C (Castagnoli)
+static quint32 crc32c(const uchar *data, qint64 size)
+{
+    static const std::array<quint32, 256> table = makeCrc32cTable();
+
+    quint32 crc = 0xffffffff;
+    for (const uchar *end = data + size; data != end; ++data) {
+        crc = table[(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+static quint64 uuidFingerprint(const QUuid &uuid)
+{
+    return (static_cast<quint64>(uuid.data1) << 32) | (static_cast<quint64>(uuid.data2) << 16) | uuid.data3;
+}
+
+// Chunk is written as the size, the stored data and the checksum of the stored data
+static void writeChunk(QByteArray &buffer, QByteArray &chunk, bool isCompressed)
+{
+    if (chunk.isEmpty()) {
+        return;
+    }
+
+    QByteArray data(isCompressed ? qCompress(chunk) : chunk);
+    writeVarint(buffer, data.size());
+    buffer.append(data);
+    quint32 checksum = crc32c(reinterpret_cast<const uchar *>(data.constData()), data.size());
+    for (int i = 0; i < syncFileChunkChecksumSize; i++) {
+        buffer.append(static_cast<char>((checksum >> (i * 8)) & 0xff));
+    }
+
+    chunk.clear();
+}
+
+// Reads the mapped file in place, any overrun marks the reader as failed.
+// In the chunked mode the next chunk is checked and loaded only when the current one is
+// exhausted, records never span the chunks.
+class SyncFileReader
+{
+public:
+    SyncFileReader(const uchar *data, qint64 size) :
+        m_data(data),
+        m_end(data + size),
+        m_isOk(true),
+        m_isCorrupted(false),
+        m_isChunked(false),
+        m_isCompressed(false),
+        m_isLastChunk(false),
+        m_next(nullptr),
+        m_fileEnd(nullptr)
+    {
+    }
+
+    // Rest of the data is read as chunks
+    void startChunks(bool isCompressed)
+    {
+        m_isChunked = true;
+        m_isCompressed = isCompressed;
+        m_next = m_data;
+        m_fileEnd = m_end;
+        m_end = m_data;
+    }
+
+    bool isOk() const
+    {
+        return m_isOk;
+    }
+
+    bool isCorrupted() const
+    {
+        return m_isCorrupted;
+    }
+
+    // Only the current chunk is counted in the chunked mode
+    qint64 bytesAvailable() const
+    {
+        return m_end - m_data;
+    }
+
+    bool atEnd()
+    {
+        if (m_data == m_end && m_isChunked && !m_isLastChunk) {
+            return !nextChunk() && m_isLastChunk;
+        }
+
+        return m_data == m_end && (!m_isChunked || m_isLastChunk);
+    }
+
+    quint8 readByte()
+    {
+        if (m_data == m_end && !nextChunk()) {
+            m_isOk = false;
+            return 0;
+        }
+
+        return *m_data++;
+    }
+
+    quint64 readVarint()
+    {
+        quint64 result = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            quint8 byte = readByte();
+            result |= static_cast<quint64>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return result;
+            }
+        }
+
+        m_isOk = false;
+        return 0;
+    }
+
+    qint64 readSignedVarint()
+    {
+        quint64 value = readVarint();
+        return static_cast<qint64>(value >> 1) ^ -static_cast<qint64>(value & 1);
+    }
+
+    // Data is valid while the file is mapped and until the next chunk is loaded
+    QByteArray readRawBytes()
+    {
+        quint64 size = readVarint();
+        if (size > static_cast<quint64>(m_end - m_data)) {
+            m_isOk = false;
+            return QByteArray();
+        }
+
+        QByteArray result(QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), static_cast<int>(size)));
+        m_data += size;
+
+        return result;
+    }
+
+    QString readString()
+    {
+        quint64 size = readVarint();
+        if (size > static_cast<quint64>(m_end - m_data)) {
+            m_isOk = false;
+            return QString();
+        } else if (!size) {
+            return QString();
+        }
+
+        QString result(QString::fromUtf8(reinterpret_cast<const char *>(m_data), static_cast<int>(size)));
+        m_data += size;
+
+        return result;
+    }
+
+    quint64 readFixed64()
+    {
+        quint64 result = 0;
+        for (int i = 0; i < 8; i++) {
+            result |= static_cast<quint64>(readByte()) << (i * 8);
+        }
+
+        return result;
+    }
+
+    QUuid readUuid()
+    {
+        if (m_end - m_data < 16) {
+            m_isOk = false;
+            return QUuid();
+        }
+
+        QUuid result(QUuid::fromRfc4122(QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), 16)));
+        m_data += 16;
+
+        return result;
+    }
+
+private:
+    bool nextChunk()
+    {
+        if (!m_isChunked || m_isLastChunk) {
+            return false;
+        }
+
+        SyncFileReader frame(m_next, m_fileEnd - m_next);
+        quint64 size = frame.readVarint();
+        if (!frame.isOk()) {
+            m_isOk = false;
+            return false;
+        }
+        m_next = frame.m_data;
+        if (!size) {
+            m_isLastChunk = true;
+            if (m_next != m_fileEnd) {
+                m_isOk = false;
+            }
+            return false;
+        }
+        if (size + syncFileChunkChecksumSize > static_cast<quint64>(m_fileEnd - m_next)) {
+            m_isOk = false;
+            return false;
+        }
+
+        const uchar *chunk = m_next;
+        m_next += size + syncFileChunkChecksumSize;
+        quint32 checksum = 0;
+        for (int i = 0; i < syncFileChunkChecksumSize; i++) {
+            checksum |= static_cast<quint32>(chunk[size + i]) << (i * 8);
+        }
+        if (crc32c(chunk, size) != checksum) {
+            m_isCorrupted = true;
+            m_isOk = false;
+            return false;
+        }
+
+        if (m_isCompressed) {
+            m_buffer = qUncompress(chunk, static_cast<int>(size));
+            if (m_buffer.isEmpty()) {
+                m_isOk = false;
+                return false;
+            }
+            m_data = reinterpret_cast<const uchar *>(m_buffer.constData());
+            m_end = m_data + m_buffer.size();
+        } else {
+            m_data = chunk;
+            m_end = chunk + size;
+        }
+
+        return true;
+    }
+
+    const uchar *m_data;
+    const uchar *m_end;
+    bool m_isOk;
+    bool m_isCorrupted;
+    bool m_isChunked;
+    bool m_isCompressed;
+    bool m_isLastChunk;
+    const uchar *m_next;
+    const uchar *m_fileEnd;
+    QByteArray m_buffer;
+};
+
+// Parsing does not touch the worker state, so it runs ahead of the DB on the thread pool
+class SyncFileParserTask : public QRunnable
+{
+public:
+    SyncFileParserTask(DataSyncerWorker *worker, int generation, int index, const QString &path) :
+        m_worker(worker),
+        m_generation(generation),
+        m_index(index),
+        m_path(path)
+    {
+    }
+
+    virtual void run()
+    {
+        QVector<TimeLogSyncDataEntry> updatedData, removedData;
+        QVector<TimeLogSyncDataCategory> categoryData;
+        // Error is reported by the worker in its own thread, empty if parsed
+        QString errorText;
+        m_worker->parseFile(m_path, updatedData, removedData, categoryData, errorText);
+
+        QMetaObject::invokeMethod(m_worker, "fileParsed", Qt::QueuedConnection,
+                                  Q_ARG(int, m_generation), Q_ARG(int, m_index), Q_ARG(QString, errorText),
+                                  Q_ARG(QVector<TimeLogSyncDataEntry>, updatedData),
+                                  Q_ARG(QVector<TimeLogSyncDataEntry>, removedData),
+                                  Q_ARG(QVector<TimeLogSyncDataCategory>, categoryData));
+    }
+
+private:
+    DataSyncerWorker *m_worker;
+    int m_generation;
+    int m_index;
+    QString m_path;
+};
+
+// Listing of the sync folder with the parsed file names, kept on disk between the syncs.
+// Folder is only listed again when its mtime changes, own changes are applied in place.
+class SyncFolderManifest
+{
+public:
+    enum FileKind {
+        OtherFile,
+        SyncFile,
+        PackFile,
+        DeltaFile
+    };
+
+    struct Item
+    {
+        qint64 size;
+        QDateTime lastModified;
+        QString mTime;
+        FileKind kind;
+    };
+
+    // Shared folder could be changed by other devices
+    explicit SyncFolderManifest(bool isShared) :
+        m_isShared(isShared),
+        m_isValid(false)
+    {
+    }
+
+    const QString &dirPath() const
+    {
+        return m_dirPath;
+    }
+
+    const QMap<QString, Item> &items() const
+    {
+        return m_items;
+    }
+
+    QSet<QString> fileNames() const
+    {
+        return m_items.keys().toSet();
+    }
+
+    void setPaths(const QString &path, const QString &manifestPath)
+    {
+        QString dirPath(QDir::cleanPath(QFileInfo(path).absoluteFilePath()));
+        if (m_dirPath == dirPath && m_manifestPath == manifestPath) {
+            return;
+        }
+
+        m_dirPath = dirPath;
+        m_manifestPath = manifestPath;
+        m_isValid = false;
+        m_items.clear();
+        load();
+    }
+
+    void invalidate()
+    {
+        m_isValid = false;
+    }
+
+    void refresh()
+    {
+        QDateTime dirMTime(QFileInfo(m_dirPath).lastModified());
+        if (m_isValid && dirMTime == m_dirMTime) {
+            return;
+        }
+
+        qCDebug(SYNC_WORKER_CATEGORY) << "Listing directory" << m_dirPath;
+
+        m_items.clear();
+        for (const QFileInfo &fileInfo: QDir(m_dirPath).entryInfoList(QDir::Files)) {
+            m_items.insert(fileInfo.fileName(), makeItem(fileInfo));
+        }
+        m_dirMTime = dirMTime;
+        m_isValid = isSettled(dirMTime);
+    }
+
+    void addFile(const QString &fileName)
+    {
+        QFileInfo fileInfo(QDir(m_dirPath).filePath(fileName));
+        if (fileInfo.exists()) {
+            m_items.insert(fileName, makeItem(fileInfo));
+        } else {
+            m_items.remove(fileName);
+        }
+        updateDirMTime();
+    }
+
+    void removeFile(const QString &fileName)
+    {
+        m_items.remove(fileName);
+        updateDirMTime();
+    }
+
+    // Own changes are already applied, foreign ones are caught by the watcher.
+    // Foreign file, added right after the own one, could leave the same mtime, so the shared folder is listed again.
+    void updateDirMTime()
+    {
+        if (m_isValid) {
+            m_dirMTime = QFileInfo(m_dirPath).lastModified();
+            m_isValid = !m_isShared || isSettled(m_dirMTime);
+        }
+    }
+
+    void save() const
+    {
+        if (m_manifestPath.isEmpty() || !QDir().mkpath(QFileInfo(m_manifestPath).path())) {
+            return;
+        }
+
+        QFile file(m_manifestPath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCWarning(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", file);
+            return;
+        }
+
+        QDataStream stream(&file);
+        stream.setVersion(syncFileStreamVersion);
+        stream << manifestFormatVersion << m_dirPath << (m_isValid ? m_dirMTime : QDateTime())
+               << static_cast<qint32>(m_items.size());
+        for (auto it = m_items.constBegin(); it != m_items.constEnd(); ++it) {
+            stream << it.key() << it->size << it->lastModified << it->mTime << static_cast<qint32>(it->kind);
+        }
+        if (stream.status() != QDataStream::Ok) {
+            qCWarning(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error writing to file", file);
+        }
+    }
+
+    static FileKind fileKind(const QString &fileName, QString *mTime = nullptr)
+    {
+        QRegularExpressionMatch match;
+        FileKind kind = OtherFile;
+        if ((match = syncFileNameRegexp.match(fileName)).hasMatch()) {
+            kind = SyncFile;
+        } else if ((match = packFileNameRegexp.match(fileName)).hasMatch()) {
+            kind = PackFile;
+        } else if ((match = deltaFileNameRegexp.match(fileName)).hasMatch()) {
+            kind = DeltaFile;
+        }
+        if (mTime) {
+            *mTime = kind != OtherFile ? match.captured("mTime") : QString();
+        }
+
+        return kind;
+    }
+
+private:
+
+    // Changes within the mtime resolution would not be noticed
+    static bool isSettled(const QDateTime &dirMTime)
+    {
+        return dirMTime.isValid() && dirMTime.msecsTo(QDateTime::currentDateTime()) > manifestMTimeResolution;
+    }
+
+    static Item makeItem(const QFileInfo &fileInfo)
+    {
+        Item item;
+        item.size = fileInfo.size();
+        item.lastModified = fileInfo.lastModified();
+        item.kind = fileKind(fileInfo.fileName(), &item.mTime);
+
+        return item;
+    }
+
+    void load()
+    {
+        QFile file(m_manifestPath);
+        if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+
+        QDataStream stream(&file);
+        stream.setVersion(syncFileStreamVersion);
+        qint32 version, count;
+        QString dirPath;
+        stream >> version;
+        if (version != manifestFormatVersion) {
+            return;
+        }
+        stream >> dirPath >> m_dirMTime >> count;
+        if (dirPath != m_dirPath) {
+            return;
+        }
+        for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+            QString fileName;
+            Item item;
+            qint32 kind;
+            stream >> fileName >> item.size >> item.lastModified >> item.mTime >> kind;
+            item.kind = static_cast<FileKind>(kind);
+            m_items.insert(fileName, item);
+        }
+
+        m_isValid = stream.status() == QDataStream::Ok && m_dirMTime.isValid();
+        if (!m_isValid) {
+            m_items.clear();
+        }
+    }
+
+    const bool m_isShared;
+    QString m_dirPath;
+    QString m_manifestPath;
+    QDateTime m_dirMTime;
+    bool m_isValid;
+    QMap<QString, Item> m_items;
+};
 
 DataSyncerWorker::DataSyncerWorker(TimeLogHistory *db, QObject *parent) :
     QObject(parent),
     m_isInitialized(false),
     m_db(db),
+    m_dbClient(new TimeLogHistoryClient(db, this)),
     m_sm(new QStateMachine(this)),
     m_exportState(new QState()),
     m_syncFoldersState(new QState()),
@@ -80,16 +746,32 @@ DataSyncerWorker::DataSyncerWorker(TimeLogHistory *db, QObject *parent) :
     m_autoSync(true),
     m_syncCacheSize(defaultSyncCacheSize),
     m_noPack(false),
+    m_isCompression(false),
     m_syncStartTimer(new QTimer(this)),
     m_syncWatcher(new QFileSystemWatcher(this)),
     m_syncWatcherTimer(new QTimer(this)),
     m_syncCacheTimeout(defaultSyncCacheTimeout),
     m_syncCacheTimer(new QTimer(this)),
+    m_syncMaxLatency(defaultSyncMaxLatency),
+    m_syncInterval(syncStartTimeout * 1000),
+    m_syncDuration(0),
+    m_isSyncPending(false),
+    m_syncPhaseName(Q_NULLPTR),
+    m_syncPhaseTraceBegin(-1),
     m_cachedSyncChanges(0),
+    m_currentIndex(0),
+    m_parseIndex(0),
+    m_parseGeneration(0),
+    m_isMergedSyncing(false),
+    m_mergedFilesCount(0),
     m_wroteToExternalSync(false),
     m_dbSyncer(nullptr),
     m_pack(nullptr),
-    m_forcePack(false)
+    m_forcePack(false),
+    m_isPackCompaction(false),
+    m_isCollectingPackChanges(false),
+    m_internalManifest(new SyncFolderManifest(false)),
+    m_externalManifest(new SyncFolderManifest(true))
 {
     m_exportState->addTransition(this, SIGNAL(exported()), m_syncFoldersState);
     m_syncFoldersState->addTransition(this, SIGNAL(foldersSynced()), m_importState);
@@ -120,9 +802,11 @@ DataSyncerWorker::DataSyncerWorker(TimeLogHistory *db, QObject *parent) :
     connect(m_sm, SIGNAL(stopped()), this, SIGNAL(stopped()));
     connect(m_sm, SIGNAL(stopped()), this, SLOT(cleanState()));
     connect(m_sm, SIGNAL(finished()), this, SLOT(cleanState()));
+    connect(m_sm, SIGNAL(started()), this, SLOT(syncCycleStarted()));
+    connect(m_sm, SIGNAL(stopped()), this, SLOT(syncCycleStopped()));
+    connect(m_sm, SIGNAL(finished()), this, SLOT(syncCycleFinished()));
 
     m_syncStartTimer->setTimerType(Qt::VeryCoarseTimer);
-    m_syncStartTimer->setInterval(syncStartTimeout * 1000);
     m_syncStartTimer->setSingleShot(true);
     connect(m_syncStartTimer, SIGNAL(timeout()), this, SLOT(sync()));
     connect(m_sm, SIGNAL(started()), m_syncStartTimer, SLOT(stop()));
@@ -137,7 +821,7 @@ DataSyncerWorker::DataSyncerWorker(TimeLogHistory *db, QObject *parent) :
     m_syncCacheTimer->setTimerType(Qt::VeryCoarseTimer);
     m_syncCacheTimer->setInterval(m_syncCacheTimeout * 1000);
     m_syncCacheTimer->setSingleShot(true);
-    connect(m_syncCacheTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    connect(m_syncCacheTimer, SIGNAL(timeout()), this, SLOT(scheduleUrgentSync()));
     connect(m_sm, SIGNAL(started()), m_syncCacheTimer, SLOT(stop()));
 
     connect(m_db, SIGNAL(error(QString)),
@@ -148,48 +832,42 @@ DataSyncerWorker::DataSyncerWorker(TimeLogHistory *db, QObject *parent) :
             this, SLOT(historyDataInserted(TimeLogEntry)));
     connect(m_db, SIGNAL(dataRemoved(TimeLogEntry)),
             this, SLOT(historyDataRemoved(TimeLogEntry)));
+    connect(m_db, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+            this, SLOT(historyDataBatchRemoved(QVector<TimeLogEntry>)));
     connect(m_db, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
             this, SLOT(historyCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
-    connect(m_db, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
-                                           QVector<TimeLogSyncDataCategory>,QDateTime)),
+    connect(m_dbClient, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                                 QVector<TimeLogSyncDataCategory>,QDateTime)),
             this, SLOT(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
                                          QVector<TimeLogSyncDataCategory>,QDateTime)));
     connect(m_db, SIGNAL(syncExistsAvailable(bool,QDateTime,QDateTime)),
             this, SLOT(syncExistsAvailable(bool,QDateTime,QDateTime)));
     connect(m_db, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)),
             this, SLOT(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)));
-    connect(m_db, SIGNAL(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>)),
-            this, SLOT(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>)));
-    connect(m_db, SIGNAL(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>)),
-            this, SLOT(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>)));
-    connect(m_db, SIGNAL(dataSynced(QDateTime)),
+    connect(m_db, SIGNAL(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)),
+            this, SLOT(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)));
+    connect(m_db, SIGNAL(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)),
+            this, SLOT(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)));
+    connect(m_dbClient, SIGNAL(dataSynced(QDateTime)),
             this, SLOT(syncDataSynced(QDateTime)));
 }
 
+DataSyncerWorker::~DataSyncerWorker()
+{
+    // Queued tasks are dropped, running ones still use the worker
+    m_parseThreadPool.clear();
+    m_parseThreadPool.waitForDone();
+
+    delete m_internalManifest;
+    delete m_externalManifest;
+}
+
 void DataSyncerWorker::init(const QString &dataPath)
 {
     m_internalSyncPath = QString("%1/sync").arg(!dataPath.isEmpty() ? dataPath
                                                                     : QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    m_internalManifest->setPaths(m_internalSyncPath,
+                                 QDir(m_internalSyncPath).filePath("manifest/internal.manifest"));
 
     m_isInitialized = true;
 }
@@ -207,6 +885,8 @@ void DataSyncerWorker::pack(const QDateTime &start)
     }
 
     m_currentSyncPath = m_externalSyncPath;
+    m_externalManifest->setPaths(m_currentSyncPath,
+                                 QDir(m_internalSyncPath).filePath("manifest/external.manifest"));
     m_syncStart = start;
 
     m_packSM->start();
@@ -226,6 +906,9 @@ void DataSyncerWorker::setAutoSync(bool autoSync)
         m_syncStartTimer->stop();
         m_syncCacheTimer->stop();
         m_syncWatcherTimer->stop();
+        m_syncPendingTimer.invalidate();
+        m_isSyncPending = false;
+        notifySyncSchedule();
     }
 }
 
@@ -257,7 +940,7 @@ void DataSyncerWorker::setSyncCacheTimeout(int syncCacheTimeout)
     if (m_syncCacheTimer->isActive()) {
         qint64 elapsedTime = m_syncCacheTimer->interval() - m_syncCacheTimer->remainingTime();
         if (elapsedTime > m_syncCacheTimeout * 1000) {
-            sync();
+            scheduleSync(true);
         } else {
             m_syncCacheTimer->setInterval(m_syncCacheTimeout * 1000 - elapsedTime);
         }
@@ -266,6 +949,27 @@ void DataSyncerWorker::setSyncCacheTimeout(int syncCacheTimeout)
     }
 }
 
+void DataSyncerWorker::setSyncMaxLatency(int syncMaxLatency)
+{
+    if (m_syncMaxLatency == syncMaxLatency) {
+        return;
+    }
+
+    m_syncMaxLatency = syncMaxLatency;
+    m_syncInterval = qMin(m_syncInterval, qMax<qint64>(m_syncMaxLatency * 1000, 0));
+
+    if (m_syncStartTimer->isActive()) {
+        scheduleSync();
+    } else {
+        notifySyncSchedule();
+    }
+}
+
+void DataSyncerWorker::setMetricsLogPath(const QString &path)
+{
+    m_metricsLogPath = path;
+}
+
 void DataSyncerWorker::setSyncPath(const QString &path)
 {
     if (m_externalSyncPath == path) {
@@ -302,6 +1006,11 @@ void DataSyncerWorker::setNoPack(bool noPack)
     m_noPack = noPack;
 }
 
+void DataSyncerWorker::setCompression(bool compression)
+{
+    m_isCompression = compression;
+}
+
 void DataSyncerWorker::sync(const QDateTime &start)
 {
     Q_ASSERT(m_isInitialized);
@@ -315,6 +1024,8 @@ void DataSyncerWorker::sync(const QDateTime &start)
     }
 
     m_currentSyncPath = m_externalSyncPath;
+    m_externalManifest->setPaths(m_currentSyncPath,
+                                 QDir(m_internalSyncPath).filePath("manifest/external.manifest"));
     m_syncStart = start;
     qCInfo(SYNC_WORKER_CATEGORY) << "Syncing with folder" << m_currentSyncPath;
 
@@ -366,6 +1077,15 @@ void DataSyncerWorker::historyDataRemoved(const TimeLogEntry &data)
     addCachedSyncChange();
 }
 
+void DataSyncerWorker::historyDataBatchRemoved(QVector<TimeLogEntry> data)
+{
+    if (m_sm->isRunning()) {
+        return;
+    }
+
+    addCachedSyncChange(data.size());
+}
+
 void DataSyncerWorker::historyCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode> categories)
 {
     Q_UNUSED(categories)
@@ -421,7 +1141,7 @@ void DataSyncerWorker::syncAmountAvailable(qlonglong size, QDateTime maxMTime, Q
         if (m_autoSync && !m_externalSyncPath.isEmpty() && m_syncCacheTimeout > 0 && !maxMTime.isNull()
             && (elapsedTime = maxMTime.msecsTo(QDateTime::currentDateTimeUtc())) >= m_syncCacheTimeout * 1000
             && !m_syncCacheTimer->isActive()) {
-        sync();
+        scheduleSync(true);
     } else {
             if (m_autoSync && !m_externalSyncPath.isEmpty() && m_syncCacheTimeout > 0 && elapsedTime > 0
                 && (!m_syncCacheTimer->isActive()
@@ -432,74 +1152,149 @@ void DataSyncerWorker::syncAmountAvailable(qlonglong size, QDateTime maxMTime, Q
     }
 }
 
-void DataSyncerWorker::syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry> removedOld,
-                                               QVector<TimeLogSyncDataEntry> removedNew,
-                                               QVector<TimeLogSyncDataEntry> insertedOld,
-                                               QVector<TimeLogSyncDataEntry> insertedNew,
-                                               QVector<TimeLogSyncDataEntry> updatedOld,
-                                               QVector<TimeLogSyncDataEntry> updatedNew) const
+void DataSyncerWorker::syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes) const
 {
+    addMetric(!m_packSM->isRunning() && !m_pack ? "recordsApplied" : "packRecordsApplied",
+              changes->removedNew.size() + changes->insertedNew.size() + changes->updatedNew.size());
+
+    if (!SYNC_WORKER_CATEGORY().isDebugEnabled()) {
+        return;
+    }
+
     qCDebug(SYNC_WORKER_CATEGORY) << (!m_packSM->isRunning() ? "Import details:" : "Pack details:");
-    for (int i = 0; i < removedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(removedOld.at(i), removedNew.at(i));
+    for (int i = 0; i < changes->removedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(changes->removedOld.at(i),
+                                                               changes->removedNew.at(i));
     }
-    for (int i = 0; i < insertedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(insertedOld.at(i), insertedNew.at(i));
+    for (int i = 0; i < changes->insertedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(changes->insertedOld.at(i),
+                                                               changes->insertedNew.at(i));
     }
-    for (int i = 0; i < updatedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(updatedOld.at(i), updatedNew.at(i));
+    for (int i = 0; i < changes->updatedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncEntryChange(changes->updatedOld.at(i),
+                                                               changes->updatedNew.at(i));
     }
 }
 
-void DataSyncerWorker::syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory> removedOld,
-                                                  QVector<TimeLogSyncDataCategory> removedNew,
-                                                  QVector<TimeLogSyncDataCategory> addedOld,
-                                                  QVector<TimeLogSyncDataCategory> addedNew,
-                                                  QVector<TimeLogSyncDataCategory> updatedOld,
-                                                  QVector<TimeLogSyncDataCategory> updatedNew) const
+void DataSyncerWorker::syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes) const
 {
+    addMetric(!m_packSM->isRunning() && !m_pack ? "recordsApplied" : "packRecordsApplied",
+              changes->removedNew.size() + changes->addedNew.size() + changes->updatedNew.size());
+
+    if (!SYNC_WORKER_CATEGORY().isDebugEnabled()) {
+        return;
+    }
+
     qCDebug(SYNC_WORKER_CATEGORY) << (!m_packSM->isRunning() ? "Import details:" : "Pack details:");
-    for (int i = 0; i < removedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(removedOld.at(i), removedNew.at(i));
+    for (int i = 0; i < changes->removedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(changes->removedOld.at(i),
+                                                                  changes->removedNew.at(i));
     }
-    for (int i = 0; i < addedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(addedOld.at(i), addedNew.at(i));
+    for (int i = 0; i < changes->addedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(changes->addedOld.at(i),
+                                                                  changes->addedNew.at(i));
     }
-    for (int i = 0; i < updatedNew.size(); i++) {
-        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(updatedOld.at(i), updatedNew.at(i));
+    for (int i = 0; i < changes->updatedNew.size(); i++) {
+        qCDebug(SYNC_WORKER_CATEGORY) << formatSyncCategoryChange(changes->updatedOld.at(i),
+                                                                  changes->updatedNew.at(i));
     }
 }
 
-void DataSyncerWorker::syncDataSynced(const QDateTime &maxSyncDate)
+void DataSyncerWorker::packEntryChangesAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes)
 {
-    Q_UNUSED(maxSyncDate)
-
-    if (!m_importState->active() || m_pack /* import from pack */) {
+    if (!m_isCollectingPackChanges) {
         return;
     }
 
-    qCInfo(SYNC_WORKER_CATEGORY) << "Successfully imported file" << m_fileList.at(m_currentIndex);
-
-    processCurrentItemImported();
+    m_packEntryChanges.append(changes->removedNew);
+    m_packEntryChanges.append(changes->insertedNew);
+    m_packEntryChanges.append(changes->updatedNew);
 }
 
-void DataSyncerWorker::syncFinished()
+void DataSyncerWorker::packCategoryChangesAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes)
 {
-    if (!m_noPack) {
-        packSync();
-    } else {
-        emit dirsSynced(QPrivateSignal());
+    if (!m_isCollectingPackChanges) {
+        return;
     }
+
+    m_packCategoryChanges.append(changes->removedNew);
+    m_packCategoryChanges.append(changes->addedNew);
+    m_packCategoryChanges.append(changes->updatedNew);
 }
 
-void DataSyncerWorker::packImported(QDateTime latestMTime)
+void DataSyncerWorker::packDeltasApplied()
 {
-    Q_UNUSED(latestMTime)
+    disconnect(m_pack, SIGNAL(dataSynced(QDateTime)), this, SLOT(packDeltasApplied()));
 
-    delete m_dbSyncer;
-    m_dbSyncer = nullptr;
-    m_pack->deinit();
-    delete m_pack;
+    startPackSync();
+}
+
+void DataSyncerWorker::syncDataSynced(const QDateTime &maxSyncDate)
+{
+    Q_UNUSED(maxSyncDate)
+
+    if (!m_importState->active() || m_pack /* import from pack */) {
+        return;
+    }
+
+    qCInfo(SYNC_WORKER_CATEGORY) << QString("Successfully imported %1 files").arg(m_mergedFilesCount);
+
+    m_isMergedSyncing = false;
+    m_mergedFilesCount = 0;
+    m_mergedEntries.clear();
+    m_mergedCategories.clear();
+
+    importCurrentItem();
+}
+
+void DataSyncerWorker::fileParsed(int generation, int index, QString errorText,
+                                  QVector<TimeLogSyncDataEntry> updatedData,
+                                  QVector<TimeLogSyncDataEntry> removedData,
+                                  QVector<TimeLogSyncDataCategory> categoryData)
+{
+    // Results of the interrupted sync
+    if (generation != m_parseGeneration || !m_importState->active()) {
+        return;
+    }
+
+    if (!errorText.isEmpty()) {
+        fail(errorText);
+        return;
+    }
+
+    addMetric("filesRead", 1);
+    addMetric("bytesRead", QFileInfo(m_fileList.at(index)).size());
+
+    SyncFileData &fileData = m_parsedFiles[index];
+    fileData.updatedData = updatedData;
+    fileData.removedData = removedData;
+    fileData.categoryData = categoryData;
+
+    if (index == m_currentIndex && !m_isMergedSyncing) {
+        importCurrentItem();
+    }
+}
+
+void DataSyncerWorker::syncFinished()
+{
+    startPhase("pack");
+
+    if (!m_noPack) {
+        packSync();
+    } else {
+        emit dirsSynced(QPrivateSignal());
+    }
+}
+
+void DataSyncerWorker::packImported(QDateTime latestMTime)
+{
+    Q_UNUSED(latestMTime)
+
+    addMetric("hashesTime", m_dbSyncer->hashesTime());
+    delete m_dbSyncer;
+    m_dbSyncer = nullptr;
+    m_pack->deinit();
+    delete m_pack;
     m_pack = nullptr;
 
     qCInfo(SYNC_WORKER_CATEGORY) << "Successfully imported pack" << m_fileList.at(m_currentIndex);
@@ -509,6 +1304,9 @@ void DataSyncerWorker::packImported(QDateTime latestMTime)
 
 void DataSyncerWorker::packExported(QDateTime latestMTime)
 {
+    m_isCollectingPackChanges = false;
+
+    addMetric("hashesTime", m_dbSyncer->hashesTime());
     delete m_dbSyncer;
     m_dbSyncer = nullptr;
     m_pack->deinit();
@@ -523,21 +1321,35 @@ void DataSyncerWorker::packExported(QDateTime latestMTime)
             fail(tr("Fail to remove file %1").arg(packDir.filePath("pack.pack")));
             return;
         }
+    } else if (!m_isPackCompaction && qMax(latestMTime, m_packMTime) > packBaseMTime()) {
+        if (!packDir.remove("pack.pack")) {
+            fail(tr("Fail to remove file %1").arg(packDir.filePath("pack.pack")));
+            return;
+        }
+        m_packMTime = qMax(latestMTime, m_packMTime);
+        if (!exportPackDelta()) {
+            return;
+        }
     } else {
-        const QDateTime &mTime = qMax(latestMTime, m_packMTime);
-        QString mTimeString = QString("%1").arg(mTime.toMSecsSinceEpoch(), mTimeLength, 10, QChar('0'));
+        m_packMTime = qMax(latestMTime, m_packMTime);
+        QString mTimeString = QString("%1").arg(m_packMTime.toMSecsSinceEpoch(), mTimeLength, 10, QChar('0'));
         m_packName = QString("%1-%2.pack").arg(mTimeString).arg(QUuid::createUuid().toString());
         if (!copyFile(packDir.filePath("pack.pack"), m_internalSyncDir.filePath(m_packName), true, true)) {
             return;
         }
-        if (!copyFile(m_internalSyncDir.filePath(m_packName), QDir(m_currentSyncPath).filePath(m_packName), true, false)) {
+        if (!copyFile(m_internalSyncDir.filePath(m_packName), QDir(m_currentSyncPath).filePath(m_packName),
+                      true, false, true)) {
             return;
         }
         m_wroteToExternalSync = true;
         qCInfo(SYNC_WORKER_CATEGORY) << "Successfully written pack" << m_internalSyncDir.filePath(m_packName);
     }
 
-    if (removeOldFiles(m_packName)) {
+    if (removeOldFiles(m_packName, m_packMTime)) {
+        if (!m_sm->isRunning()) {
+            m_internalManifest->save();
+            m_externalManifest->save();
+        }
         qCInfo(SYNC_WORKER_CATEGORY) << "Successfully packed";
         emit dirsSynced(QPrivateSignal());
     }
@@ -545,6 +1357,8 @@ void DataSyncerWorker::packExported(QDateTime latestMTime)
 
 void DataSyncerWorker::startImport()
 {
+    startPhase("import");
+
     m_fileList = AbstractDataInOut::buildFileList(m_internalSyncDir.filePath("incoming"));
     if (m_fileList.isEmpty()) {
         qCInfo(SYNC_WORKER_CATEGORY) << "No files to import";
@@ -555,29 +1369,34 @@ void DataSyncerWorker::startImport()
     std::sort(m_fileList.begin(), m_fileList.end());
     std::reverse(m_fileList.begin(), m_fileList.end());
     m_currentIndex = 0;
+    m_parseIndex = 0;
+    ++m_parseGeneration;
+    m_parsedFiles.clear();
+    m_fileSummaries.clear();
+    parseFiles();
     importCurrentItem();
 }
 
 void DataSyncerWorker::startExport()
 {
+    startPhase("export");
+
     if (!AbstractDataInOut::prepareDir(m_internalSyncPath, m_internalSyncDir)) {
         fail(tr("Fail to prepare directory %1").arg(m_internalSyncPath));
         return;
     }
 
-    QStringList fileList = AbstractDataInOut::buildFileList(m_internalSyncPath);
+    m_internalManifest->refresh();
+    const QMap<QString, SyncFolderManifest::Item> &items = m_internalManifest->items();
     QString mTimeString;
-    std::sort(fileList.begin(), fileList.end());
-    for (QList<QString>::const_reverse_iterator it = fileList.crbegin(); it != fileList.crend(); it++) {
-        QString fileName = QFileInfo(*it).fileName();
-        QRegularExpressionMatch match;
-        if (!(match = syncFileNameRegexp.match(fileName)).hasMatch()
-            && !(match = packFileNameRegexp.match(fileName)).hasMatch()) {
-            qCInfo(SYNC_WORKER_CATEGORY) << "Skipping file not matching patterns" << fileName;
+    for (auto it = items.constEnd(); it != items.constBegin(); ) {
+        --it;
+        if (it->kind == SyncFolderManifest::OtherFile) {
+            qCInfo(SYNC_WORKER_CATEGORY) << "Skipping file not matching patterns" << it.key();
             continue;
         }
 
-        mTimeString = match.captured("mTime");
+        mTimeString = it->mTime;
         break;
     }
 
@@ -588,17 +1407,19 @@ void DataSyncerWorker::startExport()
         QDateTime::fromMSecsSinceEpoch(0, Qt::UTC);
     }
 
-    m_db->getSyncData(mFrom);
+    m_dbClient->getSyncData(mFrom);
 }
 
 void DataSyncerWorker::syncFolders()
 {
+    startPhase("folders");
+
     compareWithDir(m_currentSyncPath);
 
     qCDebug(SYNC_WORKER_CATEGORY) << "Out files:" << m_outFiles;
     qCDebug(SYNC_WORKER_CATEGORY) << "In files:" << m_inFiles;
 
-    if (!copyFiles(m_internalSyncDir.path(), m_currentSyncPath, m_outFiles, false)
+    if (!copyFiles(m_internalSyncDir.path(), m_currentSyncPath, m_outFiles, false, true)
         || !copyFiles(m_currentSyncPath, m_internalSyncDir.filePath("incoming"), m_inFiles, false)) {
         return;
     }
@@ -613,19 +1434,19 @@ void DataSyncerWorker::syncFolders()
 
 void DataSyncerWorker::packSync()
 {
-    QStringList fileList = AbstractDataInOut::buildFileList(m_internalSyncPath);
-    std::reverse(fileList.begin(), fileList.end());
+    if (!m_sm->isRunning()) {   // Standalone pack, folder was not listed by the sync
+        m_internalManifest->refresh();
+    }
+    const QMap<QString, SyncFolderManifest::Item> &items = m_internalManifest->items();
 
-    // TODO: refactor to std::find_if when buildFileList() would return QFileInfoList
     QString packName;
-    auto it = fileList.cbegin();
-    while (it != fileList.cend()) {
-        QString fileName = QFileInfo(*it).fileName();
-        if (packFileNameRegexp.match(fileName).hasMatch()) {
-            packName = fileName;
+    QString lastMTimeString;
+    for (auto it = items.constEnd(); it != items.constBegin(); ) {
+        --it;
+        if (it->kind == SyncFolderManifest::PackFile) {
+            packName = it.key();
+            lastMTimeString = it->mTime;
             break;
-        } else {
-            ++it;
         }
     }
 
@@ -636,17 +1457,27 @@ void DataSyncerWorker::packSync()
 
     if (!packName.isEmpty()) {
         if (m_packName != packName) {
-            QString lastMTimeString = packFileNameRegexp.match(packName).captured("mTime");
             if (lastMTimeString > packMTimeString) {    // Use pack with latest mTime
                 m_packName = packName;
                 packMTimeString = lastMTimeString;
             }
         }
-        m_packMTime = QDateTime::fromMSecsSinceEpoch(packMTimeString.toLongLong(), Qt::UTC);
     } else {
-        m_packMTime = QDateTime::fromMSecsSinceEpoch(0, Qt::UTC);
+        packMTimeString.clear();
+    }
+
+    // Deltas up to the pack mtime are already merged into it
+    m_packDeltas.clear();
+    QString layerMTimeString(packMTimeString);
+    for (auto it = items.constBegin(); it != items.constEnd(); ++it) {
+        if (it->kind == SyncFolderManifest::DeltaFile && it->mTime > packMTimeString) {
+            m_packDeltas.append(it.key());
+            layerMTimeString = qMax(layerMTimeString, it->mTime);
+        }
     }
 
+    m_packMTime = QDateTime::fromMSecsSinceEpoch(layerMTimeString.toLongLong(), Qt::UTC);
+
     QDateTime packPeriodStart(maxPackPeriodStart());
     if (m_forcePack) {
         exportPack();
@@ -659,6 +1490,8 @@ void DataSyncerWorker::packSync()
 
 void DataSyncerWorker::updateTimestamp()
 {
+    startPhase("timestamp");
+
     if (m_wroteToExternalSync) {
         qCDebug(SYNC_WORKER_CATEGORY) << "Wrote to sync folder, updating mtime";
 #ifndef WIN32
@@ -689,8 +1522,12 @@ void DataSyncerWorker::updateTimestamp()
             fail(tr("Fail to update directory timestamp"));
             return;
         }
+        m_internalManifest->updateDirMTime();
     }
 
+    m_internalManifest->save();
+    m_externalManifest->save();
+
     emit synced(QPrivateSignal());
 }
 
@@ -698,6 +1535,12 @@ void DataSyncerWorker::cleanState()
 {
     m_fileList.clear();
     m_currentIndex = 0;
+    m_parseIndex = 0;
+    m_parsedFiles.clear();
+    m_isMergedSyncing = false;
+    m_mergedFilesCount = 0;
+    m_mergedEntries.clear();
+    m_mergedCategories.clear();
     m_outFiles.clear();
     m_inFiles.clear();
     m_cachedSyncChanges = 0;
@@ -717,6 +1560,11 @@ void DataSyncerWorker::cleanState()
     m_packName.clear();
     m_packMTime = QDateTime();
     m_forcePack = false;
+    m_packDeltas.clear();
+    m_isPackCompaction = false;
+    m_isCollectingPackChanges = false;
+    m_packEntryChanges.clear();
+    m_packCategoryChanges.clear();
 }
 
 void DataSyncerWorker::checkSyncFolder()
@@ -729,7 +1577,7 @@ void DataSyncerWorker::checkSyncFolder()
         qCDebug(SYNC_WORKER_CATEGORY) << "Sync folder is newer, sync needed"
                                       << dataDirInfo.lastModified() << syncDirInfo.lastModified();
         if (m_autoSync) {
-            sync();
+            scheduleSync();
         }
     } else {
         m_db->getSyncAmount(dataDirInfo.lastModified().addMSecs(1));
@@ -740,22 +1588,140 @@ void DataSyncerWorker::syncWatcherEvent(const QString &path)
 {
     qCDebug(SYNC_WORKER_CATEGORY) << "Event for sync directory" << path;
 
-    if (m_autoSync) {
+    m_externalManifest->invalidate();
+
+    // Don't restart the timer, so a steady stream of events could not postpone the check
+    if (m_autoSync && !m_syncWatcherTimer->isActive()) {
         m_syncWatcherTimer->start();
     }
 }
 
+void DataSyncerWorker::syncCycleStarted()
+{
+    m_syncPendingTimer.invalidate();
+    m_syncCycleTimer.start();
+
+    m_syncMetrics.clear();
+    m_syncMetrics.insert("start", QDateTime::currentDateTimeUtc());
+    m_syncPhase.clear();
+    m_syncPhaseName = Q_NULLPTR;
+
+    notifySyncSchedule();
+}
+
+void DataSyncerWorker::syncCycleStopped()
+{
+    m_syncMetrics.insert("isFailed", true);
+
+    syncCycleFinished();
+}
+
+void DataSyncerWorker::syncCycleFinished()
+{
+    if (!m_syncCycleTimer.isValid()) {
+        return;
+    }
+
+    qint64 duration = m_syncCycleTimer.elapsed();
+    m_syncCycleTimer.invalidate();
+
+    startPhase(Q_NULLPTR);
+    m_syncMetrics.insert("totalTime", duration);
+    qint64 recordsReceived = m_syncMetrics.value("recordsReceived").toLongLong();
+    m_syncMetrics.insert("conflictsDiscarded",
+                         qMax<qint64>(0, recordsReceived - m_syncMetrics.value("recordsApplied").toLongLong()));
+    if (!m_syncMetrics.contains("isFailed")) {
+        m_syncMetrics.insert("isFailed", false);
+    }
+    qCInfo(SYNC_WORKER_CATEGORY) << "Sync metrics:" << m_syncMetrics;
+    writeMetricsLog(m_syncMetrics);
+    emit syncMetricsAvailable(m_syncMetrics);
+    m_syncDuration = m_syncDuration ? (3 * m_syncDuration + duration) / 4 : duration;
+    m_syncInterval = qBound<qint64>(syncStartTimeout * 1000, syncIntervalFactor * m_syncDuration,
+                                    qMax(m_syncMaxLatency, syncStartTimeout) * 1000);
+    m_lastSyncTimer.start();
+
+    qCDebug(SYNC_WORKER_CATEGORY) << "Sync cycle took" << duration << "ms, sync interval" << m_syncInterval;
+
+    if (m_isSyncPending) {
+        m_isSyncPending = false;
+        // Deferred sync could not be started from the handler of the finished state machine
+        QMetaObject::invokeMethod(this, "checkSyncFolder", Qt::QueuedConnection);
+    } else {
+        notifySyncSchedule();
+    }
+}
+
+// Time of the previous phase is added to the "<phase>Time" metric, null phase just stops the timer
+void DataSyncerWorker::startPhase(const char *phase)
+{
+    if (!m_syncPhase.isEmpty()) {
+        addMetric(QString("%1Time").arg(m_syncPhase), m_syncPhaseTimer.elapsed());
+#ifndef TIMELOG_NO_TRACE
+        if (m_syncPhaseTraceBegin >= 0) {
+            TimeLogTrace::complete("sync", m_syncPhaseName, m_syncPhaseTraceBegin, TimeLogTrace::timestamp());
+        }
+#endif
+    }
+
+    m_syncPhase = QString::fromLatin1(phase);
+    m_syncPhaseName = phase;
+    m_syncPhaseTraceBegin = TimeLogTrace::isEnabled() ? TimeLogTrace::timestamp() : -1;
+    m_syncPhaseTimer.start();
+}
+
+void DataSyncerWorker::addMetric(const QString &name, qint64 value) const
+{
+    m_syncMetrics.insert(name, m_syncMetrics.value(name).toLongLong() + value);
+}
+
+void DataSyncerWorker::writeMetricsLog(const QVariantMap &metrics) const
+{
+    if (m_metricsLogPath.isEmpty()) {
+        return;
+    }
+
+    QFile file(m_metricsLogPath);
+    if (file.size() > maxMetricsLogSize) {
+        QFile::remove(m_metricsLogPath + ".1");
+        if (!file.rename(m_metricsLogPath + ".1")) {
+            qCWarning(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to rename file", file);
+        }
+        file.setFileName(m_metricsLogPath);
+    }
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", file);
+        return;
+    }
+
+    QVariantMap record(metrics);
+    record.insert("start", metrics.value("start").toDateTime().toString(Qt::ISODate));
+    if (file.write(QJsonDocument(QJsonObject::fromVariantMap(record)).toJson(QJsonDocument::Compact) + '\n') < 0) {
+        qCWarning(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error writing to file", file);
+    }
+}
+
+void DataSyncerWorker::scheduleUrgentSync()
+{
+    scheduleSync(true);
+}
+
 void DataSyncerWorker::compareWithDir(const QString &path)
 {
-    QDir dir(path);
-    QSet<QString> extEntries =  dir.entryList(QDir::Files).toSet();
-    QSet<QString> intEntries = m_internalSyncDir.entryList(QDir::Files).toSet();
+    Q_UNUSED(path);  // Manifest is already set to the current sync folder
+
+    m_externalManifest->refresh();
+    m_internalManifest->refresh();
+    QSet<QString> extEntries = m_externalManifest->fileNames();
+    QSet<QString> intEntries = m_internalManifest->fileNames();
 
     m_outFiles = QSet<QString>(intEntries).subtract(extEntries);
     m_inFiles = QSet<QString>(extEntries).subtract(intEntries);
 }
 
-bool DataSyncerWorker::copyFiles(const QString &from, const QString &to, const QSet<QString> fileList, bool isRemoveSource)
+bool DataSyncerWorker::copyFiles(const QString &from, const QString &to, const QSet<QString> fileList,
+                                 bool isRemoveSource, bool isCompressPack)
 {
     QDir sourceDir(from);
     QDir destinationDir;
@@ -764,16 +1730,27 @@ bool DataSyncerWorker::copyFiles(const QString &from, const QString &to, const Q
         return false;
     }
 
+    QStringList destinationFiles;
     foreach (const QString fileName, fileList) {
-        if (!copyFile(sourceDir.filePath(fileName), destinationDir.filePath(fileName), true, isRemoveSource)) {
+        if (!copyFile(sourceDir.filePath(fileName), destinationDir.filePath(fileName), true, isRemoveSource,
+                      isCompressPack && packFileNameRegexp.match(fileName).hasMatch())) {
             return false;
         }
+        destinationFiles.append(destinationDir.filePath(fileName));
+    }
+
+    // Files are synced after the whole batch is copied, so the writeback of them overlaps
+    int syncError = destinationFiles.isEmpty() ? 0 : syncFiles(destinationDir.path(), destinationFiles);
+    if (syncError) {
+        qCWarning(SYNC_WORKER_CATEGORY) << QString("Fail to sync files in %1, errno: %2")
+                                           .arg(destinationDir.path()).arg(syncError);
     }
 
     return true;
 }
 
-bool DataSyncerWorker::copyFile(const QString &source, const QString &destination, bool isOverwrite, bool isRemoveSource) const
+bool DataSyncerWorker::copyFile(const QString &source, const QString &destination, bool isOverwrite,
+                                bool isRemoveSource, bool isCompressPack) const
 {
     QFile sourceFile(source);
     QFile destinationFile(destination);
@@ -787,8 +1764,31 @@ bool DataSyncerWorker::copyFile(const QString &source, const QString &destinatio
             return false;
         }
     }
+
+    // Compressed packs only live in the sync folder, internal copies are always plain SQLite
+    bool isCompressedSource = isCompressedPack(sourceFile);
+    if (isCompressedSource || (isCompressPack && m_isCompression)) {
+        if (!convertPack(sourceFile, destinationFile, !isCompressedSource)) {
+            destinationFile.remove();
+            return false;
+        }
+        if (isRemoveSource && !sourceFile.remove()) {
+            qCCritical(SYNC_WORKER_CATEGORY)
+                    << AbstractDataInOut::formatFileError("Fail to remove file", sourceFile);
+            fail(tr("Fail to remove file %1").arg(sourceFile.fileName()));
+            return false;
+        }
+
+        updateManifests(source, destination);
+        addMetric("filesCopied", 1);
+        addMetric("bytesCopied", destinationFile.size());
+
+        return true;
+    }
+
+    // Rename is constant time on the same filesystem and falls back to copy otherwise
     if (!(isRemoveSource ? sourceFile.rename(destinationFile.fileName())
-                         : sourceFile.copy(destinationFile.fileName()))) {
+                         : (kernelCopyFile(source, destination) || sourceFile.copy(destinationFile.fileName())))) {
         qCCritical(SYNC_WORKER_CATEGORY)
                 << AbstractDataInOut::formatFileError(QString("Fail to %1 file to %2 from")
                                                       .arg(isRemoveSource ? "move" : "copy")
@@ -800,6 +1800,91 @@ bool DataSyncerWorker::copyFile(const QString &source, const QString &destinatio
         return false;
     }
 
+    updateManifests(source, destination);
+    addMetric("filesCopied", 1);
+    addMetric("bytesCopied", destinationFile.size());
+
+    return true;
+}
+
+void DataSyncerWorker::updateManifests(const QString &source, const QString &destination) const
+{
+    for (SyncFolderManifest *manifest: { m_internalManifest, m_externalManifest }) {
+        for (const QString &path: { source, destination }) {
+            QFileInfo fileInfo(path);
+            if (QDir::cleanPath(fileInfo.absolutePath()) == manifest->dirPath()) {
+                manifest->addFile(fileInfo.fileName());
+            }
+        }
+    }
+}
+
+bool DataSyncerWorker::isCompressedPack(QFile &file) const
+{
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    bool result = file.read(packFileMagicSize) == QByteArray(packFileMagic, packFileMagicSize);
+    file.close();
+
+    return result;
+}
+
+bool DataSyncerWorker::convertPack(QFile &source, QFile &destination, bool isCompress) const
+{
+    if (!source.open(QIODevice::ReadOnly)) {
+        qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", source);
+        fail(tr("Fail to open file %1").arg(source.fileName()));
+        return false;
+    }
+    if (!destination.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", destination);
+        fail(tr("Fail to open file %1").arg(destination.fileName()));
+        return false;
+    }
+
+    QDataStream sourceStream(&source);
+    QDataStream destinationStream(&destination);
+    if (isCompress) {
+        destinationStream.writeRawData(packFileMagic, packFileMagicSize);
+        while (!source.atEnd()) {
+            QByteArray block = source.read(packBlockSize);
+            if (block.isEmpty()) {
+                break;
+            }
+            destinationStream << qCompress(block);
+        }
+    } else {
+        source.seek(packFileMagicSize);
+        while (!sourceStream.atEnd()) {
+            QByteArray block;
+            sourceStream >> block;
+            QByteArray data = qUncompress(block);
+            if (sourceStream.status() != QDataStream::Ok || data.isEmpty()) {
+                fail(tr("Invalid pack file %1").arg(source.fileName()));
+                return false;
+            }
+            destinationStream.writeRawData(data.constData(), data.size());
+        }
+    }
+
+    if (source.error() != QFileDevice::NoError) {
+        qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error reading from file", source);
+        fail(tr("Fail to read from file %1").arg(source.fileName()));
+        return false;
+    }
+    if (destinationStream.status() != QDataStream::Ok || !destination.flush()) {
+        qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error writing to file", destination);
+        fail(tr("Fail to write to file %1").arg(destination.fileName()));
+        return false;
+    }
+
+    qCInfo(SYNC_WORKER_CATEGORY) << QString("%1 pack %2, %3 -> %4 bytes")
+                                    .arg(isCompress ? "Compressed" : "Uncompressed")
+                                    .arg(source.fileName())
+                                    .arg(source.size()).arg(destination.size());
+
     return true;
 }
 
@@ -820,23 +1905,132 @@ bool DataSyncerWorker::exportFile(const QVector<TimeLogSyncDataEntry> &entryData
 
     qCInfo(SYNC_WORKER_CATEGORY) << "Exporting data to file" << filePath;
 
-    QByteArray fileData;
-    QDataStream dataStream(&fileData, QIODevice::WriteOnly);
-    dataStream.setVersion(syncFileStreamVersion);
-    dataStream << syncFileFormatVersion;
+    if (!writeSyncFile(filePath, entryData, categoryData)) {
+        return false;
+    }
 
-    for (int i = 0; i < entryData.size(); i++) {
-        qCInfo(SYNC_WORKER_CATEGORY) << QString("Exported entry %1 of %2").arg(i+1).arg(entryData.size());
-        qCDebug(SYNC_WORKER_CATEGORY) << entryData.at(i).toString();
-        dataStream << entryData.at(i);
+    if (!copyFile(filePath, m_internalSyncDir.filePath(fileName), true, true)) {
+        return false;
     }
 
-    for (int i = 0; i < categoryData.size(); i++) {
-        qCInfo(SYNC_WORKER_CATEGORY) << QString("Exported category %1 of %2").arg(i+1).arg(categoryData.size());
-        qCDebug(SYNC_WORKER_CATEGORY) << categoryData.at(i).toString();
-        dataStream << categoryData.at(i);
+    qCInfo(SYNC_WORKER_CATEGORY) << "All data successfully exported";
+
+    return true;
+}
+
+bool DataSyncerWorker::writeSyncFile(const QString &filePath, const QVector<TimeLogSyncDataEntry> &entryData,
+                                     const QVector<TimeLogSyncDataCategory> &categoryData) const
+{
+    // Entry categories are stored once, entries refer them by index
+    QHash<QString, int> categoryIndexes;
+    QStringList categoryNames;
+    for (const TimeLogSyncDataEntry &item: entryData) {
+        if (!item.sync.isRemoved && !categoryIndexes.contains(item.entry.category)) {
+            categoryIndexes.insert(item.entry.category, categoryNames.size());
+            categoryNames.append(item.entry.category);
+        }
+    }
+
+    QVector<quint64> fingerprints;
+    fingerprints.reserve(entryData.size() + categoryData.size());
+    qint64 minMTime = std::numeric_limits<qint64>::max();
+    qint64 maxMTime = 0;
+    for (const TimeLogSyncDataEntry &item: entryData) {
+        fingerprints.append(uuidFingerprint(item.entry.uuid));
+        minMTime = qMin(minMTime, item.sync.mTime.toMSecsSinceEpoch());
+        maxMTime = qMax(maxMTime, item.sync.mTime.toMSecsSinceEpoch());
+    }
+    for (const TimeLogSyncDataCategory &item: categoryData) {
+        fingerprints.append(uuidFingerprint(item.category.uuid));
+        minMTime = qMin(minMTime, item.sync.mTime.toMSecsSinceEpoch());
+        maxMTime = qMax(maxMTime, item.sync.mTime.toMSecsSinceEpoch());
+    }
+    std::sort(fingerprints.begin(), fingerprints.end());
+    fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()), fingerprints.end());
+    if (fingerprints.isEmpty()) {
+        minMTime = 0;
+    }
+
+    QByteArray fileData(syncFileMagic, syncFileMagicSize);
+    writeVarint(fileData, syncFileFormatVersion);
+    fileData.append(static_cast<char>((m_isCompression ? syncFileCompressedFlag : 0) | syncFileSummaryFlag));
+
+    writeVarint(fileData, entryData.size() + categoryData.size());
+    writeSignedVarint(fileData, minMTime);
+    writeVarint(fileData, maxMTime - minMTime);
+    writeVarint(fileData, fingerprints.size());
+    for (quint64 fingerprint: fingerprints) {
+        for (int i = 0; i < 8; i++) {
+            fileData.append(static_cast<char>((fingerprint >> (i * 8)) & 0xff));
+        }
+    }
+
+    // Chunk is written out only between the records
+    QByteArray chunk;
+    auto writeFullChunk = [this, &fileData, &chunk]() {
+        if (chunk.size() >= syncFileChunkSize) {
+            writeChunk(fileData, chunk, m_isCompression);
+        }
+    };
+
+    writeVarint(chunk, categoryNames.size());
+    for (const QString &name: categoryNames) {
+        writeBytes(chunk, name.toUtf8());
+        writeFullChunk();
+    }
+
+    // Times are stored as the deltas to the previous item, data is sorted by mtime
+    qint64 previousMTime = 0;
+    qint64 previousStart = 0;
+    writeVarint(chunk, entryData.size());
+    for (const TimeLogSyncDataEntry &item: entryData) {
+        qCDebug(SYNC_WORKER_CATEGORY) << item.toString();
+        qint64 mTime = item.sync.mTime.toMSecsSinceEpoch();
+        chunk.append(static_cast<char>(item.sync.isRemoved ? 1 : 0));
+        writeSignedVarint(chunk, mTime - previousMTime);
+        chunk.append(item.entry.uuid.toRfc4122());
+        previousMTime = mTime;
+        if (item.sync.isRemoved) {
+            writeFullChunk();
+            continue;
+        }
+
+        qint64 start = item.entry.startTime.toTime_t();
+        writeSignedVarint(chunk, start - previousStart);
+        writeVarint(chunk, categoryIndexes.value(item.entry.category));
+        writeBytes(chunk, item.entry.comment.toUtf8());
+        previousStart = start;
+        writeFullChunk();
+    }
+
+    previousMTime = 0;
+    writeVarint(chunk, categoryData.size());
+    for (const TimeLogSyncDataCategory &item: categoryData) {
+        qCDebug(SYNC_WORKER_CATEGORY) << item.toString();
+        qint64 mTime = item.sync.mTime.toMSecsSinceEpoch();
+        chunk.append(static_cast<char>(item.sync.isRemoved ? 1 : 0));
+        writeSignedVarint(chunk, mTime - previousMTime);
+        chunk.append(item.category.uuid.toRfc4122());
+        previousMTime = mTime;
+        if (item.sync.isRemoved) {
+            writeFullChunk();
+            continue;
+        }
+
+        writeBytes(chunk, item.category.name.toUtf8());
+        writeBytes(chunk, item.category.data.isEmpty()
+                          ? QByteArray()
+                          : QJsonDocument(QJsonObject::fromVariantMap(item.category.data))
+                            .toJson(QJsonDocument::Compact));
+        writeFullChunk();
     }
 
+    writeChunk(fileData, chunk, m_isCompression);
+    writeVarint(fileData, 0);
+
+    qCInfo(SYNC_WORKER_CATEGORY) << QString("Exported %1 entries and %2 categories")
+                                    .arg(entryData.size()).arg(categoryData.size());
+
     QFile file(filePath);
     if (file.exists()) {
         qCWarning(SYNC_WORKER_CATEGORY) << "File already exists, overwriting" << filePath;
@@ -849,14 +2043,7 @@ bool DataSyncerWorker::exportFile(const QVector<TimeLogSyncDataEntry> &entryData
         return false;
     }
 
-    QDataStream fileStream(&file);
-    fileStream << syncFileStreamVersion;
-    fileStream.setVersion(syncFileStreamVersion);
-
-    fileStream << fileData;
-    fileStream << qChecksum(fileData.constData(), fileData.size());
-
-    if (fileStream.status() != QDataStream::Ok || file.error() != QFileDevice::NoError) {
+    if (file.write(fileData) != fileData.size() || file.error() != QFileDevice::NoError) {
         qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error writing to file", file);
         fail(tr("Fail to write to file %1").arg(file.fileName()));
         return false;
@@ -864,40 +2051,147 @@ bool DataSyncerWorker::exportFile(const QVector<TimeLogSyncDataEntry> &entryData
 
     file.close();
 
-    if (!copyFile(filePath, m_internalSyncDir.filePath(fileName), true, true)) {
-        return false;
-    }
-
-    qCInfo(SYNC_WORKER_CATEGORY) << "All data successfully exported";
+    addMetric("filesExported", 1);
+    addMetric("bytesExported", fileData.size());
 
     return true;
 }
 
-void DataSyncerWorker::importCurrentItem()
+// Parsing runs ahead of the DB by the limited amount of files, so the memory usage is bounded
+void DataSyncerWorker::parseFiles()
 {
-    qCInfo(SYNC_WORKER_CATEGORY) << QString("Importing file %1 of %2")
-                                    .arg(m_currentIndex+1).arg(m_fileList.size());
-    const QString &filePath(m_fileList.at(m_currentIndex));
-    if (packFileNameRegexp.match(QFileInfo(filePath).fileName()).hasMatch()) {
-        m_forcePack = true;
-        m_packName = QFileInfo(filePath).fileName();
-        importPack(filePath);
-    } else {
-        importFile(filePath);
+    int maxParsedFiles = qMax(2, m_parseThreadPool.maxThreadCount() * 2);
+    while (m_parseIndex < m_fileList.size() && m_parseIndex - m_currentIndex < maxParsedFiles) {
+        const QString &filePath(m_fileList.at(m_parseIndex));
+        QString fileName(QFileInfo(filePath).fileName());
+        // Packs are imported by the DBSyncer in turn
+        if (!packFileNameRegexp.match(fileName).hasMatch()) {
+            SyncFileSummary summary;
+            if (readSyncFileSummary(filePath, summary) && isFileCovered(fileName, summary)) {
+                qCInfo(SYNC_WORKER_CATEGORY) << "Skipping already covered file" << filePath;
+                addMetric("filesSkipped", 1);
+                m_parsedFiles.insert(m_parseIndex, SyncFileData());
+            } else {
+                m_parseThreadPool.start(new SyncFileParserTask(this, m_parseGeneration, m_parseIndex, filePath));
+            }
+            if (summary.isValid) {
+                m_fileSummaries.append(summary);
+            }
+        }
+        ++m_parseIndex;
     }
 }
 
-void DataSyncerWorker::importFile(const QString &path)
+// Items are consumed strictly in the file list order, waiting for the parser if needed.
+// Consecutive sync files are merged and applied at once, before the next pack or at the end.
+void DataSyncerWorker::importCurrentItem()
 {
-    QVector<TimeLogSyncDataEntry> updatedData, removedData;
-    QVector<TimeLogSyncDataCategory> categoryData;
+    while (m_currentIndex < m_fileList.size()) {
+        const QString &filePath(m_fileList.at(m_currentIndex));
+        if (packFileNameRegexp.match(QFileInfo(filePath).fileName()).hasMatch()) {
+            if (m_mergedFilesCount) {
+                syncMergedFiles();
+                return;
+            }
 
-    if (!parseFile(path, updatedData, removedData, categoryData)) {
+            qCInfo(SYNC_WORKER_CATEGORY) << QString("Importing file %1 of %2")
+                                            .arg(m_currentIndex+1).arg(m_fileList.size());
+            m_forcePack = true;
+            m_packName = QFileInfo(filePath).fileName();
+            importPack(filePath);
+            parseFiles();
+            return;
+        }
+
+        if (!m_parsedFiles.contains(m_currentIndex)) {
+            parseFiles();
+            return;
+        }
+
+        qCInfo(SYNC_WORKER_CATEGORY) << QString("Importing file %1 of %2")
+                                        .arg(m_currentIndex+1).arg(m_fileList.size());
+        mergeFile(m_parsedFiles.take(m_currentIndex));
+        ++m_currentIndex;
+        parseFiles();
+    }
+
+    if (m_mergedFilesCount) {
+        syncMergedFiles();
         return;
     }
 
-    if (!updatedData.isEmpty() || !removedData.isEmpty() || !categoryData.isEmpty()) {
-        m_db->sync(updatedData, removedData, categoryData);
+    if (copyFiles(m_internalSyncDir.filePath("incoming"), m_internalSyncDir.path(), m_inFiles, true)) {
+        emit imported(QPrivateSignal());
+    }
+}
+
+// Only the latest change of each item is kept, on equal mtime the file applied first wins,
+// as it would when applying files one by one
+void DataSyncerWorker::mergeFile(const SyncFileData &fileData)
+{
+    auto mergeEntries = [this](const QVector<TimeLogSyncDataEntry> &data) {
+        for (const TimeLogSyncDataEntry &item: data) {
+            QHash<QUuid, TimeLogSyncDataEntry>::iterator it = m_mergedEntries.find(item.entry.uuid);
+            if (it == m_mergedEntries.end()) {
+                m_mergedEntries.insert(item.entry.uuid, item);
+            } else if (it->sync.mTime < item.sync.mTime) {
+                it.value() = item;
+            }
+        }
+    };
+    mergeEntries(fileData.removedData);
+    mergeEntries(fileData.updatedData);
+    for (const TimeLogSyncDataCategory &item: fileData.categoryData) {
+        QHash<QUuid, TimeLogSyncDataCategory>::iterator it = m_mergedCategories.find(item.category.uuid);
+        if (it == m_mergedCategories.end()) {
+            m_mergedCategories.insert(item.category.uuid, item);
+        } else if (it->sync.mTime < item.sync.mTime) {
+            it.value() = item;
+        }
+    }
+
+    ++m_mergedFilesCount;
+}
+
+// DB expects the data sorted by mtime
+DataSyncerWorker::SyncFileData DataSyncerWorker::takeMergedData()
+{
+    SyncFileData result;
+    for (const TimeLogSyncDataEntry &item: m_mergedEntries) {
+        (item.sync.isRemoved ? result.removedData : result.updatedData).append(item);
+    }
+    result.categoryData = m_mergedCategories.values().toVector();
+    m_mergedEntries.clear();
+    m_mergedCategories.clear();
+
+    auto entryComparator = [](const TimeLogSyncDataEntry &e1, const TimeLogSyncDataEntry &e2) {
+        return e1.sync.mTime < e2.sync.mTime;
+    };
+    std::sort(result.updatedData.begin(), result.updatedData.end(), entryComparator);
+    std::sort(result.removedData.begin(), result.removedData.end(), entryComparator);
+    std::sort(result.categoryData.begin(), result.categoryData.end(),
+              [](const TimeLogSyncDataCategory &c1, const TimeLogSyncDataCategory &c2) {
+        return c1.sync.mTime < c2.sync.mTime;
+    });
+
+    return result;
+}
+
+void DataSyncerWorker::syncMergedFiles()
+{
+    SyncFileData fileData(takeMergedData());
+
+    qCInfo(SYNC_WORKER_CATEGORY) << QString("Syncing %1 files, %2 entries and %3 categories")
+                                    .arg(m_mergedFilesCount)
+                                    .arg(fileData.updatedData.size() + fileData.removedData.size())
+                                    .arg(fileData.categoryData.size());
+
+    addMetric("recordsReceived", fileData.updatedData.size() + fileData.removedData.size()
+                                 + fileData.categoryData.size());
+
+    m_isMergedSyncing = true;
+    if (!fileData.updatedData.isEmpty() || !fileData.removedData.isEmpty() || !fileData.categoryData.isEmpty()) {
+        m_dbClient->sync(fileData.updatedData, fileData.removedData, fileData.categoryData);
     } else {
         syncDataSynced(QDateTime());
     }
@@ -906,57 +2200,310 @@ void DataSyncerWorker::importFile(const QString &path)
 bool DataSyncerWorker::parseFile(const QString &path,
                                  QVector<TimeLogSyncDataEntry> &updatedData,
                                  QVector<TimeLogSyncDataEntry> &removedData,
-                                 QVector<TimeLogSyncDataCategory> &categoryData) const
+                                 QVector<TimeLogSyncDataCategory> &categoryData, QString &errorText) const
 {
     QFile file(path);
     if (!file.exists()) {
-        fail(tr("File %1 does not exists").arg(path));
+        errorText = tr("File %1 does not exists").arg(path);
         return false;
     }
 
     if (!file.open(QIODevice::ReadOnly)) {
         qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", file);
-        fail(tr("Fail to open file %1").arg(file.fileName()));
+        errorText = tr("Fail to open file %1").arg(file.fileName());
         return false;
     }
 
-    QDataStream fileStream(&file);
+    // File is parsed in place, the copy is only made if it can not be mapped
+    qint64 size = file.size();
+    QByteArray fileContent;
+    const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+    if (!data) {
+        fileContent = file.readAll();
+        if (file.error() != QFileDevice::NoError) {
+            qCCritical(SYNC_WORKER_CATEGORY) << AbstractDataInOut::formatFileError("Error reading from file", file);
+            errorText = tr("Fail to read from file %1").arg(file.fileName());
+            return false;
+        }
+        data = reinterpret_cast<const uchar *>(fileContent.constData());
+        size = fileContent.size();
+    }
+
+    bool result;
+    if (size >= syncFileMagicSize && memcmp(data, syncFileMagic, syncFileMagicSize) == 0) {
+        result = parseData(data, size, path, updatedData, removedData, categoryData, errorText);
+    } else {
+        result = parseLegacyData(QByteArray::fromRawData(reinterpret_cast<const char *>(data), size), path,
+                                 updatedData, removedData, categoryData, errorText);
+    }
+
+    if (result && updatedData.isEmpty() && removedData.isEmpty() && categoryData.isEmpty()) {
+        qCWarning(SYNC_WORKER_CATEGORY) << "No data in file" << path;
+    }
+
+    return result;
+}
+
+bool DataSyncerWorker::readSummary(SyncFileReader &reader, SyncFileSummary &summary)
+{
+    summary.recordsCount = reader.readVarint();
+    qint64 minMTime = reader.readSignedVarint();
+    quint64 mTimeRange = reader.readVarint();
+    // Mtime is never before the epoch, so the range is checked without the signed overflow
+    if (!reader.isOk() || minMTime < 0
+        || mTimeRange > static_cast<quint64>(std::numeric_limits<qint64>::max() - minMTime)) {
+        return false;
+    }
+    summary.minMTime = QDateTime::fromMSecsSinceEpoch(minMTime, Qt::UTC);
+    summary.maxMTime = QDateTime::fromMSecsSinceEpoch(minMTime + static_cast<qint64>(mTimeRange), Qt::UTC);
+    quint64 fingerprintsCount = reader.readVarint();
+    // Count is checked against the data left, before anything is allocated for it
+    if (!reader.isOk() || fingerprintsCount > static_cast<quint64>(summary.recordsCount)
+        || fingerprintsCount > static_cast<quint64>(reader.bytesAvailable()) / sizeof(quint64)) {
+        return false;
+    }
+
+    summary.fingerprints.reserve(static_cast<int>(fingerprintsCount));
+    for (quint64 i = 0; i < fingerprintsCount && reader.isOk(); i++) {
+        summary.fingerprints.append(reader.readFixed64());
+    }
+    summary.isValid = reader.isOk() && std::is_sorted(summary.fingerprints.constBegin(),
+                                                      summary.fingerprints.constEnd());
+
+    return summary.isValid;
+}
+
+// Only the header is read, files without the summary are always parsed
+bool DataSyncerWorker::readSyncFileSummary(const QString &path, SyncFileSummary &summary) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint64 size = file.size();
+    const uchar *data = size > syncFileMagicSize ? file.map(0, size) : nullptr;
+    if (!data || memcmp(data, syncFileMagic, syncFileMagicSize) != 0) {
+        return false;
+    }
+
+    SyncFileReader reader(data + syncFileMagicSize, size - syncFileMagicSize);
+    if (reader.readVarint() != static_cast<quint64>(syncFileFormatVersion)) {
+        return false;
+    }
+    quint8 flags = reader.readByte();
+    if (!reader.isOk() || !(flags & syncFileSummaryFlag)) {
+        return false;
+    }
+
+    return readSummary(reader, summary);
+}
+
+// Sync files up to the pack layer mtime are already merged into it, same as for removeOldFiles().
+// Otherwise file is covered if each its record is superseded by a newer file of this import.
+bool DataSyncerWorker::isFileCovered(const QString &fileName, const SyncFileSummary &summary) const
+{
+    if (syncFileNameRegexp.match(fileName).hasMatch() && !m_packName.isEmpty() && summary.maxMTime <= m_packMTime) {
+        return true;
+    }
+
+    if (summary.fingerprints.isEmpty()) {
+        return false;
+    }
+
+    QVector<const SyncFileSummary *> newerFiles;
+    for (const SyncFileSummary &newer: m_fileSummaries) {
+        if (summary.maxMTime < newer.minMTime) {
+            newerFiles.append(&newer);
+        }
+    }
+    if (newerFiles.isEmpty()) {
+        return false;
+    }
+
+    for (quint64 fingerprint: summary.fingerprints) {
+        bool isFound = false;
+        for (const SyncFileSummary *newer: newerFiles) {
+            if (std::binary_search(newer->fingerprints.constBegin(), newer->fingerprints.constEnd(), fingerprint)) {
+                isFound = true;
+                break;
+            }
+        }
+        if (!isFound) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DataSyncerWorker::parseData(const uchar *data, qint64 size, const QString &path,
+                                 QVector<TimeLogSyncDataEntry> &updatedData,
+                                 QVector<TimeLogSyncDataEntry> &removedData,
+                                 QVector<TimeLogSyncDataCategory> &categoryData, QString &errorText) const
+{
+    SyncFileReader reader(data + syncFileMagicSize, size - syncFileMagicSize);
+    quint64 formatVersion = reader.readVarint();
+    if (!reader.isOk() || formatVersion != syncFileFormatVersion) {
+        errorText = tr("Data format version %1 instead of %2")
+                    .arg(formatVersion).arg(syncFileFormatVersion);
+        return false;
+    }
+    quint8 flags = reader.readByte();
+    if (!reader.isOk() || (flags & ~(syncFileCompressedFlag | syncFileSummaryFlag))) {
+        errorText = tr("Invalid file %1, unknown flags").arg(path);
+        return false;
+    }
+
+    SyncFileSummary summary;
+    if ((flags & syncFileSummaryFlag) && !readSummary(reader, summary)) {
+        errorText = tr("Invalid file %1, bad summary").arg(path);
+        return false;
+    }
+
+    reader.startChunks(flags & syncFileCompressedFlag);
+
+    QVector<QString> categoryNames;
+    quint64 namesCount = reader.readVarint();
+    for (quint64 i = 0; i < namesCount && reader.isOk(); i++) {
+        categoryNames.append(TimeLogCategoryPool::intern(reader.readString()));
+    }
+
+    qint64 previousMTime = 0;
+    qint64 previousStart = 0;
+    quint64 entriesCount = reader.readVarint();
+    for (quint64 i = 0; i < entriesCount && reader.isOk(); i++) {
+        TimeLogSyncDataEntry syncEntry;
+        syncEntry.sync.type = TimeLogSyncDataBase::Entry;
+        syncEntry.sync.isRemoved = reader.readByte() & 1;
+        previousMTime += reader.readSignedVarint();
+        syncEntry.sync.mTime = QDateTime::fromMSecsSinceEpoch(previousMTime, Qt::UTC);
+        syncEntry.entry.uuid = reader.readUuid();
+        if (!reader.isOk()) {
+            break;
+        }
+
+        if (syncEntry.sync.isRemoved) {
+            if (!syncEntry.entry.uuid.isNull()) {
+                qCDebug(SYNC_WORKER_CATEGORY) << "Valid removed entry:" << syncEntry;
+                removedData.append(syncEntry);
+                continue;
+            }
+        } else {
+            previousStart += reader.readSignedVarint();
+            syncEntry.entry.startTime = QDateTime::fromTime_t(previousStart, Qt::UTC);
+            quint64 categoryIndex = reader.readVarint();
+            syncEntry.entry.category = categoryIndex < static_cast<quint64>(categoryNames.size())
+                                       ? categoryNames.at(categoryIndex) : QString();
+            syncEntry.entry.comment = reader.readString();
+            if (!reader.isOk()) {
+                break;
+            }
+            if (syncEntry.entry.isValid()) {
+                qCDebug(SYNC_WORKER_CATEGORY) << "Valid entry:" << syncEntry;
+                updatedData.append(syncEntry);
+                continue;
+            }
+        }
+
+        qCWarning(SYNC_WORKER_CATEGORY) << "Invalid entry:" << syncEntry;
+        errorText = tr("Invalid sync entry");
+        return false;
+    }
+
+    previousMTime = 0;
+    quint64 categoriesCount = reader.readVarint();
+    for (quint64 i = 0; i < categoriesCount && reader.isOk(); i++) {
+        TimeLogSyncDataCategory syncCategory;
+        syncCategory.sync.type = TimeLogSyncDataBase::Category;
+        syncCategory.sync.isRemoved = reader.readByte() & 1;
+        previousMTime += reader.readSignedVarint();
+        syncCategory.sync.mTime = QDateTime::fromMSecsSinceEpoch(previousMTime, Qt::UTC);
+        syncCategory.category.uuid = reader.readUuid();
+        if (!reader.isOk()) {
+            break;
+        }
+
+        if (syncCategory.sync.isRemoved) {
+            if (!syncCategory.category.uuid.isNull()) {
+                qCDebug(SYNC_WORKER_CATEGORY) << "Valid removed category:" << syncCategory;
+                categoryData.append(syncCategory);
+                continue;
+            }
+        } else {
+            syncCategory.category.name = reader.readString();
+            QByteArray jsonData = reader.readRawBytes();
+            if (!jsonData.isEmpty()) {
+                syncCategory.category.data = QJsonDocument::fromJson(jsonData).object().toVariantMap();
+            }
+            if (!reader.isOk()) {
+                break;
+            }
+            if (syncCategory.category.isValid()) {
+                qCDebug(SYNC_WORKER_CATEGORY) << "Valid category:" << syncCategory;
+                categoryData.append(syncCategory);
+                continue;
+            }
+        }
+
+        qCWarning(SYNC_WORKER_CATEGORY) << "Invalid category:" << syncCategory;
+        errorText = tr("Invalid sync category");
+        return false;
+    }
+
+    if (reader.isCorrupted()) {
+        errorText = tr("Invalid file %1, checksums does not match").arg(path);
+        return false;
+    } else if (!reader.isOk() || !reader.atEnd()) {
+        errorText = tr("Invalid data in file %1").arg(path);
+        return false;
+    }
+
+    return true;
+}
+
+bool DataSyncerWorker::parseLegacyData(const QByteArray &rawData, const QString &path,
+                                       QVector<TimeLogSyncDataEntry> &updatedData,
+                                       QVector<TimeLogSyncDataEntry> &removedData,
+                                       QVector<TimeLogSyncDataCategory> &categoryData,
+                                       QString &errorText) const
+{
+    QDataStream fileStream(rawData);
 
     if (fileStream.atEnd()) {
-        fail(tr("Invalid file %1, no stream version").arg(path));
+        errorText = tr("Invalid file %1, no stream version").arg(path);
         return false;
     }
     qint32 streamVersion;
     fileStream >> streamVersion;
     if (streamVersion > syncFileStreamVersion) {
-        fail(tr("Stream version too new: %1 > %2")
-             .arg(streamVersion).arg(syncFileStreamVersion));
+        errorText = tr("Stream version too new: %1 > %2")
+                    .arg(streamVersion).arg(syncFileStreamVersion);
         return false;
     }
     fileStream.setVersion(streamVersion);
 
     if (fileStream.atEnd()) {
-        fail(tr("Invalid file %1, no data").arg(path));
+        errorText = tr("Invalid file %1, no data").arg(path);
         return false;
     }
     QByteArray fileData;
     fileStream >> fileData;
-    if (fileStream.status() != QDataStream::Ok || file.error() != QFileDevice::NoError) {
-        qCCritical(SYNC_WORKER_CATEGORY)
-                << AbstractDataInOut::formatFileError(QString("Error reading from file, stream status %1")
-                                                      .arg(fileStream.status()), file);
-        fail(tr("Fail to read from file %1").arg(file.fileName()));
+    if (fileStream.status() != QDataStream::Ok) {
+        qCCritical(SYNC_WORKER_CATEGORY) << QString("Error reading from file %1, stream status %2")
+                                            .arg(path).arg(fileStream.status());
+        errorText = tr("Fail to read from file %1").arg(path);
         return false;
     }
 
     if (fileStream.atEnd()) {
-        fail(tr("Invalid file %1, no checksum").arg(path));
+        errorText = tr("Invalid file %1, no checksum").arg(path);
         return false;
     }
     quint16 checksum;
     fileStream >> checksum;
     if (qChecksum(fileData.constData(), fileData.size()) != checksum) {
-        fail(tr("Invalid file %1, checksums does not match").arg(path));
+        errorText = tr("Invalid file %1, checksums does not match").arg(path);
         return false;
     }
 
@@ -964,14 +2511,14 @@ bool DataSyncerWorker::parseFile(const QString &path,
     dataStream.setVersion(streamVersion);
 
     if (dataStream.atEnd()) {
-        fail(tr("Invalid data in file %1, no format version").arg(path));
+        errorText = tr("Invalid data in file %1, no format version").arg(path);
         return false;
     }
     qint32 formatVersion;
     dataStream >> formatVersion;
-    if (formatVersion != syncFileFormatVersion) {
-        fail(tr("Data format version %1 instead of %2")
-             .arg(formatVersion).arg(syncFileFormatVersion));
+    if (formatVersion != legacySyncFileFormatVersion) {
+        errorText = tr("Data format version %1 instead of %2")
+                    .arg(formatVersion).arg(legacySyncFileFormatVersion);
         return false;
     }
 
@@ -995,7 +2542,7 @@ bool DataSyncerWorker::parseFile(const QString &path,
                 removedData.append(syncEntry);
             } else {
                 qCWarning(SYNC_WORKER_CATEGORY) << "Invalid entry:" << syncEntry;
-                fail(tr("Invalid sync entry"));
+                errorText = tr("Invalid sync entry");
                 return false;
             }
             break;
@@ -1015,34 +2562,36 @@ bool DataSyncerWorker::parseFile(const QString &path,
                 categoryData.append(syncCategory);
             } else {
                 qCWarning(SYNC_WORKER_CATEGORY) << "Invalid category:" << syncCategory;
-                fail(tr("Invalid sync category"));
+                errorText = tr("Invalid sync category");
                 return false;
             }
             break;
         }
         default:
             qCWarning(SYNC_WORKER_CATEGORY) << "Invalid sync item type:" << base.type;
-            fail(tr("Invalid sync item type"));
+            errorText = tr("Invalid sync item type");
             return false;
         }
     }
 
-    if (updatedData.isEmpty() && removedData.isEmpty() && categoryData.isEmpty()) {
-        qCWarning(SYNC_WORKER_CATEGORY) << "No data in file" << path;
-    }
-
     return true;
 }
 
 void DataSyncerWorker::importPack(const QString &path)
 {
-    m_pack = new TimeLogHistory(this);
-    if (!m_pack->init(m_internalSyncPath, m_internalSyncDir.relativeFilePath(path), true)) {
+    addMetric("filesRead", 1);
+    addMetric("bytesRead", QFileInfo(path).size());
+
+    // Pack is only read by the syncer, so it's opened without own thread, schema setup and categories
+    m_pack = new TimeLogHistory(m_db, this);
+    if (!m_pack->initPack(m_internalSyncPath, m_internalSyncDir.relativeFilePath(path),
+                          TimeLogConnectionProfile::compatible())) {
         fail(tr("Fail to open pack file %1").arg(path));
         return;
     }
 
-    m_dbSyncer = new DBSyncer(m_pack, m_db, this);
+    m_dbSyncer = new DBSyncer(m_pack, m_dbClient, this);
+    m_dbSyncer->setPrefetchDepth(packSyncPrefetchDepth);
     connect(m_dbSyncer, SIGNAL(finished(QDateTime)),
             this, SLOT(packImported(QDateTime)));
     connect(m_dbSyncer, SIGNAL(error(QString)),
@@ -1054,13 +2603,7 @@ void DataSyncerWorker::importPack(const QString &path)
 void DataSyncerWorker::processCurrentItemImported()
 {
     ++m_currentIndex;
-    if (m_currentIndex == m_fileList.size()) {
-        if (copyFiles(m_internalSyncDir.filePath("incoming"), m_internalSyncDir.path(), m_inFiles, true)) {
-            emit imported(QPrivateSignal());
-        }
-    } else {
-        importCurrentItem();
-    }
+    importCurrentItem();
 }
 
 void DataSyncerWorker::exportPack()
@@ -1081,39 +2624,65 @@ void DataSyncerWorker::exportPack()
         qCDebug(SYNC_WORKER_CATEGORY) << "No existing pack file, creating new";
     }
 
+    // Only the changes are written out as a delta, unless it's time to write out the new pack
+    m_isPackCompaction = m_packName.isEmpty() || m_packDeltas.size() >= maxPackDeltas;
+
+    // Pack file is copied as a whole, so it should not keep any data in WAL file
     m_pack = new TimeLogHistory(this);
     if (!m_pack->init(m_internalSyncPath,
                       m_internalSyncDir.relativeFilePath(packDir.filePath("pack.pack")),
-                      false)) {
+                      false, false, TimeLogConnectionProfile::compatible())) {
         fail(tr("Fail to create pack file"));
         return;
     }
-    connect(m_pack, SIGNAL(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                                   QVector<TimeLogSyncDataEntry>,
-                                                   QVector<TimeLogSyncDataEntry>,
-                                                   QVector<TimeLogSyncDataEntry>,
-                                                   QVector<TimeLogSyncDataEntry>,
-                                                   QVector<TimeLogSyncDataEntry>)),
-            this, SLOT(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataEntry>)));
-    connect(m_pack, SIGNAL(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                      QVector<TimeLogSyncDataCategory>,
-                                                      QVector<TimeLogSyncDataCategory>,
-                                                      QVector<TimeLogSyncDataCategory>,
-                                                      QVector<TimeLogSyncDataCategory>,
-                                                      QVector<TimeLogSyncDataCategory>)),
-            this, SLOT(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>,
-                                                  QVector<TimeLogSyncDataCategory>)));
-
-    m_dbSyncer = new DBSyncer(m_db, m_pack, this);
+
+    // Horizon depends only on the pack name, so all devices purge the same items and hashes still match
+    if (!m_packName.isEmpty()) {
+        QDateTime purgeHorizon(packBaseMTime().addDays(-removedRetentionDays));
+        m_db->purgeRemoved(purgeHorizon);
+        m_pack->purgeRemoved(purgeHorizon);
+    }
+    connect(m_pack, SIGNAL(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)),
+            this, SLOT(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)));
+    connect(m_pack, SIGNAL(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)),
+            this, SLOT(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)));
+    connect(m_pack, SIGNAL(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)),
+            this, SLOT(packEntryChangesAvailable(QSharedPointer<TimeLogSyncEntryChanges>)));
+    connect(m_pack, SIGNAL(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)),
+            this, SLOT(packCategoryChangesAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)));
+
+    // Deltas are applied over the pack to get the state other devices have
+    for (const QString &deltaName: m_packDeltas) {
+        SyncFileData fileData;
+        QString errorText;
+        if (!parseFile(m_internalSyncDir.filePath(deltaName),
+                       fileData.updatedData, fileData.removedData, fileData.categoryData, errorText)) {
+            fail(errorText);
+            return;
+        }
+        mergeFile(fileData);
+    }
+    m_mergedFilesCount = 0;
+    SyncFileData deltaData(takeMergedData());
+
+    if (deltaData.updatedData.isEmpty() && deltaData.removedData.isEmpty() && deltaData.categoryData.isEmpty()) {
+        startPackSync();
+    } else {
+        qCDebug(SYNC_WORKER_CATEGORY) << "Applying pack deltas" << m_packDeltas;
+        connect(m_pack, SIGNAL(dataSynced(QDateTime)),
+                this, SLOT(packDeltasApplied()));
+        m_pack->sync(deltaData.updatedData, deltaData.removedData, deltaData.categoryData);
+    }
+}
+
+void DataSyncerWorker::startPackSync()
+{
+    m_packEntryChanges.clear();
+    m_packCategoryChanges.clear();
+    m_isCollectingPackChanges = true;
+
+    m_dbSyncer = new DBSyncer(m_dbClient, m_pack, this);
+    m_dbSyncer->setPrefetchDepth(packSyncPrefetchDepth);
     connect(m_dbSyncer, SIGNAL(finished(QDateTime)),
             this, SLOT(packExported(QDateTime)));
     connect(m_dbSyncer, SIGNAL(error(QString)),
@@ -1122,6 +2691,46 @@ void DataSyncerWorker::exportPack()
     m_dbSyncer->start(true, maxPackPeriodStart());
 }
 
+bool DataSyncerWorker::exportPackDelta()
+{
+    SyncFileData fileData;
+    fileData.updatedData = m_packEntryChanges;
+    fileData.categoryData = m_packCategoryChanges;
+    mergeFile(fileData);
+    m_mergedFilesCount = 0;
+    fileData = takeMergedData();
+    m_packEntryChanges.clear();
+    m_packCategoryChanges.clear();
+
+    QVector<TimeLogSyncDataEntry> entryData(fileData.updatedData + fileData.removedData);
+    std::sort(entryData.begin(), entryData.end(),
+              [](const TimeLogSyncDataEntry &e1, const TimeLogSyncDataEntry &e2) {
+        return e1.sync.mTime < e2.sync.mTime;
+    });
+
+    QString mTimeString = QString("%1").arg(m_packMTime.toMSecsSinceEpoch(), mTimeLength, 10, QChar('0'));
+    QString deltaName = QString("%1-%2.delta").arg(mTimeString).arg(QUuid::createUuid().toString());
+    QDir packDir(m_internalSyncDir.filePath("pack"));
+    if (!writeSyncFile(packDir.filePath(deltaName), entryData, fileData.categoryData)) {
+        return false;
+    }
+    if (!copyFile(packDir.filePath(deltaName), m_internalSyncDir.filePath(deltaName), true, true)) {
+        return false;
+    }
+    if (!copyFile(m_internalSyncDir.filePath(deltaName), QDir(m_currentSyncPath).filePath(deltaName),
+                  true, false)) {
+        return false;
+    }
+    m_packDeltas.append(deltaName);
+    m_wroteToExternalSync = true;
+
+    qCInfo(SYNC_WORKER_CATEGORY) << QString("Successfully written pack delta %1, %2 entries and %3 categories")
+                                    .arg(m_internalSyncDir.filePath(deltaName))
+                                    .arg(entryData.size()).arg(fileData.categoryData.size());
+
+    return true;
+}
+
 QString DataSyncerWorker::formatSyncEntryChange(const TimeLogSyncDataEntry &oldData,
                                                 const TimeLogSyncDataEntry &newData) const
 {
@@ -1158,65 +2767,72 @@ QString DataSyncerWorker::formatSyncCategoryChange(const TimeLogSyncDataCategory
     return result.join(' ');
 }
 
+// Delta should be newer than the pack, otherwise it would be superseded by it
+QDateTime DataSyncerWorker::packBaseMTime() const
+{
+    QString mTimeString = packFileNameRegexp.match(m_packName).captured("mTime");
+    return QDateTime::fromMSecsSinceEpoch(mTimeString.toLongLong(), Qt::UTC);
+}
+
 QDateTime DataSyncerWorker::maxPackPeriodStart() const
 {
     QDate date = qMax(m_syncStart.toUTC().date().addMonths(-1), m_packMTime.toUTC().date());
     return QDateTime(QDate(date.year(), date.month(), 1), QTime(), Qt::UTC);
 }
 
-bool DataSyncerWorker::removeOldFiles(const QString &packName)
+bool DataSyncerWorker::removeOldFiles(const QString &packName, const QDateTime &layerMTime)
 {
+    // Packs and deltas are superseded by the last pack, sync files by the last pack or delta
     QString packMTimeString = packFileNameRegexp.match(packName).captured("mTime");
-    QStringList fileList = AbstractDataInOut::buildFileList(m_internalSyncPath);
-    for (const QString &filePath: fileList) {
-        QString fileName = QFileInfo(filePath).fileName();
-        if (fileName == packName) { // Don't delete last pack
-            continue;
+    QString layerMTimeString = QString("%1").arg(layerMTime.toMSecsSinceEpoch(), mTimeLength, 10, QChar('0'));
+    auto isOldFile = [&](QMap<QString, SyncFolderManifest::Item>::const_iterator it) {
+        if (it.key() == packName) { // Don't delete last pack
+            return false;
         }
-        QRegularExpressionMatch match;
-        if ((match = packFileNameRegexp.match(fileName)).hasMatch()) {
-            if (match.captured("mTime") > packMTimeString) {
-                continue;
-            }
-        } else if ((match = syncFileNameRegexp.match(fileName)).hasMatch()) {
-            if (match.captured("mTime") > packMTimeString) {
-                continue;
-            }
-        } else {
-            continue;
+        switch (it->kind) {
+        case SyncFolderManifest::PackFile:
+        case SyncFolderManifest::DeltaFile:
+            return !packMTimeString.isEmpty() && it->mTime <= packMTimeString;
+        case SyncFolderManifest::SyncFile:
+            return !packMTimeString.isEmpty() && it->mTime <= layerMTimeString;
+        default:
+            return false;
         }
+    };
 
+    QStringList oldFiles;
+    const QMap<QString, SyncFolderManifest::Item> &internalItems = m_internalManifest->items();
+    for (auto it = internalItems.constBegin(); it != internalItems.constEnd(); ++it) {
+        if (isOldFile(it)) {
+            oldFiles.append(it.key());
+        }
+    }
+    for (const QString &fileName: oldFiles) {
         if (!m_internalSyncDir.remove(fileName)) {
-            fail(QString("Fail to remove file %1").arg(filePath));
+            fail(QString("Fail to remove file %1").arg(m_internalSyncDir.filePath(fileName)));
             return false;
         }
+        m_internalManifest->removeFile(fileName);
         qCDebug(SYNC_WORKER_CATEGORY) << "Removed" << m_internalSyncDir.filePath(fileName);
     }
 
     QDir syncDir(m_currentSyncPath);
-    fileList = AbstractDataInOut::buildFileList(m_currentSyncPath);
-    for (const QString &filePath: fileList) {
-        QString fileName = QFileInfo(filePath).fileName();
-        if (fileName == packName) { // Don't delete last pack
-            continue;
-        }
-        QRegularExpressionMatch match;
-        if ((match = packFileNameRegexp.match(fileName)).hasMatch()) {
-            if (match.captured("mTime") > packMTimeString) {
-                continue;
-            }
-        } else if ((match = syncFileNameRegexp.match(fileName)).hasMatch()) {
-            if (match.captured("mTime") > packMTimeString) {
-                continue;
-            }
-        } else {
-            continue;
+    if (!m_sm->isRunning()) {
+        m_externalManifest->refresh();
+    }
+    oldFiles.clear();
+    const QMap<QString, SyncFolderManifest::Item> &externalItems = m_externalManifest->items();
+    for (auto it = externalItems.constBegin(); it != externalItems.constEnd(); ++it) {
+        if (isOldFile(it)) {
+            oldFiles.append(it.key());
         }
-
+    }
+    for (const QString &fileName: oldFiles) {
         if (!syncDir.remove(fileName)) {
-            fail(tr("Fail to remove file %1").arg(filePath));
+            fail(tr("Fail to remove file %1").arg(syncDir.filePath(fileName)));
             return false;
         }
+        m_externalManifest->removeFile(fileName);
         m_wroteToExternalSync = true;
 
         qCDebug(SYNC_WORKER_CATEGORY) << "Removed" << syncDir.filePath(fileName);
@@ -1225,13 +2841,13 @@ bool DataSyncerWorker::removeOldFiles(const QString &packName)
     return true;
 }
 
-void DataSyncerWorker::addCachedSyncChange()
+void DataSyncerWorker::addCachedSyncChange(int count)
 {
     if (m_autoSync && m_syncCacheTimeout > 0) {
         m_syncCacheTimer->start(m_syncCacheTimeout * 1000);
     }
 
-    addCachedSyncChanges(1);
+    addCachedSyncChanges(count);
 }
 
 void DataSyncerWorker::addCachedSyncChanges(int count)
@@ -1248,6 +2864,44 @@ void DataSyncerWorker::checkCachedSyncChanges()
     if (!m_autoSync || m_sm->isRunning() || m_externalSyncPath.isEmpty()) {
         return;
     } else if (m_cachedSyncChanges > m_syncCacheSize) {
-        m_syncStartTimer->start();
+        scheduleSync();
     }
 }
+
+void DataSyncerWorker::scheduleSync(bool isUrgent)
+{
+    if (!m_autoSync || m_externalSyncPath.isEmpty()) {
+        return;
+    } else if (m_sm->isRunning() || m_packSM->isRunning()) {
+        qCDebug(SYNC_WORKER_CATEGORY) << "Sync in progress, deferring next one";
+        m_isSyncPending = true;
+        return;
+    }
+
+    if (!m_syncPendingTimer.isValid()) {
+        m_syncPendingTimer.start();
+    }
+
+    // Each request postpones the sync, coalescing bursts, but never past the max latency
+    qint64 delay = isUrgent ? 0 : syncStartTimeout * 1000;
+    if (!isUrgent && m_lastSyncTimer.isValid()) {   // Keep slow cycles apart
+        delay = qMax(delay, m_syncInterval - m_lastSyncTimer.elapsed());
+    }
+    delay = qBound<qint64>(0, delay, m_syncMaxLatency * 1000 - m_syncPendingTimer.elapsed());
+
+    m_syncStartTimer->start(delay);
+
+    qCDebug(SYNC_WORKER_CATEGORY) << "Sync scheduled in" << delay << "ms";
+
+    notifySyncSchedule();
+}
+
+void DataSyncerWorker::notifySyncSchedule() const
+{
+    QDateTime nextSyncTime;
+    if (m_syncStartTimer->isActive()) {
+        nextSyncTime = QDateTime::currentDateTimeUtc().addMSecs(m_syncStartTimer->remainingTime());
+    }
+
+    emit syncScheduleChanged(nextSyncTime, m_syncInterval / 1000);
+}
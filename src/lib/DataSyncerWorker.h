@@ -22,6 +22,10 @@
 #include <QObject>
 #include <QDir>
 #include <QSet>
+#include <QMap>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QVariantMap>
 
 #include "TimeLogHistory.h"
 
@@ -30,15 +34,21 @@ class QState;
 class QFinalState;
 class QTimer;
 class QFileSystemWatcher;
+class QFile;
 
 class TimeLogHistory;
+class TimeLogHistoryClient;
 class DBSyncer;
+class SyncFolderManifest;
+class SyncFileReader;
 
 class DataSyncerWorker : public QObject
 {
     Q_OBJECT
+    friend class SyncFileParserTask;
 public:
     explicit DataSyncerWorker(TimeLogHistory *db, QObject *parent = 0);
+    ~DataSyncerWorker();
 
     Q_INVOKABLE void init(const QString &dataPath);
 
@@ -47,8 +57,11 @@ public:
     Q_INVOKABLE void setAutoSync(bool autoSync);
     Q_INVOKABLE void setSyncCacheSize(int syncCacheSize);
     Q_INVOKABLE void setSyncCacheTimeout(int syncCacheTimeout);
+    Q_INVOKABLE void setSyncMaxLatency(int syncMaxLatency);
+    Q_INVOKABLE void setMetricsLogPath(const QString &path);
     Q_INVOKABLE void setSyncPath(const QString &path);
     Q_INVOKABLE void setNoPack(bool noPack);
+    Q_INVOKABLE void setCompression(bool compression);
 
 public slots:
     void sync(const QDateTime &start = QDateTime::currentDateTimeUtc());
@@ -63,34 +76,34 @@ signals:
     void dirsSynced(QPrivateSignal);
     void synced(QPrivateSignal);
     void stopped(QPrivateSignal);
+    void syncScheduleChanged(QDateTime nextSyncTime, int syncInterval) const;
+    void syncMetricsAvailable(QVariantMap metrics) const;
 
 private slots:
     void historyError(const QString &errorText);
     void historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields);
     void historyDataInserted(const TimeLogEntry &data);
     void historyDataRemoved(const TimeLogEntry &data);
+    void historyDataBatchRemoved(QVector<TimeLogEntry> data);
     void historyCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode> categories);
     void syncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
                            QVector<TimeLogSyncDataCategory> categoryData, QDateTime until);
     void syncExistsAvailable(bool isExists, QDateTime mBegin, QDateTime mEnd);
     void syncAmountAvailable(qlonglong size, QDateTime maxMTime, QDateTime mBegin, QDateTime mEnd);
-    void syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry> removedOld,
-                                 QVector<TimeLogSyncDataEntry> removedNew,
-                                 QVector<TimeLogSyncDataEntry> insertedOld,
-                                 QVector<TimeLogSyncDataEntry> insertedNew,
-                                 QVector<TimeLogSyncDataEntry> updatedOld,
-                                 QVector<TimeLogSyncDataEntry> updatedNew) const;
-    void syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory> removedOld,
-                                    QVector<TimeLogSyncDataCategory> removedNew,
-                                    QVector<TimeLogSyncDataCategory> addedOld,
-                                    QVector<TimeLogSyncDataCategory> addedNew,
-                                    QVector<TimeLogSyncDataCategory> updatedOld,
-                                    QVector<TimeLogSyncDataCategory> updatedNew) const;
+    void syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes) const;
+    void syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes) const;
     void syncDataSynced(const QDateTime &maxSyncDate);
     void syncFinished();
+    void fileParsed(int generation, int index, QString errorText,
+                    QVector<TimeLogSyncDataEntry> updatedData,
+                    QVector<TimeLogSyncDataEntry> removedData,
+                    QVector<TimeLogSyncDataCategory> categoryData);
 
     void packImported(QDateTime latestMTime);
     void packExported(QDateTime latestMTime);
+    void packEntryChangesAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes);
+    void packCategoryChangesAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes);
+    void packDeltasApplied();
 
     void startImport();
     void startExport();
@@ -101,36 +114,88 @@ private slots:
 
     void checkSyncFolder();
     void syncWatcherEvent(const QString &path);
+    void syncCycleStarted();
+    void syncCycleStopped();
+    void syncCycleFinished();
+    void scheduleUrgentSync();
 
 private:
+    struct SyncFileData
+    {
+        QVector<TimeLogSyncDataEntry> updatedData;
+        QVector<TimeLogSyncDataEntry> removedData;
+        QVector<TimeLogSyncDataCategory> categoryData;
+    };
+
+    // Header of the sync file, fingerprints are sorted and unique
+    struct SyncFileSummary
+    {
+        SyncFileSummary() : isValid(false), recordsCount(0) {}
+
+        bool isValid;
+        qint64 recordsCount;
+        QDateTime minMTime;
+        QDateTime maxMTime;
+        QVector<quint64> fingerprints;
+    };
+
     void compareWithDir(const QString &path);
     bool copyFiles(const QString &from, const QString &to, const QSet<QString> fileList,
-                   bool isRemoveSource);
+                   bool isRemoveSource, bool isCompressPack = false);
     bool copyFile(const QString &source, const QString &destination, bool isOverwrite,
-                  bool isRemoveSource) const;
+                  bool isRemoveSource, bool isCompressPack = false) const;
+    void updateManifests(const QString &source, const QString &destination) const;
+    bool isCompressedPack(QFile &file) const;
+    bool convertPack(QFile &source, QFile &destination, bool isCompress) const;
     bool exportFile(const QVector<TimeLogSyncDataEntry> &entryData,
                     const QVector<TimeLogSyncDataCategory> &categoryData);
+    bool writeSyncFile(const QString &filePath, const QVector<TimeLogSyncDataEntry> &entryData,
+                       const QVector<TimeLogSyncDataCategory> &categoryData) const;
+    static bool readSummary(SyncFileReader &reader, SyncFileSummary &summary);
+    bool readSyncFileSummary(const QString &path, SyncFileSummary &summary) const;
+    bool isFileCovered(const QString &fileName, const SyncFileSummary &summary) const;
+    void parseFiles();
     void importCurrentItem();
-    void importFile(const QString &path);
+    void mergeFile(const SyncFileData &fileData);
+    SyncFileData takeMergedData();
+    void syncMergedFiles();
     bool parseFile(const QString &path,
                    QVector<TimeLogSyncDataEntry> &updatedData,
                    QVector<TimeLogSyncDataEntry> &removedData,
-                   QVector<TimeLogSyncDataCategory> &categoryData) const;
+                   QVector<TimeLogSyncDataCategory> &categoryData, QString &errorText) const;
+    bool parseData(const uchar *data, qint64 size, const QString &path,
+                   QVector<TimeLogSyncDataEntry> &updatedData,
+                   QVector<TimeLogSyncDataEntry> &removedData,
+                   QVector<TimeLogSyncDataCategory> &categoryData, QString &errorText) const;
+    bool parseLegacyData(const QByteArray &rawData, const QString &path,
+                         QVector<TimeLogSyncDataEntry> &updatedData,
+                         QVector<TimeLogSyncDataEntry> &removedData,
+                         QVector<TimeLogSyncDataCategory> &categoryData, QString &errorText) const;
     void importPack(const QString &path);
     void processCurrentItemImported();
     void exportPack();
+    void startPackSync();
+    bool exportPackDelta();
     QString formatSyncEntryChange(const TimeLogSyncDataEntry &oldData,
                                   const TimeLogSyncDataEntry &newData) const;
     QString formatSyncCategoryChange(const TimeLogSyncDataCategory &oldData,
                                      const TimeLogSyncDataCategory &newData) const;
+    QDateTime packBaseMTime() const;
     QDateTime maxPackPeriodStart() const;
-    bool removeOldFiles(const QString &packName);
-    void addCachedSyncChange();
+    bool removeOldFiles(const QString &packName, const QDateTime &layerMTime);
+    void addCachedSyncChange(int count = 1);
     void addCachedSyncChanges(int count);
     void checkCachedSyncChanges();
+    void scheduleSync(bool isUrgent = false);
+    void notifySyncSchedule() const;
+    void startPhase(const char *phase);
+    void addMetric(const QString &name, qint64 value) const;
+    void writeMetricsLog(const QVariantMap &metrics) const;
 
     bool m_isInitialized;
     TimeLogHistory *m_db;
+    // Sync requests to the history, the network syncer shares it
+    TimeLogHistoryClient *m_dbClient;
     QString m_internalSyncPath;
     QStateMachine *m_sm;
     QState *m_exportState;
@@ -145,11 +210,25 @@ private:
     int m_syncCacheSize;
     QString m_externalSyncPath;
     bool m_noPack;
+    bool m_isCompression;
     QTimer *m_syncStartTimer;
     QFileSystemWatcher *m_syncWatcher;
     QTimer *m_syncWatcherTimer;
     int m_syncCacheTimeout;
     QTimer *m_syncCacheTimer;
+    int m_syncMaxLatency;
+    qint64 m_syncInterval;
+    qint64 m_syncDuration;
+    bool m_isSyncPending;
+    QElapsedTimer m_syncPendingTimer;
+    QElapsedTimer m_syncCycleTimer;
+    QElapsedTimer m_lastSyncTimer;
+    QString m_metricsLogPath;
+    mutable QVariantMap m_syncMetrics;
+    QString m_syncPhase;
+    const char *m_syncPhaseName;
+    qint64 m_syncPhaseTraceBegin;
+    QElapsedTimer m_syncPhaseTimer;
 
     QDir m_internalSyncDir;
     QString m_currentSyncPath;
@@ -158,6 +237,14 @@ private:
     int m_cachedSyncChanges;
     QStringList m_fileList;
     int m_currentIndex;
+    int m_parseIndex;
+    int m_parseGeneration;
+    QMap<int, SyncFileData> m_parsedFiles;
+    QVector<SyncFileSummary> m_fileSummaries;
+    bool m_isMergedSyncing;
+    int m_mergedFilesCount;
+    QHash<QUuid, TimeLogSyncDataEntry> m_mergedEntries;
+    QHash<QUuid, TimeLogSyncDataCategory> m_mergedCategories;
     QSet<QString> m_outFiles;
     QSet<QString> m_inFiles;
     bool m_wroteToExternalSync;
@@ -168,6 +255,16 @@ private:
     QString m_packName;
     QDateTime m_packMTime;
     bool m_forcePack;
+    QStringList m_packDeltas;
+    bool m_isPackCompaction;
+    bool m_isCollectingPackChanges;
+    QVector<TimeLogSyncDataEntry> m_packEntryChanges;
+    QVector<TimeLogSyncDataCategory> m_packCategoryChanges;
+
+    SyncFolderManifest *m_internalManifest;
+    SyncFolderManifest *m_externalManifest;
+
+    QThreadPool m_parseThreadPool;
 };
 
 #endif // DATASYNCERWORKER_H
@@ -0,0 +1,286 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QTimer>
+
+#include "NetworkSyncerWorker.h"
+#include "DBSyncer.h"
+#include "TimeLogHistoryClient.h"
+#include "TimeLogRemoteHistory.h"
+#include "TimeLogSyncServer.h"
+#include "TimeLogCategoryTreeNode.h"
+
+#include <QLoggingCategory>
+
+#define fail(message) \
+    do {    \
+        qCCritical(NETWORK_SYNC_WORKER_CATEGORY) << message;    \
+        emit error(message);   \
+    } while (0)
+
+Q_LOGGING_CATEGORY(NETWORK_SYNC_WORKER_CATEGORY, "NetworkSyncerWorker", QtInfoMsg)
+
+// Changes are sent to the peer shortly after they are made
+const int syncStartTimeout = 2;
+// Each range is a network round trip, so more of them are kept in flight
+const int networkSyncPrefetchDepth = 4;
+
+NetworkSyncerWorker::NetworkSyncerWorker(TimeLogHistory *db, QObject *parent) :
+    QObject(parent),
+    m_db(db),
+    m_dbClient(new TimeLogHistoryClient(db, this)),
+    m_remote(new TimeLogRemoteHistory(this)),
+    m_server(nullptr),
+    m_dbSyncer(nullptr),
+    m_syncStartTimer(new QTimer(this)),
+    m_autoSync(true),
+    m_peerPort(0),
+    m_serverPort(0),
+    m_isRunning(false),
+    m_isSyncPending(false)
+{
+    connect(m_remote, SIGNAL(connected()), this, SLOT(remoteConnected()));
+    connect(m_remote, SIGNAL(error(QString)), this, SLOT(remoteError(QString)));
+    connect(m_remote, SIGNAL(dataChanged()), this, SLOT(remoteDataChanged()));
+
+    m_syncStartTimer->setTimerType(Qt::VeryCoarseTimer);
+    m_syncStartTimer->setInterval(syncStartTimeout * 1000);
+    m_syncStartTimer->setSingleShot(true);
+    connect(m_syncStartTimer, SIGNAL(timeout()), this, SLOT(sync()));
+
+    connect(m_db, SIGNAL(error(QString)), this, SLOT(syncerError(QString)));
+    connect(m_db, SIGNAL(dataInserted(TimeLogEntry)), this, SLOT(historyDataChanged()));
+    connect(m_db, SIGNAL(dataImported(QVector<TimeLogEntry>)), this, SLOT(historyDataChanged()));
+    connect(m_db, SIGNAL(dataRemoved(TimeLogEntry)), this, SLOT(historyDataChanged()));
+    connect(m_db, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)), this, SLOT(historyDataChanged()));
+    connect(m_db, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
+            this, SLOT(historyDataChanged()));
+    connect(m_db, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
+            this, SLOT(historyDataChanged()));
+}
+
+void NetworkSyncerWorker::setAutoSync(bool autoSync)
+{
+    m_autoSync = autoSync;
+
+    if (!m_autoSync) {
+        m_syncStartTimer->stop();
+    }
+}
+
+void NetworkSyncerWorker::setToken(const QString &token)
+{
+    if (m_token == token) {
+        return;
+    }
+
+    m_token = token;
+    m_remote->setToken(token);
+    // Server refuses to listen without the token
+    restartServer();
+}
+
+void NetworkSyncerWorker::setPeer(const QString &host, int port)
+{
+    if (m_peerHost == host && m_peerPort == port) {
+        return;
+    }
+
+    m_peerHost = host;
+    m_peerPort = port;
+    m_remote->disconnectFromPeer();
+
+    if (m_isRunning) {
+        stopSync();
+    }
+}
+
+void NetworkSyncerWorker::setServerPort(int port)
+{
+    if (m_serverPort == port) {
+        return;
+    }
+
+    m_serverPort = port;
+    restartServer();
+}
+
+void NetworkSyncerWorker::setServerAddress(const QString &address)
+{
+    if (m_serverAddress == address) {
+        return;
+    }
+
+    m_serverAddress = address;
+    restartServer();
+}
+
+void NetworkSyncerWorker::sync()
+{
+    if (m_peerHost.isEmpty() || m_peerPort <= 0) {
+        fail(tr("Set sync peer"));
+        return;
+    } else if (m_isRunning) {
+        qCDebug(NETWORK_SYNC_WORKER_CATEGORY) << "Sync already in progress";
+        m_isSyncPending = true;
+        return;
+    }
+
+    m_isRunning = true;
+    m_isSyncPending = false;
+    m_syncStartTimer->stop();
+    qCInfo(NETWORK_SYNC_WORKER_CATEGORY) << "Syncing with peer" << m_peerHost << m_peerPort;
+
+    emit started(QPrivateSignal());
+
+    if (m_remote->isConnected()) {
+        remoteConnected();
+    } else {
+        m_remote->connectToPeer(m_peerHost, m_peerPort);
+    }
+}
+
+void NetworkSyncerWorker::historyDataChanged()
+{
+    // Own changes, made by the pull from the peer
+    if (m_isRunning) {
+        return;
+    }
+
+    if (m_autoSync && !m_peerHost.isEmpty()) {
+        m_syncStartTimer->start();
+    }
+}
+
+void NetworkSyncerWorker::remoteDataChanged()
+{
+    if (m_isRunning) {
+        m_isSyncPending = true;
+    } else if (m_autoSync) {
+        m_syncStartTimer->start();
+    }
+}
+
+void NetworkSyncerWorker::remoteConnected()
+{
+    if (!m_isRunning || m_dbSyncer) {
+        return;
+    }
+
+    qCDebug(NETWORK_SYNC_WORKER_CATEGORY) << "Connected, pulling changes";
+
+    startSyncer(m_remote, m_dbClient, SLOT(pulled(QDateTime)));
+}
+
+void NetworkSyncerWorker::remoteError(const QString &errorText)
+{
+    if (!m_isRunning) {
+        qCWarning(NETWORK_SYNC_WORKER_CATEGORY) << "Peer error while idle:" << errorText;
+        return;
+    }
+
+    stopSync();
+    fail(errorText);
+}
+
+void NetworkSyncerWorker::pulled(QDateTime latestMTime)
+{
+    qCDebug(NETWORK_SYNC_WORKER_CATEGORY) << "Pulled changes up to" << latestMTime << ", pushing changes";
+
+    m_dbSyncer->deleteLater();
+    m_dbSyncer = nullptr;
+
+    startSyncer(m_dbClient, m_remote, SLOT(pushed(QDateTime)));
+}
+
+void NetworkSyncerWorker::pushed(QDateTime latestMTime)
+{
+    qCInfo(NETWORK_SYNC_WORKER_CATEGORY) << "Synced with peer, pushed changes up to" << latestMTime;
+
+    m_dbSyncer->deleteLater();
+    m_dbSyncer = nullptr;
+    m_isRunning = false;
+
+    emit synced(QPrivateSignal());
+
+    if (m_isSyncPending && m_autoSync) {
+        m_isSyncPending = false;
+        m_syncStartTimer->start();
+    }
+}
+
+void NetworkSyncerWorker::syncerError(const QString &errorText)
+{
+    if (!m_isRunning) {
+        return;
+    }
+
+    stopSync();
+    fail(errorText);
+}
+
+void NetworkSyncerWorker::startSyncer(QObject *source, QObject *destination, const char *finishedSlot)
+{
+    m_dbSyncer = new DBSyncer(source, destination, this);
+    m_dbSyncer->setPrefetchDepth(networkSyncPrefetchDepth);
+    connect(m_dbSyncer, SIGNAL(finished(QDateTime)), this, finishedSlot);
+    connect(m_dbSyncer, SIGNAL(error(QString)), this, SLOT(syncerError(QString)));
+    m_dbSyncer->start(false);
+}
+
+void NetworkSyncerWorker::restartServer()
+{
+    if (m_server) {
+        m_server->close();
+        m_server->deleteLater();
+        m_server = nullptr;
+    }
+
+    if (m_serverPort <= 0) {
+        return;
+    } else if (m_token.isEmpty()) {
+        fail(tr("Set sync token to accept the peers"));
+        return;
+    }
+
+    QHostAddress address(QHostAddress::LocalHost);
+    if (!m_serverAddress.isEmpty() && !address.setAddress(m_serverAddress)) {
+        fail(tr("Invalid sync server address %1").arg(m_serverAddress));
+        return;
+    }
+
+    m_server = new TimeLogSyncServer(m_db, this);
+    m_server->setToken(m_token);
+    if (!m_server->listen(m_serverPort, address)) {
+        fail(tr("Fail to listen on port %1").arg(m_serverPort));
+    }
+}
+
+void NetworkSyncerWorker::stopSync()
+{
+    if (m_dbSyncer) {
+        m_dbSyncer->disconnect(this);
+        m_dbSyncer->deleteLater();
+        m_dbSyncer = nullptr;
+    }
+    m_remote->disconnectFromPeer();
+    m_isRunning = false;
+    m_isSyncPending = false;
+
+    emit stopped(QPrivateSignal());
+}
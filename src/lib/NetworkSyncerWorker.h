@@ -0,0 +1,89 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef NETWORKSYNCERWORKER_H
+#define NETWORKSYNCERWORKER_H
+
+#include <QObject>
+#include <QDateTime>
+
+#include "TimeLogHistory.h"
+
+class QTimer;
+
+class DBSyncer;
+class TimeLogHistoryClient;
+class TimeLogRemoteHistory;
+class TimeLogSyncServer;
+
+// Syncs the history directly with the peer, running DBSyncer over the network both ways
+class NetworkSyncerWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NetworkSyncerWorker(TimeLogHistory *db, QObject *parent = 0);
+
+    Q_INVOKABLE void setAutoSync(bool autoSync);
+    Q_INVOKABLE void setToken(const QString &token);
+    Q_INVOKABLE void setPeer(const QString &host, int port);
+    Q_INVOKABLE void setServerPort(int port);
+    // Empty address is for the local connections only
+    Q_INVOKABLE void setServerAddress(const QString &address);
+
+public slots:
+    void sync();
+
+signals:
+    void error(const QString &errorText) const;
+
+    void started(QPrivateSignal);
+    void synced(QPrivateSignal);
+    void stopped(QPrivateSignal);
+
+private slots:
+    void historyDataChanged();
+    void remoteDataChanged();
+    void remoteConnected();
+    void remoteError(const QString &errorText);
+    void pulled(QDateTime latestMTime);
+    void pushed(QDateTime latestMTime);
+    void syncerError(const QString &errorText);
+
+private:
+    void startSyncer(QObject *source, QObject *destination, const char *finishedSlot);
+    void stopSync();
+    void restartServer();
+
+    TimeLogHistory *m_db;
+    // Sync requests to the history, the folder syncer and the server share it
+    TimeLogHistoryClient *m_dbClient;
+    TimeLogRemoteHistory *m_remote;
+    TimeLogSyncServer *m_server;
+    DBSyncer *m_dbSyncer;
+    QTimer *m_syncStartTimer;
+    bool m_autoSync;
+    QString m_token;
+    QString m_peerHost;
+    int m_peerPort;
+    int m_serverPort;
+    QString m_serverAddress;
+    bool m_isRunning;
+    bool m_isSyncPending;
+};
+
+#endif // NETWORKSYNCERWORKER_H
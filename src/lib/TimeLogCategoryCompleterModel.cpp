@@ -0,0 +1,155 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "TimeLogCategoryCompleterModel.h"
+#include "TimeLogCategoryTreeNode.h"
+#include "TimeTracker.h"
+#include "TimeLogTrace.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(CATEGORY_COMPLETER_CATEGORY, "TimeLogCategoryCompleterModel", QtInfoMsg)
+
+const int defaultLimit(10);
+
+TimeLogCategoryCompleterModel::TimeLogCategoryCompleterModel(QObject *parent) :
+    SUPER(parent),
+    m_timeTracker(nullptr),
+    m_limit(defaultLimit)
+{
+}
+
+int TimeLogCategoryCompleterModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent)
+
+    return m_matches.size();
+}
+
+QVariant TimeLogCategoryCompleterModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_matches.size()) {
+        return QVariant();
+    }
+
+    const TimeLogCategoryIndex::Match &match = m_matches.at(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case FullNameRole:
+        return QVariant::fromValue(match.fullName);
+    case NameRole:
+        return QVariant::fromValue(match.name);
+    case ItemsCountRole:
+        return QVariant::fromValue(match.itemsCount);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant TimeLogCategoryCompleterModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+
+    if (orientation == Qt::Horizontal) {
+        return QString("data");
+    } else {
+        return section;
+    }
+}
+
+QHash<int, QByteArray> TimeLogCategoryCompleterModel::roleNames() const
+{
+    QHash<int, QByteArray> roles = SUPER::roleNames();
+    roles[NameRole] = "name";
+    roles[FullNameRole] = "fullName";
+    roles[ItemsCountRole] = "itemsCount";
+
+    return roles;
+}
+
+void TimeLogCategoryCompleterModel::setTimeTracker(TimeTracker *timeTracker)
+{
+    if (m_timeTracker == timeTracker) {
+        return;
+    }
+
+    if (m_timeTracker) {
+        disconnect(m_timeTracker, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
+                   this, SLOT(updateCategories(QSharedPointer<TimeLogCategoryTreeNode>)));
+    }
+
+    m_timeTracker = timeTracker;
+
+    if (m_timeTracker) {
+        connect(m_timeTracker, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
+                this, SLOT(updateCategories(QSharedPointer<TimeLogCategoryTreeNode>)));
+    }
+
+    updateCategories(m_timeTracker ? m_timeTracker->categories()
+                                   : QSharedPointer<TimeLogCategoryTreeNode>());
+
+    emit timeTrackerChanged(m_timeTracker);
+}
+
+void TimeLogCategoryCompleterModel::setFilter(const QString &filter)
+{
+    if (m_filter == filter) {
+        return;
+    }
+
+    m_filter = filter;
+
+    refresh();
+
+    emit filterChanged(m_filter);
+}
+
+void TimeLogCategoryCompleterModel::setLimit(int limit)
+{
+    if (m_limit == limit) {
+        return;
+    }
+
+    m_limit = limit;
+
+    refresh();
+
+    emit limitChanged(m_limit);
+}
+
+void TimeLogCategoryCompleterModel::updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
+{
+    TIMELOG_TRACE_SPAN("model", "completerCategories");
+
+    m_index.update(categories);
+
+    qCDebug(CATEGORY_COMPLETER_CATEGORY) << "Categories indexed" << m_index.size();
+
+    refresh();
+}
+
+void TimeLogCategoryCompleterModel::refresh()
+{
+    // Only the first matches are kept, so the reset is cheaper than the diff
+    beginResetModel();
+    m_matches = m_index.find(m_filter, m_limit);
+    endResetModel();
+}
@@ -0,0 +1,74 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGCATEGORYCOMPLETERMODEL_H
+#define TIMELOGCATEGORYCOMPLETERMODEL_H
+
+#include <QAbstractListModel>
+#include <QSharedPointer>
+
+#include "TimeLogCategoryIndex.h"
+
+class TimeLogCategoryTreeNode;
+class TimeTracker;
+
+class TimeLogCategoryCompleterModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(TimeTracker* timeTracker MEMBER m_timeTracker WRITE setTimeTracker NOTIFY timeTrackerChanged)
+    Q_PROPERTY(QString filter MEMBER m_filter WRITE setFilter NOTIFY filterChanged)
+    Q_PROPERTY(int limit MEMBER m_limit WRITE setLimit NOTIFY limitChanged)
+    typedef QAbstractListModel SUPER;
+public:
+    enum Roles {
+        NameRole = Qt::UserRole + 1,
+        FullNameRole,
+        ItemsCountRole
+    };
+
+    TimeLogCategoryCompleterModel(QObject *parent = 0);
+
+    virtual int rowCount(const QModelIndex &parent) const;
+
+    virtual QVariant data(const QModelIndex &index, int role) const;
+    virtual QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+    virtual QHash<int, QByteArray> roleNames() const;
+
+    void setTimeTracker(TimeTracker *timeTracker);
+    void setFilter(const QString &filter);
+    void setLimit(int limit);
+
+signals:
+    void timeTrackerChanged(TimeTracker *newTimeTracker);
+    void filterChanged(const QString &newFilter);
+    void limitChanged(int newLimit);
+
+private slots:
+    void updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories);
+
+private:
+    void refresh();
+
+    TimeTracker *m_timeTracker;
+    QString m_filter;
+    int m_limit;
+    TimeLogCategoryIndex m_index;
+    QVector<TimeLogCategoryIndex::Match> m_matches;
+};
+
+#endif // TIMELOGCATEGORYCOMPLETERMODEL_H
@@ -49,8 +49,6 @@ int TimeLogCategoryDepthModel::rowCount(const QModelIndex &parent) const
                                                                       : nullptr;
     }
 
-    int result = m_categoryFields.size() + ((!current || current->children().isEmpty()) ? 0 : 1);
-    qCDebug(CATEGORY_DEPTH_CATEGORY) << result;
     return m_categoryFields.size() + ((!current || current->children().isEmpty()) ? 0 : 1);
 }
 
@@ -65,16 +63,17 @@ QVariant TimeLogCategoryDepthModel::data(const QModelIndex &index, int role) con
     case NameRole:
         return QVariant::fromValue(m_categoryFields.at(index.row()));
     case FullNameRole:
-        return QVariant::fromValue(m_categoryFields.mid(0, index.row() + 1).join(" > "));
+        if (m_categoryEntries.size() > index.row()) {
+            return fullName(m_categoryEntries.at(index.row()));
+        } else {
+            return QVariant::fromValue(m_categoryFields.mid(0, index.row() + 1).join(" > "));
+        }
     case SubcategoriesRole:
         if (index.row() == 0) {
-            qCDebug(CATEGORY_DEPTH_CATEGORY) << index.row() << "subcategories (root):" << m_root->children().keys();
-            return QVariant::fromValue(m_root->children().keys());
+            return subcategories(m_root.data());
         } else if (m_categoryEntries.size() > index.row() - 1) {
-            qCDebug(CATEGORY_DEPTH_CATEGORY) << index.row() << "subcategories:" << m_categoryEntries.at(index.row() - 1)->children().keys();
-            return QVariant::fromValue(m_categoryEntries.at(index.row() - 1)->children().keys());
+            return subcategories(m_categoryEntries.at(index.row() - 1));
         } else {
-            qCDebug(CATEGORY_DEPTH_CATEGORY) << index.row() << "subcategories: empty";
             return QVariant();
         }
     case CurrentSubcategoryRole:
@@ -93,11 +92,9 @@ QVariant TimeLogCategoryDepthModel::data(const QModelIndex &index, int role) con
             category = nullptr;
         }
         if (!category || m_categoryFields.size() <= index.row()) {
-            qCDebug(CATEGORY_DEPTH_CATEGORY) << index.row() << "current index:" << 0 << category << m_categoryFields;
             return QVariant::fromValue(0);
         } else {
-            qCDebug(CATEGORY_DEPTH_CATEGORY) << index.row() << "current index:" << category->children().keys().indexOf(m_categoryFields.at(index.row())) + 1;
-            return QVariant::fromValue(category->children().keys().indexOf(m_categoryFields.at(index.row())) + 1);
+            return QVariant::fromValue(category->childIndex(m_categoryFields.at(index.row())) + 1);
         }
     }
     default:
@@ -163,9 +160,9 @@ bool TimeLogCategoryDepthModel::setData(const QModelIndex &index, const QVariant
         if (newIndex <= 0) {
             subcategoryName = QString("");
         } else if (index.row() == 0) {
-            subcategoryName = m_root->children().keys().at(newIndex - 1);
+            subcategoryName = m_root->children().at(newIndex - 1)->name;
         } else if (m_categoryEntries.size() > index.row() - 1) {
-            subcategoryName = m_categoryEntries.at(index.row() - 1)->children().keys().at(newIndex - 1);
+            subcategoryName = m_categoryEntries.at(index.row() - 1)->children().at(newIndex - 1)->name;
         } else {
             subcategoryName = QString("");
         }
@@ -230,9 +227,48 @@ void TimeLogCategoryDepthModel::setCategory(const QString &category)
 
 void TimeLogCategoryDepthModel::updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
 {
+    if (m_root && categories) {
+        // Resolve the selection in the new tree, it stays as is when the whole path still exists
+        QList<TimeLogCategoryTreeNode*> categoryEntries;
+        TimeLogCategoryTreeNode *category = categories.data();
+        for (const QString &categoryField: m_categoryFields) {
+            category = category->child(categoryField);
+            if (!category) {
+                break;
+            }
+            categoryEntries.append(category);
+        }
+
+        if (categoryEntries.size() == m_categoryFields.size()) {
+            int oldRows = rowCount(QModelIndex());
+            int newRows = m_categoryFields.size() + (category->children().isEmpty() ? 0 : 1);
+
+            if (newRows > oldRows) {
+                beginInsertRows(QModelIndex(), oldRows, newRows - 1);
+            } else if (newRows < oldRows) {
+                beginRemoveRows(QModelIndex(), newRows, oldRows - 1);
+            }
+            m_root = categories;
+            clearCache();
+            m_categoryEntries.swap(categoryEntries);
+            if (newRows > oldRows) {
+                endInsertRows();
+            } else if (newRows < oldRows) {
+                endRemoveRows();
+            }
+
+            if (qMin(oldRows, newRows) > 0) {
+                emit dataChanged(index(0, 0, QModelIndex()), index(qMin(oldRows, newRows) - 1, 0, QModelIndex()),
+                                 QVector<int>() << SubcategoriesRole << CurrentIndexRole);
+            }
+            return;
+        }
+    }
+
     beginResetModel();
 
     m_root = categories;
+    clearCache();
 
     QStringList categoryFields(m_categoryFields);
 
@@ -275,7 +311,7 @@ void TimeLogCategoryDepthModel::setCategoryFields(int startLevel, const QStringL
     }
     TimeLogCategoryTreeNode *category = parentCategory;
     for (int i = 0; i < categoryFields.size() && category && category->depth() < newSize; i++) {
-        category = category->children().value(categoryFields.at(i));
+        category = category->child(categoryFields.at(i));
     }
 
     TimeLogCategoryTreeNode *current;
@@ -302,7 +338,7 @@ void TimeLogCategoryDepthModel::setCategoryFields(int startLevel, const QStringL
     bool isItemsRemove = removeStart <= removeEnd;
 
     if (parentCategory && !categoryFields.isEmpty()) {
-        category = parentCategory->children().value(categoryFields.constFirst());
+        category = parentCategory->child(categoryFields.constFirst());
     }
 
     if (isItemsRemove) {
@@ -319,7 +355,7 @@ void TimeLogCategoryDepthModel::setCategoryFields(int startLevel, const QStringL
     }
 
     for (int i = 0; i < categoryFields.size() && category && category->depth() < startRow + 1; i++) {
-        category = category->children().value(categoryFields.at(i));
+        category = category->child(categoryFields.at(i));
     }
 
     if (isItemsEdit) {
@@ -361,7 +397,7 @@ void TimeLogCategoryDepthModel::setCategoryFields(int startLevel, const QStringL
 
         for (int i = 1; i + startRow < newSize; i++) {
             if (category) {
-                category = category->children().value(categoryFields.at(i));
+                category = category->child(categoryFields.at(i));
                 if (category) {
                     m_categoryEntries.append(category);
                 }
@@ -376,3 +412,29 @@ void TimeLogCategoryDepthModel::setCategoryFields(int startLevel, const QStringL
 
     emit categoryChanged();
 }
+
+QVariant TimeLogCategoryDepthModel::subcategories(const TimeLogCategoryTreeNode *node) const
+{
+    QHash<const TimeLogCategoryTreeNode*, QVariant>::const_iterator it = m_subcategoriesCache.constFind(node);
+    if (it == m_subcategoriesCache.constEnd()) {
+        it = m_subcategoriesCache.insert(node, QVariant::fromValue(node->childNames()));
+    }
+
+    return it.value();
+}
+
+QVariant TimeLogCategoryDepthModel::fullName(const TimeLogCategoryTreeNode *node) const
+{
+    QHash<const TimeLogCategoryTreeNode*, QVariant>::const_iterator it = m_fullNameCache.constFind(node);
+    if (it == m_fullNameCache.constEnd()) {
+        it = m_fullNameCache.insert(node, QVariant::fromValue(node->fullName()));
+    }
+
+    return it.value();
+}
+
+void TimeLogCategoryDepthModel::clearCache()
+{
+    m_subcategoriesCache.clear();
+    m_fullNameCache.clear();
+}
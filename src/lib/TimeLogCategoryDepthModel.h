@@ -68,12 +68,20 @@ private slots:
 private:
     void setSubcategory(int level, const QString &subcategory);
     void setCategoryFields(int rowIndex, const QStringList &categoryFields);
+    QVariant subcategories(const TimeLogCategoryTreeNode *node) const;
+    QVariant fullName(const TimeLogCategoryTreeNode *node) const;
+    void clearCache();
 
     TimeTracker *m_timeTracker;
     QSharedPointer<TimeLogCategoryTreeNode> m_root;
     QStringList m_categoryFields;
     QList<TimeLogCategoryTreeNode*> m_categoryEntries;
     const QRegularExpression m_splitRegexp;
+
+    // Tree nodes are never modified once published, so per-node values stay
+    // valid until the root is replaced
+    mutable QHash<const TimeLogCategoryTreeNode*, QVariant> m_subcategoriesCache;
+    mutable QHash<const TimeLogCategoryTreeNode*, QVariant> m_fullNameCache;
 };
 
 #endif // TIMELOGCATEGORYDEPTHMODEL_H
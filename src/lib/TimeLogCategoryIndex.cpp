@@ -0,0 +1,340 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <algorithm>
+
+#include <QRegularExpression>
+
+#include "TimeLogCategoryIndex.h"
+#include "TimeLogCategoryTreeNode.h"
+
+const int trigramSize(3);
+const QString categorySeparator(" > ");
+const QRegularExpression separatorRegexp("\\s*>\\s*");
+
+// Same form as the keys of the full names, so the fragments with the separator match too
+static QString normalizeKey(const QString &text)
+{
+    return text.simplified().toLower().replace(separatorRegexp, categorySeparator);
+}
+
+static bool matchSubstring(const QString &itemKey, const QString &key, TimeLogCategoryIndex::MatchQuality &quality)
+{
+    if (itemKey.startsWith(key)) {
+        quality = (itemKey.size() == key.size() ? TimeLogCategoryIndex::ExactMatch
+                                                : TimeLogCategoryIndex::PrefixMatch);
+    } else if (itemKey.contains(categorySeparator + key)) {
+        quality = TimeLogCategoryIndex::SegmentPrefixMatch;
+    } else if (itemKey.contains(key)) {
+        quality = TimeLogCategoryIndex::SubstringMatch;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+TimeLogCategoryIndex::TimeLogCategoryIndex() :
+    m_removedCount(0)
+{
+    clear();
+}
+
+void TimeLogCategoryIndex::update(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
+{
+    if (!categories) {
+        clear();
+        return;
+    }
+
+    const TimeLogCategoryTreeDiff &diff = categories->diff();
+    if (!m_root || diff.isRebuilt || diff.base != m_root.data()) {
+        rebuild(categories);
+        return;
+    }
+
+    // Path could be listed more than once in the diff, so each one is resolved in the new tree
+    for (const QString &fullName: diff.added) {
+        updatePath(categories.data(), fullName);
+    }
+    for (const QString &fullName: diff.removed) {
+        updatePath(categories.data(), fullName);
+    }
+    for (const QString &fullName: diff.changed) {
+        updatePath(categories.data(), fullName);
+    }
+
+    m_root = categories;
+
+    if (m_removedCount > m_items.size() / 2) {
+        rebuild(categories);
+    }
+}
+
+void TimeLogCategoryIndex::clear()
+{
+    m_root.reset();
+    m_items.clear();
+    m_ids.clear();
+    m_removedCount = 0;
+    m_trie.clear();
+    m_trie.append(TrieNode());
+    m_trigrams.clear();
+}
+
+int TimeLogCategoryIndex::size() const
+{
+    return m_ids.size();
+}
+
+QVector<TimeLogCategoryIndex::Match> TimeLogCategoryIndex::find(const QString &query, int limit) const
+{
+    QString key(normalizeKey(query));
+
+    QHash<int, MatchQuality> matches;
+    if (key.isEmpty()) {
+        for (int id: m_ids) {
+            matches.insert(id, PrefixMatch);
+        }
+    } else if (key.size() < trigramSize) {
+        findSegmentPrefix(key, matches);
+    } else {
+        findSubstring(key, matches);
+        if (limit <= 0 || matches.size() < limit) {
+            findFuzzy(key, matches);
+        }
+    }
+
+    QVector<Candidate> candidates;
+    candidates.reserve(matches.size());
+    for (auto it = matches.constBegin(); it != matches.constEnd(); ++it) {
+        Candidate candidate;
+        candidate.id = it.key();
+        candidate.quality = it.value();
+        candidates.append(candidate);
+    }
+
+    int count = (limit > 0 ? qMin(limit, candidates.size()) : candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                      [this](const Candidate &left, const Candidate &right) {
+        return isBetter(left, right);
+    });
+
+    QVector<Match> result;
+    result.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const Item &item = m_items.at(candidates.at(i).id);
+        Match match;
+        match.fullName = item.fullName;
+        match.name = item.name;
+        match.itemsCount = item.itemsCount;
+        match.quality = candidates.at(i).quality;
+        result.append(match);
+    }
+
+    return result;
+}
+
+void TimeLogCategoryIndex::rebuild(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
+{
+    clear();
+
+    m_root = categories;
+    for (const TimeLogCategoryTreeNode *child: m_root->children()) {
+        addNode(child);
+    }
+}
+
+void TimeLogCategoryIndex::addNode(const TimeLogCategoryTreeNode *node)
+{
+    addItem(node, node->fullName());
+    for (const TimeLogCategoryTreeNode *child: node->children()) {
+        addNode(child);
+    }
+}
+
+void TimeLogCategoryIndex::updatePath(const TimeLogCategoryTreeNode *root, const QString &fullName)
+{
+    const TimeLogCategoryTreeNode *node = root;
+    for (const QString &field: fullName.split(categorySeparator)) {
+        node = node->child(field);
+        if (!node) {
+            removeItem(fullName);
+            return;
+        }
+    }
+
+    int id = m_ids.value(fullName, -1);
+    if (id == -1) {
+        addItem(node, fullName);
+    } else {
+        m_items[id].itemsCount = node->itemsCount;
+    }
+}
+
+void TimeLogCategoryIndex::addItem(const TimeLogCategoryTreeNode *node, const QString &fullName)
+{
+    int id = m_items.size();
+
+    Item item;
+    item.fullName = fullName;
+    item.name = node->name;
+    item.key = fullName.toLower();
+    item.itemsCount = node->itemsCount;
+    item.isValid = true;
+    m_items.append(item);
+    m_ids.insert(fullName, id);
+
+    for (const QString &segment: item.key.split(categorySeparator)) {
+        addSegment(segment, id);
+    }
+
+    for (int i = 0; i + trigramSize <= item.key.size(); i++) {
+        QVector<int> &ids = m_trigrams[item.key.mid(i, trigramSize)];
+        // Repeated trigram of the same name is listed once
+        if (ids.isEmpty() || ids.constLast() != id) {
+            ids.append(id);
+        }
+    }
+}
+
+void TimeLogCategoryIndex::removeItem(const QString &fullName)
+{
+    QHash<QString, int>::iterator it = m_ids.find(fullName);
+    if (it == m_ids.end()) {
+        return;
+    }
+
+    m_items[it.value()].isValid = false;
+    m_ids.erase(it);
+    m_removedCount++;
+}
+
+void TimeLogCategoryIndex::addSegment(const QString &segment, int id)
+{
+    int node = 0;
+    for (const QChar &c: segment) {
+        int child = m_trie.at(node).children.value(c, -1);
+        if (child == -1) {
+            child = m_trie.size();
+            m_trie.append(TrieNode());
+            m_trie[node].children.insert(c, child);
+        }
+        node = child;
+    }
+
+    m_trie[node].items.append(id);
+}
+
+void TimeLogCategoryIndex::findSegmentPrefix(const QString &prefix, QHash<int, MatchQuality> &matches) const
+{
+    int node = 0;
+    for (const QChar &c: prefix) {
+        node = m_trie.at(node).children.value(c, -1);
+        if (node == -1) {
+            return;
+        }
+    }
+
+    QVector<int> stack;
+    stack.append(node);
+    while (!stack.isEmpty()) {
+        const TrieNode &trieNode = m_trie.at(stack.takeLast());
+        for (int id: trieNode.items) {
+            const Item &item = m_items.at(id);
+            if (!item.isValid) {
+                continue;
+            }
+            MatchQuality quality;
+            if (matchSubstring(item.key, prefix, quality)) {
+                matches.insert(id, quality);
+            }
+        }
+        for (int child: trieNode.children) {
+            stack.append(child);
+        }
+    }
+}
+
+void TimeLogCategoryIndex::findSubstring(const QString &key, QHash<int, MatchQuality> &matches) const
+{
+    // The rarest trigram of the key gives the shortest list to check
+    const QVector<int> *ids = nullptr;
+    for (int i = 0; i + trigramSize <= key.size(); i++) {
+        QHash<QString, QVector<int> >::const_iterator it = m_trigrams.constFind(key.mid(i, trigramSize));
+        if (it == m_trigrams.constEnd()) {
+            return;
+        }
+        if (!ids || it.value().size() < ids->size()) {
+            ids = &it.value();
+        }
+    }
+
+    for (int id: *ids) {
+        const Item &item = m_items.at(id);
+        if (!item.isValid) {
+            continue;
+        }
+        MatchQuality quality;
+        if (matchSubstring(item.key, key, quality)) {
+            matches.insert(id, quality);
+        }
+    }
+}
+
+void TimeLogCategoryIndex::findFuzzy(const QString &key, QHash<int, MatchQuality> &matches) const
+{
+    // Characters of the key in the same order, anything could be between them
+    for (int id: m_ids) {
+        if (matches.contains(id)) {
+            continue;
+        }
+
+        const QString &itemKey = m_items.at(id).key;
+        int pos = 0;
+        for (const QChar &c: key) {
+            if (c.isSpace() || c == QLatin1Char('>')) {
+                continue;
+            }
+            pos = itemKey.indexOf(c, pos);
+            if (pos == -1) {
+                break;
+            }
+            pos++;
+        }
+
+        if (pos != -1) {
+            matches.insert(id, FuzzyMatch);
+        }
+    }
+}
+
+bool TimeLogCategoryIndex::isBetter(const Candidate &left, const Candidate &right) const
+{
+    if (left.quality != right.quality) {
+        return left.quality > right.quality;
+    }
+
+    const Item &leftItem = m_items.at(left.id);
+    const Item &rightItem = m_items.at(right.id);
+    if (leftItem.itemsCount != rightItem.itemsCount) {
+        return leftItem.itemsCount > rightItem.itemsCount;
+    }
+
+    return leftItem.fullName < rightItem.fullName;
+}
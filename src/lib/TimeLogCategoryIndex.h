@@ -0,0 +1,103 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGCATEGORYINDEX_H
+#define TIMELOGCATEGORYINDEX_H
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+class TimeLogCategoryTreeNode;
+
+// Lookup of the categories by a typed fragment at any depth of the hierarchy.
+// Segment prefixes are found by the trie, longer fragments by the trigrams of the full names.
+class TimeLogCategoryIndex
+{
+public:
+    enum MatchQuality {
+        FuzzyMatch,
+        SubstringMatch,
+        SegmentPrefixMatch,
+        PrefixMatch,
+        ExactMatch
+    };
+
+    struct Match
+    {
+        QString fullName;
+        QString name;
+        int itemsCount;
+        MatchQuality quality;
+    };
+
+    TimeLogCategoryIndex();
+
+    // Applies the diff of the tree, if it was cloned from the indexed one, rebuilds otherwise
+    void update(const QSharedPointer<TimeLogCategoryTreeNode> &categories);
+    void clear();
+
+    int size() const;
+
+    // Sorted by the match quality, then by the entries count, empty query matches everything
+    QVector<Match> find(const QString &query, int limit) const;
+
+private:
+    struct Item
+    {
+        QString fullName;
+        QString name;
+        QString key;
+        int itemsCount;
+        bool isValid;
+    };
+
+    struct TrieNode
+    {
+        QHash<QChar, int> children;
+        QVector<int> items;
+    };
+
+    struct Candidate
+    {
+        int id;
+        MatchQuality quality;
+    };
+
+    void rebuild(const QSharedPointer<TimeLogCategoryTreeNode> &categories);
+    void addNode(const TimeLogCategoryTreeNode *node);
+    void updatePath(const TimeLogCategoryTreeNode *root, const QString &fullName);
+    void addItem(const TimeLogCategoryTreeNode *node, const QString &fullName);
+    void removeItem(const QString &fullName);
+    void addSegment(const QString &segment, int id);
+    void findSegmentPrefix(const QString &prefix, QHash<int, MatchQuality> &matches) const;
+    void findSubstring(const QString &key, QHash<int, MatchQuality> &matches) const;
+    void findFuzzy(const QString &key, QHash<int, MatchQuality> &matches) const;
+    bool isBetter(const Candidate &left, const Candidate &right) const;
+
+    QSharedPointer<TimeLogCategoryTreeNode> m_root;
+    // Removed items are only marked, till the index is rebuilt
+    QVector<Item> m_items;
+    QHash<QString, int> m_ids;
+    int m_removedCount;
+    QVector<TrieNode> m_trie;
+    QHash<QString, QVector<int> > m_trigrams;
+};
+
+#endif // TIMELOGCATEGORYINDEX_H
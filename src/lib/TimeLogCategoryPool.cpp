@@ -0,0 +1,68 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QReadWriteLock>
+#include <QSet>
+
+#include "TimeLogCategoryPool.h"
+
+// Upper bound for the names kept, there are usually a few hundred of them, the rest is
+// returned as is in the unlikely case the pool fills up
+static const int maxPoolSize(65536);
+
+Q_GLOBAL_STATIC(QReadWriteLock, poolLock)
+Q_GLOBAL_STATIC(QSet<QString>, pool)
+
+QString TimeLogCategoryPool::intern(const QString &category)
+{
+    if (category.isEmpty()) {
+        return category;
+    }
+
+    {
+        QReadLocker locker(poolLock());
+        QSet<QString>::const_iterator it = pool()->constFind(category);
+        if (it != pool()->constEnd()) {
+            return *it;
+        }
+    }
+
+    QWriteLocker locker(poolLock());
+    QSet<QString>::const_iterator it = pool()->constFind(category);
+    if (it != pool()->constEnd()) {
+        return *it;
+    } else if (pool()->size() >= maxPoolSize) {
+        return category;
+    }
+
+    pool()->insert(category);
+
+    return category;
+}
+
+bool TimeLogCategoryPool::isEqual(const QString &a, const QString &b)
+{
+    // Interned names are compared by the buffer, the others fall back to the content
+    return (a.constData() == b.constData() && a.size() == b.size()) || a == b;
+}
+
+int TimeLogCategoryPool::size()
+{
+    QReadLocker locker(poolLock());
+    return pool()->size();
+}
@@ -0,0 +1,34 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGCATEGORYPOOL_H
+#define TIMELOGCATEGORYPOOL_H
+
+#include <QString>
+
+// Process-wide pool of category names, interned strings share a single buffer, so
+// records from the DB, sync files and the models don't hold own copies of the same name
+class TimeLogCategoryPool
+{
+public:
+    static QString intern(const QString &category);
+    static bool isEqual(const QString &a, const QString &b);
+    static int size();
+};
+
+#endif // TIMELOGCATEGORYPOOL_H
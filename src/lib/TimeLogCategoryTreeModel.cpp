@@ -22,28 +22,33 @@
 
 TimeLogCategoryTreeModel::TimeLogCategoryTreeModel(QObject *parent) :
     SUPER(parent),
-    m_timeTracker(nullptr)
+    m_timeTracker(nullptr),
+    m_rootItem(nullptr)
 {
 
 }
 
+TimeLogCategoryTreeModel::~TimeLogCategoryTreeModel()
+{
+    deleteItem(m_rootItem);
+}
+
 QModelIndex TimeLogCategoryTreeModel::index(int row, int column, const QModelIndex &parent) const
 {
     if (!hasIndex(row, column, parent)) {
         return QModelIndex();
     }
 
-    TimeLogCategoryTreeNode *parentCategory;
+    Item *parentItem;
 
     if (!parent.isValid()) {
-        parentCategory = m_root.data();
+        parentItem = m_rootItem;
     } else {
-        parentCategory = static_cast<TimeLogCategoryTreeNode*>(parent.internalPointer());
+        parentItem = static_cast<Item*>(parent.internalPointer());
     }
 
-    if (parentCategory && row < parentCategory->children().size()) {
-        return createIndex(row, column,
-                           parentCategory->children().value(parentCategory->children().keys().at(row)));
+    if (parentItem && row < parentItem->children.size()) {
+        return createIndex(row, column, parentItem->children.at(row));
     } else {
         return QModelIndex();
     }
@@ -55,15 +60,15 @@ QModelIndex TimeLogCategoryTreeModel::parent(const QModelIndex &child) const
         return QModelIndex();
     }
 
-    TimeLogCategoryTreeNode *childCategory = static_cast<TimeLogCategoryTreeNode*>(child.internalPointer());
-    TimeLogCategoryTreeNode *parentCategory = static_cast<TimeLogCategoryTreeNode*>(childCategory->parent());
+    Item *childItem = static_cast<Item*>(child.internalPointer());
+    Item *parentItem = childItem->parent;
 
-    if (parentCategory == m_root) {
+    if (parentItem == m_rootItem) {
         return QModelIndex();
     }
 
-    int row = parentCategory->parent() ? parentCategory->parent()->children().keys().indexOf(parentCategory->name) : 0;
-    return createIndex(row, 0, parentCategory);
+    int row = parentItem->parent ? parentItem->parent->children.indexOf(parentItem) : 0;
+    return createIndex(row, 0, parentItem);
 }
 
 int TimeLogCategoryTreeModel::columnCount(const QModelIndex &parent) const
@@ -79,14 +84,14 @@ int TimeLogCategoryTreeModel::rowCount(const QModelIndex &parent) const
         return 0;
     }
 
-    TimeLogCategoryTreeNode *parentCategory;
+    Item *parentItem;
     if (!parent.isValid()) {
-        parentCategory = m_root.data();
+        parentItem = m_rootItem;
     } else {
-        parentCategory = static_cast<TimeLogCategoryTreeNode*>(parent.internalPointer());
+        parentItem = static_cast<Item*>(parent.internalPointer());
     }
 
-    return parentCategory ? parentCategory->children().size() : 0;
+    return parentItem ? parentItem->children.size() : 0;
 }
 
 QVariant TimeLogCategoryTreeModel::data(const QModelIndex &index, int role) const
@@ -95,7 +100,7 @@ QVariant TimeLogCategoryTreeModel::data(const QModelIndex &index, int role) cons
         return QVariant();
     }
 
-    TimeLogCategoryTreeNode *node = static_cast<TimeLogCategoryTreeNode*>(index.internalPointer());
+    const TimeLogCategoryTreeNode *node = static_cast<Item*>(index.internalPointer())->node;
 
     switch (role) {
     case Qt::DisplayRole:
@@ -167,7 +172,7 @@ bool TimeLogCategoryTreeModel::setData(const QModelIndex &index, const QVariant
 
     TimeLogCategoryData data = value.value<TimeLogCategoryData>();
     Q_ASSERT(data.isValid());
-    TimeLogCategoryTreeNode *node = static_cast<TimeLogCategoryTreeNode*>(index.internalPointer());
+    const TimeLogCategoryTreeNode *node = static_cast<Item*>(index.internalPointer())->node;
     TimeLogCategory category(node->category.uuid, data);
     if (category.uuid.isNull()) {
         category.uuid = QUuid::createUuid();
@@ -188,7 +193,7 @@ void TimeLogCategoryTreeModel::removeItem(const QModelIndex &index)
         return;
     }
 
-    TimeLogCategoryTreeNode *node = static_cast<TimeLogCategoryTreeNode*>(index.internalPointer());
+    const TimeLogCategoryTreeNode *node = static_cast<Item*>(index.internalPointer())->node;
 
     m_timeTracker->removeCategory(node->category.name);
 }
@@ -233,9 +238,86 @@ void TimeLogCategoryTreeModel::setTimeTracker(TimeTracker *timeTracker)
 
 void TimeLogCategoryTreeModel::updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
 {
-    beginResetModel();
+    if (!m_rootItem || !categories) {
+        beginResetModel();
+        deleteItem(m_rootItem);
+        m_rootItem = categories ? createItem(categories.data(), nullptr) : nullptr;
+        m_root = categories;
+        endResetModel();
+        return;
+    }
 
+    // Items are moved to the new tree, the old one is kept till all of them are
+    updateItem(m_rootItem, QModelIndex(), categories.data());
     m_root = categories;
+}
+
+TimeLogCategoryTreeModel::Item *TimeLogCategoryTreeModel::createItem(const TimeLogCategoryTreeNode *node,
+                                                                     Item *parent) const
+{
+    Item *item = new Item;
+    item->node = node;
+    item->parent = parent;
+    item->children.reserve(node->children().size());
+    for (const TimeLogCategoryTreeNode *child: node->children()) {
+        item->children.append(createItem(child, item));
+    }
+
+    return item;
+}
+
+void TimeLogCategoryTreeModel::deleteItem(Item *item)
+{
+    if (!item) {
+        return;
+    }
 
-    endResetModel();
+    for (Item *child: item->children) {
+        deleteItem(child);
+    }
+    delete item;
+}
+
+bool TimeLogCategoryTreeModel::isNodeChanged(const TimeLogCategoryTreeNode *oldNode,
+                                             const TimeLogCategoryTreeNode *newNode)
+{
+    return (oldNode->hasItems != newNode->hasItems
+            || oldNode->category.uuid != newNode->category.uuid
+            || oldNode->category.name != newNode->category.name
+            || oldNode->category.data != newNode->category.data);
+}
+
+void TimeLogCategoryTreeModel::updateItem(Item *item, const QModelIndex &itemIndex, const TimeLogCategoryTreeNode *node)
+{
+    if (itemIndex.isValid() && isNodeChanged(item->node, node)) {
+        item->node = node;
+        emit dataChanged(itemIndex, itemIndex);
+    } else {
+        item->node = node;
+    }
+
+    // Both children lists are sorted by name, so they are merged in a single pass
+    const QVector<TimeLogCategoryTreeNode*> &children = node->children();
+    int row = 0;
+    int nodeRow = 0;
+    while (row < item->children.size() || nodeRow < children.size()) {
+        const TimeLogCategoryTreeNode *child = nodeRow < children.size() ? children.at(nodeRow) : nullptr;
+        Item *childItem = row < item->children.size() ? item->children.at(row) : nullptr;
+
+        if (childItem && (!child || childItem->node->name < child->name)) {
+            beginRemoveRows(itemIndex, row, row);
+            deleteItem(item->children.takeAt(row));
+            endRemoveRows();
+        } else if (!childItem || child->name < childItem->node->name) {
+            beginInsertRows(itemIndex, row, row);
+            item->children.insert(row, createItem(child, item));
+            endInsertRows();
+            row++;
+            nodeRow++;
+        } else {
+            updateItem(childItem, index(row, 0, itemIndex), child);
+            row++;
+            nodeRow++;
+        }
+    }
 }
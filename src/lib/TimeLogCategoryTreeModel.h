@@ -44,6 +44,7 @@ public:
     Q_ENUM(Roles)
 
     explicit TimeLogCategoryTreeModel(QObject *parent = 0);
+    ~TimeLogCategoryTreeModel();
 
     virtual QModelIndex index(int row, int column, const QModelIndex &parent) const;
     virtual QModelIndex parent(const QModelIndex &child) const;
@@ -71,8 +72,22 @@ private slots:
     void updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories);
 
 private:
+    // Model own structure, which outlives the trees, so indexes stay valid on tree changes
+    struct Item
+    {
+        const TimeLogCategoryTreeNode *node;
+        Item *parent;
+        QVector<Item*> children;
+    };
+
+    Item *createItem(const TimeLogCategoryTreeNode *node, Item *parent) const;
+    static void deleteItem(Item *item);
+    static bool isNodeChanged(const TimeLogCategoryTreeNode *oldNode, const TimeLogCategoryTreeNode *newNode);
+    void updateItem(Item *item, const QModelIndex &itemIndex, const TimeLogCategoryTreeNode *node);
+
     TimeTracker *m_timeTracker;
     QSharedPointer<TimeLogCategoryTreeNode> m_root;
+    Item *m_rootItem;
 };
 
 #endif // TIMELOGCATEGORYTREEMODEL_H
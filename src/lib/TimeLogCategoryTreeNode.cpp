@@ -16,25 +16,38 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <algorithm>
+#include <deque>
+
 #include "TimeLogCategoryTreeNode.h"
 
+struct TimeLogCategoryTreeArena
+{
+    // Deque keeps the addresses of the nodes on growth
+    std::deque<TimeLogCategoryTreeNode> nodes;
+    TimeLogCategoryTreeDiff diff;
+};
+
+TimeLogCategoryTreeDiff::TimeLogCategoryTreeDiff() :
+    isRebuilt(true),
+    base(nullptr)
+{
+
+}
+
 TimeLogCategoryTreeNode::TimeLogCategoryTreeNode(const QString &name, TimeLogCategoryTreeNode *parent) :
     name(name),
     hasItems(false),
-    m_parent(nullptr)
+    itemsCount(0),
+    m_parent(parent),
+    m_arena(parent ? nullptr : new TimeLogCategoryTreeArena())
 {
-    if (parent) {
-        setParent(parent);
-    }
+
 }
 
 TimeLogCategoryTreeNode::~TimeLogCategoryTreeNode()
 {
-    if (m_parent) {
-        m_parent->m_children.remove(name);
-    }
-
-    qDeleteAll(m_children.values());
+    delete m_arena;
 }
 
 QString TimeLogCategoryTreeNode::fullName() const
@@ -61,25 +74,123 @@ int TimeLogCategoryTreeNode::depth() const
     return result;
 }
 
-const QMap<QString, TimeLogCategoryTreeNode *> &TimeLogCategoryTreeNode::children() const
+const QVector<TimeLogCategoryTreeNode *> &TimeLogCategoryTreeNode::children() const
 {
     return m_children;
 }
 
+TimeLogCategoryTreeNode *TimeLogCategoryTreeNode::child(const QString &name) const
+{
+    QVector<TimeLogCategoryTreeNode*>::const_iterator it = findChild(name);
+
+    return (it != m_children.constEnd() && (*it)->name == name) ? *it : nullptr;
+}
+
+int TimeLogCategoryTreeNode::childIndex(const QString &name) const
+{
+    QVector<TimeLogCategoryTreeNode*>::const_iterator it = findChild(name);
+
+    return (it != m_children.constEnd() && (*it)->name == name) ? it - m_children.constBegin() : -1;
+}
+
+QStringList TimeLogCategoryTreeNode::childNames() const
+{
+    QStringList result;
+    result.reserve(m_children.size());
+    for (const TimeLogCategoryTreeNode *child: m_children) {
+        result.append(child->name);
+    }
+
+    return result;
+}
+
 TimeLogCategoryTreeNode *TimeLogCategoryTreeNode::parent() const
 {
     return m_parent;
 }
 
-void TimeLogCategoryTreeNode::setParent(TimeLogCategoryTreeNode *parent)
+TimeLogCategoryTreeNode *TimeLogCategoryTreeNode::addChild(const QString &name)
 {
-    if (m_parent) {
-        m_parent->m_children.remove(name);
+    QVector<TimeLogCategoryTreeNode*>::const_iterator it = findChild(name);
+    if (it != m_children.constEnd() && (*it)->name == name) {
+        return *it;
     }
 
-    m_parent = parent;
+    TimeLogCategoryTreeArena *arena = root()->m_arena;
+    arena->nodes.emplace_back(name, this);
+    TimeLogCategoryTreeNode *node = &arena->nodes.back();
+    m_children.insert(it - m_children.constBegin(), node);
+
+    return node;
+}
 
-    if (parent) {
-        m_parent->m_children.insert(name, this);
+void TimeLogCategoryTreeNode::removeChild(const QString &name)
+{
+    // The node memory is kept till the tree is freed
+    int index = childIndex(name);
+    if (index != -1) {
+        m_children.remove(index);
+    }
+}
+
+QSharedPointer<TimeLogCategoryTreeNode> TimeLogCategoryTreeNode::clone() const
+{
+    Q_ASSERT(!m_parent);
+
+    TimeLogCategoryTreeNode *result = new TimeLogCategoryTreeNode(name);
+    result->category = category;
+    result->hasItems = hasItems;
+    result->itemsCount = itemsCount;
+    cloneChildren(result);
+    result->m_arena->diff.isRebuilt = false;
+    result->m_arena->diff.base = this;
+
+    return QSharedPointer<TimeLogCategoryTreeNode>(result);
+}
+
+const TimeLogCategoryTreeDiff &TimeLogCategoryTreeNode::diff() const
+{
+    Q_ASSERT(m_arena);
+
+    return m_arena->diff;
+}
+
+TimeLogCategoryTreeDiff &TimeLogCategoryTreeNode::diff()
+{
+    Q_ASSERT(m_arena);
+
+    return m_arena->diff;
+}
+
+TimeLogCategoryTreeNode *TimeLogCategoryTreeNode::root()
+{
+    TimeLogCategoryTreeNode *node = this;
+    while (node->m_parent) {
+        node = node->m_parent;
+    }
+
+    return node;
+}
+
+QVector<TimeLogCategoryTreeNode*>::const_iterator TimeLogCategoryTreeNode::findChild(const QString &name) const
+{
+    return std::lower_bound(m_children.constBegin(), m_children.constEnd(), name,
+                            [](const TimeLogCategoryTreeNode *node, const QString &name) {
+        return node->name < name;
+    });
+}
+
+void TimeLogCategoryTreeNode::cloneChildren(TimeLogCategoryTreeNode *target) const
+{
+    TimeLogCategoryTreeArena *arena = target->root()->m_arena;
+    target->m_children.reserve(m_children.size());
+    for (const TimeLogCategoryTreeNode *child: m_children) {
+        arena->nodes.emplace_back(child->name, target);
+        TimeLogCategoryTreeNode *node = &arena->nodes.back();
+        node->category = child->category;
+        node->hasItems = child->hasItems;
+        node->itemsCount = child->itemsCount;
+        target->m_children.append(node);
+        child->cloneChildren(node);
     }
 }
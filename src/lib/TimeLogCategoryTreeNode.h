@@ -22,10 +22,24 @@
 #include <QObject>
 #include <QVariantMap>
 #include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
 
 #include "TimeLogCategory.h"
 
-class TimeLogCategoryTreeNode;
+struct TimeLogCategoryTreeArena;
+
+// Changes of the tree relative to the previous one, full name paths
+struct TimeLogCategoryTreeDiff
+{
+    TimeLogCategoryTreeDiff();
+
+    bool isRebuilt; // Tree was built from scratch, no paths listed
+    const TimeLogCategoryTreeNode *base; // Tree the paths are relative to
+    QStringList added;
+    QStringList removed;
+    QStringList changed;
+};
 
 class TimeLogCategoryTreeNode
 {
@@ -35,18 +49,37 @@ public:
 
     QString fullName() const;
     int depth() const;
-    const QMap<QString, TimeLogCategoryTreeNode*> &children() const;
+    // Sorted by name
+    const QVector<TimeLogCategoryTreeNode*> &children() const;
+    TimeLogCategoryTreeNode *child(const QString &name) const;
+    int childIndex(const QString &name) const;
+    QStringList childNames() const;
 
     TimeLogCategoryTreeNode *parent() const;
-    void setParent(TimeLogCategoryTreeNode *parent);
+
+    // Child nodes are allocated in the arena of the root and freed with it
+    TimeLogCategoryTreeNode *addChild(const QString &name);
+    void removeChild(const QString &name);
+
+    QSharedPointer<TimeLogCategoryTreeNode> clone() const;
+    const TimeLogCategoryTreeDiff &diff() const;
+    TimeLogCategoryTreeDiff &diff();
 
     QString name;
     TimeLogCategory category;
     bool hasItems;
+    int itemsCount; // As of the last patch of the node, not updated on each entry
 
 private:
+    Q_DISABLE_COPY(TimeLogCategoryTreeNode)
+
+    TimeLogCategoryTreeNode *root();
+    QVector<TimeLogCategoryTreeNode*>::const_iterator findChild(const QString &name) const;
+    void cloneChildren(TimeLogCategoryTreeNode *target) const;
+
     TimeLogCategoryTreeNode *m_parent;
-    QMap<QString, TimeLogCategoryTreeNode*> m_children;
+    QVector<TimeLogCategoryTreeNode*> m_children;
+    TimeLogCategoryTreeArena *m_arena;  // Set only for the root
 };
 
 Q_DECLARE_METATYPE(QSharedPointer<TimeLogCategoryTreeNode>)
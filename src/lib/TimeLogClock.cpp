@@ -0,0 +1,119 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QCoreApplication>
+#include <QPointer>
+#include <QTimer>
+
+#include <QLoggingCategory>
+
+#include "TimeLogClock.h"
+
+Q_LOGGING_CATEGORY(CLOCK_CATEGORY, "TimeLogClock", QtInfoMsg)
+
+// Durations are shown with the seconds precision
+const int defaultInterval(1000);
+
+TimeLogClock::TimeLogClock(QObject *parent) :
+    QObject(parent),
+    m_timer(new QTimer(this)),
+    m_interval(defaultInterval)
+{
+    m_timer->setSingleShot(true);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, SIGNAL(timeout()),
+            this, SLOT(tick()));
+}
+
+TimeLogClock *TimeLogClock::instance()
+{
+    // Owned by the application, so it is destroyed before the event dispatcher
+    static QPointer<TimeLogClock> clock;
+    if (!clock) {
+        clock = new TimeLogClock(QCoreApplication::instance());
+    }
+
+    return clock;
+}
+
+QDateTime TimeLogClock::now() const
+{
+    // Last tick is the common value for all subscribers, the others get the actual time
+    return m_timer->isActive() && m_now.isValid() ? m_now : QDateTime::currentDateTimeUtc();
+}
+
+int TimeLogClock::interval() const
+{
+    return m_interval;
+}
+
+void TimeLogClock::setInterval(int interval)
+{
+    if (interval <= 0) {
+        qCWarning(CLOCK_CATEGORY) << "Invalid interval" << interval;
+        return;
+    } else if (m_interval == interval) {
+        return;
+    }
+
+    m_interval = interval;
+    if (m_timer->isActive()) {
+        scheduleTick();
+    }
+
+    emit intervalChanged(m_interval);
+}
+
+void TimeLogClock::connectNotify(const QMetaMethod &signal)
+{
+    if (signal == QMetaMethod::fromSignal(&TimeLogClock::nowChanged)) {
+        updateTimer();
+    }
+}
+
+void TimeLogClock::disconnectNotify(const QMetaMethod &signal)
+{
+    // Signal is invalid on disconnect of all signals
+    if (!signal.isValid() || signal == QMetaMethod::fromSignal(&TimeLogClock::nowChanged)) {
+        updateTimer();
+    }
+}
+
+void TimeLogClock::tick()
+{
+    m_now = QDateTime::currentDateTimeUtc();
+    scheduleTick();
+
+    emit nowChanged(m_now);
+}
+
+void TimeLogClock::updateTimer()
+{
+    if (!isSignalConnected(QMetaMethod::fromSignal(&TimeLogClock::nowChanged))) {
+        m_timer->stop();
+    } else if (!m_timer->isActive()) {
+        m_now = QDateTime::currentDateTimeUtc();
+        scheduleTick();
+    }
+}
+
+void TimeLogClock::scheduleTick()
+{
+    qint64 msecs = QDateTime::currentMSecsSinceEpoch();
+    m_timer->start(m_interval - static_cast<int>(msecs % m_interval));
+}
@@ -0,0 +1,64 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGCLOCK_H
+#define TIMELOGCLOCK_H
+
+#include <QObject>
+#include <QDateTime>
+
+class QTimer;
+
+// Shared source of the current time for the running entry, ticks are aligned to the interval,
+// so all the views are updated at once. The timer runs only while nowChanged() is connected.
+class TimeLogClock : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QDateTime now READ now NOTIFY nowChanged)
+    Q_PROPERTY(int interval READ interval WRITE setInterval NOTIFY intervalChanged)
+public:
+    explicit TimeLogClock(QObject *parent = 0);
+
+    // Created on the first call, should be used from the GUI thread only
+    static TimeLogClock *instance();
+
+    QDateTime now() const;
+    int interval() const;
+    void setInterval(int interval);
+
+signals:
+    void nowChanged(const QDateTime &now);
+    void intervalChanged(int interval);
+
+protected:
+    virtual void connectNotify(const QMetaMethod &signal);
+    virtual void disconnectNotify(const QMetaMethod &signal);
+
+private slots:
+    void tick();
+
+private:
+    void updateTimer();
+    void scheduleTick();
+
+    QTimer *m_timer;
+    int m_interval;
+    QDateTime m_now;
+};
+
+#endif // TIMELOGCLOCK_H
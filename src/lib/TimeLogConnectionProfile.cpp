@@ -0,0 +1,127 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QStringList>
+
+#include "TimeLogConnectionProfile.h"
+
+TimeLogConnectionProfile::TimeLogConnectionProfile() :
+    journalMode(WalJournal),
+    synchronous(SynchronousNormal),
+    cacheSize(8 * 1024),
+    mmapSize(64 * 1024 * 1024),
+    isTempStoreMemory(true),
+    readConnections(2),
+    slowQueryTime(-1)
+{
+
+}
+
+TimeLogConnectionProfile TimeLogConnectionProfile::compatible()
+{
+    TimeLogConnectionProfile profile;
+    profile.journalMode = RollbackJournal;
+    profile.synchronous = SynchronousFull;
+    profile.cacheSize = 0;
+    profile.mmapSize = 0;
+    profile.isTempStoreMemory = false;
+    profile.readConnections = 0;
+
+    return profile;
+}
+
+TimeLogConnectionProfile TimeLogConnectionProfile::fromString(const QString &string, bool *ok)
+{
+    TimeLogConnectionProfile profile;
+    bool isValid = true;
+
+    for (const QString &item: string.split(',', QString::SkipEmptyParts)) {
+        const QString key(item.section('=', 0, 0).trimmed().toLower());
+        const QString value(item.section('=', 1).trimmed().toLower());
+
+        if (key == "compatible" && value.isEmpty()) {
+            profile = compatible();
+        } else if (key == "wal" && value.isEmpty()) {
+            profile.journalMode = WalJournal;
+        } else if (key == "journal") {
+            if (value == "wal") {
+                profile.journalMode = WalJournal;
+            } else if (value == "delete" || value == "rollback") {
+                profile.journalMode = RollbackJournal;
+            } else {
+                isValid = false;
+            }
+        } else if (key == "synchronous") {
+            if (value == "off") {
+                profile.synchronous = SynchronousOff;
+            } else if (value == "normal") {
+                profile.synchronous = SynchronousNormal;
+            } else if (value == "full") {
+                profile.synchronous = SynchronousFull;
+            } else {
+                isValid = false;
+            }
+        } else if (key == "cache") {
+            bool isNumber = false;
+            profile.cacheSize = value.toInt(&isNumber);
+            isValid = isValid && isNumber && profile.cacheSize >= 0;
+        } else if (key == "mmap") {
+            bool isNumber = false;
+            profile.mmapSize = value.toLongLong(&isNumber);
+            isValid = isValid && isNumber && profile.mmapSize >= 0;
+        } else if (key == "readers") {
+            bool isNumber = false;
+            profile.readConnections = value.toInt(&isNumber);
+            isValid = isValid && isNumber && profile.readConnections >= 0;
+        } else if (key == "slowquery") {
+            bool isNumber = false;
+            profile.slowQueryTime = value.toInt(&isNumber);
+            isValid = isValid && isNumber && profile.slowQueryTime >= -1;
+        } else if (key == "temp") {
+            if (value == "memory") {
+                profile.isTempStoreMemory = true;
+            } else if (value == "file" || value == "default") {
+                profile.isTempStoreMemory = false;
+            } else {
+                isValid = false;
+            }
+        } else {
+            isValid = false;
+        }
+    }
+
+    if (ok) {
+        *ok = isValid;
+    }
+
+    return isValid ? profile : TimeLogConnectionProfile();
+}
+
+QString TimeLogConnectionProfile::toString() const
+{
+    static const char *synchronousNames[] = { "off", "normal", "full" };
+
+    return QString("journal=%1,synchronous=%2,cache=%3,mmap=%4,temp=%5,readers=%6,slowquery=%7")
+            .arg(journalMode == WalJournal ? "wal" : "delete")
+            .arg(synchronousNames[synchronous])
+            .arg(cacheSize)
+            .arg(mmapSize)
+            .arg(isTempStoreMemory ? "memory" : "default")
+            .arg(readConnections)
+            .arg(slowQueryTime);
+}
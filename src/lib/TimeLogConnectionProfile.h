@@ -0,0 +1,61 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGCONNECTIONPROFILE_H
+#define TIMELOGCONNECTIONPROFILE_H
+
+#include <QString>
+#include <QMetaType>
+
+struct TimeLogConnectionProfile
+{
+public:
+    enum JournalMode {
+        RollbackJournal,
+        WalJournal
+    };
+
+    enum SynchronousMode {
+        SynchronousOff,
+        SynchronousNormal,
+        SynchronousFull
+    };
+
+    TimeLogConnectionProfile();
+
+    // Rollback journal profile for DB files, that are copied as a whole, e.g. sync packs
+    static TimeLogConnectionProfile compatible();
+    // Parses "wal", "compatible" or comma-separated list of key=value pairs (journal, synchronous,
+    // cache, mmap, temp, readers, slowquery), starting from the default profile
+    static TimeLogConnectionProfile fromString(const QString &string, bool *ok = Q_NULLPTR);
+
+    QString toString() const;
+
+    JournalMode journalMode;
+    SynchronousMode synchronous;
+    int cacheSize;          // KiB, 0 for SQLite default
+    qint64 mmapSize;        // bytes, 0 to disable
+    bool isTempStoreMemory;
+    int readConnections;    // additional read-only connections, used only with WAL
+    int slowQueryTime;      // ms, slower statements are logged and the plans are audited, -1 to disable
+};
+
+Q_DECLARE_TYPEINFO(TimeLogConnectionProfile, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(TimeLogConnectionProfile)
+
+#endif // TIMELOGCONNECTIONPROFILE_H
@@ -0,0 +1,108 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QSet>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "TimeLogDiagnostics.h"
+#include "TimeLogHistory.h"
+#include "TimeLogModel.h"
+#include "TimeLogCategoryPool.h"
+#include "TimeTracker.h"
+
+Q_GLOBAL_STATIC(QSet<const TimeLogModel*>, models)
+
+TimeLogDiagnostics::TimeLogDiagnostics(QObject *parent) :
+    QObject(parent),
+    m_timeTracker(Q_NULLPTR)
+{
+
+}
+
+void TimeLogDiagnostics::requestReport()
+{
+    requestReport(m_timeTracker ? m_timeTracker->history() : Q_NULLPTR);
+}
+
+void TimeLogDiagnostics::requestReport(TimeLogHistory *history)
+{
+    if (m_history) {
+        disconnect(m_history, SIGNAL(diagnosticsAvailable(QVariantMap)),
+                   this, SLOT(historyDiagnosticsAvailable(QVariantMap)));
+        m_history = Q_NULLPTR;
+    }
+
+    if (!history) {
+        emit reportAvailable(modelsReport());
+        return;
+    }
+
+    m_history = history;
+    connect(m_history, SIGNAL(diagnosticsAvailable(QVariantMap)),
+            this, SLOT(historyDiagnosticsAvailable(QVariantMap)));
+    m_history->getDiagnostics();
+}
+
+QString TimeLogDiagnostics::reportText(const QVariantMap &report) const
+{
+    return QString::fromUtf8(QJsonDocument(QJsonObject::fromVariantMap(report)).toJson());
+}
+
+void TimeLogDiagnostics::historyDiagnosticsAvailable(QVariantMap data)
+{
+    disconnect(m_history, SIGNAL(diagnosticsAvailable(QVariantMap)),
+               this, SLOT(historyDiagnosticsAvailable(QVariantMap)));
+    m_history = Q_NULLPTR;
+
+    // Models are reported as of the reply, the history could be slow to reply
+    QVariantMap result(modelsReport());
+    result.insert("history", data);
+
+    emit reportAvailable(result);
+}
+
+QVariantMap TimeLogDiagnostics::modelsReport() const
+{
+    QVariantMap result;
+
+    QVariantList modelsList;
+    qint64 modelsBytes = 0;
+    for (const TimeLogModel *model: *models()) {
+        QVariantMap modelDiagnostics(model->diagnostics());
+        modelsBytes += modelDiagnostics.value("bytes").toLongLong();
+        modelsList.append(modelDiagnostics);
+    }
+    result.insert("models", modelsList);
+    result.insert("modelsBytes", modelsBytes);
+    result.insert("categoryPoolSize", TimeLogCategoryPool::size());
+
+    return result;
+}
+
+void TimeLogDiagnostics::addModel(const TimeLogModel *model)
+{
+    models()->insert(model);
+}
+
+void TimeLogDiagnostics::removeModel(const TimeLogModel *model)
+{
+    if (!models.isDestroyed()) {
+        models()->remove(model);
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGDIAGNOSTICS_H
+#define TIMELOGDIAGNOSTICS_H
+
+#include <QObject>
+#include <QPointer>
+#include <QVariant>
+
+class TimeTracker;
+class TimeLogHistory;
+class TimeLogModel;
+
+// Reports the rows and the approximate memory usage of the models and the history caches,
+// along with the DB and the request queue stats
+class TimeLogDiagnostics : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(TimeTracker* timeTracker MEMBER m_timeTracker NOTIFY timeTrackerChanged)
+public:
+    explicit TimeLogDiagnostics(QObject *parent = 0);
+
+    // Report is emitted with reportAvailable(), once the history workers replied
+    Q_INVOKABLE void requestReport();
+    void requestReport(TimeLogHistory *history);
+    Q_INVOKABLE QString reportText(const QVariantMap &report) const;
+
+    // Models are tracked from the GUI thread only
+    static void addModel(const TimeLogModel *model);
+    static void removeModel(const TimeLogModel *model);
+
+signals:
+    void timeTrackerChanged(TimeTracker *newTimeTracker);
+    void reportAvailable(QVariantMap report) const;
+
+private slots:
+    void historyDiagnosticsAvailable(QVariantMap data);
+
+private:
+    QVariantMap modelsReport() const;
+
+    TimeTracker *m_timeTracker;
+    QPointer<TimeLogHistory> m_history;
+};
+
+#endif // TIMELOGDIAGNOSTICS_H
@@ -19,6 +19,7 @@
 #include <QDebug>
 
 #include "TimeLogEntry.h"
+#include "TimeLogCategoryPool.h"
 
 TimeLogEntry::TimeLogEntry(const QUuid &uuid, const TimeLogData &data) :
     TimeLogData(data),
@@ -53,5 +54,8 @@ QDataStream &operator<<(QDataStream &stream, const TimeLogEntry &data)
 
 QDataStream &operator>>(QDataStream &stream, TimeLogEntry &data)
 {
-    return stream >> data.uuid >> data.startTime >> data.category >> data.comment;
+    stream >> data.uuid >> data.startTime >> data.category >> data.comment;
+    data.category = TimeLogCategoryPool::intern(data.category);
+
+    return stream;
 }
@@ -16,24 +16,51 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <QCoreApplication>
+#include <QMetaMethod>
+#include <QSemaphore>
 #include <QThread>
 
 #include "TimeLogHistory.h"
 #include "TimeLogHistoryWorker.h"
 
+static const int syncSliceSize(500);
+
 TimeLogHistory::TimeLogHistory(QObject *parent) :
+    TimeLogHistory(Q_NULLPTR, parent)
+{
+
+}
+
+TimeLogHistory::TimeLogHistory(const TimeLogHistory *host, QObject *parent) :
     QObject(parent),
-    m_thread(new QThread()),
+    m_thread(host ? host->m_thread : new QThread()),
+    m_isSharedThread(host != Q_NULLPTR),
     m_worker(new TimeLogHistoryWorker()),
+    m_nextReader(0),
+    m_pendingWrites(0),
+    m_pendingBackgroundWrites(0),
+    m_isReadDuringBackgroundWrite(false),
+    m_isDataChangedDuringRead(false),
+    m_cancelledRequests(new TimeLogCancelledRequests()),
+    m_backupWorker(Q_NULLPTR),
+    m_pendingDiagnostics(0),
+    m_isInitReadonly(false),
     m_size(0),
     m_undoCount(0)
 {
+    qRegisterMetaType<TimeLogConnectionProfile>();
+    qRegisterMetaType<QSharedPointer<TimeLogSyncEntryChanges> >();
+    qRegisterMetaType<QSharedPointer<TimeLogSyncCategoryChanges> >();
+
     connect(m_worker, SIGNAL(error(QString)),
             this, SIGNAL(error(QString)));
     connect(m_worker, SIGNAL(dataOutdated()),
             this, SIGNAL(dataOutdated()));
     connect(m_worker, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
             this, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    connect(m_worker, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+            this, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
     connect(m_worker, SIGNAL(storedCategoriesAvailable(QVector<TimeLogCategory>)),
             this, SIGNAL(storedCategoriesAvailable(QVector<TimeLogCategory>)));
     connect(m_worker, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
@@ -44,6 +71,8 @@ TimeLogHistory::TimeLogHistory(QObject *parent) :
             this, SIGNAL(dataImported(QVector<TimeLogEntry>)));
     connect(m_worker, SIGNAL(dataRemoved(TimeLogEntry)),
             this, SIGNAL(dataRemoved(TimeLogEntry)));
+    connect(m_worker, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+            this, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)));
     connect(m_worker, SIGNAL(sizeChanged(qlonglong)),
             this, SLOT(workerSizeChanged(qlonglong)));
     connect(m_worker, SIGNAL(undoCountChanged(int)),
@@ -52,74 +81,190 @@ TimeLogHistory::TimeLogHistory(QObject *parent) :
             this, SLOT(workerCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
     connect(m_worker, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)),
             this, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    connect(m_worker, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)),
+            this, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)));
     connect(m_worker, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
-                                               QVector<TimeLogSyncDataCategory>,QDateTime)),
-            this, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
-                                           QVector<TimeLogSyncDataCategory>,QDateTime)));
+                                               QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)),
+            this, SLOT(workerSyncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                               QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)));
     connect(m_worker, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)),
             this, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)));
     connect(m_worker, SIGNAL(syncExistsAvailable(bool,QDateTime,QDateTime)),
             this, SIGNAL(syncExistsAvailable(bool,QDateTime,QDateTime)));
-    connect(m_worker, SIGNAL(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                                     QVector<TimeLogSyncDataEntry>,
-                                                     QVector<TimeLogSyncDataEntry>,
-                                                     QVector<TimeLogSyncDataEntry>,
-                                                     QVector<TimeLogSyncDataEntry>,
-                                                     QVector<TimeLogSyncDataEntry>)),
-            this, SIGNAL(syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>,
-                                                 QVector<TimeLogSyncDataEntry>)));
-    connect(m_worker, SIGNAL(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                        QVector<TimeLogSyncDataCategory>,
-                                                        QVector<TimeLogSyncDataCategory>,
-                                                        QVector<TimeLogSyncDataCategory>,
-                                                        QVector<TimeLogSyncDataCategory>,
-                                                        QVector<TimeLogSyncDataCategory>)),
-            this, SIGNAL(syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>,
-                                                    QVector<TimeLogSyncDataCategory>)));
-    connect(m_worker, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)),
-            this, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)));
-    connect(m_worker, SIGNAL(dataSynced(QDateTime)),
-            this, SIGNAL(dataSynced(QDateTime)));
-    connect(m_worker, SIGNAL(hashesUpdated()),
-            this, SIGNAL(hashesUpdated()));
+    connect(m_worker, SIGNAL(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)),
+            this, SIGNAL(syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges>)));
+    connect(m_worker, SIGNAL(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)),
+            this, SIGNAL(syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges>)));
+    connect(m_worker, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)),
+            this, SLOT(workerHashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)));
+    connect(m_worker, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)),
+            this, SLOT(workerDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)));
+    connect(m_worker, SIGNAL(dataSynced(QDateTime,qlonglong)),
+            this, SLOT(workerDataSynced(QDateTime,qlonglong)));
+    connect(m_worker, SIGNAL(hashesUpdated(qlonglong)),
+            this, SLOT(workerHashesUpdated(qlonglong)));
+    connect(m_worker, SIGNAL(dataArchived(QDateTime)),
+            this, SIGNAL(dataArchived(QDateTime)));
+    connect(m_worker, SIGNAL(removedPurged(QDateTime)),
+            this, SIGNAL(removedPurged(QDateTime)));
+    connect(m_worker, SIGNAL(backupProgress(qlonglong,qlonglong)),
+            this, SIGNAL(backupProgress(qlonglong,qlonglong)));
+    connect(m_worker, SIGNAL(backupProgress(qlonglong,qlonglong)),
+            this, SLOT(workerBackupProgress(qlonglong,qlonglong)));
+    connect(m_worker, SIGNAL(backupFinished(QString,bool)),
+            this, SLOT(workerBackupFinished(QString,bool)));
+    connect(m_worker, SIGNAL(maintenanceProgress(int,int)),
+            this, SIGNAL(maintenanceProgress(int,int)));
+    connect(m_worker, SIGNAL(maintenanceFinished(bool)),
+            this, SIGNAL(maintenanceFinished(bool)));
+    connect(m_worker, SIGNAL(diagnosticsAvailable(QVariantMap,int)),
+            this, SLOT(workerDiagnosticsAvailable(QVariantMap,int)));
+    connect(m_worker, SIGNAL(initFinished(bool)),
+            this, SLOT(workerInitFinished(bool)));
+    connect(m_worker, SIGNAL(barrierPassed()),
+            this, SLOT(workerBarrierPassed()));
+    connect(m_worker, SIGNAL(syncFinished()),
+            this, SLOT(workerSyncFinished()));
+    connect(m_worker, SIGNAL(dataInserted(TimeLogEntry)),
+            this, SLOT(workerDataChanged()));
+    connect(m_worker, SIGNAL(dataRemoved(TimeLogEntry)),
+            this, SLOT(workerDataChanged()));
+    connect(m_worker, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+            this, SLOT(workerDataChanged()));
+    connect(m_worker, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
+            this, SLOT(workerDataChanged()));
+
+    connect(m_worker, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+            this, SLOT(workerRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    m_worker->setCancelledRequests(m_cancelledRequests);
+    m_worker->moveToThread(m_thread);
+
+    // Shared thread is owned by the host, the worker is deleted with this history
+    if (m_isSharedThread) {
+        return;
+    }
 
     connect(m_thread, SIGNAL(finished()), m_worker, SLOT(deleteLater()));
     connect(m_worker, SIGNAL(destroyed()), m_thread, SLOT(deleteLater()));
 
-    m_worker->moveToThread(m_thread);
     m_thread->start();
 }
 
 TimeLogHistory::~TimeLogHistory()
 {
-    if (m_thread->isRunning()) {
+    for (QThread *thread: m_readerThreads) {
+        if (thread->isRunning()) {
+            thread->quit();
+        }
+    }
+
+    if (m_isSharedThread) {
+        m_worker->deleteLater();
+    } else if (m_thread->isRunning()) {
         m_thread->quit();
     }
 }
 
-bool TimeLogHistory::init(const QString &dataPath, const QString &filePath, bool isReadonly, bool isPopulateCategories)
+bool TimeLogHistory::init(const QString &dataPath, const QString &filePath, bool isReadonly,
+                          bool isPopulateCategories, const TimeLogConnectionProfile &profile)
 {
     bool result = false;
 
     QMetaObject::invokeMethod(m_worker, "init", Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(bool, result), Q_ARG(QString, dataPath),
                               Q_ARG(QString, filePath), Q_ARG(bool, isReadonly),
-                              Q_ARG(bool, isPopulateCategories));
+                              Q_ARG(bool, isPopulateCategories),
+                              Q_ARG(TimeLogConnectionProfile, profile));
+
+    if (result) {
+        initReaders(dataPath, filePath, isReadonly, profile);
+    }
+
+    return result;
+}
+
+void TimeLogHistory::initAsync(const QString &dataPath, const QString &filePath, bool isReadonly,
+                               bool isPopulateCategories, const TimeLogConnectionProfile &profile,
+                               const TimeLogSnapshot &snapshot)
+{
+    m_initDataPath = dataPath;
+    m_initFilePath = filePath;
+    m_isInitReadonly = isReadonly;
+    m_initProfile = profile;
+
+    // Requests are queued after the init and served once it finishes
+    m_size = snapshot.size;
+    m_categories = snapshot.categories;
+    m_snapshotEntries = snapshot.recentEntries;
+
+    TimeLogHistoryWorker *worker = m_worker;
+    QVector<TimeLogEntry> expectedEntries = m_snapshotEntries;
+    post(worker, InitPriority, [=]() {
+        worker->initAsync(dataPath, filePath, isReadonly, isPopulateCategories, profile, expectedEntries);
+    });
+}
+
+bool TimeLogHistory::initPack(const QString &dataPath, const QString &filePath,
+                              const TimeLogConnectionProfile &profile)
+{
+    bool result = false;
+
+    QMetaObject::invokeMethod(m_worker, "initPack", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, result), Q_ARG(QString, dataPath),
+                              Q_ARG(QString, filePath), Q_ARG(TimeLogConnectionProfile, profile));
 
     return result;
 }
 
+void TimeLogHistory::initReaders(const QString &dataPath, const QString &filePath, bool isReadonly,
+                                 const TimeLogConnectionProfile &profile)
+{
+    // Only WAL allows to read the DB, while the writer holds the lock
+    if (isReadonly || profile.journalMode != TimeLogConnectionProfile::WalJournal) {
+        return;
+    }
+
+    for (int i = 0; i < profile.readConnections; i++) {
+        QThread *thread = new QThread();
+        TimeLogHistoryWorker *reader = new TimeLogHistoryWorker();
+        reader->setCancelledRequests(m_cancelledRequests);
+        connectReader(reader);
+        connect(thread, SIGNAL(finished()), reader, SLOT(deleteLater()));
+        connect(reader, SIGNAL(destroyed()), thread, SLOT(deleteLater()));
+        reader->moveToThread(thread);
+        thread->start();
+
+        bool isReaderInitialized = false;
+        QMetaObject::invokeMethod(reader, "init", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, isReaderInitialized), Q_ARG(QString, dataPath),
+                                  Q_ARG(QString, filePath), Q_ARG(bool, true), Q_ARG(bool, false),
+                                  Q_ARG(TimeLogConnectionProfile, profile));
+        if (!isReaderInitialized) {
+            // Not critical, the writer connection serves all requests in this case
+            thread->quit();
+            break;
+        }
+
+        m_readerThreads.append(thread);
+        m_readers.append(reader);
+    }
+}
+
 void TimeLogHistory::deinit()
 {
-    QMetaObject::invokeMethod(m_worker, "deinit", Qt::BlockingQueuedConnection);
+    // Pending requests of any priority should be served before
+    for (TimeLogHistoryWorker *reader: m_readers) {
+        post(reader, ShutdownPriority, [reader]() { reader->deinit(); }, true);
+    }
+    for (QThread *thread: m_readerThreads) {
+        thread->quit();
+    }
+    m_readers.clear();
+    m_readerThreads.clear();
+
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, ShutdownPriority, [worker]() { worker->deinit(); }, true);
 }
 
 qlonglong TimeLogHistory::size() const
@@ -127,6 +272,11 @@ qlonglong TimeLogHistory::size() const
     return m_size;
 }
 
+QVector<TimeLogEntry> TimeLogHistory::snapshotEntries() const
+{
+    return m_snapshotEntries;
+}
+
 QSharedPointer<TimeLogCategoryTreeNode> TimeLogHistory::categories() const
 {
     return m_categories;
@@ -139,118 +289,358 @@ int TimeLogHistory::undoCount() const
 
 void TimeLogHistory::insert(const TimeLogEntry &data)
 {
-    QMetaObject::invokeMethod(m_worker, "insert", Qt::AutoConnection, Q_ARG(TimeLogEntry, data));
+    postWrite([data](TimeLogHistoryWorker *worker) { worker->insert(data); });
 }
 
 void TimeLogHistory::import(const QVector<TimeLogEntry> &data)
 {
-    QMetaObject::invokeMethod(m_worker, "import", Qt::AutoConnection,
-                              Q_ARG(QVector<TimeLogEntry>, data));
+    postWrite([data](TimeLogHistoryWorker *worker) { worker->import(data); });
 }
 
 void TimeLogHistory::remove(const TimeLogEntry &data)
 {
-    QMetaObject::invokeMethod(m_worker, "remove", Qt::AutoConnection, Q_ARG(TimeLogEntry, data));
+    postWrite([data](TimeLogHistoryWorker *worker) { worker->remove(data); });
 }
 
 void TimeLogHistory::edit(const TimeLogEntry &data, TimeLogHistory::Fields fields)
 {
-    QMetaObject::invokeMethod(m_worker, "edit", Qt::AutoConnection, Q_ARG(TimeLogEntry, data),
-                              Q_ARG(TimeLogHistory::Fields, fields));
+    postWrite([data, fields](TimeLogHistoryWorker *worker) { worker->edit(data, fields); });
+}
+
+void TimeLogHistory::removeBatch(const QVector<TimeLogEntry> &data)
+{
+    postWrite([data](TimeLogHistoryWorker *worker) { worker->removeBatch(data); });
+}
+
+void TimeLogHistory::editBatch(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields)
+{
+    postWrite([data, fields](TimeLogHistoryWorker *worker) { worker->editBatch(data, fields); });
 }
 
 void TimeLogHistory::addCategory(const TimeLogCategory &category)
 {
-    QMetaObject::invokeMethod(m_worker, "addCategory", Qt::AutoConnection,
-                              Q_ARG(TimeLogCategory, category));
+    postWrite([category](TimeLogHistoryWorker *worker) { worker->addCategory(category); });
 }
 
 void TimeLogHistory::removeCategory(const QString &name)
 {
-    QMetaObject::invokeMethod(m_worker, "removeCategory", Qt::AutoConnection,
-                              Q_ARG(QString, name));
+    postWrite([name](TimeLogHistoryWorker *worker) { worker->removeCategory(name); });
 }
 
 void TimeLogHistory::editCategory(const QString &oldName, const TimeLogCategory &category)
 {
-    QMetaObject::invokeMethod(m_worker, "editCategory", Qt::AutoConnection,
-                              Q_ARG(QString, oldName), Q_ARG(TimeLogCategory, category));
+    postWrite([oldName, category](TimeLogHistoryWorker *worker) {
+        worker->editCategory(oldName, category);
+    });
 }
 
 void TimeLogHistory::sync(const QVector<TimeLogSyncDataEntry> &updatedData,
                           const QVector<TimeLogSyncDataEntry> &removedData,
                           const QVector<TimeLogSyncDataCategory> &categoryData)
 {
-    QMetaObject::invokeMethod(m_worker, "sync", Qt::AutoConnection,
-                              Q_ARG(QVector<TimeLogSyncDataEntry>, updatedData),
-                              Q_ARG(QVector<TimeLogSyncDataEntry>, removedData),
-                              Q_ARG(QVector<TimeLogSyncDataCategory>, categoryData));
+    requestSync(0, updatedData, removedData, categoryData);
 }
 
 void TimeLogHistory::updateHashes()
 {
-    QMetaObject::invokeMethod(m_worker, "updateHashes", Qt::AutoConnection);
+    requestUpdateHashes(0);
+}
+
+void TimeLogHistory::requestSync(qlonglong requestId, const QVector<TimeLogSyncDataEntry> &updatedData,
+                                 const QVector<TimeLogSyncDataEntry> &removedData,
+                                 const QVector<TimeLogSyncDataCategory> &categoryData)
+{
+    if (postToOwner([=]() { requestSync(requestId, updatedData, removedData, categoryData); })) {
+        return;
+    }
+
+    // Interactive requests could be served between the slices
+    int totalSize = updatedData.size() + removedData.size();
+    int offset = 0;
+    do {
+        QVector<TimeLogSyncDataEntry> updatedPart = updatedData.mid(offset, syncSliceSize);
+        QVector<TimeLogSyncDataEntry> removedPart = removedData.mid(qMax(offset - updatedData.size(), 0),
+                                                                    syncSliceSize - updatedPart.size());
+        QVector<TimeLogSyncDataCategory> categoryPart = (offset == 0 ? categoryData
+                                                                     : QVector<TimeLogSyncDataCategory>());
+        offset += syncSliceSize;
+        bool isLastSlice = offset >= totalSize;
+
+        // Counted before the post, so the finish of the slice is never seen first
+        ++m_pendingBackgroundWrites;
+        TimeLogHistoryWorker *worker = m_worker;
+        post(worker, BackgroundPriority, [=]() {
+            worker->sync(updatedPart, removedPart, categoryPart, isLastSlice, requestId);
+        });
+    } while (offset < totalSize);
+}
+
+void TimeLogHistory::requestUpdateHashes(qlonglong requestId)
+{
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, BackgroundPriority, [worker, requestId]() { worker->updateHashes(requestId); });
+}
+
+void TimeLogHistory::archive(const QDateTime &until)
+{
+    postWrite([until](TimeLogHistoryWorker *worker) { worker->archive(until); });
+}
+
+// Removed items older than until are dropped, later reads see the result
+void TimeLogHistory::purgeRemoved(const QDateTime &until)
+{
+    postWrite([until](TimeLogHistoryWorker *worker) { worker->purgeRemoved(until); });
 }
 
 void TimeLogHistory::undo()
 {
-    QMetaObject::invokeMethod(m_worker, "undo", Qt::AutoConnection);
+    postWrite([](TimeLogHistoryWorker *worker) { worker->undo(); });
 }
 
 void TimeLogHistory::getHistoryBetween(qlonglong id, const QDateTime &begin, const QDateTime &end,
-                                       const QString &category, bool withSubcategories) const
+                                       const QString &category, bool withSubcategories, uint chunkSize) const
 {
-    QMetaObject::invokeMethod(m_worker, "getHistoryBetween", Qt::AutoConnection, Q_ARG(qlonglong, id),
-                              Q_ARG(QDateTime, begin), Q_ARG(QDateTime, end), Q_ARG(QString, category),
-                              Q_ARG(bool, withSubcategories));
+    postRequest(id, [=](TimeLogHistoryWorker *worker) {
+        worker->getHistoryBetween(id, begin, end, category, withSubcategories, chunkSize);
+    });
 }
 
 void TimeLogHistory::getHistoryAfter(qlonglong id, const uint limit, const QDateTime &from) const
 {
-    QMetaObject::invokeMethod(m_worker, "getHistoryAfter", Qt::AutoConnection, Q_ARG(qlonglong, id),
-                              Q_ARG(uint, limit), Q_ARG(QDateTime, from));
+    postRequest(id, [=](TimeLogHistoryWorker *worker) {
+        worker->getHistoryAfter(id, limit, from);
+    });
 }
 
 void TimeLogHistory::getHistoryBefore(qlonglong id, const uint limit, const QDateTime &until) const
 {
-    QMetaObject::invokeMethod(m_worker, "getHistoryBefore", Qt::AutoConnection, Q_ARG(qlonglong, id),
-                              Q_ARG(uint, limit), Q_ARG(QDateTime, until));
+    postRequest(id, [=](TimeLogHistoryWorker *worker) {
+        worker->getHistoryBefore(id, limit, until);
+    });
+}
+
+void TimeLogHistory::searchComments(qlonglong id, const QString &text, const QDateTime &begin,
+                                    const QDateTime &end, const QString &category, bool withSubcategories) const
+{
+    postRequest(id, [=](TimeLogHistoryWorker *worker) {
+        worker->searchComments(id, text, begin, end, category, withSubcategories);
+    });
+}
+
+void TimeLogHistory::cancelRequest(qlonglong id)
+{
+    if (postToOwner([this, id]() { cancelRequest(id); })) {
+        return;
+    }
+
+    // Completed requests are not tracked, so the id could be reused later
+    if (m_activeRequests.contains(id)) {
+        m_cancelledRequests->insert(id);
+    }
 }
 
 void TimeLogHistory::getStoredCategories() const
 {
-    QMetaObject::invokeMethod(m_worker, "getStoredCategories", Qt::AutoConnection);
+    postRead(InteractivePriority, [](TimeLogHistoryWorker *worker) { worker->getStoredCategories(); });
 }
 
 void TimeLogHistory::getStats(const QDateTime &begin, const QDateTime &end, const QString &category, const QString &separator) const
 {
-    QMetaObject::invokeMethod(m_worker, "getStats", Qt::AutoConnection,
-                              Q_ARG(QDateTime, begin), Q_ARG(QDateTime, end),
-                              Q_ARG(QString, category), Q_ARG(QString, separator));
+    postRead(InteractivePriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getStats(begin, end, category, separator);
+    });
+}
+
+void TimeLogHistory::getStatsSeries(const QDateTime &begin, const QDateTime &end, int bucket, int depth,
+                                    const QString &category, const QString &separator) const
+{
+    postRead(InteractivePriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getStatsSeries(begin, end, bucket, depth, category, separator);
+    });
+}
+
+void TimeLogHistory::saveSnapshot(const QString &filePath, int entriesCount, bool isWait) const
+{
+    // On wait the pending changes are saved, otherwise it could be done after the interactive requests
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, isWait ? WritePriority : BackgroundPriority, [worker, filePath, entriesCount]() {
+        worker->saveSnapshot(filePath, entriesCount);
+    }, isWait);
+}
+
+void TimeLogHistory::beginReadSnapshot() const
+{
+    // Same priority as the reads, so it is ordered with them
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, InteractivePriority, [worker]() { worker->beginSnapshot(); });
+}
+
+void TimeLogHistory::endReadSnapshot() const
+{
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, InteractivePriority, [worker]() { worker->endSnapshot(); });
+}
+
+void TimeLogHistory::backup(const QString &filePath)
+{
+    if (m_backupWorker) {
+        emit error(tr("Backup is already in progress"));
+        emit backupFinished(filePath, false);
+        return;
+    }
+
+    // Readers don't delay the writes, the copy is made on own connection of the worker
+    TimeLogHistoryWorker *worker = m_readers.isEmpty() ? m_worker : m_readers.constLast();
+    m_backupWorker = worker;
+    post(worker, BackgroundPriority, [worker, filePath]() { worker->backup(filePath); });
+}
+
+void TimeLogHistory::maintain()
+{
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, BackgroundPriority, [worker]() { worker->maintain(true); });
 }
 
 void TimeLogHistory::getSyncData(const QDateTime &mBegin, const QDateTime &mEnd) const
 {
-    QMetaObject::invokeMethod(m_worker, "getSyncData", Qt::AutoConnection,
-                              Q_ARG(QDateTime, mBegin), Q_ARG(QDateTime, mEnd));
+    requestSyncData(0, mBegin, mEnd);
 }
 
 void TimeLogHistory::getSyncExists(const QDateTime &mBegin, const QDateTime &mEnd) const
 {
-    QMetaObject::invokeMethod(m_worker, "getSyncExists", Qt::AutoConnection,
-                              Q_ARG(QDateTime, mBegin), Q_ARG(QDateTime, mEnd));
+    postRead(BackgroundPriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getSyncExists(mBegin, mEnd);
+    });
 }
 
 void TimeLogHistory::getSyncAmount(const QDateTime &mBegin, const QDateTime &mEnd) const
 {
-    QMetaObject::invokeMethod(m_worker, "getSyncAmount", Qt::AutoConnection,
-                              Q_ARG(QDateTime, mBegin), Q_ARG(QDateTime, mEnd));
+    postRead(BackgroundPriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getSyncAmount(mBegin, mEnd);
+    });
 }
 
 void TimeLogHistory::getHashes(const QDateTime &maxDate, bool noUpdate)
 {
-    QMetaObject::invokeMethod(m_worker, "getHashes", Qt::AutoConnection,
-                              Q_ARG(QDateTime, maxDate), Q_ARG(bool, noUpdate));
+    requestHashes(0, maxDate, noUpdate);
+}
+
+void TimeLogHistory::getDayHashes(const QDateTime &begin, const QDateTime &end) const
+{
+    requestDayHashes(0, begin, end);
+}
+
+void TimeLogHistory::getDiagnostics() const
+{
+    requestDiagnostics(QThread::currentThread());
+}
+
+void TimeLogHistory::requestSyncData(qlonglong requestId, const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    postRead(BackgroundPriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getSyncData(mBegin, mEnd, requestId);
+    });
+}
+
+void TimeLogHistory::requestHashes(qlonglong requestId, const QDateTime &maxDate, bool noUpdate) const
+{
+    // Hashes are maintained on write, so readers can serve them
+    postRead(BackgroundPriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getHashes(maxDate, noUpdate, requestId);
+    });
+}
+
+void TimeLogHistory::requestDayHashes(qlonglong requestId, const QDateTime &begin, const QDateTime &end) const
+{
+    postRead(BackgroundPriority, [=](TimeLogHistoryWorker *worker) {
+        worker->getDayHashes(begin, end, requestId);
+    });
+}
+
+// Worker, which shares the thread of the caller, is skipped, as the pack history could be asked from the
+// worker of its host
+void TimeLogHistory::requestDiagnostics(QThread *callerThread) const
+{
+    if (postToOwner([this, callerThread]() { requestDiagnostics(callerThread); })) {
+        return;
+    }
+
+    // Pending collection is reported to all the callers
+    if (m_pendingDiagnostics > 0) {
+        return;
+    }
+
+    m_diagnostics.clear();
+
+    QVariantMap requests;
+    requests.insert("pendingWrites", m_pendingWrites);
+    requests.insert("pendingBackgroundWrites", m_pendingBackgroundWrites);
+    requests.insert("active", m_activeRequests.size());
+    m_diagnostics.insert("requests", requests);
+
+    QVariantMap snapshot;
+    snapshot.insert("count", m_snapshotEntries.size());
+    snapshot.insert("bytes", static_cast<qint64>(m_snapshotEntries.size() * sizeof(TimeLogEntry)));
+    m_diagnostics.insert("snapshot", snapshot);
+
+    QVariantMap skipped;
+    skipped.insert("sharedThread", true);
+
+    QVector<TimeLogHistoryWorker*> workers(m_readers);
+    workers.prepend(m_worker);
+    QVariantList readers;
+    for (int i = 0; i < workers.size(); i++) {
+        TimeLogHistoryWorker *worker = workers.at(i);
+        int readerIndex = i - 1;
+        if (readerIndex >= 0) {
+            readers.append(QVariantMap());
+        }
+
+        if (worker->thread() == callerThread) {
+            if (readerIndex < 0) {
+                m_diagnostics.insert("writer", skipped);
+            } else {
+                readers[readerIndex] = skipped;
+            }
+            continue;
+        }
+
+        ++m_pendingDiagnostics;
+        post(worker, InteractivePriority, [worker, readerIndex]() { worker->getDiagnostics(readerIndex); });
+    }
+    m_diagnostics.insert("readers", readers);
+
+    if (m_pendingDiagnostics == 0) {
+        emit diagnosticsAvailable(m_diagnostics);
+    }
+}
+
+bool TimeLogHistory::event(QEvent *event)
+{
+    if (event->type() == TimeLogHistoryRequest::eventType()) {
+        static_cast<TimeLogHistoryRequest*>(event)->call();
+        return true;
+    }
+
+    return QObject::event(event);
+}
+
+void TimeLogHistory::connectNotify(const QMetaMethod &signal)
+{
+    if (signal == QMetaMethod::fromSignal(&TimeLogHistory::syncEntryStatsAvailable)
+        || signal == QMetaMethod::fromSignal(&TimeLogHistory::syncCategoryStatsAvailable)) {
+        updateSyncChangesEnabled();
+    }
+}
+
+void TimeLogHistory::disconnectNotify(const QMetaMethod &signal)
+{
+    // Signal is invalid on disconnect of all signals
+    if (!signal.isValid()
+        || signal == QMetaMethod::fromSignal(&TimeLogHistory::syncEntryStatsAvailable)
+        || signal == QMetaMethod::fromSignal(&TimeLogHistory::syncCategoryStatsAvailable)) {
+        updateSyncChangesEnabled();
+    }
 }
 
 void TimeLogHistory::workerSizeChanged(qlonglong size)
@@ -264,6 +654,17 @@ void TimeLogHistory::workerSizeChanged(qlonglong size)
     emit sizeChanged(m_size);
 }
 
+void TimeLogHistory::workerInitFinished(bool result)
+{
+    m_snapshotEntries.clear();
+
+    if (result) {
+        initReaders(m_initDataPath, m_initFilePath, m_isInitReadonly, m_initProfile);
+    }
+
+    emit initFinished(result);
+}
+
 void TimeLogHistory::workerCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode> categories)
 {
     m_categories = categories;
@@ -281,3 +682,262 @@ void TimeLogHistory::workerUndoCountChanged(int undoCount)
 
     emit undoCountChanged(m_undoCount);
 }
+
+void TimeLogHistory::workerBarrierPassed()
+{
+    Q_ASSERT(m_pendingWrites > 0);
+    --m_pendingWrites;
+}
+
+void TimeLogHistory::workerSyncFinished()
+{
+    Q_ASSERT(m_pendingBackgroundWrites > 0);
+    if (--m_pendingBackgroundWrites == 0) {
+        // Readers could miss the changes, made in parallel, so the data should be re-requested
+        if (m_isReadDuringBackgroundWrite && m_isDataChangedDuringRead) {
+            emit dataOutdated();
+        }
+        m_isReadDuringBackgroundWrite = false;
+        m_isDataChangedDuringRead = false;
+    }
+}
+
+void TimeLogHistory::workerDataChanged()
+{
+    if (m_isReadDuringBackgroundWrite) {
+        m_isDataChangedDuringRead = true;
+    }
+}
+
+// Replies to the own requests are broadcast, replies to the clients are only seen by the one which asked
+void TimeLogHistory::workerSyncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                             QVector<TimeLogSyncDataCategory> categoryData,
+                                             QDateTime until, qlonglong requestId)
+{
+    if (requestId) {
+        emit clientSyncDataAvailable(entryData, categoryData, until, requestId);
+    } else {
+        emit syncDataAvailable(entryData, categoryData, until);
+    }
+}
+
+void TimeLogHistory::workerHashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId)
+{
+    if (requestId) {
+        emit clientHashesAvailable(hashes, requestId);
+    } else {
+        emit hashesAvailable(hashes);
+    }
+}
+
+void TimeLogHistory::workerDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin,
+                                              QDateTime end, qlonglong requestId)
+{
+    if (requestId) {
+        emit clientDayHashesAvailable(hashes, begin, end, requestId);
+    } else {
+        emit dayHashesAvailable(hashes, begin, end);
+    }
+}
+
+void TimeLogHistory::workerDataSynced(QDateTime maxSyncDate, qlonglong requestId)
+{
+    if (requestId) {
+        emit clientDataSynced(maxSyncDate, requestId);
+    } else {
+        emit dataSynced(maxSyncDate);
+    }
+}
+
+void TimeLogHistory::workerHashesUpdated(qlonglong requestId)
+{
+    if (requestId) {
+        emit clientHashesUpdated(requestId);
+    } else {
+        emit hashesUpdated();
+    }
+}
+
+void TimeLogHistory::workerRequestCompleted(QVector<TimeLogEntry> data, qlonglong id)
+{
+    Q_UNUSED(data)
+
+    m_activeRequests.remove(id);
+    m_cancelledRequests->remove(id);
+}
+
+void TimeLogHistory::workerBackupProgress(qlonglong copied, qlonglong total)
+{
+    Q_UNUSED(copied)
+    Q_UNUSED(total)
+
+    // Next step is queued after the requests, posted meanwhile
+    TimeLogHistoryWorker *worker = m_backupWorker;
+    if (worker) {
+        post(worker, BackgroundPriority, [worker]() { worker->backupStep(); });
+    }
+}
+
+void TimeLogHistory::workerBackupFinished(QString filePath, bool result)
+{
+    m_backupWorker = Q_NULLPTR;
+
+    emit backupFinished(filePath, result);
+}
+
+void TimeLogHistory::workerDiagnosticsAvailable(QVariantMap data, int readerIndex)
+{
+    if (m_pendingDiagnostics == 0) {
+        return;
+    }
+
+    if (readerIndex < 0) {
+        m_diagnostics.insert("writer", data);
+    } else {
+        QVariantList readers(m_diagnostics.value("readers").toList());
+        if (readerIndex < readers.size()) {
+            readers[readerIndex] = data;
+            m_diagnostics.insert("readers", readers);
+        }
+    }
+
+    if (--m_pendingDiagnostics == 0) {
+        emit diagnosticsAvailable(m_diagnostics);
+    }
+}
+
+void TimeLogHistory::connectReader(TimeLogHistoryWorker *reader)
+{
+    connect(reader, SIGNAL(error(QString)),
+            this, SIGNAL(error(QString)));
+    connect(reader, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+            this, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    connect(reader, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+            this, SLOT(workerRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    connect(reader, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+            this, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+    connect(reader, SIGNAL(storedCategoriesAvailable(QVector<TimeLogCategory>)),
+            this, SIGNAL(storedCategoriesAvailable(QVector<TimeLogCategory>)));
+    connect(reader, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)),
+            this, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    connect(reader, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)),
+            this, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)));
+    connect(reader, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                             QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)),
+            this, SLOT(workerSyncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                               QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)));
+    connect(reader, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)),
+            this, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)));
+    connect(reader, SIGNAL(syncExistsAvailable(bool,QDateTime,QDateTime)),
+            this, SIGNAL(syncExistsAvailable(bool,QDateTime,QDateTime)));
+    connect(reader, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)),
+            this, SLOT(workerHashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)));
+    connect(reader, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)),
+            this, SLOT(workerDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)));
+    connect(reader, SIGNAL(backupProgress(qlonglong,qlonglong)),
+            this, SIGNAL(backupProgress(qlonglong,qlonglong)));
+    connect(reader, SIGNAL(backupProgress(qlonglong,qlonglong)),
+            this, SLOT(workerBackupProgress(qlonglong,qlonglong)));
+    connect(reader, SIGNAL(backupFinished(QString,bool)),
+            this, SLOT(workerBackupFinished(QString,bool)));
+    connect(reader, SIGNAL(diagnosticsAvailable(QVariantMap,int)),
+            this, SLOT(workerDiagnosticsAvailable(QVariantMap,int)));
+}
+
+void TimeLogHistory::startWrite()
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    ++m_pendingWrites;
+
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, WritePriority, [worker]() { worker->barrier(); });
+}
+
+// Sync changes are collected by the worker only if there is someone to receive them
+void TimeLogHistory::updateSyncChangesEnabled()
+{
+    m_worker->setSyncChangesEnabled(isSignalConnected(QMetaMethod::fromSignal(&TimeLogHistory::syncEntryStatsAvailable))
+                                    || isSignalConnected(QMetaMethod::fromSignal(&TimeLogHistory::syncCategoryStatsAvailable)));
+}
+
+TimeLogHistoryWorker *TimeLogHistory::readWorker() const
+{
+    // Requests after own changes should see them, so wait for the writer in this case.
+    // Sync is performed in background, reading in parallel is handled in workerSyncFinished().
+    if (m_readers.isEmpty() || m_pendingWrites > 0) {
+        return m_worker;
+    }
+
+    m_nextReader = (m_nextReader + 1) % m_readers.size();
+
+    return m_readers.at(m_nextReader);
+}
+
+void TimeLogHistory::post(TimeLogHistoryWorker *worker, int priority, const std::function<void()> &call,
+                          bool isWait) const
+{
+    if (!isWait) {
+        QCoreApplication::postEvent(worker, new TimeLogHistoryRequest(call), priority);
+        return;
+    }
+
+    QSemaphore semaphore;
+    QCoreApplication::postEvent(worker, new TimeLogHistoryRequest([call, &semaphore]() {
+        call();
+        semaphore.release();
+    }), priority);
+    semaphore.acquire();
+}
+
+// Routing state is changed only in the thread of the history, sync workers call it from own thread
+bool TimeLogHistory::postToOwner(const std::function<void()> &call) const
+{
+    if (QThread::currentThread() == thread()) {
+        return false;
+    }
+
+    QCoreApplication::postEvent(const_cast<TimeLogHistory*>(this), new TimeLogHistoryRequest(call));
+
+    return true;
+}
+
+void TimeLogHistory::postWrite(const std::function<void(TimeLogHistoryWorker*)> &call)
+{
+    if (postToOwner([this, call]() { postWrite(call); })) {
+        return;
+    }
+
+    TimeLogHistoryWorker *worker = m_worker;
+    post(worker, WritePriority, [worker, call]() { call(worker); });
+    startWrite();
+}
+
+void TimeLogHistory::postRead(int priority, const std::function<void(TimeLogHistoryWorker*)> &call) const
+{
+    if (postToOwner([this, priority, call]() { postRead(priority, call); })) {
+        return;
+    }
+
+    TimeLogHistoryWorker *worker = readWorker();
+    // Should not overtake own changes, queued on the writer
+    if (worker == m_worker && m_pendingWrites > 0) {
+        priority = qMin(priority, static_cast<int>(WritePriority));
+    }
+    // Could overtake the background sync on the writer
+    if (m_pendingBackgroundWrites > 0) {
+        m_isReadDuringBackgroundWrite = true;
+    }
+
+    post(worker, priority, [worker, call]() { call(worker); });
+}
+
+void TimeLogHistory::postRequest(qlonglong id, const std::function<void(TimeLogHistoryWorker*)> &call) const
+{
+    if (postToOwner([this, id, call]() { postRequest(id, call); })) {
+        return;
+    }
+
+    m_activeRequests.insert(id);
+    postRead(InteractivePriority, call);
+}
@@ -19,17 +19,26 @@
 #ifndef TIMELOGHISTORY_H
 #define TIMELOGHISTORY_H
 
+#include <functional>
+
 #include <QObject>
 #include <QSharedPointer>
+#include <QVector>
+#include <QSet>
+#include <QVariant>
 
 #include "TimeLogStats.h"
 #include "TimeLogSyncDataEntry.h"
 #include "TimeLogSyncDataCategory.h"
+#include "TimeLogSyncChanges.h"
+#include "TimeLogConnectionProfile.h"
+#include "TimeLogSnapshot.h"
 
 class QThread;
 
 class TimeLogHistoryWorker;
 class TimeLogCategoryTreeNode;
+class TimeLogCancelledRequests;
 
 class TimeLogHistory : public QObject
 {
@@ -48,13 +57,25 @@ public:
     Q_FLAG(Fields)
 
     explicit TimeLogHistory(QObject *parent = 0);
+    // Worker runs in the thread of the host, which should outlive this history
+    explicit TimeLogHistory(const TimeLogHistory *host, QObject *parent = 0);
     virtual ~TimeLogHistory();
 
     bool init(const QString &dataPath, const QString &filePath = QString(), bool isReadonly = false,
-              bool isPopulateCategories = false);
+              bool isPopulateCategories = false,
+              const TimeLogConnectionProfile &profile = TimeLogConnectionProfile());
+    // Returns immediately, showing the snapshot data until the init is finished
+    void initAsync(const QString &dataPath, const QString &filePath, bool isReadonly,
+                   bool isPopulateCategories, const TimeLogConnectionProfile &profile,
+                   const TimeLogSnapshot &snapshot = TimeLogSnapshot());
+    // Read-only open without the schema setup and the categories, for the sync packs.
+    // Only the sync data and the hashes are available.
+    bool initPack(const QString &dataPath, const QString &filePath,
+                  const TimeLogConnectionProfile &profile = TimeLogConnectionProfile());
     void deinit();
 
     qlonglong size() const;
+    QVector<TimeLogEntry> snapshotEntries() const;
     QSharedPointer<TimeLogCategoryTreeNode> categories() const;
     int undoCount() const;
 
@@ -63,6 +84,9 @@ public slots:
     void import(const QVector<TimeLogEntry> &data);
     void remove(const TimeLogEntry &data);
     void edit(const TimeLogEntry &data, TimeLogHistory::Fields fields);
+    // Single transaction and a single undo for all the entries
+    void removeBatch(const QVector<TimeLogEntry> &data);
+    void editBatch(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields);
     void addCategory(const TimeLogCategory &category);
     void removeCategory(const QString &name);
     void editCategory(const QString &oldName, const TimeLogCategory &category);
@@ -70,6 +94,8 @@ public slots:
               const QVector<TimeLogSyncDataEntry> &removedData,
               const QVector<TimeLogSyncDataCategory> &categoryData);
     void updateHashes();
+    void archive(const QDateTime &until = QDateTime::currentDateTimeUtc());
+    void purgeRemoved(const QDateTime &until);
 
     void undo();
 
@@ -77,11 +103,19 @@ public slots:
                            const QDateTime &begin = QDateTime::fromTime_t(0, Qt::UTC),
                            const QDateTime &end = QDateTime::currentDateTimeUtc(),
                            const QString &category = QString(),
-                           bool withSubcategories = false) const;
+                           bool withSubcategories = false,
+                           uint chunkSize = 0) const;
     void getHistoryAfter(qlonglong id, const uint limit,
                          const QDateTime &from = QDateTime::fromTime_t(0, Qt::UTC)) const;
     void getHistoryBefore(qlonglong id, const uint limit,
                           const QDateTime &until = QDateTime::currentDateTimeUtc()) const;
+    void searchComments(qlonglong id, const QString &text,
+                        const QDateTime &begin = QDateTime::fromTime_t(0, Qt::UTC),
+                        const QDateTime &end = QDateTime::currentDateTimeUtc(),
+                        const QString &category = QString(),
+                        bool withSubcategories = false) const;
+    // Queued request is dropped, running one is aborted, both are completed with empty data
+    void cancelRequest(qlonglong id);
 
     void getStoredCategories() const;
 
@@ -89,6 +123,9 @@ public slots:
                   const QDateTime &end = QDateTime::currentDateTimeUtc(),
                   const QString &category = QString(),
                   const QString &separator = ">") const;
+    void getStatsSeries(const QDateTime &begin, const QDateTime &end,
+                        int bucket = TimeLogStatsSeries::DayBucket, int depth = 1,
+                        const QString &category = QString(), const QString &separator = ">") const;
 
     void getSyncData(const QDateTime &mBegin = QDateTime(),
                      const QDateTime &mEnd = QDateTime()) const;
@@ -98,49 +135,154 @@ public slots:
                            const QDateTime &mEnd = QDateTime::currentDateTimeUtc()) const;
 
     void getHashes(const QDateTime &maxDate = QDateTime(), bool noUpdate = false);
+    void getDayHashes(const QDateTime &begin, const QDateTime &end) const;
+
+    void saveSnapshot(const QString &filePath, int entriesCount, bool isWait = false) const;
+    // Caches and DB stats of the workers are reported with diagnosticsAvailable(), without waiting for them
+    void getDiagnostics() const;
+
+    // Requests between these calls see the same data, while other instance keeps writing to the DB.
+    // Only for read-only history in WAL mode, all its requests are served by the single connection.
+    void beginReadSnapshot() const;
+    void endReadSnapshot() const;
+
+    // Consistent copy of the DB, made in background steps, doesn't block the writes in WAL mode
+    void backup(const QString &filePath);
+    // Worker starts the maintenance on idle, this call starts it now, including the tasks which are not due.
+    // Old DB is converted to the incremental vacuum by this call, on idle only if many of its pages are free.
+    void maintain();
 
 signals:
+    void initFinished(bool result) const;
     void error(const QString &errorText) const;
     void dataOutdated() const;
     void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id) const;
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id) const;
     void storedCategoriesAvailable(QVector<TimeLogCategory> data) const;
     void dataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields>) const;
     void dataInserted(const TimeLogEntry &data) const;
     void dataImported(QVector<TimeLogEntry> data) const;
     void dataRemoved(const TimeLogEntry &data) const;
+    void dataBatchRemoved(QVector<TimeLogEntry> data) const;
     void statsDataAvailable(QVector<TimeLogStats> data, QDateTime until) const;
+    void statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until) const;
     void syncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
                            QVector<TimeLogSyncDataCategory> categoryData, QDateTime until) const;
     void syncAmountAvailable(qlonglong size, QDateTime maxMTime, QDateTime mBegin, QDateTime mEnd) const;
     void syncExistsAvailable(bool isExists, QDateTime mBegin, QDateTime mEnd) const;
-    void syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry> removedOld,
-                                 QVector<TimeLogSyncDataEntry> removedNew,
-                                 QVector<TimeLogSyncDataEntry> insertedOld,
-                                 QVector<TimeLogSyncDataEntry> insertedNew,
-                                 QVector<TimeLogSyncDataEntry> updatedOld,
-                                 QVector<TimeLogSyncDataEntry> updatedNew) const;
-    void syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory> removedOld,
-                                    QVector<TimeLogSyncDataCategory> removedNew,
-                                    QVector<TimeLogSyncDataCategory> addedOld,
-                                    QVector<TimeLogSyncDataCategory> addedNew,
-                                    QVector<TimeLogSyncDataCategory> updatedOld,
-                                    QVector<TimeLogSyncDataCategory> updatedNew) const;
+    void syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes) const;
+    void syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes) const;
     void hashesAvailable(QMap<QDateTime, QByteArray> hashes) const;
+    void dayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end) const;
     void dataSynced(const QDateTime &maxSyncDate) const;
     void hashesUpdated() const;
+    void dataArchived(const QDateTime &until) const;
+    void removedPurged(const QDateTime &until) const;
+    void backupProgress(qlonglong copied, qlonglong total) const;
+    void backupFinished(const QString &filePath, bool result) const;
+    // Zero total is reported while the step of unknown duration is in progress
+    void maintenanceProgress(int done, int total) const;
+    void maintenanceFinished(bool result) const;
+    void diagnosticsAvailable(QVariantMap data) const;
+
+    // Replies to the requests of TimeLogHistoryClient
+    void clientSyncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                 QVector<TimeLogSyncDataCategory> categoryData, QDateTime until,
+                                 qlonglong requestId) const;
+    void clientHashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId) const;
+    void clientDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end,
+                                  qlonglong requestId) const;
+    void clientDataSynced(QDateTime maxSyncDate, qlonglong requestId) const;
+    void clientHashesUpdated(qlonglong requestId) const;
 
     void sizeChanged(qlonglong size) const;
     void categoriesChanged(const QSharedPointer<TimeLogCategoryTreeNode> &categories) const;
     void undoCountChanged(int undoCount) const;
 
+protected:
+    virtual bool event(QEvent *event);
+    virtual void connectNotify(const QMetaMethod &signal);
+    virtual void disconnectNotify(const QMetaMethod &signal);
+
 private slots:
+    void workerInitFinished(bool result);
     void workerSizeChanged(qlonglong size);
     void workerCategoriesChanged(QSharedPointer<TimeLogCategoryTreeNode> categories);
     void workerUndoCountChanged(int undoCount);
+    void workerBarrierPassed();
+    void workerSyncFinished();
+    void workerDataChanged();
+    void workerSyncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                 QVector<TimeLogSyncDataCategory> categoryData, QDateTime until,
+                                 qlonglong requestId);
+    void workerHashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId);
+    void workerDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end,
+                                  qlonglong requestId);
+    void workerDataSynced(QDateTime maxSyncDate, qlonglong requestId);
+    void workerHashesUpdated(qlonglong requestId);
+    void workerRequestCompleted(QVector<TimeLogEntry> data, qlonglong id);
+    void workerBackupProgress(qlonglong copied, qlonglong total);
+    void workerBackupFinished(QString filePath, bool result);
+    void workerDiagnosticsAvailable(QVariantMap data, int readerIndex);
 
 private:
+    friend class TimeLogHistoryClient;
+
+    // Requests with higher priority are served first, same priority keeps the order
+    enum RequestPriority {
+        ShutdownPriority    = Qt::LowEventPriority - 1,
+        BackgroundPriority  = Qt::LowEventPriority,
+        WritePriority       = Qt::NormalEventPriority,
+        InteractivePriority = Qt::HighEventPriority,
+        InitPriority        = Qt::HighEventPriority + 1
+    };
+
+    void requestSync(qlonglong requestId, const QVector<TimeLogSyncDataEntry> &updatedData,
+                     const QVector<TimeLogSyncDataEntry> &removedData,
+                     const QVector<TimeLogSyncDataCategory> &categoryData);
+    void requestUpdateHashes(qlonglong requestId);
+    void requestSyncData(qlonglong requestId, const QDateTime &mBegin, const QDateTime &mEnd) const;
+    void requestHashes(qlonglong requestId, const QDateTime &maxDate, bool noUpdate) const;
+    void requestDayHashes(qlonglong requestId, const QDateTime &begin, const QDateTime &end) const;
+    void requestDiagnostics(QThread *callerThread) const;
+
+    void initReaders(const QString &dataPath, const QString &filePath, bool isReadonly,
+                     const TimeLogConnectionProfile &profile);
+    void connectReader(TimeLogHistoryWorker *reader);
+    void startWrite();
+    void updateSyncChangesEnabled();
+    TimeLogHistoryWorker *readWorker() const;
+    void post(TimeLogHistoryWorker *worker, int priority, const std::function<void()> &call,
+              bool isWait = false) const;
+    void postWrite(const std::function<void(TimeLogHistoryWorker*)> &call);
+    void postRead(int priority, const std::function<void(TimeLogHistoryWorker*)> &call) const;
+    // Interactive read, tracked by id for the cancellation
+    void postRequest(qlonglong id, const std::function<void(TimeLogHistoryWorker*)> &call) const;
+    bool postToOwner(const std::function<void()> &call) const;
+
     QThread *m_thread;
+    bool m_isSharedThread;
     TimeLogHistoryWorker *m_worker;
+    QVector<QThread*> m_readerThreads;
+    QVector<TimeLogHistoryWorker*> m_readers;
+    mutable int m_nextReader;
+    int m_pendingWrites;
+    int m_pendingBackgroundWrites;
+    mutable bool m_isReadDuringBackgroundWrite;
+    bool m_isDataChangedDuringRead;
+    QSharedPointer<TimeLogCancelledRequests> m_cancelledRequests;
+    mutable QSet<qlonglong> m_activeRequests;
+    TimeLogHistoryWorker *m_backupWorker;
+    // Collected in the thread of the history, emitted once all the workers replied
+    mutable QVariantMap m_diagnostics;
+    mutable int m_pendingDiagnostics;
+
+    // Parameters of the pending async init
+    QString m_initDataPath;
+    QString m_initFilePath;
+    bool m_isInitReadonly;
+    TimeLogConnectionProfile m_initProfile;
+    QVector<TimeLogEntry> m_snapshotEntries;
 
     qlonglong m_size;
     QSharedPointer<TimeLogCategoryTreeNode> m_categories;
@@ -0,0 +1,109 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QAtomicInt>
+
+#include "TimeLogHistoryClient.h"
+#include "TimeLogHistory.h"
+
+// Clients are created in different threads, id 0 is for the requests of the history itself
+static QAtomicInt lastClientId(0);
+
+TimeLogHistoryClient::TimeLogHistoryClient(TimeLogHistory *history, QObject *parent) :
+    QObject(parent),
+    m_history(history),
+    m_id(lastClientId.fetchAndAddRelaxed(1) + 1)
+{
+    connect(m_history, SIGNAL(clientSyncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                                      QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)),
+            this, SLOT(historySyncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                                QVector<TimeLogSyncDataCategory>,QDateTime,qlonglong)));
+    connect(m_history, SIGNAL(clientHashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)),
+            this, SLOT(historyHashesAvailable(QMap<QDateTime,QByteArray>,qlonglong)));
+    connect(m_history, SIGNAL(clientDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)),
+            this, SLOT(historyDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime,qlonglong)));
+    connect(m_history, SIGNAL(clientDataSynced(QDateTime,qlonglong)),
+            this, SLOT(historyDataSynced(QDateTime,qlonglong)));
+    connect(m_history, SIGNAL(clientHashesUpdated(qlonglong)),
+            this, SLOT(historyHashesUpdated(qlonglong)));
+}
+
+void TimeLogHistoryClient::sync(const QVector<TimeLogSyncDataEntry> &updatedData,
+                                const QVector<TimeLogSyncDataEntry> &removedData,
+                                const QVector<TimeLogSyncDataCategory> &categoryData)
+{
+    m_history->requestSync(m_id, updatedData, removedData, categoryData);
+}
+
+void TimeLogHistoryClient::updateHashes()
+{
+    m_history->requestUpdateHashes(m_id);
+}
+
+void TimeLogHistoryClient::getSyncData(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    m_history->requestSyncData(m_id, mBegin, mEnd);
+}
+
+void TimeLogHistoryClient::getHashes(const QDateTime &maxDate, bool noUpdate)
+{
+    m_history->requestHashes(m_id, maxDate, noUpdate);
+}
+
+void TimeLogHistoryClient::getDayHashes(const QDateTime &begin, const QDateTime &end) const
+{
+    m_history->requestDayHashes(m_id, begin, end);
+}
+
+void TimeLogHistoryClient::historySyncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                                    QVector<TimeLogSyncDataCategory> categoryData,
+                                                    QDateTime until, qlonglong requestId)
+{
+    if (requestId == m_id) {
+        emit syncDataAvailable(entryData, categoryData, until);
+    }
+}
+
+void TimeLogHistoryClient::historyHashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId)
+{
+    if (requestId == m_id) {
+        emit hashesAvailable(hashes);
+    }
+}
+
+void TimeLogHistoryClient::historyDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin,
+                                                     QDateTime end, qlonglong requestId)
+{
+    if (requestId == m_id) {
+        emit dayHashesAvailable(hashes, begin, end);
+    }
+}
+
+void TimeLogHistoryClient::historyDataSynced(QDateTime maxSyncDate, qlonglong requestId)
+{
+    if (requestId == m_id) {
+        emit dataSynced(maxSyncDate);
+    }
+}
+
+void TimeLogHistoryClient::historyHashesUpdated(qlonglong requestId)
+{
+    if (requestId == m_id) {
+        emit hashesUpdated();
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGHISTORYCLIENT_H
+#define TIMELOGHISTORYCLIENT_H
+
+#include <QObject>
+#include <QMap>
+#include <QVector>
+
+#include "TimeLogSyncDataEntry.h"
+#include "TimeLogSyncDataCategory.h"
+
+class TimeLogHistory;
+
+// Sync part of the TimeLogHistory interface for a single DBSyncer or peer. Replies of the history are
+// broadcast, so concurrent syncers on the same history would take each other's, this client only
+// receives the replies to own requests.
+class TimeLogHistoryClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TimeLogHistoryClient(TimeLogHistory *history, QObject *parent = 0);
+
+public slots:
+    void sync(const QVector<TimeLogSyncDataEntry> &updatedData,
+              const QVector<TimeLogSyncDataEntry> &removedData,
+              const QVector<TimeLogSyncDataCategory> &categoryData);
+    void updateHashes();
+
+    void getSyncData(const QDateTime &mBegin = QDateTime(),
+                     const QDateTime &mEnd = QDateTime()) const;
+
+    void getHashes(const QDateTime &maxDate = QDateTime(), bool noUpdate = false);
+    void getDayHashes(const QDateTime &begin, const QDateTime &end) const;
+
+signals:
+    void syncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                           QVector<TimeLogSyncDataCategory> categoryData, QDateTime until) const;
+    void hashesAvailable(QMap<QDateTime, QByteArray> hashes) const;
+    void dayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end) const;
+    void dataSynced(const QDateTime &maxSyncDate) const;
+    void hashesUpdated() const;
+
+private slots:
+    void historySyncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                  QVector<TimeLogSyncDataCategory> categoryData, QDateTime until,
+                                  qlonglong requestId);
+    void historyHashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId);
+    void historyDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end,
+                                   qlonglong requestId);
+    void historyDataSynced(QDateTime maxSyncDate, qlonglong requestId);
+    void historyHashesUpdated(qlonglong requestId);
+
+private:
+    TimeLogHistory *m_history;
+    qlonglong m_id;
+};
+
+#endif // TIMELOGHISTORYCLIENT_H
@@ -18,44 +18,269 @@
 
 #include <QStandardPaths>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QSqlError>
 #include <QDataStream>
-#include <QCryptographicHash>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QCoreApplication>
 
 #include <QLoggingCategory>
 
 #include "TimeLogHistoryWorker.h"
 #include "TimeLogCategoryTreeNode.h"
 #include "TimeLogDefaultCategories.h"
+#include "TimeLogCategoryPool.h"
+#include "TimeLogSnapshot.h"
+#include "TimeLogTrace.h"
 
 Q_LOGGING_CATEGORY(HISTORY_WORKER_CATEGORY, "TimeLogHistoryWorker", QtInfoMsg)
 
-const qint32 dbSchemaVersion = 1;
+const qint32 dbSchemaVersion = 11;
 
 const QString categorySplitPattern("\\s*>\\s*");
 
-const int maxUndoSize(10);
+// Undo journal is kept in the DB, so it is not limited by the memory
+const int maxUndoSize(100);
+
+const int queryCacheSize(64);
+
+// Amount of rows, fetched between the checks for the request cancellation
+const int cancelCheckInterval(100);
+
+// Upper bound of the result capacity, reserved by the query limit
+const uint maxReservedSize(10000);
+
+// Amount of rows, copied by a backup step, other requests are served between the steps
+const int backupStepSize(10000);
+
+const qint64 secondsPerDay(24 * 60 * 60);
+const qint64 secondsPerHour(60 * 60);
+const qint64 secondsPerWeek(7 * secondsPerDay);
+// Unix epoch is on Thursday, weeks are started on Monday
+const qint64 weekStartOffset(4 * secondsPerDay);
+
+// Limits the size of the stats series matrix
+const int maxStatsSeriesBuckets(10000);
+
+// Maintenance is started after this time without requests, in ms
+const int maintenanceIdleTime(10 * 60 * 1000);
+// Pages, freed by one step of the incremental vacuum, the rest is left to the next maintenance
+const int vacuumStepPages(256);
+const int maxVacuumSteps(64);
+// Full vacuum rewrites the whole file in one step, so on idle the DB is converted to the incremental vacuum
+// only if this share of its pages is free, in percents
+const int fullVacuumFreePercent(25);
+const qint64 analyzeInterval(secondsPerWeek);
+const qint64 integrityCheckInterval(30 * secondsPerDay);
+// Tables with the indexes, used by the queries, each is analyzed by a separate step
+const QStringList analyzedTables({ "timelog", "timelog_removed", "categories", "categories_removed",
+                                   "category_names", "category_counts", "sync_changes", "daily_stats" });
+
+// Category data is stored in binary JSON since schema version 11, it is read without parsing the text
+static QByteArray encodeCategoryData(const QVariantMap &data)
+{
+    return QJsonDocument(QJsonObject::fromVariantMap(data)).toBinaryData();
+}
+
+// Categories with the given prefix lie in [prefix, end), so lookup can use the category index
+static QString categoryRangeEnd(const QString &prefix)
+{
+    QString result(prefix);
+    while (!result.isEmpty() && result.at(result.size() - 1).unicode() == 0xFFFF) {
+        result.chop(1);
+    }
+    if (result.isEmpty()) {
+        return QString(QChar(0xFFFF)).repeated(prefix.size() + 1);
+    }
+    result[result.size() - 1] = QChar(result.at(result.size() - 1).unicode() + 1);
+
+    return result;
+}
+
+// Month hash is a count and two sums of record hashes modulo prime, so any change updates it in place
+const qint64 hashModulus(2147483647);
+
+// 28-bit word of the uuid, decoded from its hex representation
+static QString uuidWordExpression(const QString &uuid, int index)
+{
+    QStringList digits;
+    for (int i = 0; i < 7; i++) {
+        digits.append(QString("((instr('0123456789ABCDEF', substr(hex(%1), %2, 1)) - 1) << %3)")
+                      .arg(uuid).arg(index * 7 + i + 1).arg((6 - i) * 4));
+    }
+
+    return QString("(%1)").arg(digits.join(" | "));
+}
+
+// Record hash lane, keyed by the uuid words, so the sums are sensitive to every (mtime, uuid) pair
+static QString recordHashExpression(const QString &uuid, const QString &mtime, int lane)
+{
+    return QString("((%1 * (%3 % %5 + 1) + %2) % %5)")
+            .arg(uuidWordExpression(uuid, lane * 2)).arg(uuidWordExpression(uuid, lane * 2 + 1))
+            .arg(mtime).arg(hashModulus);
+}
+
+// Period is either "month" or "day"
+static QString periodStartExpression(const QString &mtime, const QString &period)
+{
+    return QString("CAST(strftime('%s', %1 / 1000, 'unixepoch', 'start of %2') AS INTEGER)").arg(mtime).arg(period);
+}
+
+// Conflict clause inside trigger is overridden by the outer INSERT OR REPLACE, so avoid conflicts at all
+static QString addPeriodHashStatement(const QString &period, const QString &uuid, const QString &mtime)
+{
+    return QString("INSERT INTO %5_hashes (start, size, sum1, sum2) SELECT %1, 0, 0, 0 "
+                   "WHERE NOT EXISTS (SELECT start FROM %5_hashes WHERE start=%1); "
+                   "UPDATE %5_hashes SET size=size + 1, sum1=(sum1 + %2) % %4, sum2=(sum2 + %3) % %4 "
+                   "WHERE start=%1; ")
+            .arg(periodStartExpression(mtime, period))
+            .arg(recordHashExpression(uuid, mtime, 0)).arg(recordHashExpression(uuid, mtime, 1))
+            .arg(hashModulus).arg(period);
+}
+
+static QString subtractPeriodHashStatement(const QString &period, const QString &uuid, const QString &mtime)
+{
+    return QString("UPDATE %5_hashes SET size=size - 1, sum1=(sum1 - %2 + %4) % %4, sum2=(sum2 - %3 + %4) % %4 "
+                   "WHERE start=%1; "
+                   "DELETE FROM %5_hashes WHERE start=%1 AND size <= 0; ")
+            .arg(periodStartExpression(mtime, period))
+            .arg(recordHashExpression(uuid, mtime, 0)).arg(recordHashExpression(uuid, mtime, 1))
+            .arg(hashModulus).arg(period);
+}
+
+// Day hashes sum up to the month hash, so only mismatched days of mismatched month need to be synced
+static QString addHashStatement(const QString &uuid, const QString &mtime)
+{
+    return addPeriodHashStatement("month", uuid, mtime) + addPeriodHashStatement("day", uuid, mtime);
+}
+
+static QString subtractHashStatement(const QString &uuid, const QString &mtime)
+{
+    return subtractPeriodHashStatement("month", uuid, mtime) + subtractPeriodHashStatement("day", uuid, mtime);
+}
+
+static QString recordsHashesSelect(const QString &period, const QString &records)
+{
+    return QString("SELECT %1 AS start, count(*) AS size, SUM(%2) % %4 AS sum1, SUM(%3) % %4 AS sum2 FROM ( "
+                   "%5"
+                   ") GROUP BY 1")
+            .arg(periodStartExpression("mtime", period))
+            .arg(recordHashExpression("uuid", "mtime", 0)).arg(recordHashExpression("uuid", "mtime", 1))
+            .arg(hashModulus).arg(records);
+}
+
+static QString hashesSelect(const QString &period, const QString &condition = QString())
+{
+    return recordsHashesSelect(period, QString("    SELECT uuid, mtime FROM timelog %1 "
+                                               "UNION ALL "
+                                               "    SELECT uuid, mtime FROM timelog_removed %1 "
+                                               "UNION ALL "
+                                               "    SELECT uuid, mtime FROM categories %1 "
+                                               "UNION ALL "
+                                               "    SELECT uuid, mtime FROM categories_removed %1 ")
+                                       .arg(condition));
+}
+
+static QMap<QDateTime, QByteArray> readHashes(QSqlQuery &query)
+{
+    QMap<QDateTime, QByteArray> result;
+
+    while (query.next()) {
+        QByteArray hash;
+        QDataStream dataStream(&hash, QIODevice::WriteOnly);
+        dataStream << query.value(1).toLongLong() << query.value(2).toLongLong() << query.value(3).toLongLong();
+        result.insert(QDateTime::fromTime_t(query.value(0).toUInt(), Qt::UTC), hash);
+    }
+
+    return result;
+}
 
-const QString selectFields("SELECT uuid, start, category, comment, duration,"
-                           " ifnull((SELECT start FROM timelog WHERE start < result.start ORDER BY start DESC LIMIT 1), 0)"
-                           " FROM timelog AS result");
+// Each word is quoted to be taken literally, the last one also matches as prefix
+static QString commentMatchExpression(const QString &text)
+{
+    QStringList terms;
+    for (QString word: text.split(QRegularExpression("\\s+"), QString::SkipEmptyParts)) {
+        terms.append(QString("\"%1\"").arg(word.replace("\"", "\"\"")));
+    }
+    if (!terms.isEmpty()) {
+        terms.last().append('*');
+    }
+
+    return terms.join(' ');
+}
+
+// Minimum amount of changed entries to recalculate durations and preceding starts in one pass
+// instead of triggers
+const int bulkModeThreshold(100);
+
+// Maximum amount of uuids looked up by one query, each is bound twice and SQLite limits parameters to 999
+const int syncLookupChunkSize(400);
+
+// Maximum amount of values looked up by one query, each is bound once
+const int lookupChunkSize(900);
+
+// Maximum amount of rows in one VALUES list, older SQLite counts them as compound SELECT terms
+const int valuesChunkSize(500);
+
+const QString selectFields("SELECT uuid, start, category, comment, duration, preceding FROM timelog_entries AS result");
+// For read-only access to the DB without stored preceding start (schema version 2 and older)
+const QString legacySelectFields("SELECT uuid, start, category, comment, duration,"
+                                 " ifnull((SELECT start FROM timelog WHERE start < result.start ORDER BY start DESC LIMIT 1), 0)"
+                                 " FROM timelog_entries AS result");
+// Archive DB is attached as "archive", it keeps category names in place
+const QString archivedSelectFields("SELECT uuid, start, category, comment, duration, preceding FROM archive.timelog AS result");
+
+// Category names are interned, entries reference them by id
+static QString categoryIdExpression(const QString &name)
+{
+    return QString("(SELECT id FROM category_names WHERE category=%1)").arg(name);
+}
+
+static QString categoryNameExpression(const QString &id)
+{
+    return QString("(SELECT category FROM category_names WHERE id=%1)").arg(id);
+}
 
 TimeLogHistoryWorker::TimeLogHistoryWorker(QObject *parent) :
     QObject(parent),
     m_isInitialized(false),
+    m_isReadonly(false),
+    m_isWalJournal(false),
+    m_isSnapshotActive(false),
     m_size(0),
     m_categorySplitRegexp(categorySplitPattern),
+    m_selectFields(selectFields),
+    m_isStatsRollupAvailable(true),
+    m_isCommentIndexAvailable(false),
+    m_isMonthHashesAvailable(true),
+    m_isDayHashesAvailable(true),
+    m_isArchivesAvailable(true),
+    m_isCategoryCountsAvailable(true),
+    m_isSyncChangesAvailable(true),
+    m_undoCount(0),
     m_insertQuery(Q_NULLPTR),
     m_removeQuery(Q_NULLPTR),
     m_notifyInsertQuery(Q_NULLPTR),
     m_notifyRemoveQuery(Q_NULLPTR),
     m_notifyEditQuery(Q_NULLPTR),
     m_notifyEditStartQuery(Q_NULLPTR),
-    m_syncAffectedQuery(Q_NULLPTR),
-    m_entryQuery(Q_NULLPTR)
+    m_entryQuery(Q_NULLPTR),
+    m_queryCache(queryCacheSize),
+    m_queryCacheHits(0),
+    m_queryCacheMisses(0),
+    m_slowQueryTime(-1),
+    m_slowQueriesCount(0),
+    m_isSyncChangesEnabled(0),
+    m_isSlicedSyncFailed(false),
+    m_maintenanceTimer(Q_NULLPTR)
 {
+    m_maintenance.done = 0;
+    m_maintenance.isActive = false;
 
 }
 
@@ -68,18 +293,163 @@ TimeLogHistoryWorker::~TimeLogHistoryWorker()
         delete m_notifyRemoveQuery;
         delete m_notifyEditQuery;
         delete m_notifyEditStartQuery;
-        delete m_syncAffectedQuery;
         delete m_entryQuery;
+        m_queryCache.clear();
 
         QSqlDatabase::database(m_connectionName).close();
         QSqlDatabase::removeDatabase(m_connectionName);
     }
 }
 
-bool TimeLogHistoryWorker::init(const QString &dataPath, const QString &filePath, bool isReadonly, bool isPopulateCategories)
+TimeLogHistoryRequest::TimeLogHistoryRequest(const std::function<void()> &call) :
+    QEvent(eventType()),
+    m_call(call)
+{
+
+}
+
+QEvent::Type TimeLogHistoryRequest::eventType()
+{
+    static const QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+    return type;
+}
+
+void TimeLogHistoryRequest::call() const
+{
+    m_call();
+}
+
+void TimeLogCancelledRequests::insert(qlonglong id)
+{
+    QMutexLocker locker(&m_mutex);
+    m_ids.insert(id);
+}
+
+void TimeLogCancelledRequests::remove(qlonglong id)
+{
+    QMutexLocker locker(&m_mutex);
+    m_ids.remove(id);
+}
+
+bool TimeLogCancelledRequests::contains(qlonglong id) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_ids.contains(id);
+}
+
+bool TimeLogHistoryWorker::event(QEvent *event)
+{
+    if (event->type() == TimeLogHistoryRequest::eventType()) {
+        TIMELOG_TRACE_SPAN("history", "request");
+        static_cast<TimeLogHistoryRequest*>(event)->call();
+        // Any request postpones the idle maintenance
+        if (m_maintenanceTimer) {
+            m_maintenanceTimer->start();
+        }
+        return true;
+    }
+
+    return QObject::event(event);
+}
+
+bool TimeLogHistoryWorker::init(const QString &dataPath, const QString &filePath, bool isReadonly,
+                                bool isPopulateCategories, const TimeLogConnectionProfile &profile)
+{
+    Q_ASSERT(!m_isInitialized);
+
+    qlonglong schemaVersion;
+    if (!openDB(dataPath, filePath, isReadonly, profile, schemaVersion)) {
+        return false;
+    }
+
+    bool isCategoryNamesAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 7);
+    if (!isReadonly) {
+        if (!setupTable()) {
+            return false;
+        }
+
+        switch (schemaVersion) {
+        case 0: // clean db
+            if (!setSchemaVersion(dbSchemaVersion)) {
+                return false;
+            }
+            break;
+        case dbSchemaVersion:
+            break;
+        default:
+            if (!upgradeSchema(schemaVersion)) {
+                return false;
+            }
+            break;
+        }
+
+        if (!setupEntriesView(true)) {
+            return false;
+        }
+
+        if (!setupTriggers()) {
+            return false;
+        }
+
+        m_isCommentIndexAvailable = setupCommentIndex();
+
+        if (!fetchUndoCount() || !fetchPurgeHorizon()) {
+            return false;
+        }
+
+        m_maintenanceTimer = new QTimer(this);
+        m_maintenanceTimer->setSingleShot(true);
+        m_maintenanceTimer->setInterval(maintenanceIdleTime);
+        connect(m_maintenanceTimer, SIGNAL(timeout()), this, SLOT(maintenanceIdle()));
+        m_maintenanceTimer->start();
+    } else {
+        if (!setupEntriesView(isCategoryNamesAvailable)) {
+            return false;
+        }
+
+        m_isCommentIndexAvailable = checkCommentIndex();
+    }
+
+    if (!fetchCategories()) {
+        return false;
+    }
+
+    if (isPopulateCategories && checkIsDBEmpty()) {
+        if (!populateCategories()) {
+            return false;
+        }
+    }
+
+    m_isInitialized = true;
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::initPack(const QString &dataPath, const QString &filePath,
+                                    const TimeLogConnectionProfile &profile)
 {
     Q_ASSERT(!m_isInitialized);
 
+    // Only the sync data and the hashes are read from the pack, so neither the schema setup,
+    // nor the categories are needed
+    qlonglong schemaVersion;
+    if (!openDB(dataPath, filePath, true, profile, schemaVersion)) {
+        return false;
+    }
+
+    if (!setupEntriesView(!(schemaVersion > 0 && schemaVersion < 7))) {
+        return false;
+    }
+
+    m_isInitialized = true;
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::openDB(const QString &dataPath, const QString &filePath, bool isReadonly,
+                                  const TimeLogConnectionProfile &profile, qlonglong &schemaVersion)
+{
     QString dirPath(QString("%1%2")
                     .arg(!dataPath.isEmpty() ? dataPath
                                              : QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
@@ -92,9 +462,12 @@ bool TimeLogHistoryWorker::init(const QString &dataPath, const QString &filePath
 
     QString dbPath(QString("%1/%2").arg(dirPath).arg(filePath.isEmpty() ? "db.sqlite" : filePath));
 
-    m_connectionName = QString("timelog_%1_%2").arg(qHash(dbPath)).arg(QDateTime::currentMSecsSinceEpoch());
+    static QAtomicInt connectionCounter;
+    m_connectionName = QString("timelog_%1_%2_%3").arg(qHash(dbPath)).arg(QDateTime::currentMSecsSinceEpoch())
+                                                  .arg(connectionCounter.fetchAndAddOrdered(1));
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
     db.setDatabaseName(dbPath);
+    m_isReadonly = isReadonly;
     if (isReadonly) {
         db.setConnectOptions("QSQLITE_OPEN_READONLY");
     }
@@ -104,43 +477,58 @@ bool TimeLogHistoryWorker::init(const QString &dataPath, const QString &filePath
         return false;
     }
 
-    qlonglong schemaVersion = getSchemaVersion();
-    switch (schemaVersion) {
-    case -1:
-        return false;
-    case 0: // clean db
-        if (!isReadonly && !setSchemaVersion(dbSchemaVersion)) {
-            return false;
-        }
-        // fall through
-    case dbSchemaVersion:
-        break;
-    default:
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Unsupported DB schema version:" << schemaVersion;
+    if (!setupConnection(profile, isReadonly)) {
         return false;
     }
 
-    if (!setupTable()) {
+    schemaVersion = getSchemaVersion();
+    if (schemaVersion == -1) {
         return false;
-    }
-
-    if (!setupTriggers()) {
+    } else if (schemaVersion > dbSchemaVersion) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Unsupported DB schema version:" << schemaVersion;
         return false;
     }
 
-    if (!fetchCategories()) {
-        return false;
+    // Read-only connection can neither create nor upgrade the schema, use it as it is
+    m_selectFields = isReadonly && schemaVersion > 0 && schemaVersion < 3 ? legacySelectFields : selectFields;
+    m_isStatsRollupAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 4);
+    m_isMonthHashesAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 5);
+    m_isDayHashesAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 6);
+    m_isArchivesAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 8);
+    m_isCategoryCountsAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 9);
+    m_isSyncChangesAvailable = !(isReadonly && schemaVersion > 0 && schemaVersion < 10);
+
+    return true;
+}
+
+void TimeLogHistoryWorker::initAsync(const QString &dataPath, const QString &filePath, bool isReadonly,
+                                     bool isPopulateCategories, const TimeLogConnectionProfile &profile,
+                                     const QVector<TimeLogEntry> &expectedEntries)
+{
+    if (!init(dataPath, filePath, isReadonly, isPopulateCategories, profile)) {
+        emit initFinished(false);
+        return;
     }
 
-    if (isPopulateCategories && checkIsDBEmpty()) {
-        if (!populateCategories()) {
-            return false;
+    // Data, shown before the init, could be outdated, e.g. by the sync without the snapshot update
+    if (!expectedEntries.isEmpty()) {
+        QVector<TimeLogEntry> entries(getRecentEntries(expectedEntries.size()));
+        bool isOutdated = (entries.size() != expectedEntries.size());
+        for (int i = 0; !isOutdated && i < entries.size(); i++) {
+            const TimeLogEntry &entry = entries.at(i);
+            const TimeLogEntry &expected = expectedEntries.at(i);
+            isOutdated = (entry.uuid != expected.uuid || entry.startTime != expected.startTime
+                          || entry.category != expected.category || entry.comment != expected.comment
+                          || entry.durationTime != expected.durationTime
+                          || entry.precedingStart != expected.precedingStart);
+        }
+        if (isOutdated) {
+            qCInfo(HISTORY_WORKER_CATEGORY) << "Snapshot is outdated";
+            emit dataOutdated();
         }
     }
 
-    m_isInitialized = true;
-
-    return true;
+    emit initFinished(true);
 }
 
 void TimeLogHistoryWorker::deinit()
@@ -159,11 +547,25 @@ void TimeLogHistoryWorker::deinit()
     m_notifyEditQuery = nullptr;
     delete m_notifyEditStartQuery;
     m_notifyEditStartQuery = nullptr;
-    delete m_syncAffectedQuery;
-    m_syncAffectedQuery = nullptr;
     delete m_entryQuery;
     m_entryQuery = nullptr;
 
+    if (!m_backup.connectionName.isEmpty()) {
+        closeBackup(false);
+    }
+
+    delete m_maintenanceTimer;
+    m_maintenanceTimer = Q_NULLPTR;
+    if (m_maintenance.isActive) {
+        finishMaintenance(false);
+    }
+
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Query cache hits:" << m_queryCacheHits
+                                     << "misses:" << m_queryCacheMisses;
+    m_queryCache.clear();
+    m_queryCacheHits = 0;
+    m_queryCacheMisses = 0;
+
     QSqlDatabase::database(m_connectionName).close();
     QSqlDatabase::removeDatabase(m_connectionName);
     m_connectionName.clear();
@@ -174,14 +576,25 @@ void TimeLogHistoryWorker::deinit()
     m_categoryRecordsCount.clear();
     updateCategories();
 
-    if (!m_undoStack.isEmpty()) {
-        m_undoStack.clear();
+    // Undo journal is kept in the DB for the next session
+    if (m_undoCount) {
+        m_undoCount = 0;
         emit undoCountChanged(0);
     }
 
     m_isInitialized = false;
 }
 
+void TimeLogHistoryWorker::setSyncChangesEnabled(bool isEnabled)
+{
+    m_isSyncChangesEnabled.store(isEnabled ? 1 : 0);
+}
+
+void TimeLogHistoryWorker::setCancelledRequests(const QSharedPointer<TimeLogCancelledRequests> &cancelledRequests)
+{
+    m_cancelledRequests = cancelledRequests;
+}
+
 qlonglong TimeLogHistoryWorker::size() const
 {
     return m_size;
@@ -192,23 +605,138 @@ QSharedPointer<TimeLogCategoryTreeNode> TimeLogHistoryWorker::categories() const
     return m_categoryTree;
 }
 
+QVariantMap TimeLogHistoryWorker::diagnostics() const
+{
+    QVariantMap result;
+    result.insert("initialized", m_isInitialized);
+    result.insert("readonly", m_isReadonly);
+    result.insert("walJournal", m_isWalJournal);
+    result.insert("size", m_size);
+    result.insert("undoCount", m_undoCount);
+
+    qint64 categoriesBytes = 0;
+    for (auto it = m_categories.constBegin(); it != m_categories.constEnd(); ++it) {
+        categoriesBytes += sizeof(TimeLogCategory) + it.key().size() * sizeof(QChar)
+                           + QJsonDocument::fromVariant(it.value().data).toJson(QJsonDocument::Compact).size();
+    }
+    QVariantMap categories;
+    categories.insert("count", m_categories.size());
+    categories.insert("bytes", categoriesBytes);
+    categories.insert("dataCacheCount", m_categoryDataCache.size());
+    result.insert("categories", categories);
+
+    qint64 recordsCountBytes = 0;
+    for (auto it = m_categoryRecordsCount.constBegin(); it != m_categoryRecordsCount.constEnd(); ++it) {
+        recordsCountBytes += sizeof(int) + sizeof(QString) + it.key().size() * sizeof(QChar);
+    }
+    QVariantMap recordsCount;
+    recordsCount.insert("count", m_categoryRecordsCount.size());
+    recordsCount.insert("bytes", recordsCountBytes);
+    result.insert("categoryRecordsCount", recordsCount);
+
+    int treeNodes = 0;
+    qint64 treeBytes = 0;
+    if (m_categoryTree) {
+        QVector<const TimeLogCategoryTreeNode*> nodes;
+        nodes.append(m_categoryTree.data());
+        while (!nodes.isEmpty()) {
+            const TimeLogCategoryTreeNode *node = nodes.takeLast();
+            treeNodes++;
+            treeBytes += sizeof(TimeLogCategoryTreeNode) + node->name.size() * sizeof(QChar)
+                         + node->children().size() * sizeof(TimeLogCategoryTreeNode*);
+            for (const TimeLogCategoryTreeNode *child: node->children()) {
+                nodes.append(child);
+            }
+        }
+    }
+    QVariantMap categoryTree;
+    categoryTree.insert("count", treeNodes);
+    categoryTree.insert("bytes", treeBytes);
+    result.insert("categoryTree", categoryTree);
+
+    QVariantMap queryCache;
+    queryCache.insert("count", m_queryCache.size());
+    queryCache.insert("maxCount", m_queryCache.maxCost());
+    queryCache.insert("hits", m_queryCacheHits);
+    queryCache.insert("misses", m_queryCacheMisses);
+    result.insert("queryCache", queryCache);
+
+    QVariantMap queryAudit;
+    queryAudit.insert("slowQueryTime", m_slowQueryTime);
+    queryAudit.insert("slowCount", m_slowQueriesCount);
+    queryAudit.insert("explainedCount", m_explainedQueries.size());
+    queryAudit.insert("fullScans", m_fullScanQueries);
+    result.insert("queryAudit", queryAudit);
+
+    if (!m_isInitialized) {
+        return result;
+    }
+
+    // The driver does not expose sqlite3_status(), the page numbers give the size of the DB and the cache
+    QVariantMap db;
+    QSqlDatabase connection = QSqlDatabase::database(m_connectionName);
+    for (const QString &pragma: QStringList() << "page_size" << "page_count" << "freelist_count"
+                                              << "cache_size" << "mmap_size" << "auto_vacuum") {
+        QSqlQuery query(connection);
+        if (!prepareAndExecQuery(query, QString("PRAGMA %1;").arg(pragma)) || !query.next()) {
+            continue;
+        }
+        db.insert(pragma, query.value(0).toLongLong());
+    }
+    // Negative cache size is in KiB, positive is in pages
+    qlonglong cacheSize = db.value("cache_size").toLongLong();
+    db.insert("cacheBytes", cacheSize < 0 ? -cacheSize * 1024 : cacheSize * db.value("page_size").toLongLong());
+    db.insert("fileBytes", db.value("page_count").toLongLong() * db.value("page_size").toLongLong());
+    result.insert("db", db);
+
+    return result;
+}
+
 void TimeLogHistoryWorker::insert(const TimeLogEntry &data)
 {
     Q_ASSERT(m_isInitialized);
 
+    if (!restoreArchives(QVector<QUuid>(), QVector<QDateTime>() << data.startTime)) {
+        processFail();
+        return;
+    }
+
     Undo undo;
     undo.type = Undo::InsertEntry;
     undo.entryData.append(data);
-    pushUndo(undo);
-
-    insertEntry(data);
+    pushUndo(undo, [this, &data]() {
+        return insertEntry(data);
+    });
 }
 
 void TimeLogHistoryWorker::import(const QVector<TimeLogEntry> &data)
 {
     Q_ASSERT(m_isInitialized);
 
-    if (insertEntryData(data) && fetchCategories()) {
+    QVector<QDateTime> starts;
+    starts.reserve(data.size());
+    for (const TimeLogEntry &entry: data) {
+        starts.append(entry.startTime);
+    }
+
+    if (!restoreArchives(QVector<QUuid>(), starts)) {
+        processFail();
+        return;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    if (!startTransaction(db)) {
+        processFail();
+        return;
+    }
+
+    if (!insertEntryData(data)) {
+        rollbackTransaction(db);
+        processFail();
+        return;
+    }
+
+    if (commitTransaction(db) && fetchCategories()) {
         emit dataImported(data);
     } else {
         processFail();
@@ -221,54 +749,154 @@ void TimeLogHistoryWorker::remove(const TimeLogEntry &data)
 {
     Q_ASSERT(m_isInitialized);
 
+    if (!restoreArchives(QVector<QUuid>() << data.uuid, QVector<QDateTime>())) {
+        processFail();
+        return;
+    }
+
     TimeLogEntry entry = getEntry(data.uuid);
+    if (!entry.isValid()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Item to remove not found:" << data.uuid;
+        processFail();
+        return;
+    }
+
     Undo undo;
     undo.type = Undo::RemoveEntry;
     undo.entryData.append(entry);
-    pushUndo(undo);
-
-    removeEntry(data);
+    pushUndo(undo, [this, &entry]() {
+        return removeEntry(entry);
+    });
 }
 
 void TimeLogHistoryWorker::edit(const TimeLogEntry &data, TimeLogHistory::Fields fields)
 {
     Q_ASSERT(m_isInitialized);
 
+    QVector<QDateTime> starts;
+    if (fields & TimeLogHistory::StartTime) {
+        starts.append(data.startTime);
+    }
+    if (!restoreArchives(QVector<QUuid>() << data.uuid, starts)) {
+        processFail();
+        return;
+    }
+
     TimeLogEntry entry = getEntry(data.uuid);
+    if (!entry.isValid()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Item to update not found:\n"
+                                            << data.startTime << data.category << data.uuid;
+        processFail();
+        return;
+    }
+
     Undo undo;
     undo.type = Undo::EditEntry;
     undo.entryData.append(entry);
     undo.entryFields.append(fields);
-    pushUndo(undo);
-
-    editEntry(data, fields);
+    pushUndo(undo, [this, &data, fields]() {
+        return editEntry(data, fields);
+    });
 }
 
-void TimeLogHistoryWorker::addCategory(const TimeLogCategory &category)
+void TimeLogHistoryWorker::removeBatch(const QVector<TimeLogEntry> &data)
 {
     Q_ASSERT(m_isInitialized);
 
-    QString categoryName(fixCategoryName(category.name));
-
-    if (categoryName.isEmpty()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << QString("Empty category name");
-        emit error("Category name can not be empty");
+    if (data.isEmpty()) {
         return;
-    } else if (m_categories.contains(categoryName) && m_categories.value(categoryName).isValid()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << QString("Category '%1' already exists").arg(categoryName);
-        emit error(QString("Category '%1' already exists").arg(categoryName));
+    } else if (data.size() == 1) {
+        remove(data.constFirst());
         return;
     }
 
-    TimeLogCategory newCategory(category);
+    QVector<QUuid> uuids;
+    uuids.reserve(data.size());
+    for (const TimeLogEntry &entry: data) {
+        uuids.append(entry.uuid);
+    }
+    if (!restoreArchives(uuids, QVector<QDateTime>())) {
+        processFail();
+        return;
+    }
+
+    QVector<TimeLogEntry> entries = getEntries(uuids);
+    if (entries.size() != data.size()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Items to remove not found:" << data.size() - entries.size();
+        processFail();
+        return;
+    }
+
+    // Undo record and all the removals are committed together
+    Undo undo;
+    undo.type = Undo::RemoveEntry;
+    undo.entryData = entries;
+    pushUndo(undo, [this, &entries]() {
+        return removeEntries(entries);
+    });
+}
+
+void TimeLogHistoryWorker::editBatch(const QVector<TimeLogEntry> &data,
+                                     const QVector<TimeLogHistory::Fields> &fields)
+{
+    Q_ASSERT(m_isInitialized);
+    Q_ASSERT(data.size() == fields.size());
+
+    if (data.isEmpty()) {
+        return;
+    } else if (data.size() == 1) {
+        edit(data.constFirst(), fields.constFirst());
+        return;
+    }
+
+    QVector<QUuid> uuids;
+    QVector<QDateTime> starts;
+    uuids.reserve(data.size());
+    for (int i = 0; i < data.size(); i++) {
+        uuids.append(data.at(i).uuid);
+        if (fields.at(i) & TimeLogHistory::StartTime) {
+            starts.append(data.at(i).startTime);
+        }
+    }
+    if (!restoreArchives(uuids, starts)) {
+        processFail();
+        return;
+    }
+
+    // Old entries are taken by the edit, which runs before the undo record is written
+    Undo undo;
+    undo.type = Undo::EditEntry;
+    undo.entryFields = fields;
+    pushUndo(undo, [this, &data, &fields, &undo]() {
+        return editEntries(data, fields, &undo.entryData);
+    });
+}
+
+void TimeLogHistoryWorker::addCategory(const TimeLogCategory &category)
+{
+    Q_ASSERT(m_isInitialized);
+
+    QString categoryName(fixCategoryName(category.name));
+
+    if (categoryName.isEmpty()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << QString("Empty category name");
+        emit error("Category name can not be empty");
+        return;
+    } else if (m_categories.contains(categoryName) && m_categories.value(categoryName).isValid()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << QString("Category '%1' already exists").arg(categoryName);
+        emit error(QString("Category '%1' already exists").arg(categoryName));
+        return;
+    }
+
+    TimeLogCategory newCategory(category);
     newCategory.name = categoryName;
 
     Undo undo;
     undo.type = Undo::AddCategory;
     undo.categoryData = newCategory;
-    pushUndo(undo);
-
-    addCategoryData(newCategory);
+    pushUndo(undo, [this, &newCategory]() {
+        return addCategoryData(newCategory);
+    });
 }
 
 void TimeLogHistoryWorker::removeCategory(const QString &name)
@@ -291,9 +919,9 @@ void TimeLogHistoryWorker::removeCategory(const QString &name)
     if (undo.categoryData.uuid.isNull()) {  // Entry-only category
         undo.categoryData.uuid = QUuid::createUuid();
     }
-    pushUndo(undo);
-
-    removeCategoryData(undo.categoryData);
+    pushUndo(undo, [this, &undo]() {
+        return removeCategoryData(undo.categoryData);
+    });
 }
 
 void TimeLogHistoryWorker::editCategory(const QString &oldName, const TimeLogCategory &category)
@@ -315,8 +943,12 @@ void TimeLogHistoryWorker::editCategory(const QString &oldName, const TimeLogCat
     TimeLogCategory newCategory(category);
     newCategory.name = categoryName;
 
+    if (oldName != categoryName && !restoreArchives(QVector<QUuid>(), QVector<QDateTime>(), oldName)) {
+        processFail();
+        return;
+    }
+
     TimeLogCategory oldCategory = m_categories.value(oldName);
-    QVector<TimeLogEntry> entries = getEntries(oldName);
     Undo undo;
     if (oldName != categoryName && m_categories.contains(categoryName)) {
         undo.type = Undo::MergeCategories;
@@ -326,77 +958,92 @@ void TimeLogHistoryWorker::editCategory(const QString &oldName, const TimeLogCat
     } else {
         undo.type = Undo::EditCategory;
     }
-    QVector<TimeLogEntry> editedEntries;
     if (oldName != categoryName) {
-        editedEntries.reserve(entries.size());
-        for (const TimeLogEntry &entry: entries) {
-            TimeLogEntry editedEntry(entry);
-            editedEntry.category = categoryName;
-            editedEntries.append(editedEntry);
+        // Undo only needs to know, which entries to move back
+        bool ok;
+        undo.entryUuids = getEntryUuids(oldName, &ok);
+        if (!ok) {
+            processFail();
+            return;
         }
-        undo.entryData.swap(entries);
-        undo.entryFields.insert(0, undo.entryData.size(), TimeLogHistory::Category);
     }
     undo.categoryData = oldCategory;
     if (undo.type == Undo::EditCategory && undo.categoryData.uuid.isNull()) {   // Entry-only category
         undo.categoryData.uuid = newCategory.uuid;
     }
     undo.categoryNewName = categoryName;
-    pushUndo(undo);
-
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-
-    if (!startTransaction(db)) {
-        goto fail;
-    }
-
-    if (!editedEntries.isEmpty()) {
-        if (!editEntriesCategory(oldName, categoryName)) {
-            goto rollback;
-        }
-        for (const TimeLogEntry &entry: editedEntries) {
-            notifyEditUpdates(entry, TimeLogHistory::Category);
-        }
-    }
-
-    if (undo.type == Undo::EditCategory) {
-        if (!oldCategory.isValid()) {  // Entry-only category, need to create db record
-            if (!addCategoryData(newCategory)) {
-                goto rollback;
-            }
-        } else {
-            if (!editCategoryData(oldName, newCategory)) {
-                goto rollback;
+    pushUndo(undo, [this, &undo, &oldName, &oldCategory, &newCategory]() {
+        if (!undo.entryUuids.isEmpty()) {
+            if (!editEntriesCategory(oldName, newCategory.name, undo.entryUuids.size())) {
+                return false;
             }
+            // Updated entries are sent in full
+            notifyUpdates(getEntries(undo.entryUuids), TimeLogHistory::Category);
         }
-    } else {    // merge
-        if (!removeCategoryData(oldCategory)) {
-            goto rollback;
+
+        if (undo.type == Undo::EditCategory) {
+            // Entry-only category needs the db record to be created
+            return oldCategory.isValid() ? editCategoryData(oldName, newCategory) : addCategoryData(newCategory);
+        } else {    // merge
+            return removeCategoryData(oldCategory);
         }
-    }
+    });
+}
 
-    if (!commitTransaction(db)) {
-        goto fail;
+void TimeLogHistoryWorker::sync(const QVector<TimeLogSyncDataEntry> &updatedData,
+                                const QVector<TimeLogSyncDataEntry> &removedData,
+                                const QVector<TimeLogSyncDataCategory> &categoryData,
+                                bool isLastSlice, qlonglong requestId)
+{
+    Q_ASSERT(m_isInitialized);
+
+    QDateTime maxSyncDate;
+    if (syncSlice(updatedData, removedData, categoryData, maxSyncDate)) {
+        m_slicedSyncDate = qMax(m_slicedSyncDate, maxSyncDate);
+    } else {
+        m_isSlicedSyncFailed = true;
     }
 
-    return;
+    emit syncFinished();
 
-rollback:
-    rollbackTransaction(db);
+    if (!isLastSlice) {
+        return;
+    }
 
-fail:
-    processFail();
+    if (!m_isSlicedSyncFailed) {
+        emit dataSynced(m_slicedSyncDate, requestId);
+    }
+    m_slicedSyncDate = QDateTime();
+    m_isSlicedSyncFailed = false;
 }
 
-void TimeLogHistoryWorker::sync(const QVector<TimeLogSyncDataEntry> &updatedData,
-                                const QVector<TimeLogSyncDataEntry> &removedData,
-                                const QVector<TimeLogSyncDataCategory> &categoryData)
+bool TimeLogHistoryWorker::syncSlice(const QVector<TimeLogSyncDataEntry> &updatedData,
+                                     const QVector<TimeLogSyncDataEntry> &removedData,
+                                     const QVector<TimeLogSyncDataCategory> &categoryData,
+                                     QDateTime &maxSyncDate)
 {
-    Q_ASSERT(m_isInitialized);
+    TIMELOG_TRACE_SPAN("sync", "syncSlice");
+    TIMELOG_TRACE_COUNTER("sync", "sliceSize", updatedData.size() + removedData.size());
+
+    QVector<QUuid> uuids;
+    QVector<QDateTime> starts;
+    uuids.reserve(updatedData.size() + removedData.size());
+    starts.reserve(updatedData.size());
+    for (const TimeLogSyncDataEntry &item: updatedData) {
+        uuids.append(item.entry.uuid);
+        starts.append(item.entry.startTime);
+    }
+    for (const TimeLogSyncDataEntry &item: removedData) {
+        uuids.append(item.entry.uuid);
+    }
+    if (!restoreArchives(uuids, starts)) {
+        processFail();
+        return false;
+    }
 
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     if (!startTransaction(db)) {
-        return;
+        return false;
     }
 
     QDateTime maxEntrySyncDate, maxCategorySyncDate;
@@ -404,1317 +1051,4745 @@ void TimeLogHistoryWorker::sync(const QVector<TimeLogSyncDataEntry> &updatedData
     if (!syncCategories(categoryData, maxCategorySyncDate)
         || !syncEntries(updatedData, removedData, maxEntrySyncDate)) {
         rollbackTransaction(db);
-        return;
+        return false;
     } else if (!commitTransaction(db)) {
-        return;
-    } else {
-        emit dataSynced(qMax(maxEntrySyncDate, maxCategorySyncDate));
+        return false;
     }
+
+    maxSyncDate = qMax(maxEntrySyncDate, maxCategorySyncDate);
+
+    return true;
 }
 
-void TimeLogHistoryWorker::updateHashes()
+void TimeLogHistoryWorker::updateHashes(qlonglong requestId)
 {
-    updateDataHashes(getDataHashes());
+    rebuildHashes();
 
-    emit hashesUpdated();
+    emit hashesUpdated(requestId);
 }
 
-void TimeLogHistoryWorker::undo()
+void TimeLogHistoryWorker::archive(const QDateTime &until)
 {
-    if (!m_undoStack.size()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Empty undo stack";
+    Q_ASSERT(m_isInitialized);
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("SELECT min(start), max(start) FROM timelog");
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
         return;
     }
 
-    Undo undo = m_undoStack.pop();
-    switch (undo.type) {
-    case Undo::InsertEntry:
-        removeEntry(undo.entryData.constFirst());
-        break;
-    case Undo::RemoveEntry:
-        insertEntry(undo.entryData.constFirst());
-        break;
-    case Undo::EditEntry:
-        editEntry(undo.entryData.constFirst(), undo.entryFields.constFirst());
-        break;
-    case Undo::AddCategory:
-        removeCategoryData(undo.categoryData);
-        break;
-    case Undo::RemoveCategory:
-        addCategoryData(undo.categoryData);
-        break;
-    case Undo::EditCategory: {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-
-        if (!startTransaction(db)) {
-            break;
-        }
+    query.next();
+    if (query.isNull(0)) {
+        query.finish();
+        emit dataArchived(until);
+        return;
+    }
+    int firstYear = QDateTime::fromTime_t(query.value(0).toUInt(), Qt::UTC).date().year();
+    // Year of the last entry stays in place, so the running entry and its predecessors are never archived
+    int lastYear = qMin(until.toUTC().date().year(),
+                        QDateTime::fromTime_t(query.value(1).toUInt(), Qt::UTC).date().year());
+    query.finish();
 
-        if (!editCategoryData(undo.categoryNewName, undo.categoryData)) {
-            rollbackTransaction(db);
-            break;
+    for (int year = firstYear; year < lastYear; year++) {
+        qint64 begin = QDateTime(QDate(year, 1, 1), QTime(0, 0), Qt::UTC).toTime_t();
+        qint64 end = QDateTime(QDate(year + 1, 1, 1), QTime(0, 0), Qt::UTC).toTime_t();
+        if (!archiveData(begin, end)) {
+            return;
         }
+    }
 
-        if (!undo.entryData.isEmpty() && !editEntries(undo.entryData, undo.entryFields)) {
-            rollbackTransaction(db);
-            break;
-        }
+    emit dataArchived(until);
+}
 
-        if (!commitTransaction(db)) {
-            break;
-        }
+// Month and day hashes are updated by the delete triggers
+void TimeLogHistoryWorker::purgeRemoved(const QDateTime &until)
+{
+    Q_ASSERT(m_isInitialized);
 
-        break;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    if (!startTransaction(db)) {
+        return;
     }
-    case Undo::MergeCategories: {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
 
-        if (!startTransaction(db)) {
-            break;
-        }
-
-        if (!addCategoryData(undo.categoryData)) {
+    QSqlQuery query(db);
+    int count = 0;
+    for (const char *table: { "timelog_removed", "categories_removed" }) {
+        QString queryString = QString("DELETE FROM %1 WHERE mtime < ?;").arg(table);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
             rollbackTransaction(db);
-            break;
+            return;
         }
+        query.addBindValue(until.toMSecsSinceEpoch());
 
-        if (!undo.entryData.isEmpty() && !editEntries(undo.entryData, undo.entryFields)) {
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
             rollbackTransaction(db);
-            break;
+            return;
         }
+        count += query.numRowsAffected();
+    }
 
-        if (!commitTransaction(db)) {
-            break;
-        }
+    bool isHorizonMoved = !m_purgeHorizon.isValid() || until > m_purgeHorizon;
+    if (isHorizonMoved && !setMaintenanceTime("purge_horizon", until.toMSecsSinceEpoch())) {
+        rollbackTransaction(db);
+        return;
+    }
 
-        break;
+    if (!commitTransaction(db)) {
+        return;
     }
+
+    if (isHorizonMoved) {
+        m_purgeHorizon = until;
     }
 
-    emit undoCountChanged(m_undoStack.size());
+    qCInfo(HISTORY_WORKER_CATEGORY) << "Purged" << count << "removed items older than" << until;
+
+    emit removedPurged(until);
 }
 
-void TimeLogHistoryWorker::getHistoryBetween(qlonglong id, const QDateTime &begin, const QDateTime &end,
-                                             const QString &category, bool withSubcategories) const
+void TimeLogHistoryWorker::barrier()
+{
+    emit barrierPassed();
+}
+
+void TimeLogHistoryWorker::beginSnapshot()
 {
     Q_ASSERT(m_isInitialized);
 
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("%1 WHERE (start BETWEEN ? AND ?) %2 ORDER BY start ASC")
-                                  .arg(selectFields)
-                                  .arg(category.isEmpty() ? ""
-                                                          : QString("AND category %1")
-                                                            .arg(withSubcategories ? "LIKE ? || '%'"
-                                                                                   : "=?"));
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+    // WAL reader doesn't block the writers, while shared lock in rollback journal mode blocks them until
+    // the end, so the snapshot is not held in this case and each request sees the latest data instead
+    if (!m_isReadonly || !m_isWalJournal || m_isSnapshotActive) {
         return;
     }
-    query.addBindValue(begin.toTime_t());
-    query.addBindValue(end.toTime_t());
-    if (!category.isEmpty()) {
-        query.addBindValue(category);
+
+    // Deferred transaction takes the snapshot on the first read
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    if (!db.transaction()) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Fail to start snapshot:" << db.lastError().text();
+        return;
     }
 
-    emit historyRequestCompleted(getHistory(query), id);
+    m_isSnapshotActive = true;
 }
 
-void TimeLogHistoryWorker::getHistoryAfter(qlonglong id, const uint limit, const QDateTime &from) const
+void TimeLogHistoryWorker::endSnapshot()
 {
-    Q_ASSERT(m_isInitialized);
+    if (!m_isSnapshotActive) {
+        return;
+    }
 
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("%1 WHERE start > ? ORDER BY start ASC LIMIT ?").arg(selectFields);
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
-        return;
+    if (!db.commit()) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Fail to end snapshot:" << db.lastError().text();
+        db.rollback();
     }
-    query.addBindValue(from.toTime_t());
-    query.addBindValue(limit);
 
-    emit historyRequestCompleted(getHistory(query), id);
+    m_isSnapshotActive = false;
 }
 
-void TimeLogHistoryWorker::getHistoryBefore(qlonglong id, const uint limit, const QDateTime &until) const
+void TimeLogHistoryWorker::backup(const QString &filePath)
 {
     Q_ASSERT(m_isInitialized);
 
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("%1 WHERE start < ? ORDER BY start DESC LIMIT ?").arg(selectFields);
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+    if (!m_backup.connectionName.isEmpty()) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Backup is already in progress:" << m_backup.filePath;
+        emit backupFinished(filePath, false);
         return;
     }
-    query.addBindValue(until.toTime_t());
-    query.addBindValue(limit);
 
-    QVector<TimeLogEntry> result = getHistory(query);
-    if (!result.isEmpty()) {
-        std::reverse(result.begin(), result.end());
+    if (!openBackup(filePath)) {
+        closeBackup(false);
+        return;
+    }
+
+    emit backupProgress(0, m_backup.total);
+
+    // In rollback journal mode the read lock of the copy blocks own writes on this thread, so it is not
+    // split into requests then
+    if (!m_isWalJournal) {
+        while (!m_backup.connectionName.isEmpty()) {
+            backupStep();
+        }
     }
-    emit historyRequestCompleted(result, id);
 }
 
-void TimeLogHistoryWorker::getStoredCategories() const
+void TimeLogHistoryWorker::backupStep()
 {
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("SELECT uuid, category, data FROM categories ORDER BY category ASC ");
-    if (!prepareAndExecQuery(query, queryString)) {
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
+    // Steps, posted after the end of the backup, are ignored
+    if (m_backup.connectionName.isEmpty()) {
         return;
     }
 
-    QVector<TimeLogCategory> result;
-
-    while (query.next()) {
-        TimeLogCategory category;
+    bool isDone = false;
+    if (!copyBackupStep(isDone) || (isDone && !finishBackup())) {
+        closeBackup(false);
+        return;
+    }
 
-        category.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
-        category.name = query.value(1).toString();
+    if (isDone) {
+        closeBackup(true);
+    } else {
+        emit backupProgress(m_backup.copied, m_backup.total);
+    }
+}
 
-        if (!query.value(2).isNull()) {
-            QByteArray jsonString = query.value(2).toByteArray();
-            QJsonParseError parseError;
-            QJsonDocument document = QJsonDocument::fromJson(jsonString, &parseError);
-            if (parseError.error != QJsonParseError::NoError) {
-                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to parse category data JSON:"
-                                                    << jsonString << "error at offset"
-                                                    << parseError.offset
-                                                    << parseError.errorString() << parseError.error;
-                emit error(tr("Fail to parse category data: %1").arg(parseError.errorString()));
-                return;
-            }
-            category.data = document.object().toVariantMap();
-        }
+void TimeLogHistoryWorker::maintain(bool isForced)
+{
+    Q_ASSERT(m_isInitialized);
 
-        result.append(category);
+    if (m_isReadonly) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Maintenance of the read-only DB is not possible";
+        emit maintenanceFinished(false);
+        return;
+    } else if (m_maintenance.isActive) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Maintenance is already in progress";
+        return;
+    } else if (!m_backup.connectionName.isEmpty()) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Maintenance is not possible during the backup";
+        emit maintenanceFinished(false);
+        return;
     }
 
-    query.finish();
-
-    emit storedCategoriesAvailable(result);
+    if (!startMaintenance(isForced)) {
+        emit maintenanceFinished(false);
+    } else if (!m_maintenance.isActive) {
+        emit maintenanceFinished(true);
+    }
 }
 
-void TimeLogHistoryWorker::getStats(const QDateTime &begin, const QDateTime &end, const QString &category, const QString &separator) const
+void TimeLogHistoryWorker::maintenanceStep()
 {
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("WITH result AS ( "
-                                  "    SELECT rtrim(substr(category, 1, ifnull(%1, length(category)))) as category, CASE "
-                                  "        WHEN duration!=-1 THEN duration "
-                                  "        ELSE (SELECT strftime('%s','now')) - (SELECT start FROM timelog ORDER BY start DESC LIMIT 1) "
-                                  "        END AS duration "
-                                  "    FROM timelog "
-                                  "    WHERE (start BETWEEN :sBegin AND :sEnd) %2 "
-                                  ") "
-                                  "SELECT category, SUM(duration) FROM result "
-                                  " GROUP BY category "
-                                  " ORDER BY category ASC")
-            .arg(category.isEmpty() ? "nullif(instr(category, :separator) - 1, -1)"
-                                    : "nullif(instr(substr(category, nullif(instr(substr(category, length(:category) + 1), :separator), 0) + 1 + length(:category)), :separator), 0) + length(:category)")
-            .arg(category.isEmpty() ? "" : "AND category LIKE :category || '%'");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
+    // Steps, posted after the end of the maintenance, are ignored
+    if (!m_maintenance.isActive) {
         return;
     }
-    query.bindValue(":sBegin", begin.toTime_t());
-    query.bindValue(":sEnd", end.toTime_t());
-    query.bindValue(":separator", separator);
-    if (!category.isEmpty()) {
-        query.bindValue(":category", category);
+
+    Maintenance::Task task = m_maintenance.steps.at(m_maintenance.done);
+    // Full vacuum can't be split, so its progress is unknown
+    if (task == Maintenance::FullVacuum) {
+        emit maintenanceProgress(m_maintenance.done, 0);
+    }
+
+    if (!runMaintenanceStep(task)) {
+        finishMaintenance(false);
+        return;
+    }
+
+    if (++m_maintenance.done == m_maintenance.steps.size()) {
+        finishMaintenance(true);
+        return;
     }
 
-    emit statsDataAvailable(getStats(query), end);
+    emit maintenanceProgress(m_maintenance.done, m_maintenance.steps.size());
+    postMaintenanceStep();
 }
 
-void TimeLogHistoryWorker::getSyncData(const QDateTime &mBegin, const QDateTime &mEnd) const
+void TimeLogHistoryWorker::maintenanceIdle()
 {
-    Q_ASSERT(m_isInitialized);
-
-    emit syncDataAvailable(getSyncEntryData(mBegin, mEnd), getSyncCategoryData(mBegin, mEnd), mEnd);
+    // Nothing to do or busy, checked again after the next idle period
+    if (m_maintenance.isActive || !m_backup.connectionName.isEmpty() || !startMaintenance(false)
+        || !m_maintenance.isActive) {
+        m_maintenanceTimer->start();
+    }
 }
 
-void TimeLogHistoryWorker::getSyncExists(const QDateTime &mBegin, const QDateTime &mEnd) const
+void TimeLogHistoryWorker::undo()
 {
-    Q_ASSERT(m_isInitialized);
+    if (!m_undoCount) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Empty undo stack";
+        return;
+    }
 
-    emit syncExistsAvailable(getSyncDataExists(mBegin, mEnd), mBegin, mEnd);
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    {
+        // Entries of the action should be in place before the transaction, archives can not be attached in it
+        QSqlQuery query(db);
+        QString queryString("SELECT uuid, start FROM undo_entries"
+                            " WHERE action=(SELECT max(id) FROM undo_actions)");
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return;
+        }
+
+        QVector<QUuid> uuids;
+        QVector<QDateTime> starts;
+        while (query.next()) {
+            uuids.append(QUuid::fromRfc4122(query.value(0).toByteArray()));
+            if (!query.isNull(1)) {
+                starts.append(QDateTime::fromTime_t(query.value(1).toUInt(), Qt::UTC));
+            }
+        }
+        query.finish();
+
+        if (!restoreArchives(uuids, starts)) {
+            emit dataOutdated();
+            return;
+        }
+    }
+
+    if (!startTransaction(db)) {
+        emit dataOutdated();
+        return;
+    }
+
+    int undoCount = m_undoCount;
+    Undo undo;
+    bool isOk = takeUndo(undo);
+    if (isOk) {
+        switch (undo.type) {
+        case Undo::InsertEntry:
+            isOk = undo.entryData.size() == 1 ? removeEntry(undo.entryData.constFirst())
+                                              : removeEntries(undo.entryData);
+            break;
+        case Undo::RemoveEntry:
+            isOk = undo.entryData.size() == 1 ? insertEntry(undo.entryData.constFirst())
+                                              : insertEntries(undo.entryData);
+            break;
+        case Undo::EditEntry:
+            isOk = undo.entryData.size() == 1 ? editEntry(undo.entryData.constFirst(), undo.entryFields.constFirst())
+                                              : editEntries(undo.entryData, undo.entryFields);
+            break;
+        case Undo::AddCategory:
+            isOk = removeCategoryData(undo.categoryData);
+            break;
+        case Undo::RemoveCategory:
+            isOk = addCategoryData(undo.categoryData);
+            break;
+        case Undo::EditCategory:
+            isOk = editCategoryData(undo.categoryNewName, undo.categoryData)
+                   && (undo.entryUuids.isEmpty()
+                       || editEntriesCategory(undo.entryUuids, undo.categoryData.name));
+            break;
+        case Undo::MergeCategories:
+            isOk = addCategoryData(undo.categoryData)
+                   && (undo.entryUuids.isEmpty()
+                       || editEntriesCategory(undo.entryUuids, undo.categoryData.name));
+            break;
+        }
+    }
+
+    // Journal record is removed in the same transaction, so it stays in place if undo fails
+    if (!isOk) {
+        rollbackTransaction(db);
+    } else if (commitTransaction(db)) {
+        emit undoCountChanged(m_undoCount);
+        return;
+    }
+
+    m_undoCount = undoCount;
+    emit dataOutdated();
 }
 
-void TimeLogHistoryWorker::getSyncAmount(const QDateTime &mBegin, const QDateTime &mEnd) const
+void TimeLogHistoryWorker::getHistoryBetween(qlonglong id, const QDateTime &begin, const QDateTime &end,
+                                             const QString &category, bool withSubcategories,
+                                             uint chunkSize) const
 {
     Q_ASSERT(m_isInitialized);
 
+    if (isRequestCancelled(id)) {
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
+    }
+
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("SELECT count(*), max(mtime) FROM ( "
-                        "    SELECT mtime FROM timelog "
-                        "    WHERE mtime BETWEEN :mBegin AND :mEnd "
-                        "UNION "
-                        "    SELECT mtime FROM timelog_removed "
-                        "    WHERE mtime BETWEEN :mBegin AND :mEnd "
-                        "UNION "
-                        "    SELECT mtime FROM categories "
-                        "    WHERE mtime BETWEEN :mBegin AND :mEnd "
-                        "UNION "
-                        "    SELECT mtime FROM categories_removed "
-                        "    WHERE mtime BETWEEN :mBegin AND :mEnd "
-                        ")");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
+    QString condition = QString(" WHERE (start BETWEEN ? AND ?) %1 ORDER BY start ASC")
+                        .arg(category.isEmpty() ? ""
+                                                : QString("AND category %1")
+                                                  .arg(withSubcategories ? ">=? AND category < ?"
+                                                                         : "=?"));
+    auto bindValues = [&](QSqlQuery &query) {
+        query.addBindValue(begin.toTime_t());
+        query.addBindValue(end.toTime_t());
+        if (!category.isEmpty()) {
+            query.addBindValue(category);
+            if (withSubcategories) {
+                query.addBindValue(categoryRangeEnd(category));
+            }
+        }
+    };
+
+    QVector<Archive> archives;
+    if (!getArchives(archives)) {
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
         return;
     }
-    query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
-    query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
+    // Archives precede the entries in the main DB, so their data is sent first
+    QVector<TimeLogEntry> result;
+    for (const Archive &archive: archives) {
+        if (isRequestCancelled(id)) {
+            emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+            return;
+        }
+        if (archive.end <= begin.toTime_t() || archive.start > end.toTime_t()
+            || !attachArchive(archivePath(archive.start), "archive")) {
+            continue;
+        }
+
+        QVector<TimeLogEntry> archivedData;
+        {
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            if (!query.prepare(archivedSelectFields + condition)) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                    << query.lastQuery();
+                emit error(tr("DB error: %1").arg(query.lastError().text()));
+            } else {
+                bindValues(query);
+                archivedData = getHistory(query, id, chunkSize);
+            }
+        }
+        detachArchive("archive");
+
+        if (!chunkSize) {
+            result.append(archivedData);
+        } else if (!archivedData.isEmpty()) {
+            emit historyRequestPartial(archivedData, id);
+        }
+    }
+
+    QSqlQuery query(db);
+    if (!prepareCachedQuery(query, m_selectFields + condition)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
+        emit historyRequestCompleted(result, id);
         return;
     }
+    bindValues(query);
 
-    query.next();
-    qlonglong result = query.value(0).toLongLong();
-    QDateTime maxMTime;
-    if (!query.isNull(1)) {
-        maxMTime = QDateTime::fromMSecsSinceEpoch(query.value(1).toLongLong(), Qt::UTC);
+    result.append(getHistory(query, id, chunkSize));
+    if (isRequestCancelled(id)) {
+        result.clear();
     }
-    query.finish();
 
-    emit syncAmountAvailable(result, maxMTime, mBegin, mEnd);
+    emit historyRequestCompleted(result, id);
 }
 
-void TimeLogHistoryWorker::getHashes(const QDateTime &maxDate, bool noUpdate)
+void TimeLogHistoryWorker::getHistoryAfter(qlonglong id, const uint limit, const QDateTime &from) const
 {
-    QMap<QDateTime, QByteArray> hashes(getDataHashes(maxDate));
-    if (!noUpdate && std::any_of(hashes.cbegin(), hashes.cend(), [](const QByteArray &hash) {
-        return hash.isEmpty();
-    })) {
-        updateDataHashes(hashes);
-        hashes = getDataHashes(maxDate);
-    }
+    Q_ASSERT(m_isInitialized);
 
-    emit hashesAvailable(hashes);
-}
+    if (isRequestCancelled(id)) {
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
+    }
 
-bool TimeLogHistoryWorker::prepareAndExecQuery(QSqlQuery &query, const QString &queryString) const
-{
-    if (!query.prepare(queryString)) {
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("%1 WHERE start > ? ORDER BY start ASC LIMIT ?").arg(m_selectFields);
+    if (!prepareCachedQuery(query, queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
-        return false;
-    }
-
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery();
-        return false;
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
     }
+    query.addBindValue(from.toTime_t());
+    query.addBindValue(limit);
 
-    return true;
+    emit historyRequestCompleted(getHistory(query, id, 0, limit), id);
 }
 
-qlonglong TimeLogHistoryWorker::getSchemaVersion() const
+void TimeLogHistoryWorker::getHistoryBefore(qlonglong id, const uint limit, const QDateTime &until) const
 {
+    Q_ASSERT(m_isInitialized);
+
+    if (isRequestCancelled(id)) {
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
+    }
+
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("PRAGMA user_version;");
-    if (!prepareAndExecQuery(query, queryString)) {
-        return -1;
+    QString queryString = QString("%1 WHERE start < ? ORDER BY start DESC LIMIT ?").arg(m_selectFields);
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
     }
+    query.addBindValue(until.toTime_t());
+    query.addBindValue(limit);
 
-    if (!query.next()) {
-        return 0;
+    QVector<TimeLogEntry> result = getHistory(query, id, 0, limit);
+    if (!result.isEmpty()) {
+        std::reverse(result.begin(), result.end());
     }
-
-    return query.value(0).toLongLong();
+    emit historyRequestCompleted(result, id);
 }
 
-bool TimeLogHistoryWorker::setSchemaVersion(qint32 schemaVersion)
+void TimeLogHistoryWorker::searchComments(qlonglong id, const QString &text, const QDateTime &begin,
+                                          const QDateTime &end, const QString &category,
+                                          bool withSubcategories) const
 {
+    Q_ASSERT(m_isInitialized);
+
+    QString matchText = m_isCommentIndexAvailable ? commentMatchExpression(text) : text.trimmed();
+    if (matchText.isEmpty() || isRequestCancelled(id)) {
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
+    }
+
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString(QString("PRAGMA user_version = %1;").arg(QString().setNum(schemaVersion)));
+    QString queryString = QString("%1 WHERE %2 AND (start BETWEEN ? AND ?) %3 ORDER BY start ASC")
+                                  .arg(m_selectFields)
+                                  .arg(m_isCommentIndexAvailable ? "start IN (SELECT rowid FROM timelog_comment"
+                                                                   " WHERE timelog_comment MATCH ?)"
+                                                                 : "comment LIKE '%' || ? || '%' ESCAPE '\\'")
+                                  .arg(category.isEmpty() ? ""
+                                                          : QString("AND category %1")
+                                                            .arg(withSubcategories ? ">=? AND category < ?"
+                                                                                   : "=?"));
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        emit historyRequestCompleted(QVector<TimeLogEntry>(), id);
+        return;
+    }
+    if (!m_isCommentIndexAvailable) {
+        matchText.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    }
+    query.addBindValue(matchText);
+    query.addBindValue(begin.toTime_t());
+    query.addBindValue(end.toTime_t());
+    if (!category.isEmpty()) {
+        query.addBindValue(category);
+        if (withSubcategories) {
+            query.addBindValue(categoryRangeEnd(category));
+        }
+    }
 
-    return prepareAndExecQuery(query, queryString);
+    emit historyRequestCompleted(getHistory(query, id), id);
 }
 
-bool TimeLogHistoryWorker::setupTable()
+void TimeLogHistoryWorker::getStoredCategories() const
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString;
-
-    /* timelog */
-    queryString = "CREATE TABLE IF NOT EXISTS timelog"
-                  " (uuid BLOB UNIQUE NOT NULL, start INTEGER PRIMARY KEY, category TEXT NOT NULL,"
-                  " comment TEXT, duration INTEGER, mtime INTEGER);";
+    QString queryString("SELECT uuid, category, data, mtime FROM categories ORDER BY category ASC ");
     if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return;
     }
 
-    queryString = "CREATE INDEX IF NOT EXISTS timelog_category_index ON timelog (category);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+    QVector<TimeLogCategory> result;
 
-    queryString = "CREATE INDEX IF NOT EXISTS timelog_mtime_index ON timelog (mtime);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+    while (query.next()) {
+        TimeLogCategory category;
 
-    /* timelog removed */
-    queryString = "CREATE TABLE IF NOT EXISTS timelog_removed"
-                  "(uuid BLOB PRIMARY KEY, mtime INTEGER) WITHOUT ROWID;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+        QByteArray uuid(query.value(0).toByteArray());
+        category.uuid = QUuid::fromRfc4122(uuid);
+        category.name = query.value(1).toString();
 
-    queryString = "CREATE INDEX IF NOT EXISTS timelog_removed_mtime_index ON timelog_removed (mtime);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+        if (!query.value(2).isNull()
+            && !decodeCategoryData(uuid, query.value(3).toLongLong(), query.value(2).toByteArray(), category.data)) {
+            return;
+        }
 
-    /* categories */
-    queryString = "CREATE TABLE IF NOT EXISTS categories"
-                  " (uuid BLOB PRIMARY KEY, category TEXT UNIQUE NOT NULL, data BLOB, mtime INTEGER) WITHOUT ROWID;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+        result.append(category);
     }
 
-    queryString = "CREATE INDEX IF NOT EXISTS categories_mtime_index ON categories (mtime);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+    query.finish();
 
-    /* categories removed */
-    queryString = "CREATE TABLE IF NOT EXISTS categories_removed"
-                  " (uuid BLOB PRIMARY KEY, mtime INTEGER) WITHOUT ROWID;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+    emit storedCategoriesAvailable(result);
+}
 
-    queryString = "CREATE INDEX IF NOT EXISTS categories_removed_mtime_index ON categories_removed (mtime);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+void TimeLogHistoryWorker::getStats(const QDateTime &begin, const QDateTime &end, const QString &category, const QString &separator) const
+{
+    qint64 sBegin = begin.toTime_t();
+    qint64 sEnd = end.toTime_t();
+    // Full days are taken from the daily stats, the rest of range and running entry from the timelog
+    qint64 dBegin = (sBegin + secondsPerDay - 1) / secondsPerDay * secondsPerDay;
+    qint64 dEnd = (sEnd + 1) / secondsPerDay * secondsPerDay - 1;
+    if (!m_isStatsRollupAvailable || dEnd < dBegin) {
+        dBegin = sEnd + 1;
+        dEnd = sEnd;
+    }
+
+    QVector<Archive> archives;
+    if (!getArchives(archives)) {
+        return;
     }
 
-    /* hashes */
-    queryString = "CREATE TABLE IF NOT EXISTS hashes (start INTEGER PRIMARY KEY, hash BLOB);";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
-    }
+    // Full days of the archived entries are in the daily stats, only the partial days need the archives
+    QStringList attachedArchives;
+    QString archivedSource;
+    for (const Archive &archive: archives) {
+        if ((archive.end <= sBegin || archive.start >= dBegin) && (archive.end <= dEnd + 1 || archive.start > sEnd)) {
+            continue;
+        }
 
-    return true;
-}
+        QString name = QString("archive%1").arg(attachedArchives.size());
+        if (!attachArchive(archivePath(archive.start), name)) {
+            continue;
+        }
+        attachedArchives.append(name);
+        archivedSource.append(QString("UNION ALL "
+                                      "    SELECT category, duration FROM %1.timelog "
+                                      "    WHERE ((start BETWEEN :sBegin AND :dBegin - 1) "
+                                      "           OR (start BETWEEN :dEnd + 1 AND :sEnd)) %2 ")
+                              .arg(name)
+                              .arg(category.isEmpty() ? "" : "AND category >= :category AND category < :categoryEnd"));
+    }
 
-bool TimeLogHistoryWorker::setupTriggers()
-{
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString;
-
-    /* timelog */
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_timelog BEFORE INSERT ON timelog "
-                  "BEGIN "
-                  "    SELECT mtime, "
-                  "        CASE WHEN NEW.mtime < mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END "
-                  "    FROM timelog_removed WHERE uuid=NEW.uuid; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
+    QString queryString = QString("WITH source AS ( "
+                                  "    SELECT category, duration FROM timelog_entries "
+                                  "    WHERE (start BETWEEN :sBegin AND :dBegin - 1) %2 "
+                                  "UNION ALL "
+                                  "    SELECT category, duration FROM timelog_entries "
+                                  "    WHERE (start BETWEEN :dEnd + 1 AND :sEnd) %2 "
+                                  "UNION ALL "
+                                  "    SELECT category, duration FROM timelog_entries "
+                                  "    WHERE start=(SELECT max(start) FROM timelog) AND duration=-1 "
+                                  "    AND (start BETWEEN :dBegin AND :dEnd) %2 "
+                                  "%3"
+                                  "%4"
+                                  "), result AS ( "
+                                  "    SELECT rtrim(substr(category, 1, ifnull(%1, length(category)))) as category, CASE "
+                                  "        WHEN duration!=-1 THEN duration "
+                                  "        ELSE (SELECT strftime('%s','now')) - (SELECT start FROM timelog ORDER BY start DESC LIMIT 1) "
+                                  "        END AS duration "
+                                  "    FROM source "
+                                  ") "
+                                  "SELECT category, SUM(duration) FROM result "
+                                  " GROUP BY category "
+                                  " ORDER BY category ASC")
+            .arg(category.isEmpty() ? "nullif(instr(category, :separator) - 1, -1)"
+                                    : "nullif(instr(substr(category, nullif(instr(substr(category, length(:category) + 1), :separator), 0) + 1 + length(:category)), :separator), 0) + length(:category)")
+            .arg(category.isEmpty() ? "" : "AND category >= :category AND category < :categoryEnd")
+            .arg(!m_isStatsRollupAvailable ? QString()
+                                           : QString("UNION ALL "
+                                                     "    SELECT category, duration FROM daily_stats "
+                                                     "    WHERE (day BETWEEN :dBegin AND :dEnd) AND duration > 0 %1 ")
+                                             .arg(category.isEmpty() ? "" : "AND category >= :category AND category < :categoryEnd"))
+            .arg(archivedSource);
+    // Statement on the attached archives is not cached, it should be released before detach
+    query.setForwardOnly(true);
+    if (!(attachedArchives.isEmpty() ? prepareCachedQuery(query, queryString) : query.prepare(queryString))) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        query.clear();
+        for (const QString &name: attachedArchives) {
+            detachArchive(name);
+        }
+        return;
+    }
+    query.bindValue(":sBegin", sBegin);
+    query.bindValue(":sEnd", sEnd);
+    query.bindValue(":dBegin", dBegin);
+    query.bindValue(":dEnd", dEnd);
+    query.bindValue(":separator", separator);
+    if (!category.isEmpty()) {
+        query.bindValue(":category", category);
+        query.bindValue(":categoryEnd", categoryRangeEnd(category));
+    }
+
+    QVector<TimeLogStats> result = getStats(query);
+    query.clear();
+    for (const QString &name: attachedArchives) {
+        detachArchive(name);
+    }
+
+    emit statsDataAvailable(result, end);
+}
+
+void TimeLogHistoryWorker::getStatsSeries(const QDateTime &begin, const QDateTime &end, int bucket, int depth,
+                                          const QString &category, const QString &separator) const
+{
+    qint64 sBegin = begin.toTime_t();
+    qint64 sEnd = end.toTime_t();
+
+    TimeLogStatsSeries result;
+    result.bucket = static_cast<TimeLogStatsSeries::Bucket>(bucket);
+
+    // Buckets are in UTC, same as the daily stats
+    QString bucketExpression;
+    switch (result.bucket) {
+    case TimeLogStatsSeries::HourBucket:
+        bucketExpression = QString("start - start % %1").arg(secondsPerHour);
+        for (qint64 start = sBegin - sBegin % secondsPerHour; start <= sEnd; start += secondsPerHour) {
+            result.buckets.append(QDateTime::fromTime_t(start, Qt::UTC));
+        }
+        break;
+    case TimeLogStatsSeries::DayBucket:
+        bucketExpression = QString("start - start % %1").arg(secondsPerDay);
+        for (qint64 start = sBegin - sBegin % secondsPerDay; start <= sEnd; start += secondsPerDay) {
+            result.buckets.append(QDateTime::fromTime_t(start, Qt::UTC));
+        }
+        break;
+    case TimeLogStatsSeries::WeekBucket:
+        bucketExpression = QString("start - (start - %1) % %2").arg(weekStartOffset).arg(secondsPerWeek);
+        for (qint64 start = sBegin - (sBegin - weekStartOffset) % secondsPerWeek; start <= sEnd;
+             start += secondsPerWeek) {
+            result.buckets.append(QDateTime::fromTime_t(start, Qt::UTC));
+        }
+        break;
+    case TimeLogStatsSeries::MonthBucket: {
+        bucketExpression = "CAST(strftime('%s', start, 'unixepoch', 'start of month') AS INTEGER)";
+        QDate date = QDateTime::fromTime_t(sBegin, Qt::UTC).date();
+        for (QDateTime start(QDate(date.year(), date.month(), 1), QTime(0, 0), Qt::UTC);
+             start.toTime_t() <= sEnd; start = start.addMonths(1)) {
+            result.buckets.append(start);
+        }
+        break;
+    }
+    default:
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Invalid stats bucket" << bucket;
+        return;
+    }
+
+    if (result.buckets.size() > maxStatsSeriesBuckets) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Too many stats buckets requested:" << result.buckets.size();
+        emit error(tr("Too many stats buckets requested"));
+        return;
+    }
+
+    QHash<qint64, int> bucketIndexes;
+    for (int i = 0; i < result.buckets.size(); i++) {
+        bucketIndexes.insert(result.buckets.at(i).toTime_t(), i);
+    }
+
+    // Daily stats can only fill the buckets of full days
+    qint64 dBegin = (sBegin + secondsPerDay - 1) / secondsPerDay * secondsPerDay;
+    qint64 dEnd = (sEnd + 1) / secondsPerDay * secondsPerDay - 1;
+    if (!m_isStatsRollupAvailable || result.bucket == TimeLogStatsSeries::HourBucket || dEnd < dBegin) {
+        dBegin = sEnd + 1;
+        dEnd = sEnd;
+    }
+
+    QVector<Archive> archives;
+    if (!getArchives(archives)) {
+        return;
+    }
+
+    QString categoryCondition(category.isEmpty() ? "" : "AND category >= :category AND category < :categoryEnd");
+
+    QStringList attachedArchives;
+    QString archivedSource;
+    for (const Archive &archive: archives) {
+        if ((archive.end <= sBegin || archive.start >= dBegin) && (archive.end <= dEnd + 1 || archive.start > sEnd)) {
+            continue;
+        }
+
+        QString name = QString("archive%1").arg(attachedArchives.size());
+        if (!attachArchive(archivePath(archive.start), name)) {
+            continue;
+        }
+        attachedArchives.append(name);
+        archivedSource.append(QString("UNION ALL "
+                                      "    SELECT start, category, duration FROM %1.timelog "
+                                      "    WHERE ((start BETWEEN :sBegin AND :dBegin - 1) "
+                                      "           OR (start BETWEEN :dEnd + 1 AND :sEnd)) %2 ")
+                              .arg(name).arg(categoryCondition));
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("WITH source AS ( "
+                                  "    SELECT start, category, duration FROM timelog_entries "
+                                  "    WHERE (start BETWEEN :sBegin AND :dBegin - 1) %1 "
+                                  "UNION ALL "
+                                  "    SELECT start, category, duration FROM timelog_entries "
+                                  "    WHERE (start BETWEEN :dEnd + 1 AND :sEnd) %1 "
+                                  "UNION ALL "
+                                  "    SELECT start, category, duration FROM timelog_entries "
+                                  "    WHERE start=(SELECT max(start) FROM timelog) AND duration=-1 "
+                                  "    AND (start BETWEEN :dBegin AND :dEnd) %1 "
+                                  "%2"
+                                  "%3"
+                                  ") "
+                                  "SELECT %4, category, SUM(CASE "
+                                  "    WHEN duration!=-1 THEN duration "
+                                  "    ELSE (SELECT strftime('%s','now')) - (SELECT start FROM timelog ORDER BY start DESC LIMIT 1) "
+                                  "    END) "
+                                  "FROM source GROUP BY 1, 2")
+            .arg(categoryCondition)
+            .arg(!m_isStatsRollupAvailable ? QString()
+                                           : QString("UNION ALL "
+                                                     "    SELECT day AS start, category, duration FROM daily_stats "
+                                                     "    WHERE (day BETWEEN :dBegin AND :dEnd) AND duration > 0 %1 ")
+                                             .arg(categoryCondition))
+            .arg(archivedSource)
+            .arg(bucketExpression);
+    // Statement on the attached archives is not cached, it should be released before detach
+    query.setForwardOnly(true);
+    bool isPrepared = (attachedArchives.isEmpty() ? prepareCachedQuery(query, queryString) : query.prepare(queryString));
+    if (isPrepared) {
+        query.bindValue(":sBegin", sBegin);
+        query.bindValue(":sEnd", sEnd);
+        query.bindValue(":dBegin", dBegin);
+        query.bindValue(":dEnd", dEnd);
+        if (!category.isEmpty()) {
+            query.bindValue(":category", category);
+            query.bindValue(":categoryEnd", categoryRangeEnd(category));
+        }
+    }
+    if (!isPrepared || !execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        query.clear();
+        for (const QString &name: attachedArchives) {
+            detachArchive(name);
+        }
+        return;
+    }
+
+    // Categories are cut to the requested depth after the aggregation, it's simpler than doing it in SQL
+    QMap<QString, QVector<int> > columns;
+    while (query.next()) {
+        QHash<qint64, int>::const_iterator bucketIt = bucketIndexes.constFind(query.value(0).toLongLong());
+        if (bucketIt == bucketIndexes.constEnd()) {
+            continue;
+        }
+
+        QString name = query.value(1).toString();
+        if (depth > 0) {
+            int nameEnd = -1;
+            for (int level = 0, from = 0; level < depth; level++) {
+                nameEnd = name.indexOf(separator, from);
+                if (nameEnd == -1) {
+                    break;
+                }
+                from = nameEnd + separator.size();
+            }
+            if (nameEnd != -1) {
+                name.truncate(nameEnd);
+            }
+            while (name.endsWith(' ')) {
+                name.chop(1);
+            }
+        }
+
+        QMap<QString, QVector<int> >::iterator it = columns.find(name);
+        if (it == columns.end()) {
+            it = columns.insert(TimeLogCategoryPool::intern(name), QVector<int>(result.buckets.size(), 0));
+        }
+        (*it)[bucketIt.value()] += query.value(2).toInt();
+    }
+    query.clear();
+    for (const QString &name: attachedArchives) {
+        detachArchive(name);
+    }
+
+    result.categories = columns.keys();
+    result.durations.resize(result.buckets.size() * result.categories.size());
+    int categoryIndex = 0;
+    for (QMap<QString, QVector<int> >::const_iterator it = columns.cbegin(); it != columns.cend(); ++it) {
+        for (int bucketIndex = 0; bucketIndex < result.buckets.size(); bucketIndex++) {
+            result.durations[bucketIndex * result.categories.size() + categoryIndex] = it.value().at(bucketIndex);
+        }
+        categoryIndex++;
+    }
+
+    emit statsSeriesAvailable(result, end);
+}
+
+void TimeLogHistoryWorker::saveSnapshot(const QString &filePath, int entriesCount) const
+{
+    Q_ASSERT(m_isInitialized);
+
+    TimeLogSnapshot snapshot;
+    snapshot.size = m_size;
+    snapshot.recentEntries = getRecentEntries(entriesCount);
+    snapshot.categories = m_categoryTree;
+
+    TimeLogSnapshot::save(filePath, snapshot);
+}
+
+void TimeLogHistoryWorker::getDiagnostics(int readerIndex) const
+{
+    emit diagnosticsAvailable(diagnostics(), readerIndex);
+}
+
+void TimeLogHistoryWorker::getSyncData(const QDateTime &mBegin, const QDateTime &mEnd,
+                                       qlonglong requestId) const
+{
+    Q_ASSERT(m_isInitialized);
+
+    emit syncDataAvailable(getSyncEntryData(mBegin, mEnd), getSyncCategoryData(mBegin, mEnd), mEnd, requestId);
+}
+
+void TimeLogHistoryWorker::getSyncExists(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    Q_ASSERT(m_isInitialized);
+
+    emit syncExistsAvailable(getSyncDataExists(mBegin, mEnd), mBegin, mEnd);
+}
+
+void TimeLogHistoryWorker::getSyncAmount(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    Q_ASSERT(m_isInitialized);
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString(m_isSyncChangesAvailable
+                        ? "SELECT count(*), max(mtime) FROM sync_changes WHERE mtime BETWEEN :mBegin AND :mEnd"
+                        : "SELECT count(*), max(mtime) FROM ( "
+                          "    SELECT mtime FROM timelog "
+                          "    WHERE mtime BETWEEN :mBegin AND :mEnd "
+                          "UNION ALL "
+                          "    SELECT mtime FROM timelog_removed "
+                          "    WHERE mtime BETWEEN :mBegin AND :mEnd "
+                          "UNION ALL "
+                          "    SELECT mtime FROM categories "
+                          "    WHERE mtime BETWEEN :mBegin AND :mEnd "
+                          "UNION ALL "
+                          "    SELECT mtime FROM categories_removed "
+                          "    WHERE mtime BETWEEN :mBegin AND :mEnd "
+                          ")");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return;
+    }
+    query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+    query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return;
+    }
+
+    query.next();
+    qlonglong result = query.value(0).toLongLong();
+    QDateTime maxMTime;
+    if (!query.isNull(1)) {
+        maxMTime = QDateTime::fromMSecsSinceEpoch(query.value(1).toLongLong(), Qt::UTC);
+    }
+    query.finish();
+
+    emit syncAmountAvailable(result, maxMTime, mBegin, mEnd);
+}
+
+void TimeLogHistoryWorker::getHashes(const QDateTime &maxDate, bool noUpdate, qlonglong requestId)
+{
+    // Month hashes are maintained by triggers and never need an update
+    Q_UNUSED(noUpdate)
+
+    emit hashesAvailable(getDataHashes(maxDate), requestId);
+}
+
+void TimeLogHistoryWorker::getDayHashes(const QDateTime &begin, const QDateTime &end, qlonglong requestId) const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+    if (m_isDayHashesAvailable) {
+        queryString = "SELECT start, size, sum1, sum2 FROM day_hashes "
+                      "WHERE start BETWEEN :begin AND :end ORDER BY start ASC";
+    } else {
+        // Read-only connection to the old schema has no day hashes table, calculate them on the fly
+        queryString = QString("SELECT start, size, sum1, sum2 FROM (%1) ORDER BY start ASC")
+                      .arg(hashesSelect("day", "WHERE mtime BETWEEN :mBegin AND :mEnd"));
+    }
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return;
+    }
+    if (m_isDayHashesAvailable) {
+        query.bindValue(":begin", begin.toTime_t());
+        query.bindValue(":end", end.toTime_t());
+    } else {
+        query.bindValue(":mBegin", begin.toMSecsSinceEpoch());
+        query.bindValue(":mEnd", end.toMSecsSinceEpoch());
+    }
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return;
+    }
+
+    QMap<QDateTime, QByteArray> result(readHashes(query));
+    query.finish();
+
+    emit dayHashesAvailable(result, begin, end, requestId);
+}
+
+bool TimeLogHistoryWorker::prepareAndExecQuery(QSqlQuery &query, const QString &queryString) const
+{
+    TIMELOG_TRACE_SPAN("sql", "exec");
+
+    query.setForwardOnly(true);
+    if (!query.prepare(queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
         return false;
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog AFTER INSERT ON timelog "
-                  "BEGIN "
-                  "    UPDATE timelog SET duration=(NEW.start - start) "
-                  "    WHERE start=( "
-                  "        SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 "
-                  "    ); "
-                  "    UPDATE timelog SET duration=IFNULL( "
-                  "        ( SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, "
-                  "        -1 "
-                  "    ) WHERE start=NEW.start; "
-                  "    DELETE FROM timelog_removed WHERE uuid=NEW.uuid; "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery();
         return false;
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS delete_timelog AFTER DELETE ON timelog "
-                  "BEGIN "
-                  "    UPDATE timelog SET duration=IFNULL( "
-                  "        ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 ) - start, "
-                  "        -1 "
-                  "    ) WHERE start=( "
-                  "        SELECT start FROM timelog WHERE start < OLD.start ORDER BY start DESC LIMIT 1 "
-                  "    ); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    return true;
+}
+
+bool TimeLogHistoryWorker::execQuery(QSqlQuery &query) const
+{
+    if (m_slowQueryTime < 0) {
+        return query.exec();
+    }
+
+    // Only the first step is timed for SELECT, the rest of the rows are fetched later
+    QElapsedTimer timer;
+    timer.start();
+    bool result = query.exec();
+    qint64 elapsed = timer.elapsed();
+    if (elapsed >= m_slowQueryTime) {
+        ++m_slowQueriesCount;
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Slow query," << elapsed << "ms:" << query.lastQuery()
+                                           << query.boundValues();
+    }
+
+    if (result) {
+        explainQuery(query);
+    }
+
+    return result;
+}
+
+void TimeLogHistoryWorker::explainQuery(const QSqlQuery &query) const
+{
+    const QString statement(query.lastQuery().trimmed());
+    if (m_explainedQueries.contains(statement)) {
+        return;
+    }
+    m_explainedQueries.insert(statement);
+
+    static const QRegularExpression dmlRegexp("^(SELECT|INSERT|UPDATE|DELETE|REPLACE|WITH)\\b",
+                                              QRegularExpression::CaseInsensitiveOption);
+    if (!dmlRegexp.match(statement).hasMatch()) {
+        return;
+    }
+
+    QSqlQuery explain(QSqlDatabase::database(m_connectionName));
+    if (!explain.prepare(QString("EXPLAIN QUERY PLAN %1").arg(statement))) {
+        qCDebug(HISTORY_WORKER_CATEGORY) << "Fail to prepare query plan:" << explain.lastError().text()
+                                         << statement;
+        return;
+    }
+    // Placeholders are at the same positions, as the statement is only prefixed
+    for (int i = 0; i < query.boundValues().size(); i++) {
+        explain.bindValue(i, query.boundValue(i));
+    }
+    if (!explain.exec()) {
+        qCDebug(HISTORY_WORKER_CATEGORY) << "Fail to get query plan:" << explain.lastError().text()
+                                         << statement;
+        return;
+    }
+
+    // Index scans are reported with USING, bare table scan reads the whole table
+    static const QRegularExpression scanRegexp("^SCAN (TABLE )?(?!SUBQUERY|CONSTANT)\\w+(?!.*USING)");
+    QStringList plan;
+    bool isFullScan = false;
+    while (explain.next()) {
+        const QString detail(explain.value(3).toString());
+        plan.append(detail);
+        isFullScan = isFullScan || scanRegexp.match(detail).hasMatch();
+    }
+
+    if (isFullScan) {
+        m_fullScanQueries.append(statement);
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Full table scan in query:" << statement << plan;
+    } else {
+        qCDebug(HISTORY_WORKER_CATEGORY) << "Query plan:" << statement << plan;
+    }
+}
+
+bool TimeLogHistoryWorker::setupConnection(const TimeLogConnectionProfile &profile, bool isReadonly)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    // Journal mode is persistent in the DB file, so it can only be changed by writable connection
+    if (!isReadonly) {
+        // Takes effect only before the tables are created, existing DB is converted by the maintenance
+        queryString = "PRAGMA auto_vacuum = INCREMENTAL;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+
+        queryString = QString("PRAGMA journal_mode = %1;")
+                      .arg(profile.journalMode == TimeLogConnectionProfile::WalJournal ? "WAL" : "DELETE");
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+        m_isWalJournal = profile.journalMode == TimeLogConnectionProfile::WalJournal;
+
+        static const char *synchronousModes[] = { "OFF", "NORMAL", "FULL" };
+        queryString = QString("PRAGMA synchronous = %1;").arg(synchronousModes[profile.synchronous]);
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+    } else {
+        queryString = "PRAGMA journal_mode;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+        m_isWalJournal = query.next() && query.value(0).toString().compare("wal", Qt::CaseInsensitive) == 0;
+        query.finish();
+        if (!m_isWalJournal) {
+            qCWarning(HISTORY_WORKER_CATEGORY) << "DB is not in WAL mode, long reads block the writes of other instances";
+        }
+    }
+
+    if (profile.cacheSize > 0) {
+        // Negative value means size in KiB instead of pages
+        queryString = QString("PRAGMA cache_size = -%1;").arg(profile.cacheSize);
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+    }
+
+    queryString = QString("PRAGMA mmap_size = %1;").arg(profile.mmapSize);
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = QString("PRAGMA temp_store = %1;").arg(profile.isTempStoreMemory ? "MEMORY" : "DEFAULT");
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    m_slowQueryTime = profile.slowQueryTime;
+
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Connection profile:" << profile.toString() << "readonly:" << isReadonly;
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::prepareCachedQuery(QSqlQuery &query, const QString &queryString) const
+{
+    // Copy of the QSqlQuery shares the prepared statement, so it stays valid after eviction from cache
+    QSqlQuery *cachedQuery = m_queryCache.object(queryString);
+    if (cachedQuery) {
+        ++m_queryCacheHits;
+        query = *cachedQuery;
+        return true;
+    }
+
+    ++m_queryCacheMisses;
+    QSqlQuery newQuery(QSqlDatabase::database(m_connectionName));
+    // Rows are only iterated once, so the driver doesn't keep the copies of the previous ones
+    newQuery.setForwardOnly(true);
+    if (!newQuery.prepare(queryString)) {
+        query = newQuery;
+        return false;
+    }
+
+    m_queryCache.insert(queryString, new QSqlQuery(newQuery));
+    query = newQuery;
+
+    return true;
+}
+
+qlonglong TimeLogHistoryWorker::getSchemaVersion() const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("PRAGMA user_version;");
+    if (!prepareAndExecQuery(query, queryString)) {
+        return -1;
+    }
+
+    if (!query.next()) {
+        return 0;
+    }
+
+    return query.value(0).toLongLong();
+}
+
+bool TimeLogHistoryWorker::setSchemaVersion(qint32 schemaVersion)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString(QString("PRAGMA user_version = %1;").arg(QString().setNum(schemaVersion)));
+
+    return prepareAndExecQuery(query, queryString);
+}
+
+bool TimeLogHistoryWorker::upgradeSchema(qlonglong schemaVersion)
+{
+    qCInfo(HISTORY_WORKER_CATEGORY) << "Upgrading DB schema from version" << schemaVersion
+                                    << "to" << dbSchemaVersion;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    if (!startTransaction(db)) {
+        return false;
+    }
+
+    switch (schemaVersion) {
+    case 1:
+        // Duration updates moved to the separate triggers, disabled in bulk mode
+        queryString = "DROP TRIGGER IF EXISTS insert_timelog;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TRIGGER IF EXISTS delete_timelog;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TRIGGER IF EXISTS update_timelog_start;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 2:
+        // Preceding start stored in the table instead of lookup on each select
+        queryString = "DROP TRIGGER IF EXISTS insert_timelog_duration;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TRIGGER IF EXISTS delete_timelog;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TRIGGER IF EXISTS update_timelog_start;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "ALTER TABLE timelog ADD COLUMN preceding INTEGER;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "UPDATE timelog SET preceding=IFNULL( "
+                      "    ( SELECT start FROM timelog AS prev WHERE prev.start < timelog.start "
+                      "      ORDER BY start DESC LIMIT 1 ), "
+                      "    0 "
+                      ");";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 3:
+        queryString = "INSERT OR REPLACE INTO daily_stats (day, category, duration) "
+                      "SELECT start - start % 86400, category, SUM(max(IFNULL(duration, 0), 0)) "
+                      "FROM timelog GROUP BY 1, 2;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 4:
+        for (const char *trigger: { "insert_timelog", "update_timelog", "insert_timelog_removed",
+                                    "insert_categories", "update_categories", "insert_categories_removed" }) {
+            queryString = QString("DROP TRIGGER IF EXISTS %1;").arg(trigger);
+            if (!prepareAndExecQuery(query, queryString)) {
+                goto rollback;
+            }
+        }
+        queryString = "DROP TABLE IF EXISTS hashes;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        queryString = QString("INSERT OR REPLACE INTO month_hashes (start, size, sum1, sum2) %1;")
+                      .arg(hashesSelect("month"));
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 5:
+        // Hash triggers are re-created with day hashes maintenance
+        for (const char *table: { "timelog", "timelog_removed", "categories", "categories_removed" }) {
+            for (const char *trigger: { "insert", "delete", "update", "replace" }) {
+                queryString = QString("DROP TRIGGER IF EXISTS %1_%2_hash;").arg(trigger).arg(table);
+                if (!prepareAndExecQuery(query, queryString)) {
+                    goto rollback;
+                }
+            }
+        }
+        queryString = QString("INSERT OR REPLACE INTO day_hashes (start, size, sum1, sum2) %1;")
+                      .arg(hashesSelect("day"));
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 6:
+        // Category names moved to the dictionary, table is re-created as its indexes and triggers change
+        queryString = "INSERT OR IGNORE INTO category_names (category) SELECT DISTINCT category FROM timelog;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "CREATE TEMP TABLE timelog_upgrade AS"
+                      " SELECT uuid, start, category_names.id AS category_id, comment, duration, mtime, preceding"
+                      " FROM timelog JOIN category_names ON category_names.category=timelog.category;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TABLE timelog;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        if (!setupTable()) {
+            goto rollback;
+        }
+
+        queryString = "INSERT INTO timelog (uuid, start, category_id, comment, duration, mtime, preceding)"
+                      " SELECT uuid, start, category_id, comment, duration, mtime, preceding FROM timelog_upgrade;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+
+        queryString = "DROP TABLE timelog_upgrade;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 7:
+        // Hashes and stats triggers are re-created to be disabled while moving entries to the archive
+        for (const char *trigger: { "insert_timelog_hash", "delete_timelog_hash",
+                                    "insert_timelog_stats", "delete_timelog_stats" }) {
+            queryString = QString("DROP TRIGGER IF EXISTS %1;").arg(trigger);
+            if (!prepareAndExecQuery(query, queryString)) {
+                goto rollback;
+            }
+        }
+        // fall through
+    case 8:
+        queryString = "INSERT OR REPLACE INTO category_counts (category_id, count) "
+                      "SELECT id, sum(count) FROM ( "
+                      "    SELECT category_id AS id, count(*) AS count FROM timelog GROUP BY category_id "
+                      "UNION ALL "
+                      "    SELECT category_names.id AS id, archive_categories.count AS count "
+                      "    FROM archive_categories JOIN category_names "
+                      "    ON category_names.category=archive_categories.category "
+                      ") GROUP BY id;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 9:
+        queryString = QString("INSERT OR REPLACE INTO sync_changes (uuid, kind, mtime) "
+                              "SELECT uuid, kind, mtime FROM ( "
+                              "    SELECT uuid, %1 AS kind, mtime FROM timelog "
+                              "UNION ALL "
+                              "    SELECT uuid, %2 AS kind, mtime FROM timelog_removed "
+                              "UNION ALL "
+                              "    SELECT uuid, %3 AS kind, mtime FROM categories "
+                              "UNION ALL "
+                              "    SELECT uuid, %4 AS kind, mtime FROM categories_removed "
+                              ") ORDER BY mtime ASC;")
+                      .arg(EntryChange).arg(RemovedEntryChange).arg(CategoryChange).arg(RemovedCategoryChange);
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+        // fall through
+    case 10:
+        if (!upgradeCategoryData()) {
+            goto rollback;
+        }
+        // fall through
+    default:
+        break;
+    }
+
+    if (!setSchemaVersion(dbSchemaVersion)) {
+        goto rollback;
+    }
+
+    if (!commitTransaction(db)) {
+        return false;
+    }
+
+    return true;
+
+rollback:
+    rollbackTransaction(db);
+    return false;
+}
+
+// Text JSON of the category data is converted to binary, undo journal is read in any format
+bool TimeLogHistoryWorker::upgradeCategoryData()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("SELECT uuid, data FROM categories WHERE data IS NOT NULL;");
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    QVector<QPair<QByteArray, QVariantMap> > categoryData;
+    while (query.next()) {
+        QByteArray rawData(query.value(1).toByteArray());
+        if (rawData.startsWith("qbjs")) {
+            continue;
+        }
+
+        QVariantMap data;
+        if (!decodeCategoryData(QByteArray(), 0, rawData, data)) {
+            query.finish();
+            return false;
+        }
+        categoryData.append(qMakePair(query.value(0).toByteArray(), data));
+    }
+    query.finish();
+
+    queryString = "UPDATE categories SET data=? WHERE uuid=?;";
+    if (!query.prepare(queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        return false;
+    }
+
+    for (const auto &item: categoryData) {
+        query.addBindValue(encodeCategoryData(item.second));
+        query.addBindValue(item.first);
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            return false;
+        }
+    }
+
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Category data converted:" << categoryData.size();
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setupTable()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    /* timelog */
+    queryString = "CREATE TABLE IF NOT EXISTS timelog"
+                  " (uuid BLOB UNIQUE NOT NULL, start INTEGER PRIMARY KEY, category_id INTEGER NOT NULL,"
+                  " comment TEXT, duration INTEGER, mtime INTEGER, preceding INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    // Index of the tables before schema version 7 is on the category names, it is re-created on upgrade
+    queryString = "CREATE INDEX IF NOT EXISTS timelog_category_index ON timelog (category_id);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS timelog_mtime_index ON timelog (mtime);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* category names, referenced by timelog entries */
+    queryString = "CREATE TABLE IF NOT EXISTS category_names (id INTEGER PRIMARY KEY, category TEXT UNIQUE NOT NULL);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* category counts, amount of entries per category name, archived ones included */
+    queryString = "CREATE TABLE IF NOT EXISTS category_counts"
+                  " (category_id INTEGER PRIMARY KEY, count INTEGER NOT NULL);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* timelog removed */
+    queryString = "CREATE TABLE IF NOT EXISTS timelog_removed"
+                  "(uuid BLOB PRIMARY KEY, mtime INTEGER) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS timelog_removed_mtime_index ON timelog_removed (mtime);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* categories */
+    queryString = "CREATE TABLE IF NOT EXISTS categories"
+                  " (uuid BLOB PRIMARY KEY, category TEXT UNIQUE NOT NULL, data BLOB, mtime INTEGER) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS categories_mtime_index ON categories (mtime);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* categories removed */
+    queryString = "CREATE TABLE IF NOT EXISTS categories_removed"
+                  " (uuid BLOB PRIMARY KEY, mtime INTEGER) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS categories_removed_mtime_index ON categories_removed (mtime);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* sync changes, latest mtime of every record of the four tables above, seq grows with each change */
+    queryString = "CREATE TABLE IF NOT EXISTS sync_changes"
+                  " (seq INTEGER PRIMARY KEY, uuid BLOB UNIQUE NOT NULL, kind INTEGER, mtime INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS sync_changes_mtime_index ON sync_changes (mtime);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* month hashes, records count and sums of record hashes per month of mtime */
+    queryString = "CREATE TABLE IF NOT EXISTS month_hashes"
+                  " (start INTEGER PRIMARY KEY, size INTEGER, sum1 INTEGER, sum2 INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* day hashes, same as month hashes, but per day of mtime */
+    queryString = "CREATE TABLE IF NOT EXISTS day_hashes"
+                  " (start INTEGER PRIMARY KEY, size INTEGER, sum1 INTEGER, sum2 INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* undo journal, action and old values of the changed fields of affected entries */
+    queryString = "CREATE TABLE IF NOT EXISTS undo_actions (id INTEGER PRIMARY KEY, type INTEGER,"
+                  " category_uuid BLOB, category TEXT, category_data BLOB, category_new_name TEXT);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TABLE IF NOT EXISTS undo_entries (action INTEGER, uuid BLOB, fields INTEGER,"
+                  " start INTEGER, category TEXT, comment TEXT);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE INDEX IF NOT EXISTS undo_entries_action_index ON undo_entries (action);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* daily stats, total duration of closed entries per UTC day of start and full category */
+    queryString = "CREATE TABLE IF NOT EXISTS daily_stats (day INTEGER, category TEXT, duration INTEGER,"
+                  " PRIMARY KEY (day, category)) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* bulk mode, neighbour update triggers are disabled while the table is not empty */
+    queryString = "CREATE TABLE IF NOT EXISTS bulk_mode (id INTEGER PRIMARY KEY CHECK (id = 0));";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* archives, closed years of entries moved to the separate DB files, start and mtime ranges */
+    queryString = "CREATE TABLE IF NOT EXISTS archives"
+                  " (start INTEGER PRIMARY KEY, end INTEGER, mbegin INTEGER, mend INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* archive hashes, contribution of archived entries to the period hashes */
+    queryString = "CREATE TABLE IF NOT EXISTS archive_hashes (archive INTEGER, period TEXT, start INTEGER,"
+                  " size INTEGER, sum1 INTEGER, sum2 INTEGER, PRIMARY KEY (archive, period, start)) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* archive categories, amount of archived entries per category */
+    queryString = "CREATE TABLE IF NOT EXISTS archive_categories (archive INTEGER, category TEXT, count INTEGER,"
+                  " PRIMARY KEY (archive, category)) WITHOUT ROWID;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* archive mode, hashes and stats triggers are disabled while the table is not empty */
+    queryString = "CREATE TABLE IF NOT EXISTS archive_mode (id INTEGER PRIMARY KEY CHECK (id = 0));";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    // Last run time of the periodic maintenance tasks
+    queryString = "CREATE TABLE IF NOT EXISTS maintenance (task TEXT PRIMARY KEY, time INTEGER);";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setupEntriesView(bool isCategoryNamesAvailable)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    // Read-only DB before schema version 7 stores category names in place, temporary view does not modify it
+    QString queryString(isCategoryNamesAvailable
+                        ? "CREATE VIEW IF NOT EXISTS timelog_entries AS"
+                          " SELECT uuid, start, category, comment, duration, mtime, preceding"
+                          " FROM timelog JOIN category_names ON category_names.id=timelog.category_id;"
+                        : "CREATE TEMP VIEW IF NOT EXISTS timelog_entries AS SELECT * FROM timelog;");
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setupCommentIndex()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    // Triggers are dropped when FTS5 is not available, so index is rebuilt if they are missing
+    bool isIndexValid = checkCommentIndex();
+
+    if (!db.transaction()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to start transaction:" << db.lastError().text();
+        return false;
+    }
+
+    queryString = "CREATE VIRTUAL TABLE IF NOT EXISTS timelog_comment USING fts5 (comment, content='timelog');";
+    if (!query.prepare(queryString) || !execQuery(query)) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Comment index is not available:" << query.lastError().text();
+        goto rollback;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_comment AFTER INSERT ON timelog "
+                  "BEGIN "
+                  "    INSERT INTO timelog_comment (rowid, comment) VALUES (NEW.start, NEW.comment); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        goto rollback;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS delete_timelog_comment AFTER DELETE ON timelog "
+                  "BEGIN "
+                  "    INSERT INTO timelog_comment (timelog_comment, rowid, comment) "
+                  "    VALUES ('delete', OLD.start, OLD.comment); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        goto rollback;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog_comment AFTER UPDATE OF start, comment ON timelog "
+                  "BEGIN "
+                  "    INSERT INTO timelog_comment (timelog_comment, rowid, comment) "
+                  "    VALUES ('delete', OLD.start, OLD.comment); "
+                  "    INSERT INTO timelog_comment (rowid, comment) VALUES (NEW.start, NEW.comment); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        goto rollback;
+    }
+
+    if (!isIndexValid) {
+        queryString = "INSERT INTO timelog_comment (timelog_comment) VALUES ('rebuild');";
+        if (!prepareAndExecQuery(query, queryString)) {
+            goto rollback;
+        }
+    }
+
+    if (!db.commit()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to commit transaction:" << db.lastError().text();
+        goto rollback;
+    }
+
+    return true;
+
+rollback:
+    if (!db.rollback()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to rollback transaction:" << db.lastError().text();
+    }
+
+    // Stale index must not be updated, search falls back to the scan
+    queryString = "DROP TRIGGER IF EXISTS insert_timelog_comment;";
+    prepareAndExecQuery(query, queryString);
+    queryString = "DROP TRIGGER IF EXISTS delete_timelog_comment;";
+    prepareAndExecQuery(query, queryString);
+    queryString = "DROP TRIGGER IF EXISTS update_timelog_comment;";
+    prepareAndExecQuery(query, queryString);
+
+    return false;
+}
+
+bool TimeLogHistoryWorker::checkCommentIndex() const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("SELECT count(*) FROM sqlite_master WHERE name IN ('timelog_comment',"
+                        " 'insert_timelog_comment', 'delete_timelog_comment', 'update_timelog_comment');");
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    bool result = query.next() && query.value(0).toInt() == 4;
+    query.finish();
+
+    return result;
+}
+
+bool TimeLogHistoryWorker::setupTriggers()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    /* timelog */
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_timelog BEFORE INSERT ON timelog "
+                  "BEGIN "
+                  "    SELECT mtime, "
+                  "        CASE WHEN NEW.mtime < mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END "
+                  "    FROM timelog_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog AFTER INSERT ON timelog "
+                  "BEGIN "
+                  "    DELETE FROM timelog_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_duration AFTER INSERT ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM bulk_mode) "
+                  "BEGIN "
+                  "    UPDATE timelog SET duration=(NEW.start - start) "
+                  "    WHERE start=( "
+                  "        SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 "
+                  "    ); "
+                  "    UPDATE timelog SET duration=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, "
+                  "        -1 "
+                  "    ), preceding=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 ), "
+                  "        0 "
+                  "    ) WHERE start=NEW.start; "
+                  "    UPDATE timelog SET preceding=NEW.start "
+                  "    WHERE start=( "
+                  "        SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 "
+                  "    ); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS delete_timelog AFTER DELETE ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM bulk_mode) "
+                  "BEGIN "
+                  "    UPDATE timelog SET duration=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 ) - start, "
+                  "        -1 "
+                  "    ) WHERE start=( "
+                  "        SELECT start FROM timelog WHERE start < OLD.start ORDER BY start DESC LIMIT 1 "
+                  "    ); "
+                  "    UPDATE timelog SET preceding=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start < OLD.start ORDER BY start DESC LIMIT 1 ), "
+                  "        0 "
+                  "    ) WHERE start=( "
+                  "        SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 "
+                  "    ); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_update_timelog BEFORE UPDATE ON timelog "
+                  "BEGIN "
+                  "    SELECT "
+                  "        CASE WHEN NEW.mtime < OLD.mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    // Archived entries are still taken into account by hashes and stats
+    if (!setupHashTriggers("timelog", true, "NOT EXISTS (SELECT id FROM archive_mode)")) {
+        return false;
+    }
+
+    if (!setupChangeTriggers("timelog", EntryChange, true)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_stats AFTER INSERT ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM archive_mode) "
+                  "BEGIN "
+                  "    INSERT OR IGNORE INTO daily_stats (day, category, duration) "
+                  "    VALUES (NEW.start - NEW.start % 86400, %1, 0); "
+                  "    UPDATE daily_stats SET duration=duration + max(IFNULL(NEW.duration, 0), 0) "
+                  "    WHERE day=NEW.start - NEW.start % 86400 AND category=%1; "
+                  "END;";
+    queryString.replace("%1", categoryNameExpression("NEW.category_id"));
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS delete_timelog_stats AFTER DELETE ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM archive_mode) "
+                  "BEGIN "
+                  "    UPDATE daily_stats SET duration=duration - max(IFNULL(OLD.duration, 0), 0) "
+                  "    WHERE day=OLD.start - OLD.start % 86400 AND category=%1; "
+                  "END;";
+    queryString.replace("%1", categoryNameExpression("OLD.category_id"));
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog_stats AFTER UPDATE OF start, category_id, duration ON timelog "
+                  "BEGIN "
+                  "    UPDATE daily_stats SET duration=duration - max(IFNULL(OLD.duration, 0), 0) "
+                  "    WHERE day=OLD.start - OLD.start % 86400 AND category=%2; "
+                  "    INSERT OR IGNORE INTO daily_stats (day, category, duration) "
+                  "    VALUES (NEW.start - NEW.start % 86400, %1, 0); "
+                  "    UPDATE daily_stats SET duration=duration + max(IFNULL(NEW.duration, 0), 0) "
+                  "    WHERE day=NEW.start - NEW.start % 86400 AND category=%1; "
+                  "END;";
+    queryString.replace("%1", categoryNameExpression("NEW.category_id"))
+               .replace("%2", categoryNameExpression("OLD.category_id"));
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    // Archived entries are still counted
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_count AFTER INSERT ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM archive_mode) "
+                  "BEGIN "
+                  "    INSERT OR IGNORE INTO category_counts (category_id, count) VALUES (NEW.category_id, 0); "
+                  "    UPDATE category_counts SET count=count + 1 WHERE category_id=NEW.category_id; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS delete_timelog_count AFTER DELETE ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM archive_mode) "
+                  "BEGIN "
+                  "    UPDATE category_counts SET count=count - 1 WHERE category_id=OLD.category_id; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog_count AFTER UPDATE OF category_id ON timelog "
+                  "WHEN NEW.category_id <> OLD.category_id "
+                  "BEGIN "
+                  "    UPDATE category_counts SET count=count - 1 WHERE category_id=OLD.category_id; "
+                  "    INSERT OR IGNORE INTO category_counts (category_id, count) VALUES (NEW.category_id, 0); "
+                  "    UPDATE category_counts SET count=count + 1 WHERE category_id=NEW.category_id; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog_start AFTER UPDATE OF start ON timelog "
+                  "WHEN NOT EXISTS (SELECT id FROM bulk_mode) "
+                  "BEGIN "
+                  "    UPDATE timelog SET duration=(NEW.start - start) "
+                  "    WHERE start=( "
+                  "        SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 "
+                  "    ); "
+                  "    UPDATE timelog SET duration=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 ) - start,"
+                  "        -1"
+                  "    ) WHERE start=NULLIF( "  // If previous item not changed, do not update it's duration twice
+                  "        ( SELECT start FROM timelog WHERE start < OLD.start ORDER BY start DESC LIMIT 1 ), "
+                  "        ( SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 ) "
+                  "    ); "
+                  "    UPDATE timelog SET duration=IFNULL( "
+                  "        ( SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, "
+                  "        -1 "
+                  "    ) WHERE start=NEW.start; "
+                  "    UPDATE timelog SET preceding=IFNULL( "
+                  "        ( SELECT start FROM timelog AS prev WHERE prev.start < timelog.start ORDER BY start DESC LIMIT 1 ), "
+                  "        0 "
+                  "    ) WHERE start IN ( "  // The moved item and items, following its old and new position
+                  "        NEW.start, "
+                  "        ( SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ), "
+                  "        ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 ) "
+                  "    ); "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    /* timelog removed */
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_timelog_removed BEFORE INSERT ON timelog_removed "
+                  "BEGIN "
+                  "    SELECT mtime, "
+                  "        CASE WHEN NEW.mtime < mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END "
+                  "    FROM timelog_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_removed AFTER INSERT ON timelog_removed "
+                  "BEGIN "
+                  "    DELETE FROM timelog WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    if (!setupHashTriggers("timelog_removed", false)) {
+        return false;
+    }
+
+    if (!setupChangeTriggers("timelog_removed", RemovedEntryChange, false)) {
+        return false;
+    }
+
+    /* categories */
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_categories BEFORE INSERT ON categories "
+                  "BEGIN "
+                  "    SELECT mtime, "
+                  "        CASE WHEN NEW.mtime < mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END "
+                  "    FROM categories_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_categories AFTER INSERT ON categories "
+                  "BEGIN "
+                  "    DELETE FROM categories_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_update_categories BEFORE UPDATE ON categories "
+                  "BEGIN "
+                  "    SELECT "
+                  "        CASE WHEN NEW.mtime < OLD.mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    if (!setupHashTriggers("categories", true)) {
+        return false;
+    }
+
+    if (!setupChangeTriggers("categories", CategoryChange, true)) {
+        return false;
+    }
+
+    /* categories removed */
+    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_categories_removed BEFORE INSERT ON categories_removed "
+                  "BEGIN "
+                  "    SELECT mtime, "
+                  "        CASE WHEN NEW.mtime < mtime "
+                  "            THEN RAISE(IGNORE) "
+                  "        END "
+                  "    FROM categories_removed WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = "CREATE TRIGGER IF NOT EXISTS insert_categories_removed AFTER INSERT ON categories_removed "
+                  "BEGIN "
+                  "    DELETE FROM categories WHERE uuid=NEW.uuid; "
+                  "END;";
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    if (!setupHashTriggers("categories_removed", false)) {
+        return false;
+    }
+
+    if (!setupChangeTriggers("categories_removed", RemovedCategoryChange, false)) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setupHashTriggers(const QString &table, bool isUpdatable, const QString &condition)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+    QString when(condition.isEmpty() ? QString() : QString("WHEN %1 ").arg(condition));
+
+    queryString = QString("CREATE TRIGGER IF NOT EXISTS insert_%1_hash AFTER INSERT ON %1 "
+                          "%2"
+                          "BEGIN "
+                          "    %3"
+                          "END;").arg(table).arg(when).arg(addHashStatement("NEW.uuid", "NEW.mtime"));
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = QString("CREATE TRIGGER IF NOT EXISTS delete_%1_hash AFTER DELETE ON %1 "
+                          "%2"
+                          "BEGIN "
+                          "    %3"
+                          "END;").arg(table).arg(when).arg(subtractHashStatement("OLD.uuid", "OLD.mtime"));
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    if (isUpdatable) {
+        queryString = QString("CREATE TRIGGER IF NOT EXISTS update_%1_hash AFTER UPDATE OF uuid, mtime ON %1 "
+                              "BEGIN "
+                              "    %2"
+                              "    %3"
+                              "END;").arg(table)
+                                     .arg(subtractHashStatement("OLD.uuid", "OLD.mtime"))
+                                     .arg(addHashStatement("NEW.uuid", "NEW.mtime"));
+    } else {
+        // Rows are replaced on conflict, which does not fire the delete trigger
+        QString replacedMTime = QString("(SELECT mtime FROM %1 WHERE uuid=NEW.uuid AND mtime <= NEW.mtime)")
+                                .arg(table);
+        queryString = QString("CREATE TRIGGER IF NOT EXISTS replace_%1_hash BEFORE INSERT ON %1 "
+                              "BEGIN "
+                              "    %2"
+                              "END;").arg(table).arg(subtractHashStatement("NEW.uuid", replacedMTime));
+    }
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    return true;
+}
+
+// Record moving between the live and removed tables keeps its uuid, so deletion only drops own kind
+bool TimeLogHistoryWorker::setupChangeTriggers(const QString &table, SyncChangeKind kind, bool isUpdatable)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
+
+    queryString = QString("CREATE TRIGGER IF NOT EXISTS insert_%1_change AFTER INSERT ON %1 "
+                          "BEGIN "
+                          "    INSERT OR REPLACE INTO sync_changes (uuid, kind, mtime) VALUES (NEW.uuid, %2, NEW.mtime); "
+                          "END;").arg(table).arg(kind);
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    queryString = QString("CREATE TRIGGER IF NOT EXISTS delete_%1_change AFTER DELETE ON %1 "
+                          "BEGIN "
+                          "    DELETE FROM sync_changes WHERE uuid=OLD.uuid AND kind=%2; "
+                          "END;").arg(table).arg(kind);
+    if (!prepareAndExecQuery(query, queryString)) {
+        return false;
+    }
+
+    if (isUpdatable) {
+        queryString = QString("CREATE TRIGGER IF NOT EXISTS update_%1_change AFTER UPDATE OF uuid, mtime ON %1 "
+                              "BEGIN "
+                              "    DELETE FROM sync_changes WHERE uuid=OLD.uuid AND kind=%2; "
+                              "    INSERT OR REPLACE INTO sync_changes (uuid, kind, mtime) "
+                              "    VALUES (NEW.uuid, %2, NEW.mtime); "
+                              "END;").arg(table).arg(kind);
+        if (!prepareAndExecQuery(query, queryString)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TimeLogHistoryWorker::setSize(qlonglong size)
+{
+    if (m_size == size) {
+        return;
+    }
+
+    m_size = size;
+
+    emit sizeChanged(m_size);
+}
+
+void TimeLogHistoryWorker::decrementCategoryCount(const QString &name)
+{
+    if (!m_categoryRecordsCount.contains(name)) {
+        fetchCategories();
+        return;
+    } else if (--(m_categoryRecordsCount[name]) == 0) {
+        updateCategories(QStringList() << name);
+    }
+}
+
+void TimeLogHistoryWorker::incrementCategoryCount(const QString &name)
+{
+    if (!m_categoryRecordsCount.contains(name)) {
+        m_categories.insert(name, TimeLogCategory(QUuid(), TimeLogCategoryData(name)));
+        m_categoryRecordsCount.insert(name, 1);
+    } else if ((m_categoryRecordsCount[name])++ > 0) {
+        return;
+    }
+
+    updateCategories(QStringList() << name);
+}
+
+void TimeLogHistoryWorker::updateCategoryCounts(const QHash<QString, int> &changes)
+{
+    QStringList names;
+    for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+        if (!it.value()) {
+            continue;
+        } else if (!m_categoryRecordsCount.contains(it.key())) {
+            if (it.value() < 0) {
+                fetchCategories();
+                return;
+            }
+            m_categories.insert(it.key(), TimeLogCategory(QUuid(), TimeLogCategoryData(it.key())));
+            m_categoryRecordsCount.insert(it.key(), it.value());
+            names.append(it.key());
+            continue;
+        }
+
+        int &count = m_categoryRecordsCount[it.key()];
+        bool isUsed = count > 0;
+        count += it.value();
+        // Categories are changed only while becoming used or unused
+        if (isUsed != (count > 0)) {
+            names.append(it.key());
+        }
+    }
+
+    if (!names.isEmpty()) {
+        updateCategories(names);
+    }
+}
+
+void TimeLogHistoryWorker::processFail()
+{
+    clearUndo();
+
+    emit dataOutdated();
+}
+
+bool TimeLogHistoryWorker::insertEntry(const TimeLogEntry &data)
+{
+    if (!insertEntryData(data)) {
+        return false;
+    }
+
+    emit dataInserted(data);
+    notifyInsertUpdates(data);
+
+    incrementCategoryCount(data.category);
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::removeEntry(const TimeLogEntry &data)
+{
+    if (!removeEntryData(data)) {
+        return false;
+    }
+
+    emit dataRemoved(data);
+    notifyRemoveUpdates(data);
+
+    decrementCategoryCount(data.category);
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntry(const TimeLogEntry &data, TimeLogHistory::Fields fields)
+{
+    QDateTime oldStart;
+    QString oldCategory;
+    if (fields == TimeLogHistory::NoFields) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "No fields specified";
+        return false;
+    } else if (fields & (TimeLogHistory::StartTime | TimeLogHistory::Category)) {
+        TimeLogEntry oldData = getEntry(data.uuid);
+        if (!oldData.isValid()) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Item to update not found:\n"
+                                                << data.startTime << data.category << data.uuid;
+            return false;
+        }
+        if (fields & TimeLogHistory::StartTime) {
+            oldStart = oldData.startTime;
+        }
+        if (fields & TimeLogHistory::Category) {
+            oldCategory = oldData.category;
+        }
+    }
+
+    if (!editEntryData(data, fields)) {
+        return false;
+    }
+
+    notifyEditUpdates(data, fields, oldStart);
+
+    if (fields & TimeLogHistory::Category) {
+        decrementCategoryCount(oldCategory);
+        incrementCategoryCount(data.category);
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::insertEntries(const QVector<TimeLogEntry> &data)
+{
+    if (!insertEntryData(data)) {
+        return false;
+    }
+
+    for (const TimeLogEntry &entry: data) {
+        emit dataInserted(entry);
+    }
+    notifyInsertUpdates(data);
+
+    QHash<QString, int> counts;
+    for (const TimeLogEntry &entry: data) {
+        counts[entry.category]++;
+    }
+    updateCategoryCounts(counts);
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::removeEntries(const QVector<TimeLogEntry> &data)
+{
+    if (!removeEntryData(data)) {
+        return false;
+    }
+
+    emit dataBatchRemoved(data);
+    notifyRemoveUpdates(data);
+
+    QHash<QString, int> counts;
+    for (const TimeLogEntry &entry: data) {
+        counts[entry.category]--;
+    }
+    updateCategoryCounts(counts);
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntries(const QVector<TimeLogEntry> &data,
+                                       const QVector<TimeLogHistory::Fields> &fields,
+                                       QVector<TimeLogEntry> *oldData)
+{
+    QVector<QUuid> uuids;
+    uuids.reserve(data.size());
+    for (int i = 0; i < data.size(); i++) {
+        if (fields.at(i) == TimeLogHistory::NoFields) {
+            qCWarning(HISTORY_WORKER_CATEGORY) << "No fields specified";
+            return false;
+        }
+        uuids.append(data.at(i).uuid);
+    }
+
+    QHash<QUuid, TimeLogEntry> foundData;
+    for (const TimeLogEntry &entry: getEntries(uuids)) {
+        foundData.insert(entry.uuid, entry);
+    }
+
+    QVector<TimeLogEntry> oldEntries;
+    oldEntries.reserve(data.size());
+    for (const TimeLogEntry &entry: data) {
+        TimeLogEntry oldEntry = foundData.value(entry.uuid);
+        if (!oldEntry.isValid()) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Item to update not found:\n"
+                                                << entry.startTime << entry.category << entry.uuid;
+            return false;
+        }
+        oldEntries.append(oldEntry);
+    }
+
+    if (!editEntryData(data, fields, oldEntries)) {
+        return false;
+    }
+
+    notifyEditUpdates(data, fields, oldEntries);
+
+    QHash<QString, int> counts;
+    for (int i = 0; i < data.size(); i++) {
+        if (fields.at(i) & TimeLogHistory::Category) {
+            counts[oldEntries.at(i).category]--;
+            counts[data.at(i).category]++;
+        }
+    }
+    updateCategoryCounts(counts);
+
+    if (oldData) {
+        *oldData = oldEntries;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::syncEntries(const QVector<TimeLogSyncDataEntry> &updatedData,
+                                       const QVector<TimeLogSyncDataEntry> &removedData,
+                                       QDateTime &maxSyncDate)
+{
+    QVector<TimeLogSyncDataEntry> removedNew;
+    QVector<TimeLogSyncDataEntry> removedOld;
+    QVector<TimeLogSyncDataEntry> insertedNew;
+    QVector<TimeLogSyncDataEntry> insertedOld;
+    QVector<TimeLogSyncDataEntry> updatedNew;
+    QVector<TimeLogSyncDataEntry> updatedOld;
+    QVector<TimeLogHistory::Fields> updateFields;
+
+    QVector<QUuid> uuids;
+    uuids.reserve(removedData.size() + updatedData.size());
+    for (const TimeLogSyncDataEntry &item: removedData) {
+        uuids.append(item.entry.uuid);
+    }
+    for (const TimeLogSyncDataEntry &item: updatedData) {
+        uuids.append(item.entry.uuid);
+    }
+
+    bool isOk = false;
+    QHash<QUuid, TimeLogSyncDataEntry> affectedData = getSyncEntriesAffected(uuids, &isOk);
+    if (!isOk) {
+        return false;
+    }
+
+    int rejectedCount = 0;
+
+    for (const TimeLogSyncDataEntry &item: removedData) {
+        QHash<QUuid, TimeLogSyncDataEntry>::const_iterator affected = affectedData.constFind(item.entry.uuid);
+        bool isAffected = affected != affectedData.constEnd();
+        if (isAffected && affected->sync.mTime >= item.sync.mTime) {
+            continue;
+        } else if (!isAffected && isBeforePurgeHorizon(item.sync.mTime)) {
+            rejectedCount++;
+            continue;
+        }
+
+        removedNew.append(item);
+        removedOld.append(isAffected ? affected.value() : TimeLogSyncDataEntry());
+    }
+
+    // Unknown item before the horizon could be removed by other device, while its tombstone is purged now.
+    // Such items are rejected, so a device, which was offline longer than the retention period, does not
+    // resurrect them, at the cost of its own changes older than the horizon, which were never synced.
+    // Hashes of those months stay different, so the items are resent and rejected on each sync.
+    for (const TimeLogSyncDataEntry &item: updatedData) {
+        QHash<QUuid, TimeLogSyncDataEntry>::const_iterator affected = affectedData.constFind(item.entry.uuid);
+        bool isAffected = affected != affectedData.constEnd();
+        if (isAffected && affected->sync.mTime >= item.sync.mTime) {
+            continue;
+        } else if (!isAffected && isBeforePurgeHorizon(item.sync.mTime)) {
+            rejectedCount++;
+            continue;
+        }
+
+        if (!isAffected || !affected->entry.isValid()) {
+            insertedNew.append(item);
+            insertedOld.append(isAffected ? affected.value() : TimeLogSyncDataEntry());
+        } else {
+            const TimeLogSyncDataEntry &oldItem(affected.value());
+            TimeLogHistory::Fields fields(TimeLogHistory::NoFields);
+            if (item.entry.startTime != oldItem.entry.startTime) {
+                fields |= TimeLogHistory::StartTime;
+            }
+            if (!TimeLogCategoryPool::isEqual(item.entry.category, oldItem.entry.category)) {
+                fields |= TimeLogHistory::Category;
+            }
+            if (item.entry.comment != oldItem.entry.comment) {
+                fields |= TimeLogHistory::Comment;
+            }
+            updatedNew.append(item);
+            updatedOld.append(oldItem);
+            updateFields.append(fields);
+        }
+    }
+
+    if (rejectedCount) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Rejected" << rejectedCount << "entries older than the purge horizon"
+                                           << m_purgeHorizon;
+    }
+
+    if (m_isSyncChangesEnabled.load()) {
+        QSharedPointer<TimeLogSyncEntryChanges> changes(new TimeLogSyncEntryChanges());
+        changes->removedOld = removedOld;
+        changes->removedNew = removedNew;
+        changes->insertedOld = insertedOld;
+        changes->insertedNew = insertedNew;
+        changes->updatedOld = updatedOld;
+        changes->updatedNew = updatedNew;
+        emit syncEntryStatsAvailable(changes);
+    }
+
+    QVector<TimeLogSyncDataEntry> removedMerged(removedOld);
+    for (int i = 0; i < removedMerged.size(); i++) {
+        removedMerged[i].entry.uuid = removedNew.at(i).entry.uuid;
+        removedMerged[i].sync.mTime = removedNew.at(i).sync.mTime;
+    }
+
+    if (!syncEntryData(removedMerged, insertedNew, updatedNew, updatedOld, updateFields)) {
+        return false;
+    }
+
+    for (const TimeLogSyncDataEntry &item: removedMerged) {
+        if (item.entry.isValid()) {
+            emit dataRemoved(item.entry);
+        }
+    }
+    for (const TimeLogSyncDataEntry &item: removedMerged) {
+        if (item.entry.isValid()) {
+            notifyRemoveUpdates(item.entry);
+        }
+    }
+    for (const TimeLogSyncDataEntry &item: insertedNew) {
+        emit dataInserted(item.entry);
+    }
+    QVector<TimeLogEntry> insertedEntries;
+    insertedEntries.reserve(insertedNew.size());
+    for (const TimeLogSyncDataEntry &item: insertedNew) {
+        insertedEntries.append(item.entry);
+    }
+    notifyInsertUpdates(insertedEntries);
+    for (int i = 0; i < updatedNew.size(); i++) {
+        notifyEditUpdates(updatedNew.at(i).entry, updateFields.at(i), updatedOld.at(i).entry.startTime);
+    }
+
+    for (const TimeLogSyncDataEntry &item: removedOld) {
+        if (item.entry.isValid()) {
+            decrementCategoryCount(item.entry.category);
+        }
+    }
+    for (const TimeLogSyncDataEntry &item: insertedNew) {
+        incrementCategoryCount(item.entry.category);
+    }
+    for (int i = 0; i < updatedNew.size(); i++) {
+        decrementCategoryCount(updatedOld.at(i).entry.category);
+        incrementCategoryCount(updatedNew.at(i).entry.category);
+    }
+
+    if (!removedNew.isEmpty()) {
+        maxSyncDate = removedNew.constLast().sync.mTime;
+    }
+    if (!insertedNew.isEmpty() && insertedNew.constLast().sync.mTime > maxSyncDate) {
+        maxSyncDate = insertedNew.constLast().sync.mTime;
+    }
+    if (!updatedNew.isEmpty() && updatedNew.constLast().sync.mTime > maxSyncDate) {
+        maxSyncDate = updatedNew.constLast().sync.mTime;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::syncCategories(const QVector<TimeLogSyncDataCategory> &categoryData,
+                                          QDateTime &maxSyncDate)
+{
+    QVector<TimeLogSyncDataCategory> removedNew;
+    QVector<TimeLogSyncDataCategory> removedOld;
+    QVector<TimeLogSyncDataCategory> addedNew;
+    QVector<TimeLogSyncDataCategory> addedOld;
+    QVector<TimeLogSyncDataCategory> updatedNew;
+    QVector<TimeLogSyncDataCategory> updatedOld;
+
+    QVector<QUuid> uuids;
+    uuids.reserve(categoryData.size());
+    for (const TimeLogSyncDataCategory &item: categoryData) {
+        uuids.append(item.category.uuid);
+    }
+
+    bool isOk = false;
+    QHash<QUuid, TimeLogSyncDataCategory> affectedData = getSyncCategoriesAffected(uuids, &isOk);
+    if (!isOk) {
+        return false;
+    }
+
+    int rejectedCount = 0;
+
+    for (const TimeLogSyncDataCategory &item: categoryData) {
+        QHash<QUuid, TimeLogSyncDataCategory>::const_iterator affected = affectedData.constFind(item.category.uuid);
+        bool isAffected = affected != affectedData.constEnd();
+        if (isAffected && affected->sync.mTime >= item.sync.mTime) {
+            continue;
+        } else if (!isAffected && isBeforePurgeHorizon(item.sync.mTime)) {  // Same as for the entries
+            rejectedCount++;
+            continue;
+        }
+
+        if (!item.category.isValid()) {
+            removedNew.append(item);
+            removedOld.append(isAffected ? affected.value() : TimeLogSyncDataCategory());
+        } else {
+            if (!isAffected || !affected->category.isValid()) {
+                addedNew.append(item);
+                addedOld.append(isAffected ? affected.value() : TimeLogSyncDataCategory());
+            } else {
+                updatedNew.append(item);
+                updatedOld.append(affected.value());
+            }
+        }
+    }
+
+    if (rejectedCount) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Rejected" << rejectedCount << "categories older than the purge horizon"
+                                           << m_purgeHorizon;
+    }
+
+    if (m_isSyncChangesEnabled.load()) {
+        QSharedPointer<TimeLogSyncCategoryChanges> changes(new TimeLogSyncCategoryChanges());
+        changes->removedOld = removedOld;
+        changes->removedNew = removedNew;
+        changes->addedOld = addedOld;
+        changes->addedNew = addedNew;
+        changes->updatedOld = updatedOld;
+        changes->updatedNew = updatedNew;
+        emit syncCategoryStatsAvailable(changes);
+    }
+
+    QVector<TimeLogSyncDataCategory> removedMerged(removedOld);
+    for (int i = 0; i < removedMerged.size(); i++) {
+        removedMerged[i].category.uuid = removedNew.at(i).category.uuid;
+        removedMerged[i].sync.mTime = removedNew.at(i).sync.mTime;
+    }
+
+    if (!syncCategoryData(removedMerged, addedNew, updatedNew, updatedOld)) {
+        return false;
+    }
+
+    if (!removedNew.isEmpty()) {
+        maxSyncDate = removedNew.constLast().sync.mTime;
+    }
+    if (!addedNew.isEmpty() && addedNew.constLast().sync.mTime > maxSyncDate) {
+        maxSyncDate = addedNew.constLast().sync.mTime;
+    }
+    if (!updatedNew.isEmpty() && updatedNew.constLast().sync.mTime > maxSyncDate) {
+        maxSyncDate = updatedNew.constLast().sync.mTime;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::insertEntryData(const QVector<TimeLogEntry> &data)
+{
+    bool isBulkMode = data.size() >= bulkModeThreshold;
+    QDateTime begin, end;
+
+    if (isBulkMode && !setBulkMode(true)) {
+        return false;
+    }
+
+    for (const TimeLogEntry &entry: data) {
+        if (!insertEntryData(entry)) {
+            return false;
+        }
+
+        if (!begin.isValid() || entry.startTime < begin) {
+            begin = entry.startTime;
+        }
+        if (!end.isValid() || entry.startTime > end) {
+            end = entry.startTime;
+        }
+    }
+
+    if (isBulkMode && (!updateDurations(begin, end) || !setBulkMode(false))) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::insertEntryData(const TimeLogSyncDataEntry &data)
+{
+    Q_ASSERT(data.entry.isValid());
+
+    if (!m_insertQuery) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        QString queryString = QString("INSERT INTO timelog (uuid, start, category_id, comment, mtime)"
+                                      " VALUES (:uuid, :start, %1, :comment, :mtime);")
+                              .arg(categoryIdExpression(":category"));
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return false;
+        }
+
+        m_insertQuery = query;
+    }
+
+    if (!internCategory(data.entry.category)) {
+        return false;
+    }
+
+    m_insertQuery->bindValue(":uuid", data.entry.uuid.toRfc4122());
+    m_insertQuery->bindValue(":start", data.entry.startTime.toTime_t());
+    m_insertQuery->bindValue(":category", data.entry.category);
+    m_insertQuery->bindValue(":comment", data.entry.comment);
+    m_insertQuery->bindValue(":mtime", data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                                 : QDateTime::currentMSecsSinceEpoch());
+
+    if (!execQuery(*m_insertQuery)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:"
+                                            << m_insertQuery->lastError().text()
+                                            << m_insertQuery->executedQuery()
+                                            << m_insertQuery->boundValues();
+        emit error(m_insertQuery->lastError().text());
+        return false;
+    }
+
+    setSize(m_size + m_insertQuery->numRowsAffected());
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::removeEntryData(const QVector<TimeLogEntry> &data)
+{
+    // Shared mtime keeps the removed records of the batch together in the sync data
+    QDateTime mTime = QDateTime::currentDateTimeUtc();
+    bool isBulkMode = data.size() >= bulkModeThreshold;
+    QDateTime begin, end;
+
+    if (isBulkMode && !setBulkMode(true)) {
+        return false;
+    }
+
+    for (const TimeLogEntry &entry: data) {
+        if (!removeEntryData(TimeLogSyncDataEntry(entry, mTime))) {
+            return false;
+        }
+
+        if (!begin.isValid() || entry.startTime < begin) {
+            begin = entry.startTime;
+        }
+        if (!end.isValid() || entry.startTime > end) {
+            end = entry.startTime;
+        }
+    }
+
+    if (isBulkMode && (!updateDurations(begin, end) || !setBulkMode(false))) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::removeEntryData(const TimeLogSyncDataEntry &data)
+{
+    Q_ASSERT(!data.entry.uuid.isNull());
+
+    if (!m_removeQuery) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        QString queryString("INSERT OR REPLACE INTO timelog_removed (uuid, mtime) VALUES(:uuid,:mtime);");
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return false;
+        }
+
+        m_removeQuery = query;
+    }
+
+    m_removeQuery->bindValue(":uuid", data.entry.uuid.toRfc4122());
+    m_removeQuery->bindValue(":mtime", data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                                 : QDateTime::currentMSecsSinceEpoch());
+
+    if (!execQuery(*m_removeQuery)) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Fail to execute query:"
+                                           << m_removeQuery->lastError().text()
+                                           << m_removeQuery->executedQuery()
+                                           << m_removeQuery->boundValues();
+        emit error(m_removeQuery->lastError().text());
+        return false;
+    }
+
+    setSize(m_size - m_removeQuery->numRowsAffected());
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntryData(const QVector<TimeLogEntry> &data,
+                                         const QVector<TimeLogHistory::Fields> &fields,
+                                         const QVector<TimeLogEntry> &oldData)
+{
+    QDateTime mTime = QDateTime::currentDateTimeUtc();
+    bool isBulkMode = data.size() >= bulkModeThreshold;
+    QDateTime begin, end;
+    auto expandRange = [&begin, &end](const QDateTime &start) {
+        if (!begin.isValid() || start < begin) {
+            begin = start;
+        }
+        if (!end.isValid() || start > end) {
+            end = start;
+        }
+    };
+
+    if (isBulkMode && !setBulkMode(true)) {
+        return false;
+    }
+
+    for (int i = 0; i < data.size(); i++) {
+        if (!editEntryData(TimeLogSyncDataEntry(data.at(i), mTime), fields.at(i))) {
+            return false;
+        }
+        if (fields.at(i) & TimeLogHistory::StartTime) {
+            expandRange(data.at(i).startTime);
+            expandRange(oldData.at(i).startTime);
+        }
+    }
+
+    if (isBulkMode && (!updateDurations(begin, end) || !setBulkMode(false))) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntryData(const TimeLogSyncDataEntry &data, TimeLogHistory::Fields fields)
+{
+    Q_ASSERT(data.entry.isValid());
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QStringList fieldNames;
+    if (fields & TimeLogHistory::StartTime) {
+        fieldNames.append("start=?");
+    }
+    if (fields & TimeLogHistory::Category) {
+        if (!internCategory(data.entry.category)) {
+            return false;
+        }
+        fieldNames.append(QString("category_id=%1").arg(categoryIdExpression("?")));
+    }
+    if (fields & TimeLogHistory::Comment) {
+        fieldNames.append("comment=?");
+    }
+    QString queryString = QString("UPDATE timelog SET %1 mtime=?"
+                                  " WHERE uuid=?;").arg(fieldNames.isEmpty() ? QString()
+                                                                             : fieldNames.join(", ") + ",");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    if (fields & TimeLogHistory::StartTime) {
+        query.addBindValue(data.entry.startTime.toTime_t());
+    }
+    if (fields & TimeLogHistory::Category) {
+        query.addBindValue(data.entry.category);
+    }
+    if (fields & TimeLogHistory::Comment) {
+        query.addBindValue(data.entry.comment);
+    }
+    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                 : QDateTime::currentMSecsSinceEpoch());
+    query.addBindValue(data.entry.uuid.toRfc4122());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::internCategory(const QString &name)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("INSERT OR IGNORE INTO category_names (category) VALUES (?);");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(name);
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntriesCategory(const QString &oldName, const QString &newName, int entriesCount)
+{
+    if (entriesCount == 0) {
+        return true;
+    }
+
+    if (!internCategory(newName)) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("UPDATE timelog SET category_id=%1, mtime=? WHERE category_id=%1;")
+                  .arg(categoryIdExpression("?"));
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(newName);
+    query.addBindValue(QDateTime::currentMSecsSinceEpoch());
+    query.addBindValue(oldName);
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    m_categoryRecordsCount[oldName] = 0;
+    m_categoryRecordsCount[newName] += entriesCount;
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editEntriesCategory(const QVector<QUuid> &uuids, const QString &newName)
+{
+    QVector<TimeLogEntry> editedEntries = getEntries(uuids);
+    if (editedEntries.size() != uuids.size()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Items to update not found:" << uuids.size() - editedEntries.size();
+        return false;
+    }
+
+    if (!internCategory(newName)) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    qlonglong mTime = QDateTime::currentMSecsSinceEpoch();
+    for (int offset = 0; offset < uuids.size(); offset += lookupChunkSize) {
+        int count = qMin(lookupChunkSize, uuids.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        QSqlQuery query(db);
+        QString queryString = QString("UPDATE timelog SET category_id=%1, mtime=? WHERE uuid IN (%2);")
+                              .arg(categoryIdExpression("?")).arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        query.addBindValue(newName);
+        query.addBindValue(mTime);
+        for (int i = offset; i < offset + count; i++) {
+            query.addBindValue(uuids.at(i).toRfc4122());
+        }
+
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+    }
+
+    for (TimeLogEntry &entry: editedEntries) {
+        entry.category = newName;
+    }
+
+    notifyUpdates(editedEntries, TimeLogHistory::Category);
+
+    // Entries may come from several categories, so the counts are re-read at once
+    return fetchCategories();
+}
+
+bool TimeLogHistoryWorker::addCategoryData(const TimeLogSyncDataCategory &data)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("INSERT INTO categories (uuid, category, data, mtime) VALUES(?,?,?,?);");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(data.category.uuid.toRfc4122());
+    query.addBindValue(data.category.name);
+    query.addBindValue(encodeCategoryData(data.category.data));
+    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                 : QDateTime::currentMSecsSinceEpoch());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    if (!m_categories.contains(data.category.name)) {
+        m_categories.insert(data.category.name, data.category);
+        if (!m_categoryRecordsCount.contains(data.category.name)) {
+            m_categoryRecordsCount.insert(data.category.name, 0);
+        }
+        updateCategories(QStringList() << data.category.name);
+    } else if (!m_categories.value(data.category.name).isValid()) { // Entry-only category
+        m_categories.insert(data.category.name, data.category);
+        if (!data.category.data.isEmpty()) {
+            updateCategories(QStringList() << data.category.name);
+        }
+    } else if (m_categories.value(data.category.name).data != data.category.data) {
+        m_categories[data.category.name].data = data.category.data;
+        updateCategories(QStringList() << data.category.name);
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::removeCategoryData(const TimeLogSyncDataCategory &data)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("INSERT OR REPLACE INTO categories_removed (uuid, mtime) VALUES(?,?);");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(data.category.uuid.toRfc4122());
+    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                 : QDateTime::currentMSecsSinceEpoch());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    QString name(data.category.name);
+    if (name.isEmpty()) {
+        auto it = std::find_if(m_categories.cbegin(), m_categories.cend(),
+                               [&data](const TimeLogCategory &c) {
+            return c.uuid == data.category.uuid;
+        });
+        if (it != m_categories.cend()) {
+            name = it->name;
+        }
+    }
+    if (!name.isEmpty()) {
+        if (m_categoryRecordsCount.value(name)) {
+            if (!m_categories.value(name).data.isEmpty()) {
+                m_categories[name].data.clear();    // Entry-only category has no data
+                updateCategories(QStringList() << name);
+            }
+        } else {
+            m_categoryRecordsCount.remove(name);
+            m_categories.remove(name);
+            updateCategories(QStringList() << name);
+        }
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::editCategoryData(const QString &oldName, const TimeLogSyncDataCategory &data)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("UPDATE categories SET category=?, data=?, mtime=? WHERE uuid=?;");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(data.category.name);
+    query.addBindValue(encodeCategoryData(data.category.data));
+    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
+                                                 : QDateTime::currentMSecsSinceEpoch());
+    query.addBindValue(data.category.uuid.toRfc4122());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    m_categories.remove(oldName);
+    m_categories.insert(data.category.name, data.category);
+    m_categoryRecordsCount.insert(data.category.name, m_categoryRecordsCount.take(oldName));
+
+    updateCategories(QStringList() << oldName << data.category.name);
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::syncEntryData(const QVector<TimeLogSyncDataEntry> &removed,
+                                         const QVector<TimeLogSyncDataEntry> &inserted,
+                                         const QVector<TimeLogSyncDataEntry> &updatedNew,
+                                         const QVector<TimeLogSyncDataEntry> &updatedOld,
+                                         const QVector<TimeLogHistory::Fields> &updateFields)
+{
+    bool isBulkMode = removed.size() + inserted.size() + updatedNew.size() >= bulkModeThreshold;
+    QDateTime begin, end;
+    auto expandRange = [&begin, &end](const TimeLogEntry &entry) {
+        if (!entry.isValid()) {
+            return;
+        }
+        if (!begin.isValid() || entry.startTime < begin) {
+            begin = entry.startTime;
+        }
+        if (!end.isValid() || entry.startTime > end) {
+            end = entry.startTime;
+        }
+    };
+
+    if (isBulkMode && !setBulkMode(true)) {
+        return false;
+    }
+
+    for (const TimeLogSyncDataEntry &item: removed) {
+        if (!removeEntryData(item)) {
+            return false;
+        }
+        expandRange(item.entry);
+    }
+
+    for (const TimeLogSyncDataEntry &item: inserted) {
+        if (!insertEntryData(item)) {
+            return false;
+        }
+        expandRange(item.entry);
+    }
+
+    for (int i = 0; i < updatedNew.size(); i++) {
+        if (!editEntryData(updatedNew.at(i), updateFields.at(i))) {
+            return false;
+        }
+        if (updateFields.at(i) & TimeLogHistory::StartTime) {
+            expandRange(updatedNew.at(i).entry);
+            expandRange(updatedOld.at(i).entry);
+        }
+    }
+
+    if (isBulkMode && (!updateDurations(begin, end) || !setBulkMode(false))) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::syncCategoryData(const QVector<TimeLogSyncDataCategory> &removed,
+                                            const QVector<TimeLogSyncDataCategory> &inserted,
+                                            const QVector<TimeLogSyncDataCategory> &updatedNew,
+                                            const QVector<TimeLogSyncDataCategory> &updatedOld)
+{
+    for (const TimeLogSyncDataCategory &item: removed) {
+        if (!removeCategoryData(item)) {
+            return false;
+        }
+    }
+
+    for (const TimeLogSyncDataCategory &item: inserted) {
+        if (!addCategoryData(item)) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < updatedNew.size(); i++) {
+        if (!editCategoryData(updatedOld.at(i).category.name, updatedNew.at(i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setBulkMode(bool isEnabled)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString(isEnabled ? "INSERT OR REPLACE INTO bulk_mode (id) VALUES (0);"
+                                  : "DELETE FROM bulk_mode;");
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::setArchiveMode(bool isEnabled)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString(isEnabled ? "INSERT OR REPLACE INTO archive_mode (id) VALUES (0);"
+                                  : "DELETE FROM archive_mode;");
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::updateDurations(const QDateTime &begin, const QDateTime &end)
+{
+    if (!begin.isValid() || !end.isValid()) {
+        return true;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    // Duration of the entry before the range and preceding start of the entry after the range
+    // also changes, if the entry at the range bound was inserted or removed
+    QString queryString("UPDATE timelog SET duration=IFNULL( "
+                        "    ( SELECT start FROM timelog AS next WHERE next.start > timelog.start "
+                        "      ORDER BY start ASC LIMIT 1 ) - start, "
+                        "    -1 "
+                        "), preceding=IFNULL( "
+                        "    ( SELECT start FROM timelog AS prev WHERE prev.start < timelog.start "
+                        "      ORDER BY start DESC LIMIT 1 ), "
+                        "    0 "
+                        ") WHERE start >= IFNULL( "
+                        "    ( SELECT start FROM timelog WHERE start < ? ORDER BY start DESC LIMIT 1 ), "
+                        "    ? "
+                        ") AND start <= IFNULL( "
+                        "    ( SELECT start FROM timelog WHERE start > ? ORDER BY start ASC LIMIT 1 ), "
+                        "    ? "
+                        ");");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.addBindValue(begin.toTime_t());
+    query.addBindValue(begin.toTime_t());
+    query.addBindValue(end.toTime_t());
+    query.addBindValue(end.toTime_t());
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Durations updated for" << query.numRowsAffected() << "entries";
+
+    return true;
+}
+
+bool TimeLogHistoryWorker::rebuildHashes()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    if (!startTransaction(db)) {
+        return false;
+    }
+
+    QSqlQuery query(db);
+    for (const char *period: { "month", "day" }) {
+        QString queryString = QString("DELETE FROM %1_hashes;").arg(period);
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            rollbackTransaction(db);
+            return false;
+        }
+
+        // Archived entries are not in the tables, their stored hashes are added instead
+        queryString = QString("INSERT INTO %1_hashes (start, size, sum1, sum2) "
+                              "SELECT start, SUM(size), SUM(sum1) % %2, SUM(sum2) % %2 FROM ( "
+                              "    %3 "
+                              "UNION ALL "
+                              "    SELECT start, size, sum1, sum2 FROM archive_hashes WHERE period='%1' "
+                              ") GROUP BY start;")
+                      .arg(period).arg(hashModulus)
+                      .arg(recordsHashesSelect(period, "    SELECT uuid, mtime FROM sync_changes "));
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            rollbackTransaction(db);
+            return false;
+        }
+    }
+
+    return commitTransaction(db);
+}
+
+QVector<TimeLogEntry> TimeLogHistoryWorker::getHistory(QSqlQuery &query, qlonglong id, uint chunkSize,
+                                                       uint expectedSize) const
+{
+    TIMELOG_TRACE_SPAN("sql", "getHistory");
+
+    QVector<TimeLogEntry> result;
+    if (chunkSize) {
+        result.reserve(chunkSize);
+    } else if (expectedSize) {
+        result.reserve(qMin(expectedSize, maxReservedSize));
+    }
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+
+    // The driver only gives the values as QVariant, so the cost of the conversions is cut instead.
+    // Preceding start of the row is the start of the previous one in ascending order and vice versa in
+    // descending, neighbour rows usually have the same category, so the implicitly shared values of the
+    // previous row are reused instead of the new date times and pool lookups.
+    uint previousTimes[2] = { 0, 0 };
+    QDateTime previousDateTimes[2];
+    QString previousCategory;
+    auto toDateTime = [&previousTimes, &previousDateTimes](uint time) {
+        for (int i = 0; i < 2; i++) {
+            if (previousTimes[i] == time && previousDateTimes[i].isValid()) {
+                return previousDateTimes[i];
+            }
+        }
+        return QDateTime::fromTime_t(time, Qt::UTC);
+    };
+
+    while (query.next()) {
+        if (id && result.size() % cancelCheckInterval == 0 && isRequestCancelled(id)) {
+            query.finish();
+            return QVector<TimeLogEntry>();
+        }
+
+        uint start = query.value(1).toUInt();
+        uint precedingStart = query.value(5).toUInt();
+        QString category(query.value(2).toString());
+        if (category != previousCategory) {
+            previousCategory = TimeLogCategoryPool::intern(category);
+        }
+
+        TimeLogEntry data;
+        data.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
+        data.startTime = toDateTime(start);
+        data.category = previousCategory;
+        data.comment = query.value(3).toString();
+        data.durationTime = query.value(4).toInt();
+        data.precedingStart = toDateTime(precedingStart);
+
+        previousTimes[0] = start;
+        previousDateTimes[0] = data.startTime;
+        previousTimes[1] = precedingStart;
+        previousDateTimes[1] = data.precedingStart;
+
+        result.append(data);
+
+        // Full chunks are sent as soon as ready, the rest is returned to complete the request
+        if (chunkSize && result.size() == static_cast<int>(chunkSize)) {
+            emit historyRequestPartial(result, id);
+            result.clear();
+            result.reserve(chunkSize);
+        }
+    }
+
+    query.finish();
+
+    return result;
+}
+
+bool TimeLogHistoryWorker::isRequestCancelled(qlonglong id) const
+{
+    return m_cancelledRequests && m_cancelledRequests->contains(id);
+}
+
+QVector<TimeLogEntry> TimeLogHistoryWorker::getRecentEntries(int count) const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("%1 WHERE start < ? ORDER BY start DESC LIMIT ?").arg(m_selectFields);
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        return QVector<TimeLogEntry>();
+    }
+    query.addBindValue(QDateTime::currentDateTimeUtc().toTime_t());
+    query.addBindValue(count);
+
+    QVector<TimeLogEntry> result = getHistory(query, 0, 0, count);
+    std::reverse(result.begin(), result.end());
+
+    return result;
+}
+
+QVector<TimeLogStats> TimeLogHistoryWorker::getStats(QSqlQuery &query) const
+{
+    QVector<TimeLogStats> result;
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+
+    while (query.next()) {
+        TimeLogStats data;
+        data.category = TimeLogCategoryPool::intern(query.value(0).toString());
+        data.durationTime = query.value(1).toInt();
+
+        result.append(data);
+    }
+
+    query.finish();
+
+    return result;
+}
+
+QVector<TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntryData(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString where = QString(mBegin.isValid() ? "mtime >= :mBegin" : "")
+                    + QString(mBegin.isValid() && mEnd.isValid() ? " AND " : "")
+                    + QString(mEnd.isValid() ? "mtime <= :mEnd" : "");
+    if (!where.isEmpty()) {
+        where = "WHERE (" + where + ")";
+    }
+    QString queryString = QString("WITH result AS ( "
+                                  "    SELECT uuid, start, category, comment, mtime FROM timelog_entries %1 "
+                                  "UNION ALL "
+                                  "    SELECT uuid, NULL, NULL, NULL, mtime FROM timelog_removed %1 "
+                                  ") "
+                                  "SELECT * FROM result ORDER BY mtime ASC").arg(where);
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return QVector<TimeLogSyncDataEntry>();
+    }
+    if (mBegin.isValid()) {
+        query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+    }
+    if (mEnd.isValid()) {
+        query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+    }
+
+    QVector<TimeLogSyncDataEntry> result = getSyncEntryData(query);
+
+    QVector<Archive> archives;
+    if (!getArchives(archives)) {
+        return result;
+    }
+
+    bool isArchivedData = false;
+    for (const Archive &archive: archives) {
+        if ((mBegin.isValid() && archive.mEnd < mBegin.toMSecsSinceEpoch())
+            || (mEnd.isValid() && archive.mBegin > mEnd.toMSecsSinceEpoch())
+            || !attachArchive(archivePath(archive.start), "archive")) {
+            continue;
+        }
+
+        {
+            QSqlQuery archiveQuery(db);
+            archiveQuery.setForwardOnly(true);
+            queryString = QString("SELECT uuid, start, category, comment, mtime FROM archive.timelog %1 "
+                                  "ORDER BY mtime ASC").arg(where);
+            if (!archiveQuery.prepare(queryString)) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << archiveQuery.lastError().text()
+                                                    << archiveQuery.lastQuery();
+                emit error(tr("DB error: %1").arg(archiveQuery.lastError().text()));
+            } else {
+                if (mBegin.isValid()) {
+                    archiveQuery.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+                }
+                if (mEnd.isValid()) {
+                    archiveQuery.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+                }
+                QVector<TimeLogSyncDataEntry> archivedData = getSyncEntryData(archiveQuery);
+                isArchivedData = isArchivedData || !archivedData.isEmpty();
+                result.append(archivedData);
+            }
+        }
+        detachArchive("archive");
+    }
+
+    if (isArchivedData) {
+        std::stable_sort(result.begin(), result.end(),
+                         [](const TimeLogSyncDataEntry &d1, const TimeLogSyncDataEntry &d2) {
+            return d1.sync.mTime < d2.sync.mTime;
+        });
+    }
+
+    return result;
+}
+
+QVector<TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntryData(QSqlQuery &query) const
+{
+    QVector<TimeLogSyncDataEntry> result;
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+
+    // Changes of the same import or sync share the mtime, so it is reused as the category in getHistory()
+    qlonglong previousMTime = 0;
+    QDateTime previousMDateTime;
+    QString previousCategory;
+
+    while (query.next()) {
+        qlonglong mTime = query.value(4).toLongLong();
+        if (mTime != previousMTime || !previousMDateTime.isValid()) {
+            previousMTime = mTime;
+            previousMDateTime = QDateTime::fromMSecsSinceEpoch(mTime, Qt::UTC);
+        }
+        QString category(query.value(2).toString());
+        if (category != previousCategory) {
+            previousCategory = TimeLogCategoryPool::intern(category);
+        }
+
+        TimeLogSyncDataEntry data;
+        data.entry.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
+        data.sync.isRemoved = query.isNull(1);
+        if (!data.sync.isRemoved) { // Removed item shouldn't has valid start time
+            data.entry.startTime = QDateTime::fromTime_t(query.value(1).toUInt(), Qt::UTC);
+        }
+        data.entry.category = previousCategory;
+        data.entry.comment = query.value(3).toString();
+        data.sync.mTime = previousMDateTime;
+
+        result.append(data);
+    }
+
+    query.finish();
+
+    return result;
+}
+
+QVector<TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoryData(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString where = QString(mBegin.isValid() ? "mtime >= :mBegin" : "")
+                    + QString(mBegin.isValid() && mEnd.isValid() ? " AND " : "")
+                    + QString(mEnd.isValid() ? "mtime <= :mEnd" : "");
+    if (!where.isEmpty()) {
+        where = "WHERE (" + where + ")";
+    }
+    QString queryString = QString("WITH result AS ( "
+                                  "    SELECT uuid, category, data, mtime FROM categories %1 "
+                                  "UNION ALL "
+                                  "    SELECT uuid, NULL, NULL, mtime FROM categories_removed %1 "
+                                  ") "
+                                  "SELECT * FROM result ORDER BY mtime ASC").arg(where);
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return QVector<TimeLogSyncDataCategory>();
+    }
+    if (mBegin.isValid()) {
+        query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+    }
+    if (mEnd.isValid()) {
+        query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+    }
+
+    return getSyncCategoryData(query);
+}
+
+QVector<TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoryData(QSqlQuery &query) const
+{
+    QVector<TimeLogSyncDataCategory> result;
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+
+    while (query.next()) {
+        TimeLogSyncDataCategory data;
+        QByteArray uuid(query.value(0).toByteArray());
+        data.category.uuid = QUuid::fromRfc4122(uuid);
+        data.category.name = query.value(1).toString();
+
+        if (!query.value(2).isNull()
+            && !decodeCategoryData(uuid, query.value(3).toLongLong(), query.value(2).toByteArray(),
+                                   data.category.data)) {
+            return result;
+        }
+
+        data.sync.isRemoved = !data.category.isValid();
+        data.sync.mTime = QDateTime::fromMSecsSinceEpoch(query.value(3).toLongLong(), Qt::UTC);
+
+        result.append(data);
+    }
+
+    query.finish();
+
+    return result;
+}
+
+TimeLogEntry TimeLogHistoryWorker::getEntry(const QUuid &uuid)
+{
+    TimeLogEntry entry;
+
+    if (!m_entryQuery) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        query->setForwardOnly(true);
+        QString queryString = QString("%1 WHERE uuid=:uuid").arg(m_selectFields);
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return entry;
+        }
+
+        m_entryQuery = query;
+    }
+
+    m_entryQuery->bindValue(":uuid", uuid.toRfc4122());
+
+    QVector<TimeLogEntry> data = getHistory(*m_entryQuery);
+    if (!data.empty()) {
+        entry = data.first();
+    }
+    return entry;
+}
+
+// Category is looked up through the dictionary, so only the category index is used
+QVector<QUuid> TimeLogHistoryWorker::getEntryUuids(const QString &category, bool *ok) const
+{
+    QVector<QUuid> result;
+    *ok = false;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("SELECT uuid FROM timelog WHERE category_id=%1").arg(categoryIdExpression("?"));
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+    query.addBindValue(category);
+
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+
+    while (query.next()) {
+        result.append(QUuid::fromRfc4122(query.value(0).toByteArray()));
     }
+    query.finish();
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_update_timelog BEFORE UPDATE ON timelog "
-                  "BEGIN "
-                  "    SELECT "
-                  "        CASE WHEN NEW.mtime < OLD.mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    *ok = true;
+    return result;
+}
+
+QVector<TimeLogEntry> TimeLogHistoryWorker::getEntries(const QVector<QUuid> &uuids) const
+{
+    QVector<TimeLogEntry> result;
+    result.reserve(uuids.size());
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    for (int offset = 0; offset < uuids.size(); offset += lookupChunkSize) {
+        int count = qMin(lookupChunkSize, uuids.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        QSqlQuery query(db);
+        QString queryString = QString("%1 WHERE uuid IN (%2)").arg(m_selectFields).arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return QVector<TimeLogEntry>();
+        }
+        for (int i = offset; i < offset + count; i++) {
+            query.addBindValue(uuids.at(i).toRfc4122());
+        }
+
+        result.append(getHistory(query));
+        if (query.lastError().isValid()) {
+            return QVector<TimeLogEntry>();
+        }
     }
 
-    // Update hash on change of the any field, except duration
-    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog AFTER UPDATE OF start, category, comment, mtime, uuid ON timelog "
-                  "BEGIN "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    return result;
+}
+
+QHash<QUuid, TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntriesAffected(const QVector<QUuid> &uuids,
+                                                                              bool *ok)
+{
+    QHash<QUuid, TimeLogSyncDataEntry> result;
+    result.reserve(uuids.size());
+    *ok = false;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    for (int offset = 0; offset < uuids.size(); offset += syncLookupChunkSize) {
+        int count = qMin(syncLookupChunkSize, uuids.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        QSqlQuery query(db);
+        QString queryString = QString("WITH result AS ( "
+                                      "    SELECT uuid, start, category, comment, mtime FROM timelog_entries "
+                                      "    WHERE uuid IN (%1) "
+                                      "UNION ALL "
+                                      "    SELECT uuid, NULL, NULL, NULL, mtime FROM timelog_removed "
+                                      "    WHERE uuid IN (%1) "
+                                      ") "
+                                      "SELECT * FROM result ORDER BY mtime ASC").arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return QHash<QUuid, TimeLogSyncDataEntry>();
+        }
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = offset; i < offset + count; i++) {
+                query.addBindValue(uuids.at(i).toRfc4122());
+            }
+        }
+
+        QVector<TimeLogSyncDataEntry> data = getSyncEntryData(query);
+        if (query.lastError().isValid()) {
+            return QHash<QUuid, TimeLogSyncDataEntry>();
+        }
+
+        // Ordered by mtime, so the latest state of the entry is kept
+        for (const TimeLogSyncDataEntry &item: data) {
+            result.insert(item.entry.uuid, item);
+        }
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS update_timelog_start AFTER UPDATE OF start ON timelog "
-                  "BEGIN "
-                  "    UPDATE timelog SET duration=(NEW.start - start) "
-                  "    WHERE start=( "
-                  "        SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 "
-                  "    ); "
-                  "    UPDATE timelog SET duration=IFNULL( "
-                  "        ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC LIMIT 1 ) - start,"
-                  "        -1"
-                  "    ) WHERE start=NULLIF( "  // If previous item not changed, do not update it's duration twice
-                  "        ( SELECT start FROM timelog WHERE start < OLD.start ORDER BY start DESC LIMIT 1 ), "
-                  "        ( SELECT start FROM timelog WHERE start < NEW.start ORDER BY start DESC LIMIT 1 ) "
-                  "    ); "
-                  "    UPDATE timelog SET duration=IFNULL( "
-                  "        ( SELECT start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, "
-                  "        -1 "
-                  "    ) WHERE start=NEW.start; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    *ok = true;
+
+    return result;
+}
+
+QHash<QUuid, TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoriesAffected(const QVector<QUuid> &uuids,
+                                                                                    bool *ok)
+{
+    QHash<QUuid, TimeLogSyncDataCategory> result;
+    result.reserve(uuids.size());
+    *ok = false;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    for (int offset = 0; offset < uuids.size(); offset += syncLookupChunkSize) {
+        int count = qMin(syncLookupChunkSize, uuids.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        QSqlQuery query(db);
+        QString queryString = QString("WITH result AS ( "
+                                      "    SELECT uuid, category, data, mtime FROM categories "
+                                      "    WHERE uuid IN (%1) "
+                                      "UNION ALL "
+                                      "    SELECT uuid, NULL, NULL, mtime FROM categories_removed "
+                                      "    WHERE uuid IN (%1) "
+                                      ") "
+                                      "SELECT * FROM result ORDER BY mtime ASC").arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return QHash<QUuid, TimeLogSyncDataCategory>();
+        }
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = offset; i < offset + count; i++) {
+                query.addBindValue(uuids.at(i).toRfc4122());
+            }
+        }
+
+        QVector<TimeLogSyncDataCategory> data = getSyncCategoryData(query);
+        if (query.lastError().isValid()) {
+            return QHash<QUuid, TimeLogSyncDataCategory>();
+        }
+
+        // Ordered by mtime, the earliest state of the category is kept as before
+        for (const TimeLogSyncDataCategory &item: data) {
+            if (!result.contains(item.category.uuid)) {
+                result.insert(item.category.uuid, item);
+            }
+        }
     }
 
-    /* timelog removed */
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_timelog_removed BEFORE INSERT ON timelog_removed "
-                  "BEGIN "
-                  "    SELECT mtime, "
-                  "        CASE WHEN NEW.mtime < mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END "
-                  "    FROM timelog_removed WHERE uuid=NEW.uuid; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
+    *ok = true;
+
+    return result;
+}
+
+bool TimeLogHistoryWorker::getSyncDataExists(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString(m_isSyncChangesAvailable
+                        ? "SELECT mtime FROM sync_changes WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1"
+                        : "SELECT mtime FROM (SELECT coalesce( "
+                          "    (SELECT mtime FROM timelog "
+                          "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
+                          "    (SELECT mtime FROM timelog_removed "
+                          "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
+                          "    (SELECT mtime FROM categories "
+                          "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
+                          "    (SELECT mtime FROM categories_removed "
+                          "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1) "
+                          ") AS mtime) WHERE mtime IS NOT NULL");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
+    query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+    query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS insert_timelog_removed AFTER INSERT ON timelog_removed "
-                  "BEGIN "
-                  "    DELETE FROM timelog WHERE uuid=NEW.uuid; "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    /* categories */
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_categories BEFORE INSERT ON categories "
-                  "BEGIN "
-                  "    SELECT mtime, "
-                  "        CASE WHEN NEW.mtime < mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END "
-                  "    FROM categories_removed WHERE uuid=NEW.uuid; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    bool result = query.next();
+    query.finish();
+
+    return result;
+}
+
+QMap<QDateTime, QByteArray> TimeLogHistoryWorker::getDataHashes(const QDateTime &maxDate) const
+{
+    QMap<QDateTime, QByteArray> result;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    // Read-only connection to the old schema has no month hashes table, calculate them on the fly
+    QString queryString = QString("SELECT start, size, sum1, sum2 FROM %1 %2 ORDER BY start ASC")
+                                  .arg(m_isMonthHashesAvailable ? QString("month_hashes")
+                                                                : QString("(%1)").arg(hashesSelect("month")))
+                                  .arg(maxDate.isValid() ? "WHERE start <= ?" : "");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
+    }
+    if (maxDate.isValid()) {
+        query.addBindValue(maxDate.toTime_t());
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS insert_categories AFTER INSERT ON categories "
-                  "BEGIN "
-                  "    DELETE FROM categories_removed WHERE uuid=NEW.uuid; "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    if (!execQuery(query)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.executedQuery() << query.boundValues();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return result;
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_update_categories BEFORE UPDATE ON categories "
-                  "BEGIN "
-                  "    SELECT "
-                  "        CASE WHEN NEW.mtime < OLD.mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    result = readHashes(query);
+
+    query.finish();
+
+    return result;
+}
+
+void TimeLogHistoryWorker::notifyInsertUpdates(const TimeLogEntry &data)
+{
+    if (!m_notifyInsertQuery) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        QString queryString = QString("SELECT * FROM ( "
+                                      "    %1 WHERE start <= :newStart ORDER BY start DESC LIMIT 2 "
+                                      ") "
+                                      "UNION "
+                                      "SELECT * FROM ( "
+                                      "    %1 WHERE start > :newStart ORDER BY start ASC LIMIT 1 "
+                                      ") ORDER BY start ASC").arg(m_selectFields);
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return;
+        }
+
+        m_notifyInsertQuery = query;
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS update_categories AFTER UPDATE ON categories "
-                  "BEGIN "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    m_notifyInsertQuery->bindValue(":newStart", data.startTime.toTime_t());
+
+    notifyUpdates(*m_notifyInsertQuery);
+}
+
+void TimeLogHistoryWorker::notifyInsertUpdates(const QVector<TimeLogEntry> &data)
+{
+    if (data.size() == 1) {
+        notifyInsertUpdates(data.constFirst());
+        return;
     }
 
-    /* categories removed */
-    queryString = "CREATE TRIGGER IF NOT EXISTS check_insert_categories_removed BEFORE INSERT ON categories_removed "
-                  "BEGIN "
-                  "    SELECT mtime, "
-                  "        CASE WHEN NEW.mtime < mtime "
-                  "            THEN RAISE(IGNORE) "
-                  "        END "
-                  "    FROM categories_removed WHERE uuid=NEW.uuid; "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    QVector<uint> starts;
+    starts.reserve(data.size());
+    for (const TimeLogEntry &entry: data) {
+        starts.append(entry.startTime.toTime_t());
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+    // Neighbours of the adjacent chunks may overlap, so the entries are merged by start
+    QMap<uint, TimeLogEntry> updatedData;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    for (int offset = 0; offset < starts.size(); offset += lookupChunkSize) {
+        int count = qMin(lookupChunkSize, starts.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        // Inserted entries, their preceding entries and the entries, following them
+        QSqlQuery query(db);
+        QString queryString = QString("WITH changed AS ( "
+                                      "    SELECT start, preceding FROM timelog WHERE start IN (%2) "
+                                      ") "
+                                      "%1 WHERE start IN (SELECT start FROM changed) "
+                                      "OR start IN (SELECT preceding FROM changed) "
+                                      "OR start IN ( "
+                                      "    SELECT (SELECT start FROM timelog WHERE start > changed.start ORDER BY start ASC LIMIT 1) "
+                                      "    FROM changed "
+                                      ") ORDER BY start ASC").arg(m_selectFields).arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return;
+        }
+        for (int i = offset; i < offset + count; i++) {
+            query.addBindValue(starts.at(i));
+        }
+
+        QVector<TimeLogEntry> chunkData = getHistory(query);
+        if (query.lastError().isValid()) {
+            return;
+        }
+
+        for (const TimeLogEntry &entry: chunkData) {
+            updatedData.insert(entry.startTime.toTime_t(), entry);
+        }
     }
 
-    queryString = "CREATE TRIGGER IF NOT EXISTS insert_categories_removed AFTER INSERT ON categories_removed "
-                  "BEGIN "
-                  "    DELETE FROM categories WHERE uuid=NEW.uuid; "
-                  "    INSERT OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); "
-                  "END;";
-    if (!prepareAndExecQuery(query, queryString)) {
-        return false;
+    notifyUpdates(updatedData.values().toVector());
+}
+
+void TimeLogHistoryWorker::notifyRemoveUpdates(const TimeLogEntry &data)
+{
+    if (!m_notifyRemoveQuery) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        QString queryString = QString("SELECT * FROM ( "
+                                      "    %1 WHERE start < :oldStart ORDER BY start DESC LIMIT 1 "
+                                      ") "
+                                      "UNION "
+                                      "SELECT * FROM ( "
+                                      "    %1 WHERE start > :oldStart ORDER BY start ASC LIMIT 1 "
+                                      ") ORDER BY start ASC").arg(m_selectFields);
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return;
+        }
+
+        m_notifyRemoveQuery = query;
     }
 
-    return true;
+    m_notifyRemoveQuery->bindValue(":oldStart", data.startTime.toTime_t());
+
+    notifyUpdates(*m_notifyRemoveQuery);
 }
 
-void TimeLogHistoryWorker::setSize(qlonglong size)
+void TimeLogHistoryWorker::notifyEditUpdates(const TimeLogEntry &data, TimeLogHistory::Fields fields, QDateTime oldStart)
 {
-    if (m_size == size) {
-        return;
+    QSqlQuery **requestQuery = (fields & TimeLogHistory::StartTime ? &m_notifyEditStartQuery
+                                                                   : &m_notifyEditQuery);
+    if (!(*requestQuery)) {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+        QSqlQuery *query = new QSqlQuery(db);
+        QString queryString;
+        if (fields & TimeLogHistory::StartTime) {
+            queryString = QString("SELECT * FROM ( "
+                                  "    %1 WHERE start <= :newStart ORDER BY start DESC LIMIT 2 "
+                                  ") "
+                                  "UNION "
+                                  "SELECT * FROM ( "
+                                  "    %1 WHERE start > :newStart ORDER BY start ASC LIMIT 1 "
+                                  ") "
+                                  "UNION "
+                                  "SELECT * FROM ( "
+                                  "    %1 WHERE start < :oldStart ORDER BY start DESC LIMIT 1 "
+                                  ") "
+                                  "UNION "
+                                  "SELECT * FROM ( "
+                                  "    %1 WHERE start > :oldStart ORDER BY start ASC LIMIT 1 "
+                                  ") ORDER BY start ASC").arg(m_selectFields);
+        } else {
+            queryString = QString("%1 WHERE start=:start").arg(m_selectFields);   // TODO: lookup by uuid
+        }
+        if (!query->prepare(queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
+                                                << query->lastError().text()
+                                                << query->lastQuery();
+            emit error(tr("DB error: %1").arg(query->lastError().text()));
+            delete query;
+            return;
+        }
+
+        *requestQuery = query;
     }
 
-    m_size = size;
+    if (fields & TimeLogHistory::StartTime) {
+        (*requestQuery)->bindValue(":newStart", data.startTime.toTime_t());
+        (*requestQuery)->bindValue(":oldStart", oldStart.toTime_t());
+        fields |= TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart;
+    } else {
+        (*requestQuery)->bindValue(":start", data.startTime.toTime_t());
+    }
 
-    emit sizeChanged(m_size);
+    notifyUpdates(**requestQuery, fields);
 }
 
-void TimeLogHistoryWorker::decrementCategoryCount(const QString &name)
+void TimeLogHistoryWorker::notifyRemoveUpdates(const QVector<TimeLogEntry> &data)
 {
-    if (!m_categoryRecordsCount.contains(name)) {
-        fetchCategories();
+    if (data.size() == 1) {
+        notifyRemoveUpdates(data.constFirst());
         return;
-    } else if (--(m_categoryRecordsCount[name]) == 0) {
-        updateCategories();
     }
-}
 
-void TimeLogHistoryWorker::incrementCategoryCount(const QString &name)
-{
-    if (!m_categoryRecordsCount.contains(name)) {
-        m_categories.insert(name, TimeLogCategory(QUuid(), TimeLogCategoryData(name)));
-        m_categoryRecordsCount.insert(name, 1);
-    } else if ((m_categoryRecordsCount[name])++ > 0) {
-        return;
+    QVector<uint> starts;
+    starts.reserve(data.size());
+    for (const TimeLogEntry &entry: data) {
+        starts.append(entry.startTime.toTime_t());
     }
 
-    updateCategories();
-}
-
-void TimeLogHistoryWorker::processFail()
-{
-    m_undoStack.clear();
-    emit undoCountChanged(0);
+    QMap<uint, TimeLogEntry> updatedData;
+    if (!getAdjacentEntries(starts, updatedData)) {
+        return;
+    }
 
-    emit dataOutdated();
+    notifyUpdates(updatedData.values().toVector());
 }
 
-void TimeLogHistoryWorker::insertEntry(const TimeLogEntry &data)
+void TimeLogHistoryWorker::notifyEditUpdates(const QVector<TimeLogEntry> &data,
+                                             const QVector<TimeLogHistory::Fields> &fields,
+                                             const QVector<TimeLogEntry> &oldData)
 {
-    if (insertEntryData(data)) {
-        emit dataInserted(data);
-        notifyInsertUpdates(data);
+    QVector<QUuid> uuids;
+    QVector<uint> starts;
+    QHash<QUuid, TimeLogHistory::Fields> editedFields;
+    uuids.reserve(data.size());
+    for (int i = 0; i < data.size(); i++) {
+        TimeLogHistory::Fields entryFields = fields.at(i);
+        if (entryFields & TimeLogHistory::StartTime) {
+            starts.append(data.at(i).startTime.toTime_t());
+            starts.append(oldData.at(i).startTime.toTime_t());
+            entryFields |= TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart;
+        }
+        uuids.append(data.at(i).uuid);
+        editedFields[data.at(i).uuid] |= entryFields;
+    }
 
-        incrementCategoryCount(data.category);
-    } else {
-        processFail();
+    // Entries around the old and new starts get their durations and preceding starts changed
+    QMap<uint, TimeLogEntry> updatedData;
+    if (!getAdjacentEntries(starts, updatedData)) {
+        return;
+    }
+    QMap<uint, TimeLogHistory::Fields> updatedFields;
+    for (auto it = updatedData.constBegin(); it != updatedData.constEnd(); ++it) {
+        updatedFields.insert(it.key(), TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart);
     }
-}
 
-void TimeLogHistoryWorker::removeEntry(const TimeLogEntry &data)
-{
-    if (removeEntryData(data)) {
-        emit dataRemoved(data);
-        notifyRemoveUpdates(data);
+    // Edited entries are taken by uuid, the stored values may differ from the given ones
+    for (const TimeLogEntry &entry: getEntries(uuids)) {
+        uint start = entry.startTime.toTime_t();
+        updatedData.insert(start, entry);
+        updatedFields[start] |= editedFields.value(entry.uuid);
+    }
 
-        decrementCategoryCount(data.category);
-    } else {
-        processFail();
+    if (!updatedData.isEmpty()) {
+        qCDebug(HISTORY_WORKER_CATEGORY) << "Updated entries count:" << updatedData.size();
+        emit dataUpdated(updatedData.values().toVector(), updatedFields.values().toVector());
     }
 }
 
-bool TimeLogHistoryWorker::editEntry(const TimeLogEntry &data, TimeLogHistory::Fields fields)
+bool TimeLogHistoryWorker::getAdjacentEntries(const QVector<uint> &starts, QMap<uint, TimeLogEntry> &result) const
 {
-    QDateTime oldStart;
-    QString oldCategory;
-    if (fields == TimeLogHistory::NoFields) {
-        qCWarning(HISTORY_WORKER_CATEGORY) << "No fields specified";
-        return false;
-    } else if (fields & (TimeLogHistory::StartTime | TimeLogHistory::Category)) {
-        TimeLogEntry oldData = getEntry(data.uuid);
-        if (!oldData.isValid()) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Item to update not found:\n"
-                                                << data.startTime << data.category << data.uuid;
-            processFail();
+    QVector<uint> uniqueStarts(starts);
+    std::sort(uniqueStarts.begin(), uniqueStarts.end());
+    uniqueStarts.erase(std::unique(uniqueStarts.begin(), uniqueStarts.end()), uniqueStarts.end());
+
+    // Neighbours of the adjacent chunks may overlap, so the entries are merged by start
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    for (int offset = 0; offset < uniqueStarts.size(); offset += valuesChunkSize) {
+        int count = qMin(valuesChunkSize, uniqueStarts.size() - offset);
+        QString placeholders = QString("(?),").repeated(count);
+        placeholders.chop(1);
+
+        QSqlQuery query(db);
+        QString queryString = QString("WITH bounds(start) AS (VALUES %2) "
+                                      "%1 WHERE start IN ( "
+                                      "    SELECT (SELECT start FROM timelog WHERE start < bounds.start ORDER BY start DESC LIMIT 1) "
+                                      "    FROM bounds "
+                                      "    UNION "
+                                      "    SELECT (SELECT start FROM timelog WHERE start > bounds.start ORDER BY start ASC LIMIT 1) "
+                                      "    FROM bounds "
+                                      ") ORDER BY start ASC").arg(m_selectFields).arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
             return false;
         }
-        if (fields & TimeLogHistory::StartTime) {
-            oldStart = oldData.startTime;
-        }
-        if (fields & TimeLogHistory::Category) {
-            oldCategory = oldData.category;
+        for (int i = offset; i < offset + count; i++) {
+            query.addBindValue(uniqueStarts.at(i));
         }
-    }
 
-    if (editEntryData(data, fields)) {
-        notifyEditUpdates(data, fields, oldStart);
+        QVector<TimeLogEntry> chunkData = getHistory(query);
+        if (query.lastError().isValid()) {
+            return false;
+        }
 
-        if (fields & TimeLogHistory::Category) {
-            decrementCategoryCount(oldCategory);
-            incrementCategoryCount(data.category);
+        for (const TimeLogEntry &entry: chunkData) {
+            result.insert(entry.startTime.toTime_t(), entry);
         }
-    }  else {
-        processFail();
-        return false;
     }
 
     return true;
 }
 
-bool TimeLogHistoryWorker::editEntries(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields)
+void TimeLogHistoryWorker::notifyUpdates(QSqlQuery &query, TimeLogHistory::Fields fields) const
 {
-    for (int i = 0; i < data.size(); i++) {
-        if (!editEntry(data.at(i), fields.at(i))) {
-            return false;
-        }
-    }
-
-    return true;
+    notifyUpdates(getHistory(query), fields);
 }
 
-bool TimeLogHistoryWorker::syncEntries(const QVector<TimeLogSyncDataEntry> &updatedData,
-                                       const QVector<TimeLogSyncDataEntry> &removedData,
-                                       QDateTime &maxSyncDate)
+void TimeLogHistoryWorker::notifyUpdates(const QVector<TimeLogEntry> &updatedData, TimeLogHistory::Fields fields) const
 {
-    QVector<TimeLogSyncDataEntry> removedNew;
-    QVector<TimeLogSyncDataEntry> removedOld;
-    QVector<TimeLogSyncDataEntry> insertedNew;
-    QVector<TimeLogSyncDataEntry> insertedOld;
-    QVector<TimeLogSyncDataEntry> updatedNew;
-    QVector<TimeLogSyncDataEntry> updatedOld;
-    QVector<TimeLogHistory::Fields> updateFields;
-
-    for (const TimeLogSyncDataEntry &item: removedData) {
-        QVector<TimeLogSyncDataEntry> affected = getSyncEntriesAffected(item.entry.uuid);
-        if (!affected.isEmpty() && affected.constFirst().sync.mTime >= item.sync.mTime) {
-            continue;
-        }
-
-        removedNew.append(item);
-        removedOld.append(affected.isEmpty() ? TimeLogSyncDataEntry() : affected.constFirst());
-    }
-
-    for (const TimeLogSyncDataEntry &item: updatedData) {
-        QVector<TimeLogSyncDataEntry> affected = getSyncEntriesAffected(item.entry.uuid);
-        if (!affected.isEmpty() && affected.constFirst().sync.mTime >= item.sync.mTime) {
-            continue;
-        }
-
-        if (affected.isEmpty() || !affected.constFirst().entry.isValid()) {
-            insertedNew.append(item);
-            insertedOld.append(affected.isEmpty() ? TimeLogSyncDataEntry() : affected.constFirst());
-        } else {
-            const TimeLogSyncDataEntry &oldItem(affected.constFirst());
-            TimeLogHistory::Fields fields(TimeLogHistory::NoFields);
-            if (item.entry.startTime != oldItem.entry.startTime) {
-                fields |= TimeLogHistory::StartTime;
-            }
-            if (item.entry.category != oldItem.entry.category) {
-                fields |= TimeLogHistory::Category;
-            }
-            if (item.entry.comment != oldItem.entry.comment) {
-                fields |= TimeLogHistory::Comment;
-            }
-            updatedNew.append(item);
-            updatedOld.append(oldItem);
-            updateFields.append(fields);
-        }
-    }
-
-    emit syncEntryStatsAvailable(removedOld, removedNew, insertedOld, insertedNew, updatedOld, updatedNew);
+    QVector<TimeLogHistory::Fields> updatedFields;
 
-    QVector<TimeLogSyncDataEntry> removedMerged(removedOld);
-    for (int i = 0; i < removedMerged.size(); i++) {
-        removedMerged[i].entry.uuid = removedNew.at(i).entry.uuid;
-        removedMerged[i].sync.mTime = removedNew.at(i).sync.mTime;
+    if (!updatedData.isEmpty()) {
+        qCDebug(HISTORY_WORKER_CATEGORY) << "Updated entries count:" << updatedData.size();
+        updatedFields.insert(0, updatedData.size(), fields);
+        emit dataUpdated(updatedData, updatedFields);
     }
+}
 
-    if (!syncEntryData(removedMerged, insertedNew, updatedNew, updateFields)) {
+bool TimeLogHistoryWorker::startTransaction(QSqlDatabase &db)
+{
+    if (!db.transaction()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to start transaction:" << db.lastError().text();
+        emit error(tr("DB error: %1").arg(db.lastError().text()));
         return false;
     }
 
-    for (const TimeLogSyncDataEntry &item: removedMerged) {
-        if (item.entry.isValid()) {
-            emit dataRemoved(item.entry);
-        }
-    }
-    for (const TimeLogSyncDataEntry &item: removedMerged) {
-        if (item.entry.isValid()) {
-            notifyRemoveUpdates(item.entry);
-        }
-    }
-    for (const TimeLogSyncDataEntry &item: insertedNew) {
-        emit dataInserted(item.entry);
-    }
-    for (const TimeLogSyncDataEntry &item: insertedNew) {
-        notifyInsertUpdates(item.entry);
-    }
-    for (int i = 0; i < updatedNew.size(); i++) {
-        notifyEditUpdates(updatedNew.at(i).entry, updateFields.at(i), updatedOld.at(i).entry.startTime);
-    }
-
-    for (const TimeLogSyncDataEntry &item: removedOld) {
-        if (item.entry.isValid()) {
-            decrementCategoryCount(item.entry.category);
-        }
-    }
-    for (const TimeLogSyncDataEntry &item: insertedNew) {
-        incrementCategoryCount(item.entry.category);
-    }
-    for (int i = 0; i < updatedNew.size(); i++) {
-        decrementCategoryCount(updatedOld.at(i).entry.category);
-        incrementCategoryCount(updatedNew.at(i).entry.category);
-    }
+    return true;
+}
 
-    if (!removedNew.isEmpty()) {
-        maxSyncDate = removedNew.constLast().sync.mTime;
-    }
-    if (!insertedNew.isEmpty() && insertedNew.constLast().sync.mTime > maxSyncDate) {
-        maxSyncDate = insertedNew.constLast().sync.mTime;
-    }
-    if (!updatedNew.isEmpty() && updatedNew.constLast().sync.mTime > maxSyncDate) {
-        maxSyncDate = updatedNew.constLast().sync.mTime;
+bool TimeLogHistoryWorker::commitTransaction(QSqlDatabase &db)
+{
+    if (!db.commit()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to commit transaction:" << db.lastError().text();
+        emit error(tr("DB error: %1").arg(db.lastError().text()));
+        rollbackTransaction(db);
+        return false;
     }
 
     return true;
 }
 
-bool TimeLogHistoryWorker::syncCategories(const QVector<TimeLogSyncDataCategory> &categoryData,
-                                          QDateTime &maxSyncDate)
+void TimeLogHistoryWorker::rollbackTransaction(QSqlDatabase &db)
 {
-    QVector<TimeLogSyncDataCategory> removedNew;
-    QVector<TimeLogSyncDataCategory> removedOld;
-    QVector<TimeLogSyncDataCategory> addedNew;
-    QVector<TimeLogSyncDataCategory> addedOld;
-    QVector<TimeLogSyncDataCategory> updatedNew;
-    QVector<TimeLogSyncDataCategory> updatedOld;
-
-    for (const TimeLogSyncDataCategory &item: categoryData) {
-        QVector<TimeLogSyncDataCategory> affected = getSyncCategoriesAffected(item.category.uuid);
-        if (!affected.isEmpty() && affected.constFirst().sync.mTime >= item.sync.mTime) {
-            continue;
-        }
-
-        if (!item.category.isValid()) {
-            removedNew.append(item);
-            removedOld.append(affected.isEmpty() ? TimeLogSyncDataCategory() : affected.constFirst());
-        } else {
-            if (affected.isEmpty() || !affected.constFirst().category.isValid()) {
-                addedNew.append(item);
-                addedOld.append(affected.isEmpty() ? TimeLogSyncDataCategory() : affected.constFirst());
-            } else {
-                updatedNew.append(item);
-                updatedOld.append(affected.constFirst());
-            }
-        }
+    if (!db.rollback()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to rollback transaction:" << db.lastError().text();
+        emit error(tr("DB error: %1").arg(db.lastError().text()));
     }
+}
 
-    emit syncCategoryStatsAvailable(removedOld, removedNew, addedOld, addedNew, updatedOld, updatedNew);
+QString TimeLogHistoryWorker::fixCategoryName(const QString &name) const
+{
+    return name.split(m_categorySplitRegexp, QString::SkipEmptyParts).join(" > ").trimmed();
+}
 
-    QVector<TimeLogSyncDataCategory> removedMerged(removedOld);
-    for (int i = 0; i < removedMerged.size(); i++) {
-        removedMerged[i].category.uuid = removedNew.at(i).category.uuid;
-        removedMerged[i].sync.mTime = removedNew.at(i).sync.mTime;
+bool TimeLogHistoryWorker::decodeCategoryData(const QByteArray &uuid, qlonglong mTime, const QByteArray &rawData,
+                                              QVariantMap &data) const
+{
+    if (!uuid.isEmpty()) {
+        auto it = m_categoryDataCache.constFind(uuid);
+        if (it != m_categoryDataCache.constEnd() && it->mTime == mTime && it->rawData == rawData) {
+            data = it->data;
+            return true;
+        }
     }
 
-    if (!syncCategoryData(removedMerged, addedNew, updatedNew, updatedOld)) {
-        return false;
+    QJsonDocument document;
+    // Binary JSON starts with the tag, text of the older schema versions is still parsed
+    if (rawData.startsWith("qbjs")) {
+        document = QJsonDocument::fromBinaryData(rawData);
+        if (document.isNull()) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to parse category binary data:" << rawData.toHex();
+            emit error(tr("Fail to parse category data: %1").arg("invalid binary data"));
+            return false;
+        }
+    } else {
+        QJsonParseError parseError;
+        document = QJsonDocument::fromJson(rawData, &parseError);
+        if (parseError.error != QJsonParseError::NoError) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to parse category data JSON:"
+                                                << rawData << "error at offset"
+                                                << parseError.offset
+                                                << parseError.errorString() << parseError.error;
+            emit error(tr("Fail to parse category data: %1").arg(parseError.errorString()));
+            return false;
+        }
     }
 
-    if (!removedNew.isEmpty()) {
-        maxSyncDate = removedNew.constLast().sync.mTime;
-    }
-    if (!addedNew.isEmpty() && addedNew.constLast().sync.mTime > maxSyncDate) {
-        maxSyncDate = addedNew.constLast().sync.mTime;
-    }
-    if (!updatedNew.isEmpty() && updatedNew.constLast().sync.mTime > maxSyncDate) {
-        maxSyncDate = updatedNew.constLast().sync.mTime;
+    data = document.object().toVariantMap();
+
+    if (!uuid.isEmpty()) {
+        m_categoryDataCache.insert(uuid, { mTime, rawData, data });
     }
 
     return true;
 }
 
-bool TimeLogHistoryWorker::insertEntryData(const QVector<TimeLogEntry> &data)
+bool TimeLogHistoryWorker::fetchCategories()
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    if (!startTransaction(db)) {
+    QSqlQuery query(db);
+    // Counts are maintained by triggers, older read-only DB has to count the entries
+    QString counts;
+    if (m_isCategoryCountsAvailable) {
+        counts = "SELECT category, count FROM category_counts JOIN category_names"
+                 " ON category_names.id=category_counts.category_id WHERE count > 0";
+    } else if (m_isArchivesAvailable) {
+        // Archived entries are counted too, as they are still the part of history
+        counts = "SELECT category, sum(count) AS count FROM ( "
+                 "    SELECT category, count(*) AS count FROM timelog_entries GROUP BY category "
+                 "UNION ALL "
+                 "    SELECT category, count FROM archive_categories "
+                 ") GROUP BY category";
+    } else {
+        counts = "SELECT category, count(*) AS count FROM timelog_entries GROUP BY category";
+    }
+    // FULL OUTER JOIN
+    QString queryString = QString("WITH t AS (%1), "
+                                  "    c AS (SELECT uuid, category, data, mtime FROM categories) "
+                                  "SELECT "
+                                  "    c.uuid AS uuid, "
+                                  "    ifnull(c.category, t.category) AS category, "
+                                  "    ifnull(t.count, 0) AS count, "
+                                  "    c.data AS data, "
+                                  "    c.mtime AS mtime "
+                                  "FROM t LEFT OUTER JOIN c ON t.category = c.category "
+                                  "UNION ALL "
+                                  "SELECT "
+                                  "    c.uuid AS uuid, "
+                                  "    ifnull(c.category, t.category) AS category, "
+                                  "    ifnull(t.count, 0) AS count, "
+                                  "    c.data AS data, "
+                                  "    c.mtime AS mtime "
+                                  "FROM c LEFT OUTER JOIN t ON t.category = c.category WHERE t.category IS NULL")
+                          .arg(counts);
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    for (const TimeLogEntry &entry: data) {
-        if (!insertEntryData(entry)) {
-            rollbackTransaction(db);
-            return false;
-        }
-    }
+    QMap<QString, TimeLogCategory> resultData;
+    QHash<QString, int> resultRecordsCount;
+    qlonglong size = 0;
+    QSet<QByteArray> uuids;
 
-    if (!commitTransaction(db)) {
-        return false;
-    }
+    while (query.next()) {
+        TimeLogCategory category;
 
-    return true;
-}
+        QByteArray uuid;
+        if (!query.value(0).isNull()) {
+            uuid = query.value(0).toByteArray();
+            category.uuid = QUuid::fromRfc4122(uuid);
+            uuids.insert(uuid);
+        }   // Entry-only category has null uuid
 
-bool TimeLogHistoryWorker::insertEntryData(const TimeLogSyncDataEntry &data)
-{
-    Q_ASSERT(data.entry.isValid());
+        category.name = query.value(1).toString();
 
-    if (!m_insertQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString = QString("INSERT INTO timelog (uuid, start, category, comment, mtime)"
-                                      " VALUES (:uuid, :start, :category, :comment, :mtime);");
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
+        int count = query.value(2).toInt();
+
+        if (!query.value(3).isNull()
+            && !decodeCategoryData(uuid, query.value(4).toLongLong(), query.value(3).toByteArray(), category.data)) {
             return false;
         }
 
-        m_insertQuery = query;
+        resultData.insert(category.name, category);
+        resultRecordsCount.insert(category.name, count);
+
+        size += count;
     }
 
-    m_insertQuery->bindValue(":uuid", data.entry.uuid.toRfc4122());
-    m_insertQuery->bindValue(":start", data.entry.startTime.toTime_t());
-    m_insertQuery->bindValue(":category", data.entry.category);
-    m_insertQuery->bindValue(":comment", data.entry.comment);
-    m_insertQuery->bindValue(":mtime", data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                                 : QDateTime::currentMSecsSinceEpoch());
+    query.finish();
 
-    if (!m_insertQuery->exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:"
-                                            << m_insertQuery->lastError().text()
-                                            << m_insertQuery->executedQuery()
-                                            << m_insertQuery->boundValues();
-        emit error(m_insertQuery->lastError().text());
-        return false;
+    // Removed categories are dropped from the cache
+    for (auto it = m_categoryDataCache.begin(); it != m_categoryDataCache.end();) {
+        if (uuids.contains(it.key())) {
+            ++it;
+        } else {
+            it = m_categoryDataCache.erase(it);
+        }
     }
 
-    setSize(m_size + m_insertQuery->numRowsAffected());
+    m_categories.swap(resultData);
+    m_categoryRecordsCount.swap(resultRecordsCount);
+
+    setSize(size);
+
+    updateCategories();
 
     return true;
 }
 
-bool TimeLogHistoryWorker::removeEntryData(const TimeLogSyncDataEntry &data)
+bool TimeLogHistoryWorker::checkIsDBEmpty()
 {
-    Q_ASSERT(!data.entry.uuid.isNull());
+    return (m_size == 0 && m_categories.isEmpty() && !getSyncDataExists());
+}
 
-    if (!m_removeQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString("INSERT OR REPLACE INTO timelog_removed (uuid, mtime) VALUES(:uuid,:mtime);");
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
+bool TimeLogHistoryWorker::populateCategories()
+{
+    QVector<TimeLogCategory> defaultCategories(TimeLogDefaultCategories::defaultCategories());
+
+    for (const TimeLogCategory &category: defaultCategories) {
+        // Use 0 mTime to make edited categories be newer than populated ones
+        TimeLogSyncDataCategory syncCategory(category, QDateTime::fromMSecsSinceEpoch(0, Qt::UTC));
+        if (!addCategoryData(syncCategory)) {
             return false;
         }
-
-        m_removeQuery = query;
-    }
-
-    m_removeQuery->bindValue(":uuid", data.entry.uuid.toRfc4122());
-    m_removeQuery->bindValue(":mtime", data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                                 : QDateTime::currentMSecsSinceEpoch());
-
-    if (!m_removeQuery->exec()) {
-        qCWarning(HISTORY_WORKER_CATEGORY) << "Fail to execute query:"
-                                           << m_removeQuery->lastError().text()
-                                           << m_removeQuery->executedQuery()
-                                           << m_removeQuery->boundValues();
-        emit error(m_removeQuery->lastError().text());
-        return false;
     }
 
-    setSize(m_size - m_removeQuery->numRowsAffected());
-
     return true;
 }
 
-bool TimeLogHistoryWorker::editEntryData(const TimeLogSyncDataEntry &data, TimeLogHistory::Fields fields)
+void TimeLogHistoryWorker::updateCategories()
 {
-    Q_ASSERT(data.entry.isValid());
+    m_categoryTree = parseCategories(m_categories.keys());
 
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QStringList fieldNames;
-    if (fields & TimeLogHistory::StartTime) {
-        fieldNames.append("start=?");
-    }
-    if (fields & TimeLogHistory::Category) {
-        fieldNames.append("category=?");
+    emit categoriesChanged(m_categoryTree);
+}
+
+void TimeLogHistoryWorker::updateCategories(const QStringList &names)
+{
+    if (!m_categoryTree) {
+        updateCategories();
+        return;
     }
-    if (fields & TimeLogHistory::Comment) {
-        fieldNames.append("comment=?");
+
+    // Emitted tree is shared with other threads, so the patch goes to a copy
+    QSharedPointer<TimeLogCategoryTreeNode> categoryTree(m_categoryTree->clone());
+    for (const QString &name: names) {
+        if (!patchCategories(categoryTree.data(), name)) {
+            updateCategories();
+            return;
+        }
     }
-    QString queryString = QString("UPDATE timelog SET %1 mtime=?"
-                                  " WHERE uuid=?;").arg(fieldNames.isEmpty() ? QString()
-                                                                             : fieldNames.join(", ") + ",");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
+
+    m_categoryTree = categoryTree;
+
+    emit categoriesChanged(m_categoryTree);
+}
+
+bool TimeLogHistoryWorker::patchCategories(TimeLogCategoryTreeNode *rootCategory, const QString &category) const
+{
+    QStringList categoryFields = category.split(m_categorySplitRegexp, QString::SkipEmptyParts);
+    // Only normalized names match the full names of the tree nodes
+    if (categoryFields.join(" > ") != category) {
         return false;
     }
-    if (fields & TimeLogHistory::StartTime) {
-        query.addBindValue(data.entry.startTime.toTime_t());
+
+    TimeLogCategoryTreeDiff &diff = rootCategory->diff();
+    TimeLogCategoryTreeNode *categoryObject = rootCategory;
+
+    if (m_categories.contains(category)) {
+        bool isAdded = false;
+        for (const QString &categoryField: categoryFields) {
+            TimeLogCategoryTreeNode *parentCategory = categoryObject;
+            categoryObject = parentCategory->child(categoryField);
+            if (!categoryObject) {
+                categoryObject = parentCategory->addChild(categoryField);
+                QString fullName(categoryObject->fullName());
+                categoryObject->category = m_categories.value(fullName);
+                categoryObject->itemsCount = m_categoryRecordsCount.value(fullName);
+                categoryObject->hasItems = categoryObject->itemsCount > 0;
+                diff.added.append(fullName);
+                isAdded = true;
+            } else {
+                isAdded = false;
+            }
+        }
+        if (!isAdded && categoryObject != rootCategory) {
+            categoryObject->category = m_categories.value(category);
+            categoryObject->itemsCount = m_categoryRecordsCount.value(category);
+            categoryObject->hasItems = categoryObject->itemsCount > 0;
+            diff.changed.append(category);
+        }
+
+        return true;
     }
-    if (fields & TimeLogHistory::Category) {
-        query.addBindValue(data.entry.category);
+
+    for (const QString &categoryField: categoryFields) {
+        categoryObject = categoryObject->child(categoryField);
+        if (!categoryObject) {
+            return true;
+        }
     }
-    if (fields & TimeLogHistory::Comment) {
-        query.addBindValue(data.entry.comment);
+    if (categoryObject == rootCategory) {
+        return true;
     }
-    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                 : QDateTime::currentMSecsSinceEpoch());
-    query.addBindValue(data.entry.uuid.toRfc4122());
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return false;
+    categoryObject->category = TimeLogCategory();
+    categoryObject->itemsCount = m_categoryRecordsCount.value(category);
+    categoryObject->hasItems = categoryObject->itemsCount > 0;
+    if (!categoryObject->children().isEmpty()) {
+        diff.changed.append(category);
+        return true;
     }
 
+    // Drop the node with the parents, which remain only for it
+    do {
+        TimeLogCategoryTreeNode *parentCategory = categoryObject->parent();
+        diff.removed.append(categoryObject->fullName());
+        parentCategory->removeChild(categoryObject->name);
+        categoryObject = parentCategory;
+    } while (categoryObject != rootCategory && categoryObject->children().isEmpty()
+             && !m_categories.contains(categoryObject->fullName()));
+
     return true;
 }
 
-bool TimeLogHistoryWorker::editEntriesCategory(const QString &oldName, const QString &newName)
+QSharedPointer<TimeLogCategoryTreeNode> TimeLogHistoryWorker::parseCategories(const QStringList &categories) const
 {
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("SELECT count(*) FROM timelog WHERE category=?");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return false;
-    }
-    query.addBindValue(oldName);
+    TimeLogCategoryTreeNode *rootCategory = new TimeLogCategoryTreeNode("RootCategory");
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return false;
+    for (const QString &category: categories) {
+        QStringList categoryFields = category.split(m_categorySplitRegexp, QString::SkipEmptyParts);
+        TimeLogCategoryTreeNode *parentCategory = rootCategory;
+        for (const QString &categoryField: categoryFields) {
+            TimeLogCategoryTreeNode *categoryObject = parentCategory->child(categoryField);
+            if (!categoryObject) {
+                categoryObject = parentCategory->addChild(categoryField);
+                QString fullName(categoryObject->fullName());
+                categoryObject->category = m_categories.value(categoryObject->fullName());
+                categoryObject->itemsCount = m_categoryRecordsCount.value(fullName);
+                categoryObject->hasItems = categoryObject->itemsCount > 0;
+            }
+            parentCategory = categoryObject;
+        }
     }
 
-    query.next();
-    qlonglong oldCategoryItemsCount = query.value(0).toLongLong();
-    query.finish();
+    return QSharedPointer<TimeLogCategoryTreeNode>(rootCategory);
+}
 
-    if (oldCategoryItemsCount == 0) {
-        return true;
+// Undo record is written in the transaction of the action, so they are committed or rolled back together.
+// Action runs first, as it may fill the undo data.
+void TimeLogHistoryWorker::pushUndo(const TimeLogHistoryWorker::Undo &undo, const std::function<bool()> &action)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    if (!startTransaction(db)) {
+        processFail();
+        return;
     }
 
-    queryString = QString("UPDATE timelog SET category=?, mtime=? WHERE category=?;");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return false;
+    if (!action() || !writeUndo(undo)) {
+        rollbackTransaction(db);
+        processFail();
+        return;
     }
-    query.addBindValue(newName);
-    query.addBindValue(QDateTime::currentMSecsSinceEpoch());
-    query.addBindValue(oldName);
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return false;
+    if (!commitTransaction(db)) {
+        processFail();
+        return;
     }
 
-    m_categoryRecordsCount[oldName] = 0;
-    m_categoryRecordsCount[newName] += oldCategoryItemsCount;
-
-    return true;
+    if (m_undoCount < maxUndoSize) {
+        emit undoCountChanged(++m_undoCount);
+    }
 }
 
-bool TimeLogHistoryWorker::addCategoryData(const TimeLogSyncDataCategory &data)
+bool TimeLogHistoryWorker::writeUndo(const TimeLogHistoryWorker::Undo &undo)
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("INSERT INTO categories (uuid, category, data, mtime) VALUES(?,?,?,?);");
-    if (!query.prepare(queryString)) {
+    QString queryString("INSERT INTO undo_actions (type, category_uuid, category, category_data, category_new_name)"
+                        " VALUES (?,?,?,?,?);");
+    if (!prepareCachedQuery(query, queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-    query.addBindValue(data.category.uuid.toRfc4122());
-    query.addBindValue(data.category.name);
-    query.addBindValue(QJsonDocument(QJsonObject::fromVariantMap(data.category.data)).toJson(QJsonDocument::Compact));
-    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                 : QDateTime::currentMSecsSinceEpoch());
+    query.addBindValue(static_cast<int>(undo.type));
+    query.addBindValue(undo.categoryData.uuid.isNull() ? QVariant(QVariant::ByteArray)
+                                                       : undo.categoryData.uuid.toRfc4122());
+    query.addBindValue(undo.categoryData.name);
+    query.addBindValue(encodeCategoryData(undo.categoryData.data));
+    query.addBindValue(undo.categoryNewName);
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    if (!m_categories.contains(data.category.name)) {
-        m_categories.insert(data.category.name, data.category);
-        if (!m_categoryRecordsCount.contains(data.category.name)) {
-            m_categoryRecordsCount.insert(data.category.name, 0);
+    qlonglong id = query.lastInsertId().toLongLong();
+
+    // Only old values of the changed fields are kept
+    queryString = "INSERT INTO undo_entries (action, uuid, fields, start, category, comment) VALUES (?,?,?,?,?,?);";
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    auto writeEntry = [this, &query, id](const TimeLogEntry &entry, TimeLogHistory::Fields fields) {
+        query.addBindValue(id);
+        query.addBindValue(entry.uuid.toRfc4122());
+        query.addBindValue(static_cast<int>(fields));
+        query.addBindValue(fields & TimeLogHistory::StartTime ? QVariant(entry.startTime.toTime_t())
+                                                              : QVariant(QVariant::UInt));
+        query.addBindValue(fields & TimeLogHistory::Category ? QVariant(entry.category)
+                                                             : QVariant(QVariant::String));
+        query.addBindValue(fields & TimeLogHistory::Comment ? QVariant(entry.comment)
+                                                            : QVariant(QVariant::String));
+
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
         }
-        updateCategories();
-    } else if (!m_categories.value(data.category.name).isValid()) { // Entry-only category
-        m_categories.insert(data.category.name, data.category);
-        if (!data.category.data.isEmpty()) {
-            updateCategories();
+
+        return true;
+    };
+
+    for (int i = 0; i < undo.entryData.size(); i++) {
+        if (!writeEntry(undo.entryData.at(i), undo.entryFields.value(i, TimeLogHistory::AllFieldsMask))) {
+            return false;
+        }
+    }
+    for (const QUuid &uuid: undo.entryUuids) {
+        TimeLogEntry entry;
+        entry.uuid = uuid;
+        entry.category = undo.categoryData.name;
+        if (!writeEntry(entry, TimeLogHistory::Category)) {
+            return false;
+        }
+    }
+
+    // Oldest records beyond the limit are dropped
+    for (const char *key: { "undo_entries WHERE action", "undo_actions WHERE id" }) {
+        queryString = QString("DELETE FROM %1 IN ("
+                              "    SELECT id FROM undo_actions ORDER BY id DESC LIMIT -1 OFFSET ?"
+                              ");").arg(key);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        query.addBindValue(maxUndoSize);
+
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
         }
-    } else if (m_categories.value(data.category.name).data != data.category.data) {
-        m_categories[data.category.name].data = data.category.data;
-        updateCategories();
     }
 
     return true;
 }
 
-bool TimeLogHistoryWorker::removeCategoryData(const TimeLogSyncDataCategory &data)
+bool TimeLogHistoryWorker::takeUndo(TimeLogHistoryWorker::Undo &undo)
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("INSERT OR REPLACE INTO categories_removed (uuid, mtime) VALUES(?,?);");
-    if (!query.prepare(queryString)) {
+    QString queryString("SELECT id, type, category_uuid, category, category_data, category_new_name"
+                        " FROM undo_actions ORDER BY id DESC LIMIT 1");
+    if (!prepareCachedQuery(query, queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-    query.addBindValue(data.category.uuid.toRfc4122());
-    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                 : QDateTime::currentMSecsSinceEpoch());
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    QString name(data.category.name);
-    if (name.isEmpty()) {
-        auto it = std::find_if(m_categories.cbegin(), m_categories.cend(),
-                               [&data](const TimeLogCategory &c) {
-            return c.uuid == data.category.uuid;
-        });
-        if (it != m_categories.cend()) {
-            name = it->name;
-        }
-    }
-    if (!name.isEmpty()) {
-        if (m_categoryRecordsCount.value(name)) {
-            if (!m_categories.value(name).data.isEmpty()) {
-                m_categories[name].data.clear();    // Entry-only category has no data
-                updateCategories();
-            }
-        } else {
-            m_categoryRecordsCount.remove(name);
-            m_categories.remove(name);
-            updateCategories();
-        }
+    if (!query.next()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Empty undo journal";
+        query.finish();
+        return false;
     }
 
-    return true;
-}
+    qlonglong id = query.value(0).toLongLong();
+    undo.type = static_cast<Undo::Type>(query.value(1).toInt());
+    if (!query.isNull(2)) {
+        undo.categoryData.uuid = QUuid::fromRfc4122(query.value(2).toByteArray());
+    }
+    undo.categoryData.name = query.value(3).toString();
+    decodeCategoryData(QByteArray(), 0, query.value(4).toByteArray(), undo.categoryData.data);
+    undo.categoryNewName = query.value(5).toString();
+    query.finish();
 
-bool TimeLogHistoryWorker::editCategoryData(const QString &oldName, const TimeLogSyncDataCategory &data)
-{
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("UPDATE categories SET category=?, data=?, mtime=? WHERE uuid=?;");
-    if (!query.prepare(queryString)) {
+    queryString = "SELECT uuid, fields, start, category, comment FROM undo_entries WHERE action=? ORDER BY rowid ASC";
+    if (!prepareCachedQuery(query, queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-    query.addBindValue(data.category.name);
-    query.addBindValue(QJsonDocument(QJsonObject::fromVariantMap(data.category.data)).toJson(QJsonDocument::Compact));
-    query.addBindValue(data.sync.mTime.isValid() ? data.sync.mTime.toMSecsSinceEpoch()
-                                                 : QDateTime::currentMSecsSinceEpoch());
-    query.addBindValue(data.category.uuid.toRfc4122());
+    query.addBindValue(id);
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    m_categories.remove(oldName);
-    m_categories.insert(data.category.name, data.category);
-    m_categoryRecordsCount.insert(data.category.name, m_categoryRecordsCount.take(oldName));
-
-    updateCategories();
-
-    return true;
-}
-
-bool TimeLogHistoryWorker::syncEntryData(const QVector<TimeLogSyncDataEntry> &removed,
-                                         const QVector<TimeLogSyncDataEntry> &inserted,
-                                         const QVector<TimeLogSyncDataEntry> &updated,
-                                         const QVector<TimeLogHistory::Fields> &updateFields)
-{
-    for (const TimeLogSyncDataEntry &item: removed) {
-        if (!removeEntryData(item)) {
-            return false;
+    bool isUuidsOnly = undo.type == Undo::EditCategory || undo.type == Undo::MergeCategories;
+    while (query.next()) {
+        QUuid uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
+        if (isUuidsOnly) {
+            undo.entryUuids.append(uuid);
+            continue;
         }
-    }
 
-    for (const TimeLogSyncDataEntry &item: inserted) {
-        if (!insertEntryData(item)) {
-            return false;
+        TimeLogEntry entry;
+        entry.uuid = uuid;
+        if (!query.isNull(2)) {
+            entry.startTime = QDateTime::fromTime_t(query.value(2).toUInt(), Qt::UTC);
         }
+        entry.category = TimeLogCategoryPool::intern(query.value(3).toString());
+        entry.comment = query.value(4).toString();
+        undo.entryData.append(entry);
+        undo.entryFields.append(TimeLogHistory::Fields(query.value(1).toInt()));
     }
+    query.finish();
 
-    for (int i = 0; i < updated.size(); i++) {
-        if (!editEntryData(updated.at(i), updateFields.at(i))) {
-            return false;
+    // Only old values of the changed fields are kept, the rest is taken from the current entries
+    if (undo.type == Undo::EditEntry) {
+        QVector<QUuid> uuids;
+        uuids.reserve(undo.entryData.size());
+        for (const TimeLogEntry &entry: undo.entryData) {
+            uuids.append(entry.uuid);
+        }
+        QHash<QUuid, TimeLogEntry> currentData;
+        for (const TimeLogEntry &entry: getEntries(uuids)) {
+            currentData.insert(entry.uuid, entry);
         }
-    }
-
-    return true;
-}
 
-bool TimeLogHistoryWorker::syncCategoryData(const QVector<TimeLogSyncDataCategory> &removed,
-                                            const QVector<TimeLogSyncDataCategory> &inserted,
-                                            const QVector<TimeLogSyncDataCategory> &updatedNew,
-                                            const QVector<TimeLogSyncDataCategory> &updatedOld)
-{
-    for (const TimeLogSyncDataCategory &item: removed) {
-        if (!removeCategoryData(item)) {
-            return false;
+        for (int i = 0; i < undo.entryData.size(); i++) {
+            TimeLogEntry entry = currentData.value(undo.entryData.at(i).uuid);
+            if (!entry.isValid()) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Item to undo not found:" << undo.entryData.at(i).uuid;
+                emit error(tr("Item to undo not found"));
+                return false;
+            }
+            TimeLogHistory::Fields fields = undo.entryFields.at(i);
+            if (fields & TimeLogHistory::StartTime) {
+                entry.startTime = undo.entryData.at(i).startTime;
+            }
+            if (fields & TimeLogHistory::Category) {
+                entry.category = undo.entryData.at(i).category;
+            }
+            if (fields & TimeLogHistory::Comment) {
+                entry.comment = undo.entryData.at(i).comment;
+            }
+            undo.entryData[i] = entry;
         }
     }
 
-    for (const TimeLogSyncDataCategory &item: inserted) {
-        if (!addCategoryData(item)) {
+    for (const char *key: { "undo_entries WHERE action", "undo_actions WHERE id" }) {
+        queryString = QString("DELETE FROM %1=?;").arg(key);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
             return false;
         }
-    }
+        query.addBindValue(id);
 
-    for (int i = 0; i < updatedNew.size(); i++) {
-        if (!editCategoryData(updatedOld.at(i).category.name, updatedNew.at(i))) {
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
             return false;
         }
     }
 
+    --m_undoCount;
+
     return true;
 }
 
-void TimeLogHistoryWorker::updateDataHashes(const QMap<QDateTime, QByteArray> &hashes)
+void TimeLogHistoryWorker::clearUndo()
 {
-    for (auto it = hashes.cbegin(); it != hashes.cend(); it++) {
-        if (it.value().isEmpty()) {
-            qCDebug(HISTORY_WORKER_CATEGORY) << "Updating data hash for period start" << it.key();
-            QByteArray hash = calcHash(it.key(), it.key().addMonths(1).addMSecs(-1));
-            if (hash.isEmpty()) {
-                if (!removeHash(it.key())) {
-                    return;
-                }
-            } else {
-                if (!writeHash(it.key(), hash)) {
-                    return;
-                }
-            }
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    for (const char *table: { "undo_entries", "undo_actions" }) {
+        QString queryString = QString("DELETE FROM %1;").arg(table);
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            break;
         }
     }
+
+    m_undoCount = 0;
+    emit undoCountChanged(0);
 }
 
-bool TimeLogHistoryWorker::writeHash(const QDateTime &start, const QByteArray &hash)
+bool TimeLogHistoryWorker::fetchUndoCount()
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("UPDATE hashes SET hash=? WHERE start=?;");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
+    QString queryString("SELECT count(*) FROM undo_actions");
+    if (!prepareAndExecQuery(query, queryString)) {
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-    query.addBindValue(hash);
-    query.addBindValue(start.toTime_t());
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
+    query.next();
+    int undoCount = query.value(0).toInt();
+    query.finish();
+
+    if (m_undoCount != undoCount) {
+        m_undoCount = undoCount;
+        emit undoCountChanged(m_undoCount);
+    }
+
+    return true;
+}
+
+// Horizon is kept in milliseconds, unlike the times of the maintenance tasks
+bool TimeLogHistoryWorker::fetchPurgeHorizon()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("SELECT time FROM maintenance WHERE task='purge_horizon'");
+    if (!prepareAndExecQuery(query, queryString)) {
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
+    m_purgeHorizon = query.next() ? QDateTime::fromMSecsSinceEpoch(query.value(0).toLongLong(), Qt::UTC)
+                                  : QDateTime();
+    query.finish();
+
     return true;
 }
 
-bool TimeLogHistoryWorker::removeHash(const QDateTime &start)
+bool TimeLogHistoryWorker::isBeforePurgeHorizon(const QDateTime &mTime) const
 {
+    return m_purgeHorizon.isValid() && mTime < m_purgeHorizon;
+}
+
+// Archives are kept next to the DB file, one file per year
+QString TimeLogHistoryWorker::archivePath(qint64 start) const
+{
+    QFileInfo fileInfo(QSqlDatabase::database(m_connectionName).databaseName());
+
+    return QString("%1/%2-archive/%3.sqlite").arg(fileInfo.absolutePath()).arg(fileInfo.completeBaseName())
+                                             .arg(QDateTime::fromTime_t(start, Qt::UTC).date().year());
+}
+
+bool TimeLogHistoryWorker::attachArchive(const QString &filePath, const QString &name, bool isCreate) const
+{
+    // Attaching the missing file would create an empty one
+    if (!isCreate && !QFile::exists(filePath)) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Archive is not available:" << filePath;
+        return false;
+    }
+
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("DELETE FROM hashes WHERE start=?;");
+    QString queryString = QString("ATTACH DATABASE ? AS %1;").arg(name);
     if (!query.prepare(queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-    query.addBindValue(start.toTime_t());
+    query.addBindValue(filePath);
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
@@ -1724,708 +5799,833 @@ bool TimeLogHistoryWorker::removeHash(const QDateTime &start)
     return true;
 }
 
-QVector<TimeLogEntry> TimeLogHistoryWorker::getHistory(QSqlQuery &query) const
+void TimeLogHistoryWorker::detachArchive(const QString &name) const
 {
-    QVector<TimeLogEntry> result;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString = QString("DETACH DATABASE %1;").arg(name);
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+    }
+}
 
-    if (!query.exec()) {
+bool TimeLogHistoryWorker::getArchives(QVector<Archive> &archives) const
+{
+    if (!m_isArchivesAvailable) {
+        return true;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString("SELECT start, end, mbegin, mend FROM archives ORDER BY start ASC");
+    if (!prepareCachedQuery(query, queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
+        return false;
     }
 
     while (query.next()) {
-        TimeLogEntry data;
-        data.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
-        data.startTime = QDateTime::fromTime_t(query.value(1).toUInt(), Qt::UTC);
-        data.category = query.value(2).toString();
-        data.comment = query.value(3).toString();
-        data.durationTime = query.value(4).toInt();
-        data.precedingStart = QDateTime::fromTime_t(query.value(5).toUInt(), Qt::UTC);
-
-        result.append(data);
+        Archive archive;
+        archive.start = query.value(0).toLongLong();
+        archive.end = query.value(1).toLongLong();
+        archive.mBegin = query.value(2).toLongLong();
+        archive.mEnd = query.value(3).toLongLong();
+        archives.append(archive);
     }
 
     query.finish();
 
-    return result;
+    return true;
 }
 
-QVector<TimeLogStats> TimeLogHistoryWorker::getStats(QSqlQuery &query) const
+bool TimeLogHistoryWorker::execArchiveQuery(QSqlQuery &query, const QString &queryString,
+                                            const QVariantList &values) const
 {
-    QVector<TimeLogStats> result;
+    // Statements on the attached archive are not cached, so it could be detached
+    query.setForwardOnly(true);
+    if (!query.prepare(queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    for (const QVariant &value: values) {
+        query.addBindValue(value);
+    }
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
-    }
-
-    while (query.next()) {
-        TimeLogStats data;
-        data.category = query.value(0).toString();
-        data.durationTime = query.value(1).toInt();
-
-        result.append(data);
+        return false;
     }
 
-    query.finish();
-
-    return result;
+    return true;
 }
 
-QVector<TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntryData(const QDateTime &mBegin, const QDateTime &mEnd) const
+bool TimeLogHistoryWorker::archiveData(qint64 begin, qint64 end)
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString where = QString(mBegin.isValid() ? "mtime >= :mBegin" : "")
-                    + QString(mBegin.isValid() && mEnd.isValid() ? " AND " : "")
-                    + QString(mEnd.isValid() ? "mtime <= :mEnd" : "");
-    if (!where.isEmpty()) {
-        where = "WHERE (" + where + ")";
-    }
-    QString queryString = QString("WITH result AS ( "
-                                  "    SELECT uuid, start, category, comment, mtime FROM timelog %1 "
-                                  "UNION ALL "
-                                  "    SELECT uuid, NULL, NULL, NULL, mtime FROM timelog_removed %1 "
-                                  ") "
-                                  "SELECT * FROM result ORDER BY mtime ASC").arg(where);
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return QVector<TimeLogSyncDataEntry>();
+    QString filePath(archivePath(begin));
+
+    if (!execArchiveQuery(query, "SELECT count(*) FROM timelog WHERE start >= ? AND start < ?",
+                          QVariantList() << begin << end)) {
+        return false;
     }
-    if (mBegin.isValid()) {
-        query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+    query.next();
+    qlonglong count = query.value(0).toLongLong();
+    query.finish();
+
+    if (!count) {
+        return true;
     }
-    if (mEnd.isValid()) {
-        query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+
+    // Leftover of the failed attempt is not referenced by the DB
+    if (QFile::exists(filePath) && !QFile::remove(filePath)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to remove stale archive:" << filePath;
+        emit error(tr("Fail to remove stale archive %1").arg(filePath));
+        return false;
     }
 
-    return getSyncEntryData(query);
-}
+    if (!QDir().mkpath(QFileInfo(filePath).absolutePath())) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to create directory for archive";
+        emit error(tr("Fail to create directory for archive"));
+        return false;
+    }
 
-QVector<TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntryData(QSqlQuery &query) const
-{
-    QVector<TimeLogSyncDataEntry> result;
+    if (!attachArchive(filePath, "archive", true)) {
+        return false;
+    }
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
+    if (!startTransaction(db)) {
+        goto fail;
     }
 
-    while (query.next()) {
-        TimeLogSyncDataEntry data;
-        data.entry.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
-        data.sync.isRemoved = query.isNull(1);
-        if (!data.sync.isRemoved) { // Removed item shouldn't has valid start time
-            data.entry.startTime = QDateTime::fromTime_t(query.value(1).toUInt(), Qt::UTC);
+    if (!execArchiveQuery(query, "CREATE TABLE archive.timelog (uuid BLOB UNIQUE NOT NULL,"
+                          " start INTEGER PRIMARY KEY, category TEXT NOT NULL, comment TEXT, duration INTEGER,"
+                          " mtime INTEGER, preceding INTEGER);", QVariantList())
+        || !execArchiveQuery(query, "INSERT INTO archive.timelog (uuid, start, category, comment, duration, mtime,"
+                             " preceding) SELECT uuid, start, category, comment, duration, mtime, preceding"
+                             " FROM timelog_entries WHERE start >= ? AND start < ?;", QVariantList() << begin << end)
+        || !execArchiveQuery(query, "INSERT INTO archives (start, end, mbegin, mend)"
+                             " SELECT ?, ?, min(mtime), max(mtime) FROM archive.timelog;",
+                             QVariantList() << begin << end)
+        || !execArchiveQuery(query, "INSERT INTO archive_categories (archive, category, count)"
+                             " SELECT ?, category, count(*) FROM archive.timelog GROUP BY category;",
+                             QVariantList() << begin)) {
+        goto rollback;
+    }
+
+    for (const char *period: { "month", "day" }) {
+        QString queryString = QString("INSERT INTO archive_hashes (archive, period, start, size, sum1, sum2)"
+                                      " SELECT ?, '%1', start, size, sum1, sum2 FROM (%2);")
+                              .arg(period).arg(recordsHashesSelect(period, "SELECT uuid, mtime FROM archive.timelog"));
+        if (!execArchiveQuery(query, queryString, QVariantList() << begin)) {
+            goto rollback;
         }
-        data.entry.category = query.value(2).toString();
-        data.entry.comment = query.value(3).toString();
-        data.sync.mTime = QDateTime::fromMSecsSinceEpoch(query.value(4).toLongLong(), Qt::UTC);
+    }
 
-        result.append(data);
+    // Hashes and stats keep the archived entries, neighbours of the range are not changed
+    if (!setArchiveMode(true) || !setBulkMode(true)
+        || !execArchiveQuery(query, "DELETE FROM timelog WHERE start >= ? AND start < ?;",
+                             QVariantList() << begin << end)
+        || !setBulkMode(false) || !setArchiveMode(false)) {
+        goto rollback;
     }
 
-    query.finish();
+    if (!commitTransaction(db)) {
+        goto fail;
+    }
 
-    return result;
+    query.clear();
+    detachArchive("archive");
+
+    return true;
+
+rollback:
+    rollbackTransaction(db);
+
+fail:
+    query.clear();
+    detachArchive("archive");
+    QFile::remove(filePath);
+
+    return false;
 }
 
-QVector<TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoryData(const QDateTime &mBegin, const QDateTime &mEnd) const
+bool TimeLogHistoryWorker::restoreArchive(const Archive &archive)
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString where = QString(mBegin.isValid() ? "mtime >= :mBegin" : "")
-                    + QString(mBegin.isValid() && mEnd.isValid() ? " AND " : "")
-                    + QString(mEnd.isValid() ? "mtime <= :mEnd" : "");
-    if (!where.isEmpty()) {
-        where = "WHERE (" + where + ")";
+    QString filePath(archivePath(archive.start));
+    QString queryString = QString("INSERT INTO timelog (uuid, start, category_id, comment, duration, mtime, preceding)"
+                                  " SELECT uuid, start, %1, comment, duration, mtime, preceding"
+                                  " FROM archive.timelog AS archived;")
+                          .arg(categoryIdExpression("archived.category"));
+
+    if (!attachArchive(filePath, "archive")) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to restore archive:" << filePath;
+        emit error(tr("Fail to restore archive %1").arg(filePath));
+        return false;
     }
-    QString queryString = QString("WITH result AS ( "
-                                  "    SELECT uuid, category, data, mtime FROM categories %1 "
-                                  "UNION ALL "
-                                  "    SELECT uuid, NULL, NULL, mtime FROM categories_removed %1 "
-                                  ") "
-                                  "SELECT * FROM result ORDER BY mtime ASC").arg(where);
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return QVector<TimeLogSyncDataCategory>();
+
+    if (!startTransaction(db)) {
+        goto fail;
     }
-    if (mBegin.isValid()) {
-        query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
+
+    if (!execArchiveQuery(query, "INSERT OR IGNORE INTO category_names (category)"
+                          " SELECT DISTINCT category FROM archive.timelog;", QVariantList())
+        || !setArchiveMode(true) || !setBulkMode(true)
+        || !execArchiveQuery(query, queryString, QVariantList())
+        || !setBulkMode(false) || !setArchiveMode(false)
+        || !execArchiveQuery(query, "DELETE FROM archive_hashes WHERE archive=?;", QVariantList() << archive.start)
+        || !execArchiveQuery(query, "DELETE FROM archive_categories WHERE archive=?;",
+                             QVariantList() << archive.start)
+        || !execArchiveQuery(query, "DELETE FROM archives WHERE start=?;", QVariantList() << archive.start)) {
+        rollbackTransaction(db);
+        goto fail;
     }
-    if (mEnd.isValid()) {
-        query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
+
+    if (!commitTransaction(db)) {
+        goto fail;
     }
 
-    return getSyncCategoryData(query);
+    query.clear();
+    detachArchive("archive");
+
+    if (!QFile::remove(filePath)) {
+        qCWarning(HISTORY_WORKER_CATEGORY) << "Fail to remove restored archive:" << filePath;
+    }
+
+    return true;
+
+fail:
+    query.clear();
+    detachArchive("archive");
+
+    return false;
 }
 
-QVector<TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoryData(QSqlQuery &query) const
+// Modified entries are moved back from the archives, so the changes apply to the whole neighbourhood
+bool TimeLogHistoryWorker::restoreArchives(const QVector<QUuid> &uuids, const QVector<QDateTime> &starts,
+                                           const QString &category)
 {
-    QVector<TimeLogSyncDataCategory> result;
+    QVector<Archive> archives;
+    if (!getArchives(archives)) {
+        return false;
+    } else if (archives.isEmpty()) {
+        return true;
+    }
 
-    if (!query.exec()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QVector<qint64> affectedStarts;
+    for (const QDateTime &start: starts) {
+        if (start.isValid()) {
+            affectedStarts.append(start.toTime_t());
+        }
     }
 
-    while (query.next()) {
-        TimeLogSyncDataCategory data;
-        data.category.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
-        data.category.name = query.value(1).toString();
+    // Entries in the main DB are affected at their current start
+    QSet<QUuid> foundUuids;
+    for (int offset = 0; offset < uuids.size(); offset += lookupChunkSize) {
+        int count = qMin(lookupChunkSize, uuids.size() - offset);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
 
-        if (!query.value(2).isNull()) {
-            QByteArray jsonString = query.value(2).toByteArray();
-            QJsonParseError parseError;
-            QJsonDocument document = QJsonDocument::fromJson(jsonString, &parseError);
-            if (parseError.error != QJsonParseError::NoError) {
-                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to parse category data JSON:"
-                                                    << jsonString << "error at offset"
-                                                    << parseError.offset
-                                                    << parseError.errorString() << parseError.error;
-                emit error(tr("Fail to parse category data: %1").arg(parseError.errorString()));
-                return result;
-            }
-            data.category.data = document.object().toVariantMap();
+        QString queryString = QString("SELECT uuid, start FROM timelog WHERE uuid IN (%1)").arg(placeholders);
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        for (int i = offset; i < offset + count; i++) {
+            query.addBindValue(uuids.at(i).toRfc4122());
         }
 
-        data.sync.isRemoved = !data.category.isValid();
-        data.sync.mTime = QDateTime::fromMSecsSinceEpoch(query.value(3).toLongLong(), Qt::UTC);
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
 
-        result.append(data);
+        while (query.next()) {
+            foundUuids.insert(QUuid::fromRfc4122(query.value(0).toByteArray()));
+            affectedStarts.append(query.value(1).toLongLong());
+        }
+        query.finish();
     }
 
+    QString queryString("SELECT min(start) FROM timelog");
+    if (!prepareAndExecQuery(query, queryString)) {
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
+    }
+    query.next();
+    bool isEmpty = query.isNull(0);
+    qint64 firstStart = query.value(0).toLongLong();
     query.finish();
 
-    return result;
-}
+    QSet<int> restoredIndices;
+    for (qint64 start: affectedStarts) {
+        for (int i = 0; i < archives.size(); i++) {
+            if (start >= archives.at(i).start && start < archives.at(i).end) {
+                restoredIndices.insert(i);
+            }
+        }
+        // Duration and preceding start of the first entry in the main DB refer to the latest archive
+        if (start >= archives.last().end && (isEmpty || start <= firstStart)) {
+            restoredIndices.insert(archives.size() - 1);
+        }
+    }
 
-TimeLogEntry TimeLogHistoryWorker::getEntry(const QUuid &uuid)
-{
-    TimeLogEntry entry;
+    if (!category.isEmpty()) {
+        queryString = "SELECT archive FROM archive_categories WHERE category=?";
+        if (!prepareCachedQuery(query, queryString)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        query.addBindValue(category);
 
-    if (!m_entryQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString = QString("%1 WHERE uuid=:uuid").arg(selectFields);
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
-            return entry;
+        if (!execQuery(query)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.executedQuery() << query.boundValues();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
         }
 
-        m_entryQuery = query;
+        while (query.next()) {
+            qint64 archiveStart = query.value(0).toLongLong();
+            for (int i = 0; i < archives.size(); i++) {
+                if (archives.at(i).start == archiveStart) {
+                    restoredIndices.insert(i);
+                }
+            }
+        }
+        query.finish();
     }
 
-    m_entryQuery->bindValue(":uuid", uuid.toRfc4122());
-
-    QVector<TimeLogEntry> data = getHistory(*m_entryQuery);
-    if (!data.empty()) {
-        entry = data.first();
+    // Entries, missing in the main DB, are either new or archived
+    QVector<QUuid> missingUuids;
+    for (const QUuid &uuid: uuids) {
+        if (!foundUuids.contains(uuid)) {
+            missingUuids.append(uuid);
+        }
     }
-    return entry;
-}
 
-QVector<TimeLogEntry> TimeLogHistoryWorker::getEntries(const QString &category) const
-{
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("%1 WHERE category=?").arg(selectFields);
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return QVector<TimeLogEntry>();
-    }
-    query.addBindValue(category);
+    for (int i = 0; i < archives.size() && !missingUuids.isEmpty(); i++) {
+        if (restoredIndices.contains(i) || !attachArchive(archivePath(archives.at(i).start), "archive")) {
+            continue;
+        }
 
-    return getHistory(query);
-}
+        bool isFound = false;
+        {
+            QSqlQuery archiveQuery(db);
+            for (int offset = 0; offset < missingUuids.size() && !isFound; offset += lookupChunkSize) {
+                int count = qMin(lookupChunkSize, missingUuids.size() - offset);
+                QString placeholders = QString("?,").repeated(count);
+                placeholders.chop(1);
+
+                QVariantList values;
+                for (int j = offset; j < offset + count; j++) {
+                    values.append(missingUuids.at(j).toRfc4122());
+                }
 
-QVector<TimeLogSyncDataEntry> TimeLogHistoryWorker::getSyncEntriesAffected(const QUuid &uuid)
-{
-    if (!m_syncAffectedQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString("WITH result AS ( "
-                            "    SELECT uuid, start, category, comment, mtime FROM timelog "
-                            "    WHERE uuid=:uuid "
-                            "UNION ALL "
-                            "    SELECT uuid, NULL, NULL, NULL, mtime FROM timelog_removed "
-                            "    WHERE uuid=:uuid "
-                            ") "
-                            "SELECT * FROM result ORDER BY mtime DESC LIMIT 1");
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
-            return QVector<TimeLogSyncDataEntry>();
+                queryString = QString("SELECT count(*) FROM archive.timelog WHERE uuid IN (%1)").arg(placeholders);
+                if (!execArchiveQuery(archiveQuery, queryString, values)) {
+                    break;
+                }
+
+                archiveQuery.next();
+                isFound = archiveQuery.value(0).toLongLong() > 0;
+                archiveQuery.finish();
+            }
         }
+        detachArchive("archive");
 
-        m_syncAffectedQuery = query;
+        if (isFound) {
+            restoredIndices.insert(i);
+        }
     }
 
-    m_syncAffectedQuery->bindValue(":uuid", uuid.toRfc4122());
+    for (int i = 0; i < archives.size(); i++) {
+        if (restoredIndices.contains(i) && !restoreArchive(archives.at(i))) {
+            return false;
+        }
+    }
 
-    return getSyncEntryData(*m_syncAffectedQuery);
+    return true;
 }
 
-QVector<TimeLogSyncDataCategory> TimeLogHistoryWorker::getSyncCategoriesAffected(const QUuid &uuid)
+// The driver does not expose the SQLite online backup API, so the tables are copied to the file, opened as
+// main DB of own connection, from the attached source in a single read transaction. The source isn't locked
+// for writing, so in WAL mode the writer goes on, while the copy is consistent with the snapshot at the start.
+// Statements of this connection are not audited, the plans could only be explained on it.
+bool TimeLogHistoryWorker::openBackup(const QString &filePath)
 {
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("WITH result AS ( "
-                        "    SELECT uuid, category, data, mtime FROM categories "
-                        "    WHERE uuid=:uuid "
-                        "UNION ALL "
-                        "    SELECT uuid, NULL, NULL, mtime FROM categories_removed "
-                        "    WHERE uuid=:uuid "
-                        ") "
-                        "SELECT * FROM result ORDER BY mtime ASC");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return QVector<TimeLogSyncDataCategory>();
+    m_backup.filePath = filePath;
+    m_backup.connectionName = QString("%1_backup").arg(m_connectionName);
+    m_backup.tables.clear();
+    m_backup.tableIndex = 0;
+    m_backup.lastRowid = 0;
+    m_backup.copied = 0;
+    m_backup.total = 0;
+    m_backup.textIndexes.clear();
+    m_backup.finalStatements.clear();
+    m_backup.isSequenceUsed = false;
+    m_backup.schemaVersion = 0;
+
+    // Incomplete copy is written to the temporary file, so the existing one is only replaced by the complete
+    QString partPath(QString("%1.part").arg(filePath));
+    if (QFile::exists(partPath) && !QFile::remove(partPath)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to remove file" << partPath;
+        emit error(tr("Fail to remove file %1").arg(partPath));
+        return false;
     }
-    query.bindValue(":uuid", uuid.toRfc4122());
-
-    return getSyncCategoryData(query);
-}
 
-bool TimeLogHistoryWorker::getSyncDataExists(const QDateTime &mBegin, const QDateTime &mEnd) const
-{
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString("SELECT mtime FROM (SELECT coalesce( "
-                        "    (SELECT mtime FROM timelog "
-                        "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
-                        "    (SELECT mtime FROM timelog_removed "
-                        "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
-                        "    (SELECT mtime FROM categories "
-                        "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1), "
-                        "    (SELECT mtime FROM categories_removed "
-                        "        WHERE mtime BETWEEN :mBegin AND :mEnd LIMIT 1) "
-                        ") AS mtime) WHERE mtime IS NOT NULL");
-    if (!query.prepare(queryString)) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
-                                            << query.lastQuery();
-        emit error(tr("DB error: %1").arg(query.lastError().text()));
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_backup.connectionName);
+    db.setDatabaseName(partPath);
+    if (!db.open()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to open backup db:" << db.lastError().text();
+        emit error(tr("DB error: %1").arg(db.lastError().text()));
         return false;
     }
-    query.bindValue(":mBegin", mBegin.toMSecsSinceEpoch());
-    query.bindValue(":mEnd", mEnd.toMSecsSinceEpoch());
 
-    if (!query.exec()) {
+    QSqlQuery query(db);
+    // Incomplete copy is removed anyway, it doesn't need the journal
+    if (!query.exec("PRAGMA journal_mode = OFF;")) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
-                                            << query.executedQuery() << query.boundValues();
+                                            << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
 
-    bool result = query.next();
-    query.finish();
-
-    return result;
-}
-
-QMap<QDateTime, QByteArray> TimeLogHistoryWorker::getDataHashes(const QDateTime &maxDate) const
-{
-    QMap<QDateTime, QByteArray> result;
-
-    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-    QSqlQuery query(db);
-    QString queryString = QString("SELECT start, hash FROM hashes %1 ORDER BY start ASC")
-                                  .arg(maxDate.isValid() ? "WHERE start <= ?" : "");
-    if (!query.prepare(queryString)) {
+    if (!query.prepare("ATTACH DATABASE ? AS backup_source;")) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
-    }
-    if (maxDate.isValid()) {
-        query.addBindValue(maxDate.toTime_t());
+        return false;
     }
-
+    query.addBindValue(QSqlDatabase::database(m_connectionName).databaseName());
     if (!query.exec()) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
+        return false;
     }
 
-    while (query.next()) {
-        result.insert(QDateTime::fromTime_t(query.value(0).toUInt(), Qt::UTC),
-                      query.value(1).toByteArray());
+    if (!startTransaction(db)) {
+        return false;
     }
 
-    query.finish();
-
-    return result;
-}
-
-void TimeLogHistoryWorker::notifyInsertUpdates(const TimeLogEntry &data)
-{
-    if (!m_notifyInsertQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString = QString("SELECT * FROM ( "
-                                      "    %1 WHERE start <= :newStart ORDER BY start DESC LIMIT 2 "
-                                      ") "
-                                      "UNION "
-                                      "SELECT * FROM ( "
-                                      "    %1 WHERE start > :newStart ORDER BY start ASC LIMIT 1 "
-                                      ") ORDER BY start ASC").arg(selectFields);
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
-            return;
-        }
-
-        m_notifyInsertQuery = query;
+    // The first read takes the snapshot, everything else is read in it
+    QString queryString("SELECT type, name, sql FROM backup_source.sqlite_master "
+                        "WHERE sql NOT NULL ORDER BY rowid ASC");
+    if (!query.exec(queryString)) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                            << query.lastQuery();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
     }
 
-    m_notifyInsertQuery->bindValue(":newStart", data.startTime.toTime_t());
+    QStringList tableStatements;
+    while (query.next()) {
+        QString type(query.value(0).toString());
+        QString name(query.value(1).toString());
+        QString sql(query.value(2).toString());
+        if (type != "table") {
+            m_backup.finalStatements.append(sql);
+            continue;
+        } else if (name.startsWith("sqlite_")) {
+            // Internal tables are created by SQLite, only the autoincrement sequence is kept
+            m_backup.isSequenceUsed = m_backup.isSequenceUsed || name == "sqlite_sequence";
+            continue;
+        } else if (sql.startsWith("CREATE VIRTUAL TABLE", Qt::CaseInsensitive)) {
+            m_backup.textIndexes.append(name);
+            tableStatements.append(sql);
+            continue;
+        }
 
-    notifyUpdates(*m_notifyInsertQuery);
-}
+        // Shadow tables of the virtual ones are created with them
+        bool isShadow = false;
+        for (const QString &textIndex: m_backup.textIndexes) {
+            if (name.startsWith(QString("%1_").arg(textIndex))) {
+                isShadow = true;
+                break;
+            }
+        }
+        if (isShadow) {
+            continue;
+        }
 
-void TimeLogHistoryWorker::notifyInsertUpdates(const QVector<TimeLogEntry> &data)
-{
-    foreach (const TimeLogEntry &entry, data) {
-        notifyInsertUpdates(entry);    // TODO: optimize
+        tableStatements.append(sql);
+        m_backup.tables.append({ name, !sql.contains("WITHOUT ROWID", Qt::CaseInsensitive) });
     }
-}
+    query.finish();
 
-void TimeLogHistoryWorker::notifyRemoveUpdates(const TimeLogEntry &data)
-{
-    if (!m_notifyRemoveQuery) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString = QString("SELECT * FROM ( "
-                                      "    %1 WHERE start < :oldStart ORDER BY start DESC LIMIT 1 "
-                                      ") "
-                                      "UNION "
-                                      "SELECT * FROM ( "
-                                      "    %1 WHERE start > :oldStart ORDER BY start ASC LIMIT 1 "
-                                      ") ORDER BY start ASC").arg(selectFields);
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
-            return;
+    for (const QString &statement: tableStatements) {
+        if (!query.exec(statement)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << statement;
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
         }
+    }
 
-        m_notifyRemoveQuery = query;
+    if (!query.exec("PRAGMA backup_source.user_version;") || !query.next()) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to get schema version:" << query.lastError().text();
+        emit error(tr("DB error: %1").arg(query.lastError().text()));
+        return false;
     }
+    m_backup.schemaVersion = query.value(0).toLongLong();
+    query.finish();
 
-    m_notifyRemoveQuery->bindValue(":oldStart", data.startTime.toTime_t());
+    for (const Backup::Table &table: m_backup.tables) {
+        if (!query.exec(QString("SELECT count(*) FROM backup_source.\"%1\"").arg(table.name)) || !query.next()) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << query.lastQuery();
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        m_backup.total += query.value(0).toLongLong();
+        query.finish();
+    }
 
-    notifyUpdates(*m_notifyRemoveQuery);
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Backup to" << filePath << "tables:" << m_backup.tables.size()
+                                     << "rows:" << m_backup.total;
+
+    return true;
 }
 
-void TimeLogHistoryWorker::notifyEditUpdates(const TimeLogEntry &data, TimeLogHistory::Fields fields, QDateTime oldStart)
+bool TimeLogHistoryWorker::copyBackupStep(bool &isDone)
 {
-    QSqlQuery **requestQuery = (fields & TimeLogHistory::StartTime ? &m_notifyEditStartQuery
-                                                                   : &m_notifyEditQuery);
-    if (!(*requestQuery)) {
-        QSqlDatabase db = QSqlDatabase::database(m_connectionName);
-        QSqlQuery *query = new QSqlQuery(db);
-        QString queryString;
-        if (fields & TimeLogHistory::StartTime) {
-            queryString = QString("SELECT * FROM ( "
-                                  "    %1 WHERE start <= :newStart ORDER BY start DESC LIMIT 2 "
-                                  ") "
-                                  "UNION "
-                                  "SELECT * FROM ( "
-                                  "    %1 WHERE start > :newStart ORDER BY start ASC LIMIT 1 "
-                                  ") "
-                                  "UNION "
-                                  "SELECT * FROM ( "
-                                  "    %1 WHERE start < :oldStart ORDER BY start DESC LIMIT 1 "
-                                  ") "
-                                  "UNION "
-                                  "SELECT * FROM ( "
-                                  "    %1 WHERE start > :oldStart ORDER BY start ASC LIMIT 1 "
-                                  ") ORDER BY start ASC").arg(selectFields);
+    QSqlDatabase db = QSqlDatabase::database(m_backup.connectionName);
+    QSqlQuery query(db);
+
+    int remaining = backupStepSize;
+    while (remaining > 0 && m_backup.tableIndex < m_backup.tables.size()) {
+        const Backup::Table &table = m_backup.tables.at(m_backup.tableIndex);
+        bool isTableDone = true;
+        if (table.isRowid) {
+            // Rows are taken by the rowid ranges, so each step starts by the index, where the previous stopped
+            QString queryString = QString("SELECT max(id) FROM (SELECT rowid AS id FROM backup_source.\"%1\" "
+                                          "WHERE rowid > ? ORDER BY rowid ASC LIMIT ?)").arg(table.name);
+            if (!query.prepare(queryString)) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                    << query.lastQuery();
+                emit error(tr("DB error: %1").arg(query.lastError().text()));
+                return false;
+            }
+            query.addBindValue(m_backup.lastRowid);
+            query.addBindValue(remaining);
+            if (!query.exec() || !query.next()) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                    << query.executedQuery() << query.boundValues();
+                emit error(tr("DB error: %1").arg(query.lastError().text()));
+                return false;
+            }
+            QVariant maxRowid(query.value(0));
+            query.finish();
+
+            if (!maxRowid.isNull()) {
+                queryString = QString("INSERT INTO main.\"%1\" SELECT * FROM backup_source.\"%1\" "
+                                      "WHERE rowid > ? AND rowid <= ?").arg(table.name);
+                if (!query.prepare(queryString)) {
+                    qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
+                                                        << query.lastQuery();
+                    emit error(tr("DB error: %1").arg(query.lastError().text()));
+                    return false;
+                }
+                query.addBindValue(m_backup.lastRowid);
+                query.addBindValue(maxRowid);
+                if (!query.exec()) {
+                    qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                        << query.executedQuery() << query.boundValues();
+                    emit error(tr("DB error: %1").arg(query.lastError().text()));
+                    return false;
+                }
+
+                int count = query.numRowsAffected();
+                m_backup.lastRowid = maxRowid.toLongLong();
+                m_backup.copied += count;
+                remaining -= count;
+                isTableDone = remaining > 0;
+            }
         } else {
-            queryString = QString("%1 WHERE start=:start").arg(selectFields);   // TODO: lookup by uuid
-        }
-        if (!query->prepare(queryString)) {
-            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:"
-                                                << query->lastError().text()
-                                                << query->lastQuery();
-            emit error(tr("DB error: %1").arg(query->lastError().text()));
-            delete query;
-            return;
+            // Tables without rowid are small, they are copied at once
+            QString queryString = QString("INSERT INTO main.\"%1\" SELECT * FROM backup_source.\"%1\"")
+                                  .arg(table.name);
+            if (!query.exec(queryString)) {
+                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                    << query.lastQuery();
+                emit error(tr("DB error: %1").arg(query.lastError().text()));
+                return false;
+            }
+
+            int count = query.numRowsAffected();
+            m_backup.copied += count;
+            remaining -= count;
         }
 
-        *requestQuery = query;
+        if (isTableDone) {
+            m_backup.tableIndex++;
+            m_backup.lastRowid = 0;
+        }
     }
 
-    if (fields & TimeLogHistory::StartTime) {
-        (*requestQuery)->bindValue(":newStart", data.startTime.toTime_t());
-        (*requestQuery)->bindValue(":oldStart", oldStart.toTime_t());
-        fields |= TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart;
-    } else {
-        (*requestQuery)->bindValue(":start", data.startTime.toTime_t());
-    }
+    isDone = m_backup.tableIndex >= m_backup.tables.size();
 
-    notifyUpdates(**requestQuery, fields);
+    return true;
 }
 
-void TimeLogHistoryWorker::notifyUpdates(QSqlQuery &query, TimeLogHistory::Fields fields) const
+bool TimeLogHistoryWorker::finishBackup()
 {
-    QVector<TimeLogEntry> updatedData = getHistory(query);
-    QVector<TimeLogHistory::Fields> updatedFields;
+    QSqlDatabase db = QSqlDatabase::database(m_backup.connectionName);
+    QSqlQuery query(db);
 
-    if (!updatedData.isEmpty()) {
-        qCDebug(HISTORY_WORKER_CATEGORY) << "Updated entries count:" << updatedData.size();
-        updatedFields.insert(0, updatedData.size(), fields);
-        emit dataUpdated(updatedData, updatedFields);
+    QStringList statements;
+    // Copied rows already advanced the sequence, but it could be ahead of them after the removals
+    if (m_backup.isSequenceUsed) {
+        statements.append("DELETE FROM main.sqlite_sequence;");
+        statements.append("INSERT INTO main.sqlite_sequence SELECT * FROM backup_source.sqlite_sequence;");
     }
-}
+    for (const QString &textIndex: m_backup.textIndexes) {
+        statements.append(QString("INSERT INTO main.\"%1\" (\"%1\") VALUES ('rebuild');").arg(textIndex));
+    }
+    // Indexes are faster to build at once, triggers should not be fired by the copied data
+    statements.append(m_backup.finalStatements);
+    statements.append(QString("PRAGMA main.user_version = %1;").arg(m_backup.schemaVersion));
 
-bool TimeLogHistoryWorker::startTransaction(QSqlDatabase &db)
-{
-    if (!db.transaction()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to start transaction:" << db.lastError().text();
-        emit error(tr("DB error: %1").arg(db.lastError().text()));
-        return false;
+    for (const QString &statement: statements) {
+        if (!query.exec(statement)) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
+                                                << statement;
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
     }
 
-    return true;
+    return commitTransaction(db);
 }
 
-bool TimeLogHistoryWorker::commitTransaction(QSqlDatabase &db)
+void TimeLogHistoryWorker::closeBackup(bool isSuccess)
 {
-    if (!db.commit()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to commit transaction:" << db.lastError().text();
-        emit error(tr("DB error: %1").arg(db.lastError().text()));
-        rollbackTransaction(db);
-        return false;
+    QString filePath(m_backup.filePath);
+    QString partPath(QString("%1.part").arg(filePath));
+
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_backup.connectionName, false);
+        if (db.isOpen()) {
+            if (!isSuccess) {
+                db.rollback();
+            }
+            db.close();
+        }
     }
+    QSqlDatabase::removeDatabase(m_backup.connectionName);
+    m_backup.connectionName.clear();
+    m_backup.filePath.clear();
 
-    return true;
-}
+    if (isSuccess && ((QFile::exists(filePath) && !QFile::remove(filePath)) || !QFile::rename(partPath, filePath))) {
+        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to replace file" << filePath;
+        emit error(tr("Fail to replace file %1").arg(filePath));
+        isSuccess = false;
+    }
 
-void TimeLogHistoryWorker::rollbackTransaction(QSqlDatabase &db)
-{
-    if (!db.rollback()) {
-        qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to rollback transaction:" << db.lastError().text();
-        emit error(tr("DB error: %1").arg(db.lastError().text()));
+    if (!isSuccess) {
+        QFile::remove(partPath);
     }
-}
 
-QString TimeLogHistoryWorker::fixCategoryName(const QString &name) const
-{
-    return name.split(m_categorySplitRegexp, QString::SkipEmptyParts).join(" > ").trimmed();
+    qCDebug(HISTORY_WORKER_CATEGORY) << "Backup to" << filePath << "finished, result:" << isSuccess;
+
+    emit backupFinished(filePath, isSuccess);
 }
 
-bool TimeLogHistoryWorker::fetchCategories()
+bool TimeLogHistoryWorker::startMaintenance(bool isForced)
 {
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    // FULL OUTER JOIN
-    QString queryString("WITH t AS (SELECT category, count(*) AS count FROM timelog GROUP BY category), "
-                        "    c AS (SELECT uuid, category, data FROM categories) "
-                        "SELECT "
-                        "    c.uuid AS uuid, "
-                        "    ifnull(c.category, t.category) AS category, "
-                        "    ifnull(t.count, 0) AS count, "
-                        "    c.data AS data "
-                        "FROM t LEFT OUTER JOIN c ON t.category = c.category "
-                        "UNION ALL "
-                        "SELECT "
-                        "    c.uuid AS uuid, "
-                        "    ifnull(c.category, t.category) AS category, "
-                        "    ifnull(t.count, 0) AS count, "
-                        "    c.data AS data "
-                        "FROM c LEFT OUTER JOIN t ON t.category = c.category WHERE t.category IS NULL");
+    QString queryString;
+
+    qlonglong pragmaValues[3];
+    const char *pragmas[] = { "auto_vacuum", "freelist_count", "page_count" };
+    for (int i = 0; i < 3; i++) {
+        queryString = QString("PRAGMA %1;").arg(pragmas[i]);
+        if (!prepareAndExecQuery(query, queryString) || !query.next()) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        pragmaValues[i] = query.value(0).toLongLong();
+        query.finish();
+    }
+
+    QHash<QString, qint64> times;
+    queryString = "SELECT task, time FROM maintenance;";
     if (!prepareAndExecQuery(query, queryString)) {
         emit error(tr("DB error: %1").arg(query.lastError().text()));
         return false;
     }
-
-    QMap<QString, TimeLogCategory> resultData;
-    QHash<QString, int> resultRecordsCount;
-    qlonglong size = 0;
-
     while (query.next()) {
-        TimeLogCategory category;
-
-        if (!query.value(0).isNull()) {
-            category.uuid = QUuid::fromRfc4122(query.value(0).toByteArray());
-        }   // Entry-only category has null uuid
-
-        category.name = query.value(1).toString();
+        times.insert(query.value(0).toString(), query.value(1).toLongLong());
+    }
+    query.finish();
 
-        int count = query.value(2).toInt();
+    qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
 
-        if (!query.value(3).isNull()) {
-            QByteArray jsonString = query.value(3).toByteArray();
-            QJsonParseError parseError;
-            QJsonDocument document = QJsonDocument::fromJson(jsonString, &parseError);
-            if (parseError.error != QJsonParseError::NoError) {
-                qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to parse category data JSON:"
-                                                    << jsonString << "error at offset"
-                                                    << parseError.offset
-                                                    << parseError.errorString() << parseError.error;
-                emit error(tr("Fail to parse category data: %1").arg(parseError.errorString()));
-                return false;
-            }
-            category.data = document.object().toVariantMap();
+    m_maintenance.steps.clear();
+    m_maintenance.tables.clear();
+    m_maintenance.done = 0;
+    // Value 2 is the incremental mode, full vacuum of the converted DB also frees all the pages
+    if (pragmaValues[0] != 2) {
+        if (isForced || pragmaValues[1] * 100 >= pragmaValues[2] * fullVacuumFreePercent) {
+            m_maintenance.steps.append(Maintenance::FullVacuum);
         }
-
-        resultData.insert(category.name, category);
-        resultRecordsCount.insert(category.name, count);
-
-        size += count;
+    } else if (pragmaValues[1] > 0) {
+        int vacuumSteps = qMin((pragmaValues[1] + vacuumStepPages - 1) / vacuumStepPages, qlonglong(maxVacuumSteps));
+        m_maintenance.steps.insert(m_maintenance.steps.size(), vacuumSteps, Maintenance::IncrementalVacuum);
+    }
+    if (isForced || now - times.value("analyze") >= analyzeInterval) {
+        m_maintenance.steps.insert(m_maintenance.steps.size(), analyzedTables.size(), Maintenance::Analyze);
+        m_maintenance.tables = analyzedTables;
+    }
+    if (isForced || now - times.value("integrity_check") >= integrityCheckInterval) {
+        m_maintenance.steps.append(Maintenance::IntegrityCheck);
     }
 
-    query.finish();
-
-    m_categories.swap(resultData);
-    m_categoryRecordsCount.swap(resultRecordsCount);
+    if (m_maintenance.steps.isEmpty()) {
+        return true;
+    }
 
-    setSize(size);
+    qCInfo(HISTORY_WORKER_CATEGORY) << "Starting DB maintenance, steps:" << m_maintenance.steps.size()
+                                    << "free pages:" << pragmaValues[1];
 
-    updateCategories();
+    m_maintenance.isActive = true;
+    emit maintenanceProgress(0, m_maintenance.steps.size());
+    postMaintenanceStep();
 
     return true;
 }
 
-bool TimeLogHistoryWorker::checkIsDBEmpty()
+void TimeLogHistoryWorker::postMaintenanceStep()
 {
-    return (m_size == 0 && m_categories.isEmpty() && !getSyncDataExists());
+    // Same priority as the background requests of the history, so the step is queued after the pending ones
+    QCoreApplication::postEvent(this, new TimeLogHistoryRequest([this]() { maintenanceStep(); }),
+                                Qt::LowEventPriority);
 }
 
-bool TimeLogHistoryWorker::populateCategories()
+bool TimeLogHistoryWorker::runMaintenanceStep(Maintenance::Task task)
 {
-    QVector<TimeLogCategory> defaultCategories(TimeLogDefaultCategories::defaultCategories());
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    QString queryString;
 
-    for (const TimeLogCategory &category: defaultCategories) {
-        // Use 0 mTime to make edited categories be newer than populated ones
-        TimeLogSyncDataCategory syncCategory(category, QDateTime::fromMSecsSinceEpoch(0, Qt::UTC));
-        if (!addCategoryData(syncCategory)) {
-            return false;
+    switch (task) {
+    case Maintenance::FullVacuum:
+        // Fails with the statements in progress, so all of them are reset first
+        for (QSqlQuery *statement: { m_insertQuery, m_removeQuery, m_notifyInsertQuery, m_notifyRemoveQuery,
+                                     m_notifyEditQuery, m_notifyEditStartQuery, m_entryQuery }) {
+            if (statement) {
+                statement->finish();
+            }
         }
-    }
-
-    return true;
-}
-
-void TimeLogHistoryWorker::updateCategories()
-{
-    m_categoryTree = parseCategories(m_categories.keys());
-
-    emit categoriesChanged(m_categoryTree);
-}
+        m_queryCache.clear();
 
-QSharedPointer<TimeLogCategoryTreeNode> TimeLogHistoryWorker::parseCategories(const QStringList &categories) const
-{
-    TimeLogCategoryTreeNode *rootCategory = new TimeLogCategoryTreeNode("RootCategory");
-
-    for (const QString &category: categories) {
-        QStringList categoryFields = category.split(m_categorySplitRegexp, QString::SkipEmptyParts);
-        TimeLogCategoryTreeNode *parentCategory = rootCategory;
-        for (const QString &categoryField: categoryFields) {
-            TimeLogCategoryTreeNode *categoryObject = parentCategory->children().value(categoryField);
-            if (!categoryObject) {
-                categoryObject = new TimeLogCategoryTreeNode(categoryField, parentCategory);
-                QString fullName(categoryObject->fullName());
-                categoryObject->category = m_categories.value(categoryObject->fullName());
-                categoryObject->hasItems = m_categoryRecordsCount.value(fullName) > 0;
+        // Auto vacuum mode of the existing DB is changed only by the full vacuum
+        if (!prepareAndExecQuery(query, "PRAGMA auto_vacuum = INCREMENTAL;")
+            || !prepareAndExecQuery(query, "VACUUM;")) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        qCInfo(HISTORY_WORKER_CATEGORY) << "DB is converted to the incremental vacuum";
+        return true;
+    case Maintenance::IncrementalVacuum:
+        queryString = QString("PRAGMA incremental_vacuum(%1);").arg(vacuumStepPages);
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        // Pages are freed while the statement is stepped
+        while (query.next()) {
+        }
+        return true;
+    case Maintenance::Analyze:
+        queryString = QString("ANALYZE %1;").arg(m_maintenance.tables.takeFirst());
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        return !m_maintenance.tables.isEmpty() || setMaintenanceTime("analyze");
+    case Maintenance::IntegrityCheck: {
+        queryString = "PRAGMA quick_check;";
+        if (!prepareAndExecQuery(query, queryString)) {
+            emit error(tr("DB error: %1").arg(query.lastError().text()));
+            return false;
+        }
+        QStringList errors;
+        while (query.next()) {
+            QString result(query.value(0).toString());
+            if (result != "ok") {
+                errors.append(result);
             }
-            parentCategory = categoryObject;
         }
+        query.finish();
+
+        if (!errors.isEmpty()) {
+            qCCritical(HISTORY_WORKER_CATEGORY) << "DB integrity check failed:" << errors;
+            emit error(tr("DB integrity check failed: %1").arg(errors.join("; ")));
+            return false;
+        }
+        return setMaintenanceTime("integrity_check");
+    }
     }
 
-    return QSharedPointer<TimeLogCategoryTreeNode>(rootCategory);
+    return false;
 }
 
-QByteArray TimeLogHistoryWorker::calcHash(const QDateTime &begin, const QDateTime &end) const
+bool TimeLogHistoryWorker::setMaintenanceTime(const QString &task, qint64 time)
 {
-    QByteArray result;
-
     QSqlDatabase db = QSqlDatabase::database(m_connectionName);
     QSqlQuery query(db);
-    QString queryString("WITH result AS ( "
-                        "    SELECT mtime, uuid FROM timelog "
-                        "    WHERE (mtime BETWEEN :mBegin AND :mEnd) "
-                        "UNION ALL "
-                        "    SELECT mtime, uuid FROM timelog_removed "
-                        "    WHERE (mtime BETWEEN :mBegin AND :mEnd) "
-                        "UNION ALL "
-                        "    SELECT mtime, uuid FROM categories "
-                        "    WHERE (mtime BETWEEN :mBegin AND :mEnd) "
-                        "UNION ALL "
-                        "    SELECT mtime, uuid FROM categories_removed "
-                        "    WHERE (mtime BETWEEN :mBegin AND :mEnd) "
-                        ") "
-                        "SELECT * FROM result ORDER BY mtime ASC, uuid ASC");
-    if (!query.prepare(queryString)) {
+    QString queryString("INSERT OR REPLACE INTO maintenance (task, time) VALUES (?,?);");
+    if (!prepareCachedQuery(query, queryString)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to prepare query:" << query.lastError().text()
                                             << query.lastQuery();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
+        return false;
     }
-    query.bindValue(":mBegin", begin.toMSecsSinceEpoch());
-    query.bindValue(":mEnd", end.toMSecsSinceEpoch());
+    query.addBindValue(task);
+    query.addBindValue(time);
 
-    if (!query.exec()) {
+    if (!execQuery(query)) {
         qCCritical(HISTORY_WORKER_CATEGORY) << "Fail to execute query:" << query.lastError().text()
                                             << query.executedQuery() << query.boundValues();
         emit error(tr("DB error: %1").arg(query.lastError().text()));
-        return result;
-    }
-
-    QByteArray hashData;
-    QDataStream dataStream(&hashData, QIODevice::WriteOnly);
-
-    while (query.next()) {
-        dataStream << query.value(0).toLongLong();
-        dataStream << query.value(1).toByteArray();
-    }
-
-    query.finish();
-
-    if (!hashData.isEmpty()) {
-        result = QCryptographicHash::hash(hashData, QCryptographicHash::Md5);
+        return false;
     }
 
-    return result;
+    return true;
 }
 
-void TimeLogHistoryWorker::pushUndo(const TimeLogHistoryWorker::Undo undo)
+void TimeLogHistoryWorker::finishMaintenance(bool result)
 {
-    m_undoStack.push(undo);
+    m_maintenance.isActive = false;
+    m_maintenance.steps.clear();
+    m_maintenance.tables.clear();
 
-    if (m_undoStack.size() > maxUndoSize) {
-        m_undoStack.takeFirst();
-    } else {
-        emit undoCountChanged(m_undoStack.size());
-    }
+    qCInfo(HISTORY_WORKER_CATEGORY) << "DB maintenance finished, result:" << result;
+
+    emit maintenanceFinished(result);
 }
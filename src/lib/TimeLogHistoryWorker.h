@@ -19,17 +19,53 @@
 #ifndef TIMELOGHISTORYWORKER_H
 #define TIMELOGHISTORYWORKER_H
 
+#include <functional>
+
 #include <QObject>
+#include <QEvent>
+#include <QMutex>
+#include <QAtomicInt>
 #include <QSqlQuery>
 #include <QSet>
-#include <QStack>
 #include <QSharedPointer>
 #include <QRegularExpression>
+#include <QCache>
+#include <QHash>
 
 #include "TimeLogHistory.h"
+#include "TimeLogConnectionProfile.h"
+
+class QTimer;
 
 class TimeLogCategoryTreeNode;
 
+// Call of the worker method, posted with the priority of the request
+class TimeLogHistoryRequest : public QEvent
+{
+public:
+    explicit TimeLogHistoryRequest(const std::function<void()> &call);
+
+    static QEvent::Type eventType();
+
+    void call() const;
+
+private:
+    std::function<void()> m_call;
+};
+
+// Ids of the cancelled history requests, shared between the threads
+class TimeLogCancelledRequests
+{
+public:
+    void insert(qlonglong id);
+    void remove(qlonglong id);
+    bool contains(qlonglong id) const;
+
+private:
+    mutable QMutex m_mutex;
+    QSet<qlonglong> m_ids;
+};
+
 class TimeLogHistoryWorker : public QObject
 {
     Q_OBJECT
@@ -38,23 +74,59 @@ public:
     ~TimeLogHistoryWorker();
 
     Q_INVOKABLE bool init(const QString &dataPath, const QString &filePath = QString(),
-                          bool isReadonly = false, bool isPopulateCategories = false);
+                          bool isReadonly = false, bool isPopulateCategories = false,
+                          const TimeLogConnectionProfile &profile = TimeLogConnectionProfile());
+    // Read-only open of the sync pack, serves only the sync data and the hashes requests
+    Q_INVOKABLE bool initPack(const QString &dataPath, const QString &filePath,
+                              const TimeLogConnectionProfile &profile);
+    // Reports the result with initFinished(), the DB is checked to have the expected recent entries
+    Q_INVOKABLE void initAsync(const QString &dataPath, const QString &filePath, bool isReadonly,
+                               bool isPopulateCategories, const TimeLogConnectionProfile &profile,
+                               const QVector<TimeLogEntry> &expectedEntries);
     Q_INVOKABLE void deinit();
+    // Cancelled requests are completed with empty data, should be set before moving to the thread
+    void setCancelledRequests(const QSharedPointer<TimeLogCancelledRequests> &cancelledRequests);
+    // Sync changes signals are not emitted unless enabled, could be called from any thread
+    void setSyncChangesEnabled(bool isEnabled);
     qlonglong size() const;
     QSharedPointer<TimeLogCategoryTreeNode> categories() const;
+    // Approximate memory usage of the caches and the DB connection stats, in the worker thread
+    QVariantMap diagnostics() const;
 
 public slots:
     void insert(const TimeLogEntry &data);
     void import(const QVector<TimeLogEntry> &data);
     void remove(const TimeLogEntry &data);
     void edit(const TimeLogEntry &data, TimeLogHistory::Fields fields);
+    // All the entries are changed in a single transaction and undone with a single undo
+    void removeBatch(const QVector<TimeLogEntry> &data);
+    void editBatch(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields);
     void addCategory(const TimeLogCategory &category);
     void removeCategory(const QString &name);
     void editCategory(const QString &oldName, const TimeLogCategory &category);
+    // Large syncs are split into slices, dataSynced() is emitted after the last one.
+    // Replies of the sync requests carry the requestId, 0 is for the requests of the history itself.
     void sync(const QVector<TimeLogSyncDataEntry> &updatedData,
               const QVector<TimeLogSyncDataEntry> &removedData,
-              const QVector<TimeLogSyncDataCategory> &categoryData);
-    void updateHashes();
+              const QVector<TimeLogSyncDataCategory> &categoryData,
+              bool isLastSlice = true, qlonglong requestId = 0);
+    void updateHashes(qlonglong requestId = 0);
+    void archive(const QDateTime &until);
+    void purgeRemoved(const QDateTime &until);
+    void barrier();
+    // Following reads of read-only connection see the same WAL snapshot until the end
+    void beginSnapshot();
+    void endSnapshot();
+    // Copies the DB to the file on a separate connection, one step per call, backupStep() is called
+    // after each backupProgress() until backupFinished()
+    void backup(const QString &filePath);
+    void backupStep();
+    // Vacuums, analyzes and checks the DB in steps, queued with the background priority, so the other
+    // requests are served between them. Started on idle automatically, the tasks which are not due are
+    // skipped unless forced. Conversion of the old DB is a single full vacuum, not forced one is done only
+    // with a large share of the free pages.
+    void maintain(bool isForced = false);
+    void maintenanceStep();
 
     void undo();
 
@@ -62,11 +134,17 @@ public slots:
                            const QDateTime &begin = QDateTime::fromTime_t(0, Qt::UTC),
                            const QDateTime &end = QDateTime::currentDateTimeUtc(),
                            const QString &category = QString(),
-                           bool withSubcategories = false) const;
+                           bool withSubcategories = false,
+                           uint chunkSize = 0) const;
     void getHistoryAfter(qlonglong id, const uint limit,
                          const QDateTime &from = QDateTime::fromTime_t(0, Qt::UTC)) const;
     void getHistoryBefore(qlonglong id, const uint limit,
                           const QDateTime &until = QDateTime::currentDateTimeUtc()) const;
+    void searchComments(qlonglong id, const QString &text,
+                        const QDateTime &begin = QDateTime::fromTime_t(0, Qt::UTC),
+                        const QDateTime &end = QDateTime::currentDateTimeUtc(),
+                        const QString &category = QString(),
+                        bool withSubcategories = false) const;
 
     void getStoredCategories() const;
 
@@ -74,51 +152,77 @@ public slots:
                   const QDateTime &end = QDateTime::currentDateTimeUtc(),
                   const QString &category = QString(),
                   const QString &separator = ">") const;
+    void getStatsSeries(const QDateTime &begin, const QDateTime &end, int bucket, int depth = 1,
+                        const QString &category = QString(), const QString &separator = ">") const;
 
     void getSyncData(const QDateTime &mBegin = QDateTime(),
-                     const QDateTime &mEnd = QDateTime()) const;
+                     const QDateTime &mEnd = QDateTime(), qlonglong requestId = 0) const;
     void getSyncExists(const QDateTime &mBegin = QDateTime::fromMSecsSinceEpoch(0, Qt::UTC),
                        const QDateTime &mEnd = QDateTime::currentDateTimeUtc()) const;
     void getSyncAmount(const QDateTime &mBegin = QDateTime::fromMSecsSinceEpoch(0, Qt::UTC),
                        const QDateTime &mEnd = QDateTime::currentDateTimeUtc()) const;
 
-    void getHashes(const QDateTime &maxDate = QDateTime(), bool noUpdate = false);
+    void getHashes(const QDateTime &maxDate = QDateTime(), bool noUpdate = false, qlonglong requestId = 0);
+    void getDayHashes(const QDateTime &begin, const QDateTime &end, qlonglong requestId = 0) const;
+
+    void saveSnapshot(const QString &filePath, int entriesCount) const;
+    // Replies with diagnosticsAvailable(), readerIndex is -1 for the writer
+    void getDiagnostics(int readerIndex) const;
 
 signals:
+    void initFinished(bool result) const;
     void error(const QString &errorText) const;
     void dataOutdated() const;
     void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id) const;
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id) const;
     void storedCategoriesAvailable(QVector<TimeLogCategory> data) const;
     void dataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields) const;
     void dataInserted(const TimeLogEntry &data) const;
     void dataImported(QVector<TimeLogEntry> data) const;
     void dataRemoved(const TimeLogEntry &data) const;
+    void dataBatchRemoved(QVector<TimeLogEntry> data) const;
     void statsDataAvailable(QVector<TimeLogStats> data, QDateTime until) const;
+    void statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until) const;
     void syncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
-                           QVector<TimeLogSyncDataCategory> categoryData, QDateTime until) const;
+                           QVector<TimeLogSyncDataCategory> categoryData, QDateTime until,
+                           qlonglong requestId) const;
     void syncAmountAvailable(qlonglong size, QDateTime maxMTime, QDateTime mBegin, QDateTime mEnd) const;
     void syncExistsAvailable(bool isExists, QDateTime mBegin, QDateTime mEnd) const;
-    void syncEntryStatsAvailable(QVector<TimeLogSyncDataEntry> removedOld,
-                                 QVector<TimeLogSyncDataEntry> removedNew,
-                                 QVector<TimeLogSyncDataEntry> insertedOld,
-                                 QVector<TimeLogSyncDataEntry> insertedNew,
-                                 QVector<TimeLogSyncDataEntry> updatedOld,
-                                 QVector<TimeLogSyncDataEntry> updatedNew) const;
-    void syncCategoryStatsAvailable(QVector<TimeLogSyncDataCategory> removedOld,
-                                    QVector<TimeLogSyncDataCategory> removedNew,
-                                    QVector<TimeLogSyncDataCategory> addedOld,
-                                    QVector<TimeLogSyncDataCategory> addedNew,
-                                    QVector<TimeLogSyncDataCategory> updatedOld,
-                                    QVector<TimeLogSyncDataCategory> updatedNew) const;
-    void hashesAvailable(QMap<QDateTime, QByteArray> hashes) const;
-    void dataSynced(QDateTime maxSyncDate) const;
-    void hashesUpdated() const;
+    void syncEntryStatsAvailable(QSharedPointer<TimeLogSyncEntryChanges> changes) const;
+    void syncCategoryStatsAvailable(QSharedPointer<TimeLogSyncCategoryChanges> changes) const;
+    void hashesAvailable(QMap<QDateTime, QByteArray> hashes, qlonglong requestId) const;
+    void dayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end,
+                            qlonglong requestId) const;
+    void dataSynced(QDateTime maxSyncDate, qlonglong requestId) const;
+    void hashesUpdated(qlonglong requestId) const;
+    void dataArchived(QDateTime until) const;
+    void removedPurged(QDateTime until) const;
+    void barrierPassed() const;
+    void syncFinished() const;
+    void backupProgress(qlonglong copied, qlonglong total) const;
+    void backupFinished(QString filePath, bool result) const;
+    void maintenanceProgress(int done, int total) const;
+    void maintenanceFinished(bool result) const;
+    void diagnosticsAvailable(QVariantMap data, int readerIndex) const;
 
     void sizeChanged(qlonglong size) const;
     void categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode> categories) const;
     void undoCountChanged(int undoCount) const;
 
+protected:
+    virtual bool event(QEvent *event);
+
+private slots:
+    void maintenanceIdle();
+
 private:
+    enum SyncChangeKind {
+        EntryChange,
+        RemovedEntryChange,
+        CategoryChange,
+        RemovedCategoryChange
+    };
+
     class Undo
     {
     public:
@@ -135,18 +239,90 @@ private:
         Type type;
         QVector<TimeLogEntry> entryData;
         QVector<TimeLogHistory::Fields> entryFields;
+        QVector<QUuid> entryUuids;
         TimeLogCategory categoryData;
         QString categoryNewName;
     };
 
+    class Archive
+    {
+    public:
+        qint64 start;
+        qint64 end;
+        qlonglong mBegin;
+        qlonglong mEnd;
+    };
+
+    // Parsed data of the category record, valid while its mtime and the raw data are the same
+    class CachedCategoryData
+    {
+    public:
+        qlonglong mTime;
+        QByteArray rawData;
+        QVariantMap data;
+    };
+
+    class Backup
+    {
+    public:
+        class Table
+        {
+        public:
+            QString name;
+            bool isRowid;
+        };
+
+        QString filePath;
+        QString connectionName;
+        QVector<Table> tables;
+        int tableIndex;
+        qlonglong lastRowid;
+        qlonglong copied;
+        qlonglong total;
+        // Full-text indexes are rebuilt from the content, other objects are created after the data
+        QStringList textIndexes;
+        QStringList finalStatements;
+        bool isSequenceUsed;
+        qlonglong schemaVersion;
+    };
+
+    class Maintenance
+    {
+    public:
+        enum Task {
+            FullVacuum,
+            IncrementalVacuum,
+            Analyze,
+            IntegrityCheck
+        };
+
+        QVector<Task> steps;
+        // Table of each analyze step
+        QStringList tables;
+        int done;
+        bool isActive;
+    };
+
     bool m_isInitialized;
+    bool m_isReadonly;
+    bool m_isWalJournal;
+    bool m_isSnapshotActive;
     QString m_connectionName;
     qlonglong m_size;
     QMap<QString, TimeLogCategory> m_categories;
     QHash<QString, int> m_categoryRecordsCount;
     QSharedPointer<TimeLogCategoryTreeNode> m_categoryTree;
+    mutable QHash<QByteArray, CachedCategoryData> m_categoryDataCache;
     const QRegularExpression m_categorySplitRegexp;
-    QStack<Undo> m_undoStack;
+    QString m_selectFields;
+    bool m_isStatsRollupAvailable;
+    bool m_isCommentIndexAvailable;
+    bool m_isMonthHashesAvailable;
+    bool m_isDayHashesAvailable;
+    bool m_isArchivesAvailable;
+    bool m_isCategoryCountsAvailable;
+    bool m_isSyncChangesAvailable;
+    int m_undoCount;
 
     QSqlQuery *m_insertQuery;
     QSqlQuery *m_removeQuery;
@@ -154,47 +330,103 @@ private:
     QSqlQuery *m_notifyRemoveQuery;
     QSqlQuery *m_notifyEditQuery;
     QSqlQuery *m_notifyEditStartQuery;
-    QSqlQuery *m_syncAffectedQuery;
     QSqlQuery *m_entryQuery;
 
+    mutable QCache<QString, QSqlQuery> m_queryCache;
+    mutable qlonglong m_queryCacheHits;
+    mutable qlonglong m_queryCacheMisses;
+    int m_slowQueryTime;
+    mutable qlonglong m_slowQueriesCount;
+    mutable QSet<QString> m_explainedQueries;
+    mutable QStringList m_fullScanQueries;
+
+    QSharedPointer<TimeLogCancelledRequests> m_cancelledRequests;
+    QAtomicInt m_isSyncChangesEnabled;
+
+    // Results of the previous slices of the sync
+    QDateTime m_slicedSyncDate;
+    bool m_isSlicedSyncFailed;
+
+    // Tombstones before it are purged, so older items, unknown to the DB, are not accepted from the sync
+    QDateTime m_purgeHorizon;
+
+    Backup m_backup;
+
+    Maintenance m_maintenance;
+    QTimer *m_maintenanceTimer;
+
     bool prepareAndExecQuery(QSqlQuery &query, const QString &queryString) const;
+    // All statements are executed with it, to be timed and audited if enabled by the profile
+    bool execQuery(QSqlQuery &query) const;
+    void explainQuery(const QSqlQuery &query) const;
+    bool prepareCachedQuery(QSqlQuery &query, const QString &queryString) const;
+    bool openDB(const QString &dataPath, const QString &filePath, bool isReadonly,
+                const TimeLogConnectionProfile &profile, qlonglong &schemaVersion);
+    bool setupConnection(const TimeLogConnectionProfile &profile, bool isReadonly);
     qlonglong getSchemaVersion() const;
     bool setSchemaVersion(qint32 schemaVersion);
+    bool upgradeSchema(qlonglong schemaVersion);
+    bool upgradeCategoryData();
     bool setupTable();
     bool setupTriggers();
+    bool setupHashTriggers(const QString &table, bool isUpdatable, const QString &condition = QString());
+    bool setupChangeTriggers(const QString &table, SyncChangeKind kind, bool isUpdatable);
+    bool setupEntriesView(bool isCategoryNamesAvailable);
+    bool setupCommentIndex();
+    bool checkCommentIndex() const;
     void setSize(qlonglong size);
     void decrementCategoryCount(const QString &name);
     void incrementCategoryCount(const QString &name);
+    // Changes of the records count by category name, categories are updated once for all of them
+    void updateCategoryCounts(const QHash<QString, int> &changes);
     void processFail();
 
-    void insertEntry(const TimeLogEntry &data);
-    void removeEntry(const TimeLogEntry &data);
+    bool insertEntry(const TimeLogEntry &data);
+    bool removeEntry(const TimeLogEntry &data);
     bool editEntry(const TimeLogEntry &data, TimeLogHistory::Fields fields);
-    bool editEntries(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields);
+    bool insertEntries(const QVector<TimeLogEntry> &data);
+    bool removeEntries(const QVector<TimeLogEntry> &data);
+    // Entries before the edit are returned in the order of data, if requested
+    bool editEntries(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields,
+                     QVector<TimeLogEntry> *oldData = 0);
     bool syncEntries(const QVector<TimeLogSyncDataEntry> &updatedData,
                      const QVector<TimeLogSyncDataEntry> &removedData, QDateTime &maxSyncDate);
     bool syncCategories(const QVector<TimeLogSyncDataCategory> &categoryData, QDateTime &maxSyncDate);
+    bool syncSlice(const QVector<TimeLogSyncDataEntry> &updatedData,
+                   const QVector<TimeLogSyncDataEntry> &removedData,
+                   const QVector<TimeLogSyncDataCategory> &categoryData, QDateTime &maxSyncDate);
 
     bool insertEntryData(const QVector<TimeLogEntry> &data);
     bool insertEntryData(const TimeLogSyncDataEntry &data);
+    bool removeEntryData(const QVector<TimeLogEntry> &data);
     bool removeEntryData(const TimeLogSyncDataEntry &data);
+    bool editEntryData(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields,
+                       const QVector<TimeLogEntry> &oldData);
     bool editEntryData(const TimeLogSyncDataEntry &data, TimeLogHistory::Fields fields);
-    bool editEntriesCategory(const QString &oldName, const QString &newName);
+    bool internCategory(const QString &name);
+    bool editEntriesCategory(const QString &oldName, const QString &newName, int entriesCount);
+    bool editEntriesCategory(const QVector<QUuid> &uuids, const QString &newName);
     bool addCategoryData(const TimeLogSyncDataCategory &data);
     bool removeCategoryData(const TimeLogSyncDataCategory &data);
     bool editCategoryData(const QString &oldName, const TimeLogSyncDataCategory &data);
     bool syncEntryData(const QVector<TimeLogSyncDataEntry> &removed,
                        const QVector<TimeLogSyncDataEntry> &inserted,
-                       const QVector<TimeLogSyncDataEntry> &updated,
+                       const QVector<TimeLogSyncDataEntry> &updatedNew,
+                       const QVector<TimeLogSyncDataEntry> &updatedOld,
                        const QVector<TimeLogHistory::Fields> &updateFields);
     bool syncCategoryData(const QVector<TimeLogSyncDataCategory> &removed,
                           const QVector<TimeLogSyncDataCategory> &inserted,
                           const QVector<TimeLogSyncDataCategory> &updatedNew,
                           const QVector<TimeLogSyncDataCategory> &updatedOld);
-    void updateDataHashes(const QMap<QDateTime, QByteArray> &hashes);
-    bool writeHash(const QDateTime &start, const QByteArray &hash);
-    bool removeHash(const QDateTime &start);
-    QVector<TimeLogEntry> getHistory(QSqlQuery &query) const;
+    bool setBulkMode(bool isEnabled);
+    bool setArchiveMode(bool isEnabled);
+    bool updateDurations(const QDateTime &begin, const QDateTime &end);
+    bool rebuildHashes();
+    // Expected size is the limit of the query, it is reserved up front, unless the result is chunked
+    QVector<TimeLogEntry> getHistory(QSqlQuery &query, qlonglong id = 0, uint chunkSize = 0,
+                                     uint expectedSize = 0) const;
+    bool isRequestCancelled(qlonglong id) const;
+    QVector<TimeLogEntry> getRecentEntries(int count) const;
     QVector<TimeLogStats> getStats(QSqlQuery &query) const;
     QVector<TimeLogSyncDataEntry> getSyncEntryData(const QDateTime &mBegin = QDateTime(),
                                               const QDateTime &mEnd = QDateTime()) const;
@@ -203,18 +435,26 @@ private:
                                                          const QDateTime &mEnd = QDateTime()) const;
     QVector<TimeLogSyncDataCategory> getSyncCategoryData(QSqlQuery &query) const;
     TimeLogEntry getEntry(const QUuid &uuid);
-    QVector<TimeLogEntry> getEntries(const QString &category) const;
-    QVector<TimeLogSyncDataEntry> getSyncEntriesAffected(const QUuid &uuid);
-    QVector<TimeLogSyncDataCategory> getSyncCategoriesAffected(const QUuid &uuid);
+    QVector<QUuid> getEntryUuids(const QString &category, bool *ok) const;
+    QVector<TimeLogEntry> getEntries(const QVector<QUuid> &uuids) const;
+    QHash<QUuid, TimeLogSyncDataEntry> getSyncEntriesAffected(const QVector<QUuid> &uuids, bool *ok);
+    QHash<QUuid, TimeLogSyncDataCategory> getSyncCategoriesAffected(const QVector<QUuid> &uuids, bool *ok);
     bool getSyncDataExists(const QDateTime &mBegin = QDateTime::fromMSecsSinceEpoch(0, Qt::UTC),
                            const QDateTime &mEnd = QDateTime::currentDateTimeUtc()) const;
     QMap<QDateTime, QByteArray> getDataHashes(const QDateTime &maxDate = QDateTime()) const;
     void notifyInsertUpdates(const TimeLogEntry &data);
     void notifyInsertUpdates(const QVector<TimeLogEntry> &data);
     void notifyRemoveUpdates(const TimeLogEntry &data);
+    void notifyRemoveUpdates(const QVector<TimeLogEntry> &data);
     void notifyEditUpdates(const TimeLogEntry &data, TimeLogHistory::Fields fields, QDateTime oldStart = QDateTime());
+    void notifyEditUpdates(const QVector<TimeLogEntry> &data, const QVector<TimeLogHistory::Fields> &fields,
+                           const QVector<TimeLogEntry> &oldData);
+    // Existing entries, preceding and following the starts, the entries at the starts are not included
+    bool getAdjacentEntries(const QVector<uint> &starts, QMap<uint, TimeLogEntry> &result) const;
     void notifyUpdates(QSqlQuery &query,
                        TimeLogHistory::Fields fields = TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart) const;
+    void notifyUpdates(const QVector<TimeLogEntry> &updatedData,
+                       TimeLogHistory::Fields fields = TimeLogHistory::DurationTime | TimeLogHistory::PrecedingStart) const;
     bool startTransaction(QSqlDatabase &db);
     bool commitTransaction(QSqlDatabase &db);
     void rollbackTransaction(QSqlDatabase &db);
@@ -223,9 +463,37 @@ private:
     bool checkIsDBEmpty();
     bool populateCategories();
     void updateCategories();
+    void updateCategories(const QStringList &names);
+    bool patchCategories(TimeLogCategoryTreeNode *rootCategory, const QString &category) const;
     QSharedPointer<TimeLogCategoryTreeNode> parseCategories(const QStringList &categories) const;
-    QByteArray calcHash(const QDateTime &begin, const QDateTime &end) const;
-    void pushUndo(const Undo undo);
+    void pushUndo(const Undo &undo, const std::function<bool()> &action);
+    bool writeUndo(const Undo &undo);
+    bool takeUndo(Undo &undo);
+    void clearUndo();
+    bool fetchUndoCount();
+    bool fetchPurgeHorizon();
+    bool isBeforePurgeHorizon(const QDateTime &mTime) const;
+    QString archivePath(qint64 start) const;
+    bool attachArchive(const QString &filePath, const QString &name, bool isCreate = false) const;
+    void detachArchive(const QString &name) const;
+    bool getArchives(QVector<Archive> &archives) const;
+    bool execArchiveQuery(QSqlQuery &query, const QString &queryString, const QVariantList &values) const;
+    bool archiveData(qint64 begin, qint64 end);
+    bool restoreArchive(const Archive &archive);
+    bool restoreArchives(const QVector<QUuid> &uuids, const QVector<QDateTime> &starts,
+                         const QString &category = QString());
+    // Record uuid and mtime are the cache key, the data without uuid is not cached
+    bool decodeCategoryData(const QByteArray &uuid, qlonglong mTime, const QByteArray &rawData,
+                            QVariantMap &data) const;
+    bool openBackup(const QString &filePath);
+    bool copyBackupStep(bool &isDone);
+    bool finishBackup();
+    void closeBackup(bool isSuccess);
+    bool startMaintenance(bool isForced);
+    void postMaintenanceStep();
+    bool runMaintenanceStep(Maintenance::Task task);
+    bool setMaintenanceTime(const QString &task, qint64 time = QDateTime::currentMSecsSinceEpoch() / 1000);
+    void finishMaintenance(bool result);
 };
 
 #endif // TIMELOGHISTORYWORKER_H
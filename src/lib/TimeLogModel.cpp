@@ -16,31 +16,32 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <algorithm>
+
 #include "TimeLogModel.h"
 #include "TimeTracker.h"
+#include "TimeLogTrace.h"
+#include "TimeLogDiagnostics.h"
+#include "TimeLogClock.h"
 
 Q_LOGGING_CATEGORY(TIME_LOG_MODEL_CATEGORY, "TimeLogModel", QtInfoMsg)
 
-class uuidEquals
-{
-public:
-    uuidEquals(const QUuid &uuid) : m_uuid(uuid) { }
-
-    bool operator ()(const TimeLogEntry &entry) const
-    {
-        return m_uuid == entry.uuid;
-    }
-
-private:
-    QUuid m_uuid;
-};
+// Batches touching at least this many rows and more than a half of the model are
+// announced with a single layoutChanged() instead of dataChanged() ranges
+const int bulkUpdateMinRows = 64;
 
 TimeLogModel::TimeLogModel(QObject *parent) :
     SUPER(parent),
     m_timeTracker(Q_NULLPTR),
-    m_history(Q_NULLPTR)
+    m_history(Q_NULLPTR),
+    m_isUuidIndexValid(true)
 {
+    TimeLogDiagnostics::addModel(this);
+}
 
+TimeLogModel::~TimeLogModel()
+{
+    TimeLogDiagnostics::removeModel(this);
 }
 
 int TimeLogModel::rowCount(const QModelIndex &parent) const
@@ -58,23 +59,24 @@ QVariant TimeLogModel::data(const QModelIndex &index, int role) const
 
     switch (role) {
     case StartTimeRole:
-        return QVariant::fromValue(m_timeLog[index.row()].startTime);
+        return QVariant::fromValue(m_timeLog.startTime(index.row()));
     case DurationTimeRole:
-        return QVariant::fromValue(m_timeLog[index.row()].durationTime);
+        return QVariant::fromValue(m_timeLog.durationTime(index.row()));
     case CategoryRole:
-        return QVariant::fromValue(m_timeLog[index.row()].category);
+        return QVariant::fromValue(m_timeLog.category(index.row()));
     case CommentRole:
-        return QVariant::fromValue(m_timeLog[index.row()].comment);
+        return QVariant::fromValue(m_timeLog.comment(index.row()));
     case PrecedingStartRole:
-        return QVariant::fromValue(m_timeLog[index.row()].precedingStart);
+        return QVariant::fromValue(m_timeLog.precedingStart(index.row()));
     case SucceedingStartRole:
-        if (m_timeLog[index.row()].durationTime == -1) {
-            return QVariant::fromValue(QDateTime::currentDateTimeUtc());
-        } else {
-            return QVariant::fromValue(QDateTime(m_timeLog[index.row()].startTime).addSecs(m_timeLog[index.row()].durationTime));
+        // Running entry is updated by the shared clock, while it is shown
+        if (m_timeLog.durationTime(index.row()) == -1) {
+            connect(TimeLogClock::instance(), SIGNAL(nowChanged(QDateTime)),
+                    this, SLOT(clockTicked()), Qt::UniqueConnection);
         }
+        return QVariant::fromValue(m_timeLog.succeedingStart(index.row()));
     case Qt::DisplayRole:
-        return QVariant::fromValue(QString("%1 | %2").arg(m_timeLog[index.row()].startTime.toString()).arg(m_timeLog[index.row()].category));
+        return QVariant::fromValue(QString("%1 | %2").arg(m_timeLog.startTime(index.row()).toString()).arg(m_timeLog.category(index.row())));
     default:
         return QVariant();
     }
@@ -134,7 +136,7 @@ bool TimeLogModel::setData(const QModelIndex &index, const QVariant &value, int
         if (!checkStartValid(index.row() - 1, index.row() + 1, time)) {
             return false;
         }
-        m_timeLog[index.row()].startTime = time;
+        m_timeLog.setStartTime(index.row(), time);
         m_history->edit(m_timeLog.at(index.row()), TimeLogHistory::StartTime);
         break;
     }
@@ -143,11 +145,11 @@ bool TimeLogModel::setData(const QModelIndex &index, const QVariant &value, int
     case SucceedingStartRole:
         return false;   // This properties can only be calculated
     case CategoryRole:
-        m_timeLog[index.row()].category = value.toString();
+        m_timeLog.setCategory(index.row(), value.toString());
         m_history->edit(m_timeLog.at(index.row()), TimeLogHistory::Category);
         break;
     case CommentRole:
-        m_timeLog[index.row()].comment = value.toString();
+        m_timeLog.setComment(index.row(), value.toString());
         m_history->edit(m_timeLog.at(index.row()), TimeLogHistory::Comment);
         break;
     default:
@@ -173,11 +175,10 @@ bool TimeLogModel::removeRows(int row, int count, const QModelIndex &parent)
 
     beginRemoveRows(parent, row, row + count - 1);
     m_timeLog.remove(row, count);
+    invalidateUuidIndex();
     endRemoveRows();
 
-    foreach (const TimeLogEntry &entry, removed) {
-        m_history->remove(entry);
-    }
+    m_history->removeBatch(removed);
 
     return true;
 }
@@ -202,6 +203,7 @@ void TimeLogModel::appendItem(TimeLogData data)
     int itemIndex = m_timeLog.size();
     beginInsertRows(QModelIndex(), itemIndex, itemIndex);
     m_timeLog.append(entry);
+    appendToUuidIndex(itemIndex);
     endInsertRows();
 
     m_history->insert(entry);
@@ -221,6 +223,7 @@ void TimeLogModel::insertItem(const QModelIndex &index, TimeLogData data)
 
     beginInsertRows(index.parent(), index.row(), index.row());
     m_timeLog.insert(index.row(), entry);
+    invalidateUuidIndex();
     endInsertRows();
 
     m_history->insert(entry);
@@ -253,6 +256,18 @@ void TimeLogModel::setTimeTracker(TimeTracker *timeTracker)
     emit timeTrackerChanged(m_timeTracker);
 }
 
+QVariantMap TimeLogModel::diagnostics() const
+{
+    QVariantMap result;
+    result.insert("type", metaObject()->className());
+    result.insert("count", m_timeLog.size());
+    result.insert("bytes", m_timeLog.approximateBytes()
+                           + m_uuidIndex.size() * static_cast<qint64>(sizeof(QUuid) + sizeof(int)));
+    result.insert("pendingRequests", m_pendingRequests.size());
+
+    return result;
+}
+
 void TimeLogModel::setHistory(TimeLogHistory *history)
 {
     if (m_history == history) {
@@ -264,12 +279,16 @@ void TimeLogModel::setHistory(TimeLogHistory *history)
                    this, SLOT(historyDataOutdated()));
         disconnect(m_history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
                    this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+        disconnect(m_history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+                   this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
         disconnect(m_history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
                    this, SLOT(historyDataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
         disconnect(m_history, SIGNAL(dataInserted(TimeLogEntry)),
                    this, SLOT(historyDataInserted(TimeLogEntry)));
         disconnect(m_history, SIGNAL(dataRemoved(TimeLogEntry)),
                    this, SLOT(historyDataRemoved(TimeLogEntry)));
+        disconnect(m_history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+                   this, SLOT(historyDataBatchRemoved(QVector<TimeLogEntry>)));
     }
 
     m_history = history;
@@ -279,12 +298,16 @@ void TimeLogModel::setHistory(TimeLogHistory *history)
                 this, SLOT(historyDataOutdated()));
         connect(m_history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
                 this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+        connect(m_history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+                this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
         connect(m_history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
                 this, SLOT(historyDataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
         connect(m_history, SIGNAL(dataInserted(TimeLogEntry)),
                 this, SLOT(historyDataInserted(TimeLogEntry)));
         connect(m_history, SIGNAL(dataRemoved(TimeLogEntry)),
                 this, SLOT(historyDataRemoved(TimeLogEntry)));
+        connect(m_history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+                this, SLOT(historyDataBatchRemoved(QVector<TimeLogEntry>)));
     }
 
     m_pendingRequests.clear();
@@ -311,17 +334,39 @@ void TimeLogModel::historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong
     processHistoryData(data);
 }
 
+void TimeLogModel::historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (m_obsoleteRequests.contains(id)) {
+        return;
+    }
+    if (!m_pendingRequests.contains(id)) {
+        qCDebug(TIME_LOG_MODEL_CATEGORY) << "Discarding received but not requested data for id" << id;
+        return;
+    }
+
+    processHistoryData(data);
+}
+
 void TimeLogModel::historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields)
 {
+    TIMELOG_TRACE_SPAN("model", "dataUpdated");
+
     Q_ASSERT(data.size() == fields.size());
 
+    const bool isBulkUpdate = (data.size() >= bulkUpdateMinRows && data.size() * 2 > m_timeLog.size());
+    if (isBulkUpdate) {
+        emit layoutAboutToBeChanged();
+    }
+
+    QVector<QPair<int, TimeLogHistory::Fields> > changes;
+    changes.reserve(data.size());
     int dataIndex = -1;
 
     for (int i = 0; i < data.size(); i++) {
         const TimeLogEntry &entry = data.at(i);
 
         if (dataIndex != -1 && dataIndex < m_timeLog.size() - 1
-            && entry.uuid == m_timeLog.at(dataIndex+1).uuid) {
+            && entry.uuid == m_timeLog.uuid(dataIndex+1)) {
             // If current item to update follows right after the previous, no search needed
             dataIndex++;
         } else {
@@ -333,31 +378,88 @@ void TimeLogModel::historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLo
             continue;
         }
 
-        QVector<int> roles;
         if (fields.at(i) & TimeLogHistory::DurationTime) {
-            m_timeLog[dataIndex].durationTime = entry.durationTime;
-            roles.append(DurationTimeRole);
-            roles.append(SucceedingStartRole);
+            m_timeLog.setDurationTime(dataIndex, entry.durationTime);
         }
         if (fields.at(i) & TimeLogHistory::StartTime) {
-            m_timeLog[dataIndex].startTime = entry.startTime;
-            roles.append(StartTimeRole);
+            m_timeLog.setStartTime(dataIndex, entry.startTime);
         }
         if (fields.at(i) & TimeLogHistory::Category) {
-            m_timeLog[dataIndex].category = entry.category;
-            roles.append(CategoryRole);
+            m_timeLog.setCategory(dataIndex, entry.category);
         }
         if (fields.at(i) & TimeLogHistory::Comment) {
-            m_timeLog[dataIndex].comment = entry.comment;
-            roles.append(CommentRole);
+            m_timeLog.setComment(dataIndex, entry.comment);
         }
         if (fields.at(i) & TimeLogHistory::PrecedingStart) {
-            m_timeLog[dataIndex].precedingStart = entry.precedingStart;
-            roles.append(PrecedingStartRole);
+            m_timeLog.setPrecedingStart(dataIndex, entry.precedingStart);
         }
-        QModelIndex itemIndex = index(dataIndex, 0, QModelIndex());
-        emit dataChanged(itemIndex, itemIndex, roles);
+        changes.append(qMakePair(dataIndex, fields.at(i)));
+    }
+
+    if (isBulkUpdate) {
+        emit layoutChanged();
+    } else {
+        notifyDataChanged(changes);
+    }
+}
+
+void TimeLogModel::notifyDataChanged(QVector<QPair<int, TimeLogHistory::Fields> > changes)
+{
+    if (changes.isEmpty()) {
+        return;
+    }
+
+    std::sort(changes.begin(), changes.end(),
+              [](const QPair<int, TimeLogHistory::Fields> &a, const QPair<int, TimeLogHistory::Fields> &b) {
+        return a.first < b.first;
+    });
+
+    // Merge repeated updates of the same row
+    int last = 0;
+    for (int i = 1; i < changes.size(); i++) {
+        if (changes.at(i).first == changes.at(last).first) {
+            changes[last].second |= changes.at(i).second;
+        } else {
+            changes[++last] = changes.at(i);
+        }
+    }
+    changes.resize(last + 1);
+
+    // Emit contiguous rows with the same fields as a single range
+    int first = 0;
+    for (int i = 1; i <= changes.size(); i++) {
+        if (i < changes.size() && changes.at(i).first == changes.at(i-1).first + 1
+            && changes.at(i).second == changes.at(first).second) {
+            continue;
+        }
+        emit dataChanged(index(changes.at(first).first, 0, QModelIndex()),
+                         index(changes.at(i-1).first, 0, QModelIndex()),
+                         fieldsRoles(changes.at(first).second));
+        first = i;
+    }
+}
+
+QVector<int> TimeLogModel::fieldsRoles(TimeLogHistory::Fields fields)
+{
+    QVector<int> roles;
+    if (fields & TimeLogHistory::DurationTime) {
+        roles.append(DurationTimeRole);
+        roles.append(SucceedingStartRole);
     }
+    if (fields & TimeLogHistory::StartTime) {
+        roles.append(StartTimeRole);
+    }
+    if (fields & TimeLogHistory::Category) {
+        roles.append(CategoryRole);
+    }
+    if (fields & TimeLogHistory::Comment) {
+        roles.append(CommentRole);
+    }
+    if (fields & TimeLogHistory::PrecedingStart) {
+        roles.append(PrecedingStartRole);
+    }
+
+    return roles;
 }
 
 void TimeLogModel::historyDataInserted(TimeLogEntry data)
@@ -370,10 +472,38 @@ void TimeLogModel::historyDataRemoved(TimeLogEntry data)
     processDataRemove(data);
 }
 
+void TimeLogModel::historyDataBatchRemoved(QVector<TimeLogEntry> data)
+{
+    for (const TimeLogEntry &entry: data) {
+        processDataRemove(entry);
+    }
+}
+
+void TimeLogModel::clockTicked()
+{
+    // Only the last entry could be running, the clock is released, when there is no one
+    int row = m_timeLog.size() - 1;
+    if (row < 0 || m_timeLog.durationTime(row) != -1) {
+        disconnect(TimeLogClock::instance(), SIGNAL(nowChanged(QDateTime)),
+                   this, SLOT(clockTicked()));
+        return;
+    }
+
+    emit dataChanged(index(row, 0), index(row, 0), QVector<int>() << SucceedingStartRole);
+}
+
 void TimeLogModel::clear()
 {
     beginResetModel();
     m_timeLog.clear();
+    m_uuidIndex.clear();
+    m_isUuidIndexValid = true;
+    // Results could be already sent, so cancelled requests are still tracked
+    if (m_history) {
+        for (qlonglong id: m_pendingRequests) {
+            m_history->cancelRequest(id);
+        }
+    }
     m_obsoleteRequests.append(m_pendingRequests);
     m_pendingRequests.clear();
     endResetModel();
@@ -381,6 +511,8 @@ void TimeLogModel::clear()
 
 void TimeLogModel::processHistoryData(QVector<TimeLogEntry> data)
 {
+    TIMELOG_TRACE_SPAN("model", "historyData");
+
     if (!data.size()) {
         return;
     }
@@ -389,6 +521,7 @@ void TimeLogModel::processHistoryData(QVector<TimeLogEntry> data)
 
     beginInsertRows(QModelIndex(), index, index + data.size() - 1);
     m_timeLog.append(data);
+    appendToUuidIndex(index);
     endInsertRows();
 }
 
@@ -399,6 +532,8 @@ void TimeLogModel::processDataInsert(TimeLogEntry data)
 
 void TimeLogModel::processDataRemove(const TimeLogEntry &data)
 {
+    TIMELOG_TRACE_SPAN("model", "dataRemove");
+
     int index = findData(data);
     if (index == -1) {
         return;
@@ -406,20 +541,60 @@ void TimeLogModel::processDataRemove(const TimeLogEntry &data)
 
     beginRemoveRows(QModelIndex(), index, index);
     m_timeLog.remove(index, 1);
+    // Removal of the last row does not shift any other
+    if (index == m_timeLog.size()) {
+        m_uuidIndex.remove(data.uuid);
+    } else {
+        invalidateUuidIndex();
+    }
     endRemoveRows();
 }
 
 int TimeLogModel::findData(const TimeLogEntry &entry) const
 {
-    QVector<TimeLogEntry>::const_iterator it = std::find_if(m_timeLog.begin(), m_timeLog.end(),
-                                                            uuidEquals(entry.uuid));
-    if (it == m_timeLog.end()) {
+    int index = findUuid(entry.uuid);
+    if (index == -1) {
         qCWarning(TIME_LOG_MODEL_CATEGORY) << "Item not found:\n"
                                            << entry.startTime << entry.category << entry.uuid;
+    }
+
+    return index;
+}
+
+// Hit is checked against the data, so stale entries are harmless and the rebuild happens only on miss
+int TimeLogModel::findUuid(const QUuid &uuid) const
+{
+    QHash<QUuid, int>::const_iterator it = m_uuidIndex.constFind(uuid);
+    if (it != m_uuidIndex.constEnd() && it.value() < m_timeLog.size() && m_timeLog.uuid(it.value()) == uuid) {
+        return it.value();
+    } else if (m_isUuidIndexValid) {
         return -1;
-    } else {
-        return (it - m_timeLog.begin());
     }
+
+    m_uuidIndex.clear();
+    m_uuidIndex.reserve(m_timeLog.size());
+    for (int i = 0; i < m_timeLog.size(); i++) {
+        m_uuidIndex.insert(m_timeLog.uuid(i), i);
+    }
+    m_isUuidIndexValid = true;
+
+    return m_uuidIndex.value(uuid, -1);
+}
+
+void TimeLogModel::appendToUuidIndex(int first)
+{
+    if (!m_isUuidIndexValid) {
+        return;
+    }
+
+    for (int i = first; i < m_timeLog.size(); i++) {
+        m_uuidIndex.insert(m_timeLog.uuid(i), i);
+    }
+}
+
+void TimeLogModel::invalidateUuidIndex()
+{
+    m_isUuidIndexValid = false;
 }
 
 bool TimeLogModel::checkStartValid(int indexBefore, int indexAfter, const QDateTime &startTime)
@@ -428,16 +603,11 @@ bool TimeLogModel::checkStartValid(int indexBefore, int indexAfter, const QDateT
     Q_ASSERT(indexAfter <= m_timeLog.size());
     Q_ASSERT(startTime.isValid());
 
-    if ((indexBefore == -1 || m_timeLog.at(indexBefore).startTime < startTime)
-        && (indexAfter == m_timeLog.size() || m_timeLog.at(indexAfter).startTime > startTime)) {
+    if ((indexBefore == -1 || m_timeLog.startTime(indexBefore) < startTime)
+        && (indexAfter == m_timeLog.size() || m_timeLog.startTime(indexAfter) > startTime)) {
         return true;
     } else {
         emit error(tr("Time %1 doesn't fall within a proper range").arg(startTime.toString(Qt::ISODate)));
         return false;
     }
 }
-
-bool TimeLogModel::startTimeCompare(const TimeLogEntry &a, const TimeLogEntry &b)
-{
-    return a.startTime < b.startTime;
-}
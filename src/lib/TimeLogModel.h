@@ -24,6 +24,7 @@
 #include <QLoggingCategory>
 
 #include "TimeLogHistory.h"
+#include "TimeLogModelStorage.h"
 
 class TimeTracker;
 
@@ -43,6 +44,7 @@ public:
     };
 
     explicit TimeLogModel(QObject *parent = 0);
+    virtual ~TimeLogModel();
 
     virtual int rowCount(const QModelIndex &parent) const;
 
@@ -60,33 +62,45 @@ public:
 
     void setTimeTracker(TimeTracker *timeTracker);
 
+    // Rows and approximate memory usage of the model
+    QVariantMap diagnostics() const;
+
 protected slots:
     virtual void setHistory(TimeLogHistory *history);
 
 private slots:
     void historyDataOutdated();
     void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id);
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id);
     void historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields);
     void historyDataInserted(TimeLogEntry data);
     void historyDataRemoved(TimeLogEntry data);
+    void historyDataBatchRemoved(QVector<TimeLogEntry> data);
+    void clockTicked();
 
 signals:
     void timeTrackerChanged(TimeTracker *newTimeTracker);
     void error(const QString &errorText) const;
 
 protected:
-    void clear();
+    virtual void clear();
     virtual void processHistoryData(QVector<TimeLogEntry> data);
     virtual void processDataInsert(TimeLogEntry data);
     virtual void processDataRemove(const TimeLogEntry &data);
     virtual int findData(const TimeLogEntry &entry) const;
+    int findUuid(const QUuid &uuid) const;
+    void appendToUuidIndex(int first);
+    void invalidateUuidIndex();
     virtual bool checkStartValid(int indexBefore, int indexAfter, const QDateTime &startTime);
-
-    static bool startTimeCompare(const TimeLogEntry &a, const TimeLogEntry &b);
+    void notifyDataChanged(QVector<QPair<int, TimeLogHistory::Fields> > changes);
+    static QVector<int> fieldsRoles(TimeLogHistory::Fields fields);
 
     TimeTracker *m_timeTracker;
     TimeLogHistory *m_history;
-    QVector<TimeLogEntry> m_timeLog;
+    TimeLogModelStorage m_timeLog;
+    // Rows by uuid, shifted rows are detected on lookup and the whole index is rebuilt once
+    mutable QHash<QUuid, int> m_uuidIndex;
+    mutable bool m_isUuidIndexValid;
     QList<qlonglong> m_pendingRequests;
     QList<qlonglong> m_obsoleteRequests;
 };
@@ -0,0 +1,255 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <algorithm>
+#include <limits>
+
+#include "TimeLogModelStorage.h"
+#include "TimeLogClock.h"
+
+static const qint64 invalidTime(std::numeric_limits<qint64>::min());
+
+TimeLogModelStorage::TimeLogModelStorage()
+{
+
+}
+
+int TimeLogModelStorage::size() const
+{
+    return m_uuids.size();
+}
+
+bool TimeLogModelStorage::isEmpty() const
+{
+    return m_uuids.isEmpty();
+}
+
+void TimeLogModelStorage::clear()
+{
+    m_uuids.clear();
+    m_startTimes.clear();
+    m_durationTimes.clear();
+    m_precedingStarts.clear();
+    m_categoryIds.clear();
+    m_comments.clear();
+    m_categories.clear();
+    m_categoryIndex.clear();
+}
+
+qint64 TimeLogModelStorage::approximateBytes() const
+{
+    qint64 result = m_uuids.capacity() * sizeof(QUuid)
+                    + m_startTimes.capacity() * sizeof(qint64)
+                    + m_durationTimes.capacity() * sizeof(int)
+                    + m_precedingStarts.capacity() * sizeof(qint64)
+                    + m_categoryIds.capacity() * sizeof(int)
+                    + m_comments.capacity() * sizeof(QString)
+                    + m_categories.capacity() * sizeof(QString)
+                    + m_categoryIndex.size() * (sizeof(QString) + sizeof(int));
+    for (const QString &comment: m_comments) {
+        result += comment.size() * sizeof(QChar);
+    }
+    // Category texts are interned in the pool, so only the references are owned
+
+    return result;
+}
+
+void TimeLogModelStorage::reserve(int size)
+{
+    m_uuids.reserve(size);
+    m_startTimes.reserve(size);
+    m_durationTimes.reserve(size);
+    m_precedingStarts.reserve(size);
+    m_categoryIds.reserve(size);
+    m_comments.reserve(size);
+}
+
+TimeLogEntry TimeLogModelStorage::at(int index) const
+{
+    TimeLogEntry entry(uuid(index), TimeLogData(startTime(index), category(index), comment(index)));
+    entry.durationTime = durationTime(index);
+    entry.precedingStart = precedingStart(index);
+
+    return entry;
+}
+
+QVector<TimeLogEntry> TimeLogModelStorage::mid(int index, int count) const
+{
+    QVector<TimeLogEntry> result;
+    result.reserve(count);
+    for (int i = index; i < index + count; i++) {
+        result.append(at(i));
+    }
+
+    return result;
+}
+
+QUuid TimeLogModelStorage::uuid(int index) const
+{
+    return m_uuids.at(index);
+}
+
+QDateTime TimeLogModelStorage::startTime(int index) const
+{
+    return fromSecs(m_startTimes.at(index));
+}
+
+int TimeLogModelStorage::durationTime(int index) const
+{
+    return m_durationTimes.at(index);
+}
+
+QString TimeLogModelStorage::category(int index) const
+{
+    return m_categories.at(m_categoryIds.at(index));
+}
+
+QString TimeLogModelStorage::comment(int index) const
+{
+    return m_comments.at(index);
+}
+
+QDateTime TimeLogModelStorage::precedingStart(int index) const
+{
+    return fromSecs(m_precedingStarts.at(index));
+}
+
+QDateTime TimeLogModelStorage::succeedingStart(int index) const
+{
+    if (m_durationTimes.at(index) == -1) {
+        return TimeLogClock::instance()->now();
+    } else {
+        return fromSecs(m_startTimes.at(index) + m_durationTimes.at(index));
+    }
+}
+
+void TimeLogModelStorage::setStartTime(int index, const QDateTime &startTime)
+{
+    m_startTimes[index] = toSecs(startTime);
+}
+
+void TimeLogModelStorage::setDurationTime(int index, int durationTime)
+{
+    m_durationTimes[index] = durationTime;
+}
+
+void TimeLogModelStorage::setCategory(int index, const QString &category)
+{
+    m_categoryIds[index] = categoryId(category);
+}
+
+void TimeLogModelStorage::setComment(int index, const QString &comment)
+{
+    m_comments[index] = comment;
+}
+
+void TimeLogModelStorage::setPrecedingStart(int index, const QDateTime &precedingStart)
+{
+    m_precedingStarts[index] = toSecs(precedingStart);
+}
+
+void TimeLogModelStorage::append(const TimeLogEntry &entry)
+{
+    insert(size(), entry);
+}
+
+void TimeLogModelStorage::append(const QVector<TimeLogEntry> &entries)
+{
+    insert(size(), entries);
+}
+
+void TimeLogModelStorage::insert(int index, const TimeLogEntry &entry)
+{
+    insertEmpty(index, 1);
+    setEntry(index, entry);
+}
+
+void TimeLogModelStorage::insert(int index, const QVector<TimeLogEntry> &entries)
+{
+    insertEmpty(index, entries.size());
+    for (int i = 0; i < entries.size(); i++) {
+        setEntry(index + i, entries.at(i));
+    }
+}
+
+void TimeLogModelStorage::remove(int index, int count)
+{
+    m_uuids.remove(index, count);
+    m_startTimes.remove(index, count);
+    m_durationTimes.remove(index, count);
+    m_precedingStarts.remove(index, count);
+    m_categoryIds.remove(index, count);
+    m_comments.remove(index, count);
+}
+
+int TimeLogModelStorage::lowerBound(const QDateTime &startTime) const
+{
+    return std::lower_bound(m_startTimes.constBegin(), m_startTimes.constEnd(), toSecs(startTime))
+           - m_startTimes.constBegin();
+}
+
+int TimeLogModelStorage::upperBound(const QDateTime &startTime) const
+{
+    return std::upper_bound(m_startTimes.constBegin(), m_startTimes.constEnd(), toSecs(startTime))
+           - m_startTimes.constBegin();
+}
+
+qint64 TimeLogModelStorage::toSecs(const QDateTime &time)
+{
+    return time.isValid() ? time.toMSecsSinceEpoch() / 1000 : invalidTime;
+}
+
+QDateTime TimeLogModelStorage::fromSecs(qint64 secs)
+{
+    return secs == invalidTime ? QDateTime() : QDateTime::fromMSecsSinceEpoch(secs * 1000, Qt::UTC);
+}
+
+int TimeLogModelStorage::categoryId(const QString &category)
+{
+    QHash<QString, int>::const_iterator it = m_categoryIndex.constFind(category);
+    if (it != m_categoryIndex.constEnd()) {
+        return it.value();
+    }
+
+    int id = m_categories.size();
+    m_categories.append(category);
+    m_categoryIndex.insert(category, id);
+
+    return id;
+}
+
+void TimeLogModelStorage::insertEmpty(int index, int count)
+{
+    // All the column types are primitive or movable, so this is a memmove for each
+    m_uuids.insert(index, count, QUuid());
+    m_startTimes.insert(index, count, invalidTime);
+    m_durationTimes.insert(index, count, 0);
+    m_precedingStarts.insert(index, count, invalidTime);
+    m_categoryIds.insert(index, count, 0);
+    m_comments.insert(index, count, QString());
+}
+
+void TimeLogModelStorage::setEntry(int index, const TimeLogEntry &entry)
+{
+    m_uuids[index] = entry.uuid;
+    m_startTimes[index] = toSecs(entry.startTime);
+    m_durationTimes[index] = entry.durationTime;
+    m_precedingStarts[index] = toSecs(entry.precedingStart);
+    m_categoryIds[index] = categoryId(entry.category);
+    m_comments[index] = entry.comment;
+}
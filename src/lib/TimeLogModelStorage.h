@@ -0,0 +1,89 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGMODELSTORAGE_H
+#define TIMELOGMODELSTORAGE_H
+
+#include <QHash>
+#include <QVector>
+
+#include "TimeLogEntry.h"
+
+// Column-wise rows of the time log models, the times are kept as UTC epoch seconds,
+// like in the DB, and QDateTime is created only when a value is read
+class TimeLogModelStorage
+{
+public:
+    TimeLogModelStorage();
+
+    int size() const;
+    bool isEmpty() const;
+    void clear();
+    void reserve(int size);
+    // Allocated column capacity and the comment and category texts
+    qint64 approximateBytes() const;
+
+    TimeLogEntry at(int index) const;
+    QVector<TimeLogEntry> mid(int index, int count) const;
+
+    QUuid uuid(int index) const;
+    QDateTime startTime(int index) const;
+    int durationTime(int index) const;
+    QString category(int index) const;
+    QString comment(int index) const;
+    QDateTime precedingStart(int index) const;
+    QDateTime succeedingStart(int index) const;
+
+    void setStartTime(int index, const QDateTime &startTime);
+    void setDurationTime(int index, int durationTime);
+    void setCategory(int index, const QString &category);
+    void setComment(int index, const QString &comment);
+    void setPrecedingStart(int index, const QDateTime &precedingStart);
+
+    void append(const TimeLogEntry &entry);
+    void append(const QVector<TimeLogEntry> &entries);
+    void insert(int index, const TimeLogEntry &entry);
+    void insert(int index, const QVector<TimeLogEntry> &entries);
+    void remove(int index, int count = 1);
+
+    // First row with start not before/after the given time
+    int lowerBound(const QDateTime &startTime) const;
+    int upperBound(const QDateTime &startTime) const;
+
+private:
+    static qint64 toSecs(const QDateTime &time);
+    static QDateTime fromSecs(qint64 secs);
+
+    int categoryId(const QString &category);
+    void insertEmpty(int index, int count);
+    void setEntry(int index, const TimeLogEntry &entry);
+
+    QVector<QUuid> m_uuids;
+    QVector<qint64> m_startTimes;
+    QVector<int> m_durationTimes;
+    QVector<qint64> m_precedingStarts;
+    QVector<int> m_categoryIds;
+    // Implicitly shared, so rows without comment hold only the shared null
+    QVector<QString> m_comments;
+
+    // Interned categories, ids are kept till the storage is cleared
+    QVector<QString> m_categories;
+    QHash<QString, int> m_categoryIndex;
+};
+
+#endif // TIMELOGMODELSTORAGE_H
@@ -19,22 +19,44 @@
 #include "TimeLogRecentModel.h"
 
 static const int defaultPopulateCount(5);
+// Rows kept in the model, the ones farthest from the last accessed row are evicted above it
+static const int maxWindowSize(500);
 
 TimeLogRecentModel::TimeLogRecentModel(QObject *parent) :
     SUPER(parent),
     m_moreDataRequested(false),
-    m_availableSize(0)
+    m_availableSize(0),
+    m_fetchDirection(FetchOlder),
+    m_isHeadLoaded(false),
+    m_isTailLoaded(true),
+    m_isNewerDataQueued(false),
+    m_lastAccessedRow(0)
 {
 
 }
 
+QVariant TimeLogRecentModel::data(const QModelIndex &index, int role) const
+{
+    if (index.isValid()) {
+        m_lastAccessedRow = index.row();
+        if (!m_isTailLoaded && !m_isNewerDataQueued
+            && index.row() >= m_timeLog.size() - defaultPopulateCount) {
+            m_isNewerDataQueued = true;
+            QMetaObject::invokeMethod(const_cast<TimeLogRecentModel*>(this), "getNewerHistory",
+                                      Qt::QueuedConnection);
+        }
+    }
+
+    return SUPER::data(index, role);
+}
+
 bool TimeLogRecentModel::canFetchMore(const QModelIndex &parent) const
 {
     if (parent != QModelIndex()) {
         return false;
     }
 
-    bool result = m_history ? m_history->size() > m_timeLog.size() : false;
+    bool result = m_history ? !m_isHeadLoaded && m_history->size() > m_timeLog.size() : false;
     if (!result) {
         m_moreDataRequested = true;
     }
@@ -51,67 +73,95 @@ void TimeLogRecentModel::fetchMore(const QModelIndex &parent)
     getMoreHistory();
 }
 
+void TimeLogRecentModel::clear()
+{
+    m_isHeadLoaded = false;
+    m_isTailLoaded = true;
+    m_lastAccessedRow = 0;
+
+    SUPER::clear();
+}
+
 void TimeLogRecentModel::processHistoryData(QVector<TimeLogEntry> data)
 {
+    if (data.size() < defaultPopulateCount) {
+        if (m_fetchDirection == FetchOlder) {
+            m_isHeadLoaded = true;
+        } else {
+            m_isTailLoaded = true;
+        }
+    }
+
     if (!data.size()) {
         return;
     }
 
     int index = 0;
 
-    if (!m_timeLog.isEmpty() && !startTimeCompare(data.last(), m_timeLog.first())) {
-        QVector<TimeLogEntry>::iterator it = std::lower_bound(m_timeLog.begin(), m_timeLog.end(),
-                                                              data.last(), startTimeCompare);
-        index = it - m_timeLog.begin();
+    if (!m_timeLog.isEmpty() && m_timeLog.startTime(m_timeLog.size() - 1) < data.first().startTime) {
+        index = m_timeLog.size();
+    } else if (!m_timeLog.isEmpty() && !(data.last().startTime < m_timeLog.startTime(0))) {
+        index = m_timeLog.lowerBound(data.last().startTime);
+        qCWarning(TIME_LOG_MODEL_CATEGORY) << "Inserting data not into beginning, current data:\n"
+                                           << m_timeLog.startTime(0) << "-" << m_timeLog.startTime(m_timeLog.size() - 1)
+                                           << "\nnew data:\n"
+                                           << data.first().startTime << "-" << data.last().startTime;
     }
 
     beginInsertRows(QModelIndex(), index, index + data.size() - 1);
-    if (index == 0) {
-        data.append(m_timeLog);
-        m_timeLog.swap(data);
+    if (index == m_timeLog.size()) {
+        m_timeLog.append(data);
+        appendToUuidIndex(index);
     } else {
-        qCWarning(TIME_LOG_MODEL_CATEGORY) << "Inserting data not into beginning, current data:\n"
-                                           << m_timeLog.first().startTime << "-" << m_timeLog.last().startTime
-                                           << "\nnew data:\n"
-                                           << data.first().startTime << "-" << data.last().startTime;
-        m_timeLog.insert(index, data.size(), TimeLogEntry());
-        for (int i = 0; i < data.size(); i++) {
-            m_timeLog[index+i] = data.at(i);
+        m_timeLog.insert(index, data);
+        invalidateUuidIndex();
+        if (m_lastAccessedRow >= index) {
+            m_lastAccessedRow += data.size();
         }
     }
     endInsertRows();
+
+    evictRows();
 }
 
 void TimeLogRecentModel::processDataInsert(TimeLogEntry data)
 {
-    if (m_timeLog.isEmpty() || startTimeCompare(data, m_timeLog.first())) {
+    if (m_timeLog.isEmpty() || data.startTime < m_timeLog.startTime(0)) {
         if (m_moreDataRequested) {
             m_moreDataRequested = false;
         } else {
+            m_isHeadLoaded = false;
             return;
         }
+    } else if (!m_isTailLoaded && m_timeLog.startTime(m_timeLog.size() - 1) < data.startTime) {
+        // Would be fetched with the newer entries
+        return;
     }
 
-    QVector<TimeLogEntry>::iterator it = std::lower_bound(m_timeLog.begin(), m_timeLog.end(),
-                                                          data, startTimeCompare);
-    if (it != m_timeLog.end() && it->uuid == data.uuid) {
+    int index = m_timeLog.lowerBound(data.startTime);
+    if (index != m_timeLog.size() && m_timeLog.uuid(index) == data.uuid) {
         return;
     }
-    int index = (it == m_timeLog.end() ? m_timeLog.size() : it - m_timeLog.begin());
 
     beginInsertRows(QModelIndex(), index, index);
     m_timeLog.insert(index, data);
+    if (index == m_timeLog.size() - 1) {
+        appendToUuidIndex(index);
+    } else {
+        invalidateUuidIndex();
+    }
     endInsertRows();
+
+    evictRows();
 }
 
 int TimeLogRecentModel::findData(const TimeLogEntry &entry) const
 {
-    QVector<TimeLogEntry>::const_iterator it = std::lower_bound(m_timeLog.begin(), m_timeLog.end(),
-                                                                entry, startTimeCompare);
-    if (it == m_timeLog.end() || it->uuid != entry.uuid) {
+    int index = m_timeLog.lowerBound(entry.startTime);
+    if (index == m_timeLog.size() || m_timeLog.uuid(index) != entry.uuid) {
         return -1;
     } else {
-        return (it - m_timeLog.begin());
+        return index;
     }
 }
 
@@ -135,6 +185,13 @@ void TimeLogRecentModel::setHistory(TimeLogHistory *history)
                 this, SLOT(setAvailableSize(qlonglong)));
 
         setAvailableSize(history->size());
+
+        // DB could be not opened yet, the entries are refreshed if they turn out to be outdated
+        QVector<TimeLogEntry> snapshotEntries(history->snapshotEntries());
+        if (!snapshotEntries.isEmpty()) {
+            m_fetchDirection = FetchOlder;
+            processHistoryData(snapshotEntries);
+        }
     }
 }
 
@@ -165,8 +222,53 @@ void TimeLogRecentModel::getMoreHistory()
         return;
     }
 
-    QDateTime until = m_timeLog.size() ? m_timeLog.at(0).startTime : QDateTime::currentDateTimeUtc();
+    QDateTime until = m_timeLog.size() ? m_timeLog.startTime(0) : QDateTime::currentDateTimeUtc();
     qlonglong id = QDateTime::currentMSecsSinceEpoch();
     m_pendingRequests.append(id);
+    m_fetchDirection = FetchOlder;
     m_history->getHistoryBefore(id, defaultPopulateCount, until);
 }
+
+void TimeLogRecentModel::getNewerHistory()
+{
+    m_isNewerDataQueued = false;
+
+    if (!m_history || m_isTailLoaded || m_timeLog.isEmpty()) {
+        return;
+    }
+
+    if (!m_pendingRequests.isEmpty()) {
+        qCDebug(TIME_LOG_MODEL_CATEGORY) << "Data already requested";
+        return;
+    }
+
+    qlonglong id = QDateTime::currentMSecsSinceEpoch();
+    m_pendingRequests.append(id);
+    m_fetchDirection = FetchNewer;
+    m_history->getHistoryAfter(id, defaultPopulateCount, m_timeLog.startTime(m_timeLog.size() - 1));
+}
+
+void TimeLogRecentModel::evictRows()
+{
+    int count = m_timeLog.size() - maxWindowSize;
+    if (count <= 0) {
+        return;
+    }
+
+    // Keep the rows around the viewport, drop the far end
+    if (m_lastAccessedRow < m_timeLog.size() / 2) {
+        int first = m_timeLog.size() - count;
+        beginRemoveRows(QModelIndex(), first, m_timeLog.size() - 1);
+        m_timeLog.remove(first, count);
+        m_isTailLoaded = false;
+        invalidateUuidIndex();
+        endRemoveRows();
+    } else {
+        beginRemoveRows(QModelIndex(), 0, count - 1);
+        m_timeLog.remove(0, count);
+        m_isHeadLoaded = false;
+        m_lastAccessedRow = qMax(m_lastAccessedRow - count, 0);
+        invalidateUuidIndex();
+        endRemoveRows();
+    }
+}
@@ -29,6 +29,8 @@ class TimeLogRecentModel : public TimeLogModel
 public:
     explicit TimeLogRecentModel(QObject *parent = 0);
 
+    virtual QVariant data(const QModelIndex &index, int role) const;
+
     virtual bool canFetchMore(const QModelIndex &parent) const;
     virtual void fetchMore(const QModelIndex & parent);
 
@@ -36,6 +38,7 @@ signals:
     void availableSizeChanged(qlonglong newAvailableSize);
 
 protected:
+    virtual void clear();
     virtual void processHistoryData(QVector<TimeLogEntry> data);
     virtual void processDataInsert(TimeLogEntry data);
     virtual int findData(const TimeLogEntry &entry) const;
@@ -45,12 +48,25 @@ protected slots:
 
 private slots:
     void setAvailableSize(qlonglong availableSize);
+    void getNewerHistory();
 
 private:
+    enum FetchDirection {
+        FetchOlder,
+        FetchNewer
+    };
+
     void getMoreHistory();
+    void evictRows();
 
     mutable bool m_moreDataRequested;
     qlonglong m_availableSize;
+    FetchDirection m_fetchDirection;
+    // Whether the oldest and the newest entries are in the window
+    bool m_isHeadLoaded;
+    bool m_isTailLoaded;
+    mutable bool m_isNewerDataQueued;
+    mutable int m_lastAccessedRow;
 };
 
 #endif // TIMELOGRECENTMODEL_H
@@ -0,0 +1,257 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QTcpSocket>
+
+#include "TimeLogRemoteHistory.h"
+#include "TimeLogSyncProtocol.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(REMOTE_HISTORY_CATEGORY, "TimeLogRemoteHistory", QtInfoMsg)
+
+TimeLogRemoteHistory::TimeLogRemoteHistory(QObject *parent) :
+    QObject(parent),
+    m_socket(new QTcpSocket(this)),
+    m_isConnected(false)
+{
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(socketReadyRead()));
+    connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError()));
+}
+
+void TimeLogRemoteHistory::setToken(const QString &token)
+{
+    m_token = token;
+}
+
+void TimeLogRemoteHistory::connectToPeer(const QString &host, quint16 port)
+{
+    disconnectFromPeer();
+
+    qCDebug(REMOTE_HISTORY_CATEGORY) << "Connecting to" << host << port;
+
+    m_socket->connectToHost(host, port);
+}
+
+void TimeLogRemoteHistory::disconnectFromPeer()
+{
+    m_isConnected = false;
+    m_buffer.clear();
+    m_serverProof.clear();
+    m_socket->abort();
+}
+
+bool TimeLogRemoteHistory::isConnected() const
+{
+    return m_isConnected;
+}
+
+void TimeLogRemoteHistory::sync(const QVector<TimeLogSyncDataEntry> &updatedData,
+                                const QVector<TimeLogSyncDataEntry> &removedData,
+                                const QVector<TimeLogSyncDataCategory> &categoryData)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << updatedData << removedData << categoryData;
+
+    send(TimeLogSyncProtocol::SyncMessage, payload);
+}
+
+void TimeLogRemoteHistory::updateHashes()
+{
+    send(TimeLogSyncProtocol::UpdateHashesMessage);
+}
+
+void TimeLogRemoteHistory::getSyncData(const QDateTime &mBegin, const QDateTime &mEnd) const
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << mBegin << mEnd;
+
+    send(TimeLogSyncProtocol::GetSyncDataMessage, payload);
+}
+
+void TimeLogRemoteHistory::getHashes(const QDateTime &maxDate, bool noUpdate)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << maxDate << noUpdate;
+
+    send(TimeLogSyncProtocol::GetHashesMessage, payload);
+}
+
+void TimeLogRemoteHistory::getDayHashes(const QDateTime &begin, const QDateTime &end) const
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << begin << end;
+
+    send(TimeLogSyncProtocol::GetDayHashesMessage, payload);
+}
+
+void TimeLogRemoteHistory::socketReadyRead()
+{
+    m_buffer.append(m_socket->readAll());
+
+    TimeLogSyncProtocol::MessageType type;
+    QByteArray payload;
+    bool isValid = true;
+    while (TimeLogSyncProtocol::takeMessage(m_buffer, type, payload, isValid)) {
+        if (!processMessage(type, payload)) {
+            return;
+        }
+    }
+
+    if (!isValid) {
+        qCCritical(REMOTE_HISTORY_CATEGORY) << "Invalid message from peer" << m_socket->peerName();
+        disconnectFromPeer();
+        emit error(tr("Invalid message from sync peer"));
+    }
+}
+
+void TimeLogRemoteHistory::socketError()
+{
+    qCCritical(REMOTE_HISTORY_CATEGORY) << "Socket error:" << m_socket->errorString();
+
+    QString errorString(m_socket->errorString());
+    disconnectFromPeer();
+    emit error(tr("Sync peer error: %1").arg(errorString));
+}
+
+void TimeLogRemoteHistory::send(int type, const QByteArray &payload) const
+{
+    m_socket->write(TimeLogSyncProtocol::message(static_cast<TimeLogSyncProtocol::MessageType>(type), payload));
+}
+
+bool TimeLogRemoteHistory::processMessage(int type, const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+
+    switch (type) {
+    case TimeLogSyncProtocol::HelloMessage: {
+        quint32 version = 0;
+        stream >> version;
+        if (version != TimeLogSyncProtocol::version) {
+            qCCritical(REMOTE_HISTORY_CATEGORY) << "Unsupported protocol version" << version;
+            disconnectFromPeer();
+            emit error(tr("Unsupported sync protocol version %1").arg(version));
+            return false;
+        }
+
+        // First hello of the server has its nonce, the next one has its proof
+        if (m_serverProof.isEmpty()) {
+            QByteArray serverNonce;
+            stream >> serverNonce;
+            if (stream.status() != QDataStream::Ok || serverNonce.size() != TimeLogSyncProtocol::nonceSize) {
+                qCCritical(REMOTE_HISTORY_CATEGORY) << "Invalid nonce from peer" << m_socket->peerName();
+                disconnectFromPeer();
+                emit error(tr("Invalid message from sync peer"));
+                return false;
+            }
+
+            QByteArray clientNonce(TimeLogSyncProtocol::nonce());
+            m_serverProof = TimeLogSyncProtocol::proof(m_token, true, serverNonce, clientNonce);
+
+            QByteArray reply;
+            QDataStream replyStream(&reply, QIODevice::WriteOnly);
+            replyStream.setVersion(TimeLogSyncProtocol::streamVersion);
+            replyStream << TimeLogSyncProtocol::version << clientNonce
+                        << TimeLogSyncProtocol::proof(m_token, false, serverNonce, clientNonce);
+            send(TimeLogSyncProtocol::HelloMessage, reply);
+            break;
+        }
+
+        QByteArray serverProof;
+        stream >> serverProof;
+        if (stream.status() != QDataStream::Ok || !TimeLogSyncProtocol::isProofEqual(serverProof, m_serverProof)) {
+            qCCritical(REMOTE_HISTORY_CATEGORY) << "Peer has no token" << m_socket->peerName();
+            disconnectFromPeer();
+            emit error(tr("Sync peer does not have the token"));
+            return false;
+        }
+        m_isConnected = true;
+        emit connected();
+        break;
+    }
+    case TimeLogSyncProtocol::ErrorMessage: {
+        QString errorText;
+        stream >> errorText;
+        qCCritical(REMOTE_HISTORY_CATEGORY) << "Peer error:" << errorText;
+        emit error(errorText);
+        break;
+    }
+    case TimeLogSyncProtocol::ChangedMessage:
+        emit dataChanged();
+        break;
+    case TimeLogSyncProtocol::HashesMessage: {
+        QMap<QDateTime, QByteArray> hashes;
+        stream >> hashes;
+        if (stream.status() == QDataStream::Ok) {
+            emit hashesAvailable(hashes);
+        }
+        break;
+    }
+    case TimeLogSyncProtocol::DayHashesMessage: {
+        QMap<QDateTime, QByteArray> hashes;
+        QDateTime begin, end;
+        stream >> hashes >> begin >> end;
+        if (stream.status() == QDataStream::Ok) {
+            emit dayHashesAvailable(hashes, begin, end);
+        }
+        break;
+    }
+    case TimeLogSyncProtocol::SyncDataMessage: {
+        QVector<TimeLogSyncDataEntry> entryData;
+        QVector<TimeLogSyncDataCategory> categoryData;
+        QDateTime until;
+        stream >> entryData >> categoryData >> until;
+        if (stream.status() == QDataStream::Ok) {
+            emit syncDataAvailable(entryData, categoryData, until);
+        }
+        break;
+    }
+    case TimeLogSyncProtocol::DataSyncedMessage: {
+        QDateTime maxSyncDate;
+        stream >> maxSyncDate;
+        if (stream.status() == QDataStream::Ok) {
+            emit dataSynced(maxSyncDate);
+        }
+        break;
+    }
+    case TimeLogSyncProtocol::HashesUpdatedMessage:
+        emit hashesUpdated();
+        break;
+    default:
+        qCWarning(REMOTE_HISTORY_CATEGORY) << "Unexpected message" << type;
+        break;
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCCritical(REMOTE_HISTORY_CATEGORY) << "Fail to read message" << type;
+        disconnectFromPeer();
+        emit error(tr("Invalid message from sync peer"));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,83 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGREMOTEHISTORY_H
+#define TIMELOGREMOTEHISTORY_H
+
+#include <QObject>
+#include <QMap>
+#include <QVector>
+
+#include "TimeLogSyncDataEntry.h"
+#include "TimeLogSyncDataCategory.h"
+
+class QTcpSocket;
+
+// Sync part of the TimeLogHistory interface, served by TimeLogSyncServer of the peer
+class TimeLogRemoteHistory : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TimeLogRemoteHistory(QObject *parent = 0);
+
+    void setToken(const QString &token);
+    void connectToPeer(const QString &host, quint16 port);
+    void disconnectFromPeer();
+    bool isConnected() const;
+
+public slots:
+    void sync(const QVector<TimeLogSyncDataEntry> &updatedData,
+              const QVector<TimeLogSyncDataEntry> &removedData,
+              const QVector<TimeLogSyncDataCategory> &categoryData);
+    void updateHashes();
+
+    void getSyncData(const QDateTime &mBegin = QDateTime(),
+                     const QDateTime &mEnd = QDateTime()) const;
+
+    void getHashes(const QDateTime &maxDate = QDateTime(), bool noUpdate = false);
+    void getDayHashes(const QDateTime &begin, const QDateTime &end) const;
+
+signals:
+    void error(const QString &errorText) const;
+    void connected() const;
+    void dataChanged() const;
+
+    void syncDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                           QVector<TimeLogSyncDataCategory> categoryData, QDateTime until) const;
+    void hashesAvailable(QMap<QDateTime, QByteArray> hashes) const;
+    void dayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end) const;
+    void dataSynced(const QDateTime &maxSyncDate) const;
+    void hashesUpdated() const;
+
+private slots:
+    void socketReadyRead();
+    void socketError();
+
+private:
+    void send(int type, const QByteArray &payload = QByteArray()) const;
+    bool processMessage(int type, const QByteArray &payload);
+
+    QString m_token;
+    QTcpSocket *m_socket;
+    QByteArray m_buffer;
+    // Expected from the server, once own proof is sent
+    QByteArray m_serverProof;
+    bool m_isConnected;
+};
+
+#endif // TIMELOGREMOTEHISTORY_H
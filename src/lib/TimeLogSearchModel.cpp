@@ -16,25 +16,46 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <QRegularExpression>
+
 #include "TimeLogSearchModel.h"
 
+static const uint historyChunkSize(500);
+
 TimeLogSearchModel::TimeLogSearchModel(QObject *parent) :
     SUPER(parent),
     m_begin(QDateTime::currentDateTimeUtc()),
-    m_end(QDateTime::currentDateTimeUtc())
+    m_end(QDateTime::currentDateTimeUtc()),
+    m_loadedWithSubcategories(false),
+    m_isUpdateScheduled(false)
 {
     connect(this, SIGNAL(beginChanged(QDateTime)),
-            this, SLOT(updateData()));
+            this, SLOT(scheduleUpdate()));
     connect(this, SIGNAL(endChanged(QDateTime)),
-            this, SLOT(updateData()));
+            this, SLOT(scheduleUpdate()));
     connect(this, SIGNAL(categoryChanged(QString)),
-            this, SLOT(updateData()));
+            this, SLOT(scheduleUpdate()));
     connect(this, SIGNAL(withSubcategoruesChanged(bool)),
-            this, SLOT(updateData()));
+            this, SLOT(scheduleUpdate()));
+    connect(this, SIGNAL(textChanged(QString)),
+            this, SLOT(scheduleUpdate()));
+}
+
+void TimeLogSearchModel::scheduleUpdate()
+{
+    // Properties are often set together, refresh once for all of them
+    if (m_isUpdateScheduled) {
+        return;
+    }
+
+    m_isUpdateScheduled = true;
+    QMetaObject::invokeMethod(this, "updateData", Qt::QueuedConnection);
 }
 
 void TimeLogSearchModel::updateData()
 {
+    m_isUpdateScheduled = false;
+
     if (!m_history) {
         return;
     }
@@ -43,28 +64,69 @@ void TimeLogSearchModel::updateData()
         return;
     }
 
+    if (m_pendingRequests.isEmpty() && m_loadedBegin.isValid()
+        && m_category == m_loadedCategory && m_withSubcategories == m_loadedWithSubcategories
+        && m_text == m_loadedText && m_begin <= m_loadedEnd && m_end >= m_loadedBegin) {
+        updateRange();
+        return;
+    }
+
     clear();
-    qlonglong id = QDateTime::currentMSecsSinceEpoch();
-    m_pendingRequests.append(id);
-    m_history->getHistoryBetween(id, m_begin, m_end, m_category, m_withSubcategories);
+    requestData(m_begin, m_end);
+
+    m_loadedBegin = m_begin;
+    m_loadedEnd = m_end;
+    m_loadedCategory = m_category;
+    m_loadedWithSubcategories = m_withSubcategories;
+    m_loadedText = m_text;
+}
+
+void TimeLogSearchModel::clear()
+{
+    m_loadedBegin = QDateTime();
+    m_loadedEnd = QDateTime();
+
+    SUPER::clear();
+}
+
+void TimeLogSearchModel::processHistoryData(QVector<TimeLogEntry> data)
+{
+    if (!data.size()) {
+        return;
+    }
+
+    int index = m_timeLog.lowerBound(data.first().startTime);
+    if (index == m_timeLog.size()) {
+        SUPER::processHistoryData(data);
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), index, index + data.size() - 1);
+    m_timeLog.insert(index, data);
+    invalidateUuidIndex();
+    endInsertRows();
 }
 
 void TimeLogSearchModel::processDataInsert(TimeLogEntry data)
 {
     if (data.startTime < m_begin || data.startTime > m_end
-        || (!m_category.isEmpty() && !data.category.startsWith(m_category))) {
+        || (!m_category.isEmpty() && !data.category.startsWith(m_category))
+        || !isTextMatches(data.comment)) {
         return;
     }
 
-    QVector<TimeLogEntry>::iterator it = std::lower_bound(m_timeLog.begin(), m_timeLog.end(),
-                                                          data, startTimeCompare);
-    if (it != m_timeLog.end() && it->uuid == data.uuid) {
+    int index = m_timeLog.lowerBound(data.startTime);
+    if (index != m_timeLog.size() && m_timeLog.uuid(index) == data.uuid) {
         return;
     }
-    int index = (it == m_timeLog.end() ? m_timeLog.size() : it - m_timeLog.begin());
 
     beginInsertRows(QModelIndex(), index, index);
     m_timeLog.insert(index, data);
+    if (index == m_timeLog.size() - 1) {
+        appendToUuidIndex(index);
+    } else {
+        invalidateUuidIndex();
+    }
     endInsertRows();
 }
 
@@ -75,11 +137,67 @@ int TimeLogSearchModel::findData(const TimeLogEntry &entry) const
         return -1;
     }
 
-    QVector<TimeLogEntry>::const_iterator it = std::lower_bound(m_timeLog.begin(), m_timeLog.end(),
-                                                                entry, startTimeCompare);
-    if (it == m_timeLog.end() || it->uuid != entry.uuid) {
+    int index = m_timeLog.lowerBound(entry.startTime);
+    if (index == m_timeLog.size() || m_timeLog.uuid(index) != entry.uuid) {
         return -1;
     } else {
-        return (it - m_timeLog.begin());
+        return index;
+    }
+}
+
+void TimeLogSearchModel::requestData(const QDateTime &begin, const QDateTime &end)
+{
+    qlonglong id = QDateTime::currentMSecsSinceEpoch();
+    while (m_pendingRequests.contains(id)) {
+        id++;
+    }
+    m_pendingRequests.append(id);
+    if (m_text.isEmpty()) {
+        m_history->getHistoryBetween(id, begin, end, m_category, m_withSubcategories, historyChunkSize);
+    } else {
+        m_history->searchComments(id, m_text, begin, end, m_category, m_withSubcategories);
     }
 }
+
+void TimeLogSearchModel::updateRange()
+{
+    // Trim the rows out of the new range
+    int index = m_timeLog.upperBound(m_end);
+    if (index != m_timeLog.size()) {
+        beginRemoveRows(QModelIndex(), index, m_timeLog.size() - 1);
+        m_timeLog.remove(index, m_timeLog.size() - index);
+        invalidateUuidIndex();
+        endRemoveRows();
+    }
+
+    int count = m_timeLog.lowerBound(m_begin);
+    if (count != 0) {
+        beginRemoveRows(QModelIndex(), 0, count - 1);
+        m_timeLog.remove(0, count);
+        invalidateUuidIndex();
+        endRemoveRows();
+    }
+
+    // Fetch only the extension of the range, the DB stores time in seconds
+    if (m_begin.toTime_t() < m_loadedBegin.toTime_t()) {
+        requestData(m_begin, m_loadedBegin.addSecs(-1));
+    }
+    if (m_end.toTime_t() > m_loadedEnd.toTime_t()) {
+        requestData(m_loadedEnd.addSecs(1), m_end);
+    }
+
+    m_loadedBegin = m_begin;
+    m_loadedEnd = m_end;
+}
+
+bool TimeLogSearchModel::isTextMatches(const QString &comment) const
+{
+    // Approximates the comment index search, which matches all words, the last one by prefix
+    for (const QString &word: m_text.split(QRegularExpression("\\s+"), QString::SkipEmptyParts)) {
+        if (!comment.contains(word, Qt::CaseInsensitive)) {
+            return false;
+        }
+    }
+
+    return true;
+}
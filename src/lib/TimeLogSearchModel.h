@@ -28,6 +28,7 @@ class TimeLogSearchModel : public TimeLogModel
     Q_PROPERTY(QDateTime end MEMBER m_end NOTIFY endChanged)
     Q_PROPERTY(QString category MEMBER m_category NOTIFY categoryChanged)
     Q_PROPERTY(bool withSubcategories MEMBER m_withSubcategories NOTIFY withSubcategoruesChanged)
+    Q_PROPERTY(QString text MEMBER m_text NOTIFY textChanged)
     typedef TimeLogModel SUPER;
 public:
     explicit TimeLogSearchModel(QObject *parent = 0);
@@ -37,18 +38,34 @@ signals:
     void endChanged(const QDateTime &end);
     void categoryChanged(const QString &category);
     void withSubcategoruesChanged(bool withSubcategories);
+    void textChanged(const QString &text);
 
 private slots:
+    void scheduleUpdate();
     void updateData();
 
 private:
+    virtual void clear();
+    virtual void processHistoryData(QVector<TimeLogEntry> data);
     virtual void processDataInsert(TimeLogEntry data);
     virtual int findData(const TimeLogEntry &entry) const;
+    bool isTextMatches(const QString &comment) const;
+    void requestData(const QDateTime &begin, const QDateTime &end);
+    void updateRange();
 
     QDateTime m_begin;
     QDateTime m_end;
     QString m_category;
     bool m_withSubcategories;
+    QString m_text;
+
+    // Parameters of the data currently in the model
+    QDateTime m_loadedBegin;
+    QDateTime m_loadedEnd;
+    QString m_loadedCategory;
+    bool m_loadedWithSubcategories;
+    QString m_loadedText;
+    bool m_isUpdateScheduled;
 };
 
 #endif // TIMELOGSEARCHMODEL_H
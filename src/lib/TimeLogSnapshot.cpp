@@ -0,0 +1,167 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStandardPaths>
+
+#include <QLoggingCategory>
+
+#include "TimeLogSnapshot.h"
+#include "TimeLogCategoryTreeNode.h"
+#include "AbstractDataInOut.h"
+
+Q_LOGGING_CATEGORY(SNAPSHOT_CATEGORY, "TimeLogSnapshot", QtInfoMsg)
+
+const char snapshotFileMagic[] = "GTTC";
+const int snapshotFileMagicSize = 4;
+const qint32 snapshotFormatVersion = 2;
+const qint32 snapshotStreamVersion = QDataStream::Qt_5_6;
+// Guards against reading garbage from the damaged file
+const qint32 maxSnapshotItems = 1000000;
+const int maxSnapshotDepth = 256;
+
+static void writeNode(QDataStream &stream, const TimeLogCategoryTreeNode *node)
+{
+    stream << node->category << node->hasItems << static_cast<qint32>(node->itemsCount)
+           << static_cast<qint32>(node->children().size());
+    for (const TimeLogCategoryTreeNode *child: node->children()) {
+        stream << child->name;
+        writeNode(stream, child);
+    }
+}
+
+static bool readNode(QDataStream &stream, TimeLogCategoryTreeNode *node, int depth = 0)
+{
+    qint32 itemsCount, count;
+    stream >> node->category >> node->hasItems >> itemsCount >> count;
+    node->itemsCount = itemsCount;
+    if (stream.status() != QDataStream::Ok || count < 0 || count > maxSnapshotItems || depth > maxSnapshotDepth) {
+        return false;
+    }
+
+    for (qint32 i = 0; i < count; i++) {
+        QString name;
+        stream >> name;
+        if (!readNode(stream, node->addChild(name), depth + 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TimeLogSnapshot::TimeLogSnapshot() :
+    size(0)
+{
+
+}
+
+bool TimeLogSnapshot::isEmpty() const
+{
+    return (size == 0 && recentEntries.isEmpty() && !categories);
+}
+
+QString TimeLogSnapshot::defaultPath(const QString &dataPath)
+{
+    return QString("%1/timelog/snapshot")
+            .arg(!dataPath.isEmpty() ? dataPath
+                                     : QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+}
+
+bool TimeLogSnapshot::load(const QString &filePath, TimeLogSnapshot &snapshot)
+{
+    QFile file(filePath);
+    if (!file.exists()) {
+        return false;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(SNAPSHOT_CATEGORY) << AbstractDataInOut::formatFileError("Fail to open file", file);
+        return false;
+    }
+
+    if (file.read(snapshotFileMagicSize) != QByteArray(snapshotFileMagic, snapshotFileMagicSize)) {
+        qCWarning(SNAPSHOT_CATEGORY) << "Not a snapshot file" << filePath;
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(snapshotStreamVersion);
+    qint32 version, count;
+    stream >> version;
+    if (version != snapshotFormatVersion) {
+        qCInfo(SNAPSHOT_CATEGORY) << "Unsupported snapshot version" << version;
+        return false;
+    }
+
+    TimeLogSnapshot result;
+    stream >> result.size >> count;
+    if (stream.status() != QDataStream::Ok || count < 0 || count > maxSnapshotItems) {
+        qCWarning(SNAPSHOT_CATEGORY) << AbstractDataInOut::formatFileError("Error reading from file", file);
+        return false;
+    }
+    result.recentEntries.reserve(count);
+    for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        TimeLogEntry entry;
+        stream >> entry >> entry.durationTime >> entry.precedingStart;
+        result.recentEntries.append(entry);
+    }
+
+    TimeLogCategoryTreeNode *rootCategory = new TimeLogCategoryTreeNode("RootCategory");
+    result.categories = QSharedPointer<TimeLogCategoryTreeNode>(rootCategory);
+    if (stream.status() != QDataStream::Ok || !readNode(stream, rootCategory)) {
+        qCWarning(SNAPSHOT_CATEGORY) << AbstractDataInOut::formatFileError("Error reading from file", file);
+        return false;
+    }
+
+    snapshot = result;
+
+    return true;
+}
+
+bool TimeLogSnapshot::save(const QString &filePath, const TimeLogSnapshot &snapshot)
+{
+    // Written to the temporary file, so the previous snapshot stays intact on failure
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(SNAPSHOT_CATEGORY) << "Fail to open file" << filePath << file.errorString();
+        return false;
+    }
+
+    file.write(snapshotFileMagic, snapshotFileMagicSize);
+
+    QDataStream stream(&file);
+    stream.setVersion(snapshotStreamVersion);
+    stream << snapshotFormatVersion << snapshot.size << static_cast<qint32>(snapshot.recentEntries.size());
+    for (const TimeLogEntry &entry: snapshot.recentEntries) {
+        stream << entry << entry.durationTime << entry.precedingStart;
+    }
+    if (snapshot.categories) {
+        writeNode(stream, snapshot.categories.data());
+    } else {
+        TimeLogCategoryTreeNode rootCategory("RootCategory");
+        writeNode(stream, &rootCategory);
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(SNAPSHOT_CATEGORY) << "Error writing to file" << filePath << file.errorString();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,47 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGSNAPSHOT_H
+#define TIMELOGSNAPSHOT_H
+
+#include <QSharedPointer>
+#include <QVector>
+
+#include "TimeLogEntry.h"
+
+class TimeLogCategoryTreeNode;
+
+// Data, needed to show the UI at startup, before the DB is opened
+struct TimeLogSnapshot
+{
+    TimeLogSnapshot();
+
+    bool isEmpty() const;
+
+    static QString defaultPath(const QString &dataPath);
+
+    static bool load(const QString &filePath, TimeLogSnapshot &snapshot);
+    static bool save(const QString &filePath, const TimeLogSnapshot &snapshot);
+
+    qlonglong size;
+    // Newest entries, sorted by start
+    QVector<TimeLogEntry> recentEntries;
+    QSharedPointer<TimeLogCategoryTreeNode> categories;
+};
+
+#endif // TIMELOGSNAPSHOT_H
@@ -31,3 +31,14 @@ TimeLogStats::TimeLogStats(int durationTime, const QString &category) :
 {
 
 }
+
+TimeLogStatsSeries::TimeLogStatsSeries() :
+    bucket(DayBucket)
+{
+
+}
+
+int TimeLogStatsSeries::durationTime(int bucketIndex, int categoryIndex) const
+{
+    return durations.at(bucketIndex * categories.size() + categoryIndex);
+}
@@ -20,6 +20,9 @@
 #define TIMELOGSTATS_H
 
 #include <QObject>
+#include <QDateTime>
+#include <QStringList>
+#include <QVector>
 
 struct TimeLogStats
 {
@@ -38,4 +41,27 @@ public:
 
 Q_DECLARE_TYPEINFO(TimeLogStats, Q_MOVABLE_TYPE);
 
+struct TimeLogStatsSeries
+{
+    enum Bucket {
+        HourBucket,
+        DayBucket,
+        WeekBucket,
+        MonthBucket
+    };
+
+    TimeLogStatsSeries();
+
+    int durationTime(int bucketIndex, int categoryIndex) const;
+
+    Bucket bucket;
+    QVector<QDateTime> buckets;
+    QStringList categories;
+    // Row per bucket, column per category
+    QVector<int> durations;
+};
+
+Q_DECLARE_TYPEINFO(TimeLogStatsSeries, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(TimeLogStatsSeries)
+
 #endif // TIMELOGSTATS_H
@@ -0,0 +1,431 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <algorithm>
+
+#include <QLoggingCategory>
+
+#include "TimeLogStatsModel.h"
+#include "TimeLogClock.h"
+#include "TimeTracker.h"
+#include "TimeLogTrace.h"
+
+Q_LOGGING_CATEGORY(STATS_MODEL_CATEGORY, "TimeLogStatsModel", QtInfoMsg)
+
+static const uint historyChunkSize(500);
+
+TimeLogStatsModel::TimeLogStatsModel(QObject *parent) :
+    SUPER(parent),
+    m_timeTracker(nullptr),
+    m_history(nullptr),
+    m_begin(QDateTime::currentDateTimeUtc()),
+    m_end(QDateTime::currentDateTimeUtc()),
+    m_separator(">"),
+    m_isUpdateScheduled(false)
+{
+    connect(this, SIGNAL(beginChanged(QDateTime)),
+            this, SLOT(scheduleUpdate()));
+    connect(this, SIGNAL(endChanged(QDateTime)),
+            this, SLOT(scheduleUpdate()));
+    connect(this, SIGNAL(categoryChanged(QString)),
+            this, SLOT(scheduleUpdate()));
+    connect(this, SIGNAL(separatorChanged(QString)),
+            this, SLOT(scheduleUpdate()));
+}
+
+int TimeLogStatsModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent)
+
+    return m_groups.size();
+}
+
+QVariant TimeLogStatsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_groups.size()) {
+        return QVariant();
+    }
+
+    const Group &group = m_groups.at(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case CategoryRole:
+        return QVariant::fromValue(group.category);
+    case DurationTimeRole:
+        return QVariant::fromValue(group.durationTime + runningTime(group.category));
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> TimeLogStatsModel::roleNames() const
+{
+    QHash<int, QByteArray> roles = SUPER::roleNames();
+    roles[CategoryRole] = "category";
+    roles[DurationTimeRole] = "durationTime";
+
+    return roles;
+}
+
+void TimeLogStatsModel::setTimeTracker(TimeTracker *timeTracker)
+{
+    if (m_timeTracker == timeTracker) {
+        return;
+    }
+
+    if (m_timeTracker) {
+        disconnect(this, SIGNAL(error(QString)),
+                   m_timeTracker, SIGNAL(error(QString)));
+        disconnect(m_timeTracker, SIGNAL(historyChanged(TimeLogHistory*)),
+                   this, SLOT(setHistory(TimeLogHistory*)));
+    }
+
+    m_timeTracker = timeTracker;
+
+    if (m_timeTracker) {
+        connect(this, SIGNAL(error(QString)),
+                m_timeTracker, SIGNAL(error(QString)));
+        connect(m_timeTracker, SIGNAL(historyChanged(TimeLogHistory*)),
+                this, SLOT(setHistory(TimeLogHistory*)));
+    }
+
+    setHistory(m_timeTracker ? m_timeTracker->history() : Q_NULLPTR);
+
+    emit timeTrackerChanged(m_timeTracker);
+}
+
+void TimeLogStatsModel::setHistory(TimeLogHistory *history)
+{
+    if (m_history == history) {
+        return;
+    }
+
+    if (m_history) {
+        disconnect(m_history, SIGNAL(dataOutdated()),
+                   this, SLOT(scheduleUpdate()));
+        disconnect(m_history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+                   this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+        disconnect(m_history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+                   this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+        disconnect(m_history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
+                   this, SLOT(historyDataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+        disconnect(m_history, SIGNAL(dataInserted(TimeLogEntry)),
+                   this, SLOT(historyDataInserted(TimeLogEntry)));
+        disconnect(m_history, SIGNAL(dataImported(QVector<TimeLogEntry>)),
+                   this, SLOT(historyDataImported(QVector<TimeLogEntry>)));
+        disconnect(m_history, SIGNAL(dataRemoved(TimeLogEntry)),
+                   this, SLOT(historyDataRemoved(TimeLogEntry)));
+        disconnect(m_history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+                   this, SLOT(historyDataBatchRemoved(QVector<TimeLogEntry>)));
+    }
+
+    m_history = history;
+
+    if (m_history) {
+        connect(m_history, SIGNAL(dataOutdated()),
+                this, SLOT(scheduleUpdate()));
+        connect(m_history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)),
+                this, SLOT(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+        connect(m_history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)),
+                this, SLOT(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+        connect(m_history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
+                this, SLOT(historyDataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+        connect(m_history, SIGNAL(dataInserted(TimeLogEntry)),
+                this, SLOT(historyDataInserted(TimeLogEntry)));
+        connect(m_history, SIGNAL(dataImported(QVector<TimeLogEntry>)),
+                this, SLOT(historyDataImported(QVector<TimeLogEntry>)));
+        connect(m_history, SIGNAL(dataRemoved(TimeLogEntry)),
+                this, SLOT(historyDataRemoved(TimeLogEntry)));
+        connect(m_history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)),
+                this, SLOT(historyDataBatchRemoved(QVector<TimeLogEntry>)));
+    }
+
+    scheduleUpdate();
+}
+
+void TimeLogStatsModel::scheduleUpdate()
+{
+    if (m_isUpdateScheduled) {
+        return;
+    }
+
+    m_isUpdateScheduled = true;
+    QMetaObject::invokeMethod(this, "updateData", Qt::QueuedConnection);
+}
+
+void TimeLogStatsModel::updateData()
+{
+    m_isUpdateScheduled = false;
+
+    clear();
+
+    if (!m_history || !m_begin.isValid() || !m_end.isValid()) {
+        return;
+    }
+
+    qlonglong id = QDateTime::currentMSecsSinceEpoch();
+    while (m_pendingRequests.contains(id)) {
+        id++;
+    }
+    m_pendingRequests.append(id);
+    m_history->getHistoryBetween(id, m_begin, m_end, m_category, true, historyChunkSize);
+}
+
+void TimeLogStatsModel::updateRunning()
+{
+    QStringList categories;
+    for (const QUuid &uuid: m_runningEntries) {
+        QString category = m_entries.value(uuid).category;
+        if (categories.contains(category)) {
+            continue;
+        }
+        categories.append(category);
+
+        int index = findGroup(category);
+        emit dataChanged(this->index(index, 0), this->index(index, 0),
+                         QVector<int>() << DurationTimeRole);
+    }
+}
+
+void TimeLogStatsModel::historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (!m_pendingRequests.removeOne(id)) {
+        return;
+    }
+
+    processEntries(data);
+}
+
+void TimeLogStatsModel::historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id)
+{
+    if (!m_pendingRequests.contains(id)) {
+        return;
+    }
+
+    processEntries(data);
+}
+
+void TimeLogStatsModel::historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields)
+{
+    Q_UNUSED(fields)
+
+    // Updated entries are always read back in full, so they simply replace the stored ones
+    processEntries(data);
+}
+
+void TimeLogStatsModel::historyDataInserted(TimeLogEntry data)
+{
+    setEntry(data);
+}
+
+void TimeLogStatsModel::historyDataImported(QVector<TimeLogEntry> data)
+{
+    processEntries(data);
+}
+
+void TimeLogStatsModel::historyDataRemoved(TimeLogEntry data)
+{
+    removeEntry(data.uuid);
+}
+
+void TimeLogStatsModel::historyDataBatchRemoved(QVector<TimeLogEntry> data)
+{
+    for (const TimeLogEntry &entry: data) {
+        removeEntry(entry.uuid);
+    }
+}
+
+void TimeLogStatsModel::clear()
+{
+    beginResetModel();
+
+    m_groups.clear();
+    m_entries.clear();
+    m_runningEntries.clear();
+    disconnect(TimeLogClock::instance(), SIGNAL(nowChanged(QDateTime)),
+               this, SLOT(updateRunning()));
+    if (m_history) {
+        for (qlonglong id: m_pendingRequests) {
+            m_history->cancelRequest(id);
+        }
+    }
+    m_pendingRequests.clear();
+
+    endResetModel();
+}
+
+void TimeLogStatsModel::processEntries(const QVector<TimeLogEntry> &data)
+{
+    TIMELOG_TRACE_SPAN("model", "statsEntries");
+
+    for (const TimeLogEntry &entry: data) {
+        setEntry(entry);
+    }
+}
+
+void TimeLogStatsModel::setEntry(const TimeLogEntry &entry)
+{
+    removeEntry(entry.uuid);
+
+    if (!isInRange(entry)) {
+        return;
+    }
+
+    Contribution contribution;
+    contribution.category = groupName(entry.category);
+    contribution.startTime = entry.startTime.toTime_t();
+    contribution.durationTime = entry.durationTime;
+    m_entries.insert(entry.uuid, contribution);
+
+    if (contribution.durationTime == -1) {
+        m_runningEntries.append(entry.uuid);
+        connect(TimeLogClock::instance(), SIGNAL(nowChanged(QDateTime)),
+                this, SLOT(updateRunning()), Qt::UniqueConnection);
+    }
+
+    addContribution(contribution.category, qMax(contribution.durationTime, 0));
+}
+
+void TimeLogStatsModel::removeEntry(const QUuid &uuid)
+{
+    QHash<QUuid, Contribution>::iterator it = m_entries.find(uuid);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    Contribution contribution = it.value();
+    m_entries.erase(it);
+
+    if (contribution.durationTime == -1) {
+        m_runningEntries.removeOne(uuid);
+        if (m_runningEntries.isEmpty()) {
+            disconnect(TimeLogClock::instance(), SIGNAL(nowChanged(QDateTime)),
+                       this, SLOT(updateRunning()));
+        }
+    }
+
+    removeContribution(contribution.category, qMax(contribution.durationTime, 0));
+}
+
+void TimeLogStatsModel::addContribution(const QString &category, qint64 durationTime)
+{
+    int index = findGroup(category);
+    if (index < m_groups.size() && m_groups.at(index).category == category) {
+        Group &group = m_groups[index];
+        group.durationTime += durationTime;
+        group.entriesCount++;
+        emit dataChanged(this->index(index, 0), this->index(index, 0),
+                         QVector<int>() << DurationTimeRole);
+        return;
+    }
+
+    Group group;
+    group.category = category;
+    group.durationTime = durationTime;
+    group.entriesCount = 1;
+
+    beginInsertRows(QModelIndex(), index, index);
+    m_groups.insert(index, group);
+    endInsertRows();
+}
+
+void TimeLogStatsModel::removeContribution(const QString &category, qint64 durationTime)
+{
+    int index = findGroup(category);
+    if (index == m_groups.size() || m_groups.at(index).category != category) {
+        qCWarning(STATS_MODEL_CATEGORY) << "No stats group for category" << category;
+        return;
+    }
+
+    Group &group = m_groups[index];
+    if (--group.entriesCount == 0) {
+        beginRemoveRows(QModelIndex(), index, index);
+        m_groups.remove(index);
+        endRemoveRows();
+        return;
+    }
+
+    group.durationTime -= durationTime;
+    emit dataChanged(this->index(index, 0), this->index(index, 0),
+                     QVector<int>() << DurationTimeRole);
+}
+
+// Returns the index of the group or the position to insert it
+int TimeLogStatsModel::findGroup(const QString &category) const
+{
+    QVector<Group>::const_iterator it = std::lower_bound(m_groups.cbegin(), m_groups.cend(), category,
+                                                         [](const Group &group, const QString &name) {
+        return group.category < name;
+    });
+
+    return it - m_groups.cbegin();
+}
+
+bool TimeLogStatsModel::isInRange(const TimeLogEntry &entry) const
+{
+    if (!entry.isValid()) {
+        return false;
+    }
+
+    uint start = entry.startTime.toTime_t();
+    if (start < m_begin.toTime_t() || start > m_end.toTime_t()) {
+        return false;
+    }
+
+    return m_category.isEmpty() || entry.category.startsWith(m_category);
+}
+
+// Same grouping as the stats query: the first level below the selected category
+QString TimeLogStatsModel::groupName(const QString &category) const
+{
+    int end;
+    if (m_category.isEmpty()) {
+        end = category.indexOf(m_separator);
+    } else {
+        end = category.indexOf(m_separator, m_category.size());
+        if (end != -1) {
+            end = category.indexOf(m_separator, end + m_separator.size());
+        }
+    }
+
+    QString result = (end == -1 ? category : category.left(end));
+    while (result.endsWith(' ')) {
+        result.chop(1);
+    }
+
+    return result;
+}
+
+qint64 TimeLogStatsModel::runningTime(const QString &category) const
+{
+    qint64 result = 0;
+    if (m_runningEntries.isEmpty()) {
+        return result;
+    }
+
+    qint64 now = TimeLogClock::instance()->now().toTime_t();
+    for (const QUuid &uuid: m_runningEntries) {
+        Contribution contribution = m_entries.value(uuid);
+        if (contribution.category == category) {
+            result += qMax(now - contribution.startTime, Q_INT64_C(0));
+        }
+    }
+
+    return result;
+}
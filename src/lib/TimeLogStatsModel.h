@@ -0,0 +1,119 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGSTATSMODEL_H
+#define TIMELOGSTATSMODEL_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QHash>
+#include <QUuid>
+
+#include "TimeLogHistory.h"
+
+class TimeTracker;
+
+class TimeLogStatsModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(TimeTracker* timeTracker MEMBER m_timeTracker WRITE setTimeTracker NOTIFY timeTrackerChanged)
+    Q_PROPERTY(QDateTime begin MEMBER m_begin NOTIFY beginChanged)
+    Q_PROPERTY(QDateTime end MEMBER m_end NOTIFY endChanged)
+    Q_PROPERTY(QString category MEMBER m_category NOTIFY categoryChanged)
+    Q_PROPERTY(QString separator MEMBER m_separator NOTIFY separatorChanged)
+    typedef QAbstractListModel SUPER;
+public:
+    enum Roles {
+        CategoryRole = Qt::UserRole + 1,
+        DurationTimeRole
+    };
+
+    explicit TimeLogStatsModel(QObject *parent = 0);
+
+    virtual int rowCount(const QModelIndex &parent) const;
+
+    virtual QVariant data(const QModelIndex &index, int role) const;
+    virtual QHash<int, QByteArray> roleNames() const;
+
+    void setTimeTracker(TimeTracker *timeTracker);
+
+signals:
+    void timeTrackerChanged(TimeTracker *newTimeTracker);
+    void beginChanged(const QDateTime &begin);
+    void endChanged(const QDateTime &end);
+    void categoryChanged(const QString &category);
+    void separatorChanged(const QString &separator);
+    void error(const QString &errorText) const;
+
+private slots:
+    void setHistory(TimeLogHistory *history);
+    void scheduleUpdate();
+    void updateData();
+    void updateRunning();
+    void historyRequestCompleted(QVector<TimeLogEntry> data, qlonglong id);
+    void historyRequestPartial(QVector<TimeLogEntry> data, qlonglong id);
+    void historyDataUpdated(QVector<TimeLogEntry> data, QVector<TimeLogHistory::Fields> fields);
+    void historyDataInserted(TimeLogEntry data);
+    void historyDataImported(QVector<TimeLogEntry> data);
+    void historyDataRemoved(TimeLogEntry data);
+    void historyDataBatchRemoved(QVector<TimeLogEntry> data);
+
+private:
+    struct Group
+    {
+        QString category;
+        qint64 durationTime;    // Finished entries only
+        int entriesCount;
+    };
+
+    struct Contribution
+    {
+        QString category;
+        qint64 startTime;
+        int durationTime;       // -1 for the running entry
+    };
+
+    void clear();
+    void processEntries(const QVector<TimeLogEntry> &data);
+    void setEntry(const TimeLogEntry &entry);
+    void removeEntry(const QUuid &uuid);
+    void addContribution(const QString &category, qint64 durationTime);
+    void removeContribution(const QString &category, qint64 durationTime);
+    int findGroup(const QString &category) const;
+    bool isInRange(const TimeLogEntry &entry) const;
+    QString groupName(const QString &category) const;
+    qint64 runningTime(const QString &category) const;
+
+    TimeTracker *m_timeTracker;
+    TimeLogHistory *m_history;
+    QDateTime m_begin;
+    QDateTime m_end;
+    QString m_category;
+    QString m_separator;
+
+    // Totals by the group name, sorted like the stats query results
+    QVector<Group> m_groups;
+    // Entries of the range, to apply the updates without the old values
+    QHash<QUuid, Contribution> m_entries;
+    // Running entries are advanced locally, on the shared clock
+    QVector<QUuid> m_runningEntries;
+    QList<qlonglong> m_pendingRequests;
+    bool m_isUpdateScheduled;
+};
+
+#endif // TIMELOGSTATSMODEL_H
@@ -0,0 +1,53 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGSYNCCHANGES_H
+#define TIMELOGSYNCCHANGES_H
+
+#include <QSharedPointer>
+#include <QVector>
+
+#include "TimeLogSyncDataEntry.h"
+#include "TimeLogSyncDataCategory.h"
+
+// Changes, applied by the sync, old and new items go in pairs.
+// Batch is shared between all receivers, so it should not be modified after sending.
+struct TimeLogSyncEntryChanges
+{
+    QVector<TimeLogSyncDataEntry> removedOld;
+    QVector<TimeLogSyncDataEntry> removedNew;
+    QVector<TimeLogSyncDataEntry> insertedOld;
+    QVector<TimeLogSyncDataEntry> insertedNew;
+    QVector<TimeLogSyncDataEntry> updatedOld;
+    QVector<TimeLogSyncDataEntry> updatedNew;
+};
+
+struct TimeLogSyncCategoryChanges
+{
+    QVector<TimeLogSyncDataCategory> removedOld;
+    QVector<TimeLogSyncDataCategory> removedNew;
+    QVector<TimeLogSyncDataCategory> addedOld;
+    QVector<TimeLogSyncDataCategory> addedNew;
+    QVector<TimeLogSyncDataCategory> updatedOld;
+    QVector<TimeLogSyncDataCategory> updatedNew;
+};
+
+Q_DECLARE_METATYPE(QSharedPointer<TimeLogSyncEntryChanges>)
+Q_DECLARE_METATYPE(QSharedPointer<TimeLogSyncCategoryChanges>)
+
+#endif // TIMELOGSYNCCHANGES_H
@@ -53,6 +53,11 @@ QDataStream &operator<<(QDataStream &stream, const TimeLogSyncDataCategory &data
     return stream << data.sync << data.category;
 }
 
+QDataStream &operator>>(QDataStream &stream, TimeLogSyncDataCategory &data)
+{
+    return stream >> data.sync >> data.category;
+}
+
 QDebug &operator<<(QDebug &stream, const TimeLogSyncDataCategory &data)
 {
     return stream << data.toString();
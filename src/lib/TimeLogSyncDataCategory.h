@@ -38,6 +38,7 @@ public:
 };
 
 QDataStream &operator<<(QDataStream &stream, const TimeLogSyncDataCategory &data);
+QDataStream &operator>>(QDataStream &stream, TimeLogSyncDataCategory &data);
 
 QDebug &operator<<(QDebug &stream, const TimeLogSyncDataCategory &data);
 
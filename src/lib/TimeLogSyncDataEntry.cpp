@@ -53,6 +53,11 @@ QDataStream &operator<<(QDataStream &stream, const TimeLogSyncDataEntry &data)
     return stream << data.sync << data.entry;
 }
 
+QDataStream &operator>>(QDataStream &stream, TimeLogSyncDataEntry &data)
+{
+    return stream >> data.sync >> data.entry;
+}
+
 QDebug &operator<<(QDebug &stream, const TimeLogSyncDataEntry &data)
 {
     return stream << data.toString();
@@ -35,6 +35,7 @@ public:
 };
 
 QDataStream &operator<<(QDataStream &stream, const TimeLogSyncDataEntry &data);
+QDataStream &operator>>(QDataStream &stream, TimeLogSyncDataEntry &data);
 
 QDebug &operator<<(QDebug &stream, const TimeLogSyncDataEntry &data);
 
@@ -0,0 +1,101 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QtEndian>
+#include <QMessageAuthenticationCode>
+#include <QUuid>
+
+#include "TimeLogSyncProtocol.h"
+
+const int messageHeaderSize = sizeof(quint32) + sizeof(quint8);
+
+const quint32 TimeLogSyncProtocol::maxMessageSize;
+const quint32 TimeLogSyncProtocol::maxHelloSize;
+const int TimeLogSyncProtocol::nonceSize;
+
+QByteArray TimeLogSyncProtocol::message(MessageType type, const QByteArray &payload)
+{
+    QByteArray result(messageHeaderSize, Qt::Uninitialized);
+    qToBigEndian<quint32>(payload.size(), reinterpret_cast<uchar*>(result.data()));
+    result[sizeof(quint32)] = static_cast<char>(type);
+    result.append(payload);
+
+    return result;
+}
+
+bool TimeLogSyncProtocol::takeMessage(QByteArray &buffer, MessageType &type, QByteArray &payload,
+                                      bool &isValid, quint32 maxSize)
+{
+    isValid = true;
+    if (buffer.size() < messageHeaderSize) {
+        return false;
+    }
+
+    quint32 size = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(buffer.constData()));
+    quint8 typeValue = static_cast<quint8>(buffer.at(sizeof(quint32)));
+    if (size > maxSize || typeValue == InvalidMessage || typeValue > HashesUpdatedMessage) {
+        isValid = false;
+        return false;
+    } else if (static_cast<quint32>(buffer.size() - messageHeaderSize) < size) {
+        return false;
+    }
+
+    type = static_cast<MessageType>(typeValue);
+    payload = buffer.mid(messageHeaderSize, size);
+    buffer.remove(0, messageHeaderSize + size);
+
+    return true;
+}
+
+QByteArray TimeLogSyncProtocol::nonce()
+{
+    // Random UUIDs are read from the system random source
+    QByteArray result;
+    while (result.size() < nonceSize) {
+        result.append(QUuid::createUuid().toRfc4122());
+    }
+    result.truncate(nonceSize);
+
+    return result;
+}
+
+QByteArray TimeLogSyncProtocol::proof(const QString &token, bool isServer,
+                                      const QByteArray &serverNonce, const QByteArray &clientNonce)
+{
+    QMessageAuthenticationCode code(QCryptographicHash::Sha256, token.toUtf8());
+    code.addData(isServer ? "server" : "client");
+    code.addData(serverNonce);
+    code.addData(clientNonce);
+
+    return code.result();
+}
+
+// All of the bytes are compared, so the timing of the reply doesn't tell how much of the proof is guessed
+bool TimeLogSyncProtocol::isProofEqual(const QByteArray &left, const QByteArray &right)
+{
+    if (left.size() != right.size()) {
+        return false;
+    }
+
+    char difference = 0;
+    for (int i = 0; i < left.size(); i++) {
+        difference |= left.at(i) ^ right.at(i);
+    }
+
+    return difference == 0;
+}
@@ -0,0 +1,71 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGSYNCPROTOCOL_H
+#define TIMELOGSYNCPROTOCOL_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QString>
+
+// Messages of the network sync, each one is a big-endian size, type byte and QDataStream payload.
+// Requests mirror TimeLogHistory sync methods and replies mirror its signals.
+// Server starts with the hello, which has its nonce. Client replies with own nonce and the proof of the token,
+// then server replies with own proof. Token itself never goes over the network, but the data is not encrypted,
+// so the peers should only be reached over the trusted network or a tunnel.
+class TimeLogSyncProtocol
+{
+public:
+    enum MessageType {
+        InvalidMessage          = 0,
+        HelloMessage            = 1,
+        ErrorMessage            = 2,
+        ChangedMessage          = 3,
+        GetHashesMessage        = 4,
+        HashesMessage           = 5,
+        GetDayHashesMessage     = 6,
+        DayHashesMessage        = 7,
+        GetSyncDataMessage      = 8,
+        SyncDataMessage         = 9,
+        SyncMessage             = 10,
+        DataSyncedMessage       = 11,
+        UpdateHashesMessage     = 12,
+        HashesUpdatedMessage    = 13
+    };
+
+    static const quint32 version = 2;
+    static const quint16 defaultPort = 47217;
+    static const int streamVersion = QDataStream::Qt_5_6;
+    // Largest reply is a single sync range, anything bigger is a broken peer
+    static const quint32 maxMessageSize = 256 * 1024 * 1024;
+    // Peer is not trusted until the hello, which has only the version, nonce and proof
+    static const quint32 maxHelloSize = 4 * 1024;
+    static const int nonceSize = 32;
+
+    static QByteArray message(MessageType type, const QByteArray &payload = QByteArray());
+    static bool takeMessage(QByteArray &buffer, MessageType &type, QByteArray &payload, bool &isValid,
+                            quint32 maxSize = maxMessageSize);
+
+    static QByteArray nonce();
+    // HMAC of both nonces, keyed by the token, proofs of the server and the client differ, so can't be replayed
+    static QByteArray proof(const QString &token, bool isServer,
+                            const QByteArray &serverNonce, const QByteArray &clientNonce);
+    static bool isProofEqual(const QByteArray &left, const QByteArray &right);
+};
+
+#endif // TIMELOGSYNCPROTOCOL_H
@@ -0,0 +1,410 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "TimeLogSyncServer.h"
+#include "TimeLogSyncProtocol.h"
+#include "TimeLogHistoryClient.h"
+#include "TimeLogCategoryTreeNode.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(SYNC_SERVER_CATEGORY, "TimeLogSyncServer", QtInfoMsg)
+
+TimeLogSyncServer::TimeLogSyncServer(TimeLogHistory *history, QObject *parent) :
+    QObject(parent),
+    m_history(history),
+    m_server(new QTcpServer(this))
+{
+    connect(m_server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+    connect(m_history, SIGNAL(error(QString)),
+            this, SLOT(historyError(QString)));
+
+    connect(m_history, SIGNAL(dataInserted(TimeLogEntry)), this, SLOT(historyDataChanged()));
+    connect(m_history, SIGNAL(dataImported(QVector<TimeLogEntry>)), this, SLOT(historyDataChanged()));
+    connect(m_history, SIGNAL(dataRemoved(TimeLogEntry)), this, SLOT(historyDataChanged()));
+    connect(m_history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)), this, SLOT(historyDataChanged()));
+    connect(m_history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)),
+            this, SLOT(historyDataChanged()));
+    connect(m_history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
+            this, SLOT(historyDataChanged()));
+}
+
+void TimeLogSyncServer::setToken(const QString &token)
+{
+    m_token = token;
+}
+
+bool TimeLogSyncServer::listen(quint16 port, const QHostAddress &address)
+{
+    if (m_token.isEmpty()) {
+        qCCritical(SYNC_SERVER_CATEGORY) << "Refusing to listen without the token";
+        return false;
+    }
+
+    if (!m_server->listen(address, port)) {
+        qCCritical(SYNC_SERVER_CATEGORY) << "Fail to listen on port" << port << m_server->errorString();
+        return false;
+    }
+
+    qCInfo(SYNC_SERVER_CATEGORY) << "Listening on" << m_server->serverAddress() << m_server->serverPort();
+
+    return true;
+}
+
+void TimeLogSyncServer::close()
+{
+    m_server->close();
+
+    // Replies for the pending requests would still come, they are dropped with the history clients
+    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+        delete it->history;
+        it.key()->disconnect(this);
+        it.key()->abort();
+        it.key()->deleteLater();
+    }
+    m_clients.clear();
+}
+
+bool TimeLogSyncServer::isListening() const
+{
+    return m_server->isListening();
+}
+
+quint16 TimeLogSyncServer::serverPort() const
+{
+    return m_server->serverPort();
+}
+
+void TimeLogSyncServer::newConnection()
+{
+    while (m_server->hasPendingConnections()) {
+        QTcpSocket *client = m_server->nextPendingConnection();
+        qCDebug(SYNC_SERVER_CATEGORY) << "New connection from" << client->peerAddress();
+
+        Client clientData;
+        clientData.isAccepted = false;
+        clientData.history = nullptr;
+        clientData.pendingSyncs = 0;
+        clientData.nonce = TimeLogSyncProtocol::nonce();
+        m_clients.insert(client, clientData);
+        connect(client, SIGNAL(readyRead()), this, SLOT(clientReadyRead()));
+        connect(client, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+
+        QByteArray hello;
+        QDataStream helloStream(&hello, QIODevice::WriteOnly);
+        helloStream.setVersion(TimeLogSyncProtocol::streamVersion);
+        helloStream << TimeLogSyncProtocol::version << clientData.nonce;
+        send(client, TimeLogSyncProtocol::HelloMessage, hello);
+    }
+}
+
+void TimeLogSyncServer::clientReadyRead()
+{
+    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
+    if (!client || !m_clients.contains(client)) {
+        return;
+    }
+
+    QByteArray &buffer = m_clients[client].buffer;
+    buffer.append(client->readAll());
+
+    TimeLogSyncProtocol::MessageType type;
+    QByteArray payload;
+    bool isValid = true;
+    while (TimeLogSyncProtocol::takeMessage(buffer, type, payload, isValid,
+                                            m_clients.value(client).isAccepted
+                                            ? TimeLogSyncProtocol::maxMessageSize
+                                            : TimeLogSyncProtocol::maxHelloSize)) {
+        if (!processMessage(client, type, payload)) {
+            isValid = false;
+            break;
+        }
+    }
+
+    if (!isValid) {
+        qCWarning(SYNC_SERVER_CATEGORY) << "Invalid message, dropping client" << client->peerAddress();
+        client->disconnectFromHost();
+    }
+}
+
+void TimeLogSyncServer::clientDisconnected()
+{
+    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
+    if (!client) {
+        return;
+    }
+
+    qCDebug(SYNC_SERVER_CATEGORY) << "Client disconnected" << client->peerAddress();
+
+    // Replies for the pending requests would still come, they are dropped with the history client
+    delete m_clients.value(client).history;
+    m_clients.remove(client);
+    client->deleteLater();
+}
+
+void TimeLogSyncServer::historyError(const QString &errorText)
+{
+    // Errors are not bound to the requests, so all the waiting peers get them
+    for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+        if (!it->requests.isEmpty()) {
+            sendError(it.key(), errorText);
+        }
+    }
+
+    emit error(errorText);
+}
+
+void TimeLogSyncServer::historyDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                                             QVector<TimeLogSyncDataCategory> categoryData,
+                                             QDateTime until)
+{
+    QTcpSocket *client = takeRequest(sender(), TimeLogSyncProtocol::SyncDataMessage, until);
+    if (!client) {
+        return;
+    }
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << entryData << categoryData << until;
+
+    send(client, TimeLogSyncProtocol::SyncDataMessage, payload);
+}
+
+void TimeLogSyncServer::historyHashesAvailable(QMap<QDateTime, QByteArray> hashes)
+{
+    QTcpSocket *client = takeRequest(sender(), TimeLogSyncProtocol::HashesMessage);
+    if (!client) {
+        return;
+    }
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << hashes;
+
+    send(client, TimeLogSyncProtocol::HashesMessage, payload);
+}
+
+void TimeLogSyncServer::historyDayHashesAvailable(QMap<QDateTime, QByteArray> hashes,
+                                                  QDateTime begin, QDateTime end)
+{
+    QTcpSocket *client = takeRequest(sender(), TimeLogSyncProtocol::DayHashesMessage, end);
+    if (!client) {
+        return;
+    }
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << hashes << begin << end;
+
+    send(client, TimeLogSyncProtocol::DayHashesMessage, payload);
+}
+
+void TimeLogSyncServer::historyDataSynced(const QDateTime &maxSyncDate)
+{
+    QTcpSocket *client = takeRequest(sender(), TimeLogSyncProtocol::DataSyncedMessage);
+    if (!client) {
+        return;
+    }
+
+    --m_clients[client].pendingSyncs;
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << maxSyncDate;
+
+    send(client, TimeLogSyncProtocol::DataSyncedMessage, payload);
+}
+
+void TimeLogSyncServer::historyHashesUpdated()
+{
+    QTcpSocket *client = takeRequest(sender(), TimeLogSyncProtocol::HashesUpdatedMessage);
+    if (client) {
+        send(client, TimeLogSyncProtocol::HashesUpdatedMessage);
+    }
+}
+
+void TimeLogSyncServer::historyDataChanged()
+{
+    // Peers, syncing at the moment, would see own changes
+    for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+        if (it->isAccepted && !it->pendingSyncs) {
+            send(it.key(), TimeLogSyncProtocol::ChangedMessage);
+        }
+    }
+}
+
+bool TimeLogSyncServer::processMessage(QTcpSocket *client, int type, const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+
+    Client &clientData = m_clients[client];
+    if (!clientData.isAccepted) {
+        quint32 version = 0;
+        QByteArray clientNonce, proof;
+        stream >> version;
+        if (type != TimeLogSyncProtocol::HelloMessage || stream.status() != QDataStream::Ok) {
+            return false;
+        } else if (version != TimeLogSyncProtocol::version) {
+            sendError(client, tr("Unsupported sync protocol version %1").arg(version));
+            return false;
+        }
+        stream >> clientNonce >> proof;
+        if (stream.status() != QDataStream::Ok || clientNonce.size() != TimeLogSyncProtocol::nonceSize) {
+            return false;
+        } else if (m_token.isEmpty()
+                   || !TimeLogSyncProtocol::isProofEqual(proof, TimeLogSyncProtocol::proof(m_token, false,
+                                                                                           clientData.nonce,
+                                                                                           clientNonce))) {
+            qCWarning(SYNC_SERVER_CATEGORY) << "Wrong token from" << client->peerAddress();
+            sendError(client, tr("Sync peer rejected the token"));
+            return false;
+        }
+
+        clientData.isAccepted = true;
+        clientData.history = new TimeLogHistoryClient(m_history, this);
+        connect(clientData.history, SIGNAL(syncDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                                             QVector<TimeLogSyncDataCategory>,QDateTime)),
+                this, SLOT(historyDataAvailable(QVector<TimeLogSyncDataEntry>,
+                                                QVector<TimeLogSyncDataCategory>,QDateTime)));
+        connect(clientData.history, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)),
+                this, SLOT(historyHashesAvailable(QMap<QDateTime,QByteArray>)));
+        connect(clientData.history, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)),
+                this, SLOT(historyDayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)));
+        connect(clientData.history, SIGNAL(dataSynced(QDateTime)),
+                this, SLOT(historyDataSynced(QDateTime)));
+        connect(clientData.history, SIGNAL(hashesUpdated()),
+                this, SLOT(historyHashesUpdated()));
+
+        QByteArray reply;
+        QDataStream replyStream(&reply, QIODevice::WriteOnly);
+        replyStream.setVersion(TimeLogSyncProtocol::streamVersion);
+        replyStream << TimeLogSyncProtocol::version
+                    << TimeLogSyncProtocol::proof(m_token, true, clientData.nonce, clientNonce);
+        send(client, TimeLogSyncProtocol::HelloMessage, reply);
+        return true;
+    }
+
+    switch (type) {
+    case TimeLogSyncProtocol::GetHashesMessage: {
+        QDateTime maxDate;
+        bool noUpdate = false;
+        stream >> maxDate >> noUpdate;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        addRequest(client, TimeLogSyncProtocol::HashesMessage);
+        clientData.history->getHashes(maxDate, noUpdate);
+        break;
+    }
+    case TimeLogSyncProtocol::GetDayHashesMessage: {
+        QDateTime begin, end;
+        stream >> begin >> end;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        addRequest(client, TimeLogSyncProtocol::DayHashesMessage, end);
+        clientData.history->getDayHashes(begin, end);
+        break;
+    }
+    case TimeLogSyncProtocol::GetSyncDataMessage: {
+        QDateTime mBegin, mEnd;
+        stream >> mBegin >> mEnd;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        addRequest(client, TimeLogSyncProtocol::SyncDataMessage, mEnd);
+        clientData.history->getSyncData(mBegin, mEnd);
+        break;
+    }
+    case TimeLogSyncProtocol::SyncMessage: {
+        QVector<TimeLogSyncDataEntry> updatedData;
+        QVector<TimeLogSyncDataEntry> removedData;
+        QVector<TimeLogSyncDataCategory> categoryData;
+        stream >> updatedData >> removedData >> categoryData;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        addRequest(client, TimeLogSyncProtocol::DataSyncedMessage);
+        ++clientData.pendingSyncs;
+        clientData.history->sync(updatedData, removedData, categoryData);
+        break;
+    }
+    case TimeLogSyncProtocol::UpdateHashesMessage:
+        addRequest(client, TimeLogSyncProtocol::HashesUpdatedMessage);
+        clientData.history->updateHashes();
+        break;
+    default:
+        qCWarning(SYNC_SERVER_CATEGORY) << "Unexpected message" << type;
+        return false;
+    }
+
+    return true;
+}
+
+void TimeLogSyncServer::addRequest(QTcpSocket *client, int replyType, const QDateTime &end)
+{
+    Request request;
+    request.replyType = replyType;
+    request.end = end;
+    m_clients[client].requests.append(request);
+}
+
+// Readers could reorder the replies to the same peer, so they are matched by type and range
+QTcpSocket *TimeLogSyncServer::takeRequest(QObject *history, int replyType, const QDateTime &end)
+{
+    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+        if (it->history != history) {
+            continue;
+        }
+
+        QList<Request> &requests = it->requests;
+        for (auto request = requests.begin(); request != requests.end(); ++request) {
+            if (request->replyType == replyType && request->end == end) {
+                requests.erase(request);
+                return it.key();
+            }
+        }
+        break;
+    }
+
+    return nullptr;
+}
+
+void TimeLogSyncServer::send(QTcpSocket *client, int type, const QByteArray &payload) const
+{
+    client->write(TimeLogSyncProtocol::message(static_cast<TimeLogSyncProtocol::MessageType>(type), payload));
+}
+
+void TimeLogSyncServer::sendError(QTcpSocket *client, const QString &errorText) const
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(TimeLogSyncProtocol::streamVersion);
+    stream << errorText;
+
+    send(client, TimeLogSyncProtocol::ErrorMessage, payload);
+}
@@ -0,0 +1,98 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGSYNCSERVER_H
+#define TIMELOGSYNCSERVER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QHash>
+#include <QList>
+
+#include "TimeLogHistory.h"
+
+class QTcpServer;
+class QTcpSocket;
+
+class TimeLogHistoryClient;
+
+// Serves the sync part of the TimeLogHistory to the TimeLogRemoteHistory of the peers
+class TimeLogSyncServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TimeLogSyncServer(TimeLogHistory *history, QObject *parent = 0);
+
+    void setToken(const QString &token);
+    // Whole history is served to anyone with the token, so it's required, and only the local
+    // connections are accepted unless other address is given explicitly.
+    // Token is not sent over the network, but the data is not encrypted, so other address
+    // should only be on the trusted network.
+    bool listen(quint16 port, const QHostAddress &address = QHostAddress::LocalHost);
+    void close();
+    bool isListening() const;
+    quint16 serverPort() const;
+
+signals:
+    void error(const QString &errorText) const;
+
+private slots:
+    void newConnection();
+    void clientReadyRead();
+    void clientDisconnected();
+
+    void historyError(const QString &errorText);
+    void historyDataAvailable(QVector<TimeLogSyncDataEntry> entryData,
+                              QVector<TimeLogSyncDataCategory> categoryData, QDateTime until);
+    void historyHashesAvailable(QMap<QDateTime, QByteArray> hashes);
+    void historyDayHashesAvailable(QMap<QDateTime, QByteArray> hashes, QDateTime begin, QDateTime end);
+    void historyDataSynced(const QDateTime &maxSyncDate);
+    void historyHashesUpdated();
+    void historyDataChanged();
+
+private:
+    struct Request
+    {
+        int replyType;
+        QDateTime end;
+    };
+
+    // Each peer has own history client, so it never gets replies to the requests of others
+    struct Client
+    {
+        QByteArray buffer;
+        QByteArray nonce;
+        bool isAccepted;
+        TimeLogHistoryClient *history;
+        QList<Request> requests;
+        int pendingSyncs;
+    };
+
+    bool processMessage(QTcpSocket *client, int type, const QByteArray &payload);
+    void addRequest(QTcpSocket *client, int replyType, const QDateTime &end = QDateTime());
+    QTcpSocket *takeRequest(QObject *history, int replyType, const QDateTime &end = QDateTime());
+    void send(QTcpSocket *client, int type, const QByteArray &payload = QByteArray()) const;
+    void sendError(QTcpSocket *client, const QString &errorText) const;
+
+    TimeLogHistory *m_history;
+    QTcpServer *m_server;
+    QString m_token;
+    QHash<QTcpSocket*, Client> m_clients;
+};
+
+#endif // TIMELOGSYNCSERVER_H
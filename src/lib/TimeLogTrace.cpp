@@ -0,0 +1,197 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+#include <QVector>
+
+#include <QLoggingCategory>
+
+#include "TimeLogTrace.h"
+
+Q_LOGGING_CATEGORY(TRACE_CATEGORY, "Trace", QtInfoMsg)
+
+// Amount of the latest events kept per thread
+static const int bufferSize(16384);
+
+namespace {
+
+struct TraceEvent
+{
+    const char *category;
+    const char *name;
+    qint64 timestamp;
+    qint64 value;
+    char phase;
+};
+
+// Written only by the owning thread, the head is published after the event is filled
+struct TraceBuffer
+{
+    QAtomicInteger<quint32> head;
+    int threadIndex;
+    TraceEvent events[bufferSize];
+};
+
+class TraceClock
+{
+public:
+    TraceClock() { m_timer.start(); }
+
+    qint64 nsecsElapsed() const { return m_timer.nsecsElapsed(); }
+
+private:
+    QElapsedTimer m_timer;
+};
+
+}
+
+static QAtomicInt isTraceEnabled(0);
+
+Q_GLOBAL_STATIC(TraceClock, traceClock)
+Q_GLOBAL_STATIC(QMutex, buffersLock)
+// Buffers are kept after the thread exits, so the dump has all the events
+Q_GLOBAL_STATIC(QVector<TraceBuffer*>, buffers)
+
+static thread_local TraceBuffer *threadBuffer = Q_NULLPTR;
+
+static TraceBuffer *currentBuffer()
+{
+    if (!threadBuffer) {
+        TraceBuffer *buffer = new TraceBuffer();
+        buffer->head.store(0);
+
+        QMutexLocker locker(buffersLock());
+        buffer->threadIndex = buffers()->size();
+        buffers()->append(buffer);
+        threadBuffer = buffer;
+    }
+
+    return threadBuffer;
+}
+
+static void record(char phase, const char *category, const char *name, qint64 timestamp, qint64 value)
+{
+    TraceBuffer *buffer = currentBuffer();
+    quint32 head = buffer->head.load();
+
+    TraceEvent &event = buffer->events[head % bufferSize];
+    event.category = category;
+    event.name = name;
+    event.timestamp = timestamp;
+    event.value = value;
+    event.phase = phase;
+
+    buffer->head.storeRelease(head + 1);
+}
+
+void TimeLogTrace::setEnabled(bool isEnabled)
+{
+    isTraceEnabled.store(isEnabled ? 1 : 0);
+}
+
+bool TimeLogTrace::isEnabled()
+{
+    return isTraceEnabled.load();
+}
+
+void TimeLogTrace::counter(const char *category, const char *name, qint64 value)
+{
+    record('C', category, name, timestamp(), value);
+}
+
+void TimeLogTrace::complete(const char *category, const char *name, qint64 begin, qint64 end)
+{
+    record('X', category, name, begin, end - begin);
+}
+
+qint64 TimeLogTrace::timestamp()
+{
+    return traceClock()->nsecsElapsed();
+}
+
+bool TimeLogTrace::dump(const QString &filePath)
+{
+    QJsonArray events;
+    qint64 pid = QCoreApplication::applicationPid();
+
+    {
+        QMutexLocker locker(buffersLock());
+        for (const TraceBuffer *buffer: *buffers()) {
+            quint32 head = buffer->head.loadAcquire();
+            quint32 count = qMin(head, static_cast<quint32>(bufferSize));
+            for (quint32 i = head - count; i != head; i++) {
+                const TraceEvent &event = buffer->events[i % bufferSize];
+                QJsonObject object;
+                object.insert("name", QString::fromLatin1(event.name));
+                object.insert("cat", QString::fromLatin1(event.category));
+                object.insert("ph", QString(QChar(event.phase)));
+                object.insert("pid", pid);
+                object.insert("tid", buffer->threadIndex);
+                // Trace format uses microseconds
+                object.insert("ts", event.timestamp / 1000.0);
+                if (event.phase == 'X') {
+                    object.insert("dur", event.value / 1000.0);
+                } else {
+                    object.insert("args", QJsonObject{ { "value", event.value } });
+                }
+                events.append(object);
+            }
+        }
+    }
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCCritical(TRACE_CATEGORY) << "Fail to open trace file" << filePath << file.errorString();
+        return false;
+    }
+
+    QJsonObject root;
+    root.insert("traceEvents", events);
+    root.insert("displayTimeUnit", QString("ms"));
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qCCritical(TRACE_CATEGORY) << "Fail to write trace file" << filePath << file.errorString();
+        return false;
+    }
+
+    qCInfo(TRACE_CATEGORY) << "Trace is written to" << filePath << "events:" << events.size();
+
+    return true;
+}
+
+TimeLogTraceSpan::TimeLogTraceSpan(const char *category, const char *name) :
+    m_category(category),
+    m_name(name),
+    m_begin(TimeLogTrace::isEnabled() ? TimeLogTrace::timestamp() : -1)
+{
+
+}
+
+TimeLogTraceSpan::~TimeLogTraceSpan()
+{
+    if (m_begin >= 0) {
+        TimeLogTrace::complete(m_category, m_name, m_begin, TimeLogTrace::timestamp());
+    }
+}
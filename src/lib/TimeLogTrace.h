@@ -0,0 +1,67 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TIMELOGTRACE_H
+#define TIMELOGTRACE_H
+
+#include <QString>
+
+// Tracing of the hot paths into per-thread ring buffers, dumped in the Chrome trace format.
+// Names should be string literals, only pointers are stored. When disabled, a span costs
+// a single atomic load, with TIMELOG_NO_TRACE defined it is removed completely.
+class TimeLogTrace
+{
+public:
+    static void setEnabled(bool isEnabled);
+    static bool isEnabled();
+
+    static void counter(const char *category, const char *name, qint64 value);
+    static void complete(const char *category, const char *name, qint64 begin, qint64 end);
+    static qint64 timestamp();
+
+    // Events of the other threads could be overwritten during the dump, the rest is consistent
+    static bool dump(const QString &filePath);
+};
+
+class TimeLogTraceSpan
+{
+public:
+    TimeLogTraceSpan(const char *category, const char *name);
+    ~TimeLogTraceSpan();
+
+private:
+    Q_DISABLE_COPY(TimeLogTraceSpan)
+
+    const char *m_category;
+    const char *m_name;
+    qint64 m_begin;
+};
+
+#ifndef TIMELOG_NO_TRACE
+#define TIMELOG_TRACE_CONCAT_IMPL(a, b) a##b
+#define TIMELOG_TRACE_CONCAT(a, b) TIMELOG_TRACE_CONCAT_IMPL(a, b)
+#define TIMELOG_TRACE_SPAN(category, name) \
+    TimeLogTraceSpan TIMELOG_TRACE_CONCAT(timeLogTraceSpan, __LINE__)(category, name)
+#define TIMELOG_TRACE_COUNTER(category, name, value) \
+    do { if (TimeLogTrace::isEnabled()) TimeLogTrace::counter(category, name, value); } while (0)
+#else
+#define TIMELOG_TRACE_SPAN(category, name) do { } while (0)
+#define TIMELOG_TRACE_COUNTER(category, name, value) do { } while (0)
+#endif
+
+#endif // TIMELOGTRACE_H
@@ -37,6 +37,9 @@ enum TimeUnits {
     Years
 };
 
+// Recent entries, saved to show before the DB is opened
+static const int snapshotEntriesCount(50);
+
 // HACK: handle plurals
 #undef QT_TRANSLATE_NOOP
 #define QT_TRANSLATE_NOOP(ctx, str, cmnt, n) str
@@ -97,7 +100,10 @@ TimeTracker::TimeTracker(QObject *parent) :
     m_syncer(Q_NULLPTR),
     m_undoCount(0)
 {
-
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()),
+                this, SLOT(saveSnapshot()));
+    }
 }
 
 void TimeTracker::setDataPath(const QUrl &dataPath)
@@ -108,19 +114,34 @@ void TimeTracker::setDataPath(const QUrl &dataPath)
 
     m_dataPath = dataPath;
 
+    // Syncer is only created for the initialized DB
+    setSyncer(Q_NULLPTR);
+
+    // Missing or damaged snapshot only means the UI is populated after the init
+    TimeLogSnapshot snapshot;
+    TimeLogSnapshot::load(TimeLogSnapshot::defaultPath(dataPath.toLocalFile()), snapshot);
+
     TimeLogHistory *history = new TimeLogHistory(this);
-    if (!history->init(dataPath.toLocalFile(), QString(), false, true)) {
-        emit error(tr("Fail to initialize DB"));
-        delete history;
+    connect(history, SIGNAL(initFinished(bool)),
+            this, SLOT(historyInitFinished(bool)));
+    history->initAsync(dataPath.toLocalFile(), QString(), false, true, m_connectionProfile, snapshot);
+    setHistory(history);
+
+    emit dataPathChanged(m_dataPath);
+}
+
+void TimeTracker::saveSnapshot()
+{
+    if (!m_history || !m_syncer) {
         return;
     }
-    setHistory(history);
 
-    DataSyncer *syncer = new DataSyncer(m_history, this);
-    syncer->init(dataPath.toLocalFile());
-    setSyncer(syncer);
+    m_history->saveSnapshot(TimeLogSnapshot::defaultPath(m_dataPath.toLocalFile()), snapshotEntriesCount, true);
+}
 
-    emit dataPathChanged(m_dataPath);
+void TimeTracker::setConnectionProfile(const TimeLogConnectionProfile &profile)
+{
+    m_connectionProfile = profile;
 }
 
 TimeLogHistory *TimeTracker::history()
@@ -175,6 +196,20 @@ void TimeTracker::getStats(const QDateTime &begin, const QDateTime &end, const Q
     m_history->getStats(begin, end, category, separator);
 }
 
+void TimeTracker::getStatsSeries(const QDateTime &begin, const QDateTime &end, int bucket, int depth,
+                                 const QString &category, const QString &separator)
+{
+    if (!m_history) {
+        return;
+    }
+
+    if (!begin.isValid() || !end.isValid()) {
+        return;
+    }
+
+    m_history->getStatsSeries(begin, end, bucket, depth, category, separator);
+}
+
 QString TimeTracker::durationText(int duration, int maxUnits, bool isAbbreviate)
 {
     QStringList values;
@@ -304,6 +339,58 @@ void TimeTracker::statsDataAvailable(QVector<TimeLogStats> data, QDateTime until
     emit statsDataAvailable(result, until);
 }
 
+void TimeTracker::statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until) const
+{
+    QVariantMap result;
+
+    // Scale is taken from the largest bucket total, to fit the stacked values
+    int maxValue = 0;
+    for (int bucketIndex = 0; bucketIndex < data.buckets.size(); bucketIndex++) {
+        int total = 0;
+        for (int categoryIndex = 0; categoryIndex < data.categories.size(); categoryIndex++) {
+            total += data.durationTime(bucketIndex, categoryIndex);
+        }
+        maxValue = qMax(maxValue, total);
+    }
+    int unit = calcTimeUnits(maxValue);
+    result.insert("unitsName", timeUnits.at(unit).abbreviated);
+    result.insert("unitsValue", timeUnits.at(unit).value);
+    result.insert("max", maxValue);
+
+    QVariantList buckets;
+    buckets.reserve(data.buckets.size());
+    for (const QDateTime &bucket: data.buckets) {
+        buckets.append(bucket);
+    }
+    result.insert("buckets", buckets);
+    result.insert("categories", data.categories);
+    // Flat list of durations, data[bucket * categories.length + category]
+    result.insert("data", QVariant::fromValue(data.durations.toList()));
+
+    emit statsSeriesAvailable(result, until);
+}
+
+void TimeTracker::historyInitFinished(bool result)
+{
+    if (sender() != m_history) {
+        return;
+    }
+
+    if (!result) {
+        emit error(tr("Fail to initialize DB"));
+        return;
+    }
+
+    DataSyncer *syncer = new DataSyncer(m_history, this);
+    syncer->init(m_dataPath.toLocalFile());
+    setSyncer(syncer);
+}
+
+void TimeTracker::historyDataSynced()
+{
+    m_history->saveSnapshot(TimeLogSnapshot::defaultPath(m_dataPath.toLocalFile()), snapshotEntriesCount);
+}
+
 void TimeTracker::updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories)
 {
     m_categories = categories;
@@ -337,6 +424,13 @@ void TimeTracker::setHistory(TimeLogHistory *history)
                 this, SIGNAL(error(QString)));
         connect(m_history, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)),
                 this, SLOT(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+        connect(m_history, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)),
+                this, SLOT(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)));
+        // Syncers make the requests through own clients
+        connect(m_history, SIGNAL(dataSynced(QDateTime)),
+                this, SLOT(historyDataSynced()));
+        connect(m_history, SIGNAL(clientDataSynced(QDateTime,qlonglong)),
+                this, SLOT(historyDataSynced()));
         connect(m_history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)),
                 this, SLOT(updateCategories(QSharedPointer<TimeLogCategoryTreeNode>)));
         connect(m_history, SIGNAL(undoCountChanged(int)),
@@ -28,6 +28,7 @@
 #include "TimeLogData.h"
 #include "TimeLogCategory.h"
 #include "TimeLogStats.h"
+#include "TimeLogConnectionProfile.h"
 
 class TimeLogHistory;
 class TimeLogCategoryTreeNode;
@@ -44,6 +45,7 @@ public:
     explicit TimeTracker(QObject *parent = 0);
 
     void setDataPath(const QUrl &dataPath);
+    void setConnectionProfile(const TimeLogConnectionProfile &profile);
 
     TimeLogHistory *history();
 
@@ -58,6 +60,10 @@ public:
                               const QDateTime &end = QDateTime::currentDateTimeUtc(),
                               const QString &category = QString(),
                               const QString &separator = ">");
+    Q_INVOKABLE void getStatsSeries(const QDateTime &begin, const QDateTime &end,
+                                    int bucket = TimeLogStatsSeries::DayBucket, int depth = 1,
+                                    const QString &category = QString(),
+                                    const QString &separator = ">");
     Q_INVOKABLE static QString durationText(int duration, int maxUnits = 7, bool isAbbreviate = false);
     Q_INVOKABLE static QString rangeText(const QDateTime &from, const QDateTime &to);
     Q_INVOKABLE static QVariantList weeksModel();
@@ -76,6 +82,7 @@ signals:
     void syncerChanged(DataSyncer *newSyncer) const;
     void error(const QString &errorText) const;
     void statsDataAvailable(QVariantMap data, QDateTime until) const;
+    void statsSeriesAvailable(QVariantMap data, QDateTime until) const;
     void categoriesChanged(const QSharedPointer<TimeLogCategoryTreeNode> newCategories) const;
     void undoCountChanged(int newUndoCount) const;
 
@@ -90,6 +97,10 @@ signals:
 
 private slots:
     void statsDataAvailable(QVector<TimeLogStats> data, QDateTime until) const;
+    void statsSeriesAvailable(TimeLogStatsSeries data, QDateTime until) const;
+    void historyInitFinished(bool result);
+    void historyDataSynced();
+    void saveSnapshot();
     void updateCategories(const QSharedPointer<TimeLogCategoryTreeNode> &categories);
     void updateUndoCount(int undoCount);
 
@@ -98,6 +109,7 @@ private:
     void setSyncer(DataSyncer *syncer);
 
     QUrl m_dataPath;
+    TimeLogConnectionProfile m_connectionProfile;
     TimeLogHistory *m_history;
     DataSyncer *m_syncer;
     QSharedPointer<TimeLogCategoryTreeNode> m_categories;
@@ -3,10 +3,13 @@ TARGET = timetracker
 
 CONFIG += staticlib
 
-QT += sql
+QT += sql network
 
 DEFINES *= QT_USE_QSTRINGBUILDER
 
+# Removes the tracing code, CONFIG+=notrace
+notrace: DEFINES *= TIMELOG_NO_TRACE
+
 SOURCES += \
     TimeLogEntry.cpp \
     TimeLogModel.cpp \
@@ -32,7 +35,23 @@ SOURCES += \
     TimeLogCategory.cpp \
     TimeLogCategoryTreeNode.cpp \
     TimeLogSyncDataEntry.cpp \
-    TimeLogDefaultCategories.cpp
+    TimeLogDefaultCategories.cpp \
+    TimeLogConnectionProfile.cpp \
+    TimeLogSyncProtocol.cpp \
+    TimeLogRemoteHistory.cpp \
+    TimeLogHistoryClient.cpp \
+    TimeLogSyncServer.cpp \
+    NetworkSyncerWorker.cpp \
+    TimeLogModelStorage.cpp \
+    TimeLogCategoryPool.cpp \
+    TimeLogStatsModel.cpp \
+    TimeLogSnapshot.cpp \
+    TimeLogTrace.cpp \
+    TimeLogDiagnostics.cpp \
+    DataReporter.cpp \
+    TimeLogClock.cpp \
+    TimeLogCategoryIndex.cpp \
+    TimeLogCategoryCompleterModel.cpp
 
 HEADERS += \
     TimeLogEntry.h \
@@ -59,4 +78,21 @@ HEADERS += \
     TimeLogCategory.h \
     TimeLogCategoryTreeNode.h \
     TimeLogSyncDataEntry.h \
-    TimeLogDefaultCategories.h
+    TimeLogDefaultCategories.h \
+    TimeLogConnectionProfile.h \
+    TimeLogSyncProtocol.h \
+    TimeLogRemoteHistory.h \
+    TimeLogHistoryClient.h \
+    TimeLogSyncServer.h \
+    NetworkSyncerWorker.h \
+    TimeLogModelStorage.h \
+    TimeLogCategoryPool.h \
+    TimeLogStatsModel.h \
+    TimeLogSnapshot.h \
+    TimeLogSyncChanges.h \
+    TimeLogTrace.h \
+    TimeLogDiagnostics.h \
+    DataReporter.h \
+    TimeLogClock.h \
+    TimeLogCategoryIndex.h \
+    TimeLogCategoryCompleterModel.h
@@ -3,4 +3,6 @@ SUBDIRS += \
     db \
     sync \
     db_syncer \
-    sync_pack
+    sync_pack \
+    network_sync \
+    models
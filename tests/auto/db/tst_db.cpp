@@ -19,14 +19,133 @@
 #include <QtTest/QtTest>
 
 #include <QTemporaryDir>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include "tst_common.h"
 #include "TimeLogCategoryTreeNode.h"
 #include "TimeLogDefaultCategories.h"
+#include "TimeLogCategoryPool.h"
+#include "TimeLogDiagnostics.h"
+#include "DataImporter.h"
+#include "DataExporter.h"
 
 QTemporaryDir *dataDir = Q_NULLPTR;
 TimeLogHistory *history = Q_NULLPTR;
 
+void extractDiagnostics(TimeLogHistory *history, QVariantMap &report)
+{
+    TimeLogDiagnostics diagnostics;
+    QSignalSpy reportSpy(&diagnostics, SIGNAL(reportAvailable(QVariantMap)));
+    diagnostics.requestReport(history);
+    QVERIFY(reportSpy.wait());
+    report = reportSpy.constFirst().at(0).toMap();
+}
+
+void checkSearch(TimeLogHistory *history, const QString &text, const QVector<TimeLogEntry> &data,
+                 const QDateTime &begin = QDateTime::fromTime_t(0, Qt::UTC),
+                 const QDateTime &end = QDateTime::currentDateTimeUtc(),
+                 const QString &category = QString(), bool withSubcategories = false)
+{
+    QSignalSpy historyDataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    QSignalSpy historyErrorSpy(history, SIGNAL(error(QString)));
+    qlonglong id = QDateTime::currentMSecsSinceEpoch();
+    history->searchComments(id, text, begin, end, category, withSubcategories);
+    QVERIFY(historyDataSpy.wait());
+    QVERIFY(historyErrorSpy.isEmpty());
+    QCOMPARE(historyDataSpy.constFirst().at(1).toLongLong(), id);
+    QVERIFY(compareData(historyDataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >(), data));
+}
+
+void checkUpdates(TimeLogHistory *history, QSignalSpy &updateSpy, const QVector<QDateTime> &changedStarts)
+{
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    QVector<TimeLogEntry> data = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(data));
+
+    QHash<QUuid, int> indexes;
+    for (int i = 0; i < data.size(); i++) {
+        indexes.insert(data.at(i).uuid, i);
+    }
+
+    // Updated entries have the values of the resulting history
+    QSet<QUuid> updatedUuids;
+    QVERIFY(!updateSpy.isEmpty());
+    for (const QList<QVariant> &arguments: updateSpy) {
+        QVector<TimeLogEntry> updateData = arguments.at(0).value<QVector<TimeLogEntry> >();
+        QVector<TimeLogHistory::Fields> updateFields = arguments.at(1).value<QVector<TimeLogHistory::Fields> >();
+        QCOMPARE(updateFields.size(), updateData.size());
+        for (int i = 0; i < updateData.size(); i++) {
+            const TimeLogEntry &entry = updateData.at(i);
+            QVERIFY(indexes.contains(entry.uuid));
+            const TimeLogEntry &expected = data.at(indexes.value(entry.uuid));
+            QVERIFY(compareData(entry, expected));
+            QCOMPARE(entry.precedingStart, expected.precedingStart);
+            QCOMPARE(entry.durationTime, expected.durationTime);
+            QVERIFY(updateFields.at(i) & TimeLogHistory::PrecedingStart);
+            QVERIFY(updateFields.at(i) & TimeLogHistory::DurationTime);
+            updatedUuids.insert(entry.uuid);
+        }
+    }
+
+    // Entries around the changed starts are updated, as well as the entries at them
+    for (const QDateTime &start: changedStarts) {
+        for (int i = 0; i < data.size(); i++) {
+            if (data.at(i).startTime < start) {
+                continue;
+            }
+            if (i > 0) {
+                QVERIFY(updatedUuids.contains(data.at(i - 1).uuid));
+            }
+            QVERIFY(updatedUuids.contains(data.at(i).uuid));
+            if (data.at(i).startTime == start && i < data.size() - 1) {
+                QVERIFY(updatedUuids.contains(data.at(i + 1).uuid));
+            }
+            break;
+        }
+    }
+}
+
+// Stats for the full days come from the daily rollup, they should match the durations of the history itself
+void checkStats(TimeLogHistory *history, const QDateTime &begin, const QDateTime &end)
+{
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    QVector<TimeLogEntry> data = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(data));
+
+    QMap<QString, int> durations;
+    for (int i = 0; i < data.size() - 1; i++) {
+        const TimeLogEntry &entry = data.at(i);
+        if (entry.startTime < begin || entry.startTime > end) {
+            continue;
+        }
+        QString name(entry.category.split('>').constFirst());
+        while (name.endsWith(' ')) {
+            name.chop(1);
+        }
+        durations[name] += entry.startTime.secsTo(data.at(i + 1).startTime);
+    }
+
+    QSignalSpy statsSpy(history, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    history->getStats(begin, end);
+    QVERIFY(statsSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QMap<QString, int> statsDurations;
+    for (const TimeLogStats &item: statsSpy.constFirst().at(0).value<QVector<TimeLogStats> >()) {
+        if (item.durationTime) {
+            statsDurations.insert(item.category, item.durationTime);
+        }
+    }
+    QCOMPARE(statsDurations, durations);
+}
+
 class tst_DB : public QObject
 {
     Q_OBJECT
@@ -42,6 +161,9 @@ private slots:
 
     void import();
     void import_data();
+    void importBulk();
+    void importBulk_data();
+    void sizePersistent();
     void entryInsert();
     void entryInsert_data();
     void entryInsertConflict();
@@ -52,6 +174,10 @@ private slots:
     void entryEdit_data();
     void entryEditConflict();
     void entryEditConflict_data();
+    void entryRemoveBatch();
+    void entryRemoveBatch_data();
+    void entryEditBatch();
+    void entryEditBatch_data();
 
     void categoryAdd();
     void categoryAdd_data();
@@ -73,6 +199,8 @@ private slots:
     void undoEntryEdit();
     void undoEntryEdit_data();
     void undoEntryMultiple();
+    void undoPersistent();
+    void undoFail();
 
     void undoCategoryAdd();
     void undoCategoryAdd_data();
@@ -87,6 +215,36 @@ private slots:
     void hashesUpdate_data();
     void hashesOld();
     void hashesOld_data();
+    void syncAmount();
+    void syncAmount_data();
+    void syncChunks();
+    void syncUpdates();
+
+    void searchComments();
+    void statsSeries();
+    void statsSeries_data();
+    void statsRollup();
+    void cancelRequest();
+    void dataImport();
+    void exportImport();
+    void exportImport_data();
+
+    void archive();
+    void purgeRemoved();
+    void purgeHorizon();
+    void foreignThreadRequests();
+    void categoryInterning();
+    void categoryTreePatch();
+    void snapshot();
+    void diagnostics();
+    void queryAudit();
+    void readonlySnapshot();
+    void backup();
+    void categoryDataUpgrade();
+    void schemaUpgrade();
+    void packOpen();
+    void maintenance();
+    void maintenanceVacuumUpgrade();
 };
 
 tst_DB::tst_DB()
@@ -129,6 +287,8 @@ void tst_DB::initTestCase()
     qRegisterMetaType<QMap<QDateTime,QByteArray> >();
     qRegisterMetaType<TimeLogCategory>();
     qRegisterMetaType<QVector<TimeLogSyncDataCategory> >();
+    qRegisterMetaType<QVector<TimeLogStats> >();
+    qRegisterMetaType<TimeLogStatsSeries>();
 
     qSetMessagePattern("[%{time}] <%{category}> %{type} (%{file}:%{line}, %{function}) %{message}");
 }
@@ -165,6 +325,82 @@ void tst_DB::import_data()
     QTest::newRow("6 entries") << 6;
 }
 
+void tst_DB::importBulk()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+    QVector<TimeLogEntry> oddData, evenData;
+    for (int i = 0; i < origData.size(); i++) {
+        (i % 2 ? oddData : evenData).append(origData.at(i));
+    }
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+
+    history->import(oddData);
+    QVERIFY(importSpy.wait());
+    history->import(evenData);
+    QVERIFY(importSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QCOMPARE(history->size(), origData.size());
+
+    QSignalSpy historyDataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    history->getHistoryBetween(0);
+    QVERIFY(historyDataSpy.wait());
+    QVector<TimeLogEntry> historyData = historyDataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(historyData));
+    QVERIFY(compareData(historyData, origData));
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::importBulk_data()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("200 entries") << 200;
+    QTest::newRow("1000 entries") << 1000;
+}
+
+void tst_DB::sizePersistent()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    TimeLogEntry entry = origData.at(0);
+    entry.category = origData.at(1).category;
+    history->edit(entry, TimeLogHistory::Category);
+    QVERIFY(updateSpy.wait());
+    origData[0] = entry;
+
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    history->remove(origData.at(5));
+    QVERIFY(removeSpy.wait());
+    origData.removeAt(5);
+
+    // Size is reset on deinit, then restored from the stored counts
+    QSignalSpy sizeSpy(history, SIGNAL(sizeChanged(qlonglong)));
+    history->deinit();
+    QVERIFY(history->init(dataDir->path()));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    while (sizeSpy.isEmpty() || sizeSpy.constLast().at(0).toLongLong() == 0) {
+        QVERIFY(sizeSpy.wait());
+    }
+    QCOMPARE(history->size(), origData.size());
+
+    checkFunction(checkDB, history, origData);
+
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+}
+
 void tst_DB::entryInsert()
 {
     QFETCH(int, initialEntries);
@@ -531,6 +767,155 @@ void tst_DB::entryEditConflict_data()
     QTest::newRow("6 entries, all") << 6 << index << entry;
 }
 
+void tst_DB::entryRemoveBatch()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy insertSpy(history, SIGNAL(dataInserted(TimeLogEntry)));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    QSignalSpy batchRemoveSpy(history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QVector<TimeLogEntry> removedData, remainingData;
+    for (int i = 0; i < origData.size(); i++) {
+        (i % 3 ? remainingData : removedData).append(origData.at(i));
+    }
+
+    history->removeBatch(removedData);
+    QVERIFY(batchRemoveSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QVERIFY(removeSpy.isEmpty());
+    QCOMPARE(batchRemoveSpy.size(), 1);
+    QCOMPARE(batchRemoveSpy.constFirst().at(0).value<QVector<TimeLogEntry> >().size(), removedData.size());
+    QCOMPARE(undoCountSpy.constLast().at(0).value<int>(), 1);
+    QCOMPARE(history->size(), remainingData.size());
+
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    QVector<TimeLogEntry> historyData = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(historyData));
+    QVERIFY(compareData(historyData, remainingData));
+
+    checkFunction(checkHashes, history, false);
+
+    // Single undo restores all the entries
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(insertSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(insertSpy.size(), removedData.size());
+    QCOMPARE(undoCountSpy.constFirst().at(0).value<int>(), 0);
+    QCOMPARE(history->size(), origData.size());
+
+    dataSpy.clear();
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    historyData = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(historyData));
+    QVERIFY(compareData(historyData, origData));
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::entryRemoveBatch_data()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("6 entries") << 6;
+    QTest::newRow("600 entries, bulk") << 600;
+}
+
+void tst_DB::entryEditBatch()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    // Starts are moved within the gaps to the following entries, so the order is kept
+    QVector<TimeLogEntry> editedData, newData(origData);
+    QVector<TimeLogHistory::Fields> editedFields;
+    for (int i = 0; i < origData.size(); i += 3) {
+        TimeLogEntry entry = origData.at(i);
+        TimeLogHistory::Fields fields = TimeLogHistory::Category | TimeLogHistory::Comment;
+        int gap = i < origData.size() - 1 ? entry.startTime.secsTo(origData.at(i + 1).startTime) : 10;
+        if (gap > 1) {
+            entry.startTime = entry.startTime.addSecs(gap / 2);
+            fields |= TimeLogHistory::StartTime;
+        }
+        entry.category = "CategoryNew";
+        entry.comment = "Batch comment";
+        editedData.append(entry);
+        editedFields.append(fields);
+        newData[i] = entry;
+    }
+
+    history->editBatch(editedData, editedFields);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(updateSpy.size(), 1);
+    QCOMPARE(undoCountSpy.constLast().at(0).value<int>(), 1);
+
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    QVector<TimeLogEntry> historyData = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(historyData));
+    QVERIFY(compareData(historyData, newData));
+
+    checkFunction(checkHashes, history, false);
+
+    // Single undo restores all the entries
+    updateSpy.clear();
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(undoCountSpy.constFirst().at(0).value<int>(), 0);
+
+    dataSpy.clear();
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    historyData = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QVERIFY(checkData(historyData));
+    QVERIFY(compareData(historyData, origData));
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::entryEditBatch_data()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("6 entries") << 6;
+    QTest::newRow("600 entries, bulk") << 600;
+}
+
 void tst_DB::categoryAdd()
 {
     QFETCH(int, initialEntries);
@@ -776,10 +1161,12 @@ void tst_DB::categoryEdit()
                 updateIndices.append(index);
             }
         }
-        while (updateSpy.size() < updateIndices.size()) {
+        // All entries of the category are updated at once
+        int updateCount = updateIndices.isEmpty() ? 0 : 1;
+        while (updateSpy.size() < updateCount) {
             QVERIFY(updateSpy.wait());
         }
-        QCOMPARE(updateSpy.size(), updateIndices.size());
+        QCOMPARE(updateSpy.size(), updateCount);
 
         bool isMerged = false;
         if (categoryNameNew != categoryNameOld
@@ -808,12 +1195,14 @@ void tst_DB::categoryEdit()
             }
         }
 
-        for (int i = 0; i < updateIndices.size(); i++) {
-            QVector<TimeLogEntry> updateData = updateSpy.at(i).at(0).value<QVector<TimeLogEntry> >();
-            QVector<TimeLogHistory::Fields> updateFields = updateSpy.at(i).at(1).value<QVector<TimeLogHistory::Fields> >();
-            QCOMPARE(updateData.size(), 1);
-            QCOMPARE(updateData.constFirst().category, origData.at(updateIndices.at(i)).category);
-            QCOMPARE(updateFields.constFirst(), TimeLogHistory::Category);
+        if (updateCount) {
+            QVector<TimeLogEntry> updateData = updateSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+            QVector<TimeLogHistory::Fields> updateFields = updateSpy.constFirst().at(1).value<QVector<TimeLogHistory::Fields> >();
+            QCOMPARE(updateData.size(), updateIndices.size());
+            for (int i = 0; i < updateData.size(); i++) {
+                QCOMPARE(updateData.at(i).category, origData.at(updateIndices.constFirst()).category);
+                QCOMPARE(updateFields.at(i), TimeLogHistory::Category);
+            }
         }
 
     }
@@ -1082,10 +1471,12 @@ void tst_DB::categoryEditName()
                 updateIndices.append(index);
             }
         }
-        while (updateSpy.size() < updateIndices.size()) {
+        // All entries of the category are updated at once
+        int updateCount = updateIndices.isEmpty() ? 0 : 1;
+        while (updateSpy.size() < updateCount) {
             QVERIFY(updateSpy.wait());
         }
-        QCOMPARE(updateSpy.size(), updateIndices.size());
+        QCOMPARE(updateSpy.size(), updateCount);
 
         bool isMerged = false;
         if (categoryNameResult != categoryNameOld
@@ -1115,12 +1506,14 @@ void tst_DB::categoryEditName()
             }
         }
 
-        for (int i = 0; i < updateIndices.size(); i++) {
-            QVector<TimeLogEntry> updateData = updateSpy.at(i).at(0).value<QVector<TimeLogEntry> >();
-            QVector<TimeLogHistory::Fields> updateFields = updateSpy.at(i).at(1).value<QVector<TimeLogHistory::Fields> >();
-            QCOMPARE(updateData.size(), 1);
-            QCOMPARE(updateData.constFirst().category, origData.at(updateIndices.at(i)).category);
-            QCOMPARE(updateFields.constFirst(), TimeLogHistory::Category);
+        if (updateCount) {
+            QVector<TimeLogEntry> updateData = updateSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+            QVector<TimeLogHistory::Fields> updateFields = updateSpy.constFirst().at(1).value<QVector<TimeLogHistory::Fields> >();
+            QCOMPARE(updateData.size(), updateIndices.size());
+            for (int i = 0; i < updateData.size(); i++) {
+                QCOMPARE(updateData.at(i).category, origData.at(updateIndices.constFirst()).category);
+                QCOMPARE(updateFields.at(i), TimeLogHistory::Category);
+            }
         }
 
     }
@@ -1661,57 +2054,196 @@ void tst_DB::undoEntryMultiple()
     checkFunction(checkHashes, history, false);
 }
 
-void tst_DB::undoCategoryAdd()
+void tst_DB::undoPersistent()
 {
-    QFETCH(int, initialEntries);
-    QFETCH(int, initialCategories);
+    QVector<TimeLogEntry> origData(defaultEntries());
 
-    QVector<TimeLogEntry> origData(defaultEntries().mid(0, initialEntries));
-    QVector<TimeLogCategory> origCategories(defaultCategories().mid(0, initialCategories));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
 
-    QFETCH(QString, categoryName);
-    QFETCH(QVariantMap, categoryData);
-    TimeLogCategory category(QUuid::createUuid(), TimeLogCategoryData(categoryName, categoryData));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    history->remove(origData.at(4));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QCOMPARE(history->undoCount(), 1);
+
+    // Only the changed fields are journaled
+    TimeLogEntry entry = origData.at(1);
+    entry.comment = "Test comment";
+    history->edit(entry, TimeLogHistory::Comment);
+    entry = origData.at(2);
+    entry.startTime = entry.startTime.addSecs(-100);
+    entry.category = "CategoryNew";
+    history->edit(entry, TimeLogHistory::StartTime | TimeLogHistory::Category);
+    while (history->undoCount() != 3) {
+        QVERIFY(undoCountSpy.wait());
+    }
+
+    history->deinit();
+    QVERIFY(history->init(dataDir->path()));
 
     QSignalSpy errorSpy(history, SIGNAL(error(QString)));
     QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
-    QSignalSpy categoriesSpy(history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
-    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+    QSignalSpy insertSpy(history, SIGNAL(dataInserted(TimeLogEntry)));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    undoCountSpy.clear();
+    while (history->undoCount() != 3) {
+        QVERIFY(undoCountSpy.wait());
+    }
 
-    checkFunction(importSyncData, history, genSyncData(origData, defaultMTimes()),
-                  genSyncData(origCategories, defaultMTimes()), 1);
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(history->undoCount(), 2);
 
-    if (categoryName.isEmpty()) {
-        QTest::ignoreMessage(QtCriticalMsg, QRegularExpression(QString("Empty category name")));
-    } else if (categoryName != "CategoryNew" && initialEntries <= initialCategories) {
-        QTest::ignoreMessage(QtCriticalMsg,
-                             QRegularExpression(QString("Category '%1' already exists").arg(categoryName)));
-    }
-    categoriesSpy.clear();
-    history->addCategory(category);
-    if (categoryName.isEmpty()
-        || (categoryName != "CategoryNew" && initialEntries <= initialCategories)) {
-        QVERIFY(errorSpy.wait());
-        QVERIFY(outdateSpy.isEmpty());
-        QVERIFY(categoriesSpy.isEmpty());
-        QVERIFY(undoCountSpy.isEmpty());
-        QCOMPARE(history->undoCount(), 0);
-    } else {
-        if (categoryName != "CategoryNew" && initialEntries > initialCategories) {
-            QVERIFY(categoriesSpy.isEmpty());
-        } else {
-            QVERIFY(categoriesSpy.wait());
-        }
-        QVERIFY(errorSpy.isEmpty());
-        QVERIFY(outdateSpy.isEmpty());
-        QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
-        QCOMPARE(undoCountSpy.constFirst().at(0).value<int>(), 1);
-        QCOMPARE(history->undoCount(), 1);
+    checkFunction(checkEdit, updateSpy, origData, TimeLogHistory::StartTime | TimeLogHistory::Category, 2);
 
-        outdateSpy.clear();
-        categoriesSpy.clear();
-        undoCountSpy.clear();
-        history->undo();
+    updateSpy.clear();
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(history->undoCount(), 1);
+
+    checkFunction(checkEdit, updateSpy, origData, TimeLogHistory::Comment, 1);
+
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(insertSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(undoCountSpy.constLast().at(0).value<int>(), 0);
+    QCOMPARE(history->undoCount(), 0);
+
+    QVERIFY(compareData(insertSpy.constFirst().at(0).value<TimeLogEntry>(), origData.at(4)));
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::undoFail()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+    TimeLogEntry entry = origData.at(2);
+    entry.comment = "Test comment";
+    history->edit(entry, TimeLogHistory::Comment);
+    while (history->undoCount() != 1) {
+        QVERIFY(undoCountSpy.wait());
+    }
+
+    // Entry disappears behind the back of the history
+    history->deinit();
+    const QString connectionName("undoFail");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("DELETE FROM timelog WHERE uuid=?;"));
+        query.addBindValue(entry.uuid.toRfc4122());
+        QVERIFY(query.exec());
+        QCOMPARE(query.numRowsAffected(), 1);
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    origData.removeAt(2);
+
+    QVERIFY(history->init(dataDir->path()));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    undoCountSpy.clear();
+    while (history->undoCount() != 1) {
+        QVERIFY(undoCountSpy.wait());
+    }
+
+    // Failed undo keeps the journal
+    QTest::ignoreMessage(QtCriticalMsg, QRegularExpression("Item to undo not found"));
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(outdateSpy.wait());
+    QVERIFY(!errorSpy.isEmpty());
+    QVERIFY(updateSpy.isEmpty());
+    QVERIFY(undoCountSpy.isEmpty());
+    QCOMPARE(history->undoCount(), 1);
+
+    history->deinit();
+    QVERIFY(history->init(dataDir->path()));
+    while (history->undoCount() != 1) {
+        QVERIFY(undoCountSpy.wait());
+    }
+
+    checkFunction(checkDB, history, origData);
+}
+
+void tst_DB::undoCategoryAdd()
+{
+    QFETCH(int, initialEntries);
+    QFETCH(int, initialCategories);
+
+    QVector<TimeLogEntry> origData(defaultEntries().mid(0, initialEntries));
+    QVector<TimeLogCategory> origCategories(defaultCategories().mid(0, initialCategories));
+
+    QFETCH(QString, categoryName);
+    QFETCH(QVariantMap, categoryData);
+    TimeLogCategory category(QUuid::createUuid(), TimeLogCategoryData(categoryName, categoryData));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy categoriesSpy(history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+
+    checkFunction(importSyncData, history, genSyncData(origData, defaultMTimes()),
+                  genSyncData(origCategories, defaultMTimes()), 1);
+
+    if (categoryName.isEmpty()) {
+        QTest::ignoreMessage(QtCriticalMsg, QRegularExpression(QString("Empty category name")));
+    } else if (categoryName != "CategoryNew" && initialEntries <= initialCategories) {
+        QTest::ignoreMessage(QtCriticalMsg,
+                             QRegularExpression(QString("Category '%1' already exists").arg(categoryName)));
+    }
+    categoriesSpy.clear();
+    history->addCategory(category);
+    if (categoryName.isEmpty()
+        || (categoryName != "CategoryNew" && initialEntries <= initialCategories)) {
+        QVERIFY(errorSpy.wait());
+        QVERIFY(outdateSpy.isEmpty());
+        QVERIFY(categoriesSpy.isEmpty());
+        QVERIFY(undoCountSpy.isEmpty());
+        QCOMPARE(history->undoCount(), 0);
+    } else {
+        if (categoryName != "CategoryNew" && initialEntries > initialCategories) {
+            QVERIFY(categoriesSpy.isEmpty());
+        } else {
+            QVERIFY(categoriesSpy.wait());
+        }
+        QVERIFY(errorSpy.isEmpty());
+        QVERIFY(outdateSpy.isEmpty());
+        QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+        QCOMPARE(undoCountSpy.constFirst().at(0).value<int>(), 1);
+        QCOMPARE(history->undoCount(), 1);
+
+        outdateSpy.clear();
+        categoriesSpy.clear();
+        undoCountSpy.clear();
+        history->undo();
         QVERIFY(errorSpy.isEmpty());
         QVERIFY(outdateSpy.isEmpty());
         if (categoryName != "CategoryNew" && initialEntries > initialCategories) {
@@ -1969,17 +2501,21 @@ void tst_DB::undoCategoryEdit()
                 updateIndices.append(index);
             }
         }
-        while (updateSpy.size() < updateIndices.size()) {
+        // All entries of the category are updated at once
+        int updateCount = updateIndices.isEmpty() ? 0 : 1;
+        while (updateSpy.size() < updateCount) {
             QVERIFY(updateSpy.wait());
         }
-        QCOMPARE(updateSpy.size(), updateIndices.size());
-
-        for (int i = 0; i < updateIndices.size(); i++) {
-            QVector<TimeLogEntry> updateData = updateSpy.at(i).at(0).value<QVector<TimeLogEntry> >();
-            QVector<TimeLogHistory::Fields> updateFields = updateSpy.at(i).at(1).value<QVector<TimeLogHistory::Fields> >();
-            QCOMPARE(updateData.size(), 1);
-            QCOMPARE(updateData.constFirst().category, origData.at(updateIndices.at(i)).category);
-            QCOMPARE(updateFields.constFirst(), TimeLogHistory::Category);
+        QCOMPARE(updateSpy.size(), updateCount);
+
+        if (updateCount) {
+            QVector<TimeLogEntry> updateData = updateSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+            QVector<TimeLogHistory::Fields> updateFields = updateSpy.constFirst().at(1).value<QVector<TimeLogHistory::Fields> >();
+            QCOMPARE(updateData.size(), updateIndices.size());
+            for (int i = 0; i < updateData.size(); i++) {
+                QCOMPARE(updateData.at(i).category, origData.at(updateIndices.constFirst()).category);
+                QCOMPARE(updateFields.at(i), TimeLogHistory::Category);
+            }
         }
     }
 
@@ -2071,7 +2607,7 @@ void tst_DB::hashes()
 
     checkFunction(importSyncData, history, origSyncEntries, origSyncCategories, 1);
 
-    checkFunction(checkHashesUpdated, history, false);
+    checkFunction(checkHashesUpdated, history, true);
 
     historyHashesSpy.clear();
     history->getHashes();
@@ -2135,7 +2671,7 @@ void tst_DB::hashesUpdate()
 
     checkFunction(importSyncData, history, origSyncEntries, origSyncCategories, 1);
 
-    checkFunction(checkHashesUpdated, history, false);
+    checkFunction(checkHashesUpdated, history, true);
 
     historyUpdateHashesSpy.clear();
     history->updateHashes();
@@ -2429,5 +2965,1657 @@ void tst_DB::hashesOld_data()
     addRemoveTests(6, 0, QDateTime(QDate(2016, 01, 10), QTime(), Qt::UTC));
 }
 
+void tst_DB::syncAmount()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(int, categoriesCount);
+
+    QVector<TimeLogEntry> origEntries(defaultEntries().mid(0, entriesCount));
+    QVector<TimeLogCategory> origCategories(defaultCategories().mid(0, categoriesCount));
+
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(origCategories, defaultMTimes()));
+
+    QSignalSpy historyErrorSpy(history, SIGNAL(error(QString)));
+
+    QSignalSpy historyOutdateSpy(history, SIGNAL(dataOutdated()));
+
+    QSignalSpy historyAmountSpy(history, SIGNAL(syncAmountAvailable(qlonglong,QDateTime,QDateTime,QDateTime)));
+
+    checkFunction(importSyncData, history, origSyncEntries, origSyncCategories, 1);
+
+    history->getSyncAmount();
+    QVERIFY(historyAmountSpy.wait());
+    QVERIFY(historyErrorSpy.isEmpty());
+    QVERIFY(historyOutdateSpy.isEmpty());
+
+    QDateTime maxMTime;
+    if (entriesCount || categoriesCount) {
+        maxMTime = defaultMTimes().at(qMax(entriesCount, categoriesCount) - 1);
+    }
+    QCOMPARE(historyAmountSpy.constFirst().at(0).toLongLong(), static_cast<qlonglong>(entriesCount + categoriesCount));
+    QCOMPARE(historyAmountSpy.constFirst().at(1).toDateTime(), maxMTime);
+
+    historyAmountSpy.clear();
+    history->getSyncAmount(defaultMTimes().at(2));
+    QVERIFY(historyAmountSpy.wait());
+    QVERIFY(historyErrorSpy.isEmpty());
+    QVERIFY(historyOutdateSpy.isEmpty());
+
+    QCOMPARE(historyAmountSpy.constFirst().at(0).toLongLong(),
+             static_cast<qlonglong>(qMax(entriesCount - 2, 0) + qMax(categoriesCount - 2, 0)));
+}
+
+void tst_DB::syncAmount_data()
+{
+    QTest::addColumn<int>("entriesCount");
+    QTest::addColumn<int>("categoriesCount");
+
+    auto addTest = [](int entries, int categories)
+    {
+        QTest::newRow(QString("%1 entries, %2 categories").arg(entries).arg(categories).toLocal8Bit())
+                << entries << categories;
+    };
+
+    auto addTestSet = [&addTest](int entries)
+    {
+        addTest(entries, 0);
+        addTest(entries, 1);
+        addTest(entries, 2);
+        addTest(entries, 4);
+        addTest(entries, 6);
+    };
+
+    addTestSet(0);
+    addTestSet(1);
+    addTestSet(2);
+    addTestSet(4);
+    addTestSet(6);
+}
+
+void tst_DB::syncChunks()
+{
+    // Known items are looked up by 400 uuids, kinds of conflicts are interleaved, so each chunk has all of them
+    const int itemsCount = 1000;
+    QDateTime baseMTime(QDateTime::currentDateTimeUtc().addDays(-1));
+    QVector<QDateTime> mTimes;
+    for (int i = 0; i < itemsCount; i++) {
+        mTimes.append(baseMTime.addSecs(i * 10));
+    }
+
+    const QVector<TimeLogEntry> entries(genData(itemsCount));
+    QVector<TimeLogCategory> categories;
+    for (int i = 0; i < itemsCount; i++) {
+        categories.append(TimeLogCategory(QUuid::createUuid(), TimeLogCategoryData(QString("SyncCategory%1").arg(i))));
+    }
+    QVector<TimeLogEntry> origData(entries);
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(entries, mTimes));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(categories, mTimes));
+
+    checkFunction(importSyncData, history, origSyncEntries, origSyncCategories,
+                  origSyncEntries.size() + origSyncCategories.size());
+
+    // Every fifth item is removed
+    QVector<TimeLogSyncDataEntry> removedEntries;
+    QVector<TimeLogSyncDataCategory> removedCategories;
+    for (int i = 4; i < itemsCount; i += 5) {
+        removedEntries.append(TimeLogSyncDataEntry(TimeLogEntry(entries.at(i).uuid), mTimes.at(i).addSecs(1)));
+        TimeLogCategory removedCategory;
+        removedCategory.uuid = categories.at(i).uuid;
+        removedCategories.append(TimeLogSyncDataCategory(removedCategory, mTimes.at(i).addSecs(1)));
+    }
+    checkFunction(importSyncData, history, removedEntries, removedCategories,
+                  removedEntries.size() + removedCategories.size());
+    for (const TimeLogSyncDataEntry &item: removedEntries) {
+        updateDataSet(origData, item.entry);
+        updateDataSet(origSyncEntries, item);
+    }
+    for (const TimeLogSyncDataCategory &item: removedCategories) {
+        updateDataSet(origSyncCategories, item);
+    }
+
+    // Known state wins on the equal mtime
+    QVector<TimeLogSyncDataEntry> newSyncEntries;
+    QVector<TimeLogSyncDataCategory> newSyncCategories;
+    QVector<TimeLogSyncDataEntry> appliedEntries;
+    QVector<TimeLogSyncDataCategory> appliedCategories;
+    for (int i = 0; i < itemsCount; i++) {
+        TimeLogEntry editedEntry(entries.at(i));
+        editedEntry.comment = QString("Comment %1").arg(i);
+        TimeLogCategory editedCategory(categories.at(i));
+        editedCategory.data.insert("color", QString("#%1").arg(i, 6, 10, QChar('0')));
+        TimeLogCategory removedCategory;
+        removedCategory.uuid = categories.at(i).uuid;
+
+        switch (i % 5) {
+        case 0:     // Edit with the same mtime
+            newSyncEntries.append(TimeLogSyncDataEntry(editedEntry, mTimes.at(i)));
+            newSyncCategories.append(TimeLogSyncDataCategory(editedCategory, mTimes.at(i)));
+            break;
+        case 1:     // Newer edit
+            newSyncEntries.append(TimeLogSyncDataEntry(editedEntry, mTimes.at(i).addSecs(1)));
+            newSyncCategories.append(TimeLogSyncDataCategory(editedCategory, mTimes.at(i).addSecs(1)));
+            appliedEntries.append(newSyncEntries.constLast());
+            appliedCategories.append(newSyncCategories.constLast());
+            break;
+        case 2:     // Removal with the same mtime
+            newSyncEntries.append(TimeLogSyncDataEntry(TimeLogEntry(entries.at(i).uuid), mTimes.at(i)));
+            newSyncCategories.append(TimeLogSyncDataCategory(removedCategory, mTimes.at(i)));
+            break;
+        case 3:     // Newer removal
+            newSyncEntries.append(TimeLogSyncDataEntry(TimeLogEntry(entries.at(i).uuid), mTimes.at(i).addSecs(1)));
+            newSyncCategories.append(TimeLogSyncDataCategory(removedCategory, mTimes.at(i).addSecs(1)));
+            appliedEntries.append(newSyncEntries.constLast());
+            appliedCategories.append(newSyncCategories.constLast());
+            break;
+        case 4:     // Edit with the mtime of the tombstone
+            newSyncEntries.append(TimeLogSyncDataEntry(editedEntry, mTimes.at(i).addSecs(1)));
+            newSyncCategories.append(TimeLogSyncDataCategory(editedCategory, mTimes.at(i).addSecs(1)));
+            break;
+        }
+    }
+
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    checkFunction(importSyncData, history, newSyncEntries, newSyncCategories,
+                  newSyncEntries.size() + newSyncCategories.size());
+    QVERIFY(outdateSpy.isEmpty());
+
+    for (const TimeLogSyncDataEntry &item: appliedEntries) {
+        updateDataSet(origData, item.entry);
+        updateDataSet(origSyncEntries, item);
+    }
+    for (const TimeLogSyncDataCategory &item: appliedCategories) {
+        updateDataSet(origSyncCategories, item);
+    }
+
+    checkFunction(checkDB, history, origData);
+    checkFunction(checkDB, history, origSyncEntries, origSyncCategories);
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::syncUpdates()
+{
+    QVector<TimeLogEntry> origData(genData(40));
+    QVector<QDateTime> origMTimes(origData.size(), QDateTime::currentDateTimeUtc().addDays(-1));
+    checkFunction(importSyncData, history, genSyncData(origData, origMTimes), QVector<TimeLogSyncDataCategory>(),
+                  origData.size());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    QSignalSpy batchRemoveSpy(history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+
+    // Sync inserts entries into the gaps and removes the entries in the middle of history
+    QDateTime mTime(QDateTime::currentDateTimeUtc());
+    QVector<TimeLogSyncDataEntry> syncData;
+    QVector<QDateTime> changedStarts;
+    for (int i = 1; i < origData.size() - 1; i += 4) {
+        int gap = origData.at(i).startTime.secsTo(origData.at(i + 1).startTime);
+        if (gap > 1) {
+            TimeLogEntry entry(QUuid::createUuid(),
+                               TimeLogData(origData.at(i).startTime.addSecs(gap / 2), "CategoryNew", "Inserted"));
+            syncData.append(TimeLogSyncDataEntry(entry, mTime));
+            changedStarts.append(entry.startTime);
+        }
+        syncData.append(TimeLogSyncDataEntry(TimeLogEntry(origData.at(i + 1).uuid), mTime));
+        changedStarts.append(origData.at(i + 1).startTime);
+    }
+    checkFunction(importSyncData, history, syncData, QVector<TimeLogSyncDataCategory>(), syncData.size());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    checkFunction(checkUpdates, history, updateSpy, changedStarts);
+
+    // Batch removal and its undo, which inserts the entries back in one batch
+    QVector<TimeLogEntry> removedData;
+    changedStarts.clear();
+    for (int i = 3; i < origData.size() - 1; i += 4) {
+        removedData.append(origData.at(i));
+        changedStarts.append(origData.at(i).startTime);
+    }
+
+    updateSpy.clear();
+    history->removeBatch(removedData);
+    QVERIFY(batchRemoveSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    checkFunction(checkUpdates, history, updateSpy, changedStarts);
+
+    updateSpy.clear();
+    undoCountSpy.clear();
+    history->undo();
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    checkFunction(checkUpdates, history, updateSpy, changedStarts);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::searchComments()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    // Same words match with the index and with the scan
+    const char *comments[] = { "Project review meeting", "lunch", "Review of the 100% plan", "meeting with team",
+                               "Code_review", "" };
+    const char *categories[] = { "Work>Meetings", "Personal", "Work>Planning", "Work", "Work>Code", "Personal" };
+    for (int i = 0; i < origData.size(); i++) {
+        origData[i].comment = comments[i];
+        origData[i].category = categories[i];
+    }
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    auto entries = [&origData](std::initializer_list<int> indexes) {
+        QVector<TimeLogEntry> result;
+        for (int index: indexes) {
+            result.append(origData.at(index));
+        }
+        return result;
+    };
+
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 3 }));
+    checkFunction(checkSearch, history, "REVIEW", entries({ 0, 2, 4 }));
+    checkFunction(checkSearch, history, "meet", entries({ 0, 3 }));
+    checkFunction(checkSearch, history, "100%", entries({ 2 }));
+    checkFunction(checkSearch, history, "code_", entries({ 4 }));
+    checkFunction(checkSearch, history, "dinner", entries({}));
+    checkFunction(checkSearch, history, "  ", entries({}));
+
+    QDateTime begin(QDateTime::fromTime_t(0, Qt::UTC));
+    QDateTime end(QDateTime::currentDateTimeUtc());
+    checkFunction(checkSearch, history, "meeting", entries({ 3 }), begin, end, "Work", false);
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 3 }), begin, end, "Work", true);
+    checkFunction(checkSearch, history, "meeting", entries({ 0 }), begin, end, "Work>Meetings", true);
+    checkFunction(checkSearch, history, "review", entries({}), begin, end, "Personal", true);
+
+    checkFunction(checkSearch, history, "review", entries({ 2, 4 }), origData.at(2).startTime, end);
+    checkFunction(checkSearch, history, "review", entries({ 0, 2 }), begin, origData.at(2).startTime);
+
+    // Index follows the edits and the removals
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    origData[1].comment = "Team lunch meeting";
+    history->edit(origData.at(1), TimeLogHistory::Comment);
+    QVERIFY(updateSpy.wait());
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 1, 3 }));
+    checkFunction(checkSearch, history, "lunch", entries({ 1 }));
+
+    updateSpy.clear();
+    origData[4].startTime = origData.at(4).startTime.addSecs(-60);
+    history->edit(origData.at(4), TimeLogHistory::StartTime);
+    QVERIFY(updateSpy.wait());
+    checkFunction(checkSearch, history, "code_", entries({ 4 }));
+
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    history->remove(origData.at(3));
+    QVERIFY(removeSpy.wait());
+    origData.removeAt(3);
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 1 }));
+    QVERIFY(errorSpy.isEmpty());
+
+    // Without the index triggers the read-only connection falls back to the scan
+    history->deinit();
+    const QString connectionName("searchComments");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("DROP TRIGGER IF EXISTS insert_timelog_comment;"));
+        QVERIFY(query.exec("DROP TRIGGER IF EXISTS delete_timelog_comment;"));
+        QVERIFY(query.exec("DROP TRIGGER IF EXISTS update_timelog_comment;"));
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    QVERIFY(history->init(dataDir->path(), QString(), true));
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 1 }));
+    checkFunction(checkSearch, history, "100%", entries({ 2 }));
+    checkFunction(checkSearch, history, "code_", entries({ 3 }));
+    checkFunction(checkSearch, history, "meeting", entries({ 0 }), begin, end, "Work", true);
+    checkFunction(checkSearch, history, "review", entries({ 0, 2 }), begin, origData.at(2).startTime);
+
+    // Index is rebuilt on the next writable open
+    history->deinit();
+    QVERIFY(history->init(dataDir->path()));
+    checkFunction(checkSearch, history, "meeting", entries({ 0, 1 }));
+    checkFunction(checkSearch, history, "review", entries({ 0, 2, 3 }));
+}
+
+void tst_DB::statsSeries()
+{
+    QFETCH(int, bucket);
+    QFETCH(int, depth);
+    QFETCH(QString, category);
+    QFETCH(bool, isStatsDepth);
+
+    QStringList categories;
+    categories << "Work" << "Work > Meetings" << "Work > Code > Review" << "Personal" << "Personal > Sport"
+               << "Work > Code";
+
+    // Several months of entries with the odd step, so the buckets are filled unevenly
+    QVector<TimeLogEntry> origData;
+    QDateTime start(QDate(2016, 1, 30), QTime(22, 0), Qt::UTC);
+    for (int i = 0; i < 400; i++) {
+        origData.append(TimeLogEntry(QUuid::createUuid(), TimeLogData(start, categories.at(i % categories.size()), "")));
+        start = start.addSecs(17000 + (i % 7) * 1000);
+    }
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    // The running entry is excluded, its duration depends on the current time
+    QDateTime begin(origData.at(3).startTime.addSecs(1));
+    QDateTime end(origData.constLast().startTime.addSecs(-1));
+
+    auto bucketStart = [bucket](const QDateTime &time) {
+        QDate date(time.date());
+        if (bucket == TimeLogStatsSeries::WeekBucket) {
+            date = date.addDays(1 - date.dayOfWeek());
+        } else if (bucket == TimeLogStatsSeries::MonthBucket) {
+            date = QDate(date.year(), date.month(), 1);
+        }
+        return QDateTime(date, QTime(0, 0), Qt::UTC);
+    };
+
+    QVector<QDateTime> buckets;
+    for (QDateTime time = bucketStart(begin); time <= end;
+         time = (bucket == TimeLogStatsSeries::DayBucket ? time.addDays(1)
+                 : bucket == TimeLogStatsSeries::WeekBucket ? time.addDays(7) : time.addMonths(1))) {
+        buckets.append(time);
+    }
+
+    QMap<QString, QMap<int, int> > durations;
+    for (int i = 0; i < origData.size() - 1; i++) {
+        const TimeLogEntry &entry = origData.at(i);
+        if (entry.startTime < begin || entry.startTime > end) {
+            continue;
+        }
+        if (!category.isEmpty() && entry.category != category
+            && !entry.category.startsWith(QString("%1 >").arg(category))) {
+            continue;
+        }
+
+        QString name(depth > 0 ? entry.category.split('>').mid(0, depth).join('>') : entry.category);
+        while (name.endsWith(' ')) {
+            name.chop(1);
+        }
+        durations[name][buckets.indexOf(bucketStart(entry.startTime))] += entry.startTime.secsTo(origData.at(i + 1).startTime);
+    }
+
+    QSignalSpy seriesSpy(history, SIGNAL(statsSeriesAvailable(TimeLogStatsSeries,QDateTime)));
+    history->getStatsSeries(begin, end, bucket, depth, category);
+    QVERIFY(seriesSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    TimeLogStatsSeries series = seriesSpy.constFirst().at(0).value<TimeLogStatsSeries>();
+    QCOMPARE(seriesSpy.constFirst().at(1).toDateTime(), end);
+    QCOMPARE(static_cast<int>(series.bucket), bucket);
+    QCOMPARE(series.buckets, buckets);
+    QCOMPARE(series.categories, QStringList(durations.keys()));
+    QCOMPARE(series.durations.size(), series.buckets.size() * series.categories.size());
+    for (int categoryIndex = 0; categoryIndex < series.categories.size(); categoryIndex++) {
+        QMap<int, int> categoryDurations = durations.value(series.categories.at(categoryIndex));
+        for (int bucketIndex = 0; bucketIndex < series.buckets.size(); bucketIndex++) {
+            QCOMPARE(series.durationTime(bucketIndex, categoryIndex), categoryDurations.value(bucketIndex));
+        }
+    }
+
+    if (!isStatsDepth) {
+        return;
+    }
+
+    // Bucket totals should be the same as the plain stats on the same depth
+    QSignalSpy statsSpy(history, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    history->getStats(begin, end, category);
+    QVERIFY(statsSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVector<TimeLogStats> stats = statsSpy.constFirst().at(0).value<QVector<TimeLogStats> >();
+    QCOMPARE(stats.size(), series.categories.size());
+    for (const TimeLogStats &item: stats) {
+        int categoryIndex = series.categories.indexOf(item.category);
+        QVERIFY2(categoryIndex != -1, qPrintable(item.category));
+        int total = 0;
+        for (int bucketIndex = 0; bucketIndex < series.buckets.size(); bucketIndex++) {
+            total += series.durationTime(bucketIndex, categoryIndex);
+        }
+        QCOMPARE(total, item.durationTime);
+    }
+}
+
+void tst_DB::statsSeries_data()
+{
+    QTest::addColumn<int>("bucket");
+    QTest::addColumn<int>("depth");
+    QTest::addColumn<QString>("category");
+    QTest::addColumn<bool>("isStatsDepth");
+
+    QTest::newRow("day") << static_cast<int>(TimeLogStatsSeries::DayBucket) << 1 << QString() << true;
+    QTest::newRow("week") << static_cast<int>(TimeLogStatsSeries::WeekBucket) << 1 << QString() << true;
+    QTest::newRow("month") << static_cast<int>(TimeLogStatsSeries::MonthBucket) << 1 << QString() << true;
+    QTest::newRow("week, depth 2") << static_cast<int>(TimeLogStatsSeries::WeekBucket) << 2 << QString() << false;
+    QTest::newRow("month, full depth") << static_cast<int>(TimeLogStatsSeries::MonthBucket) << 0 << QString() << false;
+    QTest::newRow("day, category") << static_cast<int>(TimeLogStatsSeries::DayBucket) << 2 << QString("Work") << true;
+    QTest::newRow("month, subcategory") << static_cast<int>(TimeLogStatsSeries::MonthBucket) << 3
+                                        << QString("Work > Code") << true;
+}
+
+void tst_DB::statsRollup()
+{
+    QStringList categories;
+    categories << "Work" << "Work > Meetings" << "Personal" << "Personal > Sport" << "Study";
+
+    QVector<TimeLogEntry> origData;
+    QDateTime start(QDate(2016, 3, 1), QTime(20, 0), Qt::UTC);
+    for (int i = 0; i < 60; i++) {
+        origData.append(TimeLogEntry(QUuid::createUuid(), TimeLogData(start, categories.at(i % categories.size()), "")));
+        start = start.addSecs(17000 + (i % 7) * 1000);
+    }
+
+    // Full days only, the running entry is excluded
+    QDateTime begin(origData.constFirst().startTime.date(), QTime(0, 0), Qt::UTC);
+    QDateTime end(QDateTime(origData.constLast().startTime.date(), QTime(0, 0), Qt::UTC).addSecs(-1));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    QSignalSpy batchRemoveSpy(history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)));
+    QSignalSpy undoCountSpy(history, SIGNAL(undoCountChanged(int)));
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    checkFunction(checkStats, history, begin, end);
+
+    // Category edit moves the duration, start edit changes durations of the neighbours across the days
+    TimeLogEntry entry(origData.at(5));
+    entry.category = "Study > Reading";
+    history->edit(entry, TimeLogHistory::Category);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+
+    entry = origData.at(10);
+    entry.startTime = entry.startTime.addSecs(entry.startTime.secsTo(origData.at(11).startTime) / 2);
+    updateSpy.clear();
+    undoCountSpy.clear();
+    history->edit(entry, TimeLogHistory::StartTime);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    checkFunction(checkStats, history, begin, end);
+
+    undoCountSpy.clear();
+    history->removeBatch(QVector<TimeLogEntry>() << origData.at(20) << origData.at(21));
+    QVERIFY(batchRemoveSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+
+    undoCountSpy.clear();
+    history->remove(origData.at(30));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(!undoCountSpy.isEmpty() || undoCountSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    checkFunction(checkStats, history, begin, end);
+
+    // Sync inserts, edits and removes in one transaction
+    QDateTime mTime(QDateTime::currentDateTimeUtc().addSecs(1));
+    QVector<TimeLogSyncDataEntry> syncData;
+    TimeLogEntry insertedEntry(QUuid::createUuid(),
+                               TimeLogData(origData.at(40).startTime.addSecs(3600), "Personal > Sport", ""));
+    syncData.append(TimeLogSyncDataEntry(insertedEntry, mTime));
+    entry = origData.at(45);
+    entry.category = "Work > Meetings";
+    syncData.append(TimeLogSyncDataEntry(entry, mTime));
+    syncData.append(TimeLogSyncDataEntry(TimeLogEntry(origData.at(50).uuid), mTime));
+    checkFunction(importSyncData, history, syncData, QVector<TimeLogSyncDataCategory>(), syncData.size());
+
+    checkFunction(checkStats, history, begin, end);
+
+    // Undo of the removals and of the start edit
+    for (int i = 0; i < 3; i++) {
+        undoCountSpy.clear();
+        history->undo();
+        QVERIFY(undoCountSpy.wait());
+        QVERIFY(errorSpy.isEmpty());
+        QVERIFY(outdateSpy.isEmpty());
+
+        checkFunction(checkStats, history, begin, end);
+    }
+
+    // Rollup itself has the same totals per day and category as the entries
+    history->deinit();
+    const QString connectionName("statsRollup");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        const QString aggregate("SELECT start - start % 86400 AS day, category, SUM(max(IFNULL(duration, 0), 0)) AS duration "
+                                "FROM timelog_entries GROUP BY 1, 2");
+        QVERIFY(query.exec(QString("SELECT count(*) FROM ( "
+                                   "    SELECT day, category, duration FROM daily_stats WHERE duration != 0 "
+                                   "    EXCEPT SELECT * FROM (%1) WHERE duration != 0 "
+                                   ")").arg(aggregate)));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+        QVERIFY(query.exec(QString("SELECT count(*) FROM ( "
+                                   "    SELECT * FROM (%1) WHERE duration != 0 "
+                                   "    EXCEPT SELECT day, category, duration FROM daily_stats WHERE duration != 0 "
+                                   ")").arg(aggregate)));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+        QVERIFY(query.exec("SELECT count(*) FROM daily_stats WHERE duration < 0"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    QVERIFY(history->init(dataDir->path()));
+    checkFunction(checkStats, history, begin, end);
+}
+
+void tst_DB::cancelRequest()
+{
+    QVector<TimeLogEntry> origData(genData(20000));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    QSignalSpy partialSpy(history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+
+    // Request is queued after the import on the writer, so it's dropped before the start
+    qlonglong id = QDateTime::currentMSecsSinceEpoch();
+    history->import(origData);
+    history->getHistoryBetween(id);
+    history->cancelRequest(id);
+    QVERIFY(importSpy.wait());
+    QVERIFY(!dataSpy.isEmpty() || dataSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QCOMPARE(dataSpy.size(), 1);
+    QCOMPARE(dataSpy.constFirst().at(1).toLongLong(), id);
+    QVERIFY(dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >().isEmpty());
+    QVERIFY(partialSpy.isEmpty());
+
+    // Chunked request is aborted after the first chunk
+    dataSpy.clear();
+    const uint chunkSize = 50;
+    id++;
+    QMetaObject::Connection connection = connect(history, &TimeLogHistory::historyRequestPartial,
+                                                 [id](QVector<TimeLogEntry>, qlonglong requestId) {
+        if (requestId == id) {
+            history->cancelRequest(id);
+        }
+    });
+    history->getHistoryBetween(id, origData.constFirst().startTime, origData.constLast().startTime,
+                               QString(), false, chunkSize);
+    QVERIFY(dataSpy.wait());
+    disconnect(connection);
+    QVERIFY(errorSpy.isEmpty());
+    QCOMPARE(dataSpy.size(), 1);
+    QCOMPARE(dataSpy.constFirst().at(1).toLongLong(), id);
+    QVERIFY(dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >().isEmpty());
+    QVERIFY(!partialSpy.isEmpty());
+    QVERIFY(partialSpy.size() < origData.size() / static_cast<int>(chunkSize));
+
+    // Completed request is not tracked anymore, the same id gets the full data
+    dataSpy.clear();
+    partialSpy.clear();
+    history->getHistoryBetween(id, origData.constFirst().startTime, origData.constLast().startTime);
+    QVERIFY(dataSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QCOMPARE(dataSpy.constFirst().at(1).toLongLong(), id);
+    QVERIFY(compareData(dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >(), origData));
+
+    // Cancellation of the completed request has no effect
+    history->cancelRequest(id);
+    dataSpy.clear();
+    history->getHistoryBetween(id, origData.at(100).startTime, origData.at(199).startTime);
+    QVERIFY(dataSpy.wait());
+    QCOMPARE(dataSpy.constFirst().at(1).toLongLong(), id);
+    QVERIFY(compareData(dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >(), origData.mid(100, 100)));
+
+    QSignalSpy diagnosticsSpy(history, SIGNAL(diagnosticsAvailable(QVariantMap)));
+    history->getDiagnostics();
+    QVERIFY(diagnosticsSpy.wait());
+    QCOMPARE(diagnosticsSpy.constFirst().at(0).toMap().value("requests").toMap().value("active").toInt(), 0);
+    QVERIFY(errorSpy.isEmpty());
+}
+
+void tst_DB::dataImport()
+{
+    // Daily files of the export format, enough for several import transactions
+    QVector<TimeLogEntry> origData(genData(12000));
+    // Format has the precision of seconds
+    for (TimeLogEntry &entry: origData) {
+        entry.startTime = QDateTime::fromTime_t(entry.startTime.toTime_t(), Qt::UTC);
+    }
+
+    QString importPath(QDir(dataDir->path()).filePath("import"));
+    QVERIFY(QDir().mkpath(importPath));
+    QDir importDir(importPath);
+    QFile file;
+    QTextStream stream;
+    QDate currentDate;
+    int filesCount = 0;
+    for (const TimeLogEntry &entry: origData) {
+        QDateTime startTime(entry.startTime.toUTC());
+        if (!file.isOpen() || startTime.date() != currentDate) {
+            currentDate = startTime.date();
+            stream.setDevice(Q_NULLPTR);
+            file.close();
+            file.setFileName(importDir.filePath(QString("%1.csv").arg(currentDate.toString(Qt::ISODate))));
+            QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+            stream.setDevice(&file);
+            filesCount++;
+        }
+        stream << startTime.toString(Qt::ISODate) << ';' << entry.category << ';'
+               << entry.comment << ';' << entry.uuid.toString() << '\n';
+    }
+    stream.setDevice(Q_NULLPTR);
+    file.close();
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    DataImporter importer(history);
+    importer.start(importPath);
+    QTRY_COMPARE_WITH_TIMEOUT(history->size(), origData.size(), 60000);
+    QVERIFY(errorSpy.isEmpty());
+
+    // Files are parsed in parallel, but imported in order, small files are merged to the larger transactions
+    QVERIFY(importSpy.size() > 1);
+    QVERIFY(importSpy.size() < filesCount);
+    QVector<TimeLogEntry> importedData;
+    for (const QList<QVariant> &arguments: importSpy) {
+        importedData.append(arguments.at(0).value<QVector<TimeLogEntry> >());
+    }
+    QVERIFY(compareData(importedData, origData));
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::exportImport()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(bool, isSingleFile);
+
+    // Enough entries for several export requests chunks and import transactions
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+    // Format has the precision of seconds
+    for (TimeLogEntry &entry: origData) {
+        entry.startTime = QDateTime::fromTime_t(entry.startTime.toTime_t(), Qt::UTC);
+    }
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QString exportPath(QDir(dataDir->path()).filePath("export"));
+    {
+        DataExporter exporter(history);
+        exporter.setSingleFile(isSingleFile);
+        QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+        QSignalSpy partialSpy(history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+        exporter.start(exportPath);
+        QTRY_VERIFY_WITH_TIMEOUT(!dataSpy.isEmpty(), 60000);
+        QVERIFY(errorSpy.isEmpty());
+        // Single request, streamed in chunks
+        QCOMPARE(dataSpy.size(), 1);
+        QVERIFY(partialSpy.size() > 1);
+        for (const QList<QVariant> &arguments: partialSpy) {
+            QCOMPARE(arguments.at(1).toLongLong(), dataSpy.constFirst().at(1).toLongLong());
+        }
+    }
+
+    // Entries follow in start order through all the files, split by date
+    QDir exportDir(exportPath);
+    QStringList files(exportDir.entryList(QStringList() << "*.csv", QDir::Files, QDir::Name));
+    files.removeOne("categories.csv");
+    if (isSingleFile) {
+        QCOMPARE(files, QStringList() << "timelog.csv");
+    } else {
+        QVERIFY(files.size() > 1);
+    }
+    int index = 0;
+    for (const QString &fileName: files) {
+        QFile file(exportDir.filePath(fileName));
+        QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+        QTextStream stream(&file);
+        while (!stream.atEnd()) {
+            QStringList fields(stream.readLine().split(';'));
+            QCOMPARE(fields.size(), 4);
+            QVERIFY(index < origData.size());
+            const TimeLogEntry &entry = origData.at(index++);
+            QDateTime startTime(QDateTime::fromString(fields.at(0), Qt::ISODate));
+            QCOMPARE(startTime, entry.startTime);
+            QCOMPARE(fields.at(1), entry.category);
+            QCOMPARE(fields.at(2), entry.comment);
+            QCOMPARE(QUuid(fields.at(3)), entry.uuid);
+            if (!isSingleFile) {
+                QVERIFY(fileName.startsWith(startTime.toUTC().date().toString(Qt::ISODate)));
+            }
+        }
+    }
+    QCOMPARE(index, origData.size());
+
+    // Import to the new DB, files are parsed in parallel and imported in order
+    history->deinit();
+    delete history;
+    history = new TimeLogHistory;
+    Q_CHECK_PTR(history);
+    QVERIFY(history->init(QDir(dataDir->path()).filePath("import")));
+
+    {
+        QSignalSpy importErrorSpy(history, SIGNAL(error(QString)));
+        QSignalSpy chunkSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+        DataImporter importer(history);
+        importer.start(exportPath);
+        QTRY_COMPARE_WITH_TIMEOUT(history->size(), origData.size(), 60000);
+        QVERIFY(importErrorSpy.isEmpty());
+        QVERIFY(chunkSpy.size() > 1);
+        // Small files are merged to the larger transactions
+        if (!isSingleFile) {
+            QVERIFY(chunkSpy.size() < files.size());
+        }
+    }
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::exportImport_data()
+{
+    QTest::addColumn<int>("entriesCount");
+    QTest::addColumn<bool>("isSingleFile");
+
+    QTest::newRow("daily files") << 12000 << false;
+    QTest::newRow("single file") << 12000 << true;
+}
+
+void tst_DB::archive()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    TimeLogEntry entry;
+    entry.startTime = QDateTime::fromString("2016-01-10T10:00:00Z", Qt::ISODate);
+    entry.category = "CategoryNew";
+    entry.comment = "Test comment";
+    entry.uuid = QUuid::createUuid();
+    origData.append(entry);
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy archiveSpy(history, SIGNAL(dataArchived(QDateTime)));
+    history->archive(QDateTime::fromString("2016-06-01T00:00:00Z", Qt::ISODate));
+    QVERIFY(archiveSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QCOMPARE(history->size(), origData.size());
+
+    QString archivePath(QString("%1/timelog/db-archive/2015.sqlite").arg(dataDir->path()));
+    QVERIFY(QFile::exists(archivePath));
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    history->remove(origData.at(4));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QVERIFY(!QFile::exists(archivePath));
+
+    origData.removeAt(4);
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::purgeRemoved()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+    history->remove(origData.at(1));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+    QDateTime removeTime(QDateTime::currentDateTimeUtc());
+
+    origData.removeAt(1);
+
+    auto removedCount = [](const QVector<TimeLogSyncDataEntry> &data) {
+        return static_cast<int>(std::count_if(data.cbegin(), data.cend(), [](const TimeLogSyncDataEntry &d) {
+            return d.sync.isRemoved;
+        }));
+    };
+
+    QSignalSpy purgeSpy(history, SIGNAL(removedPurged(QDateTime)));
+    history->purgeRemoved(removeTime.addDays(-1));
+    QVERIFY(purgeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    QVector<TimeLogSyncDataEntry> syncEntryData;
+    QVector<TimeLogSyncDataCategory> syncCategoryData;
+    checkFunction(extractSyncData, history, syncEntryData, syncCategoryData);
+    QCOMPARE(removedCount(syncEntryData), 1);
+
+    checkFunction(checkHashes, history, false);
+
+    purgeSpy.clear();
+    history->purgeRemoved(removeTime.addSecs(1));
+    QVERIFY(purgeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    syncEntryData.clear();
+    syncCategoryData.clear();
+    checkFunction(extractSyncData, history, syncEntryData, syncCategoryData);
+    QCOMPARE(removedCount(syncEntryData), 0);
+
+    checkFunction(checkDB, history, origData);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::purgeHorizon()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origData, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories;
+
+    checkFunction(importSyncData, history, origSyncEntries, origSyncCategories, origSyncEntries.size());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy purgeSpy(history, SIGNAL(removedPurged(QDateTime)));
+
+    QDateTime horizon(defaultMTimes().at(3));
+    history->purgeRemoved(horizon);
+    QVERIFY(purgeSpy.wait());
+    // Older purge does not move the horizon back
+    purgeSpy.clear();
+    history->purgeRemoved(horizon.addDays(-30));
+    QVERIFY(purgeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(outdateSpy.isEmpty());
+
+    history->deinit();
+
+    const QString connectionName("purgeHorizon");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT time FROM maintenance WHERE task='purge_horizon';"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toLongLong(), horizon.toMSecsSinceEpoch());
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    QVERIFY(history->init(dataDir->path()));
+
+    // Stale tombstone of the unknown entry is rejected by the restored horizon
+    TimeLogSyncDataEntry staleRemoved(TimeLogEntry(QUuid::createUuid()), horizon.addSecs(-1));
+    // Tombstone of the known entry is applied regardless of the horizon
+    TimeLogSyncDataEntry knownRemoved(TimeLogEntry(origData.at(0).uuid), horizon.addSecs(-1));
+    TimeLogSyncDataEntry newRemoved(TimeLogEntry(QUuid::createUuid()), horizon.addSecs(1));
+    // Unknown live items before the horizon could be already removed, so they are rejected too
+    TimeLogEntry staleEntry(QUuid::createUuid(),
+                            TimeLogData(QDateTime::fromString("2015-11-02T01:00:00+0200", Qt::ISODate),
+                                        "CategoryStale", ""));
+    TimeLogSyncDataEntry staleInserted(staleEntry, horizon.addDays(-10));
+
+    TimeLogCategory staleRemovedCategory;
+    staleRemovedCategory.uuid = QUuid::createUuid();
+    TimeLogSyncDataCategory staleRemovedSyncCategory(staleRemovedCategory, horizon.addSecs(-1));
+    TimeLogCategory staleCategory(QUuid::createUuid(), TimeLogCategoryData("CategoryStale"));
+    TimeLogSyncDataCategory staleAddedSyncCategory(staleCategory, horizon.addDays(-10));
+
+    QVector<TimeLogSyncDataEntry> newSyncEntries;
+    newSyncEntries << staleRemoved << knownRemoved << newRemoved << staleInserted;
+    QVector<TimeLogSyncDataCategory> newSyncCategories;
+    newSyncCategories << staleRemovedSyncCategory << staleAddedSyncCategory;
+    checkFunction(importSyncData, history, newSyncEntries, newSyncCategories,
+                  newSyncEntries.size() + newSyncCategories.size());
+
+    updateDataSet(origData, knownRemoved.entry);
+    updateDataSet(origSyncEntries, knownRemoved);
+    updateDataSet(origSyncEntries, newRemoved);
+
+    checkFunction(checkDB, history, origData);
+    checkFunction(checkDB, history, origSyncEntries, origSyncCategories);
+
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::foreignThreadRequests()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    class CallerThread : public QThread
+    {
+    public:
+        std::function<void()> call;
+
+    protected:
+        virtual void run() { call(); }
+    };
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+
+    // Same way as the sync workers call the history
+    CallerThread thread;
+    thread.call = [&origData]() {
+        history->import(origData);
+        history->remove(origData.at(1));
+        history->getStoredCategories();
+    };
+    thread.start();
+    QVERIFY(thread.wait());
+
+    QVERIFY(importSpy.wait());
+    QVERIFY(removeSpy.count() || removeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    origData.removeAt(1);
+
+    checkFunction(checkDB, history, origData);
+}
+
+void tst_DB::categoryInterning()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    history->getHistoryBetween(0);
+    QVERIFY(dataSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVector<TimeLogEntry> historyData = dataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >();
+    QCOMPARE(historyData.size(), origData.size());
+
+    QHash<QString, const QChar*> buffers;
+    for (const TimeLogEntry &entry: historyData) {
+        const QChar *buffer = buffers.value(entry.category, entry.category.constData());
+        QCOMPARE(entry.category.constData(), buffer);
+        buffers.insert(entry.category, buffer);
+        QCOMPARE(TimeLogCategoryPool::intern(QString(entry.category.constData(), entry.category.size())).constData(), buffer);
+    }
+}
+
+void tst_DB::categoryTreePatch()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QVector<TimeLogCategory> origCategories(defaultCategories());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy categoriesSpy(history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
+
+    checkFunction(importSyncData, history, genSyncData(origData, defaultMTimes()),
+                  genSyncData(origCategories, defaultMTimes()), 1);
+
+    TimeLogCategory category(QUuid::createUuid(), TimeLogCategoryData("CategoryParent > CategoryChild"));
+    categoriesSpy.clear();
+    history->addCategory(category);
+    QVERIFY(categoriesSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QSharedPointer<TimeLogCategoryTreeNode> tree;
+    tree = categoriesSpy.constLast().at(0).value<QSharedPointer<TimeLogCategoryTreeNode> >();
+    QVERIFY(!tree->diff().isRebuilt);
+    QCOMPARE(tree->diff().added, QStringList() << "CategoryParent" << "CategoryParent > CategoryChild");
+    QVERIFY(tree->diff().removed.isEmpty());
+    QVERIFY(tree->child("CategoryParent"));
+    QVERIFY(tree->child("CategoryParent")->child("CategoryChild"));
+    QCOMPARE(tree->child("CategoryParent")->child("CategoryChild")->category.uuid, category.uuid);
+    int childrenCount = tree->children().size();
+
+    categoriesSpy.clear();
+    history->removeCategory(category.name);
+    QVERIFY(categoriesSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    tree = categoriesSpy.constLast().at(0).value<QSharedPointer<TimeLogCategoryTreeNode> >();
+    QVERIFY(!tree->diff().isRebuilt);
+    QCOMPARE(tree->diff().removed, QStringList() << "CategoryParent > CategoryChild" << "CategoryParent");
+    QVERIFY(!tree->child("CategoryParent"));
+    QCOMPARE(tree->children().size(), childrenCount - 1);
+
+    checkFunction(checkDB, history, origCategories);
+}
+
+void tst_DB::snapshot()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    const int entriesCount = 3;
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QString filePath(QString("%1/snapshot").arg(dataDir->path()));
+    history->saveSnapshot(filePath, entriesCount, true);
+    QVERIFY(errorSpy.isEmpty());
+
+    TimeLogSnapshot snapshot;
+    QVERIFY(TimeLogSnapshot::load(filePath, snapshot));
+    QCOMPARE(snapshot.size, history->size());
+    QVERIFY(compareData(snapshot.recentEntries, origData.mid(origData.size() - entriesCount)));
+    QVERIFY(snapshot.categories);
+    QCOMPARE(snapshot.categories->childNames(), history->categories()->childNames());
+
+    history->deinit();
+    delete history;
+
+    // Snapshot data is available before the init is finished and matches the DB
+    history = new TimeLogHistory;
+    QSignalSpy outdateSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy initSpy(history, SIGNAL(initFinished(bool)));
+    history->initAsync(dataDir->path(), QString(), false, false, TimeLogConnectionProfile(), snapshot);
+    QCOMPARE(history->size(), snapshot.size);
+    QVERIFY(compareData(history->snapshotEntries(), snapshot.recentEntries));
+    QVERIFY(initSpy.wait());
+    QVERIFY(initSpy.constFirst().at(0).toBool());
+    QVERIFY(outdateSpy.isEmpty());
+    QVERIFY(history->snapshotEntries().isEmpty());
+
+    checkFunction(checkDB, history, origData);
+
+    history->deinit();
+    delete history;
+
+    // Outdated snapshot is detected on init
+    snapshot.recentEntries.last().comment = "Outdated comment";
+    history = new TimeLogHistory;
+    QSignalSpy outdatedSpy(history, SIGNAL(dataOutdated()));
+    QSignalSpy reinitSpy(history, SIGNAL(initFinished(bool)));
+    history->initAsync(dataDir->path(), QString(), false, false, TimeLogConnectionProfile(), snapshot);
+    QVERIFY(reinitSpy.wait());
+    QVERIFY(reinitSpy.constFirst().at(0).toBool());
+    QCOMPARE(outdatedSpy.size(), 1);
+}
+
+void tst_DB::diagnostics()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QVariantMap report;
+    checkFunction(extractDiagnostics, history, report);
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(report.value("models").toList().isEmpty());
+
+    QVariantMap writer(report.value("history").toMap().value("writer").toMap());
+    QVERIFY(writer.value("initialized").toBool());
+    QCOMPARE(writer.value("size").toLongLong(), qlonglong(origData.size()));
+    QVERIFY(writer.value("categories").toMap().value("count").toInt() > 0);
+    QVERIFY(writer.value("queryCache").toMap().value("misses").toLongLong() > 0);
+
+    QVariantMap db(writer.value("db").toMap());
+    QVERIFY(db.value("page_size").toLongLong() > 0);
+    QCOMPARE(db.value("fileBytes").toLongLong(), db.value("page_count").toLongLong() * db.value("page_size").toLongLong());
+
+    // Request is not blocked by the sync, the writer replies between the slices
+    QVector<TimeLogEntry> syncData(genData(2000));
+    QVector<QDateTime> syncMTimes(syncData.size(), QDateTime::currentDateTimeUtc());
+    QSignalSpy syncSpy(history, SIGNAL(dataSynced(QDateTime)));
+    QSignalSpy diagnosticsSpy(history, SIGNAL(diagnosticsAvailable(QVariantMap)));
+    history->sync(genSyncData(syncData, syncMTimes), QVector<TimeLogSyncDataEntry>(),
+                  QVector<TimeLogSyncDataCategory>());
+    history->getDiagnostics();
+    QVERIFY(diagnosticsSpy.wait());
+    QVERIFY(syncSpy.isEmpty());
+    QCOMPARE(diagnosticsSpy.size(), 1);
+    QVERIFY(diagnosticsSpy.constFirst().at(0).toMap().value("requests").toMap()
+            .value("pendingBackgroundWrites").toInt() > 0);
+    QVERIFY(syncSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+}
+
+void tst_DB::queryAudit()
+{
+    history->deinit();
+    delete history;
+
+    // Plans are audited for all statements, slow ones are unlikely with the threshold
+    TimeLogConnectionProfile profile;
+    profile.slowQueryTime = 60000;
+    history = new TimeLogHistory;
+    QVERIFY(history->init(dataDir->path(), QString(), false, false, profile));
+
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    history->getHistoryAfter(1, 5, origData.at(1).startTime);
+    QVERIFY(dataSpy.wait());
+    history->getHistoryBefore(2, 5, origData.at(origData.size() - 2).startTime);
+    QVERIFY(dataSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVariantMap report;
+    checkFunction(extractDiagnostics, history, report);
+    QVariantMap historyReport(report.value("history").toMap());
+    QVariantList workers(historyReport.value("readers").toList());
+    workers.prepend(historyReport.value("writer"));
+
+    int explainedCount = 0;
+    for (const QVariant &worker: workers) {
+        QVariantMap queryAudit(worker.toMap().value("queryAudit").toMap());
+        QCOMPARE(queryAudit.value("slowQueryTime").toInt(), profile.slowQueryTime);
+        explainedCount += queryAudit.value("explainedCount").toInt();
+    }
+    QVERIFY(explainedCount > 0);
+
+    // Recent history is read by the start index
+    for (const QVariant &worker: historyReport.value("readers").toList()) {
+        QCOMPARE(worker.toMap().value("queryAudit").toMap().value("fullScans").toStringList(), QStringList());
+    }
+}
+
+void tst_DB::readonlySnapshot()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    QSignalSpy insertSpy(history, SIGNAL(dataInserted(TimeLogEntry)));
+
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    // Second instance reads the DB, while the first one keeps writing to it
+    TimeLogHistory reader;
+    QVERIFY(reader.init(dataDir->path(), QString(), true));
+    QCOMPARE(reader.size(), origData.size());
+
+    QSignalSpy readerErrorSpy(&reader, SIGNAL(error(QString)));
+    QSignalSpy readerDataSpy(&reader, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    reader.beginReadSnapshot();
+    reader.getHistoryBetween(1);
+    QVERIFY(readerDataSpy.wait());
+    QCOMPARE(readerDataSpy.constFirst().at(0).value<QVector<TimeLogEntry> >().size(), origData.size());
+
+    TimeLogEntry entry;
+    entry.startTime = origData.constLast().startTime.addSecs(1000);
+    entry.category = "CategoryNew";
+    entry.comment = "Test comment";
+    entry.uuid = QUuid::createUuid();
+    history->insert(entry);
+    QVERIFY(insertSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    // Writer is not blocked by the snapshot, while the reader doesn't see its changes
+    reader.getHistoryBetween(2);
+    QVERIFY(readerDataSpy.wait());
+    QCOMPARE(readerDataSpy.constLast().at(0).value<QVector<TimeLogEntry> >().size(), origData.size());
+
+    reader.endReadSnapshot();
+    reader.getHistoryBetween(3);
+    QVERIFY(readerDataSpy.wait());
+    QCOMPARE(readerDataSpy.constLast().at(0).value<QVector<TimeLogEntry> >().size(), origData.size() + 1);
+    QVERIFY(readerErrorSpy.isEmpty());
+
+    reader.deinit();
+}
+
+void tst_DB::backup()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    QSignalSpy progressSpy(history, SIGNAL(backupProgress(qlonglong,qlonglong)));
+    QSignalSpy finishSpy(history, SIGNAL(backupFinished(QString,bool)));
+
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    QString filePath(QString("%1/backup.sqlite").arg(dataDir->path()));
+    history->backup(filePath);
+    QVERIFY(finishSpy.wait());
+    QCOMPARE(finishSpy.constFirst().at(0).toString(), filePath);
+    QVERIFY(finishSpy.constFirst().at(1).toBool());
+    QVERIFY(!progressSpy.isEmpty());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(QFile::exists(filePath));
+    QVERIFY(!QFile::exists(QString("%1.part").arg(filePath)));
+
+    // Copy is a complete DB with the same schema version, so it is opened without upgrade
+    TimeLogHistory copy;
+    QVERIFY(copy.init(dataDir->path(), "backup.sqlite"));
+    QCOMPARE(copy.size(), origData.size());
+    checkFunction(checkDB, &copy, origData);
+    checkFunction(checkHashes, &copy, false);
+
+    copy.deinit();
+}
+
+void tst_DB::categoryDataUpgrade()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QVector<TimeLogCategory> origCategories(defaultCategories());
+    for (int i = 0; i < origCategories.size(); i++) {
+        origCategories[i].data.insert("color", QString("#%1").arg(i, 6, 10, QChar('0')));
+    }
+
+    checkFunction(importSyncData, history, genSyncData(origData, defaultMTimes()),
+                  genSyncData(origCategories, defaultMTimes()), 1);
+
+    history->deinit();
+    delete history;
+    history = Q_NULLPTR;
+
+    // Schema version 10 keeps the category data in text JSON
+    const QString connectionName("categoryDataUpgrade");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("UPDATE categories SET data=? WHERE uuid=?;"));
+        for (const TimeLogCategory &category: origCategories) {
+            query.addBindValue(QJsonDocument(QJsonObject::fromVariantMap(category.data)).toJson());
+            query.addBindValue(category.uuid.toRfc4122());
+            QVERIFY(query.exec());
+        }
+        QVERIFY(query.exec("PRAGMA user_version = 10;"));
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    history = new TimeLogHistory;
+    QVERIFY(history->init(dataDir->path()));
+
+    checkFunction(checkDB, history, origData);
+    checkFunction(checkDB, history, origCategories);
+    checkFunction(checkHashes, history, false);
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT data FROM categories;"));
+        int count = 0;
+        while (query.next()) {
+            QVERIFY(query.value(0).toByteArray().startsWith("qbjs"));
+            count++;
+        }
+        QCOMPARE(count, origCategories.size());
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+void tst_DB::schemaUpgrade()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    origData[5].category = origData.at(0).category;
+    QVector<TimeLogCategory> origCategories(defaultCategories());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origData, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(origCategories, defaultMTimes()));
+    TimeLogSyncDataEntry removedEntry(TimeLogEntry(QUuid::createUuid()), defaultMTimes().constLast().addSecs(1));
+
+    history->deinit();
+    QVERIFY(QDir(QString("%1/timelog").arg(dataDir->path())).removeRecursively());
+    QVERIFY(QDir().mkpath(QString("%1/timelog").arg(dataDir->path())));
+
+    // Schema version 1, as created by the first release
+    const QStringList schema = QStringList()
+        << "CREATE TABLE IF NOT EXISTS timelog (uuid BLOB UNIQUE NOT NULL, start INTEGER PRIMARY "
+           "KEY, category TEXT NOT NULL, comment TEXT, duration INTEGER, mtime INTEGER);"
+        << "CREATE INDEX IF NOT EXISTS timelog_category_index ON timelog (category);"
+        << "CREATE INDEX IF NOT EXISTS timelog_mtime_index ON timelog (mtime);"
+        << "CREATE TABLE IF NOT EXISTS timelog_removed(uuid BLOB PRIMARY KEY, mtime INTEGER) WITHOUT "
+           "ROWID;"
+        << "CREATE INDEX IF NOT EXISTS timelog_removed_mtime_index ON timelog_removed (mtime);"
+        << "CREATE TABLE IF NOT EXISTS categories (uuid BLOB PRIMARY KEY, category TEXT UNIQUE NOT "
+           "NULL, data BLOB, mtime INTEGER) WITHOUT ROWID;"
+        << "CREATE INDEX IF NOT EXISTS categories_mtime_index ON categories (mtime);"
+        << "CREATE TABLE IF NOT EXISTS categories_removed (uuid BLOB PRIMARY KEY, mtime INTEGER) "
+           "WITHOUT ROWID;"
+        << "CREATE INDEX IF NOT EXISTS categories_removed_mtime_index ON categories_removed (mtime);"
+        << "CREATE TABLE IF NOT EXISTS hashes (start INTEGER PRIMARY KEY, hash BLOB);"
+        << "CREATE TRIGGER IF NOT EXISTS check_insert_timelog BEFORE INSERT ON timelog BEGIN SELECT "
+           "mtime, CASE WHEN NEW.mtime < mtime THEN RAISE(IGNORE) END FROM timelog_removed WHERE "
+           "uuid=NEW.uuid; END;"
+        << "CREATE TRIGGER IF NOT EXISTS insert_timelog AFTER INSERT ON timelog BEGIN UPDATE timelog "
+           "SET duration=(NEW.start - start) WHERE start=( SELECT start FROM timelog WHERE start < "
+           "NEW.start ORDER BY start DESC LIMIT 1 ); UPDATE timelog SET duration=IFNULL( ( SELECT "
+           "start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, -1 "
+           ") WHERE start=NEW.start; DELETE FROM timelog_removed WHERE uuid=NEW.uuid; INSERT OR "
+           "REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', "
+           "'start of month'), NULL); END;"
+        << "CREATE TRIGGER IF NOT EXISTS delete_timelog AFTER DELETE ON timelog BEGIN UPDATE timelog "
+           "SET duration=IFNULL( ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start "
+           "ASC LIMIT 1 ) - start, -1 ) WHERE start=( SELECT start FROM timelog WHERE start < "
+           "OLD.start ORDER BY start DESC LIMIT 1 ); END;"
+        << "CREATE TRIGGER IF NOT EXISTS check_update_timelog BEFORE UPDATE ON timelog BEGIN SELECT "
+           "CASE WHEN NEW.mtime < OLD.mtime THEN RAISE(IGNORE) END; END;"
+        << "CREATE TRIGGER IF NOT EXISTS update_timelog AFTER UPDATE OF start, category, comment, "
+           "mtime, uuid ON timelog BEGIN INSERT OR REPLACE INTO hashes (start, hash) "
+           "VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); END;"
+        << "CREATE TRIGGER IF NOT EXISTS update_timelog_start AFTER UPDATE OF start ON timelog BEGIN "
+           "UPDATE timelog SET duration=(NEW.start - start) WHERE start=( SELECT start FROM timelog "
+           "WHERE start < NEW.start ORDER BY start DESC LIMIT 1 ); UPDATE timelog SET "
+           "duration=IFNULL( ( SELECT start FROM timelog WHERE start > OLD.start ORDER BY start ASC "
+           "LIMIT 1 ) - start, -1 ) WHERE start=NULLIF( ( SELECT start FROM timelog WHERE start < "
+           "OLD.start ORDER BY start DESC LIMIT 1 ), ( SELECT start FROM timelog WHERE start < "
+           "NEW.start ORDER BY start DESC LIMIT 1 ) ); UPDATE timelog SET duration=IFNULL( ( SELECT "
+           "start FROM timelog WHERE start > NEW.start ORDER BY start ASC LIMIT 1 ) - NEW.start, -1 "
+           ") WHERE start=NEW.start; END;"
+        << "CREATE TRIGGER IF NOT EXISTS check_insert_timelog_removed BEFORE INSERT ON "
+           "timelog_removed BEGIN SELECT mtime, CASE WHEN NEW.mtime < mtime THEN RAISE(IGNORE) END "
+           "FROM timelog_removed WHERE uuid=NEW.uuid; END;"
+        << "CREATE TRIGGER IF NOT EXISTS insert_timelog_removed AFTER INSERT ON timelog_removed "
+           "BEGIN DELETE FROM timelog WHERE uuid=NEW.uuid; INSERT OR REPLACE INTO hashes (start, "
+           "hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); END;"
+        << "CREATE TRIGGER IF NOT EXISTS check_insert_categories BEFORE INSERT ON categories BEGIN "
+           "SELECT mtime, CASE WHEN NEW.mtime < mtime THEN RAISE(IGNORE) END FROM categories_removed "
+           "WHERE uuid=NEW.uuid; END;"
+        << "CREATE TRIGGER IF NOT EXISTS insert_categories AFTER INSERT ON categories BEGIN DELETE "
+           "FROM categories_removed WHERE uuid=NEW.uuid; INSERT OR REPLACE INTO hashes (start, hash) "
+           "VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of month'), NULL); END;"
+        << "CREATE TRIGGER IF NOT EXISTS check_update_categories BEFORE UPDATE ON categories BEGIN "
+           "SELECT CASE WHEN NEW.mtime < OLD.mtime THEN RAISE(IGNORE) END; END;"
+        << "CREATE TRIGGER IF NOT EXISTS update_categories AFTER UPDATE ON categories BEGIN INSERT "
+           "OR REPLACE INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', "
+           "'start of month'), NULL); END;"
+        << "CREATE TRIGGER IF NOT EXISTS check_insert_categories_removed BEFORE INSERT ON "
+           "categories_removed BEGIN SELECT mtime, CASE WHEN NEW.mtime < mtime THEN RAISE(IGNORE) "
+           "END FROM categories_removed WHERE uuid=NEW.uuid; END;"
+        << "CREATE TRIGGER IF NOT EXISTS insert_categories_removed AFTER INSERT ON "
+           "categories_removed BEGIN DELETE FROM categories WHERE uuid=NEW.uuid; INSERT OR REPLACE "
+           "INTO hashes (start, hash) VALUES(strftime('%s', NEW.mtime/1000, 'unixepoch', 'start of "
+           "month'), NULL); END;";
+
+    const QString connectionName("schemaUpgrade");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        for (const QString &queryString: schema) {
+            QVERIFY(query.exec(queryString));
+        }
+
+        // Durations are set by the triggers of that version
+        QVERIFY(query.prepare("INSERT INTO timelog (uuid, start, category, comment, mtime) VALUES (?, ?, ?, ?, ?);"));
+        for (const TimeLogSyncDataEntry &item: origSyncEntries) {
+            query.addBindValue(item.entry.uuid.toRfc4122());
+            query.addBindValue(item.entry.startTime.toTime_t());
+            query.addBindValue(item.entry.category);
+            query.addBindValue(item.entry.comment);
+            query.addBindValue(item.sync.mTime.toMSecsSinceEpoch());
+            QVERIFY(query.exec());
+        }
+
+        QVERIFY(query.prepare("INSERT INTO timelog_removed (uuid, mtime) VALUES (?, ?);"));
+        query.addBindValue(removedEntry.entry.uuid.toRfc4122());
+        query.addBindValue(removedEntry.sync.mTime.toMSecsSinceEpoch());
+        QVERIFY(query.exec());
+
+        QVERIFY(query.prepare("INSERT INTO categories (uuid, category, data, mtime) VALUES (?, ?, ?, ?);"));
+        for (const TimeLogSyncDataCategory &item: origSyncCategories) {
+            query.addBindValue(item.category.uuid.toRfc4122());
+            query.addBindValue(item.category.name);
+            query.addBindValue(QJsonDocument(QJsonObject::fromVariantMap(item.category.data)).toJson());
+            query.addBindValue(item.sync.mTime.toMSecsSinceEpoch());
+            QVERIFY(query.exec());
+        }
+
+        QVERIFY(query.exec("PRAGMA user_version = 1;"));
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    QVERIFY(history->init(dataDir->path()));
+
+    updateDataSet(origSyncEntries, removedEntry);
+    checkFunction(checkDB, history, origData);
+    checkFunction(checkDB, history, origCategories);
+    checkFunction(checkDB, history, origSyncEntries, origSyncCategories);
+    // Hashes are rebuilt by the upgrade, so they are right without the update
+    checkFunction(checkHashes, history, true);
+
+    history->deinit();
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+
+        QVERIFY(query.exec("PRAGMA user_version;"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 11);
+
+        QVERIFY(query.exec("SELECT name FROM sqlite_master WHERE name='hashes';"));
+        QVERIFY(!query.next());
+
+        QVERIFY(query.exec("SELECT start, preceding FROM timelog ORDER BY start ASC;"));
+        qint64 preceding = 0;
+        for (const TimeLogEntry &entry: origData) {
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toLongLong(), static_cast<qint64>(entry.startTime.toTime_t()));
+            QCOMPARE(query.value(1).toLongLong(), preceding);
+            preceding = entry.startTime.toTime_t();
+        }
+        QVERIFY(!query.next());
+
+        // Entries view resolves the interned names
+        QVERIFY(query.exec("SELECT uuid, category FROM timelog_entries ORDER BY start ASC;"));
+        QMap<QString, qlonglong> origCounts;
+        for (const TimeLogEntry &entry: origData) {
+            QVERIFY(query.next());
+            QCOMPARE(QUuid::fromRfc4122(query.value(0).toByteArray()), entry.uuid);
+            QCOMPARE(query.value(1).toString(), entry.category);
+            origCounts[entry.category]++;
+        }
+        QVERIFY(!query.next());
+
+        QVERIFY(query.exec("SELECT category, count FROM category_counts"
+                           " JOIN category_names ON category_names.id=category_counts.category_id"
+                           " WHERE count > 0;"));
+        QMap<QString, qlonglong> counts;
+        while (query.next()) {
+            counts.insert(query.value(0).toString(), query.value(1).toLongLong());
+        }
+        QCOMPARE(counts, origCounts);
+
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    QVERIFY(history->init(dataDir->path()));
+}
+
+void tst_DB::packOpen()
+{
+    QVector<TimeLogEntry> origEntries(defaultEntries());
+    QVector<TimeLogCategory> origCategories(defaultCategories());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(origCategories, defaultMTimes()));
+
+    checkFunction(importSyncData, history, origSyncEntries, origSyncCategories, 1);
+
+    QMap<QDateTime, QByteArray> hashes;
+    checkFunction(extractHashes, history, hashes, false);
+
+    // Pack shares the worker thread of the history, categories are not loaded
+    TimeLogHistory pack(history);
+    QVERIFY(pack.initPack(dataDir->path(), "timelog/db.sqlite"));
+    QVERIFY(!pack.categories());
+    QCOMPARE(pack.size(), qlonglong(0));
+
+    checkFunction(checkDB, &pack, origSyncEntries, origSyncCategories);
+
+    QMap<QDateTime, QByteArray> packHashes;
+    checkFunction(extractHashes, &pack, packHashes, true);
+    QCOMPARE(packHashes, hashes);
+
+    // Shared worker thread is not the caller's one, so the pack writer replies
+    QVariantMap report;
+    checkFunction(extractDiagnostics, &pack, report);
+    QVERIFY(report.value("history").toMap().value("writer").toMap().value("initialized").toBool());
+
+    pack.deinit();
+}
+
+void tst_DB::maintenance()
+{
+    QVector<TimeLogEntry> origData(genData(2000));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy progressSpy(history, SIGNAL(maintenanceProgress(int,int)));
+    QSignalSpy finishSpy(history, SIGNAL(maintenanceFinished(bool)));
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    // Removed entries and then their purged tombstones leave the free pages
+    QVector<TimeLogEntry> removedData(origData.mid(0, 1500));
+    QVector<TimeLogEntry> remainingData(origData.mid(1500));
+    QSignalSpy batchRemoveSpy(history, SIGNAL(dataBatchRemoved(QVector<TimeLogEntry>)));
+    history->removeBatch(removedData);
+    QVERIFY(batchRemoveSpy.wait());
+    QSignalSpy purgeSpy(history, SIGNAL(removedPurged(QDateTime)));
+    history->purgeRemoved(QDateTime::currentDateTimeUtc().addSecs(1));
+    QVERIFY(purgeSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVariantMap report;
+    checkFunction(extractDiagnostics, history, report);
+    QVariantMap db(report.value("history").toMap().value("writer").toMap().value("db").toMap());
+    QCOMPARE(db.value("auto_vacuum").toLongLong(), qlonglong(2));
+    QVERIFY(db.value("freelist_count").toLongLong() > 0);
+
+    history->maintain();
+    QVERIFY(finishSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(finishSpy.constFirst().at(0).toBool());
+    QVERIFY(progressSpy.size() > 1);
+    QCOMPARE(progressSpy.constFirst().at(0).toInt(), 0);
+    QCOMPARE(progressSpy.constLast().at(0).toInt() + 1, progressSpy.constLast().at(1).toInt());
+
+    checkFunction(extractDiagnostics, history, report);
+    db = report.value("history").toMap().value("writer").toMap().value("db").toMap();
+    QCOMPARE(db.value("freelist_count").toLongLong(), qlonglong(0));
+
+    checkFunction(checkDB, history, remainingData);
+    checkFunction(checkHashes, history, false);
+}
+
+void tst_DB::maintenanceVacuumUpgrade()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(origData);
+    QVERIFY(importSpy.wait());
+
+    history->deinit();
+    delete history;
+    history = Q_NULLPTR;
+
+    // DB, created before the incremental vacuum
+    const QString connectionName("maintenanceVacuumUpgrade");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(QString("%1/timelog/db.sqlite").arg(dataDir->path()));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("PRAGMA auto_vacuum = NONE;"));
+        QVERIFY(query.exec("VACUUM;"));
+        QVERIFY(query.exec("PRAGMA auto_vacuum;"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+        query.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    history = new TimeLogHistory;
+    QVERIFY(history->init(dataDir->path()));
+
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy progressSpy(history, SIGNAL(maintenanceProgress(int,int)));
+    QSignalSpy finishSpy(history, SIGNAL(maintenanceFinished(bool)));
+    history->maintain();
+    QVERIFY(finishSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+    QVERIFY(finishSpy.constFirst().at(0).toBool());
+    // Full vacuum is reported with the unknown progress
+    QVERIFY(progressSpy.size() > 1);
+    QCOMPARE(progressSpy.at(1).at(0).toInt(), 0);
+    QCOMPARE(progressSpy.at(1).at(1).toInt(), 0);
+
+    QVariantMap report;
+    checkFunction(extractDiagnostics, history, report);
+    QVariantMap db(report.value("history").toMap().value("writer").toMap().value("db").toMap());
+    QCOMPARE(db.value("auto_vacuum").toLongLong(), qlonglong(2));
+
+    checkFunction(checkDB, history, origData);
+    checkFunction(checkHashes, history, false);
+}
+
 QTEST_MAIN(tst_DB)
 #include "tst_db.moc"
@@ -1,7 +1,7 @@
 CONFIG += testcase
 CONFIG += parallel_test
 TARGET = tst_db_syncer
-QT += testlib quick sql
+QT += testlib quick sql network
 SOURCES  += tst_db_syncer.cpp
 
 # timetracker lib
@@ -22,6 +22,7 @@
 
 #include "tst_common.h"
 #include "DBSyncer.h"
+#include "TimeLogHistoryClient.h"
 #include "TimeLogCategoryTreeNode.h"
 
 QTemporaryDir *dataDir1 = nullptr;
@@ -49,6 +50,10 @@ private slots:
     void updateHashes_data();
     void bothChange();
     void bothChange_data();
+    void pipelined();
+    void pipelined_data();
+    void concurrentClients();
+    void stalePeer();
 };
 
 tst_DBSyncer::tst_DBSyncer()
@@ -264,7 +269,7 @@ void tst_DBSyncer::updateHashes()
     QVERIFY(historyErrorSpy2.isEmpty());
     QVERIFY(historyOutdateSpy2.isEmpty());
 
-    checkFunction(checkHashesUpdated, history2, updateHashes);
+    checkFunction(checkHashesUpdated, history2, true);
 
     checkFunction(checkDB, history1, origEntries);
     checkFunction(checkDB, history1, origCategories);
@@ -574,6 +579,117 @@ void tst_DBSyncer::bothChange_data()
     addRemoveTests(6, 0, QDateTime(QDate(2016, 01, 10), QTime(), Qt::UTC));
 }
 
+void tst_DBSyncer::pipelined()
+{
+    dbSyncer->setPrefetchDepth(3);
+
+    bothChange();
+}
+
+void tst_DBSyncer::pipelined_data()
+{
+    bothChange_data();
+}
+
+void tst_DBSyncer::concurrentClients()
+{
+    QVector<TimeLogEntry> origEntries(defaultEntries());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+
+    checkFunction(importSyncData, history1, origSyncEntries, QVector<TimeLogSyncDataCategory>(), 1);
+
+    TimeLogHistoryClient client1(history1);
+    TimeLogHistoryClient client2(history1);
+
+    QSignalSpy historyHashesSpy(history1, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)));
+    QSignalSpy clientHashesSpy1(&client1, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)));
+    QSignalSpy clientHashesSpy2(&client2, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)));
+
+    // All the entries are after the max date of the first client
+    client1.getHashes(QDateTime(QDate(2015, 10, 01), QTime(), Qt::UTC));
+    client2.getHashes();
+    QVERIFY(clientHashesSpy1.wait());
+    QVERIFY(clientHashesSpy2.size() || clientHashesSpy2.wait());
+
+    QCOMPARE(clientHashesSpy1.size(), 1);
+    QCOMPARE(clientHashesSpy2.size(), 1);
+    QVERIFY(historyHashesSpy.isEmpty());
+    typedef QMap<QDateTime, QByteArray> Hashes;
+    QVERIFY(clientHashesSpy1.constFirst().at(0).value<Hashes>().isEmpty());
+    QVERIFY(!clientHashesSpy2.constFirst().at(0).value<Hashes>().isEmpty());
+
+    // Syncers on the same history don't take the replies of each other
+    TimeLogHistoryClient sourceClient(history1);
+    TimeLogHistoryClient destinationClient(history2);
+    DBSyncer clientSyncer(&sourceClient, &destinationClient);
+
+    QSignalSpy historySyncedSpy(history2, SIGNAL(dataSynced(QDateTime)));
+    QSignalSpy clientSyncedSpy(&destinationClient, SIGNAL(dataSynced(QDateTime)));
+    QSignalSpy clientSyncSpy(&clientSyncer, SIGNAL(finished(QDateTime)));
+    QSignalSpy syncSpy(dbSyncer, SIGNAL(finished(QDateTime)));
+    QSignalSpy syncErrorSpy(dbSyncer, SIGNAL(error(QString)));
+    QSignalSpy clientSyncErrorSpy(&clientSyncer, SIGNAL(error(QString)));
+    clientSyncer.start(false);
+    dbSyncer->start(false);
+    QVERIFY(clientSyncSpy.wait());
+    QVERIFY(syncSpy.size() || syncSpy.wait());
+    QVERIFY(syncErrorSpy.isEmpty());
+    QVERIFY(clientSyncErrorSpy.isEmpty());
+
+    QCOMPARE(clientSyncedSpy.size(), 1);
+    QCOMPARE(historySyncedSpy.size(), 1);
+
+    checkFunction(checkDB, history2, origEntries);
+    checkFunction(checkDB, history2, origSyncEntries, QVector<TimeLogSyncDataCategory>());
+}
+
+void tst_DBSyncer::stalePeer()
+{
+    QVector<TimeLogEntry> origEntries(defaultEntries());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+
+    checkFunction(importSyncData, history1, origSyncEntries, QVector<TimeLogSyncDataCategory>(), 1);
+    checkFunction(importSyncData, history2, origSyncEntries, QVector<TimeLogSyncDataCategory>(), 1);
+
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+
+    // Entry is removed on the second device, while the first one is offline, and its tombstone is purged later
+    QDateTime removeMTime(defaultMTimes().constLast().addSecs(1));
+    TimeLogSyncDataEntry removedEntry(TimeLogEntry(origEntries.at(2).uuid), removeMTime);
+    checkFunction(importSyncData, history2, QVector<TimeLogSyncDataEntry>() << removedEntry,
+                  QVector<TimeLogSyncDataCategory>(), 1);
+
+    QDateTime horizon(removeMTime.addDays(1));
+    QSignalSpy purgeSpy(history2, SIGNAL(removedPurged(QDateTime)));
+    history2->purgeRemoved(horizon);
+    QVERIFY(purgeSpy.wait());
+
+    // First device comes back with the old copy of the entry and a new one
+    TimeLogEntry newEntry(QUuid::createUuid(),
+                          TimeLogData(origEntries.constLast().startTime.addSecs(1000),
+                                      origEntries.constFirst().category, ""));
+    TimeLogSyncDataEntry newSyncEntry(newEntry, horizon.addSecs(1));
+    checkFunction(importSyncData, history1, QVector<TimeLogSyncDataEntry>() << newSyncEntry,
+                  QVector<TimeLogSyncDataCategory>(), 1);
+
+    QSignalSpy syncSpy(dbSyncer, SIGNAL(finished(QDateTime)));
+    QSignalSpy syncErrorSpy(dbSyncer, SIGNAL(error(QString)));
+    dbSyncer->start(false);
+    QVERIFY(syncSpy.wait());
+    QVERIFY(syncErrorSpy.isEmpty());
+    QVERIFY(historyErrorSpy1.isEmpty());
+    QVERIFY(historyErrorSpy2.isEmpty());
+
+    // Removed entry is not resurrected, the new one is accepted
+    origEntries.remove(2);
+    updateDataSet(origEntries, newEntry);
+    origSyncEntries.remove(2);
+    updateDataSet(origSyncEntries, newSyncEntry);
+    checkFunction(checkDB, history2, origEntries);
+    checkFunction(checkDB, history2, origSyncEntries, QVector<TimeLogSyncDataCategory>());
+}
+
 QTEST_MAIN(tst_DBSyncer)
 
 #include "tst_db_syncer.moc"
@@ -0,0 +1,492 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QtTest/QtTest>
+
+#include "tst_common.h"
+#include "TimeLogCategoryTreeNode.h"
+#include "TimeLogStatsModel.h"
+#include "TimeLogRecentModel.h"
+#include "TimeLogSearchModel.h"
+
+QTemporaryDir *dataDir = Q_NULLPTR;
+TimeLogHistory *history = Q_NULLPTR;
+
+// Models get the history from the TimeTracker, which is not needed here
+void setModelHistory(QAbstractItemModel *model, TimeLogHistory *history)
+{
+    QVERIFY(QMetaObject::invokeMethod(model, "setHistory", Q_ARG(TimeLogHistory*, history)));
+}
+
+class RecentModel : public TimeLogRecentModel
+{
+public:
+    void setHistory(TimeLogHistory *history) { TimeLogRecentModel::setHistory(history); }
+    bool isPending() const { return !m_pendingRequests.isEmpty(); }
+};
+
+class SearchModel : public TimeLogSearchModel
+{
+public:
+    void setHistory(TimeLogHistory *history) { TimeLogSearchModel::setHistory(history); }
+    bool isPending() const { return !m_pendingRequests.isEmpty(); }
+};
+
+// Several days of entries, the range of the models excludes the running one
+QVector<TimeLogEntry> genModelData()
+{
+    QStringList categories;
+    categories << "Work" << "Work > Meetings" << "Work > Code > Review" << "Personal" << "Personal > Sport"
+               << "Work > Code";
+
+    QVector<TimeLogEntry> result;
+    QDateTime start(QDate(2016, 3, 10), QTime(20, 0), Qt::UTC);
+    for (int i = 0; i < 30; i++) {
+        QString category(categories.at(i % categories.size()));
+        // Unique categories, to check the removal of the whole row
+        if (i == 8) {
+            category = "Hobby";
+        } else if (i == 9) {
+            category = "Work > Rare";
+        }
+        result.append(TimeLogEntry(QUuid::createUuid(), TimeLogData(start, category, QString("Comment %1").arg(i))));
+        start = start.addSecs(9000 + (i % 5) * 1200);
+    }
+
+    return result;
+}
+
+void checkStatsModel(const TimeLogStatsModel &model, const QDateTime &begin, const QDateTime &end,
+                     const QString &category)
+{
+    QSignalSpy statsSpy(history, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+    history->getStats(begin, end, category);
+    QVERIFY(statsSpy.wait());
+    QVector<TimeLogStats> stats = statsSpy.constFirst().at(0).value<QVector<TimeLogStats> >();
+
+    QCOMPARE(model.rowCount(QModelIndex()), stats.size());
+    for (int i = 0; i < stats.size(); i++) {
+        QModelIndex index = model.index(i, 0);
+        QCOMPARE(model.data(index, TimeLogStatsModel::CategoryRole).toString(), stats.at(i).category);
+        QCOMPARE(model.data(index, TimeLogStatsModel::DurationTimeRole).toLongLong(),
+                 static_cast<qlonglong>(stats.at(i).durationTime));
+    }
+}
+
+// Rows should be the contiguous part of the data
+void checkModelRows(const TimeLogModel &model, const QVector<TimeLogEntry> &data, int offset, int count)
+{
+    QCOMPARE(model.rowCount(QModelIndex()), count);
+    for (int i = 0; i < count; i++) {
+        QModelIndex index = model.index(i, 0);
+        const TimeLogEntry &entry = data.at(offset + i);
+        QCOMPARE(model.data(index, TimeLogModel::StartTimeRole).toDateTime(), entry.startTime);
+        QCOMPARE(model.data(index, TimeLogModel::CategoryRole).toString(), entry.category);
+    }
+}
+
+int findRow(const QVector<TimeLogEntry> &data, const QDateTime &startTime)
+{
+    for (int i = 0; i < data.size(); i++) {
+        if (data.at(i).startTime == startTime) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+QDateTime lastRowStart(const TimeLogModel &model)
+{
+    return model.data(model.index(model.rowCount(QModelIndex()) - 1, 0), TimeLogModel::StartTimeRole).toDateTime();
+}
+
+class tst_Models : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Models();
+    virtual ~tst_Models();
+
+private slots:
+    void init();
+    void cleanup();
+    void initTestCase();
+
+    void statsInsert();
+    void statsInsert_data();
+    void statsEdit();
+    void statsEdit_data();
+    void statsRemove();
+    void statsRemove_data();
+    void recentWindow();
+    void searchRefresh();
+
+private:
+    void importData(const QVector<TimeLogEntry> &data);
+    void loadStatsModel(TimeLogStatsModel &model, const QVector<TimeLogEntry> &data, const QString &category);
+};
+
+tst_Models::tst_Models()
+{
+}
+
+tst_Models::~tst_Models()
+{
+}
+
+void tst_Models::init()
+{
+    dataDir = new QTemporaryDir();
+    Q_CHECK_PTR(dataDir);
+    QVERIFY(dataDir->isValid());
+    history = new TimeLogHistory;
+    Q_CHECK_PTR(history);
+    QVERIFY(history->init(dataDir->path()));
+}
+
+void tst_Models::cleanup()
+{
+    history->deinit();
+    delete history;
+    history = Q_NULLPTR;
+    delete dataDir;
+    dataDir = Q_NULLPTR;
+}
+
+void tst_Models::initTestCase()
+{
+    qRegisterMetaType<QSet<QString> >();
+    qRegisterMetaType<QVector<TimeLogEntry> >();
+    qRegisterMetaType<TimeLogHistory::Fields>();
+    qRegisterMetaType<QVector<TimeLogHistory::Fields> >();
+    qRegisterMetaType<QSharedPointer<TimeLogCategoryTreeNode> >();
+    qRegisterMetaType<QVector<TimeLogStats> >();
+    qRegisterMetaType<TimeLogHistory*>();
+
+    qSetMessagePattern("[%{time}] <%{category}> %{type} (%{file}:%{line}, %{function}) %{message}");
+}
+
+void tst_Models::statsInsert()
+{
+    QFETCH(QString, category);
+    QFETCH(QString, newCategory);
+
+    QVector<TimeLogEntry> origData(genModelData());
+    TimeLogStatsModel model;
+    loadStatsModel(model, origData, category);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy rowsInsertSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy changeSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)));
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    QSignalSpy insertSpy(history, SIGNAL(dataInserted(TimeLogEntry)));
+
+    // New group and the shorter previous entry
+    TimeLogEntry entry(QUuid::createUuid(), TimeLogData(origData.at(11).startTime.addSecs(600), newCategory, ""));
+    history->insert(entry);
+    QVERIFY(insertSpy.wait());
+    QVERIFY(!updateSpy.isEmpty() || updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(rowsInsertSpy.size(), 1);
+    QVERIFY(!changeSpy.isEmpty());
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+}
+
+void tst_Models::statsInsert_data()
+{
+    QTest::addColumn<QString>("category");
+    QTest::addColumn<QString>("newCategory");
+
+    QTest::newRow("all") << QString() << QString("Study > Books");
+    QTest::newRow("category") << QString("Work") << QString("Work > Design > Sketches");
+}
+
+void tst_Models::statsEdit()
+{
+    QFETCH(QString, category);
+    QFETCH(QString, newCategory);
+
+    QVector<TimeLogEntry> origData(genModelData());
+    TimeLogStatsModel model;
+    loadStatsModel(model, origData, category);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy rowsInsertSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+
+    // Contribution moves to the new group
+    TimeLogEntry entry(origData.at(13));
+    entry.category = newCategory;
+    history->edit(entry, TimeLogHistory::Category);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(rowsInsertSpy.size(), 1);
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+
+    // Durations of the entry and the previous one are changed
+    updateSpy.clear();
+    entry = origData.at(16);
+    entry.startTime = entry.startTime.addSecs(-1800);
+    history->edit(entry, TimeLogHistory::StartTime);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+
+    // Entry leaves the range
+    updateSpy.clear();
+    entry = origData.at(24);
+    entry.startTime = origData.at(25).startTime.addSecs(60);
+    history->edit(entry, TimeLogHistory::StartTime);
+    QVERIFY(updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+}
+
+void tst_Models::statsEdit_data()
+{
+    QTest::addColumn<QString>("category");
+    QTest::addColumn<QString>("newCategory");
+
+    QTest::newRow("all") << QString() << QString("Study > Books");
+    QTest::newRow("category") << QString("Work") << QString("Work > Design > Sketches");
+}
+
+void tst_Models::statsRemove()
+{
+    QFETCH(QString, category);
+    QFETCH(int, index);
+
+    QVector<TimeLogEntry> origData(genModelData());
+    TimeLogStatsModel model;
+    loadStatsModel(model, origData, category);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy rowsRemoveSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy updateSpy(history, SIGNAL(dataUpdated(QVector<TimeLogEntry>,QVector<TimeLogHistory::Fields>)));
+    QSignalSpy removeSpy(history, SIGNAL(dataRemoved(TimeLogEntry)));
+
+    // Last entry of the group removes the row, the previous entry takes its duration
+    history->remove(origData.at(index));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(!updateSpy.isEmpty() || updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(rowsRemoveSpy.size(), 1);
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+
+    // Regular entry only changes the durations
+    updateSpy.clear();
+    removeSpy.clear();
+    history->remove(origData.at(index + 5));
+    QVERIFY(removeSpy.wait());
+    QVERIFY(!updateSpy.isEmpty() || updateSpy.wait());
+    QVERIFY(errorSpy.isEmpty());
+
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(rowsRemoveSpy.size(), 1);
+    checkFunction(checkStatsModel, model, origData.at(2).startTime, origData.at(25).startTime, category);
+}
+
+void tst_Models::statsRemove_data()
+{
+    QTest::addColumn<QString>("category");
+    QTest::addColumn<int>("index");
+
+    QTest::newRow("all") << QString() << 8;
+    QTest::newRow("category") << QString("Work") << 9;
+}
+
+void tst_Models::recentWindow()
+{
+    // Rows are kept in the window of this size
+    const int windowSize = 500;
+
+    QVector<TimeLogEntry> origData(genData(1200));
+    checkFunction(importData, origData);
+
+    RecentModel model;
+    model.setHistory(history);
+
+    // Scroll to the oldest entries, the view accesses the top rows before fetching more
+    int offset = origData.size();
+    while (model.canFetchMore(QModelIndex())) {
+        if (model.rowCount(QModelIndex())) {
+            model.data(model.index(0, 0), TimeLogModel::StartTimeRole);
+        }
+        model.fetchMore(QModelIndex());
+        QTRY_VERIFY(!model.isPending());
+
+        int count = model.rowCount(QModelIndex());
+        QVERIFY(count > 0 && count <= windowSize);
+        offset = findRow(origData, model.data(model.index(0, 0), TimeLogModel::StartTimeRole).toDateTime());
+        QVERIFY(offset != -1);
+        checkFunction(checkModelRows, model, origData, offset, count);
+    }
+    QCOMPARE(offset, 0);
+    // Newest entries are evicted
+    checkFunction(checkModelRows, model, origData, 0, windowSize);
+
+    // Scroll back to the newest entries, access to the bottom rows fetches the newer ones
+    QDateTime lastStart(lastRowStart(model));
+    while (lastStart != origData.constLast().startTime) {
+        QTRY_VERIFY(!model.isPending() && lastRowStart(model) != lastStart);
+
+        int count = model.rowCount(QModelIndex());
+        QCOMPARE(count, windowSize);
+        offset = findRow(origData, model.data(model.index(0, 0), TimeLogModel::StartTimeRole).toDateTime());
+        QVERIFY(offset != -1);
+        checkFunction(checkModelRows, model, origData, offset, count);
+        lastStart = lastRowStart(model);
+    }
+    // Oldest entries are evicted
+    checkFunction(checkModelRows, model, origData, origData.size() - windowSize, windowSize);
+}
+
+void tst_Models::searchRefresh()
+{
+    QVector<TimeLogEntry> origData(genData(2000));
+    checkFunction(importData, origData);
+
+    SearchModel model;
+    model.setHistory(history);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    QSignalSpy partialSpy(history, SIGNAL(historyRequestPartial(QVector<TimeLogEntry>,qlonglong)));
+
+    // Fetched entries of the requests, made by the model
+    auto fetchedCount = [&dataSpy, &partialSpy]() {
+        int result = 0;
+        for (const QList<QVariant> &arguments: dataSpy) {
+            result += arguments.at(0).value<QVector<TimeLogEntry> >().size();
+        }
+        for (const QList<QVariant> &arguments: partialSpy) {
+            result += arguments.at(0).value<QVector<TimeLogEntry> >().size();
+        }
+        return result;
+    };
+
+    // Changes of the range are applied once, on the next event loop iteration
+    model.setProperty("begin", origData.at(500).startTime);
+    model.setProperty("end", origData.at(1000).startTime);
+    QCoreApplication::processEvents();
+    QTRY_VERIFY(!model.isPending());
+    QCOMPARE(resetSpy.size(), 1);
+    QCOMPARE(dataSpy.size(), 1);
+    checkFunction(checkModelRows, model, origData, 500, 501);
+
+    // Narrowed range only trims the rows
+    resetSpy.clear();
+    dataSpy.clear();
+    partialSpy.clear();
+    model.setProperty("begin", origData.at(600).startTime);
+    model.setProperty("end", origData.at(900).startTime);
+    QCoreApplication::processEvents();
+    QVERIFY(!model.isPending());
+    QVERIFY(resetSpy.isEmpty());
+    QVERIFY(dataSpy.isEmpty());
+    checkFunction(checkModelRows, model, origData, 600, 301);
+
+    // Extended range fetches only the new parts
+    model.setProperty("begin", origData.at(400).startTime);
+    model.setProperty("end", origData.at(1100).startTime);
+    QCoreApplication::processEvents();
+    QTRY_VERIFY(!model.isPending());
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(dataSpy.size(), 2);
+    QCOMPARE(fetchedCount(), 400);
+    checkFunction(checkModelRows, model, origData, 400, 701);
+
+    // Shifted range trims one side and extends the other
+    dataSpy.clear();
+    partialSpy.clear();
+    model.setProperty("begin", origData.at(1000).startTime);
+    model.setProperty("end", origData.at(1500).startTime);
+    QCoreApplication::processEvents();
+    QTRY_VERIFY(!model.isPending());
+    QVERIFY(resetSpy.isEmpty());
+    QCOMPARE(dataSpy.size(), 1);
+    QCOMPARE(fetchedCount(), 400);
+    checkFunction(checkModelRows, model, origData, 1000, 501);
+
+    // Disjoint range is reloaded
+    dataSpy.clear();
+    partialSpy.clear();
+    model.setProperty("begin", origData.at(1700).startTime);
+    model.setProperty("end", origData.at(1800).startTime);
+    QCoreApplication::processEvents();
+    QTRY_VERIFY(!model.isPending());
+    QCOMPARE(resetSpy.size(), 1);
+    QCOMPARE(fetchedCount(), 101);
+    checkFunction(checkModelRows, model, origData, 1700, 101);
+
+    // Other filter is reloaded, even with the same range
+    resetSpy.clear();
+    model.setProperty("category", origData.at(1750).category);
+    model.setProperty("withSubcategories", true);
+    QCoreApplication::processEvents();
+    QTRY_VERIFY(!model.isPending());
+    QCOMPARE(resetSpy.size(), 1);
+    QVector<TimeLogEntry> categoryData;
+    for (int i = 1700; i <= 1800; i++) {
+        if (origData.at(i).category.startsWith(origData.at(1750).category)) {
+            categoryData.append(origData.at(i));
+        }
+    }
+    checkFunction(checkModelRows, model, categoryData, 0, categoryData.size());
+}
+
+void tst_Models::importData(const QVector<TimeLogEntry> &data)
+{
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(data);
+    QVERIFY(importSpy.wait());
+}
+
+void tst_Models::loadStatsModel(TimeLogStatsModel &model, const QVector<TimeLogEntry> &data,
+                                const QString &category)
+{
+    checkFunction(importData, data);
+
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+    checkFunction(setModelHistory, &model, history);
+    model.setProperty("begin", data.at(2).startTime);
+    model.setProperty("end", data.at(25).startTime);
+    model.setProperty("category", category);
+    QVERIFY(dataSpy.wait());
+    QVERIFY(model.rowCount(QModelIndex()) > 0);
+
+    checkFunction(checkStatsModel, model, data.at(2).startTime, data.at(25).startTime, category);
+}
+
+QTEST_MAIN(tst_Models)
+#include "tst_models.moc"
@@ -0,0 +1,293 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QtTest/QtTest>
+
+#include <QTemporaryDir>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "tst_common.h"
+#include "DBSyncer.h"
+#include "TimeLogRemoteHistory.h"
+#include "TimeLogSyncServer.h"
+#include "TimeLogSyncProtocol.h"
+#include "TimeLogCategoryTreeNode.h"
+
+QTemporaryDir *dataDir1 = nullptr;
+QTemporaryDir *dataDir2 = nullptr;
+TimeLogHistory *history1 = nullptr;
+TimeLogHistory *history2 = nullptr;
+TimeLogSyncServer *server = nullptr;
+TimeLogRemoteHistory *remote = nullptr;
+
+class tst_NetworkSync : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_NetworkSync();
+
+private slots:
+    void init();
+    void cleanup();
+    void initTestCase();
+    void cleanupTestCase();
+
+    void push();
+    void push_data();
+    void pull();
+    void pull_data();
+    void wrongToken();
+    void emptyToken();
+    void fakePeer();
+    void oversizedHello();
+};
+
+tst_NetworkSync::tst_NetworkSync()
+{
+}
+
+void tst_NetworkSync::init()
+{
+    dataDir1 = new QTemporaryDir();
+    Q_CHECK_PTR(dataDir1);
+    QVERIFY(dataDir1->isValid());
+    history1 = new TimeLogHistory;
+    Q_CHECK_PTR(history1);
+    QVERIFY(history1->init(dataDir1->path()));
+
+    dataDir2 = new QTemporaryDir();
+    Q_CHECK_PTR(dataDir2);
+    QVERIFY(dataDir2->isValid());
+    history2 = new TimeLogHistory;
+    Q_CHECK_PTR(history2);
+    QVERIFY(history2->init(dataDir2->path()));
+
+    server = new TimeLogSyncServer(history2);
+    Q_CHECK_PTR(server);
+    server->setToken("token");
+    QVERIFY(server->listen(0, QHostAddress::LocalHost));
+
+    remote = new TimeLogRemoteHistory;
+    Q_CHECK_PTR(remote);
+    remote->setToken("token");
+}
+
+void tst_NetworkSync::cleanup()
+{
+    delete remote;
+    remote = nullptr;
+
+    delete server;
+    server = nullptr;
+
+    history1->deinit();
+    delete history1;
+    history1 = nullptr;
+    delete dataDir1;
+    dataDir1 = nullptr;
+
+    history2->deinit();
+    delete history2;
+    history2 = nullptr;
+    delete dataDir2;
+    dataDir2 = nullptr;
+}
+
+void tst_NetworkSync::initTestCase()
+{
+    qRegisterMetaType<QSet<QString> >();
+    qRegisterMetaType<QVector<TimeLogEntry> >();
+    qRegisterMetaType<TimeLogHistory::Fields>();
+    qRegisterMetaType<QVector<TimeLogHistory::Fields> >();
+    qRegisterMetaType<QVector<TimeLogSyncDataEntry> >();
+    qRegisterMetaType<QVector<TimeLogSyncDataCategory> >();
+    qRegisterMetaType<QSharedPointer<TimeLogCategoryTreeNode> >();
+    qRegisterMetaType<QMap<QDateTime,QByteArray> >();
+
+    qSetMessagePattern("[%{time}] <%{category}> %{type} (%{file}:%{line}, %{function}) %{message}");
+}
+
+void tst_NetworkSync::cleanupTestCase()
+{
+}
+
+void tst_NetworkSync::push()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(int, categoriesCount);
+
+    QVector<TimeLogEntry> origEntries(defaultEntries().mid(0, entriesCount));
+    QVector<TimeLogCategory> origCategories(defaultCategories().mid(0, categoriesCount));
+
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(origCategories, defaultMTimes()));
+
+    checkFunction(importSyncData, history1, origSyncEntries, origSyncCategories, entriesCount + categoriesCount);
+
+    QSignalSpy connectedSpy(remote, SIGNAL(connected()));
+    QSignalSpy remoteErrorSpy(remote, SIGNAL(error(QString)));
+    remote->connectToPeer("127.0.0.1", server->serverPort());
+    QVERIFY(connectedSpy.wait());
+
+    DBSyncer dbSyncer(history1, remote);
+    dbSyncer.setPrefetchDepth(4);
+    QSignalSpy syncSpy(&dbSyncer, SIGNAL(finished(QDateTime)));
+    QSignalSpy syncErrorSpy(&dbSyncer, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+
+    dbSyncer.start(false);
+    QVERIFY(syncSpy.wait());
+    QVERIFY(syncErrorSpy.isEmpty());
+    QVERIFY(remoteErrorSpy.isEmpty());
+    QVERIFY(historyErrorSpy2.isEmpty());
+
+    checkFunction(checkDB, history2, origEntries);
+    checkFunction(checkDB, history2, origCategories);
+    checkFunction(checkDB, history2, origSyncEntries, origSyncCategories);
+}
+
+void tst_NetworkSync::push_data()
+{
+    QTest::addColumn<int>("entriesCount");
+    QTest::addColumn<int>("categoriesCount");
+
+    QTest::newRow("1 entry") << 1 << 0;
+    QTest::newRow("6 entries") << 6 << 0;
+    QTest::newRow("6 categories") << 0 << 6;
+    QTest::newRow("6 entries, 6 categories") << 6 << 6;
+}
+
+void tst_NetworkSync::pull()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(int, categoriesCount);
+
+    QVector<TimeLogEntry> origEntries(defaultEntries().mid(0, entriesCount));
+    QVector<TimeLogCategory> origCategories(defaultCategories().mid(0, categoriesCount));
+
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+    QVector<TimeLogSyncDataCategory> origSyncCategories(genSyncData(origCategories, defaultMTimes()));
+
+    checkFunction(importSyncData, history2, origSyncEntries, origSyncCategories, entriesCount + categoriesCount);
+
+    QSignalSpy connectedSpy(remote, SIGNAL(connected()));
+    QSignalSpy remoteErrorSpy(remote, SIGNAL(error(QString)));
+    remote->connectToPeer("127.0.0.1", server->serverPort());
+    QVERIFY(connectedSpy.wait());
+
+    DBSyncer dbSyncer(remote, history1);
+    QSignalSpy syncSpy(&dbSyncer, SIGNAL(finished(QDateTime)));
+    QSignalSpy syncErrorSpy(&dbSyncer, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+
+    dbSyncer.start(false);
+    QVERIFY(syncSpy.wait());
+    QVERIFY(syncErrorSpy.isEmpty());
+    QVERIFY(remoteErrorSpy.isEmpty());
+    QVERIFY(historyErrorSpy1.isEmpty());
+
+    checkFunction(checkDB, history1, origEntries);
+    checkFunction(checkDB, history1, origCategories);
+    checkFunction(checkDB, history1, origSyncEntries, origSyncCategories);
+}
+
+void tst_NetworkSync::pull_data()
+{
+    push_data();
+}
+
+void tst_NetworkSync::wrongToken()
+{
+    remote->setToken("wrong");
+
+    QSignalSpy connectedSpy(remote, SIGNAL(connected()));
+    QSignalSpy remoteErrorSpy(remote, SIGNAL(error(QString)));
+    remote->connectToPeer("127.0.0.1", server->serverPort());
+    QVERIFY(remoteErrorSpy.wait());
+    QVERIFY(connectedSpy.isEmpty());
+    QVERIFY(!remote->isConnected());
+}
+
+void tst_NetworkSync::emptyToken()
+{
+    TimeLogSyncServer openServer(history2);
+    QVERIFY(!openServer.listen(0, QHostAddress::LocalHost));
+}
+
+void tst_NetworkSync::fakePeer()
+{
+    QTcpServer fakeServer;
+    QVERIFY(fakeServer.listen(QHostAddress::LocalHost));
+
+    QSignalSpy connectedSpy(remote, SIGNAL(connected()));
+    QSignalSpy remoteErrorSpy(remote, SIGNAL(error(QString)));
+    QSignalSpy newConnectionSpy(&fakeServer, SIGNAL(newConnection()));
+    remote->connectToPeer("127.0.0.1", fakeServer.serverPort());
+    QVERIFY(newConnectionSpy.wait());
+    QTcpSocket *peer = fakeServer.nextPendingConnection();
+    QVERIFY(peer);
+
+    QSignalSpy readyReadSpy(peer, SIGNAL(readyRead()));
+    QByteArray hello;
+    QDataStream helloStream(&hello, QIODevice::WriteOnly);
+    helloStream.setVersion(TimeLogSyncProtocol::streamVersion);
+    helloStream << TimeLogSyncProtocol::version << TimeLogSyncProtocol::nonce();
+    peer->write(TimeLogSyncProtocol::message(TimeLogSyncProtocol::HelloMessage, hello));
+
+    // Peer without the token only gets the proof, bound to its nonce
+    QVERIFY(readyReadSpy.wait());
+    QByteArray clientHello(peer->readAll());
+    QByteArray tokenData;
+    QDataStream tokenStream(&tokenData, QIODevice::WriteOnly);
+    tokenStream.setVersion(TimeLogSyncProtocol::streamVersion);
+    tokenStream << QString("token");
+    QVERIFY(!clientHello.contains(tokenData));
+    QVERIFY(!clientHello.contains(QByteArray("token")));
+
+    QByteArray reply;
+    QDataStream replyStream(&reply, QIODevice::WriteOnly);
+    replyStream.setVersion(TimeLogSyncProtocol::streamVersion);
+    replyStream << TimeLogSyncProtocol::version << QByteArray(32, 'x');
+    peer->write(TimeLogSyncProtocol::message(TimeLogSyncProtocol::HelloMessage, reply));
+
+    QVERIFY(remoteErrorSpy.wait());
+    QVERIFY(connectedSpy.isEmpty());
+    QVERIFY(!remote->isConnected());
+}
+
+void tst_NetworkSync::oversizedHello()
+{
+    QTcpSocket peer;
+    QSignalSpy disconnectedSpy(&peer, SIGNAL(disconnected()));
+    peer.connectToHost(QHostAddress::LocalHost, server->serverPort());
+    QVERIFY(peer.waitForConnected());
+
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(TimeLogSyncProtocol::maxHelloSize + 1)
+           << static_cast<quint8>(TimeLogSyncProtocol::HelloMessage);
+    peer.write(header);
+
+    QVERIFY(disconnectedSpy.wait());
+}
+
+QTEST_MAIN(tst_NetworkSync)
+
+#include "tst_network_sync.moc"
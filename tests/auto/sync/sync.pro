@@ -1,7 +1,7 @@
 CONFIG += testcase
 CONFIG += parallel_test
 TARGET = tst_sync
-QT += testlib quick sql
+QT += testlib quick sql network
 SOURCES  += tst_sync.cpp
 
 # timetracker lib
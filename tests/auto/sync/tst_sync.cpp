@@ -20,6 +20,12 @@
 
 #include <QTemporaryDir>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
 #include "tst_common.h"
 #include "DataSyncer.h"
 #include "TimeLogCategoryTreeNode.h"
@@ -52,6 +58,32 @@ DataSyncer *syncer1 = Q_NULLPTR;
 DataSyncer *syncer2 = Q_NULLPTR;
 DataSyncer *syncer3 = Q_NULLPTR;
 
+// Format version 1, QDataStream-serialized items, files are ordered by the mtime in the name
+void writeLegacyFile(const QString &dirPath, const QVector<TimeLogSyncDataEntry> &data,
+                     const QDateTime &fileMTime = QDateTime())
+{
+    QByteArray fileData;
+    QDataStream dataStream(&fileData, QIODevice::WriteOnly);
+    dataStream.setVersion(QDataStream::Qt_5_6);
+    dataStream << static_cast<qint32>(1);
+    for (const TimeLogSyncDataEntry &item: data) {
+        dataStream << item;
+    }
+
+    QDateTime nameMTime(fileMTime.isValid() ? fileMTime : data.last().sync.mTime);
+    QString fileName = QString("%1-%2.sync").arg(nameMTime.toMSecsSinceEpoch(), 19, 10, QChar('0'))
+                                            .arg(QUuid::createUuid().toString());
+    QFile file(QDir(dirPath).filePath(fileName));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QDataStream fileStream(&file);
+    fileStream << static_cast<qint32>(QDataStream::Qt_5_6);
+    fileStream.setVersion(QDataStream::Qt_5_6);
+    fileStream << fileData;
+    fileStream << qChecksum(fileData.constData(), fileData.size());
+    QCOMPARE(fileStream.status(), QDataStream::Ok);
+    file.close();
+}
+
 class tst_Sync : public QObject
 {
     Q_OBJECT
@@ -101,6 +133,15 @@ private slots:
     void editOldEdit_data();
     void editOldRemove();
     void editOldRemove_data();
+
+    void legacyFormat();
+    void compressed();
+    void mergedFiles();
+    void staleManifest();
+    void copiedContents();
+    void corruptedChunk();
+    void corruptedFile();
+    void oversizedSummary();
 };
 
 tst_Sync::tst_Sync()
@@ -2755,5 +2796,308 @@ void tst_Sync::editOldRemove_data()
     QTest::newRow("nothing (mtime only)") << index << entry;
 }
 
+void tst_Sync::legacyFormat()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QVector<TimeLogSyncDataEntry> syncData(genSyncData(origData, defaultMTimes()));
+
+    checkFunction(writeLegacyFile, syncDir->path(), syncData);
+
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+    QSignalSpy historyOutdateSpy2(history2, SIGNAL(dataOutdated()));
+
+    syncer2->sync();
+    QVERIFY(syncSpy2.wait());
+    QVERIFY(syncErrorSpy2.isEmpty());
+    QVERIFY(historyErrorSpy2.isEmpty());
+    QVERIFY(historyOutdateSpy2.isEmpty());
+
+    checkFunction(checkDB, history2, origData);
+}
+
+void tst_Sync::compressed()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait());
+
+    syncer1->setCompression(true);
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+    QVERIFY(syncErrorSpy1.isEmpty());
+
+    // Reader does not need compression enabled
+    syncer2->sync();
+    QVERIFY(syncSpy2.wait());
+    QVERIFY(syncErrorSpy2.isEmpty());
+    QVERIFY(historyErrorSpy2.isEmpty());
+
+    checkFunction(checkDB, history2, origData);
+}
+
+void tst_Sync::mergedFiles()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QDateTime mTime(defaultMTimes().constFirst());
+
+    auto edited = [&origData](int index, const QString &comment) {
+        TimeLogEntry entry(origData.at(index));
+        entry.comment = comment;
+        return entry;
+    };
+    auto removed = [&origData](int index) {
+        return TimeLogEntry(origData.at(index).uuid);
+    };
+
+    // Same items are changed in both files, at the equal and the newer mtimes
+    QVector<TimeLogSyncDataEntry> fileData1, fileData2;
+    fileData1.append(TimeLogSyncDataEntry(edited(0, "File 1"), mTime));
+    fileData2.append(TimeLogSyncDataEntry(edited(0, "File 2"), mTime));
+    fileData1.append(TimeLogSyncDataEntry(edited(1, "File 1"), mTime));
+    fileData2.append(TimeLogSyncDataEntry(edited(1, "File 2"), mTime.addSecs(1)));
+    fileData1.append(TimeLogSyncDataEntry(removed(2), mTime));
+    fileData2.append(TimeLogSyncDataEntry(edited(2, "File 2"), mTime));
+    fileData1.append(TimeLogSyncDataEntry(edited(3, "File 1"), mTime));
+    fileData2.append(TimeLogSyncDataEntry(removed(3), mTime));
+    fileData1.append(TimeLogSyncDataEntry(edited(4, "File 1"), mTime));
+    fileData2.append(TimeLogSyncDataEntry(removed(4), mTime.addSecs(1)));
+    fileData2.append(TimeLogSyncDataEntry(edited(5, "File 2"), mTime));
+
+    // First applied file wins on the equal mtime
+    QVector<TimeLogEntry> expectedData;
+    expectedData.append(edited(0, "File 1"));
+    expectedData.append(edited(1, "File 2"));
+    expectedData.append(edited(3, "File 1"));
+    expectedData.append(edited(5, "File 2"));
+
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncSpy3(syncer3, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy3(syncer3, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy3(history3, SIGNAL(error(QString)));
+    QSignalSpy historyOutdateSpy2(history2, SIGNAL(dataOutdated()));
+    QSignalSpy historyOutdateSpy3(history3, SIGNAL(dataOutdated()));
+
+    // Files are applied one by one
+    checkFunction(writeLegacyFile, syncDir->path(), fileData1, mTime.addSecs(10));
+
+    syncer3->sync();
+    QVERIFY(syncSpy3.wait());
+    QVERIFY(syncErrorSpy3.isEmpty());
+
+    checkFunction(writeLegacyFile, syncDir->path(), fileData2, mTime.addSecs(20));
+
+    syncSpy3.clear();
+    syncer3->sync();
+    QVERIFY(syncSpy3.wait());
+    QVERIFY(syncErrorSpy3.isEmpty());
+    QVERIFY(historyErrorSpy3.isEmpty());
+    QVERIFY(historyOutdateSpy3.isEmpty());
+
+    checkFunction(checkDB, history3, expectedData);
+
+    // Both files are merged into the single DB sync
+    syncer2->sync();
+    QVERIFY(syncSpy2.wait());
+    QVERIFY(syncErrorSpy2.isEmpty());
+    QVERIFY(historyErrorSpy2.isEmpty());
+    QVERIFY(historyOutdateSpy2.isEmpty());
+
+    checkFunction(checkDB, history2, expectedData);
+
+    QVector<TimeLogSyncDataEntry> syncEntries;
+    QVector<TimeLogSyncDataCategory> syncCategories;
+    checkFunction(extractSyncData, history3, syncEntries, syncCategories);
+    checkFunction(checkDB, history2, syncEntries, syncCategories);
+}
+
+void tst_Sync::staleManifest()
+{
+#ifdef Q_OS_LINUX
+    QVector<TimeLogEntry> origData(defaultEntries());
+    QVector<TimeLogSyncDataEntry> foreignData(genSyncData(origData, defaultMTimes()).mid(3));
+
+    // Sync folder is old enough for the listing to be trusted
+    QByteArray syncPath(QFile::encodeName(syncDir->path()));
+    struct timespec oldTimes[2] = { { time(Q_NULLPTR) - 60, 0 }, { time(Q_NULLPTR) - 60, 0 } };
+    QCOMPARE(utimensat(AT_FDCWD, syncPath.constData(), oldTimes, 0), 0);
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData.mid(0, 3));
+    QVERIFY(importSpy.wait());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+
+    // Manifest is saved with the sync and loaded by the new syncer
+    delete syncer1;
+    syncer1 = Q_NULLPTR;
+
+    struct stat syncStat;
+    QCOMPARE(stat(syncPath.constData(), &syncStat), 0);
+
+    // Foreign file is added while the device is offline, within the mtime resolution
+    checkFunction(writeLegacyFile, syncDir->path(), foreignData);
+
+    struct timespec syncTimes[2] = { syncStat.st_atim, syncStat.st_mtim };
+    QCOMPARE(utimensat(AT_FDCWD, syncPath.constData(), syncTimes, 0), 0);
+
+    syncer1 = new DataSyncer(history1);
+    Q_CHECK_PTR(syncer1);
+    syncer1->init(dataDir1->path());
+    syncer1->setNoPack(true);
+    syncer1->setAutoSync(false);
+    syncer1->setSyncPath(QUrl::fromLocalFile(syncDir->path()));
+
+    QSignalSpy resyncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    syncer1->sync();
+    QVERIFY(resyncSpy1.wait());
+    QVERIFY(syncErrorSpy1.isEmpty());
+
+    checkFunction(checkDB, history1, origData);
+#else
+    QSKIP("Directory mtime is only set on Linux");
+#endif
+}
+
+void tst_Sync::copiedContents()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait());
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+    QVERIFY(syncErrorSpy1.isEmpty());
+
+    syncer2->sync();
+    QVERIFY(syncSpy2.wait());
+    QVERIFY(syncErrorSpy2.isEmpty());
+
+    // Either the kernel copy or the QFile::copy() fallback must give the same contents on both sides
+    QDir externalDir(syncDir->path());
+    QStringList files(externalDir.entryList(QStringList() << "*.sync", QDir::Files));
+    QVERIFY(!files.isEmpty());
+    for (const QString &fileName: files) {
+        QFile externalFile(externalDir.filePath(fileName));
+        QVERIFY(externalFile.open(QIODevice::ReadOnly));
+        QByteArray externalData(externalFile.readAll());
+        QVERIFY(!externalData.isEmpty());
+
+        for (const QString &dataPath: QStringList() << dataDir1->path() << dataDir2->path()) {
+            QFile internalFile(QDir(dataPath).filePath(QString("sync/%1").arg(fileName)));
+            QVERIFY(internalFile.open(QIODevice::ReadOnly));
+            QCOMPARE(internalFile.readAll(), externalData);
+        }
+    }
+}
+
+void tst_Sync::corruptedChunk()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait());
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+
+    QStringList files(QDir(syncDir->path()).entryList(QStringList() << "*.sync", QDir::Files));
+    QCOMPARE(files.size(), 1);
+    QFile file(QDir(syncDir->path()).filePath(files.constFirst()));
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QByteArray fileData(file.readAll());
+    fileData[fileData.size() / 2] = ~fileData.at(fileData.size() / 2);
+    QVERIFY(file.seek(0));
+    QCOMPARE(file.write(fileData), static_cast<qint64>(fileData.size()));
+    file.close();
+
+    syncer2->sync();
+    QVERIFY(syncErrorSpy2.wait());
+    QCOMPARE(history2->size(), 0);
+}
+
+void tst_Sync::corruptedFile()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait());
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+
+    // Neither the current nor the legacy format, parser task fails
+    QStringList files(QDir(syncDir->path()).entryList(QStringList() << "*.sync", QDir::Files));
+    QCOMPARE(files.size(), 1);
+    QFile file(QDir(syncDir->path()).filePath(files.constFirst()));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE(file.write("corrupted"), 9);
+    file.close();
+
+    syncer2->sync();
+    QVERIFY(syncErrorSpy2.wait());
+    QCOMPARE(syncErrorSpy2.size(), 1);
+    QVERIFY(!syncErrorSpy2.constFirst().at(0).toString().isEmpty());
+    QCOMPARE(history2->size(), 0);
+}
+
+void tst_Sync::oversizedSummary()
+{
+    QVector<TimeLogEntry> origData(defaultEntries());
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait());
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait());
+
+    QStringList files(QDir(syncDir->path()).entryList(QStringList() << "*.sync", QDir::Files));
+    QCOMPARE(files.size(), 1);
+    QFile file(QDir(syncDir->path()).filePath(files.constFirst()));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    // Version 2 with the summary, maximum records and fingerprints counts, but no data for them
+    QByteArray fileData("GTTS\x02\x02");
+    fileData.append(QByteArray::fromHex("ffffffff0f0000ffffffff0f"));
+    QCOMPARE(file.write(fileData), static_cast<qint64>(fileData.size()));
+    file.close();
+
+    syncer2->sync();
+    QVERIFY(syncErrorSpy2.wait());
+    QCOMPARE(history2->size(), 0);
+}
+
 QTEST_MAIN(tst_Sync)
 #include "tst_sync.moc"
@@ -1,7 +1,7 @@
 CONFIG += testcase
 CONFIG += parallel_test
 TARGET = tst_sync_pack
-QT += testlib quick sql
+QT += testlib quick sql network
 SOURCES  += tst_sync_pack.cpp
 
 # timetracker lib
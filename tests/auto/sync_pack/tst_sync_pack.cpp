@@ -62,6 +62,9 @@ const QRegularExpression syncFileNameRegexp(syncFileNamePattern);
 const QString packFileNamePattern = QString("^%1\\.pack$").arg(fileNamePattern);
 const QRegularExpression packFileNameRegexp(packFileNamePattern);
 
+const QString deltaFileNamePattern = QString("^%1\\.delta$").arg(fileNamePattern);
+const QRegularExpression deltaFileNameRegexp(deltaFileNamePattern);
+
 void importSyncData(TimeLogHistory *history, DataSyncer *syncer, QTemporaryDir *syncDir,
                     const QVector<TimeLogSyncDataEntry> &entryData,
                     const QVector<TimeLogSyncDataCategory> &categoryData, int portionSize,
@@ -266,9 +269,13 @@ void checkPackFolder(const QString &path, const QVector<TimeLogSyncDataEntry> &e
     for (const QFileInfo &fileInfo: packList) {
         checkPackHashes(path, fileInfo.fileName());
     }
+    QCOMPARE(packList.size(), packMTime.isValid() ? 1 : 0);
 
-    QCOMPARE(mTimeFileList(packList, packFileNameRegexp),
-             packMTime.isValid() ? QVector<QDateTime>() << packMTime : QVector<QDateTime>());
+    // Latest of the pack and its deltas covers all packed data
+    QVector<QDateTime> layerMTimes(mTimeFileList(packList, packFileNameRegexp));
+    layerMTimes += mTimeFileList(buildFileList(path, false, QStringList() << "*.delta"), deltaFileNameRegexp);
+    std::sort(layerMTimes.begin(), layerMTimes.end());
+    QCOMPARE(layerMTimes.isEmpty() ? QDateTime() : layerMTimes.constLast(), packMTime);
 }
 
 class tst_SyncPack : public QObject
@@ -296,6 +303,8 @@ private slots:
 
     void twoPacks();
     void twoPacks_data();
+
+    void deltaPack();
 };
 
 tst_SyncPack::tst_SyncPack()
@@ -1582,6 +1591,59 @@ void tst_SyncPack::twoPacks_data()
     addRemoveTests(6, 6, 6, 0, QDateTime(QDate(2016, 01, 10), QTime(), Qt::UTC));
 }
 
+void tst_SyncPack::deltaPack()
+{
+    QVector<TimeLogEntry> origEntries(defaultEntries());
+    QVector<TimeLogSyncDataEntry> origSyncEntries(genSyncData(origEntries, defaultMTimes()));
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+    QSignalSpy historySyncSpy1(history1, SIGNAL(dataSynced(QDateTime)));
+
+    // Pack all the data
+    QDateTime maxMTime(*std::max_element(defaultMTimes().cbegin(), defaultMTimes().cend()));
+    QDateTime syncStart(monthStart(maxMTime).addMonths(1));
+    checkFunction(importSyncData, history1, syncer1, syncDir1, origSyncEntries,
+                  QVector<TimeLogSyncDataCategory>(), origSyncEntries.size(), false, syncStart);
+    QCOMPARE(buildFileList(syncDir1->path(), false, QStringList() << "*.pack").size(), 1);
+
+    TimeLogEntry entry;
+    entry.startTime = origEntries.constLast().startTime.addSecs(100);
+    entry.category = "CategoryNew";
+    entry.comment = "Test comment";
+    entry.uuid = QUuid::createUuid();
+    TimeLogSyncDataEntry syncEntry(entry, syncStart.addDays(1));
+    history1->sync(QVector<TimeLogSyncDataEntry>() << syncEntry, QVector<TimeLogSyncDataEntry>(),
+                   QVector<TimeLogSyncDataCategory>());
+    QVERIFY(historySyncSpy1.wait());
+    QVERIFY(historyErrorSpy1.isEmpty());
+    updateDataSet(origEntries, entry);
+
+    // Next pack only writes the change
+    syncSpy1.clear();
+    syncer1->sync(syncStart.addMonths(1));
+    QVERIFY(syncSpy1.wait());
+    QVERIFY(syncErrorSpy1.isEmpty());
+    QVERIFY(historyErrorSpy1.isEmpty());
+
+    QFileInfoList packList(buildFileList(syncDir1->path(), false, QStringList() << "*.pack"));
+    QFileInfoList deltaList(buildFileList(syncDir1->path(), false, QStringList() << "*.delta"));
+    QCOMPARE(packList.size(), 1);
+    QCOMPARE(deltaList.size(), 1);
+    QCOMPARE(mTimeFileList(deltaList, deltaFileNameRegexp), QVector<QDateTime>() << syncEntry.sync.mTime);
+    QVERIFY(buildFileList(syncDir1->path(), false, QStringList() << "*.sync").isEmpty());
+
+    syncer2->setSyncPath(QUrl::fromLocalFile(syncDir1->path()));
+    syncer2->sync(syncStart.addMonths(1));
+    QVERIFY(syncSpy2.wait());
+    QVERIFY(syncErrorSpy2.isEmpty());
+
+    checkFunction(checkDB, history2, origEntries);
+}
+
 QTEST_MAIN(tst_SyncPack)
 
 #include "tst_sync_pack.moc"
@@ -2,4 +2,6 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     db_benchmark \
+    model_benchmark \
+    scale_benchmark \
     sync_benchmark
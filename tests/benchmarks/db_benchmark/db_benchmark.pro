@@ -1,4 +1,4 @@
-QT += testlib quick sql
+QT += testlib quick sql network
 
 TARGET = tst_db_benchmark
 CONFIG   += console
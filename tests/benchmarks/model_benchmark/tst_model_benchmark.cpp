@@ -0,0 +1,432 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <QtTest/QtTest>
+
+#include "tst_common.h"
+#include "TimeLogCategoryTreeNode.h"
+#include "TimeLogRecentModel.h"
+#include "TimeLogSearchModel.h"
+#include "TimeLogCategoryTreeModel.h"
+#include "TimeLogCategoryDepthModel.h"
+#include "TimeLogCategoryCompleterModel.h"
+#include "ReverseProxyModel.h"
+
+QTemporaryDir *dataDir = Q_NULLPTR;
+TimeLogHistory *history = Q_NULLPTR;
+
+const int maxTimeout = 300000;
+
+// Models get the history from the TimeTracker, which is not needed here
+class RecentModel : public TimeLogRecentModel
+{
+public:
+    void setHistory(TimeLogHistory *history) { TimeLogRecentModel::setHistory(history); }
+    bool isPending() const { return !m_pendingRequests.isEmpty(); }
+};
+
+class SearchModel : public TimeLogSearchModel
+{
+public:
+    void setHistory(TimeLogHistory *history) { TimeLogSearchModel::setHistory(history); }
+    bool isPending() const { return !m_pendingRequests.isEmpty(); }
+};
+
+class PlainModel : public TimeLogModel
+{
+public:
+    void populate(const QVector<TimeLogEntry> &data) { processHistoryData(data); }
+    using TimeLogModel::findData;
+};
+
+QSharedPointer<TimeLogCategoryTreeNode> buildTree(const QStringList &categories)
+{
+    QSharedPointer<TimeLogCategoryTreeNode> root(new TimeLogCategoryTreeNode(QString()));
+    for (const QString &category: categories) {
+        TimeLogCategoryTreeNode *node = root.data();
+        for (const QString &field: category.split(QRegularExpression("\\s*>\\s*"), QString::SkipEmptyParts)) {
+            TimeLogCategoryTreeNode *child = node->child(field);
+            node = child ? child : node->addChild(field);
+        }
+        node->hasItems = true;
+    }
+
+    return root;
+}
+
+class tst_Model_Benchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Model_Benchmark();
+    virtual ~tst_Model_Benchmark();
+
+private slots:
+    void init();
+    void cleanup();
+    void initTestCase();
+
+    void recentFetchMore();
+    void recentFetchMore_data();
+    void searchRefresh();
+    void searchRefresh_data();
+    void dataUpdated();
+    void dataUpdated_data();
+    void findData();
+    void findData_data();
+    void reverseProxy();
+    void reverseProxy_data();
+    void categoryTreeUpdate();
+    void categoryTreeUpdate_data();
+    void categoryDepthUpdate();
+    void categoryDepthUpdate_data();
+    void categoryCompleterFilter();
+    void categoryCompleterFilter_data();
+    void parseCategories();
+    void parseCategories_data();
+
+private:
+    void importData(const QVector<TimeLogEntry> &data);
+    void addEntriesRows();
+    void addCategoriesRows();
+};
+
+tst_Model_Benchmark::tst_Model_Benchmark()
+{
+}
+
+tst_Model_Benchmark::~tst_Model_Benchmark()
+{
+}
+
+void tst_Model_Benchmark::init()
+{
+    dataDir = new QTemporaryDir();
+    Q_CHECK_PTR(dataDir);
+    QVERIFY(dataDir->isValid());
+    history = new TimeLogHistory;
+    Q_CHECK_PTR(history);
+    QVERIFY(history->init(dataDir->path()));
+}
+
+void tst_Model_Benchmark::cleanup()
+{
+    if (history) {
+        history->deinit();
+        delete history;
+        history = Q_NULLPTR;
+    }
+    delete dataDir;
+    dataDir = Q_NULLPTR;
+}
+
+void tst_Model_Benchmark::initTestCase()
+{
+    qRegisterMetaType<QSet<QString> >();
+    qRegisterMetaType<QVector<TimeLogEntry> >();
+    qRegisterMetaType<TimeLogHistory::Fields>();
+    qRegisterMetaType<QVector<TimeLogHistory::Fields> >();
+    qRegisterMetaType<QSharedPointer<TimeLogCategoryTreeNode> >();
+
+    qSetMessagePattern("[%{time}] <%{category}> %{type} (%{file}:%{line}, %{function}) %{message}");
+}
+
+void tst_Model_Benchmark::recentFetchMore()
+{
+    QFETCH(int, entriesCount);
+
+    importData(genData(entriesCount));
+
+    QBENCHMARK_ONCE {
+        RecentModel model;
+        model.setHistory(history);
+        while (model.canFetchMore(QModelIndex())) {
+            model.fetchMore(QModelIndex());
+            QTRY_VERIFY_WITH_TIMEOUT(!model.isPending(), maxTimeout);
+        }
+    }
+}
+
+void tst_Model_Benchmark::recentFetchMore_data()
+{
+    addEntriesRows();
+}
+
+void tst_Model_Benchmark::searchRefresh()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+    importData(origData);
+
+    QSignalSpy dataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
+
+    SearchModel model;
+    model.setHistory(history);
+    model.setProperty("begin", origData.first().startTime);
+    model.setProperty("end", origData.last().startTime);
+    QVERIFY(dataSpy.wait(maxTimeout));
+    QTRY_VERIFY_WITH_TIMEOUT(!model.isPending(), maxTimeout);
+    int loadedCount = model.rowCount(QModelIndex());
+
+    bool withSubcategories = false;
+    QBENCHMARK {
+        // Any changed filter drops the loaded range
+        dataSpy.clear();
+        withSubcategories = !withSubcategories;
+        model.setProperty("withSubcategories", withSubcategories);
+        QVERIFY(dataSpy.wait(maxTimeout));
+        QTRY_VERIFY_WITH_TIMEOUT(!model.isPending(), maxTimeout);
+    }
+
+    QCOMPARE(model.rowCount(QModelIndex()), loadedCount);
+}
+
+void tst_Model_Benchmark::searchRefresh_data()
+{
+    addEntriesRows();
+}
+
+void tst_Model_Benchmark::dataUpdated()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(int, updatedCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+    PlainModel model;
+    model.populate(origData);
+
+    QVector<TimeLogEntry> updatedData;
+    QVector<TimeLogHistory::Fields> fields;
+    int step = entriesCount / updatedCount;
+    for (int i = 0; i < entriesCount && updatedData.size() < updatedCount; i += step) {
+        TimeLogEntry entry = origData.at(i);
+        entry.comment.append(" edited");
+        updatedData.append(entry);
+        fields.append(TimeLogHistory::Comment);
+    }
+
+    QBENCHMARK {
+        QVERIFY(QMetaObject::invokeMethod(&model, "historyDataUpdated", Qt::DirectConnection,
+                                          Q_ARG(QVector<TimeLogEntry>, updatedData),
+                                          Q_ARG(QVector<TimeLogHistory::Fields>, fields)));
+    }
+}
+
+void tst_Model_Benchmark::dataUpdated_data()
+{
+    QTest::addColumn<int>("entriesCount");
+    QTest::addColumn<int>("updatedCount");
+
+    QTest::newRow("1000 entries, 1") << 1000 << 1;
+    QTest::newRow("1000 entries, 100") << 1000 << 100;
+    QTest::newRow("1000 entries, 1000") << 1000 << 1000;
+
+    QTest::newRow("10000 entries, 1") << 10000 << 1;
+    QTest::newRow("10000 entries, 100") << 10000 << 100;
+    QTest::newRow("10000 entries, 10000") << 10000 << 10000;
+
+    QTest::newRow("50000 entries, 1") << 50000 << 1;
+    QTest::newRow("50000 entries, 100") << 50000 << 100;
+    QTest::newRow("50000 entries, 50000") << 50000 << 50000;
+}
+
+void tst_Model_Benchmark::findData()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+    PlainModel model;
+    model.populate(origData);
+
+    QBENCHMARK {
+        for (int i = 0; i < origData.size(); i++) {
+            QCOMPARE(model.findData(origData.at(i)), i);
+        }
+    }
+}
+
+void tst_Model_Benchmark::findData_data()
+{
+    addEntriesRows();
+}
+
+void tst_Model_Benchmark::reverseProxy()
+{
+    QFETCH(int, entriesCount);
+
+    PlainModel model;
+    model.populate(genData(entriesCount));
+
+    QBENCHMARK {
+        ReverseProxyModel proxy;
+        proxy.setSourceModel(&model);
+        for (int i = 0; i < proxy.rowCount(QModelIndex()); i++) {
+            QVERIFY(proxy.mapToSource(proxy.index(i, 0, QModelIndex())).isValid());
+        }
+    }
+}
+
+void tst_Model_Benchmark::reverseProxy_data()
+{
+    addEntriesRows();
+}
+
+void tst_Model_Benchmark::categoryTreeUpdate()
+{
+    QFETCH(int, categoriesCount);
+
+    QStringList categories(genCategories(categoriesCount));
+    QStringList halfCategories(categories.mid(0, categoriesCount / 2));
+
+    TimeLogCategoryTreeModel model;
+    QVERIFY(QMetaObject::invokeMethod(&model, "updateCategories", Qt::DirectConnection,
+                                      Q_ARG(QSharedPointer<TimeLogCategoryTreeNode>, buildTree(categories))));
+
+    bool isFull = true;
+    QBENCHMARK {
+        // The tree is diffed with the current one, alternate between two sets to get changes
+        isFull = !isFull;
+        QSharedPointer<TimeLogCategoryTreeNode> tree(buildTree(isFull ? categories : halfCategories));
+        QVERIFY(QMetaObject::invokeMethod(&model, "updateCategories", Qt::DirectConnection,
+                                          Q_ARG(QSharedPointer<TimeLogCategoryTreeNode>, tree)));
+    }
+}
+
+void tst_Model_Benchmark::categoryTreeUpdate_data()
+{
+    addCategoriesRows();
+}
+
+void tst_Model_Benchmark::categoryDepthUpdate()
+{
+    QFETCH(int, categoriesCount);
+
+    QStringList categories(genCategories(categoriesCount));
+    QStringList halfCategories(categories.mid(0, categoriesCount / 2));
+
+    TimeLogCategoryDepthModel model;
+    QVERIFY(QMetaObject::invokeMethod(&model, "updateCategories", Qt::DirectConnection,
+                                      Q_ARG(QSharedPointer<TimeLogCategoryTreeNode>, buildTree(categories))));
+    model.setCategory(halfCategories.first());
+
+    bool isFull = true;
+    QBENCHMARK {
+        isFull = !isFull;
+        QSharedPointer<TimeLogCategoryTreeNode> tree(buildTree(isFull ? categories : halfCategories));
+        QVERIFY(QMetaObject::invokeMethod(&model, "updateCategories", Qt::DirectConnection,
+                                          Q_ARG(QSharedPointer<TimeLogCategoryTreeNode>, tree)));
+        for (int i = 0; i < model.rowCount(QModelIndex()); i++) {
+            model.data(model.index(i), TimeLogCategoryDepthModel::SubcategoriesRole);
+        }
+    }
+}
+
+void tst_Model_Benchmark::categoryDepthUpdate_data()
+{
+    addCategoriesRows();
+}
+
+void tst_Model_Benchmark::categoryCompleterFilter()
+{
+    QFETCH(int, categoriesCount);
+
+    TimeLogCategoryCompleterModel model;
+    QVERIFY(QMetaObject::invokeMethod(&model, "updateCategories", Qt::DirectConnection,
+                                      Q_ARG(QSharedPointer<TimeLogCategoryTreeNode>,
+                                            buildTree(genCategories(categoriesCount)))));
+
+    // Segment prefix, substring and fuzzy matches, as typed
+    const QStringList filters = QStringList() << "s" << "su" << "sub" << "ory1" << "sbct";
+    QBENCHMARK {
+        for (const QString &filter: filters) {
+            model.setFilter(filter);
+        }
+    }
+
+    QVERIFY(model.rowCount(QModelIndex()) > 0);
+}
+
+void tst_Model_Benchmark::categoryCompleterFilter_data()
+{
+    addCategoriesRows();
+}
+
+void tst_Model_Benchmark::parseCategories()
+{
+    QFETCH(int, categoriesCount);
+
+    QStringList categories(genCategories(categoriesCount));
+    QVector<TimeLogEntry> origData(genData(categoriesCount));
+    for (int i = 0; i < origData.size(); i++) {
+        origData[i].category = categories.at(i % categories.size());
+    }
+    importData(origData);
+
+    history->deinit();
+    delete history;
+    history = Q_NULLPTR;
+
+    // Categories are parsed on DB open, so the open itself is measured too
+    QBENCHMARK {
+        TimeLogHistory openedHistory;
+        QSignalSpy categoriesSpy(&openedHistory, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
+        QVERIFY(openedHistory.init(dataDir->path()));
+        QVERIFY(categoriesSpy.count() || categoriesSpy.wait(maxTimeout));
+        openedHistory.deinit();
+    }
+}
+
+void tst_Model_Benchmark::parseCategories_data()
+{
+    addCategoriesRows();
+}
+
+void tst_Model_Benchmark::importData(const QVector<TimeLogEntry> &data)
+{
+    QSignalSpy errorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history->import(data);
+    QVERIFY(importSpy.wait(maxTimeout));
+    QTRY_COMPARE_WITH_TIMEOUT(history->size(), qlonglong(data.size()), maxTimeout);
+    QVERIFY(errorSpy.isEmpty());
+}
+
+void tst_Model_Benchmark::addEntriesRows()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("100 entries") << 100;
+    QTest::newRow("1 000 entries") << 1000;
+    QTest::newRow("10 000 entries") << 10000;
+    QTest::newRow("50 000 entries") << 50000;
+}
+
+void tst_Model_Benchmark::addCategoriesRows()
+{
+    QTest::addColumn<int>("categoriesCount");
+
+    QTest::newRow("10 categories") << 10;
+    QTest::newRow("100 categories") << 100;
+    QTest::newRow("1 000 categories") << 1000;
+    QTest::newRow("10 000 categories") << 10000;
+}
+
+QTEST_MAIN(tst_Model_Benchmark)
+#include "tst_model_benchmark.moc"
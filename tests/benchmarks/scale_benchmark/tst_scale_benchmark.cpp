@@ -0,0 +1,345 @@
+/**
+ ** This file is part of the G-TimeTracker project.
+ ** Copyright 2015-2016 Nikita Krupenko <krnekit@gmail.com>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include <QtTest/QtTest>
+
+#include "tst_common.h"
+#include "TimeLogCategoryTreeNode.h"
+
+const int maxTimeout = 3600000;
+// Large data sets are generated and imported by portions to limit the memory usage
+const int importPortionSize = 100000;
+
+class tst_Scale_Benchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Scale_Benchmark();
+    virtual ~tst_Scale_Benchmark();
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void initCold();
+    void initCold_data();
+    void initWarm();
+    void initWarm_data();
+    void getStats();
+    void getStats_data();
+    void getHashes();
+    void getHashes_data();
+    void rebuildHashes();
+    void rebuildHashes_data();
+    void fileSize();
+    void fileSize_data();
+
+private:
+    bool isSkipped(int entriesCount) const;
+    void prepareData(int entriesCount);
+    void openHistory(TimeLogHistory &history, const QString &path);
+    void addEntriesRows();
+
+    QMap<int, QTemporaryDir*> m_dataDirs;
+    int m_maxEntries;
+};
+
+tst_Scale_Benchmark::tst_Scale_Benchmark() :
+    m_maxEntries(0)
+{
+}
+
+tst_Scale_Benchmark::~tst_Scale_Benchmark()
+{
+}
+
+void tst_Scale_Benchmark::initTestCase()
+{
+    qRegisterMetaType<QSet<QString> >();
+    qRegisterMetaType<QVector<TimeLogEntry> >();
+    qRegisterMetaType<TimeLogHistory::Fields>();
+    qRegisterMetaType<QVector<TimeLogHistory::Fields> >();
+    qRegisterMetaType<QSharedPointer<TimeLogCategoryTreeNode> >();
+    qRegisterMetaType<QVector<TimeLogStats> >();
+    qRegisterMetaType<QMap<QDateTime,QByteArray> >();
+
+    qSetMessagePattern("[%{time}] <%{category}> %{type} (%{file}:%{line}, %{function}) %{message}");
+
+    // Generating the largest data sets takes a long time, allow to limit them
+    m_maxEntries = qEnvironmentVariableIntValue("TIMELOG_BENCHMARK_MAX_ENTRIES");
+}
+
+void tst_Scale_Benchmark::cleanupTestCase()
+{
+    qDeleteAll(m_dataDirs);
+    m_dataDirs.clear();
+}
+
+void tst_Scale_Benchmark::initCold()
+{
+    QFETCH(int, entriesCount);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    // First open in this process, SQLite page cache is empty
+    QBENCHMARK_ONCE {
+        TimeLogHistory history;
+        checkFunction(openHistory, history, path);
+        history.deinit();
+    }
+}
+
+void tst_Scale_Benchmark::initCold_data()
+{
+    addEntriesRows();
+}
+
+void tst_Scale_Benchmark::initWarm()
+{
+    QFETCH(int, entriesCount);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    {
+        TimeLogHistory history;
+        checkFunction(openHistory, history, path);
+        history.deinit();
+    }
+
+    QBENCHMARK {
+        TimeLogHistory history;
+        checkFunction(openHistory, history, path);
+        history.deinit();
+    }
+}
+
+void tst_Scale_Benchmark::initWarm_data()
+{
+    addEntriesRows();
+}
+
+void tst_Scale_Benchmark::getStats()
+{
+    QFETCH(int, entriesCount);
+    QFETCH(int, rangeDays);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    TimeLogHistory history;
+    checkFunction(openHistory, history, path);
+
+    QSignalSpy errorSpy(&history, SIGNAL(error(QString)));
+    QSignalSpy statsSpy(&history, SIGNAL(statsDataAvailable(QVector<TimeLogStats>,QDateTime)));
+
+    QDateTime end(QDateTime::currentDateTimeUtc());
+    QDateTime begin(rangeDays ? end.addDays(-rangeDays) : QDateTime::fromTime_t(0, Qt::UTC));
+
+    QBENCHMARK {
+        statsSpy.clear();
+        history.getStats(begin, end);
+        QVERIFY(statsSpy.wait(maxTimeout));
+    }
+
+    QVERIFY(errorSpy.isEmpty());
+
+    history.deinit();
+}
+
+void tst_Scale_Benchmark::getStats_data()
+{
+    QTest::addColumn<int>("entriesCount");
+    QTest::addColumn<int>("rangeDays");
+
+    QTest::newRow("100 000 entries, day") << 100000 << 1;
+    QTest::newRow("100 000 entries, month") << 100000 << 30;
+    QTest::newRow("100 000 entries, year") << 100000 << 365;
+    QTest::newRow("100 000 entries, all") << 100000 << 0;
+
+    QTest::newRow("1 000 000 entries, day") << 1000000 << 1;
+    QTest::newRow("1 000 000 entries, month") << 1000000 << 30;
+    QTest::newRow("1 000 000 entries, year") << 1000000 << 365;
+    QTest::newRow("1 000 000 entries, all") << 1000000 << 0;
+
+    QTest::newRow("10 000 000 entries, day") << 10000000 << 1;
+    QTest::newRow("10 000 000 entries, month") << 10000000 << 30;
+    QTest::newRow("10 000 000 entries, year") << 10000000 << 365;
+    QTest::newRow("10 000 000 entries, all") << 10000000 << 0;
+}
+
+void tst_Scale_Benchmark::getHashes()
+{
+    QFETCH(int, entriesCount);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    TimeLogHistory history;
+    checkFunction(openHistory, history, path);
+
+    QSignalSpy errorSpy(&history, SIGNAL(error(QString)));
+    QSignalSpy hashesSpy(&history, SIGNAL(hashesAvailable(QMap<QDateTime,QByteArray>)));
+
+    QBENCHMARK {
+        hashesSpy.clear();
+        history.getHashes();
+        QVERIFY(hashesSpy.wait(maxTimeout));
+    }
+
+    QVERIFY(errorSpy.isEmpty());
+
+    history.deinit();
+}
+
+void tst_Scale_Benchmark::getHashes_data()
+{
+    addEntriesRows();
+}
+
+void tst_Scale_Benchmark::rebuildHashes()
+{
+    QFETCH(int, entriesCount);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    TimeLogHistory history;
+    checkFunction(openHistory, history, path);
+
+    QSignalSpy errorSpy(&history, SIGNAL(error(QString)));
+    QSignalSpy updateSpy(&history, SIGNAL(hashesUpdated()));
+
+    // Month hashes are kept by triggers, the full rebuild is the case of all of them stale
+    QBENCHMARK_ONCE {
+        history.updateHashes();
+        QVERIFY(updateSpy.wait(maxTimeout));
+    }
+
+    QVERIFY(errorSpy.isEmpty());
+
+    history.deinit();
+}
+
+void tst_Scale_Benchmark::rebuildHashes_data()
+{
+    addEntriesRows();
+}
+
+void tst_Scale_Benchmark::fileSize()
+{
+    QFETCH(int, entriesCount);
+
+    if (isSkipped(entriesCount)) {
+        QSKIP("Data set is larger than TIMELOG_BENCHMARK_MAX_ENTRIES");
+    }
+    checkFunction(prepareData, entriesCount);
+    QString path(m_dataDirs.value(entriesCount)->path());
+
+    qint64 size = QFileInfo(QString("%1/db.sqlite").arg(path)).size();
+    QVERIFY(size > 0);
+
+    // Reported as the benchmark result, to be tracked by the same tools
+    QTest::setBenchmarkResult(size, QTest::BytesAllocated);
+}
+
+void tst_Scale_Benchmark::fileSize_data()
+{
+    addEntriesRows();
+}
+
+bool tst_Scale_Benchmark::isSkipped(int entriesCount) const
+{
+    return m_maxEntries && entriesCount > m_maxEntries;
+}
+
+void tst_Scale_Benchmark::prepareData(int entriesCount)
+{
+    if (m_dataDirs.contains(entriesCount)) {
+        return;
+    }
+
+    QScopedPointer<QTemporaryDir> dataDir(new QTemporaryDir());
+    QVERIFY(dataDir->isValid());
+
+    TimeLogHistory history;
+    QVERIFY(history.init(dataDir->path()));
+
+    QSignalSpy errorSpy(&history, SIGNAL(error(QString)));
+    QSignalSpy importSpy(&history, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+
+    // Each portion has the same durations and categories, shift them to follow each other
+    int portionsCount = (entriesCount + importPortionSize - 1) / importPortionSize;
+    QVector<TimeLogEntry> portion(genData(qMin(entriesCount, importPortionSize)));
+    qint64 portionSpan = portion.first().startTime.secsTo(portion.last().startTime) + 3600;
+    for (int i = 0; i < portionsCount; i++) {
+        int size = qMin(importPortionSize, entriesCount - i * importPortionSize);
+        QVector<TimeLogEntry> data(portion.mid(0, size));
+        for (TimeLogEntry &entry: data) {
+            entry.uuid = QUuid::createUuid();
+            entry.startTime = entry.startTime.addSecs(-(portionsCount - 1 - i) * portionSpan);
+        }
+
+        importSpy.clear();
+        history.import(data);
+        QVERIFY(importSpy.wait(maxTimeout));
+    }
+
+    QVERIFY(errorSpy.isEmpty());
+    history.deinit();
+
+    m_dataDirs.insert(entriesCount, dataDir.take());
+}
+
+void tst_Scale_Benchmark::openHistory(TimeLogHistory &history, const QString &path)
+{
+    QSignalSpy categoriesSpy(&history, SIGNAL(categoriesChanged(QSharedPointer<TimeLogCategoryTreeNode>)));
+    QVERIFY(history.init(path));
+    // Categories are fetched on init, it is done when they are delivered
+    QVERIFY(categoriesSpy.count() || categoriesSpy.wait(maxTimeout));
+}
+
+void tst_Scale_Benchmark::addEntriesRows()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("100 000 entries") << 100000;
+    QTest::newRow("1 000 000 entries") << 1000000;
+    QTest::newRow("10 000 000 entries") << 10000000;
+}
+
+QTEST_MAIN(tst_Scale_Benchmark)
+#include "tst_scale_benchmark.moc"
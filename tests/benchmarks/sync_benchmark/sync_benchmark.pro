@@ -1,4 +1,4 @@
-QT += testlib quick sql
+QT += testlib quick sql network
 
 TARGET = tst_sync_benchmark
 CONFIG   += console
@@ -74,8 +74,27 @@ private slots:
     void edit_data();
     void renameCategory();
     void renameCategory_data();
+    void importFolder();
+    void importFolder_data();
+    void firstSyncPack();
+    void firstSyncPack_data();
+    void packCycles();
+    void packCycles_data();
 };
 
+void printPhaseTimes(const QVariantMap &metrics)
+{
+    // Phases of the syncer state machine are reported as "<phase>Time" metrics, in ms
+    QStringList phaseTimes;
+    for (auto it = metrics.constBegin(); it != metrics.constEnd(); ++it) {
+        if (it.key().endsWith("Time")) {
+            phaseTimes.append(QString("%1=%2").arg(it.key()).arg(it.value().toLongLong()));
+        }
+    }
+
+    qInfo().noquote() << "Phase times:" << phaseTimes.join(' ');
+}
+
 tst_Sync_benchmark::tst_Sync_benchmark()
 {
 }
@@ -593,5 +612,162 @@ void tst_Sync_benchmark::renameCategory_data()
     QTest::newRow("50000 entries") << 50000;
 }
 
+void tst_Sync_benchmark::importFolder()
+{
+    QFETCH(int, filesCount);
+    QFETCH(int, entriesPerFile);
+
+    QVector<TimeLogEntry> origData(genData(filesCount * entriesPerFile));
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+    QSignalSpy historyOutdateSpy2(history2, SIGNAL(dataOutdated()));
+
+    // Each sync exports a file, keep them all unpacked in the folder
+    syncer1->setNoPack(true);
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    for (int i = 0; i < filesCount; i++) {
+        importSpy.clear();
+        history1->import(origData.mid(i * entriesPerFile, entriesPerFile));
+        QVERIFY(importSpy.wait(maxTimeout));
+
+        syncSpy1.clear();
+        syncer1->sync();
+        QVERIFY(syncSpy1.wait(maxTimeout));
+    }
+    QVERIFY(syncErrorSpy1.isEmpty());
+    QVERIFY(historyErrorSpy1.isEmpty());
+
+    QBENCHMARK_ONCE {
+        // Sync 2 [in]
+        syncer2->sync();
+        QVERIFY(syncSpy2.wait(maxTimeout));
+        QVERIFY(syncErrorSpy2.isEmpty());
+        QVERIFY(historyErrorSpy2.isEmpty());
+        QVERIFY(historyOutdateSpy2.isEmpty());
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(history2->size(), qlonglong(origData.size()), maxTimeout);
+    printPhaseTimes(syncer2->lastSyncMetrics());
+}
+
+void tst_Sync_benchmark::importFolder_data()
+{
+    QTest::addColumn<int>("filesCount");
+    QTest::addColumn<int>("entriesPerFile");
+
+    QTest::newRow("100 files, 10 entries") << 100 << 10;
+    QTest::newRow("1000 files, 1 entry") << 1000 << 1;
+    QTest::newRow("1000 files, 10 entries") << 1000 << 10;
+    QTest::newRow("5000 files, 1 entry") << 5000 << 1;
+    QTest::newRow("5000 files, 10 entries") << 5000 << 10;
+}
+
+void tst_Sync_benchmark::firstSyncPack()
+{
+    QFETCH(int, entriesCount);
+
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncSpy2(syncer2, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy syncErrorSpy2(syncer2, SIGNAL(error(QString)));
+
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy2(history2, SIGNAL(error(QString)));
+    QSignalSpy historyOutdateSpy2(history2, SIGNAL(dataOutdated()));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait(maxTimeout));
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait(maxTimeout));
+    syncSpy1.clear();
+    syncer1->pack();
+    QVERIFY(syncSpy1.wait(maxTimeout));
+    QVERIFY(syncErrorSpy1.isEmpty());
+    QVERIFY(historyErrorSpy1.isEmpty());
+
+    QBENCHMARK_ONCE {
+        // Sync 2 [in], fresh device
+        syncer2->sync();
+        QVERIFY(syncSpy2.wait(maxTimeout));
+        QVERIFY(syncErrorSpy2.isEmpty());
+        QVERIFY(historyErrorSpy2.isEmpty());
+        QVERIFY(historyOutdateSpy2.isEmpty());
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(history2->size(), qlonglong(origData.size()), maxTimeout);
+    printPhaseTimes(syncer2->lastSyncMetrics());
+}
+
+void tst_Sync_benchmark::firstSyncPack_data()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("1000 entries") << 1000;
+    QTest::newRow("10000 entries") << 10000;
+    QTest::newRow("50000 entries") << 50000;
+    QTest::newRow("100000 entries") << 100000;
+}
+
+void tst_Sync_benchmark::packCycles()
+{
+    QFETCH(int, entriesCount);
+
+    // Generated entries are up to maxDuration apart, 50000 of them span years
+    QVector<TimeLogEntry> origData(genData(entriesCount));
+
+    QSignalSpy syncSpy1(syncer1, SIGNAL(synced()));
+    QSignalSpy syncErrorSpy1(syncer1, SIGNAL(error(QString)));
+    QSignalSpy historyErrorSpy1(history1, SIGNAL(error(QString)));
+    QSignalSpy insertSpy1(history1, SIGNAL(dataInserted(TimeLogEntry)));
+
+    QSignalSpy importSpy(history1, SIGNAL(dataImported(QVector<TimeLogEntry>)));
+    history1->import(origData);
+    QVERIFY(importSpy.wait(maxTimeout));
+
+    syncer1->sync();
+    QVERIFY(syncSpy1.wait(maxTimeout));
+
+    QDateTime lastStart(origData.constLast().startTime);
+    QBENCHMARK {
+        // Each cycle packs the whole history with a new change in it
+        TimeLogEntry entry;
+        lastStart = lastStart.addSecs(100);
+        entry.startTime = lastStart;
+        entry.category = "CategoryNew";
+        entry.comment = "Test comment";
+        entry.uuid = QUuid::createUuid();
+        insertSpy1.clear();
+        history1->insert(entry);
+        QVERIFY(insertSpy1.wait(maxTimeout));
+
+        syncSpy1.clear();
+        syncer1->pack();
+        QVERIFY(syncSpy1.wait(maxTimeout));
+        QVERIFY(syncErrorSpy1.isEmpty());
+        QVERIFY(historyErrorSpy1.isEmpty());
+    }
+
+    printPhaseTimes(syncer1->lastSyncMetrics());
+}
+
+void tst_Sync_benchmark::packCycles_data()
+{
+    QTest::addColumn<int>("entriesCount");
+
+    QTest::newRow("1000 entries") << 1000;
+    QTest::newRow("10000 entries") << 10000;
+    QTest::newRow("50000 entries") << 50000;
+}
+
 QTEST_MAIN(tst_Sync_benchmark)
 #include "tst_sync_benchmark.moc"
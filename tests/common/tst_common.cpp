@@ -21,13 +21,6 @@
 
 #include "tst_common.h"
 
-namespace {
-struct HashInput {
-    QByteArray uuid;
-    QDateTime mTime;
-};
-}
-
 QVector<TimeLogEntry> defaultDataset = QVector<TimeLogEntry>()
         << TimeLogEntry(QUuid::createUuid(), TimeLogData(QDateTime::fromString("2015-11-01T11:00:00+0200",
                                                                                Qt::ISODate),
@@ -207,6 +200,20 @@ void extractHashes(TimeLogHistory *history, QMap<QDateTime, QByteArray> &hashes,
     hashes = historyHashesSpy.constFirst().at(0).value<QMap<QDateTime,QByteArray> >();
 }
 
+void extractDayHashes(TimeLogHistory *history, const QDateTime &begin, const QDateTime &end,
+                      QMap<QDateTime, QByteArray> &hashes)
+{
+    QSignalSpy historyErrorSpy(history, SIGNAL(error(QString)));
+    QSignalSpy historyHashesSpy(history, SIGNAL(dayHashesAvailable(QMap<QDateTime,QByteArray>,QDateTime,QDateTime)));
+    history->getDayHashes(begin, end);
+    QVERIFY(historyHashesSpy.wait());
+    QVERIFY(historyErrorSpy.isEmpty());
+
+    QCOMPARE(historyHashesSpy.constFirst().at(1).toDateTime(), begin);
+    QCOMPARE(historyHashesSpy.constFirst().at(2).toDateTime(), end);
+    hashes = historyHashesSpy.constFirst().at(0).value<QMap<QDateTime,QByteArray> >();
+}
+
 void checkDB(TimeLogHistory *history, const QVector<TimeLogEntry> &data)
 {
     QSignalSpy historyDataSpy(history, SIGNAL(historyRequestCompleted(QVector<TimeLogEntry>,qlonglong)));
@@ -311,6 +318,19 @@ void checkHashes(TimeLogHistory *history, bool noUpdate)
     checkFunction(extractHashes, history, hashes, noUpdate);
     checkFunction(verifyHashes, hashes);
     checkFunction(compareHashes, hashes, calcHashes(entryData, categoryData));
+
+    QMap<QDateTime, QByteArray> origDayHashes(calcDayHashes(entryData, categoryData));
+    for (const QDateTime &start: hashes.keys()) {
+        QDateTime end(start.addMonths(1).addMSecs(-1));
+        QMap<QDateTime,QByteArray> dayHashes;
+        checkFunction(extractDayHashes, history, start, end, dayHashes);
+
+        QMap<QDateTime,QByteArray> monthDayHashes;
+        for (auto it = origDayHashes.lowerBound(start); it != origDayHashes.cend() && it.key() <= end; it++) {
+            monthDayHashes.insert(it.key(), it.value());
+        }
+        QCOMPARE(dayHashes, monthDayHashes);
+    }
 }
 
 const QVector<TimeLogEntry> &defaultEntries()
@@ -478,71 +498,75 @@ void updateDataSet(QVector<TimeLogSyncDataCategory> &data, const TimeLogSyncData
     data.insert(it, category);
 }
 
-QMap<QDateTime, QByteArray> calcHashes(const QVector<TimeLogSyncDataEntry> &entryData,
-                                       const QVector<TimeLogSyncDataCategory> &categoryData)
+static QMap<QDateTime, QByteArray> calcPeriodHashes(const QVector<TimeLogSyncDataEntry> &entryData,
+                                                    const QVector<TimeLogSyncDataCategory> &categoryData,
+                                                    QDateTime (*periodStart)(const QDateTime &))
 {
-    QMap<QDateTime, QByteArray> result;
-
-    QDateTime periodStart;
-    QByteArray hashData;
-    QDataStream dataStream(&hashData, QIODevice::WriteOnly);
+    const qint64 modulus(2147483647);
 
-    QVector<HashInput> sortedData;
-    sortedData.reserve(entryData.size() + categoryData.size());
-    for (const TimeLogSyncDataEntry &item: entryData) {
-        HashInput input;
-        input.uuid = item.entry.uuid.toRfc4122();
-        input.mTime = item.sync.mTime;
-
-        sortedData.append(input);
-    }
-    for (const TimeLogSyncDataCategory &item: categoryData) {
-        HashInput input;
-        input.uuid = item.category.uuid.toRfc4122();
-        input.mTime = item.sync.mTime;
+    struct PeriodHash {
+        qint64 size = 0;
+        qint64 sum1 = 0;
+        qint64 sum2 = 0;
+    };
 
-        sortedData.append(input);
-    }
+    QMap<QDateTime, PeriodHash> periodHashes;
 
-    std::sort(sortedData.begin(), sortedData.end(), [](const HashInput &i1, const HashInput &i2) {
-        if (i1.mTime == i2.mTime) {
-            return i1.uuid < i2.uuid;
-        } else {
-            return i1.mTime < i2.mTime;
+    auto addRecord = [&periodHashes, modulus, periodStart](const QUuid &uuid, const QDateTime &mTime) {
+        QByteArray hex(uuid.toRfc4122().toHex().toUpper());
+        qint64 words[4];
+        for (int i = 0; i < 4; i++) {
+            words[i] = hex.mid(i * 7, 7).toLongLong(nullptr, 16);
         }
-    });
-
-    if (!sortedData.empty()) {
-        periodStart = monthStart(sortedData.constFirst().mTime);
-    }
-
-    for (const HashInput &input: sortedData) {
-        if (monthStart(input.mTime) != periodStart) {
-            if (!hashData.isEmpty()) {
-                result.insert(periodStart, QCryptographicHash::hash(hashData, QCryptographicHash::Md5));
-            }
+        qint64 key = mTime.toMSecsSinceEpoch() % modulus + 1;
 
-            dataStream.device()->seek(0);
-            hashData.clear();
-            periodStart = monthStart(input.mTime);
-        }
+        PeriodHash &hash = periodHashes[periodStart(mTime)];
+        hash.size++;
+        hash.sum1 = (hash.sum1 + (words[0] * key + words[1]) % modulus) % modulus;
+        hash.sum2 = (hash.sum2 + (words[2] * key + words[3]) % modulus) % modulus;
+    };
 
-        dataStream << input.mTime.toMSecsSinceEpoch() << input.uuid;
+    for (const TimeLogSyncDataEntry &item: entryData) {
+        addRecord(item.entry.uuid, item.sync.mTime);
+    }
+    for (const TimeLogSyncDataCategory &item: categoryData) {
+        addRecord(item.category.uuid, item.sync.mTime);
     }
 
-    if (!hashData.isEmpty()) {
-        result.insert(periodStart, QCryptographicHash::hash(hashData, QCryptographicHash::Md5));
+    QMap<QDateTime, QByteArray> result;
+    for (auto it = periodHashes.cbegin(); it != periodHashes.cend(); ++it) {
+        QByteArray hash;
+        QDataStream dataStream(&hash, QIODevice::WriteOnly);
+        dataStream << it.value().size << it.value().sum1 << it.value().sum2;
+        result.insert(it.key(), hash);
     }
 
     return result;
 }
 
+QMap<QDateTime, QByteArray> calcHashes(const QVector<TimeLogSyncDataEntry> &entryData,
+                                       const QVector<TimeLogSyncDataCategory> &categoryData)
+{
+    return calcPeriodHashes(entryData, categoryData, monthStart);
+}
+
+QMap<QDateTime, QByteArray> calcDayHashes(const QVector<TimeLogSyncDataEntry> &entryData,
+                                          const QVector<TimeLogSyncDataCategory> &categoryData)
+{
+    return calcPeriodHashes(entryData, categoryData, dayStart);
+}
+
 QDateTime monthStart(const QDateTime &time)
 {
     QDate date(time.toUTC().date());
     return QDateTime(QDate(date.year(), date.month(), 1), QTime(), Qt::UTC);
 }
 
+QDateTime dayStart(const QDateTime &time)
+{
+    return QDateTime(time.toUTC().date(), QTime(), Qt::UTC);
+}
+
 void importSyncData(TimeLogHistory *history,
                     const QVector<TimeLogSyncDataEntry> &entryData,
                     const QVector<TimeLogSyncDataCategory> &categoryData,
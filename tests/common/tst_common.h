@@ -37,6 +37,8 @@ void checkEdit(QSignalSpy &updateSpy, QVector<TimeLogEntry> &origData, TimeLogHi
 
 void extractSyncData(TimeLogHistory *history, QVector<TimeLogSyncDataEntry> &entryData, QVector<TimeLogSyncDataCategory> &categoryData);
 void extractHashes(TimeLogHistory *history, QMap<QDateTime, QByteArray> &hashes, bool noUpdate);
+void extractDayHashes(TimeLogHistory *history, const QDateTime &begin, const QDateTime &end,
+                      QMap<QDateTime, QByteArray> &hashes);
 void checkDB(TimeLogHistory *history, const QVector<TimeLogEntry> &data);
 void checkDB(TimeLogHistory *history, const QVector<TimeLogCategory> &data);
 void checkDB(TimeLogHistory *history, const QVector<TimeLogSyncDataEntry> &entryData, const QVector<TimeLogSyncDataCategory> &categoryData);
@@ -61,8 +63,11 @@ void updateDataSet(QVector<TimeLogSyncDataEntry> &data, const TimeLogSyncDataEnt
 void updateDataSet(QVector<TimeLogSyncDataCategory> &data, const TimeLogSyncDataCategory &category);
 QMap<QDateTime, QByteArray> calcHashes(const QVector<TimeLogSyncDataEntry> &entryData,
                                        const QVector<TimeLogSyncDataCategory> &categoryData);
+QMap<QDateTime, QByteArray> calcDayHashes(const QVector<TimeLogSyncDataEntry> &entryData,
+                                          const QVector<TimeLogSyncDataCategory> &categoryData);
 
 QDateTime monthStart(const QDateTime &time);
+QDateTime dayStart(const QDateTime &time);
 
 void importSyncData(TimeLogHistory *history, const QVector<TimeLogSyncDataEntry> &entryData,
                     const QVector<TimeLogSyncDataCategory> &categoryData, int portionSize);